@@ -0,0 +1,149 @@
+/*
+ *  Benchmarks for the forward pass of fastRNN layers, for a sweep of batch
+ *  sizes.
+ *
+ *  Copyright (C) 2015 Rob Clucas robclu1818@gmail.com
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published
+ *  by the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program; if not, write to the Free Software Foundation,
+ *  Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#include <benchmark/benchmark.h>
+
+#include "../layer/layer.hpp"
+#include "../layer/types/softmax_policy.hpp"
+#include "../layer/types/sparse_softmax_policy.hpp"
+#include "roofline.h"
+
+const uint  NODES       = 1024;
+const uint  INPUTS      = 512;
+const uint  DEPTH       = 4;
+
+// Batch sizes of the sweeps
+const int   MIN_BATCH   = 1;
+const int   MAX_BATCH   = 1 << 10;
+const int   MULTIPLIER  = 4;
+
+typedef frnn::Layer<float, frnn::device::CPU, NODES, INPUTS, DEPTH, frnn::ltype::SoftmaxPolicy> cpu_layer;
+typedef frnn::Layer<float, frnn::device::GPU, NODES, INPUTS, DEPTH, frnn::ltype::SoftmaxPolicy> gpu_layer;
+
+// Layers pruned to a tenth of their weights, which are read in compressed sparse rows
+const float SPARSITY    = 0.9f;
+typedef frnn::Layer<float, frnn::device::CPU, NODES, INPUTS, DEPTH, frnn::ltype::SparseSoftmaxPolicy> sparse_cpu_layer;
+typedef frnn::Layer<float, frnn::device::GPU, NODES, INPUTS, DEPTH, frnn::ltype::SparseSoftmaxPolicy> sparse_gpu_layer;
+
+// A gemm and a bias for each page, and the max, exp and sum and divide of the softmax of each output
+double forwardFlops(size_t batch_size) {
+    return ( 2.0 * NODES * INPUTS + NODES ) * DEPTH * batch_size + 4.0 * NODES * batch_size;
+}
+
+// The weights and biases of each page are read once, with the inputs, and the outputs are written once
+double forwardBytes(size_t batch_size) {
+    return ( ( INPUTS + 1.0 ) * NODES * DEPTH + ( INPUTS + NODES ) * batch_size ) * sizeof(float);
+}
+
+// A multiply and add for each non zero weight (of the sum of the pages) and the softmax of each output
+double sparseForwardFlops(size_t non_zeros, size_t batch_size) {
+    return ( 2.0 * non_zeros + NODES ) * batch_size + 4.0 * NODES * batch_size;
+}
+
+// The values and the columns of the weights, the row offsets and the biases are read once
+double sparseForwardBytes(size_t non_zeros, size_t batch_size) {
+    return ( 2.0 * non_zeros + 2.0 * NODES + 1.0 + ( INPUTS + NODES ) * batch_size ) * sizeof(float);
+}
+
+void fillBatch(frnn::Tensor4<float>& ins) {
+    for (uint b = 0; b < ins.y(); b++) {
+        for (uint i = 0; i < ins.x(); i++) ins(i, b, 0, 0) = static_cast<float>((i + 3 * b) % 11) / 11.f - 0.5f;
+    }
+}
+
+static void BM_SoftmaxForwardCpu(benchmark::State& state) {
+    const uint              batch_size = state.range(0);
+    cpu_layer               layer;
+    frnn::Tensor4<float>    ins(INPUTS, batch_size, 1, 1), outs(NODES, batch_size, 1, 1);
+
+    fillBatch(ins);
+    layer.initializeWeights(-0.1f, 0.1f);
+    for (auto _ : state) {
+        layer.forward(ins, outs);
+        benchmark::ClobberMemory();
+    }
+    frnn::bench::setCounters(state, forwardBytes(batch_size), forwardFlops(batch_size),
+                             frnn::bench::hostRoofline());
+}
+BENCHMARK(BM_SoftmaxForwardCpu)->RangeMultiplier(MULTIPLIER)->Range(MIN_BATCH, MAX_BATCH);
+
+// The batch stays on the device, so only the forward pass is timed and not the copies
+static void BM_SoftmaxForwardGpu(benchmark::State& state) {
+    typedef frnn::Tensor4<float, frnn::storage::Device> device_tensor;
+
+    const uint              batch_size = state.range(0);
+    gpu_layer               layer;
+    frnn::Tensor4<float>    ins_h(INPUTS, batch_size, 1, 1);
+
+    fillBatch(ins_h);
+    device_tensor           ins(ins_h), outs(NODES, batch_size, 1, 1);
+    frnn::GpuContext&       context = frnn::GpuContext::global();
+
+    layer.initializeWeights(-0.1f, 0.1f);
+    for (auto _ : state) {
+        layer.forward(ins, outs);
+        context.synchronize();
+    }
+    frnn::bench::setCounters(state, forwardBytes(batch_size), forwardFlops(batch_size),
+                             frnn::bench::deviceRoofline());
+}
+BENCHMARK(BM_SoftmaxForwardGpu)->RangeMultiplier(MULTIPLIER)->Range(MIN_BATCH, MAX_BATCH)->UseRealTime();
+
+static void BM_SparseSoftmaxForwardCpu(benchmark::State& state) {
+    const uint              batch_size = state.range(0);
+    sparse_cpu_layer        layer;
+    frnn::Tensor4<float>    ins(INPUTS, batch_size, 1, 1), outs(NODES, batch_size, 1, 1);
+
+    fillBatch(ins);
+    layer.initializeWeights(-0.1f, 0.1f);
+    layer.prune(SPARSITY);
+    for (auto _ : state) {
+        layer.forward(ins, outs);
+        benchmark::ClobberMemory();
+    }
+    const size_t non_zeros = layer.getSparse().non_zeros;
+    frnn::bench::setCounters(state, sparseForwardBytes(non_zeros, batch_size), sparseForwardFlops(non_zeros, batch_size),
+                             frnn::bench::hostRoofline());
+}
+BENCHMARK(BM_SparseSoftmaxForwardCpu)->RangeMultiplier(MULTIPLIER)->Range(MIN_BATCH, MAX_BATCH);
+
+static void BM_SparseSoftmaxForwardGpu(benchmark::State& state) {
+    typedef frnn::Tensor4<float, frnn::storage::Device> device_tensor;
+
+    const uint              batch_size = state.range(0);
+    sparse_gpu_layer        layer;
+    frnn::Tensor4<float>    ins_h(INPUTS, batch_size, 1, 1);
+
+    fillBatch(ins_h);
+    device_tensor           ins(ins_h), outs(NODES, batch_size, 1, 1);
+    frnn::GpuContext&       context = frnn::GpuContext::global();
+
+    layer.initializeWeights(-0.1f, 0.1f);
+    layer.prune(SPARSITY);
+    for (auto _ : state) {
+        layer.forward(ins, outs);
+        context.synchronize();
+    }
+    const size_t non_zeros = layer.getSparse().non_zeros;
+    frnn::bench::setCounters(state, sparseForwardBytes(non_zeros, batch_size), sparseForwardFlops(non_zeros, batch_size),
+                             frnn::bench::deviceRoofline());
+}
+BENCHMARK(BM_SparseSoftmaxForwardGpu)->RangeMultiplier(MULTIPLIER)->Range(MIN_BATCH, MAX_BATCH)->UseRealTime();
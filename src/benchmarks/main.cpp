@@ -0,0 +1,44 @@
+/*
+ *  Main file for the fastRNN benchmarks, which adds the roofline of the
+ *  device and the host to the context of the results.
+ *
+ *  Copyright (C) 2015 Rob Clucas robclu1818@gmail.com
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published
+ *  by the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program; if not, write to the Free Software Foundation,
+ *  Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#include <benchmark/benchmark.h>
+#include <string>
+
+#include "roofline.h"
+
+int main(int argc, char** argv) {
+    benchmark::Initialize(&argc, argv);
+    if (benchmark::ReportUnrecognizedArguments(argc, argv)) return 1;
+
+    // The rooflines go in the context so that the JSON results can be compared across devices
+#ifdef FRNN_WITH_CUDA
+    const frnn::bench::Roofline& device = frnn::bench::deviceRoofline();
+    benchmark::AddCustomContext("device", device.name);
+    benchmark::AddCustomContext("device_peak_GB/s", std::to_string(device.bandwidth * 1e-9));
+    benchmark::AddCustomContext("device_peak_GFLOP/s", std::to_string(device.flops * 1e-9));
+#endif
+    const frnn::bench::Roofline& host = frnn::bench::hostRoofline();
+    benchmark::AddCustomContext("host_triad_GB/s", std::to_string(host.bandwidth * 1e-9));
+
+    benchmark::RunSpecifiedBenchmarks();
+    benchmark::Shutdown();
+    return 0;
+}
@@ -0,0 +1,102 @@
+/*
+ *  Benchmarks for the fastRNN math functions, for a sweep of sizes.
+ *
+ *  Copyright (C) 2015 Rob Clucas robclu1818@gmail.com
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published
+ *  by the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program; if not, write to the Free Software Foundation,
+ *  Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#include <benchmark/benchmark.h>
+#include <vector>
+
+#include "../math/math_gpu.hpp"
+#include "../math/math_cpu.hpp"
+#include "roofline.h"
+
+// Sizes of the vectors of the sweeps, from cache resident to much larger than the L2 of the device
+const int   MIN_SIZE    = 1 << 10;
+const int   MAX_SIZE    = 1 << 24;
+const int   MULTIPLIER  = 4;
+
+typedef frnn::Tensor4<float, frnn::storage::Device> device_tensor;
+
+// The host vector version copies in and out, so it is bound by the host to device bandwidth
+static void BM_SumGpu(benchmark::State& state) {
+    const size_t        N       = state.range(0);
+    frnn::frnnError     error;
+    frnn::GpuContext&   context = frnn::GpuContext::global();
+    std::vector<float>  x(N, 1.f);
+
+    for (auto _ : state) benchmark::DoNotOptimize(sumGpu(error, context, x));
+    frnn::bench::setCounters(state, N * sizeof(float), N, frnn::bench::deviceRoofline());
+}
+BENCHMARK(BM_SumGpu)->RangeMultiplier(MULTIPLIER)->Range(MIN_SIZE, MAX_SIZE)->UseRealTime();
+
+static void BM_SumDeviceGpu(benchmark::State& state) {
+    const size_t        N       = state.range(0);
+    frnn::frnnError     error;
+    frnn::GpuContext&   context = frnn::GpuContext::global();
+    device_tensor       x(N, 1, 1, 1);
+    float*              out     = context.scratch<float>(error, 5, 1);
+
+    for (auto _ : state) {
+        reduceDeviceGpu<frnn::reduce::sum>(error, context, x.deviceData(), N, out,
+                                           frnn::functors::voidFunctor());
+        context.synchronize();
+    }
+    frnn::bench::setCounters(state, N * sizeof(float), N, frnn::bench::deviceRoofline());
+}
+BENCHMARK(BM_SumDeviceGpu)->RangeMultiplier(MULTIPLIER)->Range(MIN_SIZE, MAX_SIZE)->UseRealTime();
+
+// Max, exp and sum, and divide, which is 4 flops for each element (counting the exp as one)
+static void BM_SoftmaxGpu(benchmark::State& state) {
+    const size_t        N       = state.range(0);
+    frnn::frnnError     error;
+    frnn::GpuContext&   context = frnn::GpuContext::global();
+    device_tensor       x(N, 1, 1, 1), val(N, 1, 1, 1);
+
+    for (auto _ : state) {
+        softmaxGpu(error, context, x, val);
+        context.synchronize();
+    }
+    frnn::bench::setCounters(state, 2.0 * N * sizeof(float), 4.0 * N, frnn::bench::deviceRoofline());
+}
+BENCHMARK(BM_SoftmaxGpu)->RangeMultiplier(MULTIPLIER)->Range(MIN_SIZE, MAX_SIZE)->UseRealTime();
+
+static void BM_AxpyGpu(benchmark::State& state) {
+    const size_t        N       = state.range(0);
+    frnn::frnnError     error;
+    frnn::GpuContext&   context = frnn::GpuContext::global();
+    device_tensor       x(N, 1, 1, 1), y(N, 1, 1, 1);
+
+    for (auto _ : state) {
+        axpyGpu(error, context, 2.f, x, y);
+        context.synchronize();
+    }
+    frnn::bench::setCounters(state, 3.0 * N * sizeof(float), 2.0 * N, frnn::bench::deviceRoofline());
+}
+BENCHMARK(BM_AxpyGpu)->RangeMultiplier(MULTIPLIER)->Range(MIN_SIZE, MAX_SIZE)->UseRealTime();
+
+static void BM_XmyCpu(benchmark::State& state) {
+    const size_t                N = state.range(0);
+    frnn::aligned_vector<float> x(N, 3.f), y(N, 1.f), result(N);
+
+    for (auto _ : state) {
+        xmyCpu(x, y, result);
+        benchmark::ClobberMemory();
+    }
+    frnn::bench::setCounters(state, 3.0 * N * sizeof(float), N, frnn::bench::hostRoofline());
+}
+BENCHMARK(BM_XmyCpu)->RangeMultiplier(MULTIPLIER)->Range(MIN_SIZE, MAX_SIZE);
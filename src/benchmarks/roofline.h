@@ -0,0 +1,195 @@
+/*
+ *  Header file for the fastRNN benchmark roofline, which gives the peak
+ *  bandwidth and throughput of the device and the host to compare the
+ *  benchmarks against.
+ *
+ *  Copyright (C) 2015 Rob Clucas robclu1818@gmail.com
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published
+ *  by the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program; if not, write to the Free Software Foundation,
+ *  Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#ifndef _FRNN_BENCHMARKS_ROOFLINE_
+#define _FRNN_BENCHMARKS_ROOFLINE_
+
+#include <benchmark/benchmark.h>
+#include <omp.h>
+
+#include <algorithm>
+#include <chrono>
+#include <string>
+#include <vector>
+
+#include "../frnn/types.h"
+#include "../frnn/aligned_allocator.h"
+
+#ifdef FRNN_WITH_CUDA
+#include <cuda_runtime.h>
+#endif
+
+/* ============================================= NOTES ======================================================
+ *
+ * 1. The peak bandwidth of the device is 2 (for DDR) * memory clock * bus width, and the peak throughput is
+ *    2 (for an FMA) * clock * SMs * single precision cores per SM, from the attributes of the device.
+ *
+ * 2. The host has no attributes for its peak, so the bandwidth is measured with a STREAM triad over arrays
+ *    which are much larger than the caches, with all the OpenMP threads, and the best of a few runs is used.
+ *    There is no peak throughput for the host, so the CPU benchmarks only report their fraction of the peak
+ *    bandwidth.
+ *
+ * 3. CPU only builds (without FRNN_WITH_CUDA) have no device roofline, and only the CPU benchmarks.
+ *
+ * 4. The byte and flop counts of each benchmark are per iteration, and are the minimum traffic and work of
+ *    the operation (each input read once and each output written once), so a fraction of the peak near 100
+ *    means the operation is at the roofline. Sizes which fit in the caches can be above 100, since the
+ *    peaks are for memory.
+ *
+ * ==========================================================================================================
+ */
+
+namespace frnn  {
+namespace bench {
+
+const size_t    TRIAD_ELEMENTS  = 1 << 24;          // Elements of each array of the host triad
+const int       TRIAD_RUNS      = 5;                // Runs of the host triad, the best is used
+
+/*
+ * ==========================================================================================================
+ * Struct       : Roofline
+ *
+ * Description  : The peak bandwidth and throughput of a device (see NOTES 1 and 2)
+ * ==========================================================================================================
+ */
+struct Roofline {
+    std::string     name;                           // Name of the device
+    double          bandwidth;                      // Peak bytes per second
+    double          flops;                          // Peak single precision flops per second (0 if unknown)
+};
+
+/*
+ * ==========================================================================================================
+ * Function     : coresPerSm
+ *
+ * Description  : Gets the number of single precision cores of each SM for a compute capability
+ *
+ * Inputs       : major     : The major version of the compute capability
+ *              : minor     : The minor version of the compute capability
+ * ==========================================================================================================
+ */
+inline int coresPerSm(int major, int minor) {
+    switch (major) {
+        case 3 : return 192;
+        case 5 : return 128;
+        case 6 : return minor == 0 ? 64 : 128;
+        case 7 : return 64;
+        case 8 : return minor == 0 ? 64 : 128;
+        default: return 128;
+    }
+}
+
+#ifdef FRNN_WITH_CUDA
+/*
+ * ==========================================================================================================
+ * Function     : deviceRoofline
+ *
+ * Description  : Gets the roofline of the current device, from its attributes (see NOTES 1)
+ * ==========================================================================================================
+ */
+inline const Roofline& deviceRoofline() {
+    static const Roofline roofline = [] {
+        int device = 0, memory_clock = 0, bus_width = 0, clock = 0, sms = 0, major = 0, minor = 0;
+        cudaGetDevice(&device);
+        cudaDeviceGetAttribute(&memory_clock, cudaDevAttrMemoryClockRate, device);      // kHz
+        cudaDeviceGetAttribute(&bus_width, cudaDevAttrGlobalMemoryBusWidth, device);     // bits
+        cudaDeviceGetAttribute(&clock, cudaDevAttrClockRate, device);                    // kHz
+        cudaDeviceGetAttribute(&sms, cudaDevAttrMultiProcessorCount, device);
+        cudaDeviceGetAttribute(&major, cudaDevAttrComputeCapabilityMajor, device);
+        cudaDeviceGetAttribute(&minor, cudaDevAttrComputeCapabilityMinor, device);
+
+        cudaDeviceProp properties;
+        cudaGetDeviceProperties(&properties, device);
+
+        Roofline device_roofline;
+        device_roofline.name      = properties.name;
+        device_roofline.bandwidth = 2.0 * memory_clock * 1e3 * bus_width / 8.0;
+        device_roofline.flops     = 2.0 * clock * 1e3 * sms * coresPerSm(major, minor);
+        return device_roofline;
+    }();
+    return roofline;
+}
+#endif
+
+/*
+ * ==========================================================================================================
+ * Function     : hostRoofline
+ *
+ * Description  : Gets the roofline of the host, with the bandwidth measured by a triad (see NOTES 2)
+ * ==========================================================================================================
+ */
+inline const Roofline& hostRoofline() {
+    static const Roofline roofline = [] {
+        aligned_vector<float> a(TRIAD_ELEMENTS, 1.f), b(TRIAD_ELEMENTS, 2.f), c(TRIAD_ELEMENTS, 0.f);
+        const long            N    = static_cast<long>(TRIAD_ELEMENTS);
+        double                best = 0.0;
+
+        for (int run = 0; run < TRIAD_RUNS; run++) {
+            const auto start = std::chrono::steady_clock::now();
+            #pragma omp parallel for schedule(static)
+            for (long i = 0; i < N; i++) c[i] = a[i] + 3.f * b[i];
+            const std::chrono::duration<double> time = std::chrono::steady_clock::now() - start;
+            best = std::max(best, 3.0 * N * sizeof(float) / time.count());
+        }
+        benchmark::DoNotOptimize(c[N - 1]);
+
+        Roofline host_roofline;
+        host_roofline.name      = "host";
+        host_roofline.bandwidth = best;
+        host_roofline.flops     = 0.0;
+        return host_roofline;
+    }();
+    return roofline;
+}
+
+/*
+ * ==========================================================================================================
+ * Function     : setCounters
+ *
+ * Description  : Sets the GB/s and GFLOP/s counters of a benchmark, and the percentage of the peak
+ *                bandwidth and throughput of the roofline (see NOTES 4)
+ *
+ * Inputs       : state     : The state of the benchmark
+ *              : bytes     : The number of bytes read and written by each iteration
+ *              : flops     : The number of flops of each iteration
+ *              : roofline  : The roofline of the device the benchmark runs on
+ * ==========================================================================================================
+ */
+inline void setCounters(benchmark::State& state, double bytes, double flops, const Roofline& roofline) {
+    // The rates are per second, so a count of (per iteration) count / peak gives the fraction of the peak
+    const benchmark::Counter::Flags rate = benchmark::Counter::kIsIterationInvariantRate;
+
+    state.counters["GB/s"]      = benchmark::Counter(bytes * 1e-9, rate);
+    state.counters["%peak_bw"]  = benchmark::Counter(bytes * 100.0 / roofline.bandwidth, rate);
+    if (flops > 0.0) {
+        state.counters["GFLOP/s"] = benchmark::Counter(flops * 1e-9, rate);
+        if (roofline.flops > 0.0) {
+            state.counters["%peak_flops"] = benchmark::Counter(flops * 100.0 / roofline.flops, rate);
+        }
+    }
+    state.SetLabel(roofline.name);
+}
+
+}   // Namespace bench
+}   // Namespace frnn
+
+#endif
@@ -0,0 +1,83 @@
+/*
+ *  Benchmarks for the evaluation of fastRNN tensor expressions, for a sweep
+ *  of sizes.
+ *
+ *  Copyright (C) 2015 Rob Clucas robclu1818@gmail.com
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published
+ *  by the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program; if not, write to the Free Software Foundation,
+ *  Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#include <benchmark/benchmark.h>
+
+#include "../new_tensor/tensor.h"
+#include "roofline.h"
+
+// Sizes of a dimension of the square tensors of the sweeps
+const int   MIN_DIM     = 1 << 5;
+const int   MAX_DIM     = 1 << 12;
+const int   MULTIPLIER  = 2;
+
+static void BM_TensorAddition(benchmark::State& state) {
+    const int               N = state.range(0);
+    frnn::Tensor<float, 2>  x = {N, N}, y = {N, N};
+
+    for (auto _ : state) {
+        frnn::Tensor<float, 2> result = x + y;
+        benchmark::DoNotOptimize(result.data().data());
+    }
+    frnn::bench::setCounters(state, 3.0 * N * N * sizeof(float), 1.0 * N * N, frnn::bench::hostRoofline());
+}
+BENCHMARK(BM_TensorAddition)->RangeMultiplier(MULTIPLIER)->Range(MIN_DIM, MAX_DIM);
+
+// The expression is evaluated in a single pass, so 3 additions only read 4 tensors and write 1
+static void BM_TensorAdditionChain(benchmark::State& state) {
+    const int               N = state.range(0);
+    frnn::Tensor<float, 2>  w = {N, N}, x = {N, N}, y = {N, N}, z = {N, N};
+
+    for (auto _ : state) {
+        frnn::Tensor<float, 2> result = w + x + y + z;
+        benchmark::DoNotOptimize(result.data().data());
+    }
+    frnn::bench::setCounters(state, 5.0 * N * N * sizeof(float), 3.0 * N * N, frnn::bench::hostRoofline());
+}
+BENCHMARK(BM_TensorAdditionChain)->RangeMultiplier(MULTIPLIER)->Range(MIN_DIM, MAX_DIM);
+
+// A transpose, which is the strided case of the slice evaluation
+static void BM_TensorSlice(benchmark::State& state) {
+    using namespace frnn::index;
+    const int               N = state.range(0);
+    frnn::Tensor<float, 2>  x = {N, N};
+
+    for (auto _ : state) {
+        frnn::Tensor<float, 2> result = x.slice(j, i);
+        benchmark::DoNotOptimize(result.data().data());
+    }
+    frnn::bench::setCounters(state, 2.0 * N * N * sizeof(float), 0.0, frnn::bench::hostRoofline());
+}
+BENCHMARK(BM_TensorSlice)->RangeMultiplier(MULTIPLIER)->Range(MIN_DIM, MAX_DIM);
+
+// The slice, where the dimensions keep their order, which is the contiguous case of the slice evaluation
+static void BM_TensorSliceContiguous(benchmark::State& state) {
+    using namespace frnn::index;
+    const int               N = state.range(0);
+    frnn::Tensor<float, 2>  x = {N, N};
+
+    for (auto _ : state) {
+        frnn::Tensor<float, 2> result = x.slice(i, j);
+        benchmark::DoNotOptimize(result.data().data());
+    }
+    frnn::bench::setCounters(state, 2.0 * N * N * sizeof(float), 0.0, frnn::bench::hostRoofline());
+}
+BENCHMARK(BM_TensorSliceContiguous)->RangeMultiplier(MULTIPLIER)->Range(MIN_DIM, MAX_DIM);
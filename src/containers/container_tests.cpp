@@ -23,9 +23,13 @@
 
 #include "tuple.h"
 #include "index_map.h"
+#include "mpsc_queue.h"
 
 #include <string>
 #include <algorithm>
+#include <memory>
+#include <thread>
+#include <vector>
 
 TEST( frnnTuple, CanCreateTupleWithMultipleTypes )
 {
@@ -57,6 +61,20 @@ TEST( frnnTuple, CanSetTupleElement )
     EXPECT_EQ( 4.5, frnn::get<2>(tuple) );
 }
 
+TEST( frnnTuple, TupleIsFlatAndConstexpr )
+{
+    struct Empty {};
+    constexpr frnn::Tuple<int, Empty, float> tuple(3, Empty(), 2.5f);
+    
+    static_assert( frnn::get<0>(tuple) == 3 && frnn::get<2>(tuple) == 2.5f, "get must be constexpr" );
+    static_assert( frnn::tuple::size(tuple) == 3, "size must be constexpr" );
+    static_assert( sizeof(frnn::Tuple<Empty, int>) == sizeof(int), "empty elements must take no space" );
+    static_assert( std::is_trivially_copyable<frnn::Tuple<int, frnn::Index>>::value, 
+                   "Tuples of Indexes must be trivially copyable" );
+    
+    EXPECT_EQ( frnn::get<0>(tuple), 3 );
+}
+
 TEST( frnnIndexMap, CanCreateVariadicMapAndGetSize ) 
 {
     frnn::IndexMap<frnn::Index> imap(4, 2, 1);
@@ -151,3 +169,73 @@ TEST( frnnIndexMap, CanEraseASingleElementWithAnIterator )
     
     EXPECT_EQ( size_after, 0 ); 
 }
+
+TEST( frnnIndexMap, KeepsInsertionOrderAfterErase )
+{
+    using namespace frnn::index;
+    frnn::IndexMap<frnn::Index> imap(k, i, m, j);
+    
+    imap.erase(i);
+    
+    size_t keys[3], values[3], pos = 0;
+    for (auto& elem : imap) { keys[pos] = elem.first(); values[pos++] = elem.second; }
+    
+    EXPECT_EQ( keys[0]  , 2 ); EXPECT_EQ( keys[1]  , 4 ); EXPECT_EQ( keys[2]  , 1 );
+    EXPECT_EQ( values[0], 0 ); EXPECT_EQ( values[1], 2 ); EXPECT_EQ( values[2], 3 );
+    EXPECT_TRUE( imap.find(i) == imap.end() );
+}
+
+TEST( frnnIndexMap, DoesNotInsertDuplicatesOrPastCapacity )
+{
+    frnn::IndexMap<frnn::Index, 2> imap(3, 70);
+    
+    EXPECT_FALSE( imap.insert(3) );
+    EXPECT_FALSE( imap.insert(4) );
+    EXPECT_EQ( imap.size(), 2 );
+    EXPECT_EQ( imap.find(70)->second, 1 );
+    EXPECT_TRUE( imap.erase(3) == 1 && imap.insert(4) );
+    EXPECT_EQ( imap.find(4)->second, 1 );
+}
+
+TEST( frnnMpscQueue, PopsTheValuesOfEachProducerInOrder )
+{
+    const int                   producers = 4, values = 20000;
+    frnn::MpscQueue<int>        queue;
+    std::vector<std::thread>    threads;
+    
+    for (int p = 0; p < producers; p++) {
+        threads.emplace_back([&queue, p, values] { for (int v = 0; v < values; v++) queue.push(p * values + v); });
+    }
+    
+    // The consumer pops while the producers push, and sees the values of each producer in order
+    std::vector<int> next(producers, 0);
+    for (int popped = 0; popped < producers * values; ) {
+        int value;
+        if (!queue.pop(value)) continue;
+        const int producer = value / values;
+        EXPECT_EQ( value % values, next[producer] );
+        next[producer] = value % values + 1;
+        popped++;
+    }
+    for (auto& thread : threads) thread.join();
+    
+    EXPECT_TRUE( queue.empty() );
+    for (int p = 0; p < producers; p++) EXPECT_EQ( next[p], values );
+}
+
+TEST( frnnMpscQueue, HoldsMoveOnlyValues )
+{
+    std::shared_ptr<int> shared = std::make_shared<int>(3);
+    {
+        frnn::MpscQueue<std::unique_ptr<std::shared_ptr<int>>> queue;
+        queue.push(std::unique_ptr<std::shared_ptr<int>>(new std::shared_ptr<int>(shared)));
+        queue.push(std::unique_ptr<std::shared_ptr<int>>(new std::shared_ptr<int>(shared)));
+        
+        std::unique_ptr<std::shared_ptr<int>> value;
+        EXPECT_TRUE( queue.pop(value) );
+        EXPECT_EQ( **value, 3 );
+        EXPECT_EQ( shared.use_count(), 3 );
+    }
+    // The value which wasn't popped is destroyed with the queue
+    EXPECT_EQ( shared.use_count(), 1 );
+}
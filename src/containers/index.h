@@ -50,6 +50,12 @@ class Index {
 private:   
     size_t _idx;                                                                //!< Value of the dimension
 public:
+     // =====================================================================================================
+     //! @brief         Default constructor, the Index represents the first dimension (so that Indexes can be
+     //!                stored in fixed size arrays).
+     // =====================================================================================================
+    constexpr Index() : _idx(0) {}
+
      // =====================================================================================================
      //! @brief         Sets the value of the Index.
      //! @param[in] i   The value to set the Index to.
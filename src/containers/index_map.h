@@ -1,6 +1,6 @@
 // ==========================================================================================================
 //! @file index_map.h
-//!       Header file for the fastRNN IndexMap class to create a hastable where the keys as Indexes and
+//!       Header file for the fastRNN IndexMap class to create a flat map where the keys as Indexes and
 //!       each key has a value which is equal to number the element was inserted into the map.
 // ==========================================================================================================
 
@@ -29,38 +29,49 @@
 
 #include "index.h"
 
-#include <unordered_map>
-#include <algorithm>
-#include <typeinfo>
+#include <cstdint>
+#include <type_traits>
+#include <utility>
 
 namespace frnn {
 
+// Maximum number of elements in an IndexMap (all the Indexes of frnn::index fit)
+const size_t INDEX_MAP_CAPACITY = 16;
+
 // ==========================================================================================================
 //! @struct     IndexMap
 //! @brief      Creates an IndexMap  where each of the arguments are the keys (an Index) and the values are 
 //!             position the key was inserted into the map i.e it is its index in the map as if the map
 //!             was a vector, thus the map can be searched for an Index quickly (since it is the key) but the
 //!             index of the Index in the map can also be found (which is usefull when passing a variable 
-//!             number of Index elements as arguments to a function).
-//!             in constant time while still being able to determine their order.
-//! @tparam     K       The type of the keys for the map (the Index class or a similar functor class).
+//!             number of Index elements as arguments to a function).                                       \n
+//!                                                                                                          \n
+//!             The elements are stored in a fixed size array in the order they were inserted, with a       \n
+//!             bitmask of the keys which are in the map, so the map never allocates on the heap. A search   \n
+//!             for a key which is not in the map is a single bit test (for keys less than 64), and a        \n
+//!             search for one which is is a scan over at most Capacity elements which are contiguous,       \n
+//!             which for the handful of indices of an expression is faster than hashing.
+//! @tparam     K           The type of the keys for the map (the Index class or a similar functor class).
+//! @tparam     Capacity    The maximum number of elements in the map.
 // ==========================================================================================================
-template <typename K>    
+template <typename K, size_t Capacity = INDEX_MAP_CAPACITY>    
 struct IndexMap {
 public:
     /* ======================================== Typedefs ================================================== */
-    typedef std::unordered_map<K, size_t, IndexHasher>      map;
-    typedef typename map::size_type                         size_type;
-    typedef typename map::iterator                          iterator;
-    typedef typename map::const_iterator                    const_iterator;
+    typedef size_t                                          size_type;
+    typedef std::pair<K, size_type>                         value_type;
+    typedef value_type*                                     iterator;
+    typedef const value_type*                               const_iterator;
     /* ==================================================================================================== */ 
 private:
-    std::unordered_map<K, size_type, IndexHasher>           _elements;          //!< Key-value pair elements   
+    value_type                                              _elements[Capacity];    //!< Key-value pairs
+    size_type                                               _size;                  //!< Number of elements
+    uint64_t                                                _mask;                  //!< Bit k set if key k is in
 public:
     // ======================================================================================================
     //! @brief      Default constructor.
     // ======================================================================================================
-    IndexMap() {}
+    IndexMap() : _size(0), _mask(0) {}
     
     // ======================================================================================================
     //! @brief      Adds all arguments as keys in the map, which the value being the element's argument index.
@@ -70,12 +81,14 @@ public:
     // ======================================================================================================
     template <typename... Ks>
     IndexMap(K element, Ks... elements) 
+    : _size(0), _mask(0)
     {
+        static_assert(sizeof...(Ks) < Capacity, "Too many elements for the capacity of the IndexMap");
         createMap<0>(element, elements...);
     }    
         
     // ======================================================================================================
-    //! @brief      Creates an unordered_map - terminating case.
+    //! @brief      Creates the map - terminating case.
     //! @param[in]  element     The element to add to the map.
     //! @tparam     iter        The iteration of the createMap function.
     //! @tparam     E           The type of the element to add to the mao.
@@ -83,11 +96,11 @@ public:
     template <size_type iter, typename E>
     void createMap(E element)
     {
-        _elements.insert(std::make_pair<K, size_type>(static_cast<K>(element), iter));
+        emplace(static_cast<K>(element), iter);
     }
     
     // ======================================================================================================
-    //! @brief      Creates an unordered_map - case for all but the terminating case.
+    //! @brief      Creates the map - case for all but the terminating case.
     //! @param[in]  element     The element to add to the map.
     //! @param[in]  elements    The other elements still to be added to the map.
     //! @tparam     iter        The iteration number of the createMapfunction.
@@ -97,35 +110,35 @@ public:
     template <size_type iter = 0, typename E, typename... Es>
     void createMap(E element, Es... elements)
     {
-        _elements.insert(std::make_pair<K, size_type>(static_cast<K>(element), iter));
+        emplace(static_cast<K>(element), iter);
         createMap<iter + 1>(elements...);
     }
 
     // ======================================================================================================
-    //! @brief      Inserts an element into the map.
+    //! @brief      Inserts an element into the map, with the size of the map as the value.
     //! @param[in]  key     The key of the element to add.
+    //! @return     True if the element was inserted, false if the key is already in the map or the map is 
+    //!             full (in which case the map is unchanged).
     // ======================================================================================================
-    void insert(K&& key) 
-    {
-        _elements.insert(std::make_pair<K, size_type>(static_cast<K>(key), _elements.size()));
-    }
-   
-    // ======================================================================================================
-    //! @brief      Moves an element from one map to this map.
-    //! @param      it      The iterator to move to this map.
-    // ======================================================================================================
-    void insert(iterator it) 
+    bool insert(const K& key) 
     {
-        _elements.insert(std::move(*it));
+        return emplace(key, _size);
     }
    
     // ======================================================================================================
-    //! @brief      Inserts an element into the map.
-    //! @param[in]  key     The key of the element to add.
-    // ======================================================================================================
-    void insert(K& key) 
+    //! @brief      Copies an element from another map to this map (the key and the value).
+    //! @param      it      The iterator to the element to copy to this map.
+    //! @return     True if the element was inserted, false if the key is already in the map or the map is 
+    //!             full (in which case the map is unchanged).
+    //! @tparam     It      The type of the iterator (an iterator or const_iterator of an IndexMap, it is a 
+    //!                     template so that 0 is not taken to be an iterator).
+    // ======================================================================================================
+    template <typename It>
+    typename std::enable_if<std::is_convertible<It, const_iterator>::value && 
+                            std::is_pointer<It>::value, bool>::type
+    insert(It it) 
     {
-        _elements.insert(std::make_pair<K, size_type>(std::move(key()), _elements.size()));
+        return emplace(it->first, it->second);
     }
 
     // ======================================================================================================
@@ -136,48 +149,60 @@ public:
     // ======================================================================================================
     size_type erase(const K& key) 
     {
-        return _elements.erase(key);
+        iterator pos = find(key);
+        if (pos == end()) return 0;
+        erase(pos);
+        return 1;
     }
    
     // ======================================================================================================
-    //! @brief      Erases an element pointer to by an iterator.
+    //! @brief      Erases an element pointer to by an iterator. The other elements keep their order.
     //! @param[in]  pos     The position of the element to remove.
     //! @return     A new iterator pointing to the element after the removed one.
     // ======================================================================================================
     iterator erase(iterator pos) 
     {
-        return _elements.erase(pos);
+        if (pos->first() < 64) _mask &= ~(uint64_t(1) << pos->first());
+        for (iterator it = pos; it + 1 != end(); ++it) *it = *(it + 1);
+        --_size;
+        return pos;
     }
     
     // ======================================================================================================
     //! @brief  Gets the size of the map.
     //! @return The size of the map.
     // ======================================================================================================
-    size_type size() const { return _elements.size(); }
+    size_type size() const { return _size; }
+    
+    // ======================================================================================================
+    //! @brief  Gets the maximum number of elements in the map.
+    //! @return The capacity of the map.
+    // ======================================================================================================
+    static constexpr size_type capacity() { return Capacity; }
     
     // ======================================================================================================
     //! @brief  Gets an iterator to the start of the map.
     //! @return A constant iterator which points to the beginning of the map.
     // ======================================================================================================
-    const_iterator begin() const { return _elements.begin(); }
+    const_iterator begin() const { return _elements; }
     
     // ======================================================================================================
     //! @brief  Gets an iterator to the start of the map.
     //! @return An iterator which points to the beginning of the map.
     // ======================================================================================================
-    iterator begin() { return _elements.begin(); }
+    iterator begin() { return _elements; }
    
     // ======================================================================================================
     //! @brief  Gets an iterator to the end of the map.
     //! @return A constant iterator which points to the end of the map.
     // ======================================================================================================
-    const_iterator end() const  { return _elements.end(); }
+    const_iterator end() const  { return _elements + _size; }
 
     // ======================================================================================================
     //! @brief  Gets an iterator to the end of the map.
     //! @return An iterator which points to the end of the map.
     // ======================================================================================================
-    iterator end() { return _elements.end(); }    
+    iterator end() { return _elements + _size; }    
    
     // ======================================================================================================
     //! @brief  Searches for an element in the map, and if found, returns an iterator to the element,
@@ -186,7 +211,10 @@ public:
     //! @return An iterator which points to the element with a key key if key is a valid key for the map,
     //!         otherwise an iterator to the end of the map.
     // ======================================================================================================
-    iterator find(const K& key) { return _elements.find(key()); }
+    iterator find(const K& key) 
+    { 
+        return const_cast<iterator>(static_cast<const IndexMap&>(*this).find(key)); 
+    }
 
     // ======================================================================================================
     //! @brief  Searches for an element in the map, and if found, returns an iterator to the element,
@@ -195,7 +223,30 @@ public:
     //! @return A constant iterator which points to the element with a key key if key is a valid key for the 
     //!         map, otherwise an iterator to the end of the map.
     // ======================================================================================================
-    const_iterator find(const K& key) const { return _elements.find(key()); }
+    const_iterator find(const K& key) const 
+    { 
+        if (key() < 64 && !((_mask >> key()) & 1)) return end();
+        for (const_iterator it = begin(); it != end(); ++it) {
+            if (it->first() == key()) return it;
+        }
+        return end();
+    }
+    
+private:
+    // ======================================================================================================
+    //! @brief      Adds an element to the end of the map, if the key is not already in the map and the map is
+    //!             not full.
+    //! @param[in]  key     The key of the element to add.
+    //! @param[in]  value   The value of the element to add.
+    //! @return     True if the element was added, otherwise false.
+    // ======================================================================================================
+    bool emplace(const K& key, size_type value)
+    {
+        if (_size == Capacity || find(key) != end()) return false;
+        _elements[_size++] = value_type(key, value);
+        if (key() < 64) _mask |= uint64_t(1) << key();
+        return true;
+    }
 };
 
 }       // End namespace frnn
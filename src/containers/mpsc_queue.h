@@ -0,0 +1,136 @@
+// ==========================================================================================================
+//! @file mpsc_queue.h
+//!       Header file for the fastRNN MpscQueue class, a lock-free queue which many threads can push to and
+//!       one thread pops from.
+// ==========================================================================================================
+
+/*
+ * ==========================================================================================================
+ *  Copyright (C) 2015 Rob Clucas robclu1818@gmail.com
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published
+ *  by the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program; if not, write to the Free Software Foundation,
+ *  Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ *  =========================================================================================================
+ */
+
+#ifndef _FRNN_CONTAINERS_MPSC_QUEUE_
+#define _FRNN_CONTAINERS_MPSC_QUEUE_
+
+#include <atomic>
+#include <cstddef>
+#include <new>
+#include <type_traits>
+#include <utility>
+
+namespace frnn {
+
+// Size of a cache line, the ends of the queue are on different lines so producers don't slow the consumer
+const size_t MPSC_QUEUE_ALIGNMENT = 64;
+
+// ==========================================================================================================
+//! @class      MpscQueue
+//! @brief      An unbounded lock-free queue with many producers and a single consumer (the node based queue
+//!             of Dmitry Vyukov). A push is one allocation and one atomic exchange, so producers never wait
+//!             for each other or for the consumer, and a pop is a load and a free.                         \n
+//!                                                                                                          \n
+//!             The queue is a linked list from the oldest node (the tail) to the newest (the head), where   \n
+//!             the tail is a node whose value has already been popped (the stub). A push exchanges the head \n
+//!             and then links the previous head to the new node, so for the moment between the two a pop   \n
+//!             doesn't see the new node (or the ones pushed after it) and returns false, and the consumer   \n
+//!             must try again later. The values of each producer are popped in the order they were pushed.
+//! @tparam     T   The type of the values, which must be movable (it can be a move only type).
+// ==========================================================================================================
+template <typename T>
+class MpscQueue {
+private:
+    // ======================================================================================================
+    //! @struct     Node
+    //! @brief      A node of the list, with storage for a value which is only constructed from the push of
+    //!             the node until its value is popped.
+    // ======================================================================================================
+    struct Node {
+        std::atomic<Node*>                                                      next;
+        typename std::aligned_storage<sizeof(T), std::alignment_of<T>::value>::type storage;
+
+        Node() : next(nullptr) {}
+
+        T* value() { return reinterpret_cast<T*>(&storage); }
+    };
+
+    alignas(MPSC_QUEUE_ALIGNMENT) std::atomic<Node*>    _head;      //!< Newest node (producers)
+    alignas(MPSC_QUEUE_ALIGNMENT) Node*                 _tail;      //!< Stub before the oldest value (consumer)
+public:
+    // ======================================================================================================
+    //! @brief      Creates an empty queue.
+    // ======================================================================================================
+    MpscQueue() : _head(new Node()), _tail(nullptr) { _tail = _head.load(std::memory_order_relaxed); }
+
+    MpscQueue(const MpscQueue&)             = delete;
+    MpscQueue& operator=(const MpscQueue&)  = delete;
+
+    // ======================================================================================================
+    //! @brief      Destroys the values which were not popped, there must be no pushes at the same time.
+    // ======================================================================================================
+    ~MpscQueue()
+    {
+        for (Node* next = _tail->next.load(std::memory_order_acquire); next != nullptr; 
+             next = _tail->next.load(std::memory_order_acquire)) {
+            next->value()->~T();
+            delete _tail;
+            _tail = next;
+        }
+        delete _tail;
+    }
+
+    // ======================================================================================================
+    //! @brief      Adds a value to the queue, from any thread.
+    //! @param[in]  value   The value to add.
+    // ======================================================================================================
+    template <typename V>
+    void push(V&& value)
+    {
+        Node* node = new Node();
+        new (node->value()) T(std::forward<V>(value));
+
+        Node* previous = _head.exchange(node, std::memory_order_acq_rel);
+        previous->next.store(node, std::memory_order_release);
+    }
+
+    // ======================================================================================================
+    //! @brief      Removes the oldest value from the queue, only from the consumer thread.
+    //! @param[out] value   The value, if there is one.
+    //! @return     If there was a value (which can be false for a moment while a push is linked in).
+    // ======================================================================================================
+    bool pop(T& value)
+    {
+        Node* next = _tail->next.load(std::memory_order_acquire);
+        if (next == nullptr) return false;
+
+        // The next node is the new stub, so its value is moved out and destroyed
+        value = std::move(*next->value());
+        next->value()->~T();
+        delete _tail;
+        _tail = next;
+        return true;
+    }
+
+    // ======================================================================================================
+    //! @brief      If there are no values which can be popped, only from the consumer thread.
+    // ======================================================================================================
+    bool empty() const { return _tail->next.load(std::memory_order_acquire) == nullptr; }
+};
+
+}   // Namespace frnn
+
+#endif
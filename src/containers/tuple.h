@@ -1,8 +1,8 @@
 // ==========================================================================================================
 //! @file tuple.h
-//!       Header file for the fastRNN Tuple class to hold and number of elements of any type. 
-//!       A good tutorial on using variadic templates for this type of implementation is given at:
-//!       http://eli.thegreenplace.net/2014/variadic-templates-in-c/
+//!       Header file for the fastRNN Tuple class to hold and number of elements of any type. The elements
+//!       are stored flat (each in its own base class of the Tuple), so that get is constexpr, does not 
+//!       recurse at runtime, and works on both the host and the device.
 // ==========================================================================================================
 
 /*
@@ -28,104 +28,170 @@
 #ifndef _FRNN_CONTAINERS_TUPLE_
 #define _FRNN_CONTAINERS_TUPLE_
 
-namespace frnn {
+#include <cstddef>
+#include <type_traits>
+
+#ifndef FRNN_HOST_DEVICE
+#ifdef __CUDACC__
+#define FRNN_HOST_DEVICE __host__ __device__
+#else
+#define FRNN_HOST_DEVICE
+#endif
+#endif
+
+namespace frnn  {
+namespace tuple {
 
 // ==========================================================================================================
-//! @struct  Tuple 
-//! @brief   Holds any number of elements of any type.
-//! @details Usage : Tuple<type1, type2, ...> tuple(elem1 of type1, elem2 of type2, ...)
-//! @tparam  Ts     The types of the elements to be stored in teh Tuple.
+//! @struct     IndexList
+//! @brief      A list of indices (the positions of the elements of a Tuple) as template parameters.
+//! @tparam     Is      The indices in the list.
 // ==========================================================================================================
-template <typename... Ts> struct Tuple {};
+template <size_t... Is> struct IndexList {};
 
 // ==========================================================================================================
-//! @struct  Tuple 
+//! @struct     MakeIndexList
+//! @brief      Makes the IndexList 0, 1, ..., N - 1 (as type).
+//! @tparam     N       The number of indices in the list.
+//! @tparam     Is      The indices which have been made so far.
 // ==========================================================================================================
-template <typename T>
-struct Tuple<T> {
-public:
-    T _back;            //!< Element of the Tuple
-public:
-    // ======================================================================================================
-    //! @brief      Constuctor for a Tuple when there is only one element (base case of recursive 
-    //!             construction).
-    //! @param[in]  element     The element to add to the Tuple.
-    //! @tparam     T           Type of the element to add to the Tuple.
-    // ======================================================================================================
-    Tuple(T element) : _back(element) {}
+template <size_t N, size_t... Is> 
+struct MakeIndexList : MakeIndexList<N - 1, N - 1, Is...> {};
+
+template <size_t... Is>
+struct MakeIndexList<0, Is...> {
+    typedef IndexList<Is...> type;
 };
 
 // ==========================================================================================================
-//! @struct  Tuple 
-// ==========================================================================================================
-template <typename T, typename... Ts>
-struct Tuple<T, Ts...> : Tuple<Ts...> {
-public: 
-    T _back;            //!< Element of the Tuple
-public:
-     // =====================================================================================================
-     //! @brief     Constructor for a Tuple when there is more than one element.
-     //! @param[in] element     The element to add to the Tuple on this iteration of the recursive 
-     //!            construction.
-     //! @param[in] elements    The rest of the elements to add to the Tuple on the remaining iterations.
-     //! @tparam    T           Type of the element to add to the Tuple. 
-     //! @tparam    Ts          The types of the elements to add to the Tuple on the following iterations of 
-     //!            the recursive construction.
-     //  ====================================================================================================
-    Tuple(T element, Ts... elements) : Tuple<Ts...>(elements...), _back(element) {}
+//! @struct     TupleLeaf
+//! @brief      Holds the element at position i of a Tuple. Each element has its own leaf, and the Tuple 
+//!             inherits from all of them, so every element is a direct base of the Tuple.
+//! @tparam     i       The position of the element in the Tuple.
+//! @tparam     T       The type of the element.
+//! @tparam     Empty   If T is an empty class, in which case the leaf inherits from T, so that the element 
+//!                     takes no space (empty base optimization).
+// ==========================================================================================================
+template <size_t i, typename T, bool Empty = std::is_empty<T>::value>
+struct TupleLeaf {
+    T _value;            //!< Element of the Tuple
+    
+    FRNN_HOST_DEVICE constexpr TupleLeaf() : _value() {}
+    FRNN_HOST_DEVICE constexpr TupleLeaf(const T& value) : _value(value) {}
+};
+
+template <size_t i, typename T>
+struct TupleLeaf<i, T, true> : T {
+    FRNN_HOST_DEVICE constexpr TupleLeaf() : T() {}
+    FRNN_HOST_DEVICE constexpr TupleLeaf(const T& value) : T(value) {}
 };
 
 // ==========================================================================================================
-//! @struct     TupleElementTypeHolder
+//! @brief      Gets the element of a leaf of a Tuple, the Tuple can be passed directly, and the leaf 
+//!             for position i (and hence the type of the element) is found by template argument deduction.
+//! @param[in]  leaf    The leaf to get the element of.
+//! @tparam     i       The position of the element in the Tuple.
+//! @tparam     T       The type of the element.
 // ==========================================================================================================
-template <size_t i, typename T> struct TupleElementTypeHolder;
+template <size_t i, typename T>
+FRNN_HOST_DEVICE constexpr T& leafValue(TupleLeaf<i, T, false>& leaf) { return leaf._value; }
+
+template <size_t i, typename T>
+FRNN_HOST_DEVICE constexpr const T& leafValue(const TupleLeaf<i, T, false>& leaf) { return leaf._value; }
+
+template <size_t i, typename T>
+FRNN_HOST_DEVICE constexpr T& leafValue(TupleLeaf<i, T, true>& leaf) { return leaf; }
+
+template <size_t i, typename T>
+FRNN_HOST_DEVICE constexpr const T& leafValue(const TupleLeaf<i, T, true>& leaf) { return leaf; }
 
 // ==========================================================================================================
-//! @struct     TupleElementTypeHolder
+//! @struct     TupleStorage
+//! @brief      Inherits from the leaves of all of the elements of a Tuple.
+//! @tparam     Indices The IndexList of the positions of the elements.
+//! @tparam     Ts      The types of the elements.
 // ==========================================================================================================
-template <typename T, typename... Ts>
-struct TupleElementTypeHolder<0, Tuple<T, Ts...>> {
-    typedef T type;         
+template <typename Indices, typename... Ts> struct TupleStorage;
+
+template <size_t... Is, typename... Ts>
+struct TupleStorage<IndexList<Is...>, Ts...> : TupleLeaf<Is, Ts>... {
+    FRNN_HOST_DEVICE constexpr TupleStorage() : TupleLeaf<Is, Ts>()... {}
+    FRNN_HOST_DEVICE constexpr TupleStorage(const Ts&... elements) : TupleLeaf<Is, Ts>(elements)... {}
 };
 
+}       // End namespace tuple
+
+// ==========================================================================================================
+//! @struct  Tuple 
+//! @brief   Holds any number of elements of any type. The Tuple is trivially copyable if all of its 
+//!          elements are, so Tuples of Indexes (and of slice dimensions) can be passed by value to kernels.
+//! @details Usage : Tuple<type1, type2, ...> tuple(elem1 of type1, elem2 of type2, ...)
+//! @tparam  Ts     The types of the elements to be stored in teh Tuple.
+// ==========================================================================================================
+template <typename... Ts> 
+struct Tuple : tuple::TupleStorage<typename tuple::MakeIndexList<sizeof...(Ts)>::type, Ts...> {
+public:
+    /* ======================================== Typedefs ================================================== */
+    typedef tuple::TupleStorage<typename tuple::MakeIndexList<sizeof...(Ts)>::type, Ts...> storage_type;
+    /* ==================================================================================================== */ 
+    
+    // ======================================================================================================
+    //! @brief      Default constructor, each element is value initialized.
+    // ======================================================================================================
+    FRNN_HOST_DEVICE constexpr Tuple() : storage_type() {}
+    
+    // ======================================================================================================
+    //! @brief      Constructs the Tuple from all of its elements.
+    //! @param[in]  elements    The elements to add to the Tuple.
+    // ======================================================================================================
+    FRNN_HOST_DEVICE constexpr Tuple(const Ts&... elements) : storage_type(elements...) {}
+};
+
+// ==========================================================================================================
+//! @struct  Tuple 
+//! @brief   Tuple with no elements.
+// ==========================================================================================================
+template <> struct Tuple<> {};
+
 // ==========================================================================================================
 //! @struct     TupleElementTypeHolder
 //! @brief      Defines the types of each of the elements in a Tuple.
 //! @tparam i   Index of the element in the Tuple for which the type must be declared. 
-//! @tparam T   Type of the element at position i in Tuple./
-//! @tparam Ts  Types of the elements at positions != i in the Tuple. 
+//! @tparam T   The type of the Tuple.
 // ==========================================================================================================
-template <size_t i, typename T, typename... Ts>
-struct TupleElementTypeHolder<i, Tuple<T, Ts...>> {
-    typedef typename TupleElementTypeHolder<i - 1, Tuple<Ts...>>::type type;  
+template <size_t i, typename T> struct TupleElementTypeHolder;
+
+template <size_t i, typename... Ts>
+struct TupleElementTypeHolder<i, Tuple<Ts...>> {
+private:
+    template <typename T, bool Empty> static T* leafType(const tuple::TupleLeaf<i, T, Empty>*);
+public:
+    typedef typename std::remove_pointer<decltype(leafType(static_cast<Tuple<Ts...>*>(0)))>::type type;
 };
 
 // ==========================================================================================================
-//! @brief      Gets the 0th element in a Tuple. Enabled if i is equal to 0.
+//! @brief      Gets the element at position i in the Tuple.
 //! @param[in]  tuple   The Tuple to get the element from.
-//! @tparam     i       The index of the element to get.
-//! @tparam     Ts      The types of all elements in the Tuple.
+//! @tparam     i       The index of the element in the Tuple.
+//! @tparam     Ts      The types of all the elements in the Tuple.
 // ==========================================================================================================
 template <size_t i, typename... Ts>
-typename std::enable_if<i == 0, typename TupleElementTypeHolder<0, Tuple<Ts...>>::type&>::type 
-get(Tuple<Ts...>& tuple) 
+FRNN_HOST_DEVICE constexpr typename TupleElementTypeHolder<i, Tuple<Ts...>>::type& get(Tuple<Ts...>& tuple) 
 {
-    return tuple._back;
+    return tuple::leafValue<i>(tuple);
 }
 
 // ==========================================================================================================
-//! @brief      Gets the element at position i in the Tuple. Enabled if i is not equal to 0.
+//! @brief      Gets the element at position i in a constant Tuple.
 //! @param[in]  tuple   The Tuple to get the element from.
 //! @tparam     i       The index of the element in the Tuple.
-//! @tparam     T       The type of the element at position i.
 //! @tparam     Ts      The types of all the elements in the Tuple.
 // ==========================================================================================================
-template <size_t i, typename T, typename... Ts>
-typename std::enable_if<i != 0, typename TupleElementTypeHolder<i, Tuple<T, Ts...>>::type&>::type
-get(Tuple<T, Ts...>& tuple) 
+template <size_t i, typename... Ts>
+FRNN_HOST_DEVICE constexpr const typename TupleElementTypeHolder<i, Tuple<Ts...>>::type& 
+get(const Tuple<Ts...>& tuple) 
 {
-    Tuple<Ts...>& tupleBase = tuple;
-    return get<i - 1>(tupleBase);       
+    return tuple::leafValue<i>(tuple);
 }
 
 namespace tuple {
@@ -137,7 +203,7 @@ namespace tuple {
 //! @return     The size of the Tuple tuple.
 // ========================================================================================================== 
 template <typename... Ts>
-size_t size(Tuple<Ts...>& tuple) { return sizeof...(Ts); }
+FRNN_HOST_DEVICE constexpr size_t size(const Tuple<Ts...>&) { return sizeof...(Ts); }
 
 }
 
@@ -0,0 +1,173 @@
+/*
+ *  Header file for the fastRNN aligned host allocator, which gives the host
+ *  data of tensors an alignment of a cache line (and of the widest vector
+ *  registers), and for the helpers which split an array into an unaligned
+ *  head, an aligned body of whole vectors and a tail.
+ *
+ *  Copyright (C) 2015 Rob Clucas robclu1818@gmail.com
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published
+ *  by the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program; if not, write to the Free Software Foundation,
+ *  Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#ifndef _FRNN_ALIGNED_ALLOCATOR_
+#define _FRNN_ALIGNED_ALLOCATOR_
+
+#include <cstddef>
+#include <cstdlib>
+#include <new>
+#include <vector>
+
+// The split is used by the kernels and on the host, builds without nvcc only have it on the host
+#ifdef __CUDACC__
+    #define FRNN_HOST_DEVICE __host__ __device__
+#else
+    #define FRNN_HOST_DEVICE
+#endif
+
+/* ============================================= NOTES ======================================================
+ *
+ * 1. 64 bytes is a cache line and the width of an AVX-512 register, so an aligned array has every vector of
+ *    every instruction set (and every float4 or double2 of the GPU) on a vector boundary, and a vector load
+ *    never spans two cache lines.
+ *
+ * 2. Kernels can't rely on the alignment of the arrays they are given, since a part of an array (a page of a
+ *    tensor, a column of a matrix or a chunk of a thread) can start anywhere. Vectorized kernels split their
+ *    arrays with alignedSplit into a prologue of the elements before the first aligned vector, a body of
+ *    whole aligned vectors and an epilogue of the elements after the last whole vector, so that the body
+ *    always uses full width loads and stores, for any number of elements and any offset.
+ *
+ * ==========================================================================================================
+ */
+
+namespace frnn {
+
+// Alignment (in bytes) of the host data of tensors
+const size_t FRNN_ALIGNMENT = 64;
+
+/*
+ * ==========================================================================================================
+ * Class        : AlignedAllocator
+ *
+ * Description  : Allocator for standard containers which aligns the memory which is allocated
+ *
+ * Params       : T         : The type of the elements to allocate
+ *              : Alignment : The alignment in bytes (a power of 2 which is at least the size of a pointer)
+ * ==========================================================================================================
+ */
+template <typename T, size_t Alignment = FRNN_ALIGNMENT>
+class AlignedAllocator {
+    public:
+        typedef T           value_type;
+        typedef T*          pointer;
+        typedef const T*    const_pointer;
+        typedef T&          reference;
+        typedef const T&    const_reference;
+        typedef size_t      size_type;
+        typedef ptrdiff_t   difference_type;
+
+        template <typename U> struct rebind { typedef AlignedAllocator<U, Alignment> other; };
+
+        AlignedAllocator() {}
+        template <typename U> AlignedAllocator( const AlignedAllocator<U, Alignment>& ) {}
+
+        /*
+         * ==================================================================================================
+         * Function     : allocate
+         *
+         * Description  : Allocates aligned memory for a number of elements, throwing std::bad_alloc (as the
+         *                standard containers expect) if the memory can't be allocated
+         *
+         * Inputs       : N     : The number of elements
+         * ==================================================================================================
+         */
+        T* allocate( size_t N ) {
+            if ( N == 0 ) return 0;
+            if ( N > max_size() ) throw std::bad_alloc();
+
+            void* memory = 0;
+            if ( posix_memalign( &memory, Alignment, N * sizeof( T ) ) != 0 ) throw std::bad_alloc();
+            return static_cast<T*>( memory );
+        }
+
+        void deallocate( T* memory, size_t ) { free( memory ); }
+
+        size_t max_size() const { return ~size_t( 0 ) / sizeof( T ); }
+
+        template <typename U> bool operator==( const AlignedAllocator<U, Alignment>& ) const { return true;  }
+        template <typename U> bool operator!=( const AlignedAllocator<U, Alignment>& ) const { return false; }
+};
+
+// Vector whose data is aligned to FRNN_ALIGNMENT bytes
+template <typename T> using aligned_vector = std::vector<T, AlignedAllocator<T>>;
+
+/*
+ * ==========================================================================================================
+ * Struct       : aligned_split
+ *
+ * Description  : How an array is split into a prologue (head), a body of whole aligned vectors, and an
+ *                epilogue (tail), which starts at element head + vectors * width
+ * ==========================================================================================================
+ */
+struct aligned_split {
+    size_t head;                // Elements before the first aligned vector
+    size_t vectors;             // Number of whole aligned vectors
+    size_t tail;                // Elements after the last whole vector
+};
+
+/*
+ * ==========================================================================================================
+ * Function     : alignedSplit
+ *
+ * Description  : Splits an array into a head, a body of aligned vectors and a tail (see NOTES 2)
+ *
+ * Inputs       : x         : The array to split
+ *              : N         : The number of elements in the array
+ *              : width     : The number of elements in a vector
+ *              : alignment : The alignment (in bytes) of a vector
+ *
+ * Params       : dType     : The type of the elements
+ * ==========================================================================================================
+ */
+template <typename dType>
+FRNN_HOST_DEVICE inline aligned_split alignedSplit( const dType* x, size_t N, size_t width, size_t alignment ) {
+    const size_t misaligned = reinterpret_cast<size_t>( x ) % alignment;
+    size_t       head       = misaligned == 0 ? 0 : ( alignment - misaligned ) / sizeof( dType );
+
+    // Arrays which aren't aligned to the element size never reach a vector boundary
+    if ( misaligned % sizeof( dType ) != 0 || head > N ) head = N;
+
+    aligned_split split = { head, ( N - head ) / width, ( N - head ) % width };
+    return split;
+}
+
+/*
+ * ==========================================================================================================
+ * Function     : sameAlignment
+ *
+ * Description  : If two arrays have the same offset from an alignment boundary, in which case both of the
+ *                arrays are aligned in the body of an alignedSplit of either of them
+ *
+ * Inputs       : x, y      : The arrays to check
+ *              : alignment : The alignment (in bytes)
+ * ==========================================================================================================
+ */
+template <typename xType, typename yType>
+FRNN_HOST_DEVICE inline bool sameAlignment( const xType* x, const yType* y, size_t alignment ) {
+    return reinterpret_cast<size_t>( x ) % alignment == reinterpret_cast<size_t>( y ) % alignment;
+}
+
+}   // Namespace frnn
+
+#endif
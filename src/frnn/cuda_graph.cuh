@@ -0,0 +1,313 @@
+/*
+ *  Header file for the fastRNN CUDA graph class, which captures a step (a
+ *  fixed sequence of work on the primary stream of a GPU context) into a
+ *  CUDA graph the first time it is run, and then replays the graph, so that
+ *  each step is a single launch.
+ *
+ *  Copyright (C) 2015 Rob Clucas robclu1818@gmail.com
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published
+ *  by the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program; if not, write to the Free Software Foundation,
+ *  Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#ifndef _FRNN_CUDA_GRAPH_
+#define _FRNN_CUDA_GRAPH_
+
+#include <cuda_runtime.h>
+
+#include <vector>
+
+#include "../util/errors.h"
+#include "gpu_context.cuh"
+#include "profiler.cuh"
+
+/* ============================================= NOTES ======================================================
+ *
+ * 1. A graph bakes in the addresses and the arguments of all the work in it, so a step reads its inputs from
+ *    and writes its outputs to buffers which it owns, and the graph has a copy node into each input buffer
+ *    (before the step) and out of each output buffer (after it). The copies are the bindings of the graph:
+ *    only the parameters of the copy nodes are updated for the buffers of the caller, so the caller can give
+ *    different buffers to each replay, and the step itself is never changed.
+ *
+ * 2. The first run of a step is done eagerly (the work is queued on the stream as usual) and the step is then
+ *    captured, without being run again. The eager run allocates the scratch buffers and moves the data of the
+ *    tensors to the device, neither of which can be done while the stream is captured, so when the step is
+ *    captured all its work is queued on the device. Functions which would wait for the stream don't wait
+ *    while it's captured (see waitForStream). A step which still can't be captured (for example one which
+ *    reads a value from the device on the host, as a loss scaler does) is run eagerly every time.
+ *
+ * 3. The scratch buffers of the context and the blocks of its allocator which the step used can move after
+ *    the step was captured (when a scratch buffer is grown, or the allocator frees its cached blocks), so the
+ *    graph records the buffer generation of the context and the number of frees of the allocator when it is
+ *    captured, and is captured again (after an eager run) if either has changed. Temporary blocks which the
+ *    step gave back to the allocator are only reused on the primary stream, so they are safe to reuse
+ *    between replays (all the work on the stream is in order).
+ *
+ * 4. Everything which is captured is fixed, so anything which changes the work of the step (other than the
+ *    bindings) must reset the graph, so that it is captured again.
+ *
+ * ==========================================================================================================
+ */
+
+namespace frnn {
+
+/*
+ * ==========================================================================================================
+ * Function     : capturing
+ *
+ * Description  : If a stream is being captured into a graph
+ *
+ * Inputs       : stream    : The stream to check
+ * ==========================================================================================================
+ */
+inline bool capturing( cudaStream_t stream ) {
+    cudaStreamCaptureStatus status = cudaStreamCaptureStatusNone;
+    return cudaStreamIsCapturing( stream, &status ) == cudaSuccess && status != cudaStreamCaptureStatusNone;
+}
+
+/*
+ * ==========================================================================================================
+ * Function     : waitForStream
+ *
+ * Description  : Waits for all the work on a stream to finish, unless the stream is being captured, when the
+ *                work is only queued into the graph, so there is nothing to wait for (see NOTES 2)
+ *
+ * Inputs       : stream    : The stream to wait for
+ * ==========================================================================================================
+ */
+inline void waitForStream( cudaStream_t stream ) {
+    if ( !capturing( stream ) ) cudaStreamSynchronize( stream );
+}
+
+/*
+ * ==========================================================================================================
+ * Struct       : graph_binding
+ *
+ * Description  : A copy between a buffer of the caller and a buffer of a step (see NOTES 1)
+ * ==========================================================================================================
+ */
+struct graph_binding {
+    void*           dst;                            // Destination of the copy (on the device)
+    const void*     src;                            // Source of the copy (on the device)
+    size_t          bytes;                          // Number of bytes to copy
+};
+
+/*
+ * ==========================================================================================================
+ * Class        : CudaGraph
+ *
+ * Description  : A step which is captured into a CUDA graph on the primary stream of a context the first
+ *                time it is run, and replayed after that (see NOTES 1 - 4)
+ * ==========================================================================================================
+ */
+class CudaGraph {
+    private:
+        GpuContext*                     context_;           // Context which the step is run on
+        cudaGraph_t                     graph_;             // Bindings and the captured step
+        cudaGraphExec_t                 exec_;              // Instance of the graph which is launched
+        std::vector<cudaGraphNode_t>    in_nodes_;          // Copy node of each input binding
+        std::vector<cudaGraphNode_t>    out_nodes_;         // Copy node of each output binding
+        std::vector<graph_binding>      ins_;               // Input bindings of the instance
+        std::vector<graph_binding>      outs_;              // Output bindings of the instance
+        size_t                          buffer_generation_; // Buffer generation of the context at the capture
+        size_t                          device_frees_;      // Frees of the allocator at the capture
+        bool                            capturable_;        // If the step could be captured
+        size_t                          num_captures_;      // Number of times the step was captured
+        size_t                          num_launches_;      // Number of replays of the graph
+    public:
+        /*
+         * ==================================================================================================
+         * Function     : CudaGraph
+         *
+         * Description  : Creates an empty graph for a step on the primary stream of a context
+         *
+         * Inputs       : context   : The context of the step, which must outlive the graph
+         * ==================================================================================================
+         */
+        explicit CudaGraph( GpuContext& context = GpuContext::global() ) :
+            context_( &context ), graph_( 0 ), exec_( 0 ), buffer_generation_( 0 ), device_frees_( 0 ),
+            capturable_( true ), num_captures_( 0 ), num_launches_( 0 ) {}
+
+        ~CudaGraph() { reset(); }
+
+        CudaGraph( const CudaGraph& )               = delete;
+        CudaGraph& operator=( const CudaGraph& )    = delete;
+
+        /*
+         * ==================================================================================================
+         * Function     : run
+         *
+         * Description  : Runs a step with its bindings: eagerly (and then captures it) if the graph isn't
+         *                captured or is out of date, otherwise by updating the bindings which changed and
+         *                launching the graph. Nothing waits for the stream.
+         *
+         * Inputs       : error     : fastRNN error type for the result of the run
+         *              : ins       : The copies into the input buffers of the step
+         *              : step      : The step, which queues its work on the primary stream of the context
+         *              : outs      : The copies out of the output buffers of the step
+         *
+         * Params       : Step      : The type of the step (a callable with no arguments)
+         * ==================================================================================================
+         */
+        template <typename Step>
+        void run( frnnError& error, const std::vector<graph_binding>& ins, Step&& step,
+                  const std::vector<graph_binding>& outs ) {
+            FRNN_PROFILE_GPU( "CudaGraph::run", &error, context_->stream() );
+            cudaStream_t stream = context_->stream();
+
+            if ( !upToDate( ins, outs ) ) {
+                reset();
+                copy( error, ins, stream );
+                step();
+                copy( error, outs, stream );
+                if ( capturable_ ) capture( error, ins, step, outs );
+                return;
+            }
+
+            if ( !bind( in_nodes_, ins_, ins ) || !bind( out_nodes_, outs_, outs ) ) {
+                frnn::err::graphError( error, stringify( exec_ ) );
+                return;
+            }
+            FRNN_COUNT_LAUNCH();
+            for ( size_t i = 0; i < ins.size(); i++ )  FRNN_COUNT_COPY( cudaMemcpyDeviceToDevice, ins[ i ].bytes );
+            for ( size_t i = 0; i < outs.size(); i++ ) FRNN_COUNT_COPY( cudaMemcpyDeviceToDevice, outs[ i ].bytes );
+            if ( cudaGraphLaunch( exec_, stream ) != cudaSuccess ) {
+                frnn::err::graphError( error, stringify( exec_ ) );
+                return;
+            }
+            num_launches_++;
+        }
+
+        /*
+         * ==================================================================================================
+         * Function     : reset
+         *
+         * Description  : Releases the captured graph, so that the next run captures the step again (see
+         *                NOTES 4)
+         * ==================================================================================================
+         */
+        void reset() {
+            if ( exec_ != 0 )  cudaGraphExecDestroy( exec_ );
+            if ( graph_ != 0 ) cudaGraphDestroy( graph_ );
+            exec_  = 0;
+            graph_ = 0;
+            in_nodes_.clear();
+            out_nodes_.clear();
+            ins_.clear();
+            outs_.clear();
+        }
+
+        // If the step is captured, so that the next run (with the same bindings sizes) is a replay
+        inline bool captured() const { return exec_ != 0; }
+
+        // If the step could be captured, steps which couldn't are always run eagerly
+        inline bool capturable() const { return capturable_; }
+
+        // Number of times the step was captured, and the number of replays of the captures
+        inline size_t numCaptures() const { return num_captures_; }
+        inline size_t numLaunches() const { return num_launches_; }
+
+    private:
+        // If the instance can be replayed with the bindings (see NOTES 3)
+        bool upToDate( const std::vector<graph_binding>& ins, const std::vector<graph_binding>& outs ) const {
+            if ( exec_ == 0 || ins.size() != ins_.size() || outs.size() != outs_.size() ) return false;
+            if ( buffer_generation_ != context_->bufferGeneration()                    ) return false;
+            if ( device_frees_ != context_->allocator().numDeviceFrees()               ) return false;
+            for ( size_t i = 0; i < ins.size(); i++ )  if ( ins[ i ].bytes != ins_[ i ].bytes )   return false;
+            for ( size_t i = 0; i < outs.size(); i++ ) if ( outs[ i ].bytes != outs_[ i ].bytes ) return false;
+            return true;
+        }
+
+        // Queues the copies of bindings on the stream
+        static void copy( frnnError& error, const std::vector<graph_binding>& bindings, cudaStream_t stream ) {
+            for ( size_t i = 0; i < bindings.size(); i++ ) {
+                if ( frnn::prof::memcpyAsync( bindings[ i ].dst, bindings[ i ].src, bindings[ i ].bytes,
+                                              cudaMemcpyDeviceToDevice, stream ) != cudaSuccess ) {
+                    frnn::err::copyError( error, stringify( bindings ) );
+                }
+            }
+        }
+
+        // Updates the copy nodes of the bindings which changed
+        bool bind( const std::vector<cudaGraphNode_t>& nodes, std::vector<graph_binding>& current,
+                   const std::vector<graph_binding>& bindings ) {
+            for ( size_t i = 0; i < bindings.size(); i++ ) {
+                if ( bindings[ i ].dst == current[ i ].dst && bindings[ i ].src == current[ i ].src ) continue;
+                if ( cudaGraphExecMemcpyNodeSetParams1D( exec_, nodes[ i ], bindings[ i ].dst, bindings[ i ].src,
+                                                         bindings[ i ].bytes, cudaMemcpyDeviceToDevice ) != cudaSuccess ) {
+                    return false;
+                }
+                current[ i ] = bindings[ i ];
+            }
+            return true;
+        }
+
+        // Captures the step, and makes the graph of the bindings around it (see NOTES 1 and 2)
+        template <typename Step>
+        void capture( frnnError& error, const std::vector<graph_binding>& ins, Step& step,
+                      const std::vector<graph_binding>& outs ) {
+            cudaStream_t    stream     = context_->stream();
+            cudaGraph_t     step_graph = 0;
+            const size_t    generation = context_->bufferGeneration();
+            const size_t    frees      = context_->allocator().numDeviceFrees();
+
+            if ( cudaStreamBeginCapture( stream, cudaStreamCaptureModeThreadLocal ) != cudaSuccess ) {
+                cudaGetLastError();
+                capturable_ = false;
+                return;
+            }
+            step();
+            if ( cudaStreamEndCapture( stream, &step_graph ) != cudaSuccess || step_graph == 0 ||
+                 context_->bufferGeneration() != generation ) {
+                // The step did something which can't be in a graph, so it's always run eagerly
+                if ( step_graph != 0 ) cudaGraphDestroy( step_graph );
+                cudaGetLastError();
+                capturable_ = false;
+                return;
+            }
+
+            cudaGraphNode_t step_node = 0;
+            bool            built     = cudaGraphCreate( &graph_, 0 ) == cudaSuccess;
+            in_nodes_.resize( ins.size(), 0 );
+            out_nodes_.resize( outs.size(), 0 );
+            for ( size_t i = 0; built && i < ins.size(); i++ ) {
+                built = cudaGraphAddMemcpyNode1D( &in_nodes_[ i ], graph_, 0, 0, ins[ i ].dst, ins[ i ].src,
+                                                  ins[ i ].bytes, cudaMemcpyDeviceToDevice ) == cudaSuccess;
+            }
+            built = built && cudaGraphAddChildGraphNode( &step_node, graph_, in_nodes_.empty() ? 0 : &in_nodes_[ 0 ],
+                                                         in_nodes_.size(), step_graph ) == cudaSuccess;
+            for ( size_t i = 0; built && i < outs.size(); i++ ) {
+                built = cudaGraphAddMemcpyNode1D( &out_nodes_[ i ], graph_, &step_node, 1, outs[ i ].dst, outs[ i ].src,
+                                                  outs[ i ].bytes, cudaMemcpyDeviceToDevice ) == cudaSuccess;
+            }
+            built = built && cudaGraphInstantiateWithFlags( &exec_, graph_, 0 ) == cudaSuccess;
+
+            // The child node has its own copy of the step
+            cudaGraphDestroy( step_graph );
+            if ( !built ) {
+                reset();
+                frnn::err::graphError( error, stringify( graph_ ) );
+                return;
+            }
+            ins_               = ins;
+            outs_              = outs;
+            buffer_generation_ = generation;
+            device_frees_      = frees;
+            num_captures_++;
+        }
+};
+
+}   // Namespace frnn
+
+#endif
@@ -0,0 +1,60 @@
+/*
+ *  Header file for the parts of the CUDA runtime which the host code of
+ *  fastRNN uses, which are the CUDA headers in GPU builds and host only
+ *  declarations in CPU only builds (without the CUDA SDK).
+ *
+ *  Copyright (C) 2015 Rob Clucas robclu1818@gmail.com
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published
+ *  by the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program; if not, write to the Free Software Foundation,
+ *  Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#ifndef _FRNN_CUDA_HOST_
+#define _FRNN_CUDA_HOST_
+
+#include "types.h"
+
+/* ============================================= NOTES ======================================================
+ *
+ * 1. The CPU code shares its headers with the GPU code, so some host signatures have CUDA types (the stream
+ *    of an op for the profiler, or of a GpuContext) and some functions are also device functions (the
+ *    element accessors of tensors, the functors and the Philox generator). Without FRNN_WITH_CUDA (see
+ *    types.h) a stream is an opaque handle which is always 0 (the host), and the function qualifiers are
+ *    empty, so the headers compile with any C++11 compiler. Everything else of CUDA (the device storage,
+ *    the GPU functions and the GPU specializations of the layer policies) is only in GPU builds, and the
+ *    events of the profiler are only declared, so that its members have the same types in both builds.
+ *
+ * ==========================================================================================================
+ */
+
+#ifdef FRNN_WITH_CUDA
+
+#include <cuda.h>
+#include <cuda_runtime.h>
+
+#else
+
+#ifndef __host__
+    #define __host__
+#endif
+#ifndef __device__
+    #define __device__
+#endif
+
+typedef struct CUstream_st*   cudaStream_t;
+typedef struct CUevent_st*    cudaEvent_t;
+
+#endif
+
+#endif
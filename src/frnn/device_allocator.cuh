@@ -0,0 +1,283 @@
+/*
+ *  Header file for the fastRNN caching device memory allocator. Device
+ *  buffers are taken from (and returned to) pools of size classes, so that
+ *  after warm up temporaries don't need cudaMalloc or cudaFree, which both
+ *  synchronize the device.
+ *
+ *  Copyright (C) 2015 Rob Clucas robclu1818@gmail.com
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published
+ *  by the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program; if not, write to the Free Software Foundation,
+ *  Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#ifndef _FRNN_DEVICE_ALLOCATOR_
+#define _FRNN_DEVICE_ALLOCATOR_
+
+#include <cuda.h>
+#include <cuda_runtime.h>
+
+#include <map>
+#include <mutex>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "types.h"
+#include "frnn.h"
+#include "profiler.cuh"
+
+/* ============================================= NOTES ======================================================
+ *
+ * 1. Requests are rounded up to a power of 2 number of bytes (with a minimum of MIN_BLOCK_BYTES), which is
+ *    the size class of the block. When a block is freed it is put on the free list for its size class and
+ *    the stream it was used on, and given to the next request of the same size class on the same stream.
+ *
+ * 2. Blocks are only reused on the stream they were freed on, so any work on the stream which still uses a
+ *    freed block is done before the work of the next user of the block, without the need for events or
+ *    synchronization. Using a block on a different stream than the one it was allocated for is not safe.
+ *
+ * 3. The memory limit caps the number of bytes which are reserved from the device (cached + in use). When a
+ *    request would go over the limit all the cached blocks are released to the device first, and if the
+ *    request would still go over the limit the allocation fails.
+ *
+ * ==========================================================================================================
+ */
+
+namespace frnn {
+
+/*
+ * ==========================================================================================================
+ * Class        : DeviceAllocator
+ *
+ * Description  : Caching allocator for device memory, which pools blocks by size class and stream. The
+ *                allocator is thread safe, so a single (process wide) allocator can be shared by all the GPU
+ *                contexts of a process.
+ * ==========================================================================================================
+ */
+class DeviceAllocator {
+    public:
+        static constexpr size_t MIN_BLOCK_BYTES = 512;          // Smallest size class
+        static constexpr size_t NO_LIMIT        = ~size_t( 0 ); // Limit for no cap on the reserved memory
+    private:
+        // Info for a block which has been given to a user
+        struct block {
+            size_t          bytes;                      // Size class of the block
+            int             device;                     // Device the block is on
+            cudaStream_t    stream;                     // Stream the block is used on
+        };
+
+        typedef std::map<size_t, std::vector<void*>>        size_class_lists;
+        typedef std::pair<int, cudaStream_t>                pool_key;
+
+        std::map<pool_key, size_class_lists>        free_blocks_;       // Cached blocks for each device and stream
+        std::unordered_map<void*, block>            used_blocks_;       // Blocks given to users
+        size_t                                      reserved_bytes_;    // Bytes reserved from the device
+        size_t                                      used_bytes_;        // Bytes given to users
+        size_t                                      high_water_mark_;   // Max bytes which were reserved
+        size_t                                      limit_;             // Max bytes which can be reserved
+        size_t                                      num_device_allocs_; // Number of calls to cudaMalloc
+        size_t                                      num_device_frees_;  // Number of cached blocks freed
+        std::mutex                                  mutex_;
+    public:
+        explicit DeviceAllocator( size_t limit = NO_LIMIT ) :
+            reserved_bytes_( 0 ), used_bytes_( 0 ), high_water_mark_( 0 ),
+            limit_( limit ), num_device_allocs_( 0 ), num_device_frees_( 0 ) {}
+
+        ~DeviceAllocator() {
+            releaseCached();
+            for ( auto& used : used_blocks_ ) cudaFree( used.first );
+        }
+
+        DeviceAllocator( const DeviceAllocator& )               = delete;
+        DeviceAllocator& operator=( const DeviceAllocator& )    = delete;
+
+        /*
+         * ==================================================================================================
+         * Function     : global
+         *
+         * Description  : Gets the process wide allocator, which is created on first use
+         * ==================================================================================================
+         */
+        static DeviceAllocator& global() {
+            static DeviceAllocator allocator;
+            return allocator;
+        }
+
+        /*
+         * ==================================================================================================
+         * Function     : sizeClass
+         *
+         * Description  : Gets the size class (number of bytes of the block) for a request
+         *
+         * Inputs       : bytes     : The number of bytes which are requested
+         * ==================================================================================================
+         */
+        static inline size_t sizeClass( size_t bytes ) {
+            size_t size_class = MIN_BLOCK_BYTES;
+            while ( size_class < bytes ) size_class <<= 1;
+            return size_class;
+        }
+
+        /*
+         * ==================================================================================================
+         * Function     : allocate
+         *
+         * Description  : Gets a block of device memory which can hold at least bytes bytes, from the cache if
+         *                there is a free block of the size class for the stream (on the current device), otherwise
+         *                from the device. The blocks of different devices are never shared, since the default
+         *                stream is the same handle on every device.
+         *
+         * Inputs       : error     : fastRNN error type for the result of the allocation
+         *              : bytes     : The number of bytes which are needed
+         *              : stream    : The stream the block will be used on
+         *
+         * Outputs      : A pointer to the block, or 0 if the allocation failed
+         * ==================================================================================================
+         */
+        void* allocate( frnnError& error, size_t bytes, cudaStream_t stream = 0 ) {
+            std::lock_guard<std::mutex> lock( mutex_ );
+            size_t size_class = sizeClass( bytes );
+            void*  ptr        = 0;
+            int    device     = 0;
+            cudaGetDevice( &device );
+
+            std::vector<void*>& free_list = free_blocks_[ pool_key( device, stream ) ][ size_class ];
+            if ( !free_list.empty() ) {
+                ptr = free_list.back();
+                free_list.pop_back();
+            } else {
+                // Give cached blocks back to the device before going over the limit
+                if ( reserved_bytes_ + size_class > limit_ ) releaseCachedLocked();
+                if ( reserved_bytes_ + size_class > limit_ ) {
+                    frnn::err::allocError( error, stringify( ptr ) );
+                    return 0;
+                }
+                if ( cudaMalloc( &ptr, size_class ) != cudaSuccess ) {
+                    // Cached blocks could be fragmenting the device, so try again without them
+                    releaseCachedLocked();
+                    if ( cudaMalloc( &ptr, size_class ) != cudaSuccess ) {
+                        frnn::err::allocError( error, stringify( ptr ) );
+                        return 0;
+                    }
+                }
+                num_device_allocs_++;
+                FRNN_COUNT_ALLOC( size_class );
+                reserved_bytes_ += size_class;
+                if ( reserved_bytes_ > high_water_mark_ ) high_water_mark_ = reserved_bytes_;
+            }
+
+            block used  = { size_class, device, stream };
+            used_blocks_[ ptr ] = used;
+            used_bytes_ += size_class;
+            return ptr;
+        }
+
+        /*
+         * ==================================================================================================
+         * Function     : deallocate
+         *
+         * Description  : Returns a block to the cache (the block is not freed on the device)
+         *
+         * Inputs       : ptr       : A pointer to the block, which must have come from allocate (or be 0)
+         * ==================================================================================================
+         */
+        void deallocate( void* ptr ) {
+            if ( ptr == 0 ) return;
+            std::lock_guard<std::mutex> lock( mutex_ );
+
+            auto used = used_blocks_.find( ptr );
+            if ( used == used_blocks_.end() ) return;
+
+            free_blocks_[ pool_key( used->second.device, used->second.stream ) ][ used->second.bytes ].push_back( ptr );
+            used_bytes_ -= used->second.bytes;
+            used_blocks_.erase( used );
+        }
+
+        /*
+         * ==================================================================================================
+         * Function     : releaseCached
+         *
+         * Description  : Frees all the cached (free) blocks on the device
+         * ==================================================================================================
+         */
+        void releaseCached() {
+            std::lock_guard<std::mutex> lock( mutex_ );
+            releaseCachedLocked();
+        }
+
+        /*
+         * ==================================================================================================
+         * Function     : setMemoryLimit
+         *
+         * Description  : Sets the maximum number of bytes the allocator can reserve from the device, so that
+         *                processes which share a device can each be given part of it. If more than the limit
+         *                is already reserved the cached blocks are released.
+         *
+         * Inputs       : limit     : The max number of bytes (NO_LIMIT for no cap)
+         * ==================================================================================================
+         */
+        void setMemoryLimit( size_t limit ) {
+            std::lock_guard<std::mutex> lock( mutex_ );
+            limit_ = limit;
+            if ( reserved_bytes_ > limit_ ) releaseCachedLocked();
+        }
+
+        inline size_t memoryLimit() const { return limit_; }
+
+        /*
+         * ==================================================================================================
+         * Function     : highWaterMark
+         *
+         * Description  : Gets the max number of bytes which have been reserved from the device (since the
+         *                allocator was created or the mark was reset)
+         * ==================================================================================================
+         */
+        inline size_t highWaterMark() const { return high_water_mark_; }
+
+        void resetHighWaterMark() {
+            std::lock_guard<std::mutex> lock( mutex_ );
+            high_water_mark_ = reserved_bytes_;
+        }
+
+        // Bytes reserved from the device (cached + in use)
+        inline size_t reservedBytes() const { return reserved_bytes_; }
+
+        // Bytes in blocks which have been given to users (rounded to size classes)
+        inline size_t usedBytes() const { return used_bytes_; }
+
+        // Number of times the allocator had to call cudaMalloc
+        inline size_t numDeviceAllocations() const { return num_device_allocs_; }
+
+        // Number of cached blocks which have been freed on the device (the addresses of blocks which were 
+        // given back to the allocator are only safe to keep, as a captured CUDA graph does, until this changes)
+        inline size_t numDeviceFrees() const { return num_device_frees_; }
+
+    private:
+        void releaseCachedLocked() {
+            for ( auto& stream_lists : free_blocks_ ) {
+                for ( auto& free_list : stream_lists.second ) {
+                    for ( size_t i = 0; i < free_list.second.size(); i++ ) {
+                        cudaFree( free_list.second[ i ] );
+                        reserved_bytes_ -= free_list.first;
+                        num_device_frees_++;
+                    }
+                    free_list.second.clear();
+                }
+            }
+        }
+};
+
+}   // Namespace frnn
+
+#endif
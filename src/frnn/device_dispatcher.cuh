@@ -0,0 +1,350 @@
+/*
+ *  Header file for the fastRNN device dispatcher. The dispatcher has a cost
+ *  model of the CPU and the GPU (host <-> device transfers, launch latency
+ *  and throughput), which is calibrated at startup, and is used to choose
+ *  the device each math function is run on, from the number of elements
+ *  and where the data currently is.
+ *
+ *  Copyright (C) 2015 Rob Clucas robclu1818@gmail.com
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published
+ *  by the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program; if not, write to the Free Software Foundation,
+ *  Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#ifndef _FRNN_DEVICE_DISPATCHER_
+#define _FRNN_DEVICE_DISPATCHER_
+
+#include <cuda.h>
+#include <cuda_runtime.h>
+
+#include <algorithm>
+#include <chrono>
+#include <mutex>
+#include <vector>
+
+#include "types.h"
+#include "frnn.h"
+#include "gpu_context.cuh"
+#include "../math/math_kernels_cpu.h"
+
+/* ============================================= NOTES ======================================================
+ *
+ * 1. The time for a function on a device is modelled as
+ *
+ *      GPU : launches * launch latency + N * work / GPU throughput
+ *            + ( inputs on the host  ? copy latency + N * input bytes  / upload bandwidth   : 0 )
+ *            + ( output to the host  ? copy latency + N * output bytes / download bandwidth : 0 )
+ *
+ *      CPU : N * work / CPU throughput
+ *            + ( inputs on the device ? copy latency + N * input bytes / download bandwidth : 0 )
+ *
+ *    where the work of a function per element is relative to axpy (the function which is used to measure the
+ *    throughput of both devices), and the device with the smaller time is used.
+ *
+ * 2. The calibration takes a few milliseconds and is done once, when the process wide dispatcher is first
+ *    used. If there is no GPU every function is run on the CPU.
+ *
+ * ==========================================================================================================
+ */
+
+namespace frnn {
+
+/*
+ * ==========================================================================================================
+ * Struct       : op_cost
+ *
+ * Description  : The cost of a math function for each element of its input
+ * ==========================================================================================================
+ */
+struct op_cost {
+    double  work;                   // Work for each element, relative to axpy
+    double  bytes_in;               // Bytes of inputs for each element
+    double  bytes_out;              // Bytes of outputs for each element
+    uint    launches;               // Number of kernel launches for the GPU version
+};
+
+/*
+ * ==========================================================================================================
+ * Struct       : OpCosts
+ *
+ * Description  : The costs of the math functions for a type
+ *
+ * Params       : dType     : The type of data the functions use
+ * ==========================================================================================================
+ */
+template <typename dType> struct OpCosts {
+    static constexpr op_cost axpy()             { return op_cost{ 1.0, 2.0 * sizeof( dType ), 1.0 * sizeof( dType ), 1 }; }
+    static constexpr op_cost xmy()              { return op_cost{ 1.0, 2.0 * sizeof( dType ), 1.0 * sizeof( dType ), 1 }; }
+    static constexpr op_cost sum()              { return op_cost{ 0.5, 1.0 * sizeof( dType ), 0.0                  , 1 }; }
+    static constexpr op_cost sumVectorized()    { return op_cost{ 1.0, 1.0 * sizeof( dType ), 1.0 * sizeof( dType ), 2 }; }
+    static constexpr op_cost softmax()          { return op_cost{ 6.0, 1.0 * sizeof( dType ), 1.0 * sizeof( dType ), 3 }; }
+};
+
+/*
+ * ==========================================================================================================
+ * Struct       : cost_model
+ *
+ * Description  : The calibrated costs of the devices, all times are in microseconds
+ * ==========================================================================================================
+ */
+struct cost_model {
+    bool    gpu_available;          // If there is a GPU to run functions on
+    double  copy_latency;           // Time for a (small) copy between the host and the device
+    double  upload_bandwidth;       // Bytes per microsecond from the host to the device
+    double  download_bandwidth;     // Bytes per microsecond from the device to the host
+    double  launch_latency;         // Time to launch a kernel (and wait for it)
+    double  gpu_throughput;         // Elements per microsecond for axpy on the GPU
+    double  cpu_throughput;         // Elements per microsecond for axpy on the CPU
+};
+
+/*
+ * ==========================================================================================================
+ * Class        : DeviceDispatcher
+ *
+ * Description  : Chooses the device to run a math function on with a cost model of the devices. The process
+ *                wide dispatcher calibrates the model with the process wide GPU context when it is first
+ *                used, and a model can also be set (for example from a previous calibration).
+ * ==========================================================================================================
+ */
+class DeviceDispatcher {
+    private:
+        cost_model          model_;             // Costs of the devices
+        mutable std::mutex  mutex_;
+    public:
+        static constexpr size_t CALIBRATION_ELEMENTS = 1 << 20;     // Elements for the throughput calibration
+        static constexpr int    CALIBRATION_REPEATS  = 5;           // Best of this many runs is used
+
+        explicit DeviceDispatcher( const cost_model& model ) : model_( model ) {}
+
+        DeviceDispatcher( const DeviceDispatcher& )             = delete;
+        DeviceDispatcher& operator=( const DeviceDispatcher& )  = delete;
+
+        /*
+         * ==================================================================================================
+         * Function     : global
+         *
+         * Description  : Gets the process wide dispatcher, which is calibrated (with the process wide GPU
+         *                context) on first use
+         * ==================================================================================================
+         */
+        static DeviceDispatcher& global() {
+            static DeviceDispatcher dispatcher( calibrate( GpuContext::global() ) );
+            return dispatcher;
+        }
+
+        /*
+         * ==================================================================================================
+         * Function     : calibrate
+         *
+         * Description  : Measures the costs of the devices. The copy latency and the bandwidths are the
+         *                best times for copies of one element and of CALIBRATION_ELEMENTS elements (through
+         *                pinned memory, which is how the GPU functions stage their copies), the launch latency
+         *                is the time for an axpy of one element, and the throughputs are for axpy with
+         *                CALIBRATION_ELEMENTS floats.
+         *
+         * Inputs       : context   : The GPU context to use for the GPU measurements
+         *
+         * Outputs      : The cost model of the devices
+         * ==================================================================================================
+         */
+        static cost_model calibrate( GpuContext& context ) {
+            cost_model model  = { false, 0.0, 1.0, 1.0, 0.0, 1.0, cpuThroughput() };
+            int        devices = 0;
+            if ( cudaGetDeviceCount( &devices ) != cudaSuccess || devices == 0 ) return model;
+
+            frnnError       error;
+            const size_t    N       = CALIBRATION_ELEMENTS;
+            const size_t    bytes   = N * sizeof( float );
+            cudaStream_t    stream  = context.stream();
+            float*          x_d     = context.scratch<float>( error, 0, N );
+            float*          y_d     = context.scratch<float>( error, 1, N );
+            float*          staging = context.pinned<float>( error, 0, N );
+            if ( x_d == 0 || y_d == 0 || staging == 0 ) return model;
+
+            std::fill( staging, staging + N, 1.0f );
+            cudaEvent_t start, stop;
+            cudaEventCreate( &start );
+            cudaEventCreate( &stop );
+
+            float one = 1.0f;
+            cublasSetPointerMode( context.blasHandle(), CUBLAS_POINTER_MODE_HOST );
+
+            // Times are the best of the repeats, in milliseconds
+            float small_up = 1e9f, big_up = 1e9f, big_down = 1e9f, launch = 1e9f, kernel = 1e9f, elapsed;
+            for ( int repeat = 0; repeat < CALIBRATION_REPEATS; repeat++ ) {
+                cudaEventRecord( start, stream );
+                cudaMemcpyAsync( x_d, staging, sizeof( float ), cudaMemcpyHostToDevice, stream );
+                cudaEventRecord( stop, stream );
+                cudaEventSynchronize( stop );
+                cudaEventElapsedTime( &elapsed, start, stop );
+                small_up = std::min( small_up, elapsed );
+
+                cudaEventRecord( start, stream );
+                cudaMemcpyAsync( x_d, staging, bytes, cudaMemcpyHostToDevice, stream );
+                cudaEventRecord( stop, stream );
+                cudaEventSynchronize( stop );
+                cudaEventElapsedTime( &elapsed, start, stop );
+                big_up = std::min( big_up, elapsed );
+
+                cudaEventRecord( start, stream );
+                cudaMemcpyAsync( staging, x_d, bytes, cudaMemcpyDeviceToHost, stream );
+                cudaEventRecord( stop, stream );
+                cudaEventSynchronize( stop );
+                cudaEventElapsedTime( &elapsed, start, stop );
+                big_down = std::min( big_down, elapsed );
+
+                cudaEventRecord( start, stream );
+                cublasSaxpy( context.blasHandle(), 1, &one, x_d, 1, y_d, 1 );
+                cudaEventRecord( stop, stream );
+                cudaEventSynchronize( stop );
+                cudaEventElapsedTime( &elapsed, start, stop );
+                launch = std::min( launch, elapsed );
+
+                cudaEventRecord( start, stream );
+                cublasSaxpy( context.blasHandle(), N, &one, x_d, 1, y_d, 1 );
+                cudaEventRecord( stop, stream );
+                cudaEventSynchronize( stop );
+                cudaEventElapsedTime( &elapsed, start, stop );
+                kernel = std::min( kernel, elapsed );
+            }
+            cudaEventDestroy( start );
+            cudaEventDestroy( stop );
+
+            // Milliseconds to microseconds, and make sure nothing is 0 (events have a resolution of ~0.5us)
+            const double us = 1000.0, min_time = 1e-3;
+            model.gpu_available      = true;
+            model.copy_latency       = small_up * us;
+            model.upload_bandwidth   = bytes / std::max( big_up   * us - model.copy_latency, min_time );
+            model.download_bandwidth = bytes / std::max( big_down * us - model.copy_latency, min_time );
+            model.launch_latency     = launch * us;
+            model.gpu_throughput     = N / std::max( kernel * us - model.launch_latency, min_time );
+            return model;
+        }
+
+        /*
+         * ==================================================================================================
+         * Function     : cpuThroughput
+         *
+         * Description  : Measures the number of elements per microsecond for axpy with floats on the CPU
+         *                (with a single thread, which is what the CPU functions use for small arrays)
+         * ==================================================================================================
+         */
+        static double cpuThroughput() {
+            const size_t        N = CALIBRATION_ELEMENTS / 8;
+            std::vector<float>  x( N, 1.0f ), y( N, 0.0f );
+            double              best = 1e30;
+
+            for ( int repeat = 0; repeat < CALIBRATION_REPEATS; repeat++ ) {
+                auto start = std::chrono::steady_clock::now();
+                frnn::dispatchCpu<frnn::cpu::axpyKernel>( 1e-3f, static_cast<const float*>( &x[ 0 ] ), &y[ 0 ], N );
+                auto stop  = std::chrono::steady_clock::now();
+                best = std::min( best, std::chrono::duration<double, std::micro>( stop - start ).count() );
+            }
+            // Keep the result so that the kernel isn't removed
+            if ( y[ N - 1 ] < 0.0f ) best += 1.0;
+            return N / std::max( best, 1e-3 );
+        }
+
+        /*
+         * ==================================================================================================
+         * Function     : model / setModel
+         *
+         * Description  : Gets (a copy of) and sets the cost model of the dispatcher
+         * ==================================================================================================
+         */
+        cost_model model() const {
+            std::lock_guard<std::mutex> lock( mutex_ );
+            return model_;
+        }
+
+        void setModel( const cost_model& model ) {
+            std::lock_guard<std::mutex> lock( mutex_ );
+            model_ = model;
+        }
+
+        /*
+         * ==================================================================================================
+         * Function     : gpuTime / cpuTime
+         *
+         * Description  : Gets the modelled time (in microseconds) of a function on the GPU or the CPU
+         *
+         * Inputs       : cost          : The cost of the function for each element
+         *              : N             : The number of elements
+         *              : on_device     : If the inputs are currently on the device (else on the host)
+         *              : out_on_host   : If the outputs are needed on the host (else on the device)
+         * ==================================================================================================
+         */
+        double gpuTime( const op_cost& cost, size_t N, bool on_device, bool out_on_host ) const {
+            cost_model m = model();
+            double time  = cost.launches * m.launch_latency + N * cost.work / m.gpu_throughput;
+            if ( !on_device )  time += m.copy_latency + N * cost.bytes_in  / m.upload_bandwidth;
+            if ( out_on_host ) time += m.copy_latency + N * cost.bytes_out / m.download_bandwidth;
+            return time;
+        }
+
+        double cpuTime( const op_cost& cost, size_t N, bool on_device ) const {
+            cost_model m = model();
+            double time  = N * cost.work / m.cpu_throughput;
+            if ( on_device ) time += m.copy_latency + N * cost.bytes_in / m.download_bandwidth;
+            return time;
+        }
+
+        /*
+         * ==================================================================================================
+         * Function     : select
+         *
+         * Description  : Chooses the device which has the smallest modelled time for a function
+         *
+         * Inputs       : cost          : The cost of the function for each element
+         *              : N             : The number of elements
+         *              : on_device     : If the inputs are currently on the device (else on the host)
+         *              : out_on_host   : If the outputs are needed on the host (else on the device)
+         *
+         * Outputs      : The device to run the function on
+         * ==================================================================================================
+         */
+        device select( const op_cost& cost, size_t N, bool on_device, bool out_on_host ) const {
+            if ( !model().gpu_available ) return device::CPU;
+            return gpuTime( cost, N, on_device, out_on_host ) < cpuTime( cost, N, on_device ) ? device::GPU
+                                                                                              : device::CPU;
+        }
+
+        /*
+         * ==================================================================================================
+         * Function     : crossover
+         *
+         * Description  : Gets the smallest number of elements for which a function is run on the GPU (when
+         *                the inputs are on the host and the outputs are needed on the host), or 0 if the
+         *                function is always run on the CPU
+         *
+         * Inputs       : cost          : The cost of the function for each element
+         * ==================================================================================================
+         */
+        size_t crossover( const op_cost& cost ) const {
+            cost_model m = model();
+            if ( !m.gpu_available ) return 0;
+
+            // Both times are linear in N, so this is where the lines cross
+            double fixed_gpu    = cost.launches * m.launch_latency + 2.0 * m.copy_latency;
+            double per_elem_gpu = cost.work / m.gpu_throughput + cost.bytes_in / m.upload_bandwidth
+                                + cost.bytes_out / m.download_bandwidth;
+            double per_elem_cpu = cost.work / m.cpu_throughput;
+            if ( per_elem_cpu <= per_elem_gpu ) return 0;
+            return static_cast<size_t>( fixed_gpu / ( per_elem_cpu - per_elem_gpu ) ) + 1;
+        }
+};
+
+}   // Namespace frnn
+
+#endif
@@ -21,8 +21,16 @@
 #include <gtest/gtest.h>
 #include <iostream>
 #include <typeinfo>
+#include <cmath>
+#include <vector>
+#include <algorithm>
+#include <cstdlib>
+#include <string>
 
 #include "types.h"
+#include "profiler.cuh"
+#include "kernel_tuner.cuh"
+#include "../util/errors.h"
 
 /* 
  * =========================================== NOTES ========================================================
@@ -141,3 +149,209 @@ TEST( frnnTypesCpu, CanDetermineVectorizedCharFromChar ) {
     
     EXPECT_EQ( typeid( frnnVectorizedCpu ).name(), typeid( sseVectorizedCpu ).name() );
 }
+
+TEST( frnnTypesCpu, CanDetermineWiderVectorizedTypesForFloat ) {
+    frnn::VectorizedTypeCpu<float, frnn::AVX2>::vect_type   frnnVectorizedAvx2;
+    frnn::VectorizedTypeCpu<float, frnn::AVX512>::vect_type frnnVectorizedAvx512;
+    __m256 avxVectorizedCpu;
+    __m512 avx512VectorizedCpu;
+    
+    EXPECT_EQ( typeid( frnnVectorizedAvx2 ).name(), typeid( avxVectorizedCpu ).name() );
+    EXPECT_EQ( typeid( frnnVectorizedAvx512 ).name(), typeid( avx512VectorizedCpu ).name() );
+    EXPECT_EQ( ( frnn::VectorizedInstructionsCpu<float, frnn::AVX512>::width() ), 16 );
+}
+
+TEST( frnnTypesCpu, DetectsAnInstructionSetTheCpuSupports ) {
+    frnn::cpu_isa isa = frnn::cpuIsa();
+    
+    EXPECT_EQ( isa, frnn::detectCpuIsa() );
+    if ( isa == frnn::AVX512 ) EXPECT_TRUE( __builtin_cpu_supports( "avx512f" ) );
+    if ( isa == frnn::AVX2 )   EXPECT_TRUE( __builtin_cpu_supports( "avx2" ) );
+}
+
+// Kernel which computes the sum of exp of each element, and the max element, with the vectorized instructions
+struct expSumMaxKernel {
+    template <frnn::cpu_isa isa, typename dType>
+    FRNN_CPU_KERNEL static void run( const dType* x, size_t N, dType* exp_sum, dType* max ) {
+        typedef frnn::VectorizedInstructionsCpu<dType, isa> vect_ins;
+        
+        typename vect_ins::vect_type sum4 = vect_ins::set1( 0 ), max4 = vect_ins::load( x );
+        for ( size_t i = 0; i + vect_ins::width() <= N; i += vect_ins::width() ) {
+            sum4 = vect_ins::add( sum4, vect_ins::exp( vect_ins::load( x + i ) ) );
+            max4 = vect_ins::max( max4, vect_ins::load( x + i ) );
+        }
+        *exp_sum = vect_ins::sum( sum4 );
+        *max     = vect_ins::maxAll( max4 );
+    }
+};
+
+template <typename dType, frnn::cpu_isa isa>
+void checkExpSumMax( dType tolerance ) {
+    const size_t N = 64;
+    std::vector<dType> x( N );
+    dType expected_sum = 0, expected_max = -1000;
+    for ( size_t i = 0; i < N; i++ ) {
+        x[ i ]          = static_cast<dType>( ( static_cast<int>( i * 37 % 64 ) - 32 ) * 0.9 );
+        expected_sum   += std::exp( x[ i ] );
+        expected_max    = std::max( expected_max, x[ i ] );
+    }
+    
+    dType exp_sum, max;
+    frnn::CpuIsaEntry<isa>::template run<expSumMaxKernel>( static_cast<const dType*>( &x[ 0 ] ), N, 
+                                                           &exp_sum, &max );
+    
+    EXPECT_NEAR( exp_sum / expected_sum, dType( 1 ), tolerance );
+    EXPECT_EQ( max, expected_max );
+}
+
+TEST( frnnTypesCpu, VectorizedExpSumAndMaxAreCorrectForEachSupportedInstructionSet ) {
+    checkExpSumMax<float, frnn::SSE>( 1e-6f );
+    checkExpSumMax<double, frnn::SSE>( 1e-13 );
+    if ( frnn::cpuIsa() == frnn::AVX2 || frnn::cpuIsa() == frnn::AVX512 ) {
+        checkExpSumMax<float, frnn::AVX2>( 1e-6f );
+        checkExpSumMax<double, frnn::AVX2>( 1e-13 );
+    }
+    if ( frnn::cpuIsa() == frnn::AVX512 ) {
+        checkExpSumMax<float, frnn::AVX512>( 1e-6f );
+        checkExpSumMax<double, frnn::AVX512>( 1e-13 );
+    }
+}
+
+TEST( frnnTypesGpu, CanDetermineVectorizedHalfFromHalf ) {
+	frnn::VectorizedTypeGpu<__half, 1>::vect_type frnnHalf1;
+	frnn::VectorizedTypeGpu<__half, 2>::vect_type frnnHalf2;
+	frnn::VectorizedTypeGpu<__half, 4>::vect_type frnnHalf4;
+
+	EXPECT_EQ( typeid( __half ).name() , typeid( frnnHalf1 ).name() );
+	EXPECT_EQ( typeid( __half2 ).name(), typeid( frnnHalf2 ).name() );
+	EXPECT_EQ( typeid( half4 ).name()  , typeid( frnnHalf4 ).name() );
+	EXPECT_EQ( sizeof( half4 ), 4 * sizeof( __half ) );
+}
+
+TEST( frnnPrecision, HalfIsAccumulatedInFloats ) {
+	EXPECT_EQ( typeid( frnn::accumulate_type<__half>::type ).name(), typeid( float ).name() );
+	EXPECT_EQ( typeid( frnn::accumulate_type<double>::type ).name(), typeid( double ).name() );
+}
+
+TEST( frnnPrecision, LossScalerBacksOffOnOverflowAndGrowsAfterTheInterval ) {
+	frnn::LossScaler scaler( 1024.f, 3 );
+
+	// An overflow skips the update and halves the scale
+	EXPECT_FALSE( scaler.update( true ) );
+	EXPECT_EQ( scaler.scale(), 512.f );
+	EXPECT_EQ( scaler.skippedUpdates(), 1u );
+
+	// The scale doubles after 3 updates without an overflow
+	EXPECT_TRUE( scaler.update( false ) );
+	EXPECT_TRUE( scaler.update( false ) );
+	EXPECT_EQ( scaler.scale(), 512.f );
+	EXPECT_TRUE( scaler.update( false ) );
+	EXPECT_EQ( scaler.scale(), 1024.f );
+	EXPECT_EQ( scaler.inverseScale(), 1.f / 1024.f );
+
+	// The scale is never less than 1
+	for ( int i = 0; i < 20; i++ ) scaler.update( true );
+	EXPECT_EQ( scaler.scale(), 1.f );
+}
+
+TEST( frnnTypesGpu, CanDetermineVectorizedCharFromInt8 ) {
+	char4 cudaChar4;
+	frnn::VectorizedTypeGpu<int8_t, 4>::vect_type frnnInt84;
+
+	EXPECT_EQ( typeid( cudaChar4 ).name(), typeid( frnnInt84 ).name() );
+}
+
+TEST( frnnProfiler, OpsIncludeTheCountersOfTheOpsTheyCall ) {
+	frnn::prof::Profiler::global().reset();
+	{
+		frnn::prof::ScopedOp outer( "outerOp", 0, 0, false );
+		frnn::prof::countCopy( cudaMemcpyHostToDevice, 64 );
+		{
+			frnn::prof::ScopedOp inner( "innerOp", 0, 0, false );
+			frnn::prof::countCopy( cudaMemcpyDeviceToHost, 16 );
+			frnn::prof::countAlloc( 256 );
+			frnn::prof::countLaunch();
+		}
+	}
+	// Counts outside of an op aren't added to any op
+	frnn::prof::countLaunch();
+
+	frnn::prof::OpStats outer, inner;
+	ASSERT_TRUE( frnn::prof::Profiler::global().find( "outerOp", outer ) );
+	ASSERT_TRUE( frnn::prof::Profiler::global().find( "innerOp", inner ) );
+
+	EXPECT_EQ( outer.calls, 1u );
+	EXPECT_EQ( outer.counters.h2d_bytes, 64u );
+	EXPECT_EQ( outer.counters.d2h_bytes, 16u );
+	EXPECT_EQ( outer.counters.alloc_bytes, 256u );
+	EXPECT_EQ( outer.counters.launches, 1u );
+	EXPECT_EQ( inner.counters.h2d_bytes, 0u );
+	EXPECT_EQ( inner.counters.d2h_bytes, 16u );
+	EXPECT_EQ( inner.counters.allocations, 1u );
+	EXPECT_GE( outer.total_us, inner.total_us );
+	EXPECT_EQ( frnn::prof::Profiler::global().summary().size(), 2u );
+}
+
+TEST( frnnProfiler, OpsCountErrorsWhichHappenDuringTheOp ) {
+	frnn::prof::Profiler::global().reset();
+	frnn::frnnError error = frnn::frnnError();
+
+	{ frnn::prof::ScopedOp op( "checkedOp", &error, 0, false ); }
+	{
+		frnn::prof::ScopedOp op( "checkedOp", &error, 0, false );
+		frnn::err::copyError( error, "x" );
+	}
+	// The error was already set, so an op which doesn't change it has no error
+	{ frnn::prof::ScopedOp op( "checkedOp", &error, 0, false ); }
+
+	frnn::prof::OpStats stats;
+	ASSERT_TRUE( frnn::prof::Profiler::global().find( "checkedOp", stats ) );
+	EXPECT_EQ( stats.calls, 3u );
+	EXPECT_EQ( stats.errors, 1u );
+}
+
+TEST( frnnProfiler, PercentilesAreTheUpperEdgeOfTheirHistogramBucket ) {
+	frnn::prof::OpStats     stats;
+	frnn::prof::op_counters counters;
+
+	for ( int i = 0; i < 50; i++ ) stats.record( 1.5, counters, false );   // [1, 2) us
+	for ( int i = 0; i < 50; i++ ) stats.record( 300.0, counters, false ); // [256, 512) us
+
+	EXPECT_EQ( stats.histogram[ 1 ], 50u );
+	EXPECT_EQ( stats.histogram[ 9 ], 50u );
+	EXPECT_DOUBLE_EQ( stats.meanUs(), 150.75 );
+	EXPECT_DOUBLE_EQ( stats.min_us, 1.5 );
+	EXPECT_DOUBLE_EQ( stats.percentileUs( 50.0 ), 2.0 );
+	// The upper edge of the bucket is past the slowest call, so the slowest call is used
+	EXPECT_DOUBLE_EQ( stats.percentileUs( 99.0 ), 300.0 );
+}
+
+TEST( frnnKernelTuner, WinnersAreCachedForEachDeviceModelAndSizeBucket ) {
+	char directory[] = "/tmp/frnn_tuning_XXXXXX";
+	ASSERT_TRUE( mkdtemp( directory ) != 0 );
+	const std::string cache  = std::string( directory ) + "/nested";
+	const std::string volta  = frnn::KernelTuner::deviceModel( 0 );
+	const frnn::launch_config winner = { 512, 256, 2 };
+	{
+		frnn::KernelTuner tuner( frnn::tune_mode::TUNE, cache );
+		tuner.setConfig( volta, "reduce_sum_f", 1000, winner );
+	}
+
+	// A new tuner (another process) reads the winner from the cache
+	frnn::KernelTuner	tuner( frnn::tune_mode::CACHED, cache );
+	frnn::launch_config	config;
+	ASSERT_TRUE( tuner.find( volta, "reduce_sum_f", 1000, config ) );
+	EXPECT_TRUE( config == winner );
+
+	// Sizes in the same power of two bucket share it, other sizes and models don't
+	EXPECT_TRUE( tuner.find( volta, "reduce_sum_f", 513, config ) );
+	EXPECT_FALSE( tuner.find( volta, "reduce_sum_f", 1025, config ) );
+	EXPECT_FALSE( tuner.find( volta, "reduce_max_f", 1000, config ) );
+	EXPECT_FALSE( tuner.find( "NVIDIA_H100_sm90", "reduce_sum_f", 1000, config ) );
+	EXPECT_EQ( frnn::KernelTuner::sizeBucket( 1 ), 0u );
+	EXPECT_EQ( frnn::KernelTuner::sizeBucket( 1024 ), 10u );
+
+	std::remove( tuner.cachePath( volta ).c_str() );
+	std::remove( cache.c_str() );
+	std::remove( directory );
+}
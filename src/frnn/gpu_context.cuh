@@ -0,0 +1,476 @@
+/*
+ *  Header file for the fastRNN GPU context class. The context owns the long
+ *  lived GPU resources (cuBLAS handle, cuRAND generator, streams and scratch
+ *  memory) so that they are created once and reused by every GPU function,
+ *  rather than being created and destroyed on each call.
+ *
+ *  Copyright (C) 2015 Rob Clucas robclu1818@gmail.com
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published
+ *  by the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program; if not, write to the Free Software Foundation,
+ *  Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#ifndef _FRNN_GPU_CONTEXT_
+#define _FRNN_GPU_CONTEXT_
+
+#include <vector>
+
+#include "cuda_host.h"
+#include "types.h"
+#include "frnn.h"
+
+#ifdef FRNN_WITH_CUDA
+#include <cublas_v2.h>
+#include <curand.h>
+#include <cuda_fp16.h>
+
+#include "device_allocator.cuh"
+#endif
+
+namespace frnn {
+
+#ifdef FRNN_WITH_CUDA
+
+class GpuContext;
+
+/*
+ * ==========================================================================================================
+ * Struct       : GradientHook
+ *
+ * Description  : Is called by the GPU wba updates with the gradients of an update, on the device, before 
+ *                they are applied, so that they can be changed (for example all-reduced over the replicas of 
+ *                a layer for data parallel training, see NcclGradientReducer). The work must be queued so
+ *                that it finishes before the primary stream of the context continues.
+ * ==========================================================================================================
+ */
+struct GradientHook {
+    virtual ~GradientHook() {}
+    virtual void gradients( frnnError& error, GpuContext& context, float* gradients_d, size_t N )  = 0;
+    virtual void gradients( frnnError& error, GpuContext& context, double* gradients_d, size_t N ) = 0;
+    virtual void gradients( frnnError& error, GpuContext& context, __half* gradients_d, size_t N ) = 0;
+};
+
+/*
+ * ==========================================================================================================
+ * Class        : GpuContext
+ *
+ * Description  : Owns the GPU resources which are used by the frnn GPU functions. Creating a cuBLAS handle
+ *                or a cuRAND generator, and allocating device memory, are expensive operations (often more
+ *                expensive than the computation for the layer sizes used), so a context is created once and
+ *                then passed to each GPU function.
+ *
+ *                A context is for the device which is current when it's created, and makeCurrent must be
+ *                called before it's used from a thread where that device isn't current.
+ *
+ *                Scratch memory is managed in slots, where each slot is a device buffer which only grows. A
+ *                function asks for a slot with a number of elements, and if the slot is already big enough
+ *                the existing buffer is returned, so after the first (warm-up) call no more allocations are
+ *                made.
+ *
+ * Note         : A context is not thread safe, and the scratch buffers are only valid until the next call
+ *                which uses the same slot, so each host thread which calls GPU functions concurrently needs
+ *                its own context. Scratch buffers belong to the primary stream, so functions which use them
+ *                on other streams must join those streams back to the primary stream before returning.
+ * ==========================================================================================================
+ */
+class GpuContext {
+    private:
+        cublasHandle_t              blas_handle_;           // Handle for all cuBLAS calls
+        curandGenerator_t           rand_generator_;        // Generator for all cuRAND calls
+        std::vector<cudaStream_t>   streams_;               // Streams, stream 0 is the primary stream
+        std::vector<void*>          scratch_;               // Scratch buffers for each slot
+        std::vector<size_t>         scratch_bytes_;         // Size (in bytes) of each scratch buffer
+        std::vector<void*>          pinned_;                // Pinned host staging buffers for each slot
+        std::vector<size_t>         pinned_bytes_;          // Size (in bytes) of each staging buffer
+        std::vector<cudaEvent_t>    events_;                // Events for joining streams
+        DeviceAllocator*            allocator_;             // Allocator for the scratch buffers
+        GradientHook*               gradient_hook_;         // Hook for the gradients of the updates (or 0)
+        int                         device_;                // Device of the context
+        int                         multi_processors_;      // Number of multiprocessors of the device
+        size_t                      shared_per_block_;      // Bytes of shared memory a block can use
+        bool                        cooperative_launch_;    // If the device supports cooperative launches
+        size_t                      buffer_generation_;     // Number of (re)allocations of the buffers
+    public:
+        /*
+         * ==================================================================================================
+         * Function     : GpuContext
+         *
+         * Description  : Creates the cuBLAS handle, the cuRAND generator and the primary stream, and binds
+         *                the handle and the generator to the primary stream.
+         *
+         * Inputs       : seed      : The seed for the random number generator
+         *              : allocator : The allocator for the device memory of the context (which must outlive
+         *                            the context)
+         * ==================================================================================================
+         */
+        explicit GpuContext(unsigned long long  seed      = 1234ULL, 
+                            DeviceAllocator&    allocator = DeviceAllocator::global()) : 
+            streams_(1, 0), allocator_(&allocator), gradient_hook_(0), device_(0), multi_processors_(0), 
+            shared_per_block_(0), cooperative_launch_(false), buffer_generation_(0) {
+            cudaStreamCreate( &streams_[ 0 ] );
+
+            int shared = 0, cooperative = 0;
+            cudaGetDevice( &device_ );
+            cudaDeviceGetAttribute( &multi_processors_, cudaDevAttrMultiProcessorCount, device_ );
+            cudaDeviceGetAttribute( &shared, cudaDevAttrMaxSharedMemoryPerBlock, device_ );
+            cudaDeviceGetAttribute( &cooperative, cudaDevAttrCooperativeLaunch, device_ );
+            shared_per_block_   = static_cast<size_t>( shared );
+            cooperative_launch_ = cooperative != 0;
+
+            cublasCreate( &blas_handle_ );
+            cublasSetStream( blas_handle_, streams_[ 0 ] );
+
+            curandCreateGenerator( &rand_generator_, CURAND_RNG_PSEUDO_DEFAULT );
+            curandSetPseudoRandomGeneratorSeed( rand_generator_, seed );
+            curandSetStream( rand_generator_, streams_[ 0 ] );
+        }
+
+        /*
+         * ==================================================================================================
+         * Function     : ~GpuContext
+         *
+         * Description  : Releases all the resources owned by the context
+         * ==================================================================================================
+         */
+        ~GpuContext() {
+            synchronize();
+            for ( size_t i = 0; i < scratch_.size(); i++ ) allocator_->deallocate( scratch_[ i ] );
+            for ( size_t i = 0; i < pinned_.size(); i++ )  cudaFreeHost( pinned_[ i ] );
+            for ( size_t i = 0; i < events_.size(); i++ )  cudaEventDestroy( events_[ i ] );
+            curandDestroyGenerator( rand_generator_ );
+            cublasDestroy( blas_handle_ );
+            for ( size_t i = 0; i < streams_.size(); i++ ) cudaStreamDestroy( streams_[ i ] );
+        }
+
+        // The context owns the handles, so it can't be copied
+        GpuContext( const GpuContext& )             = delete;
+        GpuContext& operator=( const GpuContext& )  = delete;
+
+        /*
+         * ==================================================================================================
+         * Function     : global
+         *
+         * Description  : Gets a process wide context which is created on first use, for callers which do not
+         *                want to manage a context themselves.
+         *
+         * Outputs      : A reference to the process wide context
+         * ==================================================================================================
+         */
+        static GpuContext& global() {
+            static GpuContext context;
+            return context;
+        }
+
+        /*
+         * ==================================================================================================
+         * Function     : device
+         *
+         * Description  : Gets the device of the context
+         * ==================================================================================================
+         */
+        inline int device() const { return device_; }
+
+        /*
+         * ==================================================================================================
+         * Function     : makeCurrent
+         *
+         * Description  : Makes the device of the context the current device of the calling thread
+         * ==================================================================================================
+         */
+        inline void makeCurrent() const { cudaSetDevice( device_ ); }
+
+        /*
+         * ==================================================================================================
+         * Function     : gradientHook
+         *
+         * Description  : Gets or sets the hook which the GPU wba updates call with their gradients (see
+         *                GradientHook), 0 for no hook. The hook must outlive its use by the context.
+         * ==================================================================================================
+         */
+        inline GradientHook* gradientHook() const { return gradient_hook_; }
+        inline void setGradientHook( GradientHook* hook ) { gradient_hook_ = hook; }
+
+        /*
+         * ==================================================================================================
+         * Function     : blasHandle
+         *
+         * Description  : Gets the cuBLAS handle of the context (bound to the primary stream)
+         * ==================================================================================================
+         */
+        inline cublasHandle_t blasHandle() const { return blas_handle_; }
+
+        /*
+         * ==================================================================================================
+         * Function     : randGenerator
+         *
+         * Description  : Gets the cuRAND generator of the context (bound to the primary stream)
+         * ==================================================================================================
+         */
+        inline curandGenerator_t randGenerator() const { return rand_generator_; }
+
+        /*
+         * ==================================================================================================
+         * Function     : allocator
+         *
+         * Description  : Gets the allocator which the context uses for device memory
+         * ==================================================================================================
+         */
+        inline DeviceAllocator& allocator() const { return *allocator_; }
+
+        /*
+         * ==================================================================================================
+         * Function     : multiProcessors
+         *
+         * Description  : Gets the number of multiprocessors of the device of the context
+         * ==================================================================================================
+         */
+        inline size_t multiProcessors() const { return static_cast<size_t>( multi_processors_ ); }
+
+        /*
+         * ==================================================================================================
+         * Function     : cooperativeLaunch
+         *
+         * Description  : Gets if the device of the context supports cooperative launches, which a kernel
+         *                that syncs its whole grid needs
+         * ==================================================================================================
+         */
+        inline bool cooperativeLaunch() const { return cooperative_launch_; }
+
+        /*
+         * ==================================================================================================
+         * Function     : sharedMemoryPerBlock
+         *
+         * Description  : Gets the number of bytes of shared memory which a block can use on the device
+         * ==================================================================================================
+         */
+        inline size_t sharedMemoryPerBlock() const { return shared_per_block_; }
+
+        /*
+         * ==================================================================================================
+         * Function     : stream
+         *
+         * Description  : Gets stream i of the context, creating it (and any streams before it) if it does
+         *                not exist.
+         *
+         * Inputs       : i         : The index of the stream, 0 is the primary stream
+         * ==================================================================================================
+         */
+        inline cudaStream_t stream( size_t i = 0 ) {
+            while ( streams_.size() <= i ) {
+                cudaStream_t new_stream;
+                cudaStreamCreate( &new_stream );
+                streams_.push_back( new_stream );
+            }
+            return streams_[ i ];
+        }
+
+        /*
+         * ==================================================================================================
+         * Function     : numStreams
+         *
+         * Description  : Gets the number of streams which have been created by the context
+         * ==================================================================================================
+         */
+        inline size_t numStreams() const { return streams_.size(); }
+
+        /*
+         * ==================================================================================================
+         * Function     : event
+         *
+         * Description  : Gets event i of the context, creating it (and any events before it) if it does not
+         *                exist. The events don't record timing, so they are cheap to use for joining streams.
+         *
+         * Inputs       : i         : The index of the event
+         * ==================================================================================================
+         */
+        inline cudaEvent_t event( size_t i ) {
+            while ( events_.size() <= i ) {
+                cudaEvent_t new_event;
+                cudaEventCreateWithFlags( &new_event, cudaEventDisableTiming );
+                events_.push_back( new_event );
+            }
+            return events_[ i ];
+        }
+
+        /*
+         * ==================================================================================================
+         * Function     : scratch
+         *
+         * Description  : Gets a device buffer for a slot which can hold at least N elements, allocating
+         *                (or growing) the buffer only if the existing one is too small. Buffers come from the
+         *                allocator of the context, for the primary stream.
+         *
+         * Inputs       : error     : fastRNN error type for the result of the allocation
+         *              : slot      : The slot of the scratch buffer
+         *              : N         : The number of elements the buffer must be able to hold
+         *
+         * Outputs      : A pointer to the device buffer for the slot
+         *
+         * Params       : dType     : The type of data the buffer holds
+         * ==================================================================================================
+         */
+        template <typename dType>
+        dType* scratch( frnnError& error, size_t slot, size_t N ) {
+            if ( scratch_.size() <= slot ) {
+                scratch_.resize( slot + 1, 0 );
+                scratch_bytes_.resize( slot + 1, 0 );
+            }
+
+            size_t bytes = N * sizeof( dType );
+            if ( scratch_bytes_[ slot ] < bytes ) {
+                // The old data does not need to be kept, and the old block is only
+                // reused on the primary stream, so it can go back to the allocator
+                allocator_->deallocate( scratch_[ slot ] );
+                scratch_bytes_[ slot ] = 0;
+                buffer_generation_++;
+                scratch_[ slot ]       = allocator_->allocate( error, bytes, streams_[ 0 ] );
+                if ( scratch_[ slot ] == 0 ) return 0;
+                scratch_bytes_[ slot ] = DeviceAllocator::sizeClass( bytes );
+            }
+            return static_cast<dType*>( scratch_[ slot ] );
+        }
+
+        /*
+         * ==================================================================================================
+         * Function     : pinned
+         *
+         * Description  : Gets a pinned (page locked) host buffer for a slot which can hold at least N
+         *                elements. Copies between pinned memory and the device can be asynchronous, so data
+         *                is staged in these buffers for cudaMemcpyAsync. Like the scratch buffers, the pinned
+         *                buffers only grow.
+         *
+         * Inputs       : error     : fastRNN error type for the result of the allocation
+         *              : slot      : The slot of the staging buffer (separate from the scratch slots)
+         *              : N         : The number of elements the buffer must be able to hold
+         *
+         * Outputs      : A pointer to the pinned host buffer for the slot
+         *
+         * Params       : dType     : The type of data the buffer holds
+         * ==================================================================================================
+         */
+        template <typename dType>
+        dType* pinned( frnnError& error, size_t slot, size_t N ) {
+            if ( pinned_.size() <= slot ) {
+                pinned_.resize( slot + 1, 0 );
+                pinned_bytes_.resize( slot + 1, 0 );
+            }
+
+            size_t bytes = N * sizeof( dType );
+            if ( pinned_bytes_[ slot ] < bytes ) {
+                // Copies from the old buffer could still be queued
+                synchronize();
+                cudaFreeHost( pinned_[ slot ] );
+                pinned_bytes_[ slot ] = 0;
+                buffer_generation_++;
+                if ( cudaMallocHost( &pinned_[ slot ], bytes ) != cudaSuccess ) {
+                    frnn::err::allocError( error, stringify( pinned ) );
+                    pinned_[ slot ] = 0;
+                    return 0;
+                }
+                pinned_bytes_[ slot ] = bytes;
+            }
+            return static_cast<dType*>( pinned_[ slot ] );
+        }
+
+        /*
+         * ==================================================================================================
+         * Function     : reserveScratch
+         *
+         * Description  : Makes sure that the first num_slots slots exist, so that different host threads
+         *                can safely request different (existing) slots at the same time.
+         *
+         * Inputs       : num_slots : The number of slots to create
+         * ==================================================================================================
+         */
+        inline void reserveScratch( size_t num_slots ) {
+            if ( scratch_.size() < num_slots ) {
+                scratch_.resize( num_slots, 0 );
+                scratch_bytes_.resize( num_slots, 0 );
+            }
+        }
+
+        /*
+         * ==================================================================================================
+         * Function     : scratchBytes
+         *
+         * Description  : Gets the total number of bytes of device memory held by the scratch buffers
+         * ==================================================================================================
+         */
+        inline size_t scratchBytes() const {
+            size_t total = 0;
+            for ( size_t i = 0; i < scratch_bytes_.size(); i++ ) total += scratch_bytes_[ i ];
+            return total;
+        }
+
+        /*
+         * ==================================================================================================
+         * Function     : bufferGeneration
+         *
+         * Description  : Gets the number of times a scratch or staging buffer has been allocated (or grown),
+         *                so that work which holds the addresses of the buffers (a captured CUDA graph, see
+         *                cuda_graph.cuh) can tell when they have moved
+         * ==================================================================================================
+         */
+        inline size_t bufferGeneration() const { return buffer_generation_; }
+
+        /*
+         * ==================================================================================================
+         * Function     : synchronize
+         *
+         * Description  : Waits for all the work on all the streams of the context to finish
+         * ==================================================================================================
+         */
+        inline void synchronize() {
+            for ( size_t i = 0; i < streams_.size(); i++ ) cudaStreamSynchronize( streams_[ i ] );
+        }
+};
+
+#else
+
+/*
+ * ==========================================================================================================
+ * Class        : GpuContext
+ *
+ * Description  : The context of a CPU only build (without FRNN_WITH_CUDA, see cuda_host.h), which owns no
+ *                resources. Layers and networks take a context whichever device they are for, so this has
+ *                the parts of the interface which the host code uses : its only stream is the host (0), and
+ *                synchronizing does nothing, since the CPU functions return once their work is done.
+ * ==========================================================================================================
+ */
+class GpuContext {
+    public:
+        explicit GpuContext( unsigned long long /*seed*/ = 1234ULL ) {}
+
+        GpuContext( const GpuContext& )             = delete;
+        GpuContext& operator=( const GpuContext& )  = delete;
+
+        static GpuContext& global() {
+            static GpuContext context;
+            return context;
+        }
+
+        inline int device() const { return 0; }
+        inline void makeCurrent() const {}
+        inline cudaStream_t stream( size_t /*i*/ = 0 ) { return cudaStream_t( 0 ); }
+        inline size_t numStreams() const { return 1; }
+        inline size_t scratchBytes() const { return 0; }
+        inline size_t bufferGeneration() const { return 0; }
+        inline void synchronize() {}
+};
+
+#endif
+
+}   // Namespace frnn
+
+#endif
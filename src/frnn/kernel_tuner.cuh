@@ -0,0 +1,414 @@
+/*
+ *  Header file for the fastRNN kernel tuner, which benchmarks candidate
+ *  launch configurations (block size, grid size and vector width) of a
+ *  kernel for each device model and problem size, and caches the fastest
+ *  configuration on disk.
+ *
+ *  Copyright (C) 2015 Rob Clucas robclu1818@gmail.com
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published
+ *  by the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program; if not, write to the Free Software Foundation,
+ *  Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#ifndef _FRNN_KERNEL_TUNER_
+#define _FRNN_KERNEL_TUNER_
+
+#include <cuda_runtime.h>
+#include <sys/stat.h>
+
+#include <cctype>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <map>
+#include <mutex>
+#include <set>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "types.h"
+#include "gpu_context.cuh"
+#include "cuda_graph.cuh"
+
+/* ============================================= NOTES ======================================================
+ *
+ * 1. A kernel which is tuned gives the tuner its candidate launch configurations, with the default (the
+ *    configuration which was used before the kernel was tuned) first, and a function which queues the kernel
+ *    with a configuration. The configuration which is used is the one for the model of the device (its name
+ *    and compute capability, so a V100, an A100 and an H100 each have their own) and the size bucket of the
+ *    problem (the power of two which N rounds up to), so a few sizes cover every problem size.
+ *
+ * 2. In TUNE mode, a miss benchmarks the candidates: each one is queued once to warm up and then
+ *    TUNING_REPEATS times between two events, and the fastest is kept. The kernel must therefore give the
+ *    same results when it is run again on the same data (the reductions write their result, they don't
+ *    add to it). Misses while the stream is captured into a graph use the default, since nothing is run.
+ *    The candidates are benchmarked without holding the lock of the tuner, so other kernels (and other
+ *    threads) aren't held up for the length of the benchmark. The key of the kernel is marked as being tuned
+ *    while it is benchmarked, and other misses of the same key use the default until the winner is cached.
+ *
+ * 3. The winners of each device model are in a file of the cache directory (FRNN_TUNING_DIR, or
+ *    ~/.cache/frnn), one line for each kernel and size bucket, so they are only measured once for each
+ *    device model and are shared by the processes on machines with the same GPU. In CACHED mode (the
+ *    default) the winners in the cache are used, and misses use the default without benchmarking. In OFF
+ *    mode the default is always used. The mode comes from FRNN_AUTOTUNE (0 or off, 1 or tune), and can be
+ *    set with setMode.
+ *
+ * 4. The reductions are bitwise reproducible for a launch configuration (see reduce_kernels_gpu.cuh NOTES 1),
+ *    and a configuration which is in the cache never changes, so processes which use the same cache get the
+ *    same results. A different configuration can round differently.
+ *
+ * 5. Only kernels which give the same results when they are run again on the same data are tuned : the
+ *    reductions, randGpu, the broadcasts, sumVectorsGpu and softmaxColumnsGpu (the softmax of the samples of
+ *    a batch), see math_gpu.hpp NOTES 3. The kernels which change their inputs (the update of the weights,
+ *    the in place normalize of the stable softmax and the cells of the recurrent layers, which update the
+ *    state) would give wrong results when the candidates are benchmarked, and the persistent recurrent
+ *    kernel has a block for each SM, so they keep their fixed launch configurations.
+ *
+ * ==========================================================================================================
+ */
+
+namespace frnn {
+
+/*
+ * ==========================================================================================================
+ * Struct       : launch_config
+ *
+ * Description  : A launch configuration of a kernel
+ * ==========================================================================================================
+ */
+struct launch_config {
+    uint    threads;                // Threads of each block (a multiple of the warp size)
+    uint    blocks;                 // Max number of blocks of the grid
+    uint    width;                  // Number of elements of each vector load (1, 2 or 4)
+};
+
+inline bool operator==( const launch_config& a, const launch_config& b ) {
+    return a.threads == b.threads && a.blocks == b.blocks && a.width == b.width;
+}
+
+/*
+ * ==========================================================================================================
+ * Enum         : tune_mode
+ *
+ * Description  : When the tuner benchmarks the candidates of a kernel (see NOTES 3)
+ * ==========================================================================================================
+ */
+enum class tune_mode : unsigned char {
+    OFF     = 0,                    // Always use the default
+    CACHED  = 1,                    // Use the winners in the cache, and the default for misses
+    TUNE    = 2                     // Benchmark the candidates on a miss, and cache the winner
+};
+
+/*
+ * ==========================================================================================================
+ * Class        : KernelTuner
+ *
+ * Description  : Selects the launch configurations of kernels for each device model and size bucket, by
+ *                benchmarking the candidates and caching the winners on disk (see NOTES 1 - 4). The tuner is
+ *                thread safe.
+ * ==========================================================================================================
+ */
+class KernelTuner {
+    private:
+        typedef std::map<std::string, launch_config>    config_map;
+
+        std::map<std::string, config_map>   configs_;           // Winners of each device model
+        std::set<std::string>               loaded_;            // Device models which have been read
+        std::map<int, std::string>          models_;            // Model of each device
+        std::set<std::string>               tuning_;            // Keys which are being benchmarked
+        std::string                         directory_;         // Directory of the cache
+        tune_mode                           mode_;
+        mutable std::mutex                  mutex_;
+    public:
+        static constexpr int TUNING_REPEATS = 10;               // Launches which each candidate is timed for
+
+        /*
+         * ==================================================================================================
+         * Function     : KernelTuner
+         *
+         * Description  : Creates a tuner with a cache directory (which is read when a device model is first
+         *                used, and created when a winner is first written)
+         *
+         * Inputs       : mode      : When to benchmark (from FRNN_AUTOTUNE by default)
+         *              : directory : The directory of the cache (FRNN_TUNING_DIR or ~/.cache/frnn by default)
+         * ==================================================================================================
+         */
+        explicit KernelTuner( tune_mode mode = environmentMode(), const std::string& directory = environmentDirectory() ) :
+            directory_( directory ), mode_( mode ) {}
+
+        KernelTuner( const KernelTuner& )               = delete;
+        KernelTuner& operator=( const KernelTuner& )    = delete;
+
+        /*
+         * ==================================================================================================
+         * Function     : global
+         *
+         * Description  : Gets the process wide tuner, which the math functions use
+         * ==================================================================================================
+         */
+        static KernelTuner& global() {
+            static KernelTuner tuner;
+            return tuner;
+        }
+
+        /*
+         * ==================================================================================================
+         * Function     : sizeBucket
+         *
+         * Description  : Gets the size bucket of a problem, the power of two which N rounds up to
+         *
+         * Inputs       : N         : The size of the problem
+         * ==================================================================================================
+         */
+        static inline uint sizeBucket( size_t N ) {
+            uint bucket = 0;
+            while ( bucket < 63 && ( size_t( 1 ) << bucket ) < N ) bucket++;
+            return bucket;
+        }
+
+        /*
+         * ==================================================================================================
+         * Function     : deviceModel
+         *
+         * Description  : Gets the model of a device, its name and compute capability with everything which
+         *                isn't a letter or a digit as an underscore (so it can be a file name)
+         *
+         * Inputs       : device    : The device
+         * ==================================================================================================
+         */
+        static std::string deviceModel( int device ) {
+            cudaDeviceProp properties;
+            if ( cudaGetDeviceProperties( &properties, device ) != cudaSuccess ) return "unknown";
+
+            std::ostringstream model;
+            model << properties.name << "_sm" << properties.major << properties.minor;
+            std::string name = model.str();
+            for ( size_t i = 0; i < name.size(); i++ ) {
+                if ( !std::isalnum( static_cast<unsigned char>( name[ i ] ) ) ) name[ i ] = '_';
+            }
+            return name;
+        }
+
+        /*
+         * ==================================================================================================
+         * Function     : select
+         *
+         * Description  : Gets the launch configuration of a kernel for a problem on the device of a
+         *                context: the cached winner, or the winner of the candidates when they are
+         *                benchmarked (see NOTES 2), or otherwise the default (the first candidate). When the
+         *                candidates are benchmarked the kernel is run more than once on the buffers which the
+         *                launch uses, so the kernel must write the same results each time it is run on the
+         *                same data (it must not read what it writes, see NOTES 5).
+         *
+         * Inputs       : context       : The context which the kernel is run on
+         *              : kernel        : The name of the kernel (with its template arguments)
+         *              : N             : The size of the problem
+         *              : candidates    : The candidate configurations, the default first
+         *              : launch        : Queues the kernel on the primary stream of the context with a
+         *                                configuration
+         *
+         * Params       : Launch        : The type of launch (a callable which takes a launch_config)
+         * ==================================================================================================
+         */
+        template <typename Launch>
+        launch_config select( GpuContext& context, const std::string& kernel, size_t N,
+                              const std::vector<launch_config>& candidates, Launch&& launch ) {
+            if ( mode() == tune_mode::OFF || candidates.size() < 2 ) return candidates[ 0 ];
+
+            std::unique_lock<std::mutex> lock( mutex_ );
+            const std::string   model = modelLocked( context.device() );
+            const std::string   key   = configKey( kernel, N );
+            config_map&         found = configsLocked( model );
+
+            auto config = found.find( key );
+            if ( config != found.end() ) return config->second;
+            if ( mode_ != tune_mode::TUNE || capturing( context.stream() ) ) return candidates[ 0 ];
+
+            // Another thread is benchmarking the kernel for this model and size (see NOTES 2)
+            const std::string tuning = model + "/" + key;
+            if ( !tuning_.insert( tuning ).second ) return candidates[ 0 ];
+
+            lock.unlock();
+            const launch_config winner = benchmark( context, candidates, launch );
+            lock.lock();
+
+            tuning_.erase( tuning );
+            configsLocked( model )[ key ] = winner;
+            saveLocked( model );
+            return winner;
+        }
+
+        /*
+         * ==================================================================================================
+         * Function     : find / setConfig
+         *
+         * Description  : Gets and sets the winner of a kernel for a device model and a problem size (a
+         *                config which is set is written to the cache)
+         *
+         * Inputs       : model     : The device model (see deviceModel)
+         *              : kernel    : The name of the kernel
+         *              : N         : The size of the problem
+         *              : config    : The configuration to set
+         *
+         * Outputs      : config    : The configuration which was found (find returns false if there isn't one)
+         * ==================================================================================================
+         */
+        bool find( const std::string& model, const std::string& kernel, size_t N, launch_config& config ) {
+            std::lock_guard<std::mutex> lock( mutex_ );
+            config_map& found = configsLocked( model );
+            auto        entry = found.find( configKey( kernel, N ) );
+            if ( entry == found.end() ) return false;
+            config = entry->second;
+            return true;
+        }
+
+        void setConfig( const std::string& model, const std::string& kernel, size_t N, const launch_config& config ) {
+            std::lock_guard<std::mutex> lock( mutex_ );
+            configsLocked( model )[ configKey( kernel, N ) ] = config;
+            saveLocked( model );
+        }
+
+        // The path of the cache of a device model
+        inline std::string cachePath( const std::string& model ) const { return directory_ + "/" + model + ".tuning"; }
+
+        inline tune_mode mode() const {
+            std::lock_guard<std::mutex> lock( mutex_ );
+            return mode_;
+        }
+
+        void setMode( tune_mode mode ) {
+            std::lock_guard<std::mutex> lock( mutex_ );
+            mode_ = mode;
+        }
+
+        /*
+         * ==================================================================================================
+         * Function     : environmentMode / environmentDirectory
+         *
+         * Description  : Gets the mode and the directory of the cache from the environment (see NOTES 3)
+         * ==================================================================================================
+         */
+        static tune_mode environmentMode() {
+            const char* value = std::getenv( "FRNN_AUTOTUNE" );
+            if ( value == 0 ) return tune_mode::CACHED;
+            const std::string mode( value );
+            if ( mode == "0" || mode == "off" )  return tune_mode::OFF;
+            if ( mode == "1" || mode == "tune" ) return tune_mode::TUNE;
+            return tune_mode::CACHED;
+        }
+
+        static std::string environmentDirectory() {
+            const char* directory = std::getenv( "FRNN_TUNING_DIR" );
+            if ( directory != 0 && directory[ 0 ] != '\0' ) return directory;
+            const char* home = std::getenv( "HOME" );
+            return home != 0 ? std::string( home ) + "/.cache/frnn" : std::string( ".frnn" );
+        }
+
+    private:
+        static inline std::string configKey( const std::string& kernel, size_t N ) {
+            std::ostringstream key;
+            key << kernel << "@" << sizeBucket( N );
+            return key.str();
+        }
+
+        const std::string& modelLocked( int device ) {
+            auto model = models_.find( device );
+            if ( model == models_.end() ) model = models_.insert( std::make_pair( device, deviceModel( device ) ) ).first;
+            return model->second;
+        }
+
+        // The winners of a model, which are read from the cache the first time
+        config_map& configsLocked( const std::string& model ) {
+            config_map& configs = configs_[ model ];
+            if ( loaded_.insert( model ).second ) {
+                std::ifstream file( cachePath( model ).c_str() );
+                std::string   line;
+                while ( std::getline( file, line ) ) {
+                    if ( line.empty() || line[ 0 ] == '#' ) continue;
+                    std::istringstream  entry( line );
+                    std::string         key;
+                    launch_config       config;
+                    if ( entry >> key >> config.threads >> config.blocks >> config.width ) {
+                        // Winners which were set in this process are newer
+                        configs.insert( std::make_pair( key, config ) );
+                    }
+                }
+            }
+            return configs;
+        }
+
+        // Writes the winners of a model to a temporary file which replaces the cache, so readers in other
+        // processes never see a partial file
+        void saveLocked( const std::string& model ) {
+            makeDirectories( directory_ );
+            const std::string path = cachePath( model ), temporary = path + ".tmp";
+            {
+                std::ofstream file( temporary.c_str() );
+                if ( !file ) return;
+                file << "# fastRNN kernel tuning for " << model << " : kernel@bucket threads blocks width\n";
+                for ( auto& config : configs_[ model ] ) {
+                    file << config.first << " " << config.second.threads << " " << config.second.blocks << " "
+                         << config.second.width << "\n";
+                }
+            }
+            std::rename( temporary.c_str(), path.c_str() );
+        }
+
+        static void makeDirectories( const std::string& directory ) {
+            for ( size_t end = directory.find( '/', 1 ); ; end = directory.find( '/', end + 1 ) ) {
+                mkdir( directory.substr( 0, end ).c_str(), 0755 );
+                if ( end == std::string::npos ) break;
+            }
+        }
+
+        // Times each candidate, and gets the fastest (see NOTES 2)
+        template <typename Launch>
+        static launch_config benchmark( GpuContext& context, const std::vector<launch_config>& candidates,
+                                        Launch& launch ) {
+            cudaStream_t    stream = context.stream();
+            cudaEvent_t     start, stop;
+            launch_config   winner = candidates[ 0 ];
+            float           best   = 0.f;
+            bool            timed  = false;
+            cudaEventCreate( &start );
+            cudaEventCreate( &stop );
+
+            for ( size_t c = 0; c < candidates.size(); c++ ) {
+                float elapsed = 0.f;
+                cudaGetLastError();
+                launch( candidates[ c ] );
+                // A candidate which the kernel can't be launched with (too many registers for the block) is skipped
+                if ( cudaGetLastError() != cudaSuccess ) continue;
+
+                cudaEventRecord( start, stream );
+                for ( int repeat = 0; repeat < TUNING_REPEATS; repeat++ ) launch( candidates[ c ] );
+                cudaEventRecord( stop, stream );
+                cudaEventSynchronize( stop );
+                if ( cudaEventElapsedTime( &elapsed, start, stop ) != cudaSuccess ) continue;
+                if ( !timed || elapsed < best ) {
+                    timed  = true;
+                    best   = elapsed;
+                    winner = candidates[ c ];
+                }
+            }
+            cudaEventDestroy( start );
+            cudaEventDestroy( stop );
+            return winner;
+        }
+};
+
+}   // Namespace frnn
+
+#endif
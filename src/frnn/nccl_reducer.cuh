@@ -0,0 +1,144 @@
+/*
+ *  Header file for the fastRNN NCCL gradient reducer, a gradient hook which
+ *  all-reduces the gradients of the updates of the replicas of a layer, for
+ *  data parallel training on multiple GPUs.
+ *
+ *  Copyright (C) 2015 Rob Clucas robclu1818@gmail.com
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published
+ *  by the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program; if not, write to the Free Software Foundation,
+ *  Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#ifndef _FRNN_NCCL_REDUCER_
+#define _FRNN_NCCL_REDUCER_
+
+#include <cuda_runtime.h>
+#include <nccl.h>
+
+#include <algorithm>
+
+#include "../util/errors.h"
+#include "gpu_context.cuh"
+
+// ncclAvg (which the gradients are reduced with) needs NCCL 2.10
+#if NCCL_VERSION_CODE < NCCL_VERSION( 2, 10, 0 )
+#error "The NCCL gradient reducer needs NCCL 2.10 or later"
+#endif
+
+/* ============================================= NOTES ======================================================
+ *
+ * 1. Each replica of a layer computes the gradients of its shard of the batch, and the reducer of the
+ *    replica replaces them with their average over the replicas, so each replica applies the gradients of
+ *    the whole batch (when the shards are the same size) and the replicas stay the same.
+ *
+ * 2. The gradients are reduced in buckets of at most bucket_bytes, which are all launched in one NCCL group
+ *    on the communication stream (stream 1 of the context), after the work on the primary stream which
+ *    computes the gradients. The primary stream then waits for the reductions, so the update sees the
+ *    averages, but the host doesn't wait, and the other replicas (each on its own thread) keep queueing work.
+ *
+ * ==========================================================================================================
+ */
+
+namespace frnn {
+
+const size_t NCCL_BUCKET_BYTES = 1 << 22;           // Default size of a bucket of gradients (4MB)
+
+/*
+ * ==========================================================================================================
+ * Struct       : nccl_data_type
+ *
+ * Description  : Gets the NCCL type of dType
+ *
+ * Params       : dType     : The type of the elements
+ * ==========================================================================================================
+ */
+template <typename dType> struct nccl_data_type;
+template <> struct nccl_data_type<float>  { static constexpr ncclDataType_t value = ncclFloat;  };
+template <> struct nccl_data_type<double> { static constexpr ncclDataType_t value = ncclDouble; };
+template <> struct nccl_data_type<__half> { static constexpr ncclDataType_t value = ncclHalf;   };
+
+/*
+ * ==========================================================================================================
+ * Class        : NcclGradientReducer
+ *
+ * Description  : Gradient hook which averages the gradients of an update over the ranks of a communicator
+ *                (see NOTES 1 - 2)
+ * ==========================================================================================================
+ */
+class NcclGradientReducer : public GradientHook {
+    private:
+        ncclComm_t      comm_;              // Communicator of the replicas (not owned)
+        size_t          bucket_bytes_;      // Max bytes of each reduction
+        size_t          num_buckets_;       // Buckets which have been reduced (for the tests and profiling)
+
+    public:
+        /*
+         * ==================================================================================================
+         * Function     : NcclGradientReducer
+         *
+         * Description  : Sets the communicator of the replicas and the size of the buckets
+         *
+         * Inputs       : comm          : The rank of the communicator for the device of the replica, which
+         *                                must outlive the reducer
+         *              : bucket_bytes  : The max number of bytes of each reduction
+         * ==================================================================================================
+         */
+        explicit NcclGradientReducer( ncclComm_t comm, size_t bucket_bytes = NCCL_BUCKET_BYTES ) :
+            comm_( comm ), bucket_bytes_( std::max( bucket_bytes, size_t( 1 ) ) ), num_buckets_( 0 ) {}
+
+        inline size_t bucketBytes() const { return bucket_bytes_; }
+        inline size_t numBuckets() const { return num_buckets_; }
+
+        void gradients( frnnError& error, GpuContext& context, float* gradients_d, size_t N ) {
+            reduce( error, context, gradients_d, N );
+        }
+        void gradients( frnnError& error, GpuContext& context, double* gradients_d, size_t N ) {
+            reduce( error, context, gradients_d, N );
+        }
+        void gradients( frnnError& error, GpuContext& context, __half* gradients_d, size_t N ) {
+            reduce( error, context, gradients_d, N );
+        }
+
+    private:
+        template <typename dType>
+        void reduce( frnnError& error, GpuContext& context, dType* gradients_d, size_t N ) {
+            if ( N == 0 ) return;
+
+            cudaStream_t    primary = context.stream();
+            cudaStream_t    comm    = context.stream( 1 );
+            const size_t    bucket  = std::max( bucket_bytes_ / sizeof( dType ), size_t( 1 ) );
+
+            // The reductions start after the gradients are computed
+            cudaEventRecord( context.event( 0 ), primary );
+            cudaStreamWaitEvent( comm, context.event( 0 ), 0 );
+
+            ncclGroupStart();
+            for ( size_t first = 0; first < N; first += bucket ) {
+                if ( ncclAllReduce( gradients_d + first, gradients_d + first, std::min( bucket, N - first ),
+                                    nccl_data_type<dType>::value, ncclAvg, comm_, comm ) != ncclSuccess ) {
+                    frnn::err::copyError( error, stringify( gradients_d ) );
+                }
+                num_buckets_++;
+            }
+            if ( ncclGroupEnd() != ncclSuccess ) frnn::err::copyError( error, stringify( gradients_d ) );
+
+            // The update waits for the averages
+            cudaEventRecord( context.event( 1 ), comm );
+            cudaStreamWaitEvent( primary, context.event( 1 ), 0 );
+        }
+};
+
+}   // Namespace frnn
+
+#endif
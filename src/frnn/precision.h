@@ -0,0 +1,163 @@
+/*
+ *  Header file for fastRNN reduced precision types, the accumulation types
+ *  which are used for them, and the loss scaling of the gradients.
+ *
+ *  Copyright (C) 2015 Rob Clucas robclu1818@gmail.com
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published
+ *  by the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program; if not, write to the Free Software Foundation,
+ *  Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#ifndef _FRNN_PRECISION_
+#define _FRNN_PRECISION_
+
+#include "cuda_host.h"
+
+#ifdef FRNN_WITH_CUDA
+#include <library_types.h>
+#include <cuda_fp16.h>
+
+// bfloat16 (and the compute types of cublasGemmEx) need CUDA 11
+#if CUDART_VERSION >= 11000
+#include <cuda_bf16.h>
+#define FRNN_BF16
+#endif
+#endif
+
+#include <cstddef>
+
+/* ============================================= NOTES ======================================================
+ *
+ * 1. Half (__half) and bfloat16 (__nv_bfloat16) are storage types : tensors of them use half the memory (and
+ *    the bandwidth) of floats, but the sums of the gemms and the reductions are done in floats (their
+ *    accumulate_type), and the results are rounded to the storage type once at the end.
+ *
+ * 2. Small gradients are 0 in half precision, so the loss (or the errors of the output layer) is multiplied
+ *    by a scale before the backward pass, and the update divides the gradients by the scale. LossScaler
+ *    changes the scale dynamically : when a gradient is inf or nan the update is skipped and the scale is
+ *    reduced, and after growth_interval updates without one the scale is increased.
+ *
+ * 3. The reduced precision types and the CUDA library types are only in GPU builds (with FRNN_WITH_CUDA),
+ *    the LossScaler is in both.
+ *
+ * ==========================================================================================================
+ */
+
+namespace frnn {
+
+/*
+ * ==========================================================================================================
+ * Struct       : accumulate_type
+ *
+ * Description  : Gets the type which sums of elements of dType are accumulated in (see NOTES 1)
+ *
+ * Params       : dType     : The type of the elements
+ * ==========================================================================================================
+ */
+template <typename dType> struct accumulate_type { typedef dType type; };
+#ifdef FRNN_WITH_CUDA
+template <> struct accumulate_type<__half> { typedef float type; };
+#ifdef FRNN_BF16
+template <> struct accumulate_type<__nv_bfloat16> { typedef float type; };
+#endif
+#endif
+
+/*
+ * ==========================================================================================================
+ * Struct       : cuda_data_type
+ *
+ * Description  : Gets the CUDA library type of dType, for the Ex versions of the cuBLAS functions
+ *
+ * Params       : dType     : The type of the elements
+ * ==========================================================================================================
+ */
+#ifdef FRNN_WITH_CUDA
+template <typename dType> struct cuda_data_type;
+template <> struct cuda_data_type<float>  { static constexpr cudaDataType_t value = CUDA_R_32F; };
+template <> struct cuda_data_type<double> { static constexpr cudaDataType_t value = CUDA_R_64F; };
+template <> struct cuda_data_type<__half> { static constexpr cudaDataType_t value = CUDA_R_16F; };
+#ifdef FRNN_BF16
+template <> struct cuda_data_type<__nv_bfloat16> { static constexpr cudaDataType_t value = CUDA_R_16BF; };
+#endif
+#endif
+
+/*
+ * ==========================================================================================================
+ * Class        : LossScaler
+ *
+ * Description  : Dynamic loss scale for reduced precision training (see NOTES 2)
+ * ==========================================================================================================
+ */
+class LossScaler {
+    private:
+        float       scale_;                 // The scale of the loss
+        float       growth_;                // Factor to increase the scale by
+        float       backoff_;               // Factor to decrease the scale by
+        size_t      growth_interval_;       // Updates without an overflow before the scale is increased
+        size_t      good_updates_;          // Updates without an overflow since the scale was changed
+        size_t      skipped_updates_;       // Updates which were skipped because of an overflow
+
+    public:
+        /*
+         * ==================================================================================================
+         * Function     : LossScaler
+         *
+         * Description  : Sets the initial scale and how it changes
+         *
+         * Inputs       : initial_scale     : The scale to start with
+         *              : growth_interval   : The number of updates without an overflow before the scale is
+         *                                    increased
+         *              : growth            : The factor to increase the scale by
+         *              : backoff           : The factor to decrease the scale by after an overflow
+         * ==================================================================================================
+         */
+        explicit LossScaler(float initial_scale = 65536.f, size_t growth_interval = 2000, float growth = 2.f,
+                            float backoff = 0.5f) :
+            scale_(initial_scale), growth_(growth), backoff_(backoff), growth_interval_(growth_interval),
+            good_updates_(0), skipped_updates_(0) {}
+
+        inline float scale() const { return scale_; }
+        inline float inverseScale() const { return 1.f / scale_; }
+        inline size_t skippedUpdates() const { return skipped_updates_; }
+
+        /*
+         * ==================================================================================================
+         * Function     : update
+         *
+         * Description  : Changes the scale after the gradients of an update have been checked, the scale is
+         *                never less than 1
+         *
+         * Inputs       : overflow  : If any of the gradients were inf or nan
+         *
+         * Outputs      : If the update must be applied (it must be skipped if there was an overflow)
+         * ==================================================================================================
+         */
+        bool update(bool overflow) {
+            if (overflow) {
+                scale_        = scale_ * backoff_ < 1.f ? 1.f : scale_ * backoff_;
+                good_updates_ = 0;
+                skipped_updates_++;
+                return false;
+            }
+            if (++good_updates_ >= growth_interval_) {
+                scale_       *= growth_;
+                good_updates_ = 0;
+            }
+            return true;
+        }
+};
+
+}   // Namespace frnn
+
+#endif
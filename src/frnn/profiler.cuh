@@ -0,0 +1,548 @@
+/*
+ *  Header file for the fastRNN profiler, which puts NVTX ranges around the
+ *  math functions and the layer passes, and records the time and the
+ *  copies, allocations and launches of each of them, so that a summary of
+ *  each op can be read without running a profiler.
+ *
+ *  Copyright (C) 2015 Rob Clucas robclu1818@gmail.com
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published
+ *  by the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program; if not, write to the Free Software Foundation,
+ *  Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#ifndef _FRNN_PROFILER_
+#define _FRNN_PROFILER_
+
+#ifdef FRNN_WITH_PROFILER
+#include <nvtx3/nvToolsExt.h>
+#endif
+
+#include <algorithm>
+#include <chrono>
+#include <deque>
+#include <iomanip>
+#include <map>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <vector>
+
+#include "cuda_host.h"
+#include "types.h"
+
+/* ============================================= NOTES ======================================================
+ *
+ * 1. The profiler is opt in. With FRNN_WITH_PROFILER defined the FRNN_PROFILE_* macros make a ScopedOp for
+ *    each math function and for each forward, backward and update of a layer, and the FRNN_COUNT_* macros
+ *    add to the counters of the ops, otherwise the macros are empty, so there is no cost. The Profiler is
+ *    always there, so code which reads the summary builds either way (and the summary is then empty).
+ *
+ * 2. A ScopedOp pushes an NVTX range with the name of the op for its scope, so the ops show up in Nsight
+ *    Systems. Ops on the GPU record an event on their stream at the start and the end, and the events aren't
+ *    waited on: the op is pending until its end event is done, which is checked (without blocking) when each
+ *    op ends, and waited for when the summary is read. The time of a GPU op is the GPU time between the
+ *    events, so work of the op on other streams is only included once it is joined back to the stream (which
+ *    all the GPU functions do before they return). Ops on the host are timed with the host clock.
+ *
+ * 3. The counters (bytes copied in each direction, device allocations and their bytes, and kernel launches)
+ *    are added to every op on the stack of the thread, so an op includes the counters of the ops it calls,
+ *    like its time does. Copies are counted by frnn::prof::memcpy and memcpyAsync, allocations where the
+ *    DeviceAllocator calls cudaMalloc, and launches at the launch sites of the frnn kernels. The kernels of
+ *    cuBLAS are in the time of the op which calls them, but aren't counted as launches.
+ *
+ * 4. The latency histogram of an op has a bucket for each power of two microseconds: bucket 0 is below
+ *    1 us, bucket b is [2^(b - 1), 2^b) us, and the last bucket has everything above it. Percentiles are
+ *    the upper edge of the bucket they fall in, so they are within a factor of two.
+ *
+ * 5. An op counts an error if the frnnError it was given was changed during the op, so errors which the
+ *    caller doesn't check still show up in the summary.
+ *
+ * 6. Ops on a stream which is being captured into a CUDA graph (see cuda_graph.cuh) aren't run, so they are
+ *    not recorded (and no events are recorded on the stream, since they would be part of the graph), and
+ *    only their NVTX range is kept. The replays of the graph are the ops of the graph.
+ *
+ * 7. Without FRNN_WITH_CUDA (see cuda_host.h) there are no events, so every op is timed on the host, and
+ *    there are no copies to count.
+ *
+ * ==========================================================================================================
+ */
+
+namespace frnn {
+namespace prof {
+
+const size_t HISTOGRAM_BUCKETS = 32;        // Power of two microsecond buckets (see NOTES 4)
+
+/*
+ * ==========================================================================================================
+ * Struct       : op_counters
+ *
+ * Description  : The counters of an op (see NOTES 3)
+ * ==========================================================================================================
+ */
+struct op_counters {
+    size_t      h2d_bytes;                  // Bytes copied from the host to the device
+    size_t      d2h_bytes;                  // Bytes copied from the device to the host
+    size_t      d2d_bytes;                  // Bytes copied on the device
+    size_t      allocations;                // Number of cudaMallocs
+    size_t      alloc_bytes;                // Bytes of the cudaMallocs
+    size_t      launches;                   // Number of frnn kernel launches
+
+    op_counters() : h2d_bytes(0), d2h_bytes(0), d2d_bytes(0), allocations(0), alloc_bytes(0), launches(0) {}
+
+    inline void add(const op_counters& other) {
+        h2d_bytes   += other.h2d_bytes;
+        d2h_bytes   += other.d2h_bytes;
+        d2d_bytes   += other.d2d_bytes;
+        allocations += other.allocations;
+        alloc_bytes += other.alloc_bytes;
+        launches    += other.launches;
+    }
+};
+
+/*
+ * ==========================================================================================================
+ * Struct       : OpStats
+ *
+ * Description  : The summary of all the calls of an op
+ * ==========================================================================================================
+ */
+struct OpStats {
+    std::string     name;                               // Name of the op
+    size_t          calls;                              // Number of calls
+    size_t          errors;                             // Number of calls which had an error (see NOTES 5)
+    double          total_us;                           // Total time of the calls
+    double          min_us;                             // Time of the fastest call
+    double          max_us;                             // Time of the slowest call
+    op_counters     counters;                           // Total counters of the calls
+    size_t          histogram[HISTOGRAM_BUCKETS];       // Number of calls in each bucket (see NOTES 4)
+
+    OpStats() : calls(0), errors(0), total_us(0.0), min_us(0.0), max_us(0.0) {
+        std::fill(histogram, histogram + HISTOGRAM_BUCKETS, size_t(0));
+    }
+
+    inline double meanUs() const { return calls == 0 ? 0.0 : total_us / calls; }
+
+    /*
+     * ======================================================================================================
+     * Function     : percentileUs
+     *
+     * Description  : Gets an estimate of a percentile of the time of the calls (see NOTES 4)
+     *
+     * Inputs       : p     : The percentile, in [0, 100]
+     * ======================================================================================================
+     */
+    double percentileUs(double p) const {
+        const double rank  = p / 100.0 * calls;
+        size_t       count = 0;
+        for (size_t b = 0; b < HISTOGRAM_BUCKETS; b++) {
+            count += histogram[b];
+            if (count > 0 && count >= rank) return std::min(static_cast<double>(size_t(1) << b), max_us);
+        }
+        return max_us;
+    }
+
+    /*
+     * ======================================================================================================
+     * Function     : record
+     *
+     * Description  : Adds a call to the summary
+     *
+     * Inputs       : us        : The time of the call in microseconds
+     *              : op        : The counters of the call
+     *              : failed    : If the call had an error
+     * ======================================================================================================
+     */
+    void record(double us, const op_counters& op, bool failed) {
+        min_us    = calls == 0 ? us : std::min(min_us, us);
+        max_us    = std::max(max_us, us);
+        total_us += us;
+        calls++;
+        if (failed) errors++;
+        counters.add(op);
+
+        size_t bucket = 0;
+        while (bucket < HISTOGRAM_BUCKETS - 1 && us >= static_cast<double>(size_t(1) << bucket)) bucket++;
+        histogram[bucket]++;
+    }
+};
+
+/*
+ * ==========================================================================================================
+ * Class        : Profiler
+ *
+ * Description  : Keeps the summary of each op, and the GPU ops which are waiting for their events (see
+ *                NOTES 2). The process wide profiler is used by all the ops, and is thread safe.
+ * ==========================================================================================================
+ */
+class Profiler {
+    private:
+        struct pending_op {
+            const char*     name;
+            int             device;
+            cudaEvent_t     start;
+            cudaEvent_t     end;
+            op_counters     counters;
+            bool            failed;
+        };
+
+        std::mutex                                  mutex_;
+        std::map<std::string, OpStats>              stats_;         // Summary of each op, by name
+        std::deque<pending_op>                      pending_;       // GPU ops in the order they ended
+        std::map<int, std::vector<cudaEvent_t>>     free_events_;   // Events to reuse, for each device
+
+    public:
+        Profiler() {}
+
+        ~Profiler() {
+#ifdef FRNN_WITH_CUDA
+            for (auto& pending : pending_) {
+                cudaEventDestroy(pending.start);
+                cudaEventDestroy(pending.end);
+            }
+            for (auto& events : free_events_) {
+                for (cudaEvent_t event : events.second) cudaEventDestroy(event);
+            }
+#endif
+        }
+
+        Profiler(const Profiler&)             = delete;
+        Profiler& operator=(const Profiler&)   = delete;
+
+        /*
+         * ==================================================================================================
+         * Function     : global
+         *
+         * Description  : Gets the process wide profiler
+         * ==================================================================================================
+         */
+        static Profiler& global() {
+            static Profiler profiler;
+            return profiler;
+        }
+
+#ifdef FRNN_WITH_CUDA
+        /*
+         * ==================================================================================================
+         * Function     : acquireEvent
+         *
+         * Description  : Gets an event for the current device, which is reused once its op is resolved
+         *
+         * Inputs       : device    : The current device
+         * ==================================================================================================
+         */
+        cudaEvent_t acquireEvent(int device) {
+            std::lock_guard<std::mutex> lock(mutex_);
+            std::vector<cudaEvent_t>&   events = free_events_[device];
+            cudaEvent_t                 event  = 0;
+            if (events.empty()) {
+                cudaEventCreate(&event);
+            } else {
+                event = events.back();
+                events.pop_back();
+            }
+            return event;
+        }
+
+        /*
+         * ==================================================================================================
+         * Function     : endGpuOp
+         *
+         * Description  : Adds a GPU op which has been queued, and resolves the ops which are done
+         * ==================================================================================================
+         */
+        void endGpuOp(const char* name, int device, cudaEvent_t start, cudaEvent_t end,
+                      const op_counters& counters, bool failed) {
+            std::lock_guard<std::mutex> lock(mutex_);
+            pending_op                  op = { name, device, start, end, counters, failed };
+            pending_.push_back(op);
+            resolveLocked(false);
+        }
+#endif
+
+        /*
+         * ==================================================================================================
+         * Function     : endHostOp
+         *
+         * Description  : Adds an op which ran on the host
+         * ==================================================================================================
+         */
+        void endHostOp(const char* name, double us, const op_counters& counters, bool failed) {
+            std::lock_guard<std::mutex> lock(mutex_);
+            stats_[name].record(us, counters, failed);
+        }
+
+        /*
+         * ==================================================================================================
+         * Function     : summary
+         *
+         * Description  : Gets the summary of each op (by name), after waiting for the pending GPU ops
+         * ==================================================================================================
+         */
+        std::vector<OpStats> summary() {
+            std::lock_guard<std::mutex> lock(mutex_);
+            std::vector<OpStats>        ops;
+            resolveLocked(true);
+            for (auto& op : stats_) {
+                ops.push_back(op.second);
+                ops.back().name = op.first;
+            }
+            return ops;
+        }
+
+        /*
+         * ==================================================================================================
+         * Function     : find
+         *
+         * Description  : Gets the summary of an op, after waiting for the pending GPU ops
+         *
+         * Inputs       : name      : The name of the op
+         *
+         * Outputs      : stats     : The summary of the op (if there have been calls of it)
+         * ==================================================================================================
+         */
+        bool find(const std::string& name, OpStats& stats) {
+            std::lock_guard<std::mutex> lock(mutex_);
+            resolveLocked(true);
+            auto op = stats_.find(name);
+            if (op == stats_.end()) return false;
+            stats       = op->second;
+            stats.name  = name;
+            return true;
+        }
+
+        /*
+         * ==================================================================================================
+         * Function     : reset
+         *
+         * Description  : Clears the summaries (after waiting for the pending GPU ops)
+         * ==================================================================================================
+         */
+        void reset() {
+            std::lock_guard<std::mutex> lock(mutex_);
+            resolveLocked(true);
+            stats_.clear();
+        }
+
+        /*
+         * ==================================================================================================
+         * Function     : print
+         *
+         * Description  : Prints a table of the summary of each op
+         *
+         * Inputs       : out   : The stream to print to
+         * ==================================================================================================
+         */
+        void print(std::ostream& out) {
+            out << std::left  << std::setw(28) << "op"    << std::right << std::setw(10) << "calls"
+                << std::setw(12) << "mean us" << std::setw(12) << "p50 us"   << std::setw(12) << "p99 us"
+                << std::setw(14) << "H2D bytes"  << std::setw(14) << "D2H bytes" << std::setw(8) << "allocs"
+                << std::setw(10) << "launches" << std::setw(8) << "errors" << "\n";
+            for (const OpStats& op : summary()) {
+                out << std::left  << std::setw(28) << op.name << std::right << std::setw(10) << op.calls
+                    << std::setw(12) << op.meanUs() << std::setw(12) << op.percentileUs(50.0)
+                    << std::setw(12) << op.percentileUs(99.0) << std::setw(14) << op.counters.h2d_bytes
+                    << std::setw(14) << op.counters.d2h_bytes << std::setw(8) << op.counters.allocations
+                    << std::setw(10) << op.counters.launches << std::setw(8) << op.errors << "\n";
+            }
+        }
+
+    private:
+        // Resolves the pending ops in order, stopping at the first which isn't done unless wait is set
+        void resolveLocked(bool wait) {
+#ifdef FRNN_WITH_CUDA
+            while (!pending_.empty()) {
+                pending_op& op = pending_.front();
+                if (wait) {
+                    cudaEventSynchronize(op.end);
+                } else if (cudaEventQuery(op.end) != cudaSuccess) {
+                    break;
+                }
+                float ms = 0.f;
+                cudaEventElapsedTime(&ms, op.start, op.end);
+                stats_[op.name].record(ms * 1e3, op.counters, op.failed);
+
+                free_events_[op.device].push_back(op.start);
+                free_events_[op.device].push_back(op.end);
+                pending_.pop_front();
+            }
+#else
+            (void)wait;
+#endif
+        }
+};
+
+// The counters of the ops of this thread which haven't ended, innermost last
+inline std::vector<op_counters*>& opStack() {
+    static thread_local std::vector<op_counters*> stack;
+    return stack;
+}
+
+/*
+ * ==========================================================================================================
+ * Class        : ScopedOp
+ *
+ * Description  : An op for the scope of the object, which is an NVTX range, is timed and has its own counters
+ *                (see NOTES 2 and 3). Use the FRNN_PROFILE_* macros rather than making these directly.
+ * ==========================================================================================================
+ */
+class ScopedOp {
+    private:
+        const char*                             name_;
+        const frnnError*                        error_;
+        frnnError                               error_start_;
+        cudaStream_t                            stream_;
+        bool                                    on_device_;
+        bool                                    captured_;
+        int                                     device_;
+        cudaEvent_t                             start_;
+        std::chrono::steady_clock::time_point   host_start_;
+        op_counters                             counters_;
+
+    public:
+        /*
+         * ==================================================================================================
+         * Function     : ScopedOp
+         *
+         * Description  : Starts the op
+         *
+         * Inputs       : name      : The name of the op, which must outlive the profiler (a literal)
+         *              : error     : The error of the op (or 0 if it has none)
+         *              : stream    : The stream of the op, if it's on the device
+         *              : on_device : If the op is queued on the stream, otherwise it's timed on the host
+         * ==================================================================================================
+         */
+        ScopedOp(const char* name, const frnnError* error, cudaStream_t stream, bool on_device) :
+                name_(name), error_(error), error_start_(error != 0 ? *error : frnnError()), stream_(stream),
+                on_device_(on_device), captured_(false), device_(0), start_(0) {
+#ifdef FRNN_WITH_PROFILER
+            nvtxRangePushA(name_);
+#endif
+#ifdef FRNN_WITH_CUDA
+            // The op is only queued into a graph when its stream is being captured (see NOTES 6)
+            cudaStreamCaptureStatus capture = cudaStreamCaptureStatusNone;
+            if (on_device_ && cudaStreamIsCapturing(stream_, &capture) == cudaSuccess) {
+                captured_ = capture != cudaStreamCaptureStatusNone;
+            }
+            if (on_device_ && !captured_) {
+                cudaGetDevice(&device_);
+                start_ = Profiler::global().acquireEvent(device_);
+                cudaEventRecord(start_, stream_);
+            } else if (!on_device_) {
+                host_start_ = std::chrono::steady_clock::now();
+            }
+#else
+            // Every op is on the host without CUDA (see NOTES 7)
+            on_device_  = false;
+            host_start_ = std::chrono::steady_clock::now();
+#endif
+            opStack().push_back(&counters_);
+        }
+
+        ~ScopedOp() {
+            opStack().pop_back();
+            const bool failed = error_ != 0 && *error_ != error_start_;
+#ifdef FRNN_WITH_CUDA
+            if (on_device_ && !captured_) {
+                cudaEvent_t end = Profiler::global().acquireEvent(device_);
+                cudaEventRecord(end, stream_);
+                Profiler::global().endGpuOp(name_, device_, start_, end, counters_, failed);
+            } else
+#endif
+            if (!on_device_) {
+                const std::chrono::duration<double, std::micro> time = std::chrono::steady_clock::now() - host_start_;
+                Profiler::global().endHostOp(name_, time.count(), counters_, failed);
+            }
+#ifdef FRNN_WITH_PROFILER
+            nvtxRangePop();
+#endif
+        }
+
+        ScopedOp(const ScopedOp&)             = delete;
+        ScopedOp& operator=(const ScopedOp&)   = delete;
+};
+
+/*
+ * ==========================================================================================================
+ * Function     : countCopy / countAlloc / countLaunch
+ *
+ * Description  : Adds a copy, an allocation or a launch to the ops of the thread (see NOTES 3)
+ * ==========================================================================================================
+ */
+#ifdef FRNN_WITH_CUDA
+inline void countCopy(cudaMemcpyKind kind, size_t bytes) {
+    for (op_counters* op : opStack()) {
+        if (kind == cudaMemcpyHostToDevice)         op->h2d_bytes += bytes;
+        else if (kind == cudaMemcpyDeviceToHost)    op->d2h_bytes += bytes;
+        else if (kind == cudaMemcpyDeviceToDevice)  op->d2d_bytes += bytes;
+    }
+}
+#endif
+
+inline void countAlloc(size_t bytes) {
+    for (op_counters* op : opStack()) {
+        op->allocations++;
+        op->alloc_bytes += bytes;
+    }
+}
+
+inline void countLaunch() {
+    for (op_counters* op : opStack()) op->launches++;
+}
+
+}   // Namespace prof
+}   // Namespace frnn
+
+#ifdef FRNN_WITH_PROFILER
+#define FRNN_PROFILE_OP(name, error, stream, on_device)                                                         \
+    frnn::prof::ScopedOp frnn_profile_op_( name, error, stream, on_device )
+#define FRNN_COUNT_COPY(kind, bytes)    frnn::prof::countCopy( kind, bytes )
+#define FRNN_COUNT_ALLOC(bytes)         frnn::prof::countAlloc( bytes )
+#define FRNN_COUNT_LAUNCH()             frnn::prof::countLaunch()
+#else
+#define FRNN_PROFILE_OP(name, error, stream, on_device)
+#define FRNN_COUNT_COPY(kind, bytes)
+#define FRNN_COUNT_ALLOC(bytes)
+#define FRNN_COUNT_LAUNCH()
+#endif
+
+// Ops which are queued on a stream, and ops which run on the host
+#define FRNN_PROFILE_GPU(name, error, stream)   FRNN_PROFILE_OP( name, error, stream, true )
+#define FRNN_PROFILE_CPU(name, error)           FRNN_PROFILE_OP( name, error, 0, false )
+
+#ifdef FRNN_WITH_CUDA
+namespace frnn {
+namespace prof {
+
+/*
+ * ==========================================================================================================
+ * Function     : memcpy / memcpyAsync
+ *
+ * Description  : cudaMemcpy and cudaMemcpyAsync, which add the bytes to the ops of the thread
+ * ==========================================================================================================
+ */
+inline cudaError_t memcpy(void* dst, const void* src, size_t bytes, cudaMemcpyKind kind) {
+    FRNN_COUNT_COPY( kind, bytes );
+    return cudaMemcpy(dst, src, bytes, kind);
+}
+
+inline cudaError_t memcpyAsync(void* dst, const void* src, size_t bytes, cudaMemcpyKind kind, cudaStream_t stream) {
+    FRNN_COUNT_COPY( kind, bytes );
+    return cudaMemcpyAsync(dst, src, bytes, kind, stream);
+}
+
+}   // Namespace prof
+}   // Namespace frnn
+#endif
+
+#endif
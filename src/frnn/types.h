@@ -21,9 +21,17 @@
 #ifndef _FRNN_TYPES_
 #define _FRNN_TYPES_
 
+// Builds with nvcc always have the GPU code, other builds only have it with FRNN_WITH_CUDA (which the CMake
+// option of the same name defines), so CPU only builds don't need the CUDA SDK
+#if defined(__CUDACC__) && !defined(FRNN_WITH_CUDA)
+    #define FRNN_WITH_CUDA
+#endif
+
 // Other frnn types
 #include "vectorized_types_cpu.h"
+#ifdef FRNN_WITH_CUDA
 #include "vectorized_types_gpu.h"
+#endif
 
 // Change if necessary
 #define MAX_BLOCKS          65536
@@ -38,9 +46,10 @@ namespace frnn {
  * Decsiption   : Enumerator for the devices available for use
  * ==========================================================================================================
  */
-enum device : bool {
+enum device : unsigned char {
     CPU,
-    GPU
+    GPU,
+    AUTO                // Chosen at runtime for each function (see device_dispatcher.cuh)
 };
 
 /*
@@ -53,7 +62,10 @@ enum device : bool {
 enum frnnError {
     FRNN_ALLOC_ERROR       = 1,
     FRNN_COPY_ERROR        = 2,
-    FRNN_DIMENSION_ERROR   = 3
+    FRNN_DIMENSION_ERROR   = 3,
+    FRNN_FILE_ERROR        = 4,
+    FRNN_GRAPH_ERROR       = 5,
+    FRNN_BLAS_ERROR        = 6
  };
 
 }   // Namepace frnn
@@ -26,29 +26,205 @@
 #ifndef _FRNN_VECTORIZED_TYPES_CPU_
 #define _FRNN_VECTORIZED_TYPES_CPU_
 
-#include <emmintrin.h>          // SSE vectorized types
+#include <cstddef>
+#include <cstdint>
+
+// The x86 instruction sets are all compiled into the binary (each function which uses the wider instructions
+// has a target attribute), and the widest one which the CPU supports is selected at runtime. aarch64 always
+// has NEON, so no selection is needed there. 32 bit ARM isn't supported, since its NEON doesn't have the
+// fused multiply-adds, double vectors or across vector reductions (vfmaq, float64x2_t, vaddvq) used here.
+#if defined(__x86_64__) || defined(__i386__) || defined(_M_X64)
+    #define FRNN_CPU_X86
+    #include <immintrin.h>          // SSE, AVX2 and AVX-512 vectorized types
+    #define FRNN_TARGET_SSE
+    #define FRNN_TARGET_AVX2        __attribute__((target("avx2,fma")))
+    #define FRNN_TARGET_AVX512      __attribute__((target("avx512f,avx2,fma")))
+    #define FRNN_TARGET_AVX512VNNI  __attribute__((target("avx512vnni,avx512bw,avx512f,avx2,fma")))
+#elif defined(__aarch64__)
+    #define FRNN_CPU_ARM
+    #include <arm_neon.h>           // NEON vectorized types
+    #define FRNN_TARGET_NEON
+#else
+    #error "The vectorized CPU kernels need an x86 (SSE) or an aarch64 (NEON) CPU"
+#endif
+
+// Kernels (and helpers) which use the vectorized instructions must always be inlined into the entry for the
+// instruction set, since vector types can't be passed between functions compiled for different instruction
+// sets (the calling conventions are different)
+#define FRNN_CPU_KERNEL inline __attribute__((always_inline))
+
+/* ============================================= NOTES ======================================================
+ *
+ * 1. The instructions for an instruction set (isa) are static functions with the target attribute of the
+ *    isa, so a kernel is written once as a template on the instructions struct (see math_kernels_cpu.h) 
+ *    and run through dispatchCpu, which calls the instantiation for the widest isa the CPU supports. The
+ *    kernel must be FRNN_CPU_KERNEL (always inlined) so that it is compiled for the isa of the entry.
+ *
+ * 2. load and store are unaligned, loadAligned and storeAligned need the pointer to be aligned to the
+ *    width of the vector type.
+ *
+ * 3. exp is a polynomial approximation (range reduction to [-ln2/2, ln2/2] then a Taylor polynomial), with 
+ *    a relative error of around 1e-7 for float and 1e-14 for double. Inputs are clamped so that the result 
+ *    is always a normal number (it does not overflow to inf or underflow to 0).
+ *
+ * 4. The int8 instructions only have what the quantized dot products need : dot multiplies the int8
+ *    elements of two vectors and adds the products (exactly, in int32) to the lanes of an accumulator, and
+ *    sum adds the lanes. AVX-512 without VNNI uses the AVX2 instructions (the 512 bit int8 multiplies need
+ *    AVX512BW), VNNI (vpdpbusd) has its own instructions struct which is only used when cpuHasVnni.
+ *
+ * 5. The kernels (and expVectorizedCpu) are templates on the instructions, so they can't have the target
+ *    attribute of an instruction set, and GCC warns (-Wpsabi) that the AVX vectors which the instructions
+ *    return to them would be passed with a different ABI. They are always inlined into the entry of their
+ *    instruction set, so no vector is passed between functions of different instruction sets, and the
+ *    warning is disabled for them (and only them). No function which isn't inlined takes or returns a
+ *    vector by value, so expVectorizedCpu changes its vector in place.
+ *
+ * 6. SSE has no fused multiply-add, so unless the binary is compiled with FMA3 (__FMA__, for example with
+ *    -mfma or -march=haswell) the fma of the SSE instructions is a multiply then an add, which rounds the
+ *    product. The results of the SSE kernels (exp in particular) can then differ in the last bit from the
+ *    AVX2, AVX-512 and NEON kernels, which always fuse.
+ *
+ * ==========================================================================================================
+ */
 
 namespace frnn {
+
+/*
+ * ==========================================================================================================
+ * Enum         : cpu_isa
+ * 
+ * Description  : The CPU SIMD instruction sets which have vectorized types and instructions
+ * ==========================================================================================================
+ */
+enum cpu_isa {
+    SSE,                    // 128 bit (x86)
+    AVX2,                   // 256 bit with fma (x86)
+    AVX512,                 // 512 bit (x86)
+    NEON                    // 128 bit (ARM)
+};
+
+#ifdef FRNN_CPU_X86
+    constexpr cpu_isa DEFAULT_CPU_ISA = SSE;
+#else
+    constexpr cpu_isa DEFAULT_CPU_ISA = NEON;
+#endif
     
 /*
  * ==========================================================================================================
  * Struct       : VectorizedTypeCpu
  * 
- * Description  : Gets a vectorized (v4) version of a type for sse instructions.
+ * Description  : Gets a vectorized version of a type for an instruction set (sse by default on x86).
  * 
  * Params       : dType     : The type of data (float, double, int )
+ *              : isa       : The instruction set
  * 
  * Example      : Calling frnn::vectorizedTypeCpu<float>::vectType will then use the __m128 type
  * ==========================================================================================================
  */
-template <typename dType> struct VectorizedTypeCpu;
+template <typename dType, cpu_isa isa = DEFAULT_CPU_ISA> struct VectorizedTypeCpu;
 
+#ifdef FRNN_CPU_X86
 template <> struct VectorizedTypeCpu<int>    { typedef __m128i vect_type; };
 template <> struct VectorizedTypeCpu<char>   { typedef __m128i vect_type; };
+template <> struct VectorizedTypeCpu<int8_t> { typedef __m128i vect_type; };
 template <> struct VectorizedTypeCpu<float>  { typedef __m128  vect_type; };
 template <> struct VectorizedTypeCpu<double> { typedef __m128d vect_type; };
 template <> struct VectorizedTypeCpu<float*> { typedef __m128* vect_type; };
 
+template <> struct VectorizedTypeCpu<int   , AVX2>   { typedef __m256i vect_type; };
+template <> struct VectorizedTypeCpu<char  , AVX2>   { typedef __m256i vect_type; };
+template <> struct VectorizedTypeCpu<int8_t, AVX2>   { typedef __m256i vect_type; };
+template <> struct VectorizedTypeCpu<float , AVX2>   { typedef __m256  vect_type; };
+template <> struct VectorizedTypeCpu<double, AVX2>   { typedef __m256d vect_type; };
+
+template <> struct VectorizedTypeCpu<int   , AVX512> { typedef __m512i vect_type; };
+template <> struct VectorizedTypeCpu<char  , AVX512> { typedef __m512i vect_type; };
+template <> struct VectorizedTypeCpu<int8_t, AVX512> { typedef __m512i vect_type; };
+template <> struct VectorizedTypeCpu<float , AVX512> { typedef __m512  vect_type; };
+template <> struct VectorizedTypeCpu<double, AVX512> { typedef __m512d vect_type; };
+#endif
+
+#ifdef FRNN_CPU_ARM
+template <> struct VectorizedTypeCpu<int   , NEON>   { typedef int32x4_t   vect_type; };
+template <> struct VectorizedTypeCpu<char  , NEON>   { typedef int8x16_t   vect_type; };
+template <> struct VectorizedTypeCpu<int8_t, NEON>   { typedef int8x16_t   vect_type; };
+template <> struct VectorizedTypeCpu<float , NEON>   { typedef float32x4_t vect_type; };
+template <> struct VectorizedTypeCpu<double, NEON>   { typedef float64x2_t vect_type; };
+#endif
+
+/*
+ * ==========================================================================================================
+ * Struct       : ExpLimits 
+ * 
+ * Description  : Constants for the vectorized exp approximation for a type
+ * 
+ * Params       : dType     : The type of data (float or double)
+ * ==========================================================================================================
+ */
+template <typename dType> struct ExpLimits;
+
+template <> struct ExpLimits<float> {
+    static constexpr float  hi      = 88.3f;                // Largest input (result is still finite)
+    static constexpr float  lo      = -87.3f;               // Smallest input (result is still normal)
+    static constexpr float  ln2_hi  = 0.693359375f;         // ln2 split so that n * ln2_hi is exact
+    static constexpr float  ln2_lo  = -2.12194440e-4f;
+    static constexpr int    degree  = 7;                    // Degree of the polynomial
+};
+
+template <> struct ExpLimits<double> {
+    static constexpr double hi      = 709.0;
+    static constexpr double lo      = -708.0;
+    static constexpr double ln2_hi  = 0.693147180369123816490;
+    static constexpr double ln2_lo  = 1.90821492927058770002e-10;
+    static constexpr int    degree  = 12;
+};
+
+// 1 / k! for the coefficients of the exp polynomial
+constexpr double invFactorial( int k ) { return k <= 1 ? 1.0 : invFactorial( k - 1 ) / k; }
+
+/*
+ * ==========================================================================================================
+ * Function     : expVectorizedCpu
+ * 
+ * Description  : Computes exp for each element of a vector, using only the arithmetic instructions
+ *                of the instructions struct (so it is the same for all the instruction sets). The vector
+ *                is changed in place (see NOTES 5).
+ *                
+ * Inputs       : x         : The vector to compute exp of
+ * 
+ * Outputs      : x         : exp of each element of x
+ * 
+ * Params       : vect_ins  : The vectorized instructions struct (for a type and instruction set)
+ * ==========================================================================================================
+ */
+#if defined( __GNUC__ ) && !defined( __clang__ )
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wpsabi"
+#endif
+template <typename vect_ins>
+FRNN_CPU_KERNEL void expVectorizedCpu( typename vect_ins::vect_type& x ) {
+    typedef typename vect_ins::value_type   dType;
+    typedef ExpLimits<dType>                limits;
+    typedef typename vect_ins::vect_type    vect;
+    
+    x = vect_ins::min( vect_ins::max( x, vect_ins::set1( limits::lo ) ), vect_ins::set1( limits::hi ) );
+    
+    // x = n * ln2 + r, with |r| <= ln2 / 2 
+    vect n = vect_ins::round( vect_ins::mul( x, vect_ins::set1( dType( 1.44269504088896340736 ) ) ) );
+    vect r = vect_ins::fma( n, vect_ins::set1( -limits::ln2_hi ), x );
+    r      = vect_ins::fma( n, vect_ins::set1( -limits::ln2_lo ), r );
+    
+    // exp(r) with Horner's method, then exp(x) = exp(r) * 2^n
+    vect p = vect_ins::set1( dType( invFactorial( limits::degree ) ) );
+    for ( int k = limits::degree - 1; k >= 0; k-- ) {
+        p = vect_ins::fma( p, r, vect_ins::set1( dType( invFactorial( k ) ) ) );
+    }
+    x = vect_ins::ldexp( p, n );
+}
+#if defined( __GNUC__ ) && !defined( __clang__ )
+#pragma GCC diagnostic pop
+#endif
+
 /*
  * ==========================================================================================================
  * Struct       : VectorizedInstructions 
@@ -57,46 +233,567 @@ template <> struct VectorizedTypeCpu<float*> { typedef __m128* vect_type; };
  *                function pointers allow the functions to be called without an instance of the struct
  *                
  * Params       : dType     : The type of data 
+ *              : isa       : The instruction set (sse by default on x86)
  * ==========================================================================================================
  */
 
-template <typename dType> struct VectorizedInstructionsCpu;
+template <typename dType, cpu_isa isa = DEFAULT_CPU_ISA> struct VectorizedInstructionsCpu;
 
 // Size functions for float and double
 constexpr size_t sizeFloatVectorized()  { return 4; }
 constexpr size_t sizeDoubleVectorized() { return 2; }
 
+#ifdef FRNN_CPU_X86
 // Float specification
 template <> struct VectorizedInstructionsCpu<float> {
+    typedef float   value_type;
+    typedef __m128  vect_type;
     
     static constexpr auto typeSize = &sizeFloatVectorized;
+    static constexpr size_t width() { return 4; }
+    
+    typedef __m128 (*load_fp)( const float* );
+    static constexpr load_fp mm_load_u = &_mm_loadu_ps;
+    
+    typedef __m128 (*sub_fp)( __m128, __m128 );
+    static constexpr sub_fp mm_sub_p = &_mm_sub_ps;
+    
+    typedef void (*store_fp)( float*, __m128 );
+    static constexpr store_fp mm_store_p = &_mm_store_ps;
     
-    typedef __m128 (*load)( const float* );
-    static constexpr load mm_load_u = &_mm_loadu_ps;
+    static inline __m128 set1( float a )                        { return _mm_set1_ps( a ); }
+    static inline __m128 load( const float* x )                 { return _mm_loadu_ps( x ); }
+    static inline __m128 loadAligned( const float* x )          { return _mm_load_ps( x ); }
+    static inline void   store( float* x, __m128 a )            { _mm_storeu_ps( x, a ); }
+    static inline void   storeAligned( float* x, __m128 a )     { _mm_store_ps( x, a ); }
+    static inline __m128 add( __m128 a, __m128 b )              { return _mm_add_ps( a, b ); }
+    static inline __m128 sub( __m128 a, __m128 b )              { return _mm_sub_ps( a, b ); }
+    static inline __m128 mul( __m128 a, __m128 b )              { return _mm_mul_ps( a, b ); }
+#ifdef __FMA__
+    static inline __m128 fma( __m128 a, __m128 b, __m128 c )    { return _mm_fmadd_ps( a, b, c ); }
+#else
+    // Not fused (see NOTES 6)
+    static inline __m128 fma( __m128 a, __m128 b, __m128 c )    { return _mm_add_ps( _mm_mul_ps( a, b ), c ); }
+#endif
+    static inline __m128 max( __m128 a, __m128 b )              { return _mm_max_ps( a, b ); }
+    static inline __m128 min( __m128 a, __m128 b )              { return _mm_min_ps( a, b ); }
+    static inline __m128 round( __m128 a )                      { return _mm_cvtepi32_ps( _mm_cvtps_epi32( a ) ); }
+    static inline __m128 exp( __m128 a ) { 
+        expVectorizedCpu<VectorizedInstructionsCpu<float>>( a ); return a; 
+    }
     
-    typedef __m128 (*sub)( __m128, __m128 );
-    static constexpr sub mm_sub_p = &_mm_sub_ps;
+    // a * 2^n, for integer valued n
+    static inline __m128 ldexp( __m128 a, __m128 n ) {
+        __m128i bits = _mm_slli_epi32( _mm_add_epi32( _mm_cvtps_epi32( n ), _mm_set1_epi32( 127 ) ), 23 );
+        return _mm_mul_ps( a, _mm_castsi128_ps( bits ) );
+    }
     
-    typedef void (*store)( float*, __m128 );
-    static constexpr store mm_store_p = &_mm_store_ps;
+    // Horizontal sum and max of the elements of a
+    static inline float sum( __m128 a ) {
+        __m128 shuf = _mm_shuffle_ps( a, a, _MM_SHUFFLE( 2, 3, 0, 1 ) );
+        __m128 sums = _mm_add_ps( a, shuf );
+        shuf        = _mm_movehl_ps( shuf, sums );
+        return _mm_cvtss_f32( _mm_add_ss( sums, shuf ) );
+    }
+    static inline float maxAll( __m128 a ) {
+        __m128 shuf = _mm_shuffle_ps( a, a, _MM_SHUFFLE( 2, 3, 0, 1 ) );
+        __m128 maxs = _mm_max_ps( a, shuf );
+        shuf        = _mm_movehl_ps( shuf, maxs );
+        return _mm_cvtss_f32( _mm_max_ss( maxs, shuf ) );
+    }
 };
 
 // Double specification
 template <> struct VectorizedInstructionsCpu<double> {
+    typedef double  value_type;
+    typedef __m128d vect_type;
    
     static constexpr auto typeSize = &sizeDoubleVectorized;
+    static constexpr size_t width() { return 2; }
 
-    typedef __m128d (*load)( const double* );
-    static constexpr load mm_load_u = &_mm_loadu_pd;
+    typedef __m128d (*load_fp)( const double* );
+    static constexpr load_fp mm_load_u = &_mm_loadu_pd;
+    
+    typedef __m128d (*sub_fp)( __m128d, __m128d );
+    static constexpr sub_fp mm_sub_p = &_mm_sub_pd;
+    
+    typedef void (*store_fp)( double*, __m128d );
+    static constexpr store_fp mm_store_p = &_mm_store_pd;
     
-    typedef __m128d (*sub)( __m128d, __m128d );
-    static constexpr sub mm_sub_p = &_mm_sub_pd;
+    static inline __m128d set1( double a )                          { return _mm_set1_pd( a ); }
+    static inline __m128d load( const double* x )                   { return _mm_loadu_pd( x ); }
+    static inline __m128d loadAligned( const double* x )            { return _mm_load_pd( x ); }
+    static inline void    store( double* x, __m128d a )             { _mm_storeu_pd( x, a ); }
+    static inline void    storeAligned( double* x, __m128d a )      { _mm_store_pd( x, a ); }
+    static inline __m128d add( __m128d a, __m128d b )               { return _mm_add_pd( a, b ); }
+    static inline __m128d sub( __m128d a, __m128d b )               { return _mm_sub_pd( a, b ); }
+    static inline __m128d mul( __m128d a, __m128d b )               { return _mm_mul_pd( a, b ); }
+#ifdef __FMA__
+    static inline __m128d fma( __m128d a, __m128d b, __m128d c )    { return _mm_fmadd_pd( a, b, c ); }
+#else
+    // Not fused (see NOTES 6)
+    static inline __m128d fma( __m128d a, __m128d b, __m128d c )    { return _mm_add_pd( _mm_mul_pd( a, b ), c ); }
+#endif
+    static inline __m128d max( __m128d a, __m128d b )               { return _mm_max_pd( a, b ); }
+    static inline __m128d min( __m128d a, __m128d b )               { return _mm_min_pd( a, b ); }
+    static inline __m128d round( __m128d a )                { return _mm_cvtepi32_pd( _mm_cvtpd_epi32( a ) ); }
+    static inline __m128d exp( __m128d a ) { 
+        expVectorizedCpu<VectorizedInstructionsCpu<double>>( a ); return a; 
+    }
+    
+    static inline __m128d ldexp( __m128d a, __m128d n ) {
+        __m128i n32  = _mm_add_epi32( _mm_cvtpd_epi32( n ), _mm_set1_epi32( 1023 ) );
+        __m128i bits = _mm_slli_epi64( _mm_unpacklo_epi32( n32, _mm_setzero_si128() ), 52 );
+        return _mm_mul_pd( a, _mm_castsi128_pd( bits ) );
+    }
     
-    typedef void (*store)( double*, __m128d );
-    static constexpr store mm_store_p = &_mm_store_pd;
+    static inline double sum( __m128d a )    { return _mm_cvtsd_f64( _mm_add_sd( a, _mm_unpackhi_pd( a, a ) ) ); }
+    static inline double maxAll( __m128d a ) { return _mm_cvtsd_f64( _mm_max_sd( a, _mm_unpackhi_pd( a, a ) ) ); }
 };
 
-}   // Namespace frnn
+// AVX2 float specification
+template <> struct VectorizedInstructionsCpu<float, AVX2> {
+    typedef float   value_type;
+    typedef __m256  vect_type;
+    
+    static constexpr size_t width() { return 8; }
+    
+    FRNN_TARGET_AVX2 static inline __m256 set1( float a )                     { return _mm256_set1_ps( a ); }
+    FRNN_TARGET_AVX2 static inline __m256 load( const float* x )              { return _mm256_loadu_ps( x ); }
+    FRNN_TARGET_AVX2 static inline __m256 loadAligned( const float* x )       { return _mm256_load_ps( x ); }
+    FRNN_TARGET_AVX2 static inline void   store( float* x, __m256 a )         { _mm256_storeu_ps( x, a ); }
+    FRNN_TARGET_AVX2 static inline void   storeAligned( float* x, __m256 a )  { _mm256_store_ps( x, a ); }
+    FRNN_TARGET_AVX2 static inline __m256 add( __m256 a, __m256 b )           { return _mm256_add_ps( a, b ); }
+    FRNN_TARGET_AVX2 static inline __m256 sub( __m256 a, __m256 b )           { return _mm256_sub_ps( a, b ); }
+    FRNN_TARGET_AVX2 static inline __m256 mul( __m256 a, __m256 b )           { return _mm256_mul_ps( a, b ); }
+    FRNN_TARGET_AVX2 static inline __m256 fma( __m256 a, __m256 b, __m256 c ) { return _mm256_fmadd_ps( a, b, c ); }
+    FRNN_TARGET_AVX2 static inline __m256 max( __m256 a, __m256 b )           { return _mm256_max_ps( a, b ); }
+    FRNN_TARGET_AVX2 static inline __m256 min( __m256 a, __m256 b )           { return _mm256_min_ps( a, b ); }
+    FRNN_TARGET_AVX2 static inline __m256 round( __m256 a ) { 
+        return _mm256_round_ps( a, _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC ); 
+    }
+    FRNN_TARGET_AVX2 static inline __m256 exp( __m256 a ) { 
+        expVectorizedCpu<VectorizedInstructionsCpu<float, AVX2>>( a ); return a; 
+    }
+    
+    FRNN_TARGET_AVX2 static inline __m256 ldexp( __m256 a, __m256 n ) {
+        __m256i bits = _mm256_slli_epi32( _mm256_add_epi32( _mm256_cvtps_epi32( n ), _mm256_set1_epi32( 127 ) ), 23 );
+        return _mm256_mul_ps( a, _mm256_castsi256_ps( bits ) );
+    }
+    
+    FRNN_TARGET_AVX2 static inline float sum( __m256 a ) {
+        return VectorizedInstructionsCpu<float>::sum( _mm_add_ps( _mm256_castps256_ps128( a ), 
+                                                                  _mm256_extractf128_ps( a, 1 ) ) );
+    }
+    FRNN_TARGET_AVX2 static inline float maxAll( __m256 a ) {
+        return VectorizedInstructionsCpu<float>::maxAll( _mm_max_ps( _mm256_castps256_ps128( a ), 
+                                                                     _mm256_extractf128_ps( a, 1 ) ) );
+    }
+};
+
+// AVX2 double specification
+template <> struct VectorizedInstructionsCpu<double, AVX2> {
+    typedef double  value_type;
+    typedef __m256d vect_type;
+    
+    static constexpr size_t width() { return 4; }
+    
+    FRNN_TARGET_AVX2 static inline __m256d set1( double a )                      { return _mm256_set1_pd( a ); }
+    FRNN_TARGET_AVX2 static inline __m256d load( const double* x )               { return _mm256_loadu_pd( x ); }
+    FRNN_TARGET_AVX2 static inline __m256d loadAligned( const double* x )        { return _mm256_load_pd( x ); }
+    FRNN_TARGET_AVX2 static inline void    store( double* x, __m256d a )         { _mm256_storeu_pd( x, a ); }
+    FRNN_TARGET_AVX2 static inline void    storeAligned( double* x, __m256d a )  { _mm256_store_pd( x, a ); }
+    FRNN_TARGET_AVX2 static inline __m256d add( __m256d a, __m256d b )           { return _mm256_add_pd( a, b ); }
+    FRNN_TARGET_AVX2 static inline __m256d sub( __m256d a, __m256d b )           { return _mm256_sub_pd( a, b ); }
+    FRNN_TARGET_AVX2 static inline __m256d mul( __m256d a, __m256d b )           { return _mm256_mul_pd( a, b ); }
+    FRNN_TARGET_AVX2 static inline __m256d fma( __m256d a, __m256d b, __m256d c ) { 
+        return _mm256_fmadd_pd( a, b, c ); 
+    }
+    FRNN_TARGET_AVX2 static inline __m256d max( __m256d a, __m256d b )           { return _mm256_max_pd( a, b ); }
+    FRNN_TARGET_AVX2 static inline __m256d min( __m256d a, __m256d b )           { return _mm256_min_pd( a, b ); }
+    FRNN_TARGET_AVX2 static inline __m256d round( __m256d a ) { 
+        return _mm256_round_pd( a, _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC ); 
+    }
+    FRNN_TARGET_AVX2 static inline __m256d exp( __m256d a ) { 
+        expVectorizedCpu<VectorizedInstructionsCpu<double, AVX2>>( a ); return a; 
+    }
+    
+    FRNN_TARGET_AVX2 static inline __m256d ldexp( __m256d a, __m256d n ) {
+        __m256i n64  = _mm256_cvtepi32_epi64( _mm256_cvtpd_epi32( n ) );
+        __m256i bits = _mm256_slli_epi64( _mm256_add_epi64( n64, _mm256_set1_epi64x( 1023 ) ), 52 );
+        return _mm256_mul_pd( a, _mm256_castsi256_pd( bits ) );
+    }
+    
+    FRNN_TARGET_AVX2 static inline double sum( __m256d a ) {
+        return VectorizedInstructionsCpu<double>::sum( _mm_add_pd( _mm256_castpd256_pd128( a ), 
+                                                                   _mm256_extractf128_pd( a, 1 ) ) );
+    }
+    FRNN_TARGET_AVX2 static inline double maxAll( __m256d a ) {
+        return VectorizedInstructionsCpu<double>::maxAll( _mm_max_pd( _mm256_castpd256_pd128( a ), 
+                                                                      _mm256_extractf128_pd( a, 1 ) ) );
+    }
+};
+
+// AVX-512 float specification
+template <> struct VectorizedInstructionsCpu<float, AVX512> {
+    typedef float   value_type;
+    typedef __m512  vect_type;
+    
+    static constexpr size_t width() { return 16; }
+    
+    FRNN_TARGET_AVX512 static inline __m512 set1( float a )                     { return _mm512_set1_ps( a ); }
+    FRNN_TARGET_AVX512 static inline __m512 load( const float* x )              { return _mm512_loadu_ps( x ); }
+    FRNN_TARGET_AVX512 static inline __m512 loadAligned( const float* x )       { return _mm512_load_ps( x ); }
+    FRNN_TARGET_AVX512 static inline void   store( float* x, __m512 a )         { _mm512_storeu_ps( x, a ); }
+    FRNN_TARGET_AVX512 static inline void   storeAligned( float* x, __m512 a )  { _mm512_store_ps( x, a ); }
+    FRNN_TARGET_AVX512 static inline __m512 add( __m512 a, __m512 b )           { return _mm512_add_ps( a, b ); }
+    FRNN_TARGET_AVX512 static inline __m512 sub( __m512 a, __m512 b )           { return _mm512_sub_ps( a, b ); }
+    FRNN_TARGET_AVX512 static inline __m512 mul( __m512 a, __m512 b )           { return _mm512_mul_ps( a, b ); }
+    FRNN_TARGET_AVX512 static inline __m512 fma( __m512 a, __m512 b, __m512 c ) { 
+        return _mm512_fmadd_ps( a, b, c ); 
+    }
+    FRNN_TARGET_AVX512 static inline __m512 max( __m512 a, __m512 b )           { return _mm512_max_ps( a, b ); }
+    FRNN_TARGET_AVX512 static inline __m512 min( __m512 a, __m512 b )           { return _mm512_min_ps( a, b ); }
+    FRNN_TARGET_AVX512 static inline __m512 round( __m512 a ) { 
+        return _mm512_roundscale_ps( a, _MM_FROUND_TO_NEAREST_INT ); 
+    }
+    FRNN_TARGET_AVX512 static inline __m512 ldexp( __m512 a, __m512 n )         { return _mm512_scalef_ps( a, n ); }
+    FRNN_TARGET_AVX512 static inline __m512 exp( __m512 a ) { 
+        expVectorizedCpu<VectorizedInstructionsCpu<float, AVX512>>( a ); return a; 
+    }
+    FRNN_TARGET_AVX512 static inline float  sum( __m512 a )                     { return _mm512_reduce_add_ps( a ); }
+    FRNN_TARGET_AVX512 static inline float  maxAll( __m512 a )                  { return _mm512_reduce_max_ps( a ); }
+};
+
+// AVX-512 double specification
+template <> struct VectorizedInstructionsCpu<double, AVX512> {
+    typedef double  value_type;
+    typedef __m512d vect_type;
+    
+    static constexpr size_t width() { return 8; }
+    
+    FRNN_TARGET_AVX512 static inline __m512d set1( double a )                     { return _mm512_set1_pd( a ); }
+    FRNN_TARGET_AVX512 static inline __m512d load( const double* x )              { return _mm512_loadu_pd( x ); }
+    FRNN_TARGET_AVX512 static inline __m512d loadAligned( const double* x )       { return _mm512_load_pd( x ); }
+    FRNN_TARGET_AVX512 static inline void    store( double* x, __m512d a )        { _mm512_storeu_pd( x, a ); }
+    FRNN_TARGET_AVX512 static inline void    storeAligned( double* x, __m512d a ) { _mm512_store_pd( x, a ); }
+    FRNN_TARGET_AVX512 static inline __m512d add( __m512d a, __m512d b )          { return _mm512_add_pd( a, b ); }
+    FRNN_TARGET_AVX512 static inline __m512d sub( __m512d a, __m512d b )          { return _mm512_sub_pd( a, b ); }
+    FRNN_TARGET_AVX512 static inline __m512d mul( __m512d a, __m512d b )          { return _mm512_mul_pd( a, b ); }
+    FRNN_TARGET_AVX512 static inline __m512d fma( __m512d a, __m512d b, __m512d c ) { 
+        return _mm512_fmadd_pd( a, b, c ); 
+    }
+    FRNN_TARGET_AVX512 static inline __m512d max( __m512d a, __m512d b )          { return _mm512_max_pd( a, b ); }
+    FRNN_TARGET_AVX512 static inline __m512d min( __m512d a, __m512d b )          { return _mm512_min_pd( a, b ); }
+    FRNN_TARGET_AVX512 static inline __m512d round( __m512d a ) { 
+        return _mm512_roundscale_pd( a, _MM_FROUND_TO_NEAREST_INT ); 
+    }
+    FRNN_TARGET_AVX512 static inline __m512d ldexp( __m512d a, __m512d n )        { return _mm512_scalef_pd( a, n ); }
+    FRNN_TARGET_AVX512 static inline __m512d exp( __m512d a ) { 
+        expVectorizedCpu<VectorizedInstructionsCpu<double, AVX512>>( a ); return a; 
+    }
+    FRNN_TARGET_AVX512 static inline double  sum( __m512d a )                     { return _mm512_reduce_add_pd( a ); }
+    FRNN_TARGET_AVX512 static inline double  maxAll( __m512d a )                  { return _mm512_reduce_max_pd( a ); }
+};
+#endif
+
+#ifdef FRNN_CPU_ARM
+// NEON float specification
+template <> struct VectorizedInstructionsCpu<float, NEON> {
+    typedef float       value_type;
+    typedef float32x4_t vect_type;
+    
+    static constexpr auto typeSize = &sizeFloatVectorized;
+    static constexpr size_t width() { return 4; }
+    
+    static inline float32x4_t set1( float a )                                 { return vdupq_n_f32( a ); }
+    static inline float32x4_t load( const float* x )                          { return vld1q_f32( x ); }
+    static inline float32x4_t loadAligned( const float* x )                   { return vld1q_f32( x ); }
+    static inline void        store( float* x, float32x4_t a )                { vst1q_f32( x, a ); }
+    static inline void        storeAligned( float* x, float32x4_t a )         { vst1q_f32( x, a ); }
+    static inline float32x4_t add( float32x4_t a, float32x4_t b )             { return vaddq_f32( a, b ); }
+    static inline float32x4_t sub( float32x4_t a, float32x4_t b )             { return vsubq_f32( a, b ); }
+    static inline float32x4_t mul( float32x4_t a, float32x4_t b )             { return vmulq_f32( a, b ); }
+    static inline float32x4_t fma( float32x4_t a, float32x4_t b, float32x4_t c ) { return vfmaq_f32( c, a, b ); }
+    static inline float32x4_t max( float32x4_t a, float32x4_t b )             { return vmaxq_f32( a, b ); }
+    static inline float32x4_t min( float32x4_t a, float32x4_t b )             { return vminq_f32( a, b ); }
+    static inline float32x4_t round( float32x4_t a )                          { return vrndnq_f32( a ); }
+    static inline float32x4_t exp( float32x4_t a ) { 
+        expVectorizedCpu<VectorizedInstructionsCpu<float, NEON>>( a ); return a; 
+    }
+    
+    static inline float32x4_t ldexp( float32x4_t a, float32x4_t n ) {
+        int32x4_t bits = vshlq_n_s32( vaddq_s32( vcvtnq_s32_f32( n ), vdupq_n_s32( 127 ) ), 23 );
+        return vmulq_f32( a, vreinterpretq_f32_s32( bits ) );
+    }
+    
+    static inline float sum( float32x4_t a )                                  { return vaddvq_f32( a ); }
+    static inline float maxAll( float32x4_t a )                               { return vmaxvq_f32( a ); }
+};
 
+// NEON double specification
+template <> struct VectorizedInstructionsCpu<double, NEON> {
+    typedef double      value_type;
+    typedef float64x2_t vect_type;
+    
+    static constexpr auto typeSize = &sizeDoubleVectorized;
+    static constexpr size_t width() { return 2; }
+    
+    static inline float64x2_t set1( double a )                                { return vdupq_n_f64( a ); }
+    static inline float64x2_t load( const double* x )                         { return vld1q_f64( x ); }
+    static inline float64x2_t loadAligned( const double* x )                  { return vld1q_f64( x ); }
+    static inline void        store( double* x, float64x2_t a )               { vst1q_f64( x, a ); }
+    static inline void        storeAligned( double* x, float64x2_t a )        { vst1q_f64( x, a ); }
+    static inline float64x2_t add( float64x2_t a, float64x2_t b )             { return vaddq_f64( a, b ); }
+    static inline float64x2_t sub( float64x2_t a, float64x2_t b )             { return vsubq_f64( a, b ); }
+    static inline float64x2_t mul( float64x2_t a, float64x2_t b )             { return vmulq_f64( a, b ); }
+    static inline float64x2_t fma( float64x2_t a, float64x2_t b, float64x2_t c ) { return vfmaq_f64( c, a, b ); }
+    static inline float64x2_t max( float64x2_t a, float64x2_t b )             { return vmaxq_f64( a, b ); }
+    static inline float64x2_t min( float64x2_t a, float64x2_t b )             { return vminq_f64( a, b ); }
+    static inline float64x2_t round( float64x2_t a )                          { return vrndnq_f64( a ); }
+    static inline float64x2_t exp( float64x2_t a ) { 
+        expVectorizedCpu<VectorizedInstructionsCpu<double, NEON>>( a ); return a; 
+    }
+    
+    static inline float64x2_t ldexp( float64x2_t a, float64x2_t n ) {
+        int64x2_t bits = vshlq_n_s64( vaddq_s64( vcvtnq_s64_f64( n ), vdupq_n_s64( 1023 ) ), 52 );
+        return vmulq_f64( a, vreinterpretq_f64_s64( bits ) );
+    }
+    
+    static inline double sum( float64x2_t a )                                 { return vaddvq_f64( a ); }
+    static inline double maxAll( float64x2_t a )                              { return vmaxvq_f64( a ); }
+};
+#endif
+
+/*
+ * ==========================================================================================================
+ * Struct       : VectorizedInstructionsCpu (int8)
+ * 
+ * Description  : The int8 instructions for the quantized dot products (see NOTES 4)
+ * ==========================================================================================================
+ */
+#ifdef FRNN_CPU_X86
+// SSE int8 specification, SSE2 has no sign extension from 8 to 16 bits, so it's an unpack and a shift
+template <> struct VectorizedInstructionsCpu<int8_t> {
+    typedef int8_t  value_type;
+    typedef __m128i vect_type;
+    typedef __m128i acc_type;
+    
+    static constexpr size_t width() { return 16; }
+    
+    static inline __m128i zero()                    { return _mm_setzero_si128(); }
+    static inline __m128i load( const int8_t* x )   { return _mm_loadu_si128( reinterpret_cast<const __m128i*>( x ) ); }
+    
+    static inline __m128i dot( __m128i acc, __m128i a, __m128i b ) {
+        const __m128i a_lo = _mm_srai_epi16( _mm_unpacklo_epi8( a, a ), 8 );
+        const __m128i a_hi = _mm_srai_epi16( _mm_unpackhi_epi8( a, a ), 8 );
+        const __m128i b_lo = _mm_srai_epi16( _mm_unpacklo_epi8( b, b ), 8 );
+        const __m128i b_hi = _mm_srai_epi16( _mm_unpackhi_epi8( b, b ), 8 );
+        return _mm_add_epi32( acc, _mm_add_epi32( _mm_madd_epi16( a_lo, b_lo ), _mm_madd_epi16( a_hi, b_hi ) ) );
+    }
+    
+    static inline int32_t sum( __m128i acc ) {
+        __m128i sums = _mm_add_epi32( acc, _mm_shuffle_epi32( acc, _MM_SHUFFLE( 1, 0, 3, 2 ) ) );
+        sums         = _mm_add_epi32( sums, _mm_shuffle_epi32( sums, _MM_SHUFFLE( 2, 3, 0, 1 ) ) );
+        return _mm_cvtsi128_si32( sums );
+    }
+};
+
+// AVX2 int8 specification
+template <> struct VectorizedInstructionsCpu<int8_t, AVX2> {
+    typedef int8_t  value_type;
+    typedef __m256i vect_type;
+    typedef __m256i acc_type;
+    
+    static constexpr size_t width() { return 32; }
+    
+    FRNN_TARGET_AVX2 static inline __m256i zero() { return _mm256_setzero_si256(); }
+    FRNN_TARGET_AVX2 static inline __m256i load( const int8_t* x ) { 
+        return _mm256_loadu_si256( reinterpret_cast<const __m256i*>( x ) ); 
+    }
+    
+    FRNN_TARGET_AVX2 static inline __m256i dot( __m256i acc, __m256i a, __m256i b ) {
+        const __m256i a_lo = _mm256_cvtepi8_epi16( _mm256_castsi256_si128( a ) );
+        const __m256i a_hi = _mm256_cvtepi8_epi16( _mm256_extracti128_si256( a, 1 ) );
+        const __m256i b_lo = _mm256_cvtepi8_epi16( _mm256_castsi256_si128( b ) );
+        const __m256i b_hi = _mm256_cvtepi8_epi16( _mm256_extracti128_si256( b, 1 ) );
+        return _mm256_add_epi32( acc, _mm256_add_epi32( _mm256_madd_epi16( a_lo, b_lo ), 
+                                                         _mm256_madd_epi16( a_hi, b_hi ) ) );
+    }
+    
+    FRNN_TARGET_AVX2 static inline int32_t sum( __m256i acc ) {
+        return VectorizedInstructionsCpu<int8_t>::sum( _mm_add_epi32( _mm256_castsi256_si128( acc ), 
+                                                                      _mm256_extracti128_si256( acc, 1 ) ) );
+    }
+};
+
+// AVX-512 int8 specification (without VNNI), which is the AVX2 specification
+template <> struct VectorizedInstructionsCpu<int8_t, AVX512> : VectorizedInstructionsCpu<int8_t, AVX2> {};
+
+// VNNI int8 instructions, vpdpbusd multiplies unsigned by signed bytes, so a is offset by 128 (flipping the
+// sign bit) and the extra 128 * sum( b ) is subtracted, which is also a vpdpbusd
+struct Int8VnniInstructionsCpu {
+    typedef int8_t  value_type;
+    typedef __m512i vect_type;
+    typedef __m512i acc_type;
+    
+    static constexpr size_t width() { return 64; }
+    
+    FRNN_TARGET_AVX512VNNI static inline __m512i zero()                   { return _mm512_setzero_si512(); }
+    FRNN_TARGET_AVX512VNNI static inline __m512i load( const int8_t* x )  { return _mm512_loadu_si512( x ); }
+    
+    FRNN_TARGET_AVX512VNNI static inline __m512i dot( __m512i acc, __m512i a, __m512i b ) {
+        const __m512i offset = _mm512_set1_epi8( static_cast<char>( 0x80 ) );
+        const __m512i a_u    = _mm512_xor_si512( a, offset );
+        return _mm512_sub_epi32( _mm512_dpbusd_epi32( acc, a_u, b ), 
+                                 _mm512_dpbusd_epi32( _mm512_setzero_si512(), offset, b ) );
+    }
+    
+    FRNN_TARGET_AVX512VNNI static inline int32_t sum( __m512i acc ) { return _mm512_reduce_add_epi32( acc ); }
+};
+#endif
+
+#ifdef FRNN_CPU_ARM
+// NEON int8 specification, the products are exact in 16 bits and are added in pairs to the accumulator
+template <> struct VectorizedInstructionsCpu<int8_t, NEON> {
+    typedef int8_t      value_type;
+    typedef int8x16_t   vect_type;
+    typedef int32x4_t   acc_type;
+    
+    static constexpr size_t width() { return 16; }
+    
+    static inline int32x4_t zero()                  { return vdupq_n_s32( 0 ); }
+    static inline int8x16_t load( const int8_t* x ) { return vld1q_s8( x ); }
+    
+    static inline int32x4_t dot( int32x4_t acc, int8x16_t a, int8x16_t b ) {
+        acc = vpadalq_s16( acc, vmull_s8( vget_low_s8( a ), vget_low_s8( b ) ) );
+        return vpadalq_s16( acc, vmull_high_s8( a, b ) );
+    }
+    
+    static inline int32_t sum( int32x4_t acc ) { return vaddvq_s32( acc ); }
+};
+#endif
+
+/*
+ * ==========================================================================================================
+ * Function     : detectCpuIsa
+ * 
+ * Description  : Determines the widest instruction set which the CPU supports (with CPUID on x86)
+ * ==========================================================================================================
+ */
+inline cpu_isa detectCpuIsa() {
+#ifdef FRNN_CPU_X86
+    __builtin_cpu_init();
+    if ( __builtin_cpu_supports( "avx512f" ) )                                   return AVX512;
+    if ( __builtin_cpu_supports( "avx2" ) && __builtin_cpu_supports( "fma" ) )   return AVX2;
+    return SSE;
+#else
+    return NEON;
+#endif
+}
+
+/*
+ * ==========================================================================================================
+ * Function     : cpuIsa
+ * 
+ * Description  : Gets the instruction set which the CPU kernels use, which is detected on first use
+ * ==========================================================================================================
+ */
+inline cpu_isa cpuIsa() {
+    static const cpu_isa isa = detectCpuIsa();
+    return isa;
+}
+
+/*
+ * ==========================================================================================================
+ * Function     : cpuHasVnni
+ * 
+ * Description  : If the CPU has the AVX-512 VNNI int8 dot product instructions (see NOTES 4)
+ * ==========================================================================================================
+ */
+inline bool cpuHasVnni() {
+#ifdef FRNN_CPU_X86
+    static const bool vnni = cpuIsa() == AVX512 && __builtin_cpu_supports( "avx512vnni" ) && 
+                             __builtin_cpu_supports( "avx512bw" );
+    return vnni;
+#else
+    return false;
+#endif
+}
+
+/*
+ * ==========================================================================================================
+ * Struct       : CpuIsaEntry
+ * 
+ * Description  : Calls the instantiation of a kernel for an instruction set from a function which has the
+ *                target attribute of the instruction set. The kernel's run function must be declared
+ *                FRNN_CPU_KERNEL, so that it is inlined into the entry and compiled for the instruction set.
+ *                
+ * Params       : isa       : The instruction set
+ * ==========================================================================================================
+ */
+template <cpu_isa isa> struct CpuIsaEntry;
+
+#ifdef FRNN_CPU_X86
+template <> struct CpuIsaEntry<SSE> {
+    template <typename kernel, typename... Args>
+    FRNN_TARGET_SSE static auto run( Args... args ) -> decltype( kernel::template run<SSE>( args... ) ) {
+        return kernel::template run<SSE>( args... );
+    }
+};
+
+template <> struct CpuIsaEntry<AVX2> {
+    template <typename kernel, typename... Args>
+    FRNN_TARGET_AVX2 static auto run( Args... args ) -> decltype( kernel::template run<AVX2>( args... ) ) {
+        return kernel::template run<AVX2>( args... );
+    }
+};
+
+template <> struct CpuIsaEntry<AVX512> {
+    template <typename kernel, typename... Args>
+    FRNN_TARGET_AVX512 static auto run( Args... args ) -> decltype( kernel::template run<AVX512>( args... ) ) {
+        return kernel::template run<AVX512>( args... );
+    }
+};
+#endif
+
+#ifdef FRNN_CPU_ARM
+template <> struct CpuIsaEntry<NEON> {
+    template <typename kernel, typename... Args>
+    static auto run( Args... args ) -> decltype( kernel::template run<NEON>( args... ) ) {
+        return kernel::template run<NEON>( args... );
+    }
+};
+#endif
+
+/*
+ * ==========================================================================================================
+ * Function     : dispatchCpu
+ * 
+ * Description  : Runs a CPU kernel with the widest instruction set which the CPU supports. The kernel is a
+ *                struct with a static template function run<isa>( args... ).
+ *                
+ * Inputs       : args      : The arguments for the kernel
+ * 
+ * Outputs      : The result of the kernel
+ * 
+ * Params       : kernel    : The kernel struct
+ *              : Args      : The types of the arguments for the kernel
+ * ==========================================================================================================
+ */
+template <typename kernel, typename... Args>
+auto dispatchCpu( Args... args ) -> decltype( kernel::template run<DEFAULT_CPU_ISA>( args... ) ) {
+#ifdef FRNN_CPU_X86
+    switch ( cpuIsa() ) {
+        case AVX512 : return CpuIsaEntry<AVX512>::template run<kernel>( args... );
+        case AVX2   : return CpuIsaEntry<AVX2>::template run<kernel>( args... );
+        default     : return CpuIsaEntry<SSE>::template run<kernel>( args... );
+    }
+#else
+    return CpuIsaEntry<NEON>::template run<kernel>( args... );
+#endif
+}
+
+}   // Namespace frnn
 
 #endif
@@ -25,6 +25,9 @@
 #define _FRNN_VECTORIZED_TYPES_GPU_
 
 #include <cuda.h>
+#include <cstdint>
+
+#include "precision.h"
 
 namespace frnn {
     
@@ -56,6 +59,49 @@ FRNN_VECTORIZED_INSTANCE( char	  )
 
 #undef FRNN_VECTORIZED_INSTANCE
 
+// int8_t is signed char, which is the type of the elements of the CUDA char vectors
+template <> struct VectorizedTypeGpu<int8_t, 1> { typedef char1 vect_type; };
+template <> struct VectorizedTypeGpu<int8_t, 2> { typedef char2 vect_type; };
+template <> struct VectorizedTypeGpu<int8_t, 4> { typedef char4 vect_type; };
+
+#ifdef __CUDACC__
+/* 
+ * ==========================================================================================================
+ * Function		: dot4
+ * 
+ * Description	: Adds the dot product of two vectors of 4 int8 elements to an int, with dp4a on devices which
+ *                have it (compute capability 6.1 and higher)
+ *
+ * Inputs		: a			: The first vector
+ *				: b			: The second vector
+ *				: c			: The int to add the dot product to
+ * ==========================================================================================================
+ */
+__device__ inline int dot4( char4 a, char4 b, int c ) {
+#if __CUDA_ARCH__ >= 610
+	return __dp4a( *reinterpret_cast<const int*>( &a ), *reinterpret_cast<const int*>( &b ), c );
+#else
+	return c + a.x * b.x + a.y * b.y + a.z * b.z + a.w * b.w;
+#endif
+}
+#endif
+
+// CUDA has 2 element vectors of the reduced precision types, the 4 element vectors 
+// (for the vectorized loads of the reductions) are aligned to their size like float4
+struct __align__( 8 ) half4 { __half x, y, z, w; };
+
+template <> struct VectorizedTypeGpu<__half, 1> { typedef __half  vect_type; };
+template <> struct VectorizedTypeGpu<__half, 2> { typedef __half2 vect_type; };
+template <> struct VectorizedTypeGpu<__half, 4> { typedef half4   vect_type; };
+
+#ifdef FRNN_BF16
+struct __align__( 8 ) bfloat164 { __nv_bfloat16 x, y, z, w; };
+
+template <> struct VectorizedTypeGpu<__nv_bfloat16, 1> { typedef __nv_bfloat16  vect_type; };
+template <> struct VectorizedTypeGpu<__nv_bfloat16, 2> { typedef __nv_bfloat162 vect_type; };
+template <> struct VectorizedTypeGpu<__nv_bfloat16, 4> { typedef bfloat164      vect_type; };
+#endif
+
 }   // Namespace frnn
 
 #endif
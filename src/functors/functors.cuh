@@ -82,7 +82,8 @@ struct sigmoidDerivative {
      */
     template <typename dType>
     __host__ __device__ dType operator() ( const dType& x ) const {
-        return ( sigmoid( x ) * ( dType( 1 ) - sigmoid( x ) ) );
+        const dType s = sigmoid()( x );
+        return ( s * ( dType( 1 ) - s ) );
     }
 };
 
@@ -0,0 +1,235 @@
+/*
+ *  Header file for fastRNN truncated backpropogation through time, with
+ *  checkpoints of the recurrent state so that long sequences can be trained
+ *  with a bounded amount of memory.
+ *
+ *  Copyright (C) 2015 Rob Clucas robclu1818@gmail.com
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published
+ *  by the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program; if not, write to the Free Software Foundation,
+ *  Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#ifndef _FRNN_BPTT_
+#define _FRNN_BPTT_
+
+#include <algorithm>
+#include <vector>
+
+#include "../tensor/tensor.cuh"
+#include "../util/errors.h"
+#include "types/recurrent_cpu_functions.hpp"
+
+/* ============================================= NOTES ======================================================
+ *
+ * 1. A sequence is trained in windows of timesteps, and the gradients are only backpropogated through the
+ *    timesteps of a window (the state from the previous window is used, but no gradients go to it).
+ *
+ * 2. The forward pass of a window only keeps the recurrent state at the start of every segment of
+ *    checkpoint interval timesteps (the checkpoints), and the backward pass does the segments from the last
+ *    to the first, each by restoring its checkpoint and redoing its forward pass with a trace. So the
+ *    memory of the traces is for one segment rather than the whole window, for an extra forward pass of
+ *    the window. The gradients of the timesteps before a segment are carried to the backward pass of the
+ *    segment before it, so the gradients are the same as for a single segment.
+ *
+ * 3. The checkpoints are copies of the state of the layer, which for layers with device storage are kept
+ *    on the host (the device memory of a copy is only allocated when it's used).
+ *
+ * ==========================================================================================================
+ */
+
+namespace frnn {
+
+/*
+ * ==========================================================================================================
+ * Class        : TruncatedBptt
+ *
+ * Description  : Trains a recurrent layer with truncated backpropogation through time and checkpointing
+ *                (see NOTES 1 - 3)
+ *
+ * Params       : RecurrentLayer    : The layer to train (a Layer with a RecurrentPolicy)
+ * ==========================================================================================================
+ */
+template <typename RecurrentLayer>
+class TruncatedBptt {
+
+    public:
+        typedef typename RecurrentLayer::data_type      dType;
+        typedef typename RecurrentLayer::state_type     state_type;
+        typedef Tensor4<dType>                          tensor_type;
+
+    private:
+        RecurrentLayer&             layer_;             // The layer which is trained
+        size_t                      window_;            // Timesteps per window
+        size_t                      interval_;          // Timesteps per segment of a window
+        std::vector<state_type>     checkpoints_;       // State at the start of each segment of the window
+        state_type                  end_state_;         // State after the last timestep of the window
+        tensor_type                 ins_;               // Inputs of the window
+        recurrent_trace<dType>      trace_;             // Trace of the segment which is backpropogated
+        recurrent_carry<dType>      carry_;             // Gradients carried to the segment before
+
+    public:
+        /*
+         * ==================================================================================================
+         * Function     : TruncatedBptt
+         *
+         * Description  : Sets the layer to train, the window (the number of timesteps to backpropogate
+         *                through) and the number of timesteps between checkpoints
+         *
+         * Inputs       : layer                 : The layer to train (which must outlive the trainer)
+         *              : window                : The number of timesteps per window
+         *              : checkpoint_interval   : The number of timesteps between checkpoints (the window
+         *                                        is one segment if it's 0 or more than the window)
+         * ==================================================================================================
+         */
+        TruncatedBptt(RecurrentLayer& layer, size_t window, size_t checkpoint_interval = 0) :
+            layer_(layer), window_(std::max(window, size_t(1))),
+            interval_(checkpoint_interval == 0 ? window_ : std::min(checkpoint_interval, window_)) {}
+
+        inline size_t window() const { return window_; }
+        inline size_t checkpointInterval() const { return interval_; }
+
+        /*
+         * ==================================================================================================
+         * Function     : tracedTimesteps
+         *
+         * Description  : Gets the most timesteps which are traced at the same time, which bounds the memory
+         *                of the activations kept for the backward pass
+         * ==================================================================================================
+         */
+        inline size_t tracedTimesteps() const { return interval_; }
+
+        /*
+         * ==================================================================================================
+         * Function     : forward
+         *
+         * Description  : Forward propogates a window through the layer, keeping the checkpoints of the
+         *                segments for the backward pass. The forward pass of each segment is the (untraced)
+         *                forward pass of the layer, so it is done on the device of the layer.
+         *
+         * Inputs       : ins   : The inputs of the window (inputs x batch size x timesteps)
+         *
+         * Outputs      : outs  : The outputs of the window (nodes x batch size x timesteps)
+         * ==================================================================================================
+         */
+        void forward(const tensor_type& ins, tensor_type& outs) {
+            const size_t steps = ins.z();
+            tensor_type  seg_ins, seg_outs;
+
+            ins_ = ins;
+            outs.reshape(RecurrentLayer::node_count, ins.y(), steps, 1);
+            checkpoints_.clear();
+            for (size_t first = 0; first < steps; first += interval_) {
+                const size_t count = std::min(interval_, steps - first);
+                checkpoints_.push_back(layer_.recurrentState());
+                sliceSteps(ins, first, count, seg_ins);
+                layer_.forward(seg_ins, seg_outs);
+                placeSteps(seg_outs, first, outs);
+            }
+            end_state_ = layer_.recurrentState();
+        }
+
+        /*
+         * ==================================================================================================
+         * Function     : backward
+         *
+         * Description  : Backward propogates the errors of the window of the last forward pass, adding to the
+         *                gradients of the layer, and leaves the state of the layer as it was after the forward
+         *                pass (so that the next window follows on from this one).
+         *
+         * Inputs       : errors    : The gradients of the outputs of the window (nodes x batch x timesteps)
+         *
+         * Outputs      : in_errors : The gradients of the inputs of the window (inputs x batch x timesteps)
+         * ==================================================================================================
+         */
+        void backward(const tensor_type& errors, tensor_type& in_errors) {
+            frnnError   error;
+            tensor_type seg_ins, seg_outs, seg_errors, seg_in_errors;
+
+            if (errors.z() != ins_.z() || errors.y() != ins_.y()) {
+                frnn::err::dimError(error, stringify(errors), stringify(ins_));
+                return;
+            }
+
+            in_errors.reshape(ins_.x(), ins_.y(), ins_.z(), 1);
+            carry_.clear();
+            for (size_t segment = checkpoints_.size(); segment-- > 0; ) {
+                const size_t first = segment * interval_;
+                const size_t count = std::min(interval_, static_cast<size_t>(ins_.z()) - first);
+
+                layer_.setRecurrentState(checkpoints_[segment]);
+                sliceSteps(ins_, first, count, seg_ins);
+                layer_.forward(seg_ins, seg_outs, trace_);
+                sliceSteps(errors, first, count, seg_errors);
+                layer_.backward(trace_, seg_errors, carry_, seg_in_errors);
+                placeSteps(seg_in_errors, first, in_errors);
+            }
+            layer_.setRecurrentState(end_state_);
+        }
+
+        /*
+         * ==================================================================================================
+         * Function     : train
+         *
+         * Description  : Trains the layer on a batch of sequences, updating the wba after each window, with
+         *                the errors of the outputs being their differences from the targets (the gradients of
+         *                half the squared error).
+         *
+         * Inputs       : ins           : The inputs of the sequences (inputs x batch size x timesteps)
+         *              : targets       : The targets of the outputs (nodes x batch size x timesteps)
+         *              : learning_rate : The learning rate for the updates
+         *              : momentum      : The momentum for the updates
+         *
+         * Outputs      : Half the squared error of the outputs before the updates, averaged over the samples
+         * ==================================================================================================
+         */
+        dType train(const tensor_type& ins, const tensor_type& targets, dType learning_rate, dType momentum = dType(0)) {
+            tensor_type win_ins, win_targets, outs, errors, in_errors;
+            dType       loss = 0;
+
+            for (size_t first = 0; first < ins.z(); first += window_) {
+                const size_t count = std::min(window_, static_cast<size_t>(ins.z()) - first);
+                sliceSteps(ins, first, count, win_ins);
+                sliceSteps(targets, first, count, win_targets);
+                forward(win_ins, outs);
+
+                errors.reshape(outs.x(), outs.y(), outs.z(), 1);
+                for (size_t e = 0; e < outs.size(); e++) {
+                    errors.getData()[e] = outs.getData()[e] - win_targets.getData()[e];
+                    loss += dType(0.5) * errors.getData()[e] * errors.getData()[e];
+                }
+                backward(errors, in_errors);
+                layer_.updateWba(learning_rate, momentum);
+            }
+            return ins.y() == 0 ? dType(0) : loss / ins.y();
+        }
+
+    private:
+        // Copies count timesteps from first of a tensor (the timesteps are the third dimension)
+        static void sliceSteps(const tensor_type& src, size_t first, size_t count, tensor_type& dst) {
+            const size_t step = static_cast<size_t>(src.x()) * src.y();
+            dst.reshape(src.x(), src.y(), count, 1);
+            std::copy(src.hostData().begin() + step * first, src.hostData().begin() + step * (first + count),
+                      dst.getData().begin());
+        }
+
+        // Copies all the timesteps of a tensor into another, starting at timestep first
+        static void placeSteps(const tensor_type& src, size_t first, tensor_type& dst) {
+            const size_t step = static_cast<size_t>(src.x()) * src.y();
+            std::copy(src.hostData().begin(), src.hostData().end(), dst.getData().begin() + step * first);
+        }
+};
+
+}   // Namespace frnn
+
+#endif
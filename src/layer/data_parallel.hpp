@@ -0,0 +1,246 @@
+/*
+ *  Header file for fastRNN data parallel class, which trains replicas of a
+ *  GPU layer on multiple devices, with the batches split between them.
+ *
+ *  Copyright (C) 2015 Rob Clucas robclu1818@gmail.com
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published
+ *  by the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program; if not, write to the Free Software Foundation,
+ *  Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#ifndef _FRNN_DATA_PARALLEL_
+#define _FRNN_DATA_PARALLEL_
+
+#include <cuda_runtime.h>
+#include <nccl.h>
+#include <omp.h>
+
+#include <memory>
+#include <vector>
+
+#include "../tensor/tensor.cuh"
+#include "../util/errors.h"
+#include "../frnn/device_allocator.cuh"
+#include "../frnn/gpu_context.cuh"
+#include "../frnn/nccl_reducer.cuh"
+#include "layer.hpp"
+
+/* ============================================= NOTES ======================================================
+ *
+ * 1. Each device has a replica of the layer, with its own allocator and context (for the device), and a
+ *    NcclGradientReducer as the gradient hook of the context. The replicas start with the same weights, and
+ *    each update averages the gradients over the replicas before they are applied, so the weights of the
+ *    replicas stay the same.
+ *
+ * 2. A batch is split into one shard (of consecutive columns) for each replica, and each replica is run on
+ *    its own thread, so all the replicas queue their work at the same time. The threads must run at the same
+ *    time, since the NCCL all-reduce of each replica only completes once all the replicas have started it.
+ *
+ * 3. The softmax updates use the mean gradient of the shard and the recurrent updates the sum with the
+ *    learning rate divided by the shard size, so for shards of the same size the average of the replicas is
+ *    the mean gradient of the whole batch, and a step of the replicas is a step of a single layer on the
+ *    batch. The batch size must therefore be a multiple of the number of replicas.
+ *
+ * ==========================================================================================================
+ */
+
+namespace frnn {
+
+/*
+ * ==========================================================================================================
+ * Class        : DataParallel
+ *
+ * Description  : Replicas of a GPU layer on multiple devices, which are trained on shards of each batch with
+ *                the gradients all-reduced between them (see NOTES 1 - 3)
+ *
+ * Params       : LayerType     : The type of the layer (which must be for the GPU)
+ * ==========================================================================================================
+ */
+template <typename LayerType>
+class DataParallel {
+    public:
+        typedef typename LayerType::data_type   data_type;
+
+    private:
+        std::vector<int>                                    devices_;       // Device of each replica
+        std::vector<std::unique_ptr<DeviceAllocator>>       allocators_;    // Allocator of each replica
+        std::vector<std::unique_ptr<GpuContext>>            contexts_;      // Context of each replica
+        std::vector<std::unique_ptr<LayerType>>             replicas_;      // Replicas of the layer
+        std::vector<ncclComm_t>                             comms_;         // Communicator of each replica
+        std::vector<std::unique_ptr<NcclGradientReducer>>   reducers_;      // Gradient hook of each replica
+
+    public:
+        /*
+         * ==================================================================================================
+         * Function     : DataParallel
+         *
+         * Description  : Creates a replica of the layer on each device, and the communicator for the
+         *                gradients
+         *
+         * Inputs       : devices       : The devices to put the replicas on (all the devices by default)
+         *              : bucket_bytes  : The max number of bytes of each gradient reduction
+         *              : seed          : The seed of the random number generator of the context of the first
+         *                                replica, replica i uses seed + i so the shards get different numbers
+         * ==================================================================================================
+         */
+        explicit DataParallel(const std::vector<int>& devices      = std::vector<int>(),
+                              size_t                  bucket_bytes = NCCL_BUCKET_BYTES,
+                              unsigned long long      seed         = frnn::rng::DEFAULT_SEED) :
+            devices_(devices) {
+            if (devices_.empty()) {
+                int num_devices = 0;
+                cudaGetDeviceCount(&num_devices);
+                for (int i = 0; i < num_devices; i++) devices_.push_back(i);
+            }
+            int previous = 0;
+            cudaGetDevice(&previous);
+
+            comms_.resize(devices_.size());
+            ncclCommInitAll(&comms_[0], static_cast<int>(devices_.size()), &devices_[0]);
+
+            for (size_t i = 0; i < devices_.size(); i++) {
+                cudaSetDevice(devices_[i]);
+                allocators_.emplace_back(new DeviceAllocator());
+                contexts_.emplace_back(new GpuContext(seed + i, *allocators_[i]));
+                replicas_.emplace_back(new LayerType(*contexts_[i]));
+                reducers_.emplace_back(new NcclGradientReducer(comms_[i], bucket_bytes));
+                contexts_[i]->setGradientHook(reducers_[i].get());
+            }
+            cudaSetDevice(previous);
+        }
+
+        /*
+         * ==================================================================================================
+         * Function     : ~DataParallel
+         *
+         * Description  : Releases the replicas, each with its device current (so their memory is freed on
+         *                the right device), and then the communicator
+         * ==================================================================================================
+         */
+        ~DataParallel() {
+            int previous = 0;
+            cudaGetDevice(&previous);
+            for (size_t i = 0; i < replicas_.size(); i++) {
+                cudaSetDevice(devices_[i]);
+                contexts_[i]->synchronize();
+                replicas_[i].reset();
+                reducers_[i].reset();
+                contexts_[i].reset();
+                allocators_[i].reset();
+                ncclCommDestroy(comms_[i]);
+            }
+            cudaSetDevice(previous);
+        }
+
+        // The replicas own device resources, so they can't be copied
+        DataParallel(const DataParallel&)             = delete;
+        DataParallel& operator=(const DataParallel&)  = delete;
+
+        inline size_t numReplicas() const { return replicas_.size(); }
+        inline LayerType& replica(size_t i) { return *replicas_[i]; }
+        inline const LayerType& replica(size_t i) const { return *replicas_[i]; }
+        inline GpuContext& context(size_t i) { return *contexts_[i]; }
+        inline const NcclGradientReducer& reducer(size_t i) const { return *reducers_[i]; }
+
+        /*
+         * ==================================================================================================
+         * Function     : run
+         *
+         * Description  : Calls f(i, replica, context) for each replica, on its own thread with its device
+         *                current (see NOTES 2)
+         *
+         * Inputs       : f     : The function to call for each replica
+         * ==================================================================================================
+         */
+        template <typename Function>
+        void run(Function f) {
+            const int num_replicas = static_cast<int>(replicas_.size());
+            #pragma omp parallel for num_threads(num_replicas) schedule(static, 1)
+            for (int i = 0; i < num_replicas; i++) {
+                contexts_[i]->makeCurrent();
+                f(static_cast<size_t>(i), *replicas_[i], *contexts_[i]);
+            }
+        }
+
+        /*
+         * ==================================================================================================
+         * Function     : initializeWeights
+         *
+         * Description  : Initializes the weights of all the replicas with the same seed, so they are the same
+         *
+         * Inputs       : min   : The minimum value for the weights
+         *              : max   : The maximum value for the weights
+         *              : seed  : The seed for the random numbers
+         * ==================================================================================================
+         */
+        void initializeWeights(data_type min, data_type max, unsigned long long seed = frnn::rng::DEFAULT_SEED) {
+            run([=](size_t, LayerType& layer, GpuContext&) { layer.initializeWeights(min, max, seed); });
+        }
+
+        /*
+         * ==================================================================================================
+         * Function     : train
+         *
+         * Description  : Does a forward pass, a backward pass and an update of each replica on its shard of a
+         *                batch (see NOTES 3)
+         *
+         * Inputs       : ins           : The inputs of the batch (one column per sample)
+         *              : targets       : The targets of the batch (one column per sample)
+         *              : learning_rate : The learning rate of the update
+         *              : momentum      : The momentum of the update
+         *
+         * Params       : Storage       : The storage policy of the batch
+         * ==================================================================================================
+         */
+        template <template <typename> class Storage>
+        void train(const Tensor4<data_type, Storage>& ins, const Tensor4<data_type, Storage>& targets,
+                   data_type learning_rate = data_type(0.01), data_type momentum = data_type(0)) {
+            frnnError error;
+            if (ins.y() != targets.y() || ins.y() % replicas_.size() != 0) {
+                frnn::err::dimError(error, stringify(ins), stringify(targets));
+                return;
+            }
+
+            const uint shard = ins.y() / static_cast<uint>(replicas_.size());
+            std::vector<Tensor4<data_type>> shard_ins, shard_outs, shard_targets;
+            for (size_t i = 0; i < replicas_.size(); i++) {
+                shard_ins.push_back(column(ins, i * shard, shard));
+                shard_targets.push_back(column(targets, i * shard, shard));
+                shard_outs.push_back(Tensor4<data_type>(targets.x(), shard, 1, 1));
+            }
+
+            run([&](size_t i, LayerType& layer, GpuContext& context) {
+                layer.forward(shard_ins[i], shard_outs[i]);
+                layer.backward(shard_outs[i], shard_targets[i]);
+                layer.updateWba(shard_ins[i], learning_rate, momentum);
+                context.synchronize();
+            });
+        }
+
+    private:
+        // Copies the columns [first, first + count) of a batch
+        template <template <typename> class Storage>
+        static Tensor4<data_type> column(const Tensor4<data_type, Storage>& batch, uint first, uint count) {
+            Tensor4<data_type>      shard(batch.x(), count, 1, 1);
+            const data_type*        batch_h = &batch.hostData()[0];
+            for (uint b = 0; b < count; b++) {
+                for (uint n = 0; n < batch.x(); n++) shard(n, b, 0, 0) = batch_h[batch.index(n, first + b, 0, 0)];
+            }
+            return shard;
+        }
+};
+
+}   // Namespace frnn
+
+#endif
@@ -0,0 +1,206 @@
+/*
+ *  Header file for the fastRNN graph step class, which runs the forward
+ *  pass or the training step of a GPU layer for a fixed batch size as a
+ *  replay of a captured CUDA graph.
+ *
+ *  Copyright (C) 2015 Rob Clucas robclu1818@gmail.com
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published
+ *  by the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program; if not, write to the Free Software Foundation,
+ *  Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#ifndef _FRNN_GRAPH_STEP_
+#define _FRNN_GRAPH_STEP_
+
+#include <vector>
+
+#include "../tensor/tensor.cuh"
+#include "../util/errors.h"
+#include "../frnn/cuda_graph.cuh"
+#include "layer.hpp"
+
+/* ============================================= NOTES ======================================================
+ *
+ * 1. For a fixed batch size the launches of a step of a layer (the gemms of the pages, the sum of the pages,
+ *    the softmax, the errors and the update) are the same for every step, so at small batch sizes, where each
+ *    kernel is short, the time on the host to launch them is most of the step. The step has its own input,
+ *    target and output tensors, and is captured into a CudaGraph (see cuda_graph.cuh) with the tensors of the
+ *    caller as its bindings, so a step after the first one is a single graph launch.
+ *
+ * 2. The wba, the wba deltas and the errors of the layer are in the graph, so before each replay the layer
+ *    makes their device copies current (see Layer::deviceBuffers), which uploads any changes made to them on
+ *    the host and lets reads on the host after the replay get its results. If any of them has moved on the
+ *    device the step is captured again.
+ *
+ * 3. The learning rate and the momentum are arguments of the update kernels, so they are part of a captured
+ *    training step, and changing them captures the step again.
+ *
+ * ==========================================================================================================
+ */
+
+namespace frnn {
+
+/*
+ * ==========================================================================================================
+ * Class        : GraphStep
+ *
+ * Description  : The forward pass and the training step (forward, backward and update) of a GPU layer for a
+ *                fixed batch size, each captured into a CUDA graph on its first run and replayed after that
+ *                (see NOTES 1 - 3). The tensors are on the device, and nothing waits for the stream.
+ *
+ * Params       : LayerType     : The type of the layer (which must be for the GPU, with a policy which keeps
+ *                                its parameters in device tensors)
+ * ==========================================================================================================
+ */
+template <typename LayerType>
+class GraphStep {
+    public:
+        typedef typename LayerType::data_type           data_type;
+        typedef Tensor4<data_type, storage::Device>     tensor_type;
+
+    private:
+        LayerType*                  layer_;                 // Layer which the steps are for
+        uint                        batch_size_;            // Batch size of the steps
+        tensor_type                 ins_;                   // Inputs of the steps
+        tensor_type                 targets_;               // Targets of the training step
+        tensor_type                 outs_;                  // Outputs of the steps
+        CudaGraph                   forward_graph_;         // Graph of the forward pass
+        CudaGraph                   train_graph_;           // Graph of the training step
+        std::vector<const void*>    forward_buffers_;       // Buffers of the layer when forward was captured
+        std::vector<const void*>    train_buffers_;         // Buffers of the layer when train was captured
+        data_type                   learning_rate_;         // Learning rate of the captured training step
+        data_type                   momentum_;              // Momentum of the captured training step
+
+    public:
+        /*
+         * ==================================================================================================
+         * Function     : GraphStep
+         *
+         * Description  : Creates the steps of a layer for a batch size, the graphs are captured on the first
+         *                run of each step
+         *
+         * Inputs       : layer         : The layer, which must outlive the steps
+         *              : batch_size    : The number of samples of each step
+         * ==================================================================================================
+         */
+        GraphStep(LayerType& layer, uint batch_size) :
+            layer_(&layer), batch_size_(batch_size),
+            ins_(LayerType::input_count, batch_size, 1, 1), targets_(LayerType::node_count, batch_size, 1, 1),
+            outs_(LayerType::node_count, batch_size, 1, 1), forward_graph_(layer.gpuContext()),
+            train_graph_(layer.gpuContext()), learning_rate_(0), momentum_(0) {
+            ins_.overwriteDeviceData();
+            targets_.overwriteDeviceData();
+            outs_.overwriteDeviceData();
+        }
+
+        /*
+         * ==================================================================================================
+         * Function     : forward
+         *
+         * Description  : Forward pass of the layer for a batch
+         *
+         * Inputs       : error     : fastRNN error type for the result of the step
+         *              : ins       : The inputs (num_inputs x batch size)
+         *
+         * Outputs      : outs      : The outputs of the layer (nodes x batch size)
+         * ==================================================================================================
+         */
+        void forward(frnnError& error, const tensor_type& ins, tensor_type& outs) {
+            if (!checkBatch(error, ins, outs)) return;
+
+            std::vector<graph_binding> in_bindings(1, binding(ins_, ins));
+            std::vector<graph_binding> out_bindings(1, binding(outs, outs_));
+            prepare(forward_graph_, forward_buffers_);
+            forward_graph_.run(error, in_bindings, [this] { layer_->forward(ins_, outs_); }, out_bindings);
+            layer_->deviceBuffers(forward_buffers_);
+        }
+
+        /*
+         * ==================================================================================================
+         * Function     : train
+         *
+         * Description  : Training step of the layer for a batch: the forward pass, the errors for the
+         *                targets and the update of the wba with the mean gradient of the batch
+         *
+         * Inputs       : error         : fastRNN error type for the result of the step
+         *              : ins           : The inputs (num_inputs x batch size)
+         *              : targets       : The targets (nodes x batch size)
+         *              : learning_rate : The learning rate for the update
+         *              : momentum      : The momentum for the update
+         *
+         * Outputs      : outs          : The outputs of the forward pass (nodes x batch size)
+         * ==================================================================================================
+         */
+        void train(frnnError& error, const tensor_type& ins, const tensor_type& targets, tensor_type& outs,
+                   data_type learning_rate, data_type momentum = 0) {
+            if (!checkBatch(error, ins, outs)) return;
+            if (targets.x() != LayerType::node_count || targets.y() != batch_size_) {
+                frnn::err::dimError(error, stringify(targets), stringify(outs));
+                return;
+            }
+
+            // The rates are in the captured update (see NOTES 3)
+            if (learning_rate != learning_rate_ || momentum != momentum_) train_graph_.reset();
+            learning_rate_ = learning_rate;
+            momentum_      = momentum;
+
+            std::vector<graph_binding> in_bindings;
+            in_bindings.push_back(binding(ins_, ins));
+            in_bindings.push_back(binding(targets_, targets));
+            std::vector<graph_binding> out_bindings(1, binding(outs, outs_));
+            prepare(train_graph_, train_buffers_);
+            train_graph_.run(error, in_bindings, [this] {
+                layer_->forward(ins_, outs_);
+                layer_->backward(outs_, targets_);
+                layer_->updateWba(ins_, learning_rate_, momentum_);
+            }, out_bindings);
+            layer_->deviceBuffers(train_buffers_);
+        }
+
+        // The graphs of the forward pass and the training step
+        inline const CudaGraph& forwardGraph() const { return forward_graph_; }
+        inline const CudaGraph& trainGraph() const { return train_graph_; }
+
+        inline uint batchSize() const { return batch_size_; }
+
+    private:
+        // Checks the batch of the inputs, and shapes the outputs for it
+        bool checkBatch(frnnError& error, const tensor_type& ins, tensor_type& outs) {
+            if (ins.x() != LayerType::input_count || ins.y() != batch_size_) {
+                frnn::err::dimError(error, stringify(ins), stringify(batch_size_));
+                return false;
+            }
+            if (outs.x() != LayerType::node_count || outs.y() != batch_size_ || outs.size() != outs_.size()) {
+                outs.reshape(LayerType::node_count, batch_size_, 1, 1);
+            }
+            return true;
+        }
+
+        // A copy of all of src into dst, the whole of dst is overwritten
+        static graph_binding binding(tensor_type& dst, const tensor_type& src) {
+            graph_binding copy = { dst.overwriteDeviceData(), src.deviceData(), src.size() * sizeof(data_type) };
+            return copy;
+        }
+
+        // Makes the buffers of the layer current, and resets the graph if they moved (see NOTES 2)
+        void prepare(CudaGraph& graph, const std::vector<const void*>& captured_buffers) {
+            std::vector<const void*> buffers;
+            layer_->deviceBuffers(buffers);
+            if (buffers != captured_buffers) graph.reset();
+        }
+};
+
+}   // Namespace frnn
+
+#endif
@@ -0,0 +1,536 @@
+/*
+ *  Header file for the fastRNN inference server, which batches the sequences
+ *  of concurrent requests into forward passes of a layer (or a network) and
+ *  keeps the recurrent state of each sequence between its requests.
+ *
+ *  Copyright (C) 2015 Rob Clucas robclu1818@gmail.com
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published
+ *  by the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program; if not, write to the Free Software Foundation,
+ *  Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#ifndef _FRNN_INFERENCE_SERVER_
+#define _FRNN_INFERENCE_SERVER_
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <deque>
+#include <exception>
+#include <future>
+#include <memory>
+#include <thread>
+#include <unordered_map>
+#include <unordered_set>
+#include <utility>
+#include <vector>
+
+#include "../tensor/tensor.cuh"
+#include "../containers/mpsc_queue.h"
+#include "../util/errors.h"
+#include "../frnn/profiler.cuh"
+
+/* ============================================= NOTES ======================================================
+ *
+ * 1. Clients on any number of threads submit requests (the inputs of the next timesteps of a sequence) to
+ *    a lock-free queue (see mpsc_queue.h), and a single worker thread, which is the only one which uses
+ *    the model, takes them off the queue and runs them in batches. A batch is the oldest request and the
+ *    requests after it with the same number of timesteps, so it is one forward pass of the model over
+ *    (inputs x batch size x timesteps). A batch is run when it has max_batch requests or when its oldest
+ *    request has waited for max_delay, so the delay which batching adds to a request is at most max_delay
+ *    (plus the time of the batches before it).
+ *
+ * 2. The recurrent state of each sequence (see recurrent_state in types/recurrent_cells.hpp) is kept
+ *    between its requests by the server. Before a batch the states of its sequences are gathered into the
+ *    columns of the state of the model, and after the batch they are scattered back, so each sequence
+ *    carries on from its own last timestep, as if it had been run on its own. A new sequence (or a request
+ *    which starts its sequence again) starts from zeros. Only models with a recurrent state (recurrentState
+ *    and setRecurrentState, which recurrent layers have) have state which is kept, other models must not
+ *    keep any state between forward passes (a network of recurrent layers would mix the states of batches).
+ *
+ * 3. Requests of the same sequence depend on each other, so a batch has at most one request of each
+ *    sequence, and the requests of a sequence are run in the order they were submitted (a request which
+ *    isn't in a batch keeps the later requests of its sequence out of the batch too). Ending a sequence
+ *    (which frees its state) is a request as well, so it happens after the requests before it.
+ *
+ * 4. The worker polls the queue every idle_wait while there are no requests, so that submitting never
+ *    waits on a lock or wakes a thread, which bounds the delay of the first request after a quiet time to
+ *    idle_wait.
+ *
+ * ==========================================================================================================
+ */
+
+namespace frnn {
+
+/*
+ * ==========================================================================================================
+ * Struct       : inference_options
+ *
+ * Description  : The batching of an inference server (see NOTES 1 and 4)
+ * ==========================================================================================================
+ */
+struct inference_options {
+    uint                        max_batch;          // Max number of sequences of a batch
+    std::chrono::microseconds   max_delay;          // Max time a request waits for its batch to fill
+    std::chrono::microseconds   idle_wait;          // Time between polls of the queue when it's empty
+
+    inference_options() : max_batch( 64 ), max_delay( 1000 ), idle_wait( 50 ) {}
+};
+
+/*
+ * ==========================================================================================================
+ * Struct       : inference_stats
+ *
+ * Description  : The counts of the requests and the batches of an inference server
+ * ==========================================================================================================
+ */
+struct inference_stats {
+    size_t      requests;                           // Requests which have been run
+    size_t      batches;                            // Forward passes
+    size_t      full_batches;                       // Batches which had max_batch requests
+    size_t      sequences;                          // Sequences which have a state
+};
+
+/*
+ * ==========================================================================================================
+ * Class        : InferenceServer
+ *
+ * Description  : Runs the requests of concurrent clients through a model in dynamic batches, and keeps the
+ *                recurrent state of each sequence between its requests (see NOTES 1 - 4). Each request is
+ *                the inputs of one or more timesteps of a sequence, and gets the outputs of the model for
+ *                the timesteps.
+ *
+ * Params       : Model     : The type of the model (a Layer or a Network)
+ *              : Storage   : The storage policy of the inputs and outputs of the forward passes
+ * ==========================================================================================================
+ */
+template <typename Model, template <typename> class Storage = storage::Host>
+class InferenceServer {
+    public:
+        typedef typename Model::data_type       dType;
+        typedef std::vector<dType>              result_type;
+        typedef Tensor4<dType, Storage>         tensor_type;
+        typedef std::chrono::steady_clock       clock_type;
+
+    private:
+        // A request for the timesteps of a sequence, or to end a sequence
+        struct request {
+            uint64_t                    sequence;       // Id of the sequence
+            bool                        start;          // If the sequence starts again at this request
+            bool                        end;            // If the sequence ends (without any timesteps)
+            uint                        timesteps;      // Timesteps of the inputs
+            std::vector<dType>          ins;            // Inputs : inputs x timesteps
+            std::promise<result_type>   result;         // Outputs : nodes x timesteps
+            clock_type::time_point      arrival;        // When the request was submitted
+        };
+        typedef std::unique_ptr<request> request_ptr;
+
+        // The recurrent state of a sequence, the column of the sequence of each tensor of the state
+        struct sequence_state {
+            std::vector<dType>  hidden;
+            std::vector<dType>  inputs;
+            std::vector<dType>  cells;
+        };
+
+        Model&                                          model_;         // Model which the batches are run on
+        inference_options                               options_;
+        MpscQueue<request_ptr>                          queue_;         // Submitted requests
+        std::deque<request_ptr>                         pending_;       // Taken off the queue, not yet run
+        std::unordered_map<uint64_t, sequence_state>    states_;        // State of each sequence
+        tensor_type                                     ins_;           // Inputs of a batch
+        tensor_type                                     outs_;          // Outputs of a batch
+        std::atomic<bool>                               stopping_;      // If the worker must finish
+        std::atomic<size_t>                             requests_;
+        std::atomic<size_t>                             batches_;
+        std::atomic<size_t>                             full_batches_;
+        std::atomic<size_t>                             sequences_;
+        std::thread                                     worker_;        // Runs the batches
+
+    public:
+        /*
+         * ==================================================================================================
+         * Function     : InferenceServer
+         *
+         * Description  : Creates a server for a model and starts its worker, the model must not be used by
+         *                anything else until the server is destroyed
+         *
+         * Inputs       : model     : The model, which must outlive the server
+         *              : options   : The batching of the server
+         * ==================================================================================================
+         */
+        explicit InferenceServer( Model& model, const inference_options& options = inference_options() ) :
+            model_( model ), options_( options ), stopping_( false ), requests_( 0 ), batches_( 0 ),
+            full_batches_( 0 ), sequences_( 0 ) {
+            options_.max_batch = std::max( options_.max_batch, 1u );
+            worker_ = std::thread( [ this ] { run(); } );
+        }
+
+        InferenceServer( const InferenceServer& )               = delete;
+        InferenceServer& operator=( const InferenceServer& )    = delete;
+
+        /*
+         * ==================================================================================================
+         * Function     : ~InferenceServer
+         *
+         * Description  : Runs the requests which have been submitted and stops the worker
+         * ==================================================================================================
+         */
+        ~InferenceServer() {
+            stopping_.store( true, std::memory_order_release );
+            worker_.join();
+        }
+
+        /*
+         * ==================================================================================================
+         * Function     : submit
+         *
+         * Description  : Submits the inputs of the next timesteps of a sequence, from any thread
+         *
+         * Inputs       : error     : fastRNN error type for the result of the submission
+         *              : sequence  : The id of the sequence
+         *              : ins       : The inputs (inputs x timesteps, the inputs of each timestep together)
+         *              : start     : If the sequence starts again from zeros at these timesteps
+         *
+         * Outputs      : The outputs of the model for the timesteps (nodes x timesteps) when the batch of the
+         *                request is done, or an invalid future if the inputs aren't whole timesteps
+         * ==================================================================================================
+         */
+        std::future<result_type> submit( frnnError& error, uint64_t sequence, std::vector<dType> ins,
+                                         bool start = false ) {
+            const size_t num_inputs = Model::input_count;
+            if ( ins.empty() || ins.size() % num_inputs != 0 ) {
+                frnn::err::dimError( error, stringify( ins ), stringify( Model::input_count ) );
+                return std::future<result_type>();
+            }
+
+            request_ptr new_request( new request() );
+            new_request->sequence  = sequence;
+            new_request->start     = start;
+            new_request->end       = false;
+            new_request->timesteps = static_cast<uint>( ins.size() / num_inputs );
+            new_request->ins       = std::move( ins );
+            new_request->arrival   = clock_type::now();
+
+            std::future<result_type> result = new_request->result.get_future();
+            queue_.push( std::move( new_request ) );
+            return result;
+        }
+
+        /*
+         * ==================================================================================================
+         * Function     : endSequence
+         *
+         * Description  : Frees the state of a sequence after its requests which have been submitted, from
+         *                any thread (a later request of the sequence starts it from zeros)
+         *
+         * Inputs       : sequence  : The id of the sequence
+         * ==================================================================================================
+         */
+        void endSequence( uint64_t sequence ) {
+            request_ptr end_request( new request() );
+            end_request->sequence  = sequence;
+            end_request->start     = false;
+            end_request->end       = true;
+            end_request->timesteps = 0;
+            end_request->arrival   = clock_type::now();
+            queue_.push( std::move( end_request ) );
+        }
+
+        /*
+         * ==================================================================================================
+         * Function     : stats
+         *
+         * Description  : Gets the counts of the requests and the batches which have been run
+         * ==================================================================================================
+         */
+        inference_stats stats() const {
+            inference_stats counts = { requests_.load(), batches_.load(), full_batches_.load(),
+                                       sequences_.load() };
+            return counts;
+        }
+
+        inline const inference_options& options() const { return options_; }
+
+    private:
+        /*
+         * ==================================================================================================
+         * Function     : run
+         *
+         * Description  : The loop of the worker, which runs batches until it's stopped and every request has
+         *                been run (see NOTES 1 and 4)
+         * ==================================================================================================
+         */
+        void run() {
+            while ( true ) {
+                takeRequests();
+                while ( !pending_.empty() && pending_.front()->end ) endFront();
+
+                if ( pending_.empty() ) {
+                    if ( stopping_.load( std::memory_order_acquire ) && queue_.empty() ) return;
+                    std::this_thread::sleep_for( options_.idle_wait );
+                    continue;
+                }
+                if ( !batchReady() ) {
+                    const clock_type::time_point deadline = pending_.front()->arrival + options_.max_delay;
+                    std::this_thread::sleep_until( std::min( deadline,
+                                                             clock_type::now() + options_.idle_wait ) );
+                    continue;
+                }
+                runBatch();
+            }
+        }
+
+        /*
+         * ==================================================================================================
+         * Function     : takeRequests
+         *
+         * Description  : Moves the requests which have been submitted from the queue to the pending requests
+         * ==================================================================================================
+         */
+        void takeRequests() {
+            request_ptr next;
+            while ( queue_.pop( next ) ) pending_.push_back( std::move( next ) );
+        }
+
+        /*
+         * ==================================================================================================
+         * Function     : endFront
+         *
+         * Description  : Frees the state of the sequence of the oldest request, which is an end
+         * ==================================================================================================
+         */
+        void endFront() {
+            if ( states_.erase( pending_.front()->sequence ) != 0 ) sequences_--;
+            pending_.pop_front();
+        }
+
+        /*
+         * ==================================================================================================
+         * Function     : batchRequests
+         *
+         * Description  : Gets the pending requests which can be in the batch of the oldest request, in order
+         *                (see NOTES 3)
+         *
+         * Outputs      : batch     : The indices of the requests of the batch in the pending requests
+         * ==================================================================================================
+         */
+        void batchRequests( std::vector<size_t>& batch ) const {
+            std::unordered_set<uint64_t> seen;
+            const uint timesteps = pending_.front()->timesteps;
+
+            batch.clear();
+            for ( size_t i = 0; i < pending_.size() && batch.size() < options_.max_batch; i++ ) {
+                const request& candidate = *pending_[ i ];
+                if ( !seen.insert( candidate.sequence ).second ) continue;
+                if ( !candidate.end && candidate.timesteps == timesteps ) batch.push_back( i );
+            }
+        }
+
+        /*
+         * ==================================================================================================
+         * Function     : batchReady
+         *
+         * Description  : Gets if the batch of the oldest request must be run now, because it is full, its
+         *                oldest request has waited for max_delay, or the server is stopping (see NOTES 1)
+         * ==================================================================================================
+         */
+        bool batchReady() const {
+            if ( stopping_.load( std::memory_order_acquire ) ) return true;
+            if ( clock_type::now() >= pending_.front()->arrival + options_.max_delay ) return true;
+
+            std::vector<size_t> batch;
+            batchRequests( batch );
+            return batch.size() == options_.max_batch;
+        }
+
+        /*
+         * ==================================================================================================
+         * Function     : runBatch
+         *
+         * Description  : Runs the batch of the oldest request, and gives each request its outputs (or the
+         *                exception of the forward pass if it throws)
+         * ==================================================================================================
+         */
+        void runBatch() {
+            FRNN_PROFILE_OP( "InferenceServer::batch", 0, 0, false );
+            std::vector<size_t> indices;
+            batchRequests( indices );
+
+            std::vector<request_ptr> batch;
+            for ( size_t i : indices ) batch.push_back( std::move( pending_[ i ] ) );
+            for ( size_t i = indices.size(); i-- > 0; ) pending_.erase( pending_.begin() + indices[ i ] );
+
+            const uint num_inputs = Model::input_count;
+            const uint nodes      = Model::node_count;
+            const uint batch_size = static_cast<uint>( batch.size() );
+            const uint timesteps  = batch[ 0 ]->timesteps;
+
+            try {
+                ins_.reshape( num_inputs, batch_size, timesteps, 1 );
+                auto& ins = ins_.getData();
+                for ( uint b = 0; b < batch_size; b++ ) {
+                    for ( uint t = 0; t < timesteps; t++ ) {
+                        std::copy( batch[ b ]->ins.begin() + t * num_inputs,
+                                   batch[ b ]->ins.begin() + ( t + 1 ) * num_inputs,
+                                   ins.begin() + ins_.index( 0, b, t, 0 ) );
+                    }
+                }
+
+                gatherStates( batch, model_, 0 );
+                model_.forward( ins_, outs_ );
+                scatterStates( batch, model_, 0 );
+
+                countBatch( batch_size );
+                const auto& outs = static_cast<const tensor_type&>( outs_ ).hostData();
+                for ( uint b = 0; b < batch_size; b++ ) {
+                    result_type result( static_cast<size_t>( nodes ) * timesteps );
+                    for ( uint t = 0; t < timesteps; t++ ) {
+                        std::copy( outs.begin() + outs_.index( 0, b, t, 0 ),
+                                   outs.begin() + outs_.index( 0, b, t, 0 ) + nodes,
+                                   result.begin() + t * nodes );
+                    }
+                    batch[ b ]->result.set_value( std::move( result ) );
+                }
+            } catch ( ... ) {
+                countBatch( batch_size );
+                for ( auto& failed : batch ) failed->result.set_exception( std::current_exception() );
+            }
+        }
+
+        /*
+         * ==================================================================================================
+         * Function     : countBatch
+         *
+         * Description  : Counts a batch before its results are set, so that the stats include it for the
+         *                clients
+         *
+         * Inputs       : batch_size    : The number of requests of the batch
+         * ==================================================================================================
+         */
+        void countBatch( uint batch_size ) {
+            requests_ += batch_size;
+            batches_++;
+            if ( batch_size == options_.max_batch ) full_batches_++;
+        }
+
+        /*
+         * ==================================================================================================
+         * Function     : gatherStates
+         *
+         * Description  : Sets the state of the model to the states of the sequences of a batch (see NOTES 2),
+         *                for models with a recurrent state (the int overload), and does nothing for other
+         *                models (the long overload)
+         *
+         * Inputs       : batch     : The requests of the batch
+         *              : model     : The model
+         *
+         * Params       : Batch     : The type of the requests of the batch
+         *              : M         : The type of the model
+         * ==================================================================================================
+         */
+        template <typename Batch, typename M>
+        auto gatherStates( const Batch& batch, M& model, int )
+            -> decltype( model.setRecurrentState( model.recurrentState() ), void() ) {
+            typedef typename std::decay<decltype( model.recurrentState() )>::type state_type;
+            const uint batch_size = static_cast<uint>( batch.size() );
+
+            state_type state;
+            state.reset( Model::node_count, Model::input_count, batch_size, model.depth, true );
+            for ( uint b = 0; b < batch_size; b++ ) {
+                auto found = states_.find( batch[ b ]->sequence );
+                if ( found == states_.end() || batch[ b ]->start ) continue;
+                toColumn( found->second.hidden, state.hidden, b );
+                toColumn( found->second.inputs, state.inputs, b );
+                toColumn( found->second.cells , state.cells , b );
+            }
+            model.setRecurrentState( state );
+        }
+
+        template <typename Batch, typename M>
+        void gatherStates( const Batch&, M&, long ) {}
+
+        /*
+         * ==================================================================================================
+         * Function     : scatterStates
+         *
+         * Description  : Keeps the state of each sequence of a batch after the batch (see NOTES 2), for
+         *                models with a recurrent state (the int overload), and does nothing for other models
+         *                (the long overload)
+         *
+         * Inputs       : batch     : The requests of the batch
+         *              : model     : The model
+         *
+         * Params       : Batch     : The type of the requests of the batch
+         *              : M         : The type of the model
+         * ==================================================================================================
+         */
+        template <typename Batch, typename M>
+        auto scatterStates( const Batch& batch, M& model, int )
+            -> decltype( model.setRecurrentState( model.recurrentState() ), void() ) {
+            const auto& state = model.recurrentState();
+            for ( uint b = 0; b < static_cast<uint>( batch.size() ); b++ ) {
+                auto inserted = states_.insert( std::make_pair( batch[ b ]->sequence, sequence_state() ) );
+                if ( inserted.second ) sequences_++;
+                fromColumn( state.hidden, b, inserted.first->second.hidden );
+                fromColumn( state.inputs, b, inserted.first->second.inputs );
+                fromColumn( state.cells , b, inserted.first->second.cells  );
+            }
+        }
+
+        template <typename Batch, typename M>
+        void scatterStates( const Batch&, M&, long ) {}
+
+        /*
+         * ==================================================================================================
+         * Function     : toColumn / fromColumn
+         *
+         * Description  : Copies the column of a sequence (x x z) into column b of a state tensor
+         *                (x x batch size x z), or column b of a state tensor into the column of a sequence
+         *
+         * Inputs       : column    : The column of the sequence (for toColumn)
+         *              : tensor    : The state tensor (for fromColumn)
+         *              : b         : The column of the sequence in the state tensor
+         *
+         * Outputs      : tensor    : The state tensor (for toColumn)
+         *              : column    : The column of the sequence (for fromColumn)
+         *
+         * Params       : Tensor    : The type of the state tensor
+         * ==================================================================================================
+         */
+        template <typename Tensor>
+        static void toColumn( const std::vector<dType>& column, Tensor& tensor, uint b ) {
+            if ( column.size() != static_cast<size_t>( tensor.x() ) * tensor.z() ) return;
+            auto& data = tensor.getData();
+            for ( uint z = 0; z < tensor.z(); z++ ) {
+                std::copy( column.begin() + z * tensor.x(), column.begin() + ( z + 1 ) * tensor.x(),
+                           data.begin() + tensor.index( 0, b, z, 0 ) );
+            }
+        }
+
+        template <typename Tensor>
+        static void fromColumn( const Tensor& tensor, uint b, std::vector<dType>& column ) {
+            const auto& data = tensor.hostData();
+            column.resize( static_cast<size_t>( tensor.x() ) * tensor.z() );
+            for ( uint z = 0; z < tensor.z(); z++ ) {
+                std::copy( data.begin() + tensor.index( 0, b, z, 0 ),
+                           data.begin() + tensor.index( 0, b, z, 0 ) + tensor.x(),
+                           column.begin() + z * tensor.x() );
+            }
+        }
+};
+
+}   // Namespace frnn
+
+#endif
@@ -21,10 +21,15 @@
 #ifndef _FRNN_LAYER_
 #define _FRNN_LAYER_
 
-#include <omp.h>
+#include <algorithm>
+#include <type_traits>
+#include <utility>
 
 #include "../tensor/tensor.cuh"
+#include "../tensor/checkpoint.cuh"
 #include "../math/math.hpp"
+#include "../frnn/gpu_context.cuh"
+#include "../frnn/profiler.cuh"
 
 namespace frnn {
 
@@ -53,6 +58,11 @@ template <typename                          dType,
 class Layer : public TypePolicy<dType, dev, _nodes, _inputs, _depth> {  
 
     public:
+        typedef dType                                           data_type;
+        typedef TypePolicy<dType, dev, _nodes, _inputs, _depth> policy_type;
+        static constexpr uint node_count  = _nodes;             // Sizes for checking layers at compile time
+        static constexpr uint input_count = _inputs;
+
         uint                num_nodes;
         uint                num_inputs;
         uint                depth;
@@ -63,9 +73,13 @@ class Layer : public TypePolicy<dType, dev, _nodes, _inputs, _depth> {
          * Function     : layer 
          *
          * Description  : Defines the size of the layer and the layer parameters. 
+         *
+         * Inputs       : context   : The GPU context used by the layer's GPU functions, which must outlive
+         *                            the layer (the process wide context is used by default)
          * ==================================================================================================
          */
-        explicit Layer() :
+        explicit Layer(GpuContext& context = GpuContext::global()) :
+            TypePolicy<dType, dev, _nodes, _inputs, _depth>(context),
             num_nodes(_nodes), num_inputs(_inputs), depth(_depth), outputs(_nodes, 0) {}
 
         /*
@@ -73,23 +87,20 @@ class Layer : public TypePolicy<dType, dev, _nodes, _inputs, _depth> {
          * Function     : initializeWeights
          * 
          * Description  : Initialzes the weights between a certain range (by default the weights are
-         *                initialized to 0 during construction).
+         *                initialized to 0 during construction). The weights of all the pages are one Philox
+         *                stream for the seed, so layers with the same seed have the same weights on the CPU 
+         *                and the GPU. The weights of device wbas are made on the device. Only the weights at
+         *                the start of each page (see weightsPerPage of the TypePolicy) are initialized.
          *
          * Inputs       : min   : The minimum value for the weights
          *              : max   : The maximum value for the weights
+         *              : seed  : The seed for the random numbers
          * ==================================================================================================
          */
-        inline void initializeWeights(dType min, dType max) {
-            // For each page in the tensor, use a thread to initialize the weights
-            #pragma omp parallel num_threads (depth)
-            {
-                int thread_id       = omp_get_thread_num();
-                dType* weight_start = &this->wba(0, 0, thread_id, 0);
-                size_t num_elements = num_nodes * std::max(num_nodes, num_inputs);
-                
-                // CPU version is a lot faster at the moment due to CPU-GPU transfer, so use CPU
-                frnn::math<dType, frnn::device::CPU>::rand(weight_start, num_elements, min, max);
-            }
+        inline void initializeWeights(dType min, dType max, unsigned long long seed = frnn::rng::DEFAULT_SEED) {
+            typedef typename TypePolicy<dType, dev, _nodes, _inputs, _depth>::wba_type wba_type;
+            initializeWeights(min, max, seed, std::integral_constant<bool, wba_type::on_device>());
+            loadPlanes(static_cast<TypePolicy<dType, dev, _nodes, _inputs, _depth>&>(*this), 0);
         }
         
         /*
@@ -101,11 +112,52 @@ class Layer : public TypePolicy<dType, dev, _nodes, _inputs, _depth> {
          * Outputs      : A constant pointer to the weights, biases, and activations of the layer
          * ==================================================================================================
          */
-        inline const Tensor4<dType>& getWBA() const { 
+        inline const typename TypePolicy<dType, dev, _nodes, _inputs, _depth>::wba_type& getWBA() const { 
             // wba tensor in the typePolicy instance
+            packPlanes(static_cast<const TypePolicy<dType, dev, _nodes, _inputs, _depth>&>(*this), 0);
             return this->wba;
         }
         
+        /*
+         * ==================================================================================================
+         * Function     : saveWeights
+         * 
+         * Description  : Adds the wba of the layer to a checkpoint, the writer keeps a reference to the wba, 
+         *                so the layer must not be updated until the checkpoint is written
+         *
+         * Inputs       : error     : fastRNN error type for the result
+         *              : writer    : The writer of the checkpoint
+         *              : name      : The name of the wba in the checkpoint
+         * ==================================================================================================
+         */
+        inline bool saveWeights(frnnError& error, CheckpointWriter& writer, const char* name) const {
+            return writer.add(error, name, getWBA());
+        }
+
+        /*
+         * ==================================================================================================
+         * Function     : loadWeights
+         * 
+         * Description  : Loads the wba of the layer from a checkpoint, which must have the dimensions of the
+         *                wba of the layer. Device wbas are copied straight from the checkpoint to the device.
+         *
+         * Inputs       : error         : fastRNN error type for the result
+         *              : checkpoint    : The checkpoint to load the wba from
+         *              : name          : The name of the wba in the checkpoint
+         * ==================================================================================================
+         */
+        inline bool loadWeights(frnnError& error, const Checkpoint& checkpoint, const char* name) {
+            const checkpoint_entry* wba_entry = checkpoint.find(name);
+            if (wba_entry != 0 && (wba_entry->dims[0] != this->wba.x() || wba_entry->dims[1] != this->wba.y() ||
+                                   wba_entry->dims[2] != this->wba.z() || wba_entry->dims[3] != this->wba.w())) {
+                frnn::err::dimError(error, name, stringify(this->wba));
+                return false;
+            }
+            if (!checkpoint.load(error, name, this->wba)) return false;
+            loadPlanes(static_cast<TypePolicy<dType, dev, _nodes, _inputs, _depth>&>(*this), 0);
+            return true;
+        }
+
         /*
          * ==================================================================================================
          * Function     : outputs 
@@ -130,7 +182,100 @@ class Layer : public TypePolicy<dType, dev, _nodes, _inputs, _depth> {
          */
         inline const dType* getErrors() const {
             // Errors vector in typepolicy base
-            return &(this->errors[0]); 
+            return &(this->errors.hostData()[0]); 
+        }
+
+        /*
+         * ==================================================================================================
+         * Function     : gpuContext
+         *
+         * Description  : Gets the GPU context of the layer
+         * ==================================================================================================
+         */
+        inline GpuContext& gpuContext() const { return *this->context; }
+
+        /*
+         * ==================================================================================================
+         * Function     : deviceBuffers
+         *
+         * Description  : Makes the device copies of the wba, the wba deltas and the errors of the layer the
+         *                most recent ones, uploading any changes made on the host, for device work which the 
+         *                layer doesn't queue itself (a replay of a CUDA graph, see graph_step.hpp), so that
+         *                reads on the host after the work get its results. Only for policies which keep them 
+         *                in device tensors.
+         *
+         * Outputs      : buffers   : The device pointers of the wba, the wba deltas and the errors
+         * ==================================================================================================
+         */
+        inline void deviceBuffers(std::vector<const void*>& buffers) {
+            buffers.clear();
+            buffers.push_back(this->wba.deviceData());
+            buffers.push_back(this->wba_deltas.deviceData());
+            buffers.push_back(this->errors.deviceData());
+        }
+
+        /*
+         * ==================================================================================================
+         * Function     : forward / backward / updateWba
+         *
+         * Description  : The passes of the TypePolicy (with the same arguments), where each pass is an op of
+         *                the profiler (see profiler.cuh), which is on the primary stream of the context for
+         *                GPU layers and on the host for CPU layers
+         * ==================================================================================================
+         */
+        template <typename... Args>
+        inline auto forward(Args&&... args) -> decltype(std::declval<policy_type&>().forward(std::forward<Args>(args)...)) {
+            FRNN_PROFILE_OP("Layer::forward", 0, opStream(), dev == device::GPU);
+            return policy_type::forward(std::forward<Args>(args)...);
+        }
+
+        template <typename... Args>
+        inline auto backward(Args&&... args) -> decltype(std::declval<policy_type&>().backward(std::forward<Args>(args)...)) {
+            FRNN_PROFILE_OP("Layer::backward", 0, opStream(), dev == device::GPU);
+            return policy_type::backward(std::forward<Args>(args)...);
+        }
+
+        template <typename... Args>
+        inline auto updateWba(Args&&... args) -> decltype(std::declval<policy_type&>().updateWba(std::forward<Args>(args)...)) {
+            FRNN_PROFILE_OP("Layer::updateWba", 0, opStream(), dev == device::GPU);
+            return policy_type::updateWba(std::forward<Args>(args)...);
+        }
+    private:
+        // The stream of the ops of the layer (CPU layers are timed on the host)
+        inline cudaStream_t opStream() const { return dev == device::GPU ? this->context->stream() : cudaStream_t(0); }
+
+        // Policies which keep their parameters in planes (see AlignedSoftmaxPolicy) have wba as a view, 
+        // which is loaded into the planes when it's changed and packed from the planes when it's read (and
+        // policies with a quantized copy of the weights, see QuantizedSoftmaxPolicy, load it the same way)
+        template <typename Policy>
+        static auto loadPlanes(Policy& policy, int) -> decltype(policy.loadWba(), void()) { policy.loadWba(); }
+        template <typename Policy>
+        static void loadPlanes(Policy&, long) {}
+
+        template <typename Policy>
+        static auto packPlanes(const Policy& policy, int) -> decltype(policy.packWba(), void()) { policy.packWba(); }
+        template <typename Policy>
+        static void packPlanes(const Policy&, long) {}
+
+        // Each page is filled by all the threads (or the GPU) with its part of the stream
+        inline void initializeWeights(dType min, dType max, unsigned long long seed, std::false_type) {
+            dType* wba_start    = &this->wba.getData()[0];
+            size_t num_elements = this->weightsPerPage();
+            
+            for (uint page = 0; page < depth; page++) {
+                frnn::math<dType, frnn::device::CPU>::rand(wba_start + this->wba.index(0, 0, page, 0), num_elements, 
+                                                           min, max, seed, page * num_elements);
+            }
+        }
+        
+        inline void initializeWeights(dType min, dType max, unsigned long long seed, std::true_type) {
+            dType* wba_start    = this->wba.deviceData();
+            size_t num_elements = this->weightsPerPage();
+            
+            for (uint page = 0; page < depth; page++) {
+                frnn::math<dType, frnn::device::GPU>::rand(*this->context, wba_start + this->wba.index(0, 0, page, 0), 
+                                                           num_elements, min, max, seed, page * num_elements);
+            }
         }
 };
 
@@ -19,22 +19,145 @@
  */
 
 #include <gtest/gtest.h>
+#include <cmath>
 #include <iostream>
 
 #include "layer.hpp"
 #include "types/softmax_policy.hpp"
+#include "types/aligned_softmax_policy.hpp"
+#include "types/quantized_softmax_policy.hpp"
+#include "types/sparse_softmax_policy.hpp"
+#include "types/recurrent_policy.hpp"
+#include "network.hpp"
+#include "bptt.hpp"
+#ifdef FRNN_WITH_CUDA
+#include "data_parallel.hpp"
+#include "model_parallel.hpp"
+#include "graph_step.hpp"
+#endif
+#include "inference_server.hpp"
 #include "../frnn/frnn.h"
 
 const size_t    INPUTS      = 6000;
 const size_t    NODES       = 800;
 const size_t    DEPTH       = 1;
 const float     TOLERANCE   = 1e-3;
+const size_t    BATCH_SIZE  = 5;
 
+// The GPU layers, and the tests which use them, need FRNN_WITH_CUDA (the CPU tests are in both builds)
+#ifdef FRNN_WITH_CUDA
 typedef frnn::Layer<float,                             // Data type
                      frnn::device::GPU,                // Device type
                      NODES, INPUTS, DEPTH,              // Size
                      frnn::ltype::SoftmaxPolicy>  frnnLayerSmaxf;        
 
+// Deep layer to check that the pages (which each use a stream) are joined correctly
+typedef frnn::Layer<float, frnn::device::GPU, 64, 128, 16, frnn::ltype::SoftmaxPolicy> frnnLayerSmaxfDeep;
+
+// Small layer for checking the batched forward pass and update against host results
+typedef frnn::Layer<float, frnn::device::GPU, 8, 4, 2, frnn::ltype::SoftmaxPolicy> frnnLayerSmaxfSmall;
+// Softmax layer with a page for each of (up to) 4 devices, and the same layer sharded by page
+typedef frnn::Layer<float, frnn::device::GPU, 8, 4, 4, frnn::ltype::SoftmaxPolicy> frnnLayerSmaxfPages;
+typedef frnn::PageShardedSoftmax<float, 8, 4, 4>                                   frnnShardedSmaxf;
+
+// GPU versions of the aligned, sparse and recurrent CPU layers below
+typedef frnn::Layer<float, frnn::device::GPU, 8, 4, 2, frnn::ltype::AlignedSoftmaxPolicy> frnnLayerAlignedSmaxf;
+typedef frnn::Layer<float, frnn::device::GPU, 16, 100, 2, frnn::ltype::SparseSoftmaxPolicy>    frnnLayerSparseSmaxf;
+typedef frnn::Layer<float, frnn::device::GPU, 8, 4, 2, frnn::ltype::LstmPolicy> frnnLayerLstmf;
+typedef frnn::Layer<float, frnn::device::GPU, 8, 4, 2, frnn::ltype::GruPolicy>  frnnLayerGruf;
+typedef frnn::Layer<float, frnn::device::GPU, 2048, 16, 1, frnn::ltype::RnnPolicy> frnnLayerRnnfWide;
+#endif
+
+// CPU layers, which must give the same results as the GPU layers
+typedef frnn::Layer<float, frnn::device::CPU, NODES, INPUTS, DEPTH, frnn::ltype::SoftmaxPolicy> frnnLayerSmaxfCpu;
+typedef frnn::Layer<float, frnn::device::CPU, 8, 4, 2, frnn::ltype::SoftmaxPolicy> frnnLayerSmaxfSmallCpu;
+
+// Layers with the parameters in aligned planes, which must give the same results as the packed layers
+typedef frnn::Layer<float, frnn::device::CPU, 8, 4, 2, frnn::ltype::AlignedSoftmaxPolicy> frnnLayerAlignedSmaxfCpu;
+
+// Define quantized softmax layers and the float layers they are compared with (the inputs are more than a row)
+typedef frnn::Layer<float, frnn::device::CPU, 16, 100, 2, frnn::ltype::QuantizedSoftmaxPolicy> frnnLayerQuantSmaxfCpu;
+typedef frnn::Layer<float, frnn::device::CPU, 16, 100, 2, frnn::ltype::SoftmaxPolicy>          frnnLayerFloatSmaxfCpu;
+
+// Sparse softmax layers of the same size, which are pruned and compared with the float layer
+typedef frnn::Layer<float, frnn::device::CPU, 16, 100, 2, frnn::ltype::SparseSoftmaxPolicy>    frnnLayerSparseSmaxfCpu;
+
+// Recurrent layers, the small ones use the persistent kernel and the wide one the stepped kernels
+typedef frnn::Layer<float, frnn::device::CPU, 3, 2, 1, frnn::ltype::RnnPolicy>  frnnLayerRnnfCpu;
+typedef frnn::Layer<float, frnn::device::CPU, 8, 4, 2, frnn::ltype::LstmPolicy> frnnLayerLstmfCpu;
+typedef frnn::Layer<float, frnn::device::CPU, 8, 4, 2, frnn::ltype::GruPolicy>  frnnLayerGrufCpu;
+typedef frnn::Layer<float, frnn::device::CPU, 2048, 16, 1, frnn::ltype::RnnPolicy> frnnLayerRnnfWideCpu;
+const size_t    TIMESTEPS   = 6;
+
+// Network of layers of the same width, so that the activations can share buffers
+typedef frnn::Layer<float, frnn::device::CPU, 8, 4, 1, frnn::ltype::RnnPolicy>     frnnLayerRnnfInCpu;
+typedef frnn::Layer<float, frnn::device::CPU, 8, 8, 1, frnn::ltype::RnnPolicy>     frnnLayerRnnfHiddenCpu;
+typedef frnn::Layer<float, frnn::device::CPU, 5, 8, 1, frnn::ltype::SoftmaxPolicy> frnnLayerSmaxfOutCpu;
+typedef frnn::Network<frnn::storage::Host, frnnLayerRnnfInCpu, frnnLayerRnnfHiddenCpu, frnnLayerRnnfHiddenCpu,
+                      frnnLayerRnnfHiddenCpu, frnnLayerSmaxfOutCpu> frnnNetworkCpu;
+
+// Fills a sequence of inputs (inputs x batch size x timesteps)
+void fillSequence(frnn::Tensor4<float>& ins) {
+    for (uint t = 0; t < ins.z(); t++) {
+        for (uint b = 0; b < ins.y(); b++) {
+            for (uint i = 0; i < ins.x(); i++) ins(i, b, t, 0) = static_cast<float>((i + 2 * b + 3 * t) % 7) / 7.f - 0.4f;
+        }
+    }
+}
+
+// Half the squared error of the outputs of a sequence, from the start of the sequence
+template <typename RecurrentLayer>
+double sequenceLoss(RecurrentLayer& layer, const frnn::Tensor4<float>& ins, const frnn::Tensor4<float>& targets) {
+    frnn::Tensor4<float> outs;
+    double               loss = 0.0;
+
+    layer.resetState();
+    layer.forward(ins, outs);
+    for (size_t e = 0; e < outs.size(); e++) {
+        const double error = outs.getData()[e] - targets.hostData()[e];
+        loss += 0.5 * error * error;
+    }
+    return loss;
+}
+
+// Backpropogates the errors of a sequence (from its start) with a trainer, and gets the input errors
+template <typename RecurrentLayer>
+void sequenceGradients(RecurrentLayer& layer, size_t interval, const frnn::Tensor4<float>& ins,
+                       const frnn::Tensor4<float>& targets, frnn::Tensor4<float>& in_errors) {
+    frnn::TruncatedBptt<RecurrentLayer> trainer(layer, ins.z(), interval);
+    frnn::Tensor4<float>                outs, errors;
+
+    layer.resetState();
+    trainer.forward(ins, outs);
+    errors.reshape(outs.x(), outs.y(), outs.z(), 1);
+    for (size_t e = 0; e < outs.size(); e++) errors.getData()[e] = outs.getData()[e] - targets.hostData()[e];
+    trainer.backward(errors, in_errors);
+}
+
+#ifdef FRNN_WITH_CUDA
+// Checks that the GPU layer gives the same outputs as the CPU layer for the same weights, for two
+// forward passes (so that the state carried between passes is also checked)
+template <typename GpuLayer, typename CpuLayer>
+void checkRecurrentGpuMatchesCpu(uint batch_size) {
+    GpuLayer gpuLayer;
+    CpuLayer cpuLayer;
+    frnn::Tensor4<float> ins(cpuLayer.num_inputs, batch_size, TIMESTEPS, 1), gpu_outs, cpu_outs;
+
+    fillSequence(ins);
+    gpuLayer.initializeWeights(-0.5f, 0.5f, 7ULL);
+    cpuLayer.initializeWeights(-0.5f, 0.5f, 7ULL);
+
+    for (uint pass = 0; pass < 2; pass++) {
+        gpuLayer.forward(ins, gpu_outs);
+        cpuLayer.forward(ins, cpu_outs);
+
+        ASSERT_EQ( gpu_outs.size(), cpu_outs.size() );
+        for (size_t e = 0; e < cpu_outs.size(); e++) {
+            EXPECT_NEAR( gpu_outs.getData()[e], cpu_outs.getData()[e], TOLERANCE );
+        }
+    }
+}
+
 TEST(frnnLayer, CanCreateSoftmaxLayerCorrectly) {
     frnnLayerSmaxf softmaxLayer;
 
@@ -95,6 +218,28 @@ TEST(frnnLayer, CanForwardPassOnSoftmaxLayer) {
     EXPECT_NEAR( sum, 1.0f, TOLERANCE );
 }
 
+TEST(frnnLayer, CanForwardPassOnDeepSoftmaxLayer) {
+    frnnLayerSmaxfDeep softmaxLayer;
+
+    std::vector<float> ins(128, 0.5f), outs;
+
+    softmaxLayer.initializeWeights(0.0f, 0.1f);
+
+    // Second pass checks that reused staging buffers and events give the same results
+    softmaxLayer.forward(ins, outs);
+    std::vector<float> first_outs(outs);
+    softmaxLayer.forward(ins, outs);
+
+    float sum = 0.0f;
+    for (uint i = 0; i < outs.size(); i++) {
+        sum += outs[i];
+        EXPECT_NEAR( outs[i], first_outs[i], TOLERANCE );
+    }
+    
+    EXPECT_EQ( outs.size(), 64 );
+    EXPECT_NEAR( sum, 1.0f, TOLERANCE );
+}
+
 TEST(frnnLayer, SoftmaxLayerCanBackpropCorrectly) {
     frnnLayerSmaxf softmaxLayer;
 
@@ -112,3 +257,784 @@ TEST(frnnLayer, SoftmaxLayerCanBackpropCorrectly) {
         EXPECT_EQ( outs[i] - targets[i], errs[i] );
     }
 }
+
+TEST(frnnLayer, BatchedForwardPassMatchesSingleForwardPasses) {
+    frnnLayerSmaxf softmaxLayer;
+    frnn::Tensor4<float> ins(INPUTS, BATCH_SIZE, 1, 1), outs(NODES, BATCH_SIZE, 1, 1);
+
+    for (uint b = 0; b < BATCH_SIZE; b++) {
+        for (uint i = 0; i < INPUTS; i++) ins(i, b, 0, 0) = static_cast<float>(i % (b + 2)) / INPUTS;
+    }
+    softmaxLayer.initializeWeights(0.0f, 1.0f);
+
+    softmaxLayer.forward(ins, outs);
+
+    for (uint b = 0; b < BATCH_SIZE; b++) {
+        std::vector<float> sample_ins(INPUTS), sample_outs;
+        for (uint i = 0; i < INPUTS; i++) sample_ins[i] = ins(i, b, 0, 0);
+
+        softmaxLayer.forward(sample_ins, sample_outs);
+        for (uint n = 0; n < NODES; n++) {
+            EXPECT_NEAR( outs(n, b, 0, 0), sample_outs[n], TOLERANCE );
+        }
+    }
+}
+
+TEST(frnnLayer, BatchedUpdateUsesAverageGradientOfBatch) {
+    frnnLayerSmaxfSmall softmaxLayer;
+    frnn::Tensor4<float> acts(4, BATCH_SIZE, 1, 1), outs(8, BATCH_SIZE, 1, 1), targets(8, BATCH_SIZE, 1, 1);
+    const float learning_rate = 0.5f;
+
+    for (uint b = 0; b < BATCH_SIZE; b++) {
+        for (uint i = 0; i < 4; i++) acts(i, b, 0, 0) = float(i + b) / 10.f;
+        for (uint n = 0; n < 8; n++) {
+            outs(n, b, 0, 0)    = float(n) / 8.f;
+            targets(n, b, 0, 0) = float(b) / 5.f;
+        }
+    }
+
+    softmaxLayer.backward(outs, targets);
+    softmaxLayer.updateWba(acts, learning_rate);
+
+    const frnn::Tensor4<float> wba = softmaxLayer.getWBA();
+    for (uint page = 0; page < 2; page++) {
+        for (uint n = 0; n < 8; n++) {
+            float weight_grad = 0.f, bias_grad = 0.f;
+            for (uint b = 0; b < BATCH_SIZE; b++) {
+                weight_grad += (outs(n, b, 0, 0) - targets(n, b, 0, 0)) * acts(1, b, 0, 0);
+                bias_grad   += (outs(n, b, 0, 0) - targets(n, b, 0, 0));
+            }
+            // Weights and biases start at 0
+            EXPECT_NEAR( wba(n, 1, page, 0), -learning_rate * weight_grad / BATCH_SIZE, TOLERANCE );
+            EXPECT_NEAR( wba(n, 4, page, 0), -learning_rate * bias_grad   / BATCH_SIZE, TOLERANCE );
+        }
+    }
+}
+
+TEST(frnnLayer, UpdateAddsMomentumOfPreviousUpdate) {
+    frnnLayerSmaxfSmall softmaxLayer;
+    frnn::Tensor4<float> acts(4, 1, 1, 1);
+    std::vector<float> outs(8, 1.f), targets(8, 0.f);
+    const float learning_rate = 0.1f, momentum = 0.5f;
+
+    for (uint i = 0; i < 4; i++) acts(i, 0, 0, 0) = 1.f;
+
+    // Errors are all 1, so the gradient of each weight and bias is 1
+    softmaxLayer.backward(outs, targets);
+    softmaxLayer.updateWba(acts, learning_rate, momentum);
+    softmaxLayer.updateWba(acts, learning_rate, momentum);
+
+    // First update is -lr, second is -lr + momentum * -lr
+    const frnn::Tensor4<float> wba = softmaxLayer.getWBA();
+    float expected = -learning_rate * (2.f + momentum);
+    for (uint page = 0; page < 2; page++) {
+        for (uint n = 0; n < 8; n++) {
+            EXPECT_NEAR( wba(n, 0, page, 0), expected, TOLERANCE );
+            EXPECT_NEAR( wba(n, 4, page, 0), expected, TOLERANCE );
+            // Activations don't get an update
+            EXPECT_NEAR( wba(n, 5, page, 0), 0.f, TOLERANCE );
+        }
+    }
+}
+
+TEST(frnnLayer, BackpropWithDeviceTensorsComputesErrorsOnDevice) {
+    frnnLayerSmaxfSmall softmaxLayer;
+    frnn::Tensor4<float, frnn::storage::Device> outs(8, BATCH_SIZE, 1, 1), targets(8, BATCH_SIZE, 1, 1);
+
+    for (uint b = 0; b < BATCH_SIZE; b++) {
+        for (uint n = 0; n < 8; n++) {
+            outs(n, b, 0, 0)    = float(n + b);
+            targets(n, b, 0, 0) = float(b);
+        }
+    }
+
+    softmaxLayer.backward(outs, targets);
+    const float* errs = softmaxLayer.getErrors();
+
+    for (uint b = 0; b < BATCH_SIZE; b++) {
+        for (uint n = 0; n < 8; n++) {
+            EXPECT_EQ( errs[b * 8 + n], float(n) );
+        }
+    }
+}
+
+TEST(frnnLayer, CpuForwardPassMatchesGpuForwardPass) {
+    frnnLayerSmaxf    gpuLayer;
+    frnnLayerSmaxfCpu cpuLayer;
+    frnn::Tensor4<float> ins(INPUTS, BATCH_SIZE, 1, 1), gpu_outs(NODES, BATCH_SIZE, 1, 1), cpu_outs;
+
+    for (uint b = 0; b < BATCH_SIZE; b++) {
+        for (uint i = 0; i < INPUTS; i++) ins(i, b, 0, 0) = static_cast<float>(i % (b + 2)) / INPUTS;
+    }
+    gpuLayer.initializeWeights(0.0f, 1.0f);
+    cpuLayer.initializeWeights(0.0f, 1.0f);
+
+    // Use the same weights for both layers
+    const frnn::Tensor4<float, frnn::storage::Device>& gpu_wba = gpuLayer.getWBA();
+    const_cast<frnn::Tensor4<float>&>(cpuLayer.getWBA()).getData() = gpu_wba.hostData();
+
+    gpuLayer.forward(ins, gpu_outs);
+    cpuLayer.forward(ins, cpu_outs);
+
+    std::vector<float> sample_ins(INPUTS), sample_outs;
+    for (uint i = 0; i < INPUTS; i++) sample_ins[i] = ins(i, 0, 0, 0);
+    cpuLayer.forward(sample_ins, sample_outs);
+
+    for (uint b = 0; b < BATCH_SIZE; b++) {
+        for (uint n = 0; n < NODES; n++) {
+            EXPECT_NEAR( cpu_outs(n, b, 0, 0), gpu_outs(n, b, 0, 0), TOLERANCE );
+        }
+    }
+    for (uint n = 0; n < NODES; n++) EXPECT_NEAR( sample_outs[n], cpu_outs(n, 0, 0, 0), TOLERANCE );
+}
+
+TEST(frnnLayer, CpuAndGpuLayersHaveTheSameWeightsForTheSameSeed) {
+    frnnLayerSmaxf    gpuLayer;
+    frnnLayerSmaxfCpu cpuLayer;
+
+    gpuLayer.initializeWeights(-1.0f, 1.0f, 99ULL);
+    cpuLayer.initializeWeights(-1.0f, 1.0f, 99ULL);
+
+    EXPECT_EQ( gpuLayer.getWBA().hostData(), cpuLayer.getWBA().hostData() );
+}
+
+#endif
+
+TEST(frnnLayer, CpuBatchedUpdateUsesAverageGradientAndMomentum) {
+    frnnLayerSmaxfSmallCpu softmaxLayer;
+    frnn::Tensor4<float> acts(4, BATCH_SIZE, 1, 1), outs(8, BATCH_SIZE, 1, 1), targets(8, BATCH_SIZE, 1, 1);
+    const float learning_rate = 0.5f, momentum = 0.5f;
+
+    for (uint b = 0; b < BATCH_SIZE; b++) {
+        for (uint i = 0; i < 4; i++) acts(i, b, 0, 0) = float(i + b) / 10.f;
+        for (uint n = 0; n < 8; n++) {
+            outs(n, b, 0, 0)    = float(n) / 8.f;
+            targets(n, b, 0, 0) = float(b) / 5.f;
+        }
+    }
+
+    // The second update adds the momentum of the first
+    softmaxLayer.backward(outs, targets);
+    softmaxLayer.updateWba(acts, learning_rate, momentum);
+    softmaxLayer.updateWba(acts, learning_rate, momentum);
+
+    const frnn::Tensor4<float> wba = softmaxLayer.getWBA();
+    for (uint page = 0; page < 2; page++) {
+        for (uint n = 0; n < 8; n++) {
+            float weight_grad = 0.f, bias_grad = 0.f;
+            for (uint b = 0; b < BATCH_SIZE; b++) {
+                weight_grad += (outs(n, b, 0, 0) - targets(n, b, 0, 0)) * acts(1, b, 0, 0);
+                bias_grad   += (outs(n, b, 0, 0) - targets(n, b, 0, 0));
+            }
+            float scale = -learning_rate * (2.f + momentum) / BATCH_SIZE;
+            EXPECT_NEAR( wba(n, 1, page, 0), scale * weight_grad, TOLERANCE );
+            EXPECT_NEAR( wba(n, 4, page, 0), scale * bias_grad  , TOLERANCE );
+            // Activations don't get an update
+            EXPECT_NEAR( wba(n, 5, page, 0), 0.f, TOLERANCE );
+        }
+    }
+}
+
+// Checks that a layer with aligned planes gives the same outputs and updates as a packed layer
+template <typename AlignedLayer, typename PackedLayer>
+void checkAlignedMatchesPacked() {
+    AlignedLayer alignedLayer;
+    PackedLayer  packedLayer;
+    frnn::Tensor4<float> ins(4, BATCH_SIZE, 1, 1), targets(8, BATCH_SIZE, 1, 1), aligned_outs, packed_outs;
+
+    fillSequence(ins);
+    for (size_t e = 0; e < targets.size(); e++) targets.getData()[e] = e % 8 == ( e / 8 ) % 8 ? 1.f : 0.f;
+    alignedLayer.initializeWeights(-0.5f, 0.5f, 3ULL);
+    packedLayer.initializeWeights(-0.5f, 0.5f, 3ULL);
+
+    // Columns of 8 floats are padded to 128 bytes
+    EXPECT_EQ( alignedLayer.leadingDimension(), 32 );
+
+    for (uint iteration = 0; iteration < 3; iteration++) {
+        alignedLayer.forward(ins, aligned_outs);
+        packedLayer.forward(ins, packed_outs);
+        ASSERT_EQ( aligned_outs.size(), packed_outs.size() );
+        for (size_t e = 0; e < packed_outs.size(); e++) {
+            EXPECT_NEAR( aligned_outs.getData()[e], packed_outs.getData()[e], TOLERANCE );
+        }
+        alignedLayer.backward(aligned_outs, targets);
+        packedLayer.backward(packed_outs, targets);
+        alignedLayer.updateWba(ins, 0.1f, 0.9f);
+        packedLayer.updateWba(ins, 0.1f, 0.9f);
+    }
+
+    // The packed view has the weights and biases (the columns after them are 0 for both)
+    const frnn::Tensor4<float>& aligned_wba = alignedLayer.getWBA();
+    const frnn::Tensor4<float>& packed_wba  = packedLayer.getWBA();
+    for (uint page = 0; page < 2; page++) {
+        for (uint col = 0; col < 5; col++) {
+            for (uint n = 0; n < 8; n++) EXPECT_NEAR( aligned_wba(n, col, page, 0), packed_wba(n, col, page, 0), TOLERANCE );
+        }
+    }
+
+    // Without padding the results are the same
+    std::vector<float> sample(4, 0.2f), aligned_sample_outs, packed_sample_outs;
+    alignedLayer.setLeadingDimension(8);
+    alignedLayer.forward(sample, aligned_sample_outs);
+    packedLayer.forward(sample, packed_sample_outs);
+    for (uint n = 0; n < 8; n++) EXPECT_NEAR( aligned_sample_outs[n], packed_sample_outs[n], TOLERANCE );
+}
+
+TEST(frnnLayer, AlignedSoftmaxLayerMatchesPackedLayer) {
+    checkAlignedMatchesPacked<frnnLayerAlignedSmaxfCpu, frnnLayerSmaxfSmallCpu>();
+#ifdef FRNN_WITH_CUDA
+    checkAlignedMatchesPacked<frnnLayerAlignedSmaxf   , frnnLayerSmaxfSmall   >();
+#endif
+}
+
+TEST(frnnLayer, QuantizedSoftmaxLayerIsCloseToFloatLayer) {
+    frnnLayerQuantSmaxfCpu  quantLayer;
+    frnnLayerFloatSmaxfCpu  floatLayer;
+    frnn::Tensor4<float>    ins(100, BATCH_SIZE, 1, 1), targets(16, BATCH_SIZE, 1, 1), quant_outs, float_outs;
+
+    fillSequence(ins);
+    for (size_t e = 0; e < targets.size(); e++) targets.getData()[e] = e % 16 == ( e / 16 ) % 16 ? 1.f : 0.f;
+    quantLayer.initializeWeights(-0.5f, 0.5f, 5ULL);
+    floatLayer.initializeWeights(-0.5f, 0.5f, 5ULL);
+
+    // Each row is padded to 128 elements
+    EXPECT_EQ( quantLayer.getQuantized().row_stride, 128 );
+
+    // The updates are done on the float weights, which are quantized again
+    for (uint iteration = 0; iteration < 3; iteration++) {
+        quantLayer.forward(ins, quant_outs);
+        floatLayer.forward(ins, float_outs);
+        ASSERT_EQ( quant_outs.size(), float_outs.size() );
+        for (size_t e = 0; e < float_outs.size(); e++) {
+            EXPECT_NEAR( quant_outs.getData()[e], float_outs.getData()[e], 1e-2f );
+        }
+        quantLayer.backward(float_outs, targets);
+        floatLayer.backward(float_outs, targets);
+        quantLayer.updateWba(ins, 0.1f, 0.9f);
+        floatLayer.updateWba(ins, 0.1f, 0.9f);
+    }
+
+    std::vector<float> sample(100, 0.2f), quant_sample_outs, float_sample_outs;
+    quantLayer.forward(sample, quant_sample_outs);
+    floatLayer.forward(sample, float_sample_outs);
+    for (uint n = 0; n < 16; n++) EXPECT_NEAR( quant_sample_outs[n], float_sample_outs[n], 1e-2f );
+}
+
+TEST(frnnLayer, QuantizedForwardPassMatchesTheDequantizedWeightsAndInputs) {
+    frnnLayerQuantSmaxfCpu  quantLayer;
+    frnn::Tensor4<float>    ins(100, BATCH_SIZE, 1, 1), outs;
+
+    fillSequence(ins);
+    quantLayer.initializeWeights(-0.5f, 0.5f, 9ULL);
+    quantLayer.forward(ins, outs);
+    ASSERT_EQ( outs.size(), 16 * BATCH_SIZE );
+
+    // The softmax of the products of the dequantized rows and samples (the int8 sums are exact)
+    const frnn::quantized_wba<float>& quantized = quantLayer.getQuantized();
+    std::vector<int8_t> sample(100);
+    for (uint b = 0; b < BATCH_SIZE; b++) {
+        const float sample_scale = quantizeCpu(&ins.hostData()[b * 100], 100, &sample[0]);
+        std::vector<double> logits(16);
+        double max = -1e30, sum = 0.0;
+        for (uint n = 0; n < 16; n++) {
+            logits[n] = quantized.biases[n];
+            for (uint page = 0; page < 2; page++) {
+                int32_t dot = 0;
+                for (uint i = 0; i < 100; i++) dot += int32_t(quantized.row(n, page)[i]) * sample[i];
+                logits[n] += double(quantized.scale(n, page)) * sample_scale * dot;
+            }
+            max = std::max(max, logits[n]);
+        }
+        for (uint n = 0; n < 16; n++) sum += std::exp(logits[n] - max);
+        for (uint n = 0; n < 16; n++) EXPECT_NEAR( outs(n, b, 0, 0), std::exp(logits[n] - max) / sum, 1e-5 );
+    }
+}
+
+TEST(frnnLayer, PrunedSparseSoftmaxLayerMatchesFloatLayerWithThePrunedWeights) {
+    frnn::frnnError         error = frnn::frnnError(0);
+    frnnLayerSparseSmaxfCpu sparseCpuLayer;
+    frnnLayerFloatSmaxfCpu  floatLayer;
+    frnn::CheckpointWriter  writer;
+    frnn::Tensor4<float>    ins(100, BATCH_SIZE, 1, 1), targets(16, BATCH_SIZE, 1, 1), cpu_outs, float_outs;
+
+    fillSequence(ins);
+    for (size_t e = 0; e < targets.size(); e++) targets.getData()[e] = e % 16 == ( e / 16 ) % 16 ? 1.f : 0.f;
+    sparseCpuLayer.initializeWeights(-0.5f, 0.5f, 5ULL);
+
+    // 80% of the weights of the sum of the 2 pages are pruned (in both pages), so 20% of them are stored
+    EXPECT_GE( sparseCpuLayer.prune(0.8f), 2 * 1280 );
+    EXPECT_LE( sparseCpuLayer.getSparse().non_zeros, 320 );
+    EXPECT_NEAR( sparseCpuLayer.getSparse().density(), 0.2, 0.01 );
+#ifdef FRNN_WITH_CUDA
+    frnnLayerSparseSmaxf    sparseGpuLayer;
+    frnn::Tensor4<float>    gpu_outs;
+    sparseGpuLayer.initializeWeights(-0.5f, 0.5f, 5ULL);
+    EXPECT_GE( sparseGpuLayer.prune(0.8f), 2 * 1280 );
+    EXPECT_EQ( sparseGpuLayer.getSparse().non_zeros, sparseCpuLayer.getSparse().non_zeros );
+#endif
+
+    EXPECT_TRUE( sparseCpuLayer.saveWeights(error, writer, "sparse") );
+    ASSERT_TRUE( writer.write(error, "frnn_sparse_test.ckpt") );
+    frnn::Checkpoint checkpoint(error, "frnn_sparse_test.ckpt");
+    EXPECT_TRUE( floatLayer.loadWeights(error, checkpoint, "sparse") );
+    std::remove("frnn_sparse_test.ckpt");
+
+    sparseCpuLayer.forward(ins, cpu_outs);
+    floatLayer.forward(ins, float_outs);
+    ASSERT_EQ( cpu_outs.size(), float_outs.size() );
+    for (size_t e = 0; e < float_outs.size(); e++) {
+        EXPECT_NEAR( cpu_outs.getData()[e], float_outs.getData()[e], TOLERANCE );
+    }
+
+#ifdef FRNN_WITH_CUDA
+    sparseGpuLayer.forward(ins, gpu_outs);
+    ASSERT_EQ( gpu_outs.size(), float_outs.size() );
+    for (size_t e = 0; e < float_outs.size(); e++) {
+        EXPECT_NEAR( gpu_outs.getData()[e], float_outs.getData()[e], TOLERANCE );
+    }
+
+    std::vector<float> sample(100, 0.2f), sparse_sample_outs, float_sample_outs;
+    sparseGpuLayer.forward(sample, sparse_sample_outs);
+    floatLayer.forward(sample, float_sample_outs);
+    for (uint n = 0; n < 16; n++) EXPECT_NEAR( sparse_sample_outs[n], float_sample_outs[n], TOLERANCE );
+#endif
+
+    // The pruned weights stay zero through the updates
+    const size_t non_zeros = sparseCpuLayer.getSparse().non_zeros;
+    for (uint iteration = 0; iteration < 3; iteration++) {
+        sparseCpuLayer.forward(ins, cpu_outs);
+        sparseCpuLayer.backward(cpu_outs, targets);
+        sparseCpuLayer.updateWba(ins, 0.1f, 0.9f);
+        EXPECT_LE( sparseCpuLayer.getSparse().non_zeros, non_zeros );
+    }
+}
+
+TEST(frnnLayer, PruneWbaGivesTheRequestedDensityForTheSumOfThePages) {
+    const uint           nodes = 16, num_inputs = 100, pages = 3;
+    frnn::Tensor4<float> wba(nodes, num_inputs + 2, pages, 1);
+    for (size_t e = 0; e < wba.size(); e++) wba.getData()[e] = std::sin(0.37f * e + 0.1f);
+
+    const float sparsities[] = { 0.f, 0.5f, 0.9f };
+    for (float sparsity : sparsities) {
+        frnn::Tensor4<float>                            pruned  = wba;
+        frnn::sparse_wba<float, frnn::storage::Host>    sparse;
+        const size_t                                    weights = nodes * num_inputs;
+        const size_t                                    zeroed  = static_cast<size_t>(std::floor(sparsity * weights));
+
+        // The same weights are zeroed in every page
+        EXPECT_EQ( frnn::pruneWba(pruned, num_inputs, sparsity), pages * zeroed );
+        sparse.compress(pruned, num_inputs);
+        EXPECT_EQ( sparse.non_zeros, weights - zeroed );
+        EXPECT_NEAR( sparse.density(), 1.0 - sparsity, 1e-6 );
+    }
+}
+
+TEST(frnnLayer, RnnForwardPassMatchesHostComputation) {
+    frnnLayerRnnfCpu rnnLayer;
+    frnn::Tensor4<float> ins(2, 1, TIMESTEPS, 1), outs;
+
+    fillSequence(ins);
+    rnnLayer.initializeWeights(-1.0f, 1.0f);
+    frnn::Tensor4<float>& wba = const_cast<frnn::Tensor4<float>&>(rnnLayer.getWBA());
+    for (uint n = 0; n < 3; n++) wba(n, 5, 0, 0) = 0.1f * n;            // Biases after W (2) and U (3)
+
+    rnnLayer.forward(ins, outs);
+
+    // h_t = tanh( W * x_t + U * h_( t - 1 ) + b )
+    std::vector<float> h(3, 0.f), h_next(3);
+    for (uint t = 0; t < TIMESTEPS; t++) {
+        for (uint n = 0; n < 3; n++) {
+            float sum = wba(n, 5, 0, 0);
+            for (uint i = 0; i < 2; i++) sum += wba(n, i, 0, 0) * ins(i, 0, t, 0);
+            for (uint j = 0; j < 3; j++) sum += wba(n, 2 + j, 0, 0) * h[j];
+            h_next[n] = std::tanh(sum);
+        }
+        h = h_next;
+        for (uint n = 0; n < 3; n++) EXPECT_NEAR( outs(n, 0, t, 0), h[n], TOLERANCE );
+    }
+}
+
+TEST(frnnLayer, RecurrentTimestepsCarryTheStateOfTheSequence) {
+    frnnLayerLstmfCpu sequenceLayer, stepLayer;
+    frnn::Tensor4<float> ins(4, 1, TIMESTEPS, 1), outs;
+
+    fillSequence(ins);
+    sequenceLayer.initializeWeights(-0.5f, 0.5f, 3ULL);
+    stepLayer.initializeWeights(-0.5f, 0.5f, 3ULL);
+    sequenceLayer.forward(ins, outs);
+
+    // One timestep at a time gives the same outputs, and resetting the state starts a new sequence
+    for (uint pass = 0; pass < 2; pass++) {
+        for (uint t = 0; t < TIMESTEPS; t++) {
+            std::vector<float> step_ins(4), step_outs;
+            for (uint i = 0; i < 4; i++) step_ins[i] = ins(i, 0, t, 0);
+            stepLayer.forward(step_ins, step_outs);
+            for (uint n = 0; n < 8; n++) EXPECT_NEAR( step_outs[n], outs(n, 0, t, 0), TOLERANCE );
+        }
+        stepLayer.resetState();
+    }
+}
+
+#ifdef FRNN_WITH_CUDA
+TEST(frnnLayer, PersistentRecurrentKernelMatchesCpu) {
+    checkRecurrentGpuMatchesCpu<frnnLayerLstmf, frnnLayerLstmfCpu>(BATCH_SIZE);
+    checkRecurrentGpuMatchesCpu<frnnLayerGruf , frnnLayerGrufCpu >(BATCH_SIZE);
+}
+
+TEST(frnnLayer, SteppedRecurrentKernelsMatchCpu) {
+    // Too many nodes for the recurrent weights of a block to fit in shared memory, and a batch which is
+    // too big for the persistent kernel
+    checkRecurrentGpuMatchesCpu<frnnLayerRnnfWide, frnnLayerRnnfWideCpu>(BATCH_SIZE);
+    checkRecurrentGpuMatchesCpu<frnnLayerLstmf   , frnnLayerLstmfCpu   >(80);
+}
+#endif
+
+TEST(frnnLayer, MemoryPlannerSharesBuffersOfTensorsWhichAreNotLive) {
+    // A chain only needs two buffers (whatever the sizes of its tensors), and live tensors don't share
+    frnn::BufferPlan chain  = frnn::planBuffers({8, 8, 8, 8}   , {0, 1, 2, 3}, {1, 2, 3, 4});
+    frnn::BufferPlan sizes  = frnn::planBuffers({8, 4, 4, 8}   , {0, 1, 2, 3}, {1, 2, 3, 4});
+    frnn::BufferPlan widths = frnn::planBuffers({512, 256, 10} , {0, 1, 2}   , {1, 2, 3});
+    frnn::BufferPlan kept   = frnn::planBuffers({8, 8, 8}      , {0, 1, 2}   , {3, 3, 3});
+
+    EXPECT_EQ( chain.buffer_of, std::vector<size_t>({0, 1, 0, 1}) );
+    EXPECT_EQ( chain.totalElements(), 16 );
+    EXPECT_EQ( sizes.buffer_of, std::vector<size_t>({0, 1, 0, 1}) );
+    EXPECT_EQ( sizes.buffer_elements, std::vector<size_t>({8, 8}) );
+    EXPECT_EQ( widths.buffer_of, std::vector<size_t>({0, 1, 0}) );
+    EXPECT_EQ( widths.buffer_elements, std::vector<size_t>({512, 256}) );
+    EXPECT_EQ( kept.buffer_elements.size(), 3 );
+
+    // A free buffer which is big enough is used before a larger or a smaller one
+    frnn::BufferPlan best = frnn::planBuffers({4, 16, 8, 2, 4}, {0, 0, 0, 1, 2}, {0, 0, 0, 3, 3});
+    EXPECT_EQ( best.buffer_of, std::vector<size_t>({0, 1, 2, 0, 2}) );
+    EXPECT_EQ( best.buffer_elements, std::vector<size_t>({4, 16, 8}) );
+}
+
+TEST(frnnLayer, NetworkForwardPassMatchesChainedLayers) {
+    frnnNetworkCpu network, trainingNetwork(frnn::GpuContext::global(), true);
+    frnn::Tensor4<float> ins(4, BATCH_SIZE, 1, 1), outs, a, b;
+
+    fillSequence(ins);
+    network.layer<0>().initializeWeights(-0.5f, 0.5f, 1ULL);
+    network.layer<1>().initializeWeights(-0.5f, 0.5f, 2ULL);
+    network.layer<2>().initializeWeights(-0.5f, 0.5f, 3ULL);
+    network.layer<3>().initializeWeights(-0.5f, 0.5f, 4ULL);
+    network.layer<4>().initializeWeights(-0.5f, 0.5f, 5ULL);
+    network.forward(ins, outs);
+
+    // The same layers by hand
+    frnnLayerRnnfInCpu     in;
+    frnnLayerRnnfHiddenCpu hidden1, hidden2, hidden3;
+    frnnLayerSmaxfOutCpu   out;
+    in.initializeWeights(-0.5f, 0.5f, 1ULL);
+    hidden1.initializeWeights(-0.5f, 0.5f, 2ULL);
+    hidden2.initializeWeights(-0.5f, 0.5f, 3ULL);
+    hidden3.initializeWeights(-0.5f, 0.5f, 4ULL);
+    out.initializeWeights(-0.5f, 0.5f, 5ULL);
+    in.forward(ins, a); hidden1.forward(a, b); hidden2.forward(b, a); hidden3.forward(a, b); out.forward(b, a);
+
+    ASSERT_EQ( outs.size(), a.size() );
+    for (size_t e = 0; e < a.size(); e++) EXPECT_NEAR( outs.getData()[e], a.getData()[e], TOLERANCE );
+
+    // Four activations in two buffers, unless they are all kept
+    trainingNetwork.forward(ins, outs);
+    EXPECT_EQ( network.memoryPlan().buffer_elements.size(), 2 );
+    EXPECT_EQ( trainingNetwork.memoryPlan().buffer_elements.size(), 4 );
+
+    // The same number of columns as timesteps rather than samples is a new plan
+    frnn::Tensor4<float> sequence(4, 1, BATCH_SIZE, 1);
+    fillSequence(sequence);
+    network.forward(sequence, outs);
+    EXPECT_EQ( network.activations(0).y(), 1 );
+    EXPECT_EQ( network.activations(0).z(), BATCH_SIZE );
+}
+
+TEST(frnnLayer, BpttGradientsMatchFiniteDifferences) {
+    frnnLayerLstmfCpu lstmLayer;
+    frnn::Tensor4<float> ins(4, 2, TIMESTEPS, 1), targets(8, 2, TIMESTEPS, 1), in_errors;
+
+    fillSequence(ins);
+    for (size_t e = 0; e < targets.size(); e++) targets.getData()[e] = static_cast<float>(e % 5) / 5.f - 0.4f;
+    lstmLayer.initializeWeights(-0.5f, 0.5f, 11ULL);
+    sequenceGradients(lstmLayer, 2, ins, targets, in_errors);
+
+    // Central differences of the loss for some of the weights of both pages, and the biases
+    frnn::Tensor4<float>& wba = const_cast<frnn::Tensor4<float>&>(lstmLayer.getWBA());
+    const float eps = 1e-2f;
+    for (uint page = 0; page < wba.z(); page++) {
+        for (uint col = 0; col < wba.y() - 1; col++) {                  // Not the activations
+            for (uint row = col % 5; row < wba.x(); row += 5) {
+                const float weight = wba(row, col, page, 0);
+                wba(row, col, page, 0) = weight + eps;
+                const double loss_up = sequenceLoss(lstmLayer, ins, targets);
+                wba(row, col, page, 0) = weight - eps;
+                const double loss_down = sequenceLoss(lstmLayer, ins, targets);
+                wba(row, col, page, 0) = weight;
+
+                EXPECT_NEAR( lstmLayer.getWbaGradients()(row, col, page, 0), (loss_up - loss_down) / (2 * eps), 5e-3 );
+            }
+        }
+    }
+}
+
+TEST(frnnLayer, CheckpointedBpttMatchesFullBptt) {
+    frnnLayerGrufCpu checkpointedLayer, fullLayer, forwardLayer;
+    frnn::Tensor4<float> ins(4, BATCH_SIZE, TIMESTEPS + 1, 1), targets(8, BATCH_SIZE, TIMESTEPS + 1, 1);
+    frnn::Tensor4<float> checkpointed_errors, full_errors;
+
+    fillSequence(ins);
+    for (size_t e = 0; e < targets.size(); e++) targets.getData()[e] = static_cast<float>(e % 3) / 3.f;
+    checkpointedLayer.initializeWeights(-0.5f, 0.5f, 5ULL);
+    fullLayer.initializeWeights(-0.5f, 0.5f, 5ULL);
+    forwardLayer.initializeWeights(-0.5f, 0.5f, 5ULL);
+
+    // Segments of 2, 2, 2 and 1 timesteps recomputed from checkpoints, against a single traced segment
+    sequenceGradients(checkpointedLayer, 2, ins, targets, checkpointed_errors);
+    sequenceGradients(fullLayer, 0, ins, targets, full_errors);
+
+    const frnn::Tensor4<float>& checkpointed_grads = checkpointedLayer.getWbaGradients();
+    const frnn::Tensor4<float>& full_grads         = fullLayer.getWbaGradients();
+    ASSERT_EQ( checkpointed_grads.size(), full_grads.size() );
+    for (size_t e = 0; e < full_grads.size(); e++) {
+        EXPECT_NEAR( checkpointed_grads.hostData()[e], full_grads.hostData()[e], TOLERANCE );
+    }
+    ASSERT_EQ( checkpointed_errors.size(), full_errors.size() );
+    for (size_t e = 0; e < full_errors.size(); e++) {
+        EXPECT_NEAR( checkpointed_errors.getData()[e], full_errors.getData()[e], TOLERANCE );
+    }
+
+    // The state after the backward pass is the state at the end of the sequence
+    frnn::Tensor4<float> next_ins(4, BATCH_SIZE, 1, 1), checkpointed_outs, forward_outs;
+    fillSequence(next_ins);
+    forwardLayer.forward(ins, forward_outs);
+    forwardLayer.forward(next_ins, forward_outs);
+    checkpointedLayer.forward(next_ins, checkpointed_outs);
+    for (size_t e = 0; e < forward_outs.size(); e++) {
+        EXPECT_NEAR( checkpointed_outs.getData()[e], forward_outs.getData()[e], TOLERANCE );
+    }
+}
+
+#ifdef FRNN_WITH_CUDA
+TEST(frnnLayer, BpttOfGpuLayerMatchesCpuLayer) {
+    frnnLayerGruf    gpuLayer;
+    frnnLayerGrufCpu cpuLayer;
+    frnn::Tensor4<float> ins(4, BATCH_SIZE, TIMESTEPS, 1), targets(8, BATCH_SIZE, TIMESTEPS, 1);
+    frnn::Tensor4<float> gpu_errors, cpu_errors;
+
+    fillSequence(ins);
+    for (size_t e = 0; e < targets.size(); e++) targets.getData()[e] = static_cast<float>(e % 4) / 4.f;
+    gpuLayer.initializeWeights(-0.5f, 0.5f, 9ULL);
+    cpuLayer.initializeWeights(-0.5f, 0.5f, 9ULL);
+
+    sequenceGradients(gpuLayer, 3, ins, targets, gpu_errors);
+    sequenceGradients(cpuLayer, 3, ins, targets, cpu_errors);
+
+    for (size_t e = 0; e < cpuLayer.getWbaGradients().size(); e++) {
+        EXPECT_NEAR( gpuLayer.getWbaGradients().hostData()[e], cpuLayer.getWbaGradients().hostData()[e], TOLERANCE );
+    }
+    ASSERT_EQ( gpu_errors.size(), cpu_errors.size() );
+    for (size_t e = 0; e < cpu_errors.size(); e++) {
+        EXPECT_NEAR( gpu_errors.getData()[e], cpu_errors.getData()[e], TOLERANCE );
+    }
+}
+
+TEST(frnnLayer, DataParallelStepMatchesStepOfSingleLayerOnTheBatch) {
+    frnn::DataParallel<frnnLayerSmaxfSmall> replicas;
+    frnnLayerSmaxfSmall                     softmaxLayer;
+    const uint batch_size = 4 * static_cast<uint>(replicas.numReplicas());
+    frnn::Tensor4<float> ins(4, batch_size, 1, 1), outs(8, batch_size, 1, 1), targets(8, batch_size, 1, 1);
+
+    for (uint b = 0; b < batch_size; b++) {
+        for (uint i = 0; i < 4; i++) ins(i, b, 0, 0) = static_cast<float>((i + 3 * b) % 5) / 5.f;
+        for (uint n = 0; n < 8; n++) targets(n, b, 0, 0) = n == b % 8 ? 1.f : 0.f;
+    }
+    replicas.initializeWeights(-0.5f, 0.5f, 5ULL);
+    softmaxLayer.initializeWeights(-0.5f, 0.5f, 5ULL);
+
+    for (uint step = 0; step < 2; step++) {
+        replicas.train(ins, targets, 0.5f, 0.5f);
+        softmaxLayer.forward(ins, outs);
+        softmaxLayer.backward(outs, targets);
+        softmaxLayer.updateWba(ins, 0.5f, 0.5f);
+    }
+
+    const frnn::aligned_vector<float> expected = softmaxLayer.getWBA().hostData();
+    for (size_t r = 0; r < replicas.numReplicas(); r++) {
+        replicas.context(r).makeCurrent();
+        const frnn::aligned_vector<float> wba = replicas.replica(r).getWBA().hostData();
+        ASSERT_EQ( wba.size(), expected.size() );
+        for (size_t e = 0; e < expected.size(); e++) EXPECT_NEAR( wba[e], expected[e], TOLERANCE );
+        EXPECT_GT( replicas.reducer(r).numBuckets(), 0u );
+    }
+    frnn::GpuContext::global().makeCurrent();
+}
+
+TEST(frnnLayer, GraphStepMatchesEagerSteps) {
+    typedef frnn::Tensor4<float, frnn::storage::Device> device_tensor;
+    frnn::frnnError                         error = frnn::frnnError(0);
+    frnnLayerSmaxfSmall                     graphLayer, softmaxLayer;
+    frnn::GraphStep<frnnLayerSmaxfSmall>    step(graphLayer, BATCH_SIZE);
+    device_tensor ins(4, BATCH_SIZE, 1, 1), other_ins(4, BATCH_SIZE, 1, 1), targets(8, BATCH_SIZE, 1, 1);
+    device_tensor graph_outs, outs(8, BATCH_SIZE, 1, 1);
+
+    for (uint b = 0; b < BATCH_SIZE; b++) {
+        for (uint i = 0; i < 4; i++) {
+            ins(i, b, 0, 0)       = static_cast<float>((i + 3 * b) % 5) / 5.f;
+            other_ins(i, b, 0, 0) = static_cast<float>((2 * i + b) % 7) / 7.f;
+        }
+        for (uint n = 0; n < 8; n++) targets(n, b, 0, 0) = n == b % 8 ? 1.f : 0.f;
+    }
+    graphLayer.initializeWeights(-0.5f, 0.5f, 9ULL);
+    softmaxLayer.initializeWeights(-0.5f, 0.5f, 9ULL);
+
+    for (uint s = 0; s < 4; s++) {
+        // The last steps are given other inputs, which only changes the input copy of the graph
+        device_tensor& batch = s < 2 ? ins : other_ins;
+        step.train(error, batch, targets, graph_outs, 0.5f, 0.5f);
+        softmaxLayer.forward(batch, outs);
+        softmaxLayer.backward(outs, targets);
+        softmaxLayer.updateWba(batch, 0.5f, 0.5f);
+
+        ASSERT_EQ( graph_outs.size(), outs.size() );
+        for (size_t e = 0; e < outs.size(); e++) EXPECT_NEAR( graph_outs.hostData()[e], outs.hostData()[e], TOLERANCE );
+
+        // The wba is read on the host between the replays, which must still see the updates of each replay
+        const frnn::aligned_vector<float> expected = softmaxLayer.getWBA().hostData();
+        const frnn::aligned_vector<float> wba      = graphLayer.getWBA().hostData();
+        for (size_t e = 0; e < expected.size(); e++) EXPECT_NEAR( wba[e], expected[e], TOLERANCE );
+    }
+    EXPECT_EQ( error, frnn::frnnError(0) );
+    EXPECT_EQ( step.trainGraph().numCaptures(), 1u );
+    EXPECT_EQ( step.trainGraph().numLaunches(), 3u );
+}
+
+TEST(frnnLayer, PageShardedSoftmaxMatchesUnshardedLayer) {
+    frnnShardedSmaxf     shardedLayer;
+    frnnLayerSmaxfPages  softmaxLayer;
+    frnn::Tensor4<float> ins(4, BATCH_SIZE, 1, 1), targets(8, BATCH_SIZE, 1, 1);
+    frnn::Tensor4<float> sharded_outs, outs(8, BATCH_SIZE, 1, 1);
+
+    for (uint b = 0; b < BATCH_SIZE; b++) {
+        for (uint i = 0; i < 4; i++) ins(i, b, 0, 0) = static_cast<float>((2 * i + b) % 7) / 7.f;
+        for (uint n = 0; n < 8; n++) targets(n, b, 0, 0) = n == b % 8 ? 1.f : 0.f;
+    }
+    shardedLayer.initializeWeights(-0.5f, 0.5f, 11ULL);
+    softmaxLayer.initializeWeights(-0.5f, 0.5f, 11ULL);
+    EXPECT_EQ( shardedLayer.getWBA().hostData(), softmaxLayer.getWBA().hostData() );
+
+    for (uint step = 0; step < 2; step++) {
+        shardedLayer.forward(ins, sharded_outs);
+        softmaxLayer.forward(ins, outs);
+        ASSERT_EQ( sharded_outs.size(), outs.size() );
+        for (size_t e = 0; e < outs.size(); e++) EXPECT_NEAR( sharded_outs.getData()[e], outs.getData()[e], TOLERANCE );
+
+        shardedLayer.backward(sharded_outs, targets);
+        softmaxLayer.backward(outs, targets);
+        shardedLayer.updateWba(ins, 0.5f, 0.5f);
+        softmaxLayer.updateWba(ins, 0.5f, 0.5f);
+    }
+
+    const frnn::aligned_vector<float> expected = softmaxLayer.getWBA().hostData();
+    const frnn::aligned_vector<float> wba      = shardedLayer.getWBA().hostData();
+    ASSERT_EQ( wba.size(), expected.size() );
+    for (size_t e = 0; e < expected.size(); e++) EXPECT_NEAR( wba[e], expected[e], TOLERANCE );
+}
+#endif
+
+TEST(frnnLayer, WeightsLoadedFromCheckpointMatchSavedWeights) {
+    frnn::frnnError         error = frnn::frnnError(0);
+    frnnLayerSmaxfSmallCpu  cpuLayer, loadedCpuLayer;
+#ifdef FRNN_WITH_CUDA
+    frnnLayerSmaxfSmall     loadedGpuLayer;
+#endif
+    frnn::CheckpointWriter  writer;
+
+    cpuLayer.initializeWeights(-1.0f, 1.0f, 21ULL);
+    EXPECT_TRUE( cpuLayer.saveWeights(error, writer, "softmax") );
+    ASSERT_TRUE( writer.write(error, "frnn_layer_test.ckpt") );
+
+    frnn::Checkpoint checkpoint(error, "frnn_layer_test.ckpt");
+    EXPECT_TRUE( loadedCpuLayer.loadWeights(error, checkpoint, "softmax") );
+#ifdef FRNN_WITH_CUDA
+    EXPECT_TRUE( loadedGpuLayer.loadWeights(error, checkpoint, "softmax") );
+#endif
+
+    EXPECT_EQ( loadedCpuLayer.getWBA().hostData(), cpuLayer.getWBA().hostData() );
+#ifdef FRNN_WITH_CUDA
+    EXPECT_EQ( loadedGpuLayer.getWBA().hostData(), cpuLayer.getWBA().hostData() );
+#endif
+
+    // A layer of a different size can't load the weights
+    frnnLayerAlignedSmaxfCpu alignedLayer;
+    frnnLayerSmaxfCpu        wideLayer;
+    EXPECT_TRUE( alignedLayer.loadWeights(error, checkpoint, "softmax") );
+    EXPECT_FALSE( wideLayer.loadWeights(error, checkpoint, "softmax") );
+    std::remove("frnn_layer_test.ckpt");
+}
+
+TEST(frnnLayer, InferenceServerBatchesSequencesAndKeepsTheirState) {
+    const uint SEQUENCES = 8, CHUNKS = 3, CHUNK_STEPS = TIMESTEPS / CHUNKS;
+    frnnLayerLstmfCpu servedLayer, sequenceLayer;
+    frnn::frnnError   error = frnn::frnnError(0);
+
+    servedLayer.initializeWeights(-0.5f, 0.5f, 3ULL);
+    sequenceLayer.initializeWeights(-0.5f, 0.5f, 3ULL);
+
+    // Each sequence on its own is the expected outputs of its chunks
+    std::vector<frnn::Tensor4<float>> ins(SEQUENCES), outs(SEQUENCES);
+    for (uint s = 0; s < SEQUENCES; s++) {
+        ins[s].reshape(4, 1, TIMESTEPS, 1);
+        for (uint t = 0; t < TIMESTEPS; t++) {
+            for (uint i = 0; i < 4; i++) ins[s](i, 0, t, 0) = static_cast<float>((i + 2 * s + 3 * t) % 7) / 7.f - 0.4f;
+        }
+        sequenceLayer.resetState();
+        sequenceLayer.forward(ins[s], outs[s]);
+    }
+
+    frnn::inference_options options;
+    options.max_batch = SEQUENCES;
+    options.max_delay = std::chrono::microseconds(20000);
+    std::vector<std::vector<std::future<std::vector<float>>>> results(SEQUENCES);
+    {
+        frnn::InferenceServer<frnnLayerLstmfCpu> server(servedLayer, options);
+
+        // The chunks of each sequence are submitted without waiting, from a thread for every 2 sequences
+        std::vector<std::thread> clients;
+        for (uint c = 0; c < SEQUENCES / 2; c++) {
+            clients.emplace_back([&, c] {
+                frnn::frnnError client_error = frnn::frnnError(0);
+                for (uint chunk = 0; chunk < CHUNKS; chunk++) {
+                    for (uint s = 2 * c; s < 2 * c + 2; s++) {
+                        std::vector<float> chunk_ins;
+                        for (uint t = chunk * CHUNK_STEPS; t < (chunk + 1) * CHUNK_STEPS; t++) {
+                            for (uint i = 0; i < 4; i++) chunk_ins.push_back(ins[s](i, 0, t, 0));
+                        }
+                        results[s].push_back(server.submit(client_error, s, chunk_ins, chunk == 0));
+                    }
+                }
+            });
+        }
+        for (auto& client : clients) client.join();
+
+        for (uint s = 0; s < SEQUENCES; s++) {
+            for (uint chunk = 0; chunk < CHUNKS; chunk++) {
+                const std::vector<float> chunk_outs = results[s][chunk].get();
+                ASSERT_EQ( chunk_outs.size(), 8 * CHUNK_STEPS );
+                for (uint t = 0; t < CHUNK_STEPS; t++) {
+                    for (uint n = 0; n < 8; n++) {
+                        EXPECT_NEAR( chunk_outs[n + 8 * t], outs[s](n, 0, chunk * CHUNK_STEPS + t, 0), TOLERANCE );
+                    }
+                }
+            }
+        }
+
+        const frnn::inference_stats stats = server.stats();
+        EXPECT_EQ( stats.requests, SEQUENCES * CHUNKS );
+        EXPECT_LT( stats.batches, stats.requests );
+        EXPECT_EQ( stats.sequences, SEQUENCES );
+
+        // Inputs which aren't whole timesteps aren't submitted
+        EXPECT_FALSE( server.submit(error, 0, std::vector<float>(5)).valid() );
+        EXPECT_EQ( error, frnn::frnnError::FRNN_DIMENSION_ERROR );
+    }
+}
@@ -0,0 +1,137 @@
+/*
+ *  Header file for the fastRNN memory planner, which assigns the tensors of
+ *  a network to buffers so that tensors which are not live at the same time
+ *  share storage.
+ *
+ *  Copyright (C) 2015 Rob Clucas robclu1818@gmail.com
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published
+ *  by the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program; if not, write to the Free Software Foundation,
+ *  Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#ifndef _FRNN_MEMORY_PLANNER_
+#define _FRNN_MEMORY_PLANNER_
+
+#include <algorithm>
+#include <vector>
+
+#include "../util/errors.h"
+
+/* ============================================= NOTES ======================================================
+ *
+ * 1. A tensor is live from the step which writes it (first use) to the last step which reads it (last use),
+ *    so two tensors can share a buffer if one's last use is before the other's first use. For a chain of
+ *    layers the output of layer i is only read by layer i + 1, so the activations of any number of layers
+ *    (of any widths) fit in two buffers for a forward pass.
+ *
+ * 2. Buffers are shared by capacity, so a buffer holds as many elements as the largest of its tensors and
+ *    the smaller ones use the front of it. The tensor which is written into a buffer overwrites it, so the
+ *    buffer is reshaped for overwriting (see Tensor4::reshapeForOverwrite) which neither reallocates nor
+ *    copies the data, even for tensors stored on the device. Each tensor goes into the smallest free buffer
+ *    which can hold it, or else the largest free buffer (which grows to hold it), so that as little memory
+ *    is added as possible.
+ *
+ * ==========================================================================================================
+ */
+
+namespace frnn {
+
+/*
+ * ==========================================================================================================
+ * Struct       : BufferPlan
+ *
+ * Description  : The buffers of a memory plan, and the buffer which each tensor uses
+ * ==========================================================================================================
+ */
+struct BufferPlan {
+    std::vector<size_t>     buffer_of;          // Buffer of each tensor
+    std::vector<size_t>     buffer_elements;    // Number of elements of each buffer
+
+    /*
+     * ======================================================================================================
+     * Function     : totalElements
+     *
+     * Description  : Gets the number of elements of all the buffers of the plan
+     * ======================================================================================================
+     */
+    size_t totalElements() const {
+        size_t total = 0;
+        for ( size_t b = 0; b < buffer_elements.size(); b++ ) total += buffer_elements[ b ];
+        return total;
+    }
+};
+
+/*
+ * ==========================================================================================================
+ * Function     : planBuffers
+ *
+ * Description  : Assigns tensors to buffers from their liveness (see NOTES 1 and 2). The tensors are placed
+ *                in order of their first use, each in the smallest buffer which is no longer live and can
+ *                hold it, else in the largest buffer which is no longer live, or in a new buffer if they are
+ *                all live. Each buffer has the number of elements of the largest of its tensors.
+ *
+ * Inputs       : elements      : The number of elements of each tensor
+ *              : first_use     : The step at which each tensor is written
+ *              : last_use      : The last step at which each tensor is read
+ *
+ * Outputs      : The buffers and the buffer of each tensor
+ * ==========================================================================================================
+ */
+inline BufferPlan planBuffers( const std::vector<size_t>& elements ,
+                               const std::vector<size_t>& first_use,
+                               const std::vector<size_t>& last_use ) {
+    frnnError           error;
+    BufferPlan          plan;
+    std::vector<size_t> order( elements.size() ), buffer_last;
+
+    if ( first_use.size() != elements.size() || last_use.size() != elements.size() ) {
+        frnn::err::dimError( error, stringify( first_use ), stringify( elements ) );
+        return plan;
+    }
+
+    for ( size_t t = 0; t < order.size(); t++ ) order[ t ] = t;
+    std::stable_sort( order.begin(), order.end(),
+                      [ &first_use ]( size_t a, size_t b ) { return first_use[ a ] < first_use[ b ]; } );
+
+    plan.buffer_of.resize( elements.size(), 0 );
+    for ( size_t o = 0; o < order.size(); o++ ) {
+        const size_t tensor = order[ o ];
+        size_t       fits   = plan.buffer_elements.size(), largest = plan.buffer_elements.size();
+
+        for ( size_t b = 0; b < plan.buffer_elements.size(); b++ ) {
+            if ( buffer_last[ b ] >= first_use[ tensor ] ) continue;
+            if ( plan.buffer_elements[ b ] >= elements[ tensor ] &&
+                 ( fits == plan.buffer_elements.size() || plan.buffer_elements[ b ] < plan.buffer_elements[ fits ] ) ) {
+                fits = b;
+            }
+            if ( largest == plan.buffer_elements.size() || plan.buffer_elements[ b ] > plan.buffer_elements[ largest ] ) {
+                largest = b;
+            }
+        }
+
+        size_t buffer = fits != plan.buffer_elements.size() ? fits : largest;
+        if ( buffer == plan.buffer_elements.size() ) {
+            plan.buffer_elements.push_back( 0 );
+            buffer_last.push_back( 0 );
+        }
+        plan.buffer_elements[ buffer ] = std::max( plan.buffer_elements[ buffer ], elements[ tensor ] );
+        buffer_last[ buffer ]          = std::max( last_use[ tensor ], first_use[ tensor ] );
+        plan.buffer_of[ tensor ]  = buffer;
+    }
+    return plan;
+}
+
+}   // Namespace frnn
+
+#endif
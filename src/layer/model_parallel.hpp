@@ -0,0 +1,378 @@
+/*
+ *  Header file for fastRNN model parallel class, a softmax layer whose depth
+ *  pages are split between multiple GPUs.
+ *
+ *  Copyright (C) 2015 Rob Clucas robclu1818@gmail.com
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published
+ *  by the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program; if not, write to the Free Software Foundation,
+ *  Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#ifndef _FRNN_MODEL_PARALLEL_
+#define _FRNN_MODEL_PARALLEL_
+
+#include <cuda_runtime.h>
+#include <nccl.h>
+#include <omp.h>
+
+#include <algorithm>
+#include <vector>
+
+#include "../tensor/tensor.cuh"
+#include "../util/errors.h"
+#include "../math/math.hpp"
+#include "../frnn/device_allocator.cuh"
+#include "../frnn/gpu_context.cuh"
+#include "../frnn/nccl_reducer.cuh"
+#include "types/softmax_gpu_functions.cuh"
+
+/* ============================================= NOTES ======================================================
+ *
+ * 1. The output of a softmax layer is softmax( sum over pages ( W_p*x + b_p ) ), so the pages can be split
+ *    between devices : each device (a shard) keeps the wba of a range of consecutive pages, and computes the
+ *    sum of W_p*x + b_p for its pages (softmaxLogitsPagesGpu). The partial sums are added by an NCCL reduce
+ *    onto the first shard (the root), which does the softmax, so no weights are staged through the host and
+ *    only the inputs and the (nodes x batch) partial sums move between the devices.
+ *
+ * 2. The errors of the layer are the same for all the pages, so they are found on the root and broadcast to
+ *    the other shards, and each shard then updates its own pages (on its own thread) with the update of a
+ *    SoftmaxPolicy layer, which for each page only needs the inputs and the errors.
+ *
+ * 3. The inputs are broadcast from the root to all the shards, so device inputs must be on the root device.
+ *    The weights of each page are initialized with the part of the Philox stream of the page of a Layer, so
+ *    a sharded layer has the same weights as an unsharded one for the same seed.
+ *
+ * ==========================================================================================================
+ */
+
+namespace frnn {
+
+/*
+ * ==========================================================================================================
+ * Class        : PageShardedSoftmax
+ *
+ * Description  : Softmax layer for the GPU with its pages split between devices (see NOTES 1 - 3)
+ *
+ * Params       : dType     : The type of data for the layer
+ *              : nodes     : The number of nodes for the layer
+ *              : inputs    : The number of inputs to the layer
+ *              : depth     : The number of pages of the layer
+ * ==========================================================================================================
+ */
+template <typename dType, uint nodes, uint inputs, uint depth>
+class PageShardedSoftmax {
+    public:
+        typedef dType                               data_type;
+        typedef Tensor4<dType, storage::Device>     device_tensor;
+        static constexpr uint node_count  = nodes;
+        static constexpr uint input_count = inputs;
+
+    private:
+        // The pages of one device, and the resources of the device
+        struct shard {
+            int                 device;             // Device of the shard
+            uint                first_page;         // Page of the layer of the first page of the shard
+            uint                pages;              // Number of pages of the shard
+            DeviceAllocator     allocator;          // Allocator for the context of the shard
+            GpuContext          context;            // Context (and streams) of the shard
+            device_tensor       wba;                // Weights, biases and activations of the pages
+            device_tensor       wba_deltas;         // Updates of the wba from the last update (for momentum)
+            device_tensor       ins;                // Inputs of the layer (broadcast from the root)
+            device_tensor       errors;             // Errors of the layer (broadcast from the root)
+
+            shard(int dev, uint first, uint num_pages) :
+                device(dev), first_page(first), pages(num_pages), allocator(), context(1234ULL, allocator),
+                wba(nodes, std::max(inputs, nodes) + 2, num_pages, 1),
+                wba_deltas(nodes, std::max(inputs, nodes) + 2, num_pages, 1), ins(inputs, 1, 1, 1),
+                errors(nodes, 1, 1, 1) {}
+        };
+
+        std::vector<shard*>         shards_;        // Shards of the layer, the first is the root
+        std::vector<ncclComm_t>     comms_;         // Rank of the communicator of each shard
+
+    public:
+        /*
+         * ==================================================================================================
+         * Function     : PageShardedSoftmax
+         *
+         * Description  : Splits the pages between the devices, as evenly as possible (a device gets no
+         *                shard if there are more devices than pages)
+         *
+         * Inputs       : devices   : The devices to put the pages on (all the devices by default)
+         * ==================================================================================================
+         */
+        explicit PageShardedSoftmax(std::vector<int> devices = std::vector<int>()) {
+            if (devices.empty()) {
+                int num_devices = 0;
+                cudaGetDeviceCount(&num_devices);
+                for (int i = 0; i < num_devices; i++) devices.push_back(i);
+            }
+            if (devices.size() > depth) devices.resize(depth);
+
+            int previous = 0;
+            cudaGetDevice(&previous);
+
+            const uint num_shards = static_cast<uint>(devices.size());
+            uint       first      = 0;
+            for (uint i = 0; i < num_shards; i++) {
+                const uint pages = depth / num_shards + (i < depth % num_shards ? 1 : 0);
+                cudaSetDevice(devices[i]);
+                shards_.push_back(new shard(devices[i], first, pages));
+                first += pages;
+            }
+            comms_.resize(num_shards);
+            ncclCommInitAll(&comms_[0], static_cast<int>(num_shards), &devices[0]);
+            cudaSetDevice(previous);
+        }
+
+        /*
+         * ==================================================================================================
+         * Function     : ~PageShardedSoftmax
+         *
+         * Description  : Releases the shards, each with its device current
+         * ==================================================================================================
+         */
+        ~PageShardedSoftmax() {
+            int previous = 0;
+            cudaGetDevice(&previous);
+            for (size_t i = 0; i < shards_.size(); i++) {
+                cudaSetDevice(shards_[i]->device);
+                shards_[i]->context.synchronize();
+                delete shards_[i];
+                ncclCommDestroy(comms_[i]);
+            }
+            cudaSetDevice(previous);
+        }
+
+        // The shards own device resources, so they can't be copied
+        PageShardedSoftmax(const PageShardedSoftmax&)             = delete;
+        PageShardedSoftmax& operator=(const PageShardedSoftmax&)  = delete;
+
+        inline size_t numShards() const { return shards_.size(); }
+        inline int shardDevice(size_t i) const { return shards_[i]->device; }
+        inline uint shardPages(size_t i) const { return shards_[i]->pages; }
+
+        static size_t weightsPerPage() { return nodes * std::max(nodes, inputs); }
+
+        /*
+         * ==================================================================================================
+         * Function     : initializeWeights
+         *
+         * Description  : Initializes the weights of each page with its part of the Philox stream for the seed
+         *                (see NOTES 3)
+         *
+         * Inputs       : min   : The minimum value for the weights
+         *              : max   : The maximum value for the weights
+         *              : seed  : The seed for the random numbers
+         * ==================================================================================================
+         */
+        void initializeWeights(dType min, dType max, unsigned long long seed = frnn::rng::DEFAULT_SEED) {
+            const size_t num_elements = weightsPerPage();
+            for (size_t i = 0; i < shards_.size(); i++) {
+                shard& s = *shards_[i];
+                s.context.makeCurrent();
+                dType* wba_start = s.wba.deviceData();
+                for (uint page = 0; page < s.pages; page++) {
+                    frnn::math<dType, frnn::device::GPU>::rand(s.context, wba_start + s.wba.index(0, 0, page, 0),
+                                                               num_elements, min, max, seed,
+                                                               (s.first_page + page) * num_elements);
+                }
+                s.context.synchronize();
+            }
+            shards_[0]->context.makeCurrent();
+        }
+
+        /*
+         * ==================================================================================================
+         * Function     : getWBA
+         *
+         * Description  : Gathers the pages of all the shards into one (host) wba tensor, in the layout of the
+         *                wba of an unsharded layer
+         * ==================================================================================================
+         */
+        Tensor4<dType> getWBA() const {
+            Tensor4<dType> wba(nodes, std::max(inputs, nodes) + 2, depth, 1);
+            for (size_t i = 0; i < shards_.size(); i++) {
+                const shard& s = *shards_[i];
+                s.context.makeCurrent();
+                const auto& page_data = s.wba.hostData();
+                std::copy(page_data.begin(), page_data.end(),
+                          wba.getData().begin() + wba.index(0, 0, s.first_page, 0));
+            }
+            shards_[0]->context.makeCurrent();
+            return wba;
+        }
+
+        /*
+         * ==================================================================================================
+         * Function     : forward
+         *
+         * Description  : Forward pass for a batch (see NOTES 1)
+         *
+         * Inputs       : ins       : The inputs of the batch (inputs x batch size), one sample per column
+         *
+         * Outputs      : outs      : The outputs of the batch (nodes x batch size), on the root device
+         *
+         * Params       : IoStorage : The storage policy of the inputs and outputs
+         * ==================================================================================================
+         */
+        template <template <typename> class IoStorage>
+        void forward(const Tensor4<dType, IoStorage>& ins, Tensor4<dType, IoStorage>& outs) {
+            frnnError   error;
+            shard&      root       = *shards_[0];
+            const size_t batch_size = ins.y();
+
+            if (ins.x() != inputs) {
+                frnn::err::dimError(error, stringify(ins), stringify(inputs));
+                return;
+            }
+            if (outs.x() != nodes || outs.y() != batch_size || outs.size() != nodes * batch_size) {
+                outs.reshape(nodes, batch_size, 1, 1);
+            }
+            broadcastInputs(error, ins);
+
+            // The partial sums of the pages of each shard, in scratch slot 3 of its context
+            std::vector<dType*> logits(shards_.size(), 0);
+            for (size_t i = 0; i < shards_.size(); i++) {
+                shard& s = *shards_[i];
+                s.context.makeCurrent();
+                const size_t page_size = s.wba.x() * s.wba.y();
+                const dType* wba_d     = static_cast<const device_tensor&>(s.wba).deviceData();
+                const dType* ins_d     = static_cast<const device_tensor&>(s.ins).deviceData();
+                logits[i] = s.context.template scratch<dType>(error, 3, nodes * batch_size);
+                if (logits[i] == 0) return;
+                softmaxLogitsPagesGpu(error, s.context, ins_d, wba_d, nodes, page_size,
+                                      wba_d + s.wba.index(0, inputs, 0, 0), page_size, nodes, s.pages, inputs,
+                                      batch_size, logits[i]);
+            }
+
+            // Sum of the partial sums onto the root (in place)
+            ncclGroupStart();
+            for (size_t i = 0; i < shards_.size(); i++) {
+                if (ncclReduce(logits[i], logits[i], nodes * batch_size, nccl_data_type<dType>::value, ncclSum,
+                               0, comms_[i], shards_[i]->context.stream()) != ncclSuccess) {
+                    frnn::err::copyError(error, stringify(logits));
+                }
+            }
+            ncclGroupEnd();
+
+            // Softmax of each sample on the root
+            root.context.makeCurrent();
+            cudaStream_t stream = root.context.stream();
+            dType* outs_d = deviceTensorGpu(error, root.context.template scratch<dType>(error, 6, outs.size()),
+                                            outs, stream, false);
+            if (outs_d == 0) return;
+            softmaxColumnsGpu(root.context, logits[0], outs_d, nodes, batch_size);
+            finishTensorGpu(error, outs_d, outs, stream);
+        }
+
+        /*
+         * ==================================================================================================
+         * Function     : backward
+         *
+         * Description  : Finds the errors of a batch on the root and broadcasts them to all the shards (see
+         *                NOTES 2)
+         *
+         * Inputs       : outs      : The outputs of the batch (nodes x batch size)
+         *              : targets   : The targets of the batch (nodes x batch size)
+         *
+         * Params       : IoStorage : The storage policy of the outputs and targets
+         * ==================================================================================================
+         */
+        template <template <typename> class IoStorage>
+        void backward(Tensor4<dType, IoStorage>& outs, Tensor4<dType, IoStorage>& targets) {
+            frnnError error;
+            shard&    root = *shards_[0];
+
+            root.context.makeCurrent();
+            softmaxBackwardGpu(root.context, outs, targets, root.errors);
+
+            std::vector<dType*> errors_d(shards_.size(), 0);
+            for (size_t i = 0; i < shards_.size(); i++) {
+                shards_[i]->context.makeCurrent();
+                shards_[i]->errors.reshape(outs.x(), outs.y(), 1, 1);
+                errors_d[i] = shards_[i]->errors.deviceData();
+            }
+            broadcast(error, errors_d, root.errors.size());
+            root.context.makeCurrent();
+        }
+
+        /*
+         * ==================================================================================================
+         * Function     : updateWba
+         *
+         * Description  : Updates the pages of each shard with the errors of the last backward pass, with
+         *                each shard on its own thread
+         *
+         * Inputs       : prev_layer_acts   : The inputs of the batch (inputs x batch size)
+         *              : learning_rate     : The learning rate for the update
+         *              : momentum          : The momentum for the update
+         *
+         * Params       : IoStorage         : The storage policy of the inputs
+         * ==================================================================================================
+         */
+        template <template <typename> class IoStorage>
+        void updateWba(const Tensor4<dType, IoStorage>& prev_layer_acts, dType learning_rate = dType(0.01),
+                       dType momentum = dType(0)) {
+            frnnError error;
+            broadcastInputs(error, prev_layer_acts);
+
+            const int num_shards = static_cast<int>(shards_.size());
+            #pragma omp parallel for num_threads(num_shards) schedule(static, 1)
+            for (int i = 0; i < num_shards; i++) {
+                shard& s = *shards_[i];
+                s.context.makeCurrent();
+                softmaxUpdateWbaGpu(s.context, s.ins, s.errors, inputs, learning_rate, momentum, s.wba, s.wba_deltas);
+            }
+            shards_[0]->context.makeCurrent();
+        }
+
+    private:
+        // Puts the inputs on the root, and broadcasts them to the inputs of each shard
+        template <template <typename> class IoStorage>
+        void broadcastInputs(frnnError& error, const Tensor4<dType, IoStorage>& ins) {
+            std::vector<dType*> ins_d(shards_.size(), 0);
+            for (size_t i = 0; i < shards_.size(); i++) {
+                shards_[i]->context.makeCurrent();
+                shards_[i]->ins.reshape(ins.x(), ins.y(), 1, 1);
+                ins_d[i] = shards_[i]->ins.deviceData();
+            }
+            shard& root = *shards_[0];
+            root.context.makeCurrent();
+            const dType* root_ins = deviceTensorGpu(error, root.context.template scratch<dType>(error, 0, ins.size()),
+                                                    ins, root.context.stream());
+            if (root_ins == 0) return;
+            if (cudaMemcpyAsync(ins_d[0], root_ins, ins.size() * sizeof(dType), cudaMemcpyDeviceToDevice,
+                                root.context.stream()) != cudaSuccess) {
+                frnn::err::copyError(error, stringify(ins));
+            }
+            broadcast(error, ins_d, ins.size());
+        }
+
+        // Broadcasts N elements from the buffer of the root to the buffers of the other shards (in place)
+        void broadcast(frnnError& error, const std::vector<dType*>& buffers, size_t N) {
+            ncclGroupStart();
+            for (size_t i = 0; i < shards_.size(); i++) {
+                if (ncclBroadcast(buffers[i], buffers[i], N, nccl_data_type<dType>::value, 0, comms_[i],
+                                  shards_[i]->context.stream()) != ncclSuccess) {
+                    frnn::err::copyError(error, stringify(buffers));
+                }
+            }
+            ncclGroupEnd();
+        }
+};
+
+}   // Namespace frnn
+
+#endif
@@ -0,0 +1,220 @@
+/*
+ *  Header file for fastRNN network class, which chains layers.
+ *
+ *  Copyright (C) 2015 Rob Clucas robclu1818@gmail.com
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published
+ *  by the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program; if not, write to the Free Software Foundation,
+ *  Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#ifndef _FRNN_NETWORK_
+#define _FRNN_NETWORK_
+
+#include <type_traits>
+#include <vector>
+
+#include "../tensor/tensor.cuh"
+#include "../containers/tuple.h"
+#include "../frnn/gpu_context.cuh"
+#include "memory_planner.hpp"
+#include "layer.hpp"
+
+namespace frnn {
+
+/*
+ * ==========================================================================================================
+ * Struct       : LayersChain
+ *
+ * Description  : If the outputs of each layer are the inputs of the next layer
+ *
+ * Params       : Layers    : The layers, in the order of the forward pass
+ * ==========================================================================================================
+ */
+template <typename... Layers> struct LayersChain;
+
+template <typename L> struct LayersChain<L> : std::true_type {};
+
+template <typename L0, typename L1, typename... Layers>
+struct LayersChain<L0, L1, Layers...>
+    : std::integral_constant<bool, L0::node_count == L1::input_count && LayersChain<L1, Layers...>::value> {};
+
+/*
+ * ==========================================================================================================
+ * Class        : Network
+ *
+ * Description  : Chains layers so that the outputs of each layer are the inputs of the next one. The
+ *                activations between the layers are tensors owned by the network, which are given to the
+ *                layers by reference (so nothing is copied between the layers), and the memory planner
+ *                assigns them to buffers so that activations which are not live at the same time share
+ *                storage (see NOTES 1 of memory_planner.hpp). The activations are only needed by the next
+ *                layer for a forward pass, but when they are kept (for training) they are all live until
+ *                the end of the pass, so they each have a buffer.
+ *
+ * Params       : Storage   : The storage policy of the activations (and of the inputs and outputs)
+ *              : Layers    : The layers, in the order of the forward pass
+ * ==========================================================================================================
+ */
+template <template <typename> class Storage, typename... Layers>
+class Network {
+
+    static_assert( sizeof...(Layers) > 0, "A network needs at least one layer" );
+    static_assert( LayersChain<Layers...>::value, "The nodes of each layer must be the inputs of the next layer" );
+
+    public:
+        typedef Tuple<Layers...>                                                        layers_type;
+        typedef typename TupleElementTypeHolder<0, layers_type>::type::data_type        data_type;
+        typedef Tensor4<data_type, Storage>                                             tensor_type;
+
+        template <size_t i>
+        using layer_type = typename TupleElementTypeHolder<i, layers_type>::type;
+
+        // Inputs of the first layer and nodes of the last layer, as for a Layer
+        static constexpr uint input_count = layer_type<0>::input_count;
+        static constexpr uint node_count  = layer_type<sizeof...(Layers) - 1>::node_count;
+
+    private:
+        layers_type                 layers_;            // The layers of the network
+        std::vector<tensor_type>    buffers_;           // Buffers for the activations between the layers
+        BufferPlan                  plan_;              // Buffer of each activation
+        uint                        planned_batch_;     // Batch size of the plan
+        uint                        planned_steps_;     // Timesteps of the plan
+        bool                        keep_activations_;  // If all the activations are kept for training
+
+    public:
+        /*
+         * ==================================================================================================
+         * Function     : Network
+         *
+         * Description  : Creates the layers of the network, which all use the same GPU context
+         *
+         * Inputs       : context           : The GPU context of the layers (which must outlive the network)
+         *              : keep_activations  : If the activations of all the layers must be kept after the
+         *                                    forward pass (for training)
+         * ==================================================================================================
+         */
+        explicit Network(GpuContext& context = GpuContext::global(), bool keep_activations = false) :
+            layers_(Layers(context)...), planned_batch_(0), planned_steps_(0), keep_activations_(keep_activations) {}
+
+        /*
+         * ==================================================================================================
+         * Function     : numLayers
+         *
+         * Description  : Gets the number of layers of the network
+         * ==================================================================================================
+         */
+        static constexpr size_t numLayers() { return sizeof...(Layers); }
+
+        /*
+         * ==================================================================================================
+         * Function     : layer
+         *
+         * Description  : Gets layer i of the network
+         *
+         * Params       : i     : The index of the layer
+         * ==================================================================================================
+         */
+        template <size_t i>
+        layer_type<i>& layer() { return frnn::get<i>(layers_); }
+
+        template <size_t i>
+        const layer_type<i>& layer() const { return frnn::get<i>(layers_); }
+
+        /*
+         * ==================================================================================================
+         * Function     : activations
+         *
+         * Description  : Gets the outputs of layer i of the last forward pass, for i before the last layer
+         *                (the outputs of the last layer are the outputs of the forward pass). The buffer of
+         *                the activations may have been reused by a later layer unless the activations are
+         *                kept.
+         *
+         * Inputs       : i     : The index of the layer
+         * ==================================================================================================
+         */
+        const tensor_type& activations(size_t i) const { return buffers_[plan_.buffer_of[i]]; }
+
+        /*
+         * ==================================================================================================
+         * Function     : memoryPlan
+         *
+         * Description  : Gets the plan of the buffers of the activations of the last forward pass
+         * ==================================================================================================
+         */
+        const BufferPlan& memoryPlan() const { return plan_; }
+
+        /*
+         * ==================================================================================================
+         * Function     : forward
+         *
+         * Description  : Forward propogates a batch through all the layers of the network. The buffers are
+         *                planned (and allocated) when the batch size or the number of timesteps of the inputs
+         *                changes, so after the first batch the forward pass doesn't allocate any memory.
+         *                Each activation is written into the front of its buffer, which is reshaped for it
+         *                without copying anything (see NOTES 2 of memory_planner.hpp).
+         *
+         * Inputs       : ins   : The inputs to the first layer (inputs x batch size x timesteps)
+         *
+         * Outputs      : outs  : The outputs of the last layer (nodes x batch size x timesteps)
+         * ==================================================================================================
+         */
+        void forward(const tensor_type& ins, tensor_type& outs) {
+            plan(ins.y(), ins.z());
+            forwardFrom<0>(ins, outs, std::integral_constant<bool, numLayers() == 1>());
+        }
+
+    private:
+        // Plans the buffers of the activations (the outputs of all the layers but the last) for a batch
+        void plan(uint batch_size, uint steps) {
+            if (batch_size == planned_batch_ && steps == planned_steps_) return;
+
+            const size_t        columns = static_cast<size_t>(batch_size) * steps;
+            const uint          nodes[] = { Layers::node_count... };
+            const size_t        num_activations = numLayers() - 1;
+            std::vector<size_t> elements(num_activations), first_use(num_activations), last_use(num_activations);
+
+            // The outputs of layer i are written at step i and read at step i + 1 (or kept until the end)
+            for (size_t i = 0; i < num_activations; i++) {
+                elements[i]  = nodes[i] * columns;
+                first_use[i] = i;
+                last_use[i]  = keep_activations_ ? numLayers() : i + 1;
+            }
+            plan_ = planBuffers(elements, first_use, last_use);
+
+            // Allocate each buffer at its full size now, so reshaping it for an activation never allocates
+            buffers_.resize(plan_.buffer_elements.size());
+            for (size_t b = 0; b < buffers_.size(); b++) {
+                buffers_[b].reshapeForOverwrite(static_cast<int>(plan_.buffer_elements[b]), 1, 1, 1);
+                buffers_[b].sync();
+            }
+            planned_batch_ = batch_size;
+            planned_steps_ = steps;
+        }
+
+        template <size_t i>
+        void forwardFrom(const tensor_type& ins, tensor_type& outs, std::false_type) {
+            tensor_type& acts = buffers_[plan_.buffer_of[i]];
+            acts.reshapeForOverwrite(layer_type<i>::node_count, ins.y(), ins.z(), 1);
+            frnn::get<i>(layers_).forward(ins, acts);
+            forwardFrom<i + 1>(acts, outs, std::integral_constant<bool, i + 2 == numLayers()>());
+        }
+
+        template <size_t i>
+        void forwardFrom(const tensor_type& ins, tensor_type& outs, std::true_type) {
+            frnn::get<i>(layers_).forward(ins, outs);
+        }
+};
+
+}   // Namespace frnn
+
+#endif
@@ -0,0 +1,326 @@
+/*
+ *  Header file for fastRNN aligned softmax policy class, a softmax layer
+ *  which keeps its weights, biases and activations in separate planes with
+ *  a padded leading dimension.
+ *
+ *  Copyright (C) 2015 Rob Clucas robclu1818@gmail.com
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published
+ *  by the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program; if not, write to the Free Software Foundation,
+ *  Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#ifndef _FRNN_ALIGNED_SOFTMAX_POLICY_
+#define _FRNN_ALIGNED_SOFTMAX_POLICY_
+
+#include <vector>
+
+#include "../../tensor/tensor.cuh"
+#include "../../frnn/frnn.h"
+#include "../../frnn/gpu_context.cuh"
+#include "wba_planes.hpp"
+#include "softmax_cpu_functions.hpp"
+#ifdef FRNN_WITH_CUDA
+#include "softmax_gpu_functions.cuh"
+#endif
+
+/* ============================================= NOTES ======================================================
+ *
+ * 1. The layer computes the same thing as a SoftmaxPolicy layer, but the parameters are kept in wba planes
+ *    (see wba_planes.hpp), so the weights have a padded leading dimension and nothing is stored for the
+ *    unused columns of the packed wba.
+ *
+ * 2. The packed wba is kept as a view for compatibility (getWBA of a layer), which is packed from the planes
+ *    each time it's read, so it's for reading the parameters rather than for the hot loop. When the weights
+ *    are changed through the view (for example by initializeWeights), loadWba must be called to set the
+ *    planes from the view.
+ *
+ * ==========================================================================================================
+ */
+
+namespace frnn {
+namespace ltype {
+
+/*
+ * ==========================================================================================================
+ * Class        : AlignedSoftmaxPolicy
+ *
+ * Desription   : Policy class for a softmax layer with the parameters in wba planes (see NOTES 1 - 2)
+ *
+ * Params       : dType     : The type of data for the network
+ *              : device    : The device type to use (CPU or GPU)
+ *              : nodes     : The number of nodes for the layer
+ *              : inputs    : The number of inputs to the layer
+ *              : depth     : The number of different inputs in the layer (almost always 1 for softmax)
+ *              : alignment : The alignment (in bytes) of each column of the planes, which sets the default
+ *                            leading dimension (see alignedLeadingDimension)
+ * ==========================================================================================================
+ */
+template <typename          dType,
+         frnn::device       dev,
+         uint               nodes,
+         uint               inputs,
+         uint               depth,
+         uint               alignment = WBA_PLANE_ALIGNMENT>
+class AlignedSoftmaxPolicy;
+
+/* ============================================== GPU Definitions ========================================  */
+#ifdef FRNN_WITH_CUDA
+
+template <typename          dType,
+          uint              nodes,
+          uint              inputs,
+          uint              depth,
+          uint              alignment>
+class AlignedSoftmaxPolicy<dType, frnn::device::GPU, nodes, inputs, depth, alignment> {
+
+    public:
+        // The planes stay on the device between calls
+        typedef Tensor4<dType, storage::Device>     wba_type;
+        typedef Tensor4<dType, storage::Device>     errors_type;
+        typedef wba_planes<dType, storage::Device>  planes_type;
+
+        /*
+         * ==================================================================================================
+         * Function     : AlignedSoftmaxPolicy
+         *
+         * Description  : Constructor for the policy, which makes the planes with the leading dimension for
+         *                the alignment
+         *
+         * Inputs       : gpu_context   : The GPU context which owns the handles and device memory used by the
+         *                                GPU functions of the layer (it must outlive the layer)
+         * ==================================================================================================
+         */
+        explicit AlignedSoftmaxPolicy(GpuContext& gpu_context = GpuContext::global()) :
+            wba(nodes, std::max(inputs, nodes) + 2, depth, 1), num_inputs(inputs), errors(nodes, 1, 1, 1),
+            context(&gpu_context) { setLeadingDimension(alignedLeadingDimension<dType>(nodes, alignment)); }
+
+        /*
+         * ==================================================================================================
+         * Function     : setLeadingDimension
+         *
+         * Description  : Sets the leading dimension of the planes, keeping the weights and biases (and
+         *                clearing the momentum of the updates)
+         *
+         * Inputs       : ld    : The leading dimension, which must be at least the number of nodes
+         * ==================================================================================================
+         */
+        void setLeadingDimension(uint ld);
+
+        inline uint leadingDimension() const { return planes.leadingDimension(); }
+        inline const planes_type& getPlanes() const { return planes; }
+
+        // The planes from the packed view, and the packed view from the planes (see NOTES 2)
+        void loadWba() { planes.load(static_cast<const wba_type&>(wba)); }
+        void packWba() const { planes.pack(wba); }
+
+        // See SoftmaxPolicy for the forward, backward and update functions
+        void forward(std::vector<dType>& ins, std::vector<dType>& outs);
+
+        template <template <typename> class Storage>
+        void forward(const Tensor4<dType, Storage>& ins, Tensor4<dType, Storage>& outs);
+
+        void backward(std::vector<dType>& outs, std::vector<dType>& targets);
+
+        template <template <typename> class Storage>
+        void backward(Tensor4<dType, Storage>& outs, Tensor4<dType, Storage>& targets);
+
+        template <template <typename> class Storage>
+        void updateWba(const frnn::Tensor4<dType, Storage>& prev_layer_acts,
+                       dType learning_rate = dType(0.01), dType momentum = dType(0));
+
+        // The weights are initialized in the packed view, as for SoftmaxPolicy
+        static size_t weightsPerPage() { return nodes * std::max(nodes, inputs); }
+
+    protected:
+        mutable wba_type    wba;             // Packed view of the planes
+        planes_type         planes;          // Weights, biases and activations
+        planes_type         plane_deltas;    // Updates of the planes from the last update (for momentum)
+        errors_type         errors;          // Errors for the layer (one column per sample)
+        uint                num_inputs;      // Number of inputs for the layer
+        GpuContext*         context;         // GPU context for the GPU functions
+};
+#endif
+
+/* =============================================== CPU Definitions ======================================== */
+
+template <typename          dType,
+          uint              nodes,
+          uint              inputs,
+          uint              depth,
+          uint              alignment>
+class AlignedSoftmaxPolicy<dType, frnn::device::CPU, nodes, inputs, depth, alignment> {
+
+    public:
+        typedef Tensor4<dType>                      wba_type;
+        typedef Tensor4<dType>                      errors_type;
+        typedef wba_planes<dType, storage::Host>    planes_type;
+
+        /*
+         * ==================================================================================================
+         * Function     : AlignedSoftmaxPolicy
+         *
+         * Description  : Constructor for the policy, which makes the planes with the leading dimension for
+         *                the alignment
+         *
+         * Inputs       : gpu_context   : The GPU context of the layer, which the CPU functions don't use (it is
+         *                                kept so that the CPU and GPU layers are created the same way)
+         * ==================================================================================================
+         */
+        explicit AlignedSoftmaxPolicy(GpuContext& gpu_context = GpuContext::global()) :
+            wba(nodes, std::max(inputs, nodes) + 2, depth, 1), num_inputs(inputs), errors(nodes, 1, 1, 1),
+            context(&gpu_context) { setLeadingDimension(alignedLeadingDimension<dType>(nodes, alignment)); }
+
+        void setLeadingDimension(uint ld);
+
+        inline uint leadingDimension() const { return planes.leadingDimension(); }
+        inline const planes_type& getPlanes() const { return planes; }
+
+        void loadWba() { planes.load(static_cast<const wba_type&>(wba)); }
+        void packWba() const { planes.pack(wba); }
+
+        void forward(std::vector<dType>& ins, std::vector<dType>& outs);
+
+        template <template <typename> class Storage>
+        void forward(const Tensor4<dType, Storage>& ins, Tensor4<dType, Storage>& outs);
+
+        void backward(std::vector<dType>& outs, std::vector<dType>& targets);
+
+        template <template <typename> class Storage>
+        void backward(Tensor4<dType, Storage>& outs, Tensor4<dType, Storage>& targets);
+
+        template <template <typename> class Storage>
+        void updateWba(const frnn::Tensor4<dType, Storage>& prev_layer_acts,
+                       dType learning_rate = dType(0.01), dType momentum = dType(0));
+
+        static size_t weightsPerPage() { return nodes * std::max(nodes, inputs); }
+
+    protected:
+        mutable wba_type    wba;             // Packed view of the planes
+        planes_type         planes;          // Weights, biases and activations
+        planes_type         plane_deltas;    // Updates of the planes from the last update (for momentum)
+        errors_type         errors;          // Errors for the layer (one column per sample)
+        uint                num_inputs;      // Number of inputs for the layer
+        GpuContext*         context;         // GPU context (unused by the CPU functions)
+};
+
+/* ======================================= GPU IMPLEMENTATIONS ============================================ */
+#ifdef FRNN_WITH_CUDA
+
+template <typename dType, uint nds, uint ipts, uint dth, uint aln>
+void AlignedSoftmaxPolicy<dType, device::GPU, nds, ipts, dth, aln>::setLeadingDimension(uint ld) {
+    frnnError error;
+    if (ld < nds) {
+        frnn::err::dimError(error, stringify(ld), stringify(nds));
+        return;
+    }
+    if (planes.nodes != 0) packWba();
+    planes.reshape(nds, ipts, dth, ld);
+    plane_deltas.reshape(nds, ipts, dth, ld);
+    loadWba();
+}
+
+template <typename dType, uint nds, uint ipts, uint dth, uint aln>
+void AlignedSoftmaxPolicy<dType, device::GPU, nds, ipts, dth, aln>::forward(
+        std::vector<dType>& ins, std::vector<dType>& outs) {
+    // A batch of one sample, so that the planes are used by the batched gemms
+    Tensor4<dType> ins_t(ins.size(), 1, 1, 1), outs_t;
+    ins_t.getData().assign(ins.begin(), ins.end());
+    softmaxForwardBatchedGpu(*context, static_cast<const Tensor4<dType>&>(ins_t), planes, num_inputs, outs_t);
+
+    if (outs.size() < outs_t.size()) outs.resize(outs_t.size(), 0);
+    std::copy(outs_t.getData().begin(), outs_t.getData().end(), outs.begin());
+}
+
+template <typename dType, uint nds, uint ipts, uint dth, uint aln>
+template <template <typename> class Storage>
+void AlignedSoftmaxPolicy<dType, device::GPU, nds, ipts, dth, aln>::forward(
+        const Tensor4<dType, Storage>& ins, Tensor4<dType, Storage>& outs) {
+    softmaxForwardBatchedGpu(*context, ins, static_cast<const planes_type&>(planes), num_inputs, outs);
+}
+
+template <typename dType, uint nds, uint ipts, uint dth, uint aln>
+void AlignedSoftmaxPolicy<dType, device::GPU, nds, ipts, dth, aln>::backward(
+        std::vector<dType>& outs, std::vector<dType>& targets) {
+    errors.reshape(outs.size(), 1, 1, 1);
+    softmaxBackwardCpu(outs, targets, errors.getData());
+}
+
+template <typename dType, uint nds, uint ipts, uint dth, uint aln>
+template <template <typename> class Storage>
+void AlignedSoftmaxPolicy<dType, device::GPU, nds, ipts, dth, aln>::backward(
+        Tensor4<dType, Storage>& outs, Tensor4<dType, Storage>& targets) {
+    softmaxBackwardGpu(*context, outs, targets, errors);
+}
+
+template <typename dType, uint nds, uint ipts, uint dth, uint aln>
+template <template <typename> class Storage>
+void AlignedSoftmaxPolicy<dType, device::GPU, nds, ipts, dth, aln>::updateWba(
+        const frnn::Tensor4<dType, Storage>& prev_layer_acts, dType learning_rate, dType momentum) {
+    softmaxUpdateWbaGpu(*context, prev_layer_acts, errors, num_inputs, learning_rate, momentum, planes, plane_deltas);
+}
+#endif
+
+/* ======================================= CPU IMPLEMENTATIONS  =========================================== */
+
+template <typename dType, uint nds, uint ipts, uint dth, uint aln>
+void AlignedSoftmaxPolicy<dType, device::CPU, nds, ipts, dth, aln>::setLeadingDimension(uint ld) {
+    frnnError error;
+    if (ld < nds) {
+        frnn::err::dimError(error, stringify(ld), stringify(nds));
+        return;
+    }
+    if (planes.nodes != 0) packWba();
+    planes.reshape(nds, ipts, dth, ld);
+    plane_deltas.reshape(nds, ipts, dth, ld);
+    loadWba();
+}
+
+template <typename dType, uint nds, uint ipts, uint dth, uint aln>
+void AlignedSoftmaxPolicy<dType, device::CPU, nds, ipts, dth, aln>::forward(
+        std::vector<dType>& ins, std::vector<dType>& outs) {
+    softmaxForwardCpu(ins, planes, num_inputs, outs);
+}
+
+template <typename dType, uint nds, uint ipts, uint dth, uint aln>
+template <template <typename> class Storage>
+void AlignedSoftmaxPolicy<dType, device::CPU, nds, ipts, dth, aln>::forward(
+        const Tensor4<dType, Storage>& ins, Tensor4<dType, Storage>& outs) {
+    softmaxForwardBatchedCpu(ins, planes, num_inputs, outs);
+}
+
+template <typename dType, uint nds, uint ipts, uint dth, uint aln>
+void AlignedSoftmaxPolicy<dType, device::CPU, nds, ipts, dth, aln>::backward(
+        std::vector<dType>& outs, std::vector<dType>& targets) {
+    errors.reshape(outs.size(), 1, 1, 1);
+    softmaxBackwardCpu(outs, targets, errors.getData());
+}
+
+template <typename dType, uint nds, uint ipts, uint dth, uint aln>
+template <template <typename> class Storage>
+void AlignedSoftmaxPolicy<dType, device::CPU, nds, ipts, dth, aln>::backward(
+        Tensor4<dType, Storage>& outs, Tensor4<dType, Storage>& targets) {
+    errors.reshape(outs.x(), outs.y(), 1, 1);
+    softmaxBackwardCpu(outs.getData(), targets.getData(), errors.getData());
+}
+
+template <typename dType, uint nds, uint ipts, uint dth, uint aln>
+template <template <typename> class Storage>
+void AlignedSoftmaxPolicy<dType, device::CPU, nds, ipts, dth, aln>::updateWba(
+        const frnn::Tensor4<dType, Storage>& prev_layer_acts, dType learning_rate, dType momentum) {
+    softmaxUpdateWbaCpu(prev_layer_acts, errors, num_inputs, learning_rate, momentum, planes, plane_deltas);
+}
+
+}   // Namepsace ltype
+}   // Namepsace frnn
+#endif
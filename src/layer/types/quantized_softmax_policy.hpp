@@ -0,0 +1,166 @@
+/*
+ *  Header file for fastRNN quantized softmax policy class, a softmax layer
+ *  for inference on the CPU whose forward pass uses int8 weights.
+ *
+ *  Copyright (C) 2015 Rob Clucas robclu1818@gmail.com
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published
+ *  by the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program; if not, write to the Free Software Foundation,
+ *  Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#ifndef _FRNN_QUANTIZED_SOFTMAX_POLICY_
+#define _FRNN_QUANTIZED_SOFTMAX_POLICY_
+
+#include <vector>
+
+#include "../../tensor/tensor.cuh"
+#include "../../frnn/frnn.h"
+#include "../../frnn/gpu_context.cuh"
+#include "quantized_wba.hpp"
+#include "softmax_cpu_functions.hpp"
+
+/* ============================================= NOTES ======================================================
+ *
+ * 1. The layer keeps the packed wba (in dType) as the parameters, and a quantized copy of the weights (see
+ *    quantized_wba.hpp) which the forward passes use. The copy is made by loadWba, which the layer calls
+ *    when the weights are initialized, and which must be called after the wba is changed in any other way.
+ *
+ * 2. The backward pass and the update are those of a SoftmaxPolicy layer, on the wba in dType, after which
+ *    the weights are quantized again. So a layer can be fine tuned with the quantized forward pass, but it is
+ *    meant for inference, and there is only a CPU version.
+ *
+ * ==========================================================================================================
+ */
+
+namespace frnn {
+namespace ltype {
+
+/*
+ * ==========================================================================================================
+ * Class        : QuantizedSoftmaxPolicy
+ *
+ * Desription   : Policy class for a softmax layer with an int8 forward pass (see NOTES 1 - 2)
+ *
+ * Params       : dType     : The type of data for the network
+ *              : device    : The device type to use (only CPU)
+ *              : nodes     : The number of nodes for the layer
+ *              : inputs    : The number of inputs to the layer
+ *              : depth     : The number of different inputs in the layer (almost always 1 for softmax)
+ * ==========================================================================================================
+ */
+template <typename          dType,
+         frnn::device       dev,
+         uint               nodes,
+         uint               inputs,
+         uint               depth>
+class QuantizedSoftmaxPolicy;
+
+/* ============================================== CPU Definitions ========================================  */
+
+template <typename          dType,
+          uint              nodes,
+          uint              inputs,
+          uint              depth>
+class QuantizedSoftmaxPolicy<dType, frnn::device::CPU, nodes, inputs, depth> {
+
+    public:
+        typedef Tensor4<dType>          wba_type;
+        typedef Tensor4<dType>          errors_type;
+        typedef quantized_wba<dType>    quantized_type;
+
+        /*
+         * ==================================================================================================
+         * Function     : QuantizedSoftmaxPolicy
+         *
+         * Description  : Constructor for the policy, which quantizes the (zero) weights
+         *
+         * Inputs       : gpu_context   : The GPU context of the layer, which the CPU functions don't use (it is
+         *                                kept so that the layers are created the same way)
+         * ==================================================================================================
+         */
+        explicit QuantizedSoftmaxPolicy(GpuContext& gpu_context = GpuContext::global()) :
+            wba(nodes, std::max(inputs, nodes) + 2, depth, 1),
+            wba_deltas(nodes, std::max(inputs, nodes) + 2, depth, 1), errors(nodes, 1, 1, 1),
+            num_inputs(inputs), context(&gpu_context) { loadWba(); }
+
+        inline const quantized_type& getQuantized() const { return quantized; }
+
+        void loadWba() { quantized.quantize(static_cast<const wba_type&>(wba), num_inputs); }
+
+        void forward(std::vector<dType>& ins, std::vector<dType>& outs);
+
+        template <template <typename> class Storage>
+        void forward(const Tensor4<dType, Storage>& ins, Tensor4<dType, Storage>& outs);
+
+        void backward(std::vector<dType>& outs, std::vector<dType>& targets);
+
+        template <template <typename> class Storage>
+        void backward(Tensor4<dType, Storage>& outs, Tensor4<dType, Storage>& targets);
+
+        template <template <typename> class Storage>
+        void updateWba(const frnn::Tensor4<dType, Storage>& prev_layer_acts,
+                       dType learning_rate = dType(0.01), dType momentum = dType(0));
+
+        static size_t weightsPerPage() { return nodes * std::max(nodes, inputs); }
+
+    protected:
+        wba_type            wba;             // Weights, biases and activations (in dType)
+        wba_type            wba_deltas;      // Updates of the wba from the last update (for momentum)
+        quantized_type      quantized;       // Quantized weights and biases for the forward passes
+        errors_type         errors;          // Errors for the layer (one column per sample)
+        uint                num_inputs;      // Number of inputs for the layer
+        GpuContext*         context;         // GPU context (unused by the CPU functions)
+};
+
+/* ======================================= CPU IMPLEMENTATIONS  =========================================== */
+
+template <typename dType, uint nds, uint ipts, uint dth>
+void QuantizedSoftmaxPolicy<dType, device::CPU, nds, ipts, dth>::forward(
+        std::vector<dType>& ins, std::vector<dType>& outs) {
+    softmaxForwardCpu(ins, quantized, num_inputs, outs);
+}
+
+template <typename dType, uint nds, uint ipts, uint dth>
+template <template <typename> class Storage>
+void QuantizedSoftmaxPolicy<dType, device::CPU, nds, ipts, dth>::forward(
+        const Tensor4<dType, Storage>& ins, Tensor4<dType, Storage>& outs) {
+    softmaxForwardBatchedCpu(ins, quantized, num_inputs, outs);
+}
+
+template <typename dType, uint nds, uint ipts, uint dth>
+void QuantizedSoftmaxPolicy<dType, device::CPU, nds, ipts, dth>::backward(
+        std::vector<dType>& outs, std::vector<dType>& targets) {
+    errors.reshape(outs.size(), 1, 1, 1);
+    softmaxBackwardCpu(outs, targets, errors.getData());
+}
+
+template <typename dType, uint nds, uint ipts, uint dth>
+template <template <typename> class Storage>
+void QuantizedSoftmaxPolicy<dType, device::CPU, nds, ipts, dth>::backward(
+        Tensor4<dType, Storage>& outs, Tensor4<dType, Storage>& targets) {
+    errors.reshape(outs.x(), outs.y(), 1, 1);
+    softmaxBackwardCpu(outs.getData(), targets.getData(), errors.getData());
+}
+
+template <typename dType, uint nds, uint ipts, uint dth>
+template <template <typename> class Storage>
+void QuantizedSoftmaxPolicy<dType, device::CPU, nds, ipts, dth>::updateWba(
+        const frnn::Tensor4<dType, Storage>& prev_layer_acts, dType learning_rate, dType momentum) {
+    softmaxUpdateWbaCpu(prev_layer_acts, errors, num_inputs, learning_rate, momentum, wba, wba_deltas);
+    loadWba();
+}
+
+}   // Namepsace ltype
+}   // Namepsace frnn
+#endif
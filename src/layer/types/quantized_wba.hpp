@@ -0,0 +1,134 @@
+/*
+ *  Header file for the fastRNN quantized wba, which stores the weights of a
+ *  layer as int8 with a scale for each row, for quantized inference on the
+ *  CPU.
+ *
+ *  Copyright (C) 2015 Rob Clucas robclu1818@gmail.com
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published
+ *  by the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program; if not, write to the Free Software Foundation,
+ *  Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#ifndef _FRNN_QUANTIZED_WBA_
+#define _FRNN_QUANTIZED_WBA_
+
+#include <algorithm>
+#include <cstdint>
+#include <vector>
+
+#include "../../tensor/tensor.cuh"
+#include "../../util/errors.h"
+#include "../../frnn/aligned_allocator.h"
+#include "../../math/math_cpu.hpp"
+
+/* ============================================= NOTES ======================================================
+ *
+ * 1. The weights of each node for each page (a row of W_p) are quantized separately (symmetric, so a row
+ *    is its int8 elements times its scale, see quantizeCpu), which keeps the error of a row relative to its
+ *    own largest weight rather than the largest weight of the layer.
+ *
+ * 2. The rows are stored contiguously (W_p is column major in the packed wba), each padded with zeros to a
+ *    multiple of FRNN_ALIGNMENT bytes, so every row starts on a vector boundary and a quantized input padded
+ *    the same way can be multiplied with the whole row, without a scalar tail.
+ *
+ * 3. The biases are kept in dType, summed over the pages, since all the pages get the same inputs.
+ *
+ * ==========================================================================================================
+ */
+
+namespace frnn {
+
+/*
+ * ==========================================================================================================
+ * Function     : quantizedRowStride
+ *
+ * Description  : Gets the number of elements of a quantized row of num_inputs weights (see NOTES 2)
+ *
+ * Inputs       : num_inputs    : The number of inputs of the layer
+ * ==========================================================================================================
+ */
+inline size_t quantizedRowStride( size_t num_inputs ) {
+    return ( ( num_inputs + FRNN_ALIGNMENT - 1 ) / FRNN_ALIGNMENT ) * FRNN_ALIGNMENT;
+}
+
+/*
+ * ==========================================================================================================
+ * Struct       : quantized_wba
+ *
+ * Description  : The int8 weights of a layer with a scale for each row, and the biases (see NOTES 1 - 3)
+ *
+ * Params       : dType     : The type of data of the scales and the biases
+ * ==========================================================================================================
+ */
+template <typename dType>
+struct quantized_wba {
+    aligned_vector<int8_t>  weights;        // Row ( page * nodes + node ) is the weights of a node for a page
+    std::vector<dType>      scales;         // The scale of each row
+    std::vector<dType>      biases;         // The sum of the biases of the pages for each node
+    uint                    nodes;          // The number of nodes of the layer
+    uint                    inputs;         // The number of inputs of the layer
+    uint                    depth;          // The number of pages
+    size_t                  row_stride;     // The number of elements of each row (with the padding)
+
+    quantized_wba() : nodes( 0 ), inputs( 0 ), depth( 0 ), row_stride( 0 ) {}
+
+    inline const int8_t* row( size_t node, size_t page ) const {
+        return &weights[ 0 ] + ( page * nodes + node ) * row_stride;
+    }
+    inline dType scale( size_t node, size_t page ) const { return scales[ page * nodes + node ]; }
+
+    /*
+     * ======================================================================================================
+     * Function     : quantize
+     *
+     * Description  : Sets the quantized weights and the biases from a packed wba tensor
+     *
+     * Inputs       : wba           : The packed weights, biases and activations
+     *              : num_inputs    : The number of inputs of the layer
+     *
+     * Params       : Storage       : The storage policy of the packed tensor
+     * ======================================================================================================
+     */
+    template <template <typename> class Storage>
+    void quantize( const Tensor4<dType, Storage>& wba, uint num_inputs ) {
+        frnnError error;
+        if ( wba.y() < num_inputs + 2 ) {
+            frnn::err::dimError( error, stringify( wba ), stringify( num_inputs ) );
+            return;
+        }
+
+        nodes      = wba.x();
+        inputs     = num_inputs;
+        depth      = wba.z();
+        row_stride = quantizedRowStride( num_inputs );
+        weights.assign( row_stride * nodes * depth, 0 );
+        scales.assign( nodes * depth, dType( 0 ) );
+        biases.assign( nodes, dType( 0 ) );
+
+        const dType*        wba_h = &wba.hostData()[ 0 ];
+        std::vector<dType>  values( num_inputs );
+        for ( uint page = 0; page < depth; page++ ) {
+            for ( uint node = 0; node < nodes; node++ ) {
+                for ( uint col = 0; col < num_inputs; col++ ) values[ col ] = wba_h[ wba.index( node, col, page, 0 ) ];
+                int8_t* q = &weights[ 0 ] + ( page * nodes + node ) * row_stride;
+                scales[ page * nodes + node ] = num_inputs == 0 ? dType( 1 ) : quantizeCpu( &values[ 0 ], num_inputs, q );
+                biases[ node ] += wba_h[ wba.index( node, num_inputs, page, 0 ) ];
+            }
+        }
+    }
+};
+
+}   // Namespace frnn
+
+#endif
@@ -0,0 +1,255 @@
+/*
+ *  Header file for the fastRNN recurrent cells (vanilla RNN, LSTM and GRU),
+ *  which are shared by the CPU and GPU implementations of the recurrent
+ *  layer policies, and for the recurrent state of a layer.
+ *
+ *  Copyright (C) 2015 Rob Clucas robclu1818@gmail.com
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published
+ *  by the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program; if not, write to the Free Software Foundation,
+ *  Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#ifndef _FRNN_RECURRENT_CELLS_
+#define _FRNN_RECURRENT_CELLS_
+
+#include <algorithm>
+#include <cmath>
+
+#include "../../frnn/cuda_host.h"
+#include "../../tensor/tensor.cuh"
+#include "../../functors/functors.cuh"
+
+/* ============================================= NOTES ======================================================
+ *
+ * 1. A recurrent layer with G gates uses the same wba layout for every cell, each page is a
+ *    ( G * nodes ) x ( inputs + nodes + 2 ) matrix where the rows are the gates of each node (row
+ *    g * nodes + n is gate g of node n) and the columns are
+ *
+ *      | W_d ( inputs ) | U_d ( nodes ) | b_d | activations |
+ *
+ *    W_d are the weights of the inputs and U_d the weights of the outputs of the layer. Page d is for the
+ *    step d timesteps back (depth is the number of timesteps back which have inputs to the layer), so the
+ *    pre-activations of the gates at timestep t are
+ *
+ *      in_t  = sum over d ( W_d * x_( t - d ) + b_d )          rec_t = sum over d ( U_d * h_( t - 1 - d ) )
+ *
+ *    which for a depth of 1 is the usual cell. The input part is kept apart from the recurrent part since
+ *    the GRU only resets the recurrent part of its candidate.
+ *
+ * 2. The inputs and outputs of previous timesteps (before the first timestep of a forward pass) come from
+ *    the recurrent state of the layer, which starts as zeros and is kept between forward passes, so a
+ *    sequence can be given all at once or one timestep at a time (which is the case for inference).
+ *
+ * 3. The backward pass of a cell recomputes the gates from the pre-activations (rather than keeping them
+ *    from the forward pass), so that only the pre-activations and the cell states need to be kept for a
+ *    timestep. Since in and rec are added for every gate except the candidate of the GRU, their gradients
+ *    are the same for those gates.
+ *
+ * ==========================================================================================================
+ */
+
+namespace frnn {
+namespace cell {
+
+/*
+ * ==========================================================================================================
+ * Struct       : rnn
+ *
+ * Description  : Vanilla recurrent cell, h = tanh( in + rec )
+ * ==========================================================================================================
+ */
+struct rnn {
+    static constexpr uint gates = 1;
+
+    /*
+     * ======================================================================================================
+     * Function     : step
+     *
+     * Description  : Computes the output of a node of a cell for a timestep
+     *
+     * Inputs       : in        : The input part of the pre-activation of each gate of the node
+     *              : rec       : The recurrent part of the pre-activation of each gate of the node
+     *              : h_prev    : The output of the node at the previous timestep
+     *              : c         : The cell state of the node at the previous timestep (LSTM only)
+     *
+     * Outputs      : c         : The cell state of the node at this timestep (LSTM only)
+     *              : The output of the node at this timestep
+     *
+     * Params       : dType     : The type of data of the cell
+     * ======================================================================================================
+     */
+    template <typename dType>
+    __host__ __device__ static inline dType step( const dType* in, const dType* rec, dType h_prev, dType& c ) {
+        return std::tanh( in[ 0 ] + rec[ 0 ] );
+    }
+
+    /*
+     * ======================================================================================================
+     * Function     : backward
+     *
+     * Description  : Computes the gradients of the pre-activations of the gates of a node for a timestep,
+     *                from the gradient of the output of the node (see NOTES 3)
+     *
+     * Inputs       : in        : The input part of the pre-activation of each gate of the node
+     *              : rec       : The recurrent part of the pre-activation of each gate of the node
+     *              : h_prev    : The output of the node at the previous timestep
+     *              : c_prev    : The cell state of the node at the previous timestep (LSTM only)
+     *              : dh        : The gradient of the output of the node at this timestep
+     *              : dc        : The gradient of the cell state of the node at this timestep (LSTM only)
+     *
+     * Outputs      : dc        : The gradient of the cell state of the node at the previous timestep
+     *              : d_in      : The gradient of the input part of the pre-activation of each gate
+     *              : d_rec     : The gradient of the recurrent part of the pre-activation of each gate
+     *              : The gradient of the output of the previous timestep which doesn't go through U
+     *
+     * Params       : dType     : The type of data of the cell
+     * ======================================================================================================
+     */
+    template <typename dType>
+    __host__ __device__ static inline dType backward( const dType* in, const dType* rec, dType h_prev, dType c_prev,
+                                                      dType dh, dType& dc, dType* d_in, dType* d_rec ) {
+        const dType h = std::tanh( in[ 0 ] + rec[ 0 ] );
+        d_in[ 0 ] = d_rec[ 0 ] = dh * ( dType( 1 ) - h * h );
+        return dType( 0 );
+    }
+};
+
+/*
+ * ==========================================================================================================
+ * Struct       : lstm
+ *
+ * Description  : Long short-term memory cell with gates ( input, forget, candidate, output ), where
+ *                c = f * c + i * g and h = o * tanh( c )
+ * ==========================================================================================================
+ */
+struct lstm {
+    static constexpr uint gates = 4;
+
+    template <typename dType>
+    __host__ __device__ static inline dType step( const dType* in, const dType* rec, dType h_prev, dType& c ) {
+        frnn::functors::sigmoid sigmoid;
+        const dType i = sigmoid( in[ 0 ] + rec[ 0 ] );
+        const dType f = sigmoid( in[ 1 ] + rec[ 1 ] );
+        const dType g = std::tanh( in[ 2 ] + rec[ 2 ] );
+        const dType o = sigmoid( in[ 3 ] + rec[ 3 ] );
+        c = f * c + i * g;
+        return o * std::tanh( c );
+    }
+
+    template <typename dType>
+    __host__ __device__ static inline dType backward( const dType* in, const dType* rec, dType h_prev, dType c_prev,
+                                                      dType dh, dType& dc, dType* d_in, dType* d_rec ) {
+        frnn::functors::sigmoid sigmoid;
+        const dType i   = sigmoid( in[ 0 ] + rec[ 0 ] );
+        const dType f   = sigmoid( in[ 1 ] + rec[ 1 ] );
+        const dType g   = std::tanh( in[ 2 ] + rec[ 2 ] );
+        const dType o   = sigmoid( in[ 3 ] + rec[ 3 ] );
+        const dType t_c = std::tanh( f * c_prev + i * g );
+        const dType d_c = dc + dh * o * ( dType( 1 ) - t_c * t_c );
+
+        d_in[ 0 ] = d_rec[ 0 ] = d_c * g * i * ( dType( 1 ) - i );
+        d_in[ 1 ] = d_rec[ 1 ] = d_c * c_prev * f * ( dType( 1 ) - f );
+        d_in[ 2 ] = d_rec[ 2 ] = d_c * i * ( dType( 1 ) - g * g );
+        d_in[ 3 ] = d_rec[ 3 ] = dh * t_c * o * ( dType( 1 ) - o );
+        dc = d_c * f;
+        return dType( 0 );
+    }
+};
+
+/*
+ * ==========================================================================================================
+ * Struct       : gru
+ *
+ * Description  : Gated recurrent unit with gates ( reset, update, candidate ), where the reset gate scales
+ *                the recurrent part of the candidate, n = tanh( in_n + r * rec_n ), and
+ *                h = ( 1 - z ) * n + z * h_prev
+ * ==========================================================================================================
+ */
+struct gru {
+    static constexpr uint gates = 3;
+
+    template <typename dType>
+    __host__ __device__ static inline dType step( const dType* in, const dType* rec, dType h_prev, dType& c ) {
+        frnn::functors::sigmoid sigmoid;
+        const dType r = sigmoid( in[ 0 ] + rec[ 0 ] );
+        const dType z = sigmoid( in[ 1 ] + rec[ 1 ] );
+        const dType n = std::tanh( in[ 2 ] + r * rec[ 2 ] );
+        return ( dType( 1 ) - z ) * n + z * h_prev;
+    }
+
+    template <typename dType>
+    __host__ __device__ static inline dType backward( const dType* in, const dType* rec, dType h_prev, dType c_prev,
+                                                      dType dh, dType& dc, dType* d_in, dType* d_rec ) {
+        frnn::functors::sigmoid sigmoid;
+        const dType r   = sigmoid( in[ 0 ] + rec[ 0 ] );
+        const dType z   = sigmoid( in[ 1 ] + rec[ 1 ] );
+        const dType n   = std::tanh( in[ 2 ] + r * rec[ 2 ] );
+        const dType d_n = dh * ( dType( 1 ) - z ) * ( dType( 1 ) - n * n );
+
+        d_in[ 0 ] = d_rec[ 0 ] = d_n * rec[ 2 ] * r * ( dType( 1 ) - r );
+        d_in[ 1 ] = d_rec[ 1 ] = dh * ( h_prev - n ) * z * ( dType( 1 ) - z );
+        d_in[ 2 ]  = d_n;
+        d_rec[ 2 ] = d_n * r;
+        return dh * z;
+    }
+};
+
+}   // Namespace cell
+
+/*
+ * ==========================================================================================================
+ * Struct       : recurrent_state
+ *
+ * Description  : The outputs, inputs and cell states of the timesteps before the next forward pass of a
+ *                recurrent layer (see NOTES 2), for each sample of a batch
+ *
+ * Params       : dType     : The type of data of the state
+ *              : Storage   : The storage policy of the state tensors
+ * ==========================================================================================================
+ */
+template <typename dType, template <typename> class Storage>
+struct recurrent_state {
+    Tensor4<dType, Storage>     hidden;         // Outputs h_( t - depth ) ... h_( t - 1 ) : nodes x batch x depth
+    Tensor4<dType, Storage>     inputs;         // Inputs x_( t - depth + 1 ) ... x_( t - 1 ): inputs x batch x depth - 1
+    Tensor4<dType, Storage>     cells;          // Cell states c_( t - 1 )                  : nodes x batch
+
+    /*
+     * ======================================================================================================
+     * Function     : reset
+     *
+     * Description  : Sets the state to zeros for a batch, if the state is not already for a batch of the
+     *                size or if force is true
+     *
+     * Inputs       : nodes         : The number of nodes of the layer
+     *              : num_inputs    : The number of inputs of the layer
+     *              : batch_size    : The number of samples in the batch
+     *              : depth         : The depth of the layer
+     *              : force         : If the state must be reset when it's already for the batch size
+     * ======================================================================================================
+     */
+    void reset( uint nodes, uint num_inputs, uint batch_size, uint depth, bool force = false ) {
+        if ( !force && hidden.x() == nodes && hidden.y() == batch_size && hidden.z() == depth ) return;
+
+        hidden.reshape( nodes, batch_size, depth, 1 );
+        inputs.reshape( num_inputs, batch_size, depth - 1, 1 );
+        cells.reshape( nodes, batch_size, 1, 1 );
+        std::fill( hidden.getData().begin(), hidden.getData().end(), dType( 0 ) );
+        std::fill( inputs.getData().begin(), inputs.getData().end(), dType( 0 ) );
+        std::fill( cells.getData().begin() , cells.getData().end() , dType( 0 ) );
+    }
+};
+
+}   // Namespace frnn
+
+#endif
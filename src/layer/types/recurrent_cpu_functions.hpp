@@ -0,0 +1,384 @@
+/*
+ *  Header file for fastRNN recurrent layer CPU functions.
+ *
+ *  Copyright (C) 2015 Rob Clucas robclu1818@gmail.com
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published
+ *  by the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program; if not, write to the Free Software Foundation,
+ *  Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#ifndef _FRNN_RECURRENT_FUNCTIONS_CPU_
+#define _FRNN_RECURRENT_FUNCTIONS_CPU_
+
+#include <algorithm>
+#include <vector>
+
+#include "../../frnn/types.h"
+#include "../../util/errors.h"
+#include "../../tensor/tensor.cuh"
+#include "../../math/math.hpp"
+#include "recurrent_cells.hpp"
+
+namespace frnn {
+
+/*
+ * ==========================================================================================================
+ * Struct       : recurrent_trace
+ *
+ * Description  : What the backward pass needs from a forward pass of a recurrent layer, which is the inputs
+ *                and outputs (including those of the state), the pre-activations and the cell states of
+ *                every timestep of the pass (see NOTES 3 of recurrent_cells.hpp)
+ *
+ * Params       : dType     : The type of data of the trace
+ * ==========================================================================================================
+ */
+template <typename dType>
+struct recurrent_trace {
+    std::vector<dType>  xs;             // Inputs of the state, then of the pass : inputs x batch x depth - 1 + steps
+    std::vector<dType>  hs;             // Outputs of the state, then of the pass: nodes x batch x depth + steps
+    std::vector<dType>  pre;            // Input part of the pre-activations     : gates * nodes x batch x steps
+    std::vector<dType>  rec;            // Recurrent part of the pre-activations : gates * nodes x batch x steps
+    std::vector<dType>  cells;          // Cell states before each timestep, then after the last : nodes x batch x steps + 1
+};
+
+/*
+ * ==========================================================================================================
+ * Struct       : recurrent_carry
+ *
+ * Description  : The gradients of the outputs, inputs and cell states of the timesteps before a backward
+ *                pass (the state of the forward pass), which are carried to the backward pass of the
+ *                timesteps before them. They are empty (zeros) for the last timesteps which are
+ *                backpropogated through, so that the gradients are truncated there.
+ *
+ * Params       : dType     : The type of data of the gradients
+ * ==========================================================================================================
+ */
+template <typename dType>
+struct recurrent_carry {
+    std::vector<dType>  hidden;         // nodes x batch x depth
+    std::vector<dType>  inputs;         // inputs x batch x depth - 1
+    std::vector<dType>  cells;          // nodes x batch
+
+    void clear() { hidden.clear(); inputs.clear(); cells.clear(); }
+};
+
+/*
+ * ==========================================================================================================
+ * Function     : recurrentForwardCpu
+ *
+ * Description  : Forward pass of a recurrent layer for a batch of sequences on the CPU. The input part of
+ *                the pre-activations (see NOTES 1 of recurrent_cells.hpp) doesn't depend on the outputs, so
+ *                it is found for all the timesteps at once with a gemm for each page. Each timestep is then
+ *                a gemm for each page for the recurrent part, followed by the cell for each node of each
+ *                sample.
+ *
+ * Inputs       : ins           : The inputs to the layer, (num_inputs x batch size x timesteps)
+ *              : wba           : The weights, biases and activations of the layer
+ *              : num_inputs    : The number of inputs to the layer
+ *              : state         : The recurrent state of the layer before the first timestep
+ *              : trace         : Where to keep what the backward pass needs (if it isn't 0)
+ *
+ * Outputs      : outs          : The outputs of the layer (nodes x batch size x timesteps)
+ *              : state         : The recurrent state of the layer after the last timestep
+ *              : trace         : The trace of the forward pass
+ *
+ * Params       : Cell          : The recurrent cell (see frnn::cell)
+ *              : dType         : The type of data used for the computation
+ *              : Storage       : The storage policy of the wba tensor and the state
+ *              : IoStorage     : The storage policy of the input and output tensors
+ * ==========================================================================================================
+ */
+template <typename Cell, typename dType, template <typename> class Storage, template <typename> class IoStorage>
+void recurrentForwardCpu( const Tensor4<dType, IoStorage>&      ins       ,
+                          const Tensor4<dType, Storage>&        wba       ,
+                          uint                                  num_inputs,
+                          recurrent_state<dType, Storage>&      state     ,
+                          Tensor4<dType, IoStorage>&            outs      ,
+                          recurrent_trace<dType>*               trace = 0 ) {
+    frnnError       error;
+    const size_t    rows       = wba.x();                           // Gates of all the nodes
+    const size_t    nodes      = rows / Cell::gates;
+    const size_t    depth      = wba.z();
+    const size_t    batch_size = ins.y();
+    const size_t    steps      = ins.z();
+    const size_t    page_size  = wba.x() * wba.y();
+
+    if ( ins.x() != num_inputs || depth == 0 ) {
+        frnn::err::dimError( error, stringify( ins ), stringify( num_inputs ) );
+        return;
+    }
+    if ( outs.x() != nodes || outs.y() != batch_size || outs.z() != steps || outs.size() != nodes * batch_size * steps ) {
+        outs.reshape( nodes, batch_size, steps, 1 );
+    }
+    state.reset( nodes, num_inputs, batch_size, depth );
+    if ( batch_size == 0 || steps == 0 ) return;
+
+    // The inputs and outputs of the timesteps before this pass are followed by those of this pass
+    // The buffers are those of the trace, so that nothing is copied when the pass is traced
+    const size_t            in_step  = num_inputs * batch_size;
+    const size_t            out_step = nodes * batch_size;
+    recurrent_trace<dType>  local;
+    recurrent_trace<dType>& tr       = trace != 0 ? *trace : local;
+    std::vector<dType>&     xs       = tr.xs;
+    std::vector<dType>&     hs       = tr.hs;
+    std::vector<dType>&     pre      = tr.pre;
+    std::vector<dType>      biases( rows, 0 );
+
+    xs.resize( in_step * ( depth - 1 + steps ) );
+    hs.resize( out_step * ( depth + steps ) );
+    pre.resize( rows * batch_size * steps );
+    tr.rec.resize( rows * batch_size * ( trace != 0 ? steps : 1 ) );
+    tr.cells.resize( trace != 0 ? out_step * ( steps + 1 ) : 0 );
+
+    const Tensor4<dType, Storage>& hidden_c = state.hidden;
+    const Tensor4<dType, Storage>& inputs_c = state.inputs;
+    std::copy( inputs_c.hostData().begin(), inputs_c.hostData().end(), xs.begin() );
+    std::copy( ins.hostData().begin()     , ins.hostData().end()     , xs.begin() + in_step * ( depth - 1 ) );
+    std::copy( hidden_c.hostData().begin(), hidden_c.hostData().end(), hs.begin() );
+
+    const dType*    wba_h   = &wba.hostData()[ 0 ];
+    const dType*    u_h     = wba_h + wba.index( 0, num_inputs, 0, 0 );
+    dType*          cells_h = &state.cells.hostData()[ 0 ];
+    if ( trace != 0 ) std::copy( cells_h, cells_h + out_step, tr.cells.begin() );
+
+    // Input part of the pre-activations of every timestep, which start as the sum of the biases of the
+    // pages, then page d adds W_d times the inputs d timesteps back
+    sumVectorsCpu( error, wba_h + wba.index( 0, num_inputs + nodes, 0, 0 ), rows, depth, page_size, &biases[ 0 ] );
+    for ( size_t s = 0; s < batch_size * steps; s++ ) std::copy( biases.begin(), biases.end(), pre.begin() + s * rows );
+    for ( size_t d = 0; d < depth; d++ ) {
+        frnn::math<dType, device::CPU>::gemm(
+                blas::cpu::OP_N, blas::cpu::OP_N, rows, batch_size * steps, num_inputs, dType( 1 ),
+                wba_h + d * page_size, rows, &xs[ in_step * ( depth - 1 - d ) ], num_inputs, dType( 1 ),
+                &pre[ 0 ], rows );
+    }
+
+    for ( size_t t = 0; t < steps; t++ ) {
+        dType* rec = &tr.rec[ trace != 0 ? rows * batch_size * t : 0 ];
+
+        // Recurrent part, page d uses the outputs d + 1 timesteps back
+        for ( size_t d = 0; d < depth; d++ ) {
+            frnn::math<dType, device::CPU>::gemm(
+                    blas::cpu::OP_N, blas::cpu::OP_N, rows, batch_size, nodes, dType( 1 ),
+                    u_h + d * page_size, rows, &hs[ out_step * ( depth + t - 1 - d ) ], nodes,
+                    d == 0 ? dType( 0 ) : dType( 1 ), rec, rows );
+        }
+
+        const dType*    pre_t  = &pre[ rows * batch_size * t ];
+        const dType*    h_prev = &hs[ out_step * ( depth + t - 1 ) ];
+        dType*          h      = &hs[ out_step * ( depth + t ) ];
+
+        #pragma omp parallel for if ( out_step >= frnn::CPU_PARALLEL_MIN_ELEMENTS )
+        for ( size_t e = 0; e < out_step; e++ ) {
+            const size_t    node   = e % nodes;
+            const size_t    sample = e / nodes;
+            dType           in_g[ Cell::gates ], rec_g[ Cell::gates ];
+            for ( size_t g = 0; g < Cell::gates; g++ ) {
+                in_g[ g ]  = pre_t[ sample * rows + g * nodes + node ];
+                rec_g[ g ] = rec[ sample * rows + g * nodes + node ];
+            }
+            h[ e ] = Cell::step( in_g, rec_g, h_prev[ e ], cells_h[ e ] );
+        }
+        if ( trace != 0 ) std::copy( cells_h, cells_h + out_step, tr.cells.begin() + out_step * ( t + 1 ) );
+    }
+
+    // The outputs of this pass, and the last depth timesteps are the state for the next pass
+    std::copy( hs.begin() + out_step * depth, hs.end(), outs.hostData().begin() );
+    std::copy( hs.begin() + out_step * steps, hs.begin() + out_step * ( steps + depth ), state.hidden.hostData().begin() );
+    std::copy( xs.begin() + in_step * steps , xs.end()                                 , state.inputs.hostData().begin() );
+}
+
+/*
+ * ==========================================================================================================
+ * Function     : recurrentBackwardCpu
+ *
+ * Description  : Backward pass through time of a recurrent layer for the timesteps of a traced forward pass.
+ *                The timesteps are done from the last to the first, each is the cells for each node of each
+ *                sample then a gemm for each page for the gradients of the earlier outputs and of U. The
+ *                gradients of W and of the errors of the inputs are then a gemm for each page for all the
+ *                timesteps at once. The gradients for the timesteps before the pass are left in carry, for
+ *                the backward pass of those timesteps.
+ *
+ * Inputs       : wba           : The weights, biases and activations of the layer
+ *              : num_inputs    : The number of inputs to the layer
+ *              : trace         : The trace of the forward pass of the timesteps
+ *              : errors        : The gradients of the outputs of the layer (nodes x batch size x timesteps)
+ *              : carry         : The gradients of the timesteps after the pass which are for the timesteps
+ *                                of the pass (empty if there are none)
+ *
+ * Outputs      : gradients     : The gradients of the wba, which are added to
+ *              : carry         : The gradients of the timesteps before the pass
+ *              : in_errors     : The gradients of the inputs of the layer (inputs x batch size x timesteps)
+ *
+ * Params       : Cell          : The recurrent cell (see frnn::cell)
+ *              : dType         : The type of data used for the computation
+ *              : Storage       : The storage policy of the wba and gradient tensors
+ *              : IoStorage     : The storage policy of the error tensors
+ * ==========================================================================================================
+ */
+template <typename Cell, typename dType, template <typename> class Storage, template <typename> class IoStorage>
+void recurrentBackwardCpu( const Tensor4<dType, Storage>&        wba       ,
+                           uint                                  num_inputs,
+                           const recurrent_trace<dType>&         trace     ,
+                           const Tensor4<dType, IoStorage>&      errors    ,
+                           recurrent_carry<dType>&               carry     ,
+                           Tensor4<dType, Storage>&              gradients ,
+                           Tensor4<dType, IoStorage>&            in_errors ) {
+    frnnError       error;
+    const size_t    rows       = wba.x();
+    const size_t    nodes      = rows / Cell::gates;
+    const size_t    depth      = wba.z();
+    const size_t    batch_size = errors.y();
+    const size_t    steps      = errors.z();
+    const size_t    page_size  = wba.x() * wba.y();
+    const size_t    in_step    = num_inputs * batch_size;
+    const size_t    out_step   = nodes * batch_size;
+
+    if ( errors.x() != nodes || trace.pre.size() != rows * batch_size * steps || trace.cells.size() != out_step * ( steps + 1 ) ) {
+        frnn::err::dimError( error, stringify( errors ), stringify( trace ) );
+        return;
+    }
+    if ( gradients.x() != wba.x() || gradients.y() != wba.y() || gradients.z() != wba.z() ) {
+        gradients.reshape( wba.x(), wba.y(), wba.z(), 1 );
+    }
+    if ( in_errors.x() != num_inputs || in_errors.y() != batch_size || in_errors.z() != steps ||
+         in_errors.size() != in_step * steps ) {
+        in_errors.reshape( num_inputs, batch_size, steps, 1 );
+    }
+    if ( batch_size == 0 || steps == 0 ) return;
+
+    // Gradients of the outputs and inputs of the state and of the pass (laid out as in the trace), the
+    // carried gradients are for the last depth outputs and depth - 1 inputs
+    std::vector<dType>  dh( out_step * ( depth + steps ), 0 ), dx( in_step * ( depth - 1 + steps ), 0 );
+    std::vector<dType>  dc( out_step, 0 ), d_in( rows * batch_size * steps ), d_rec( rows * batch_size );
+    std::vector<dType>  d_biases( rows );
+
+    const Tensor4<dType, IoStorage>& errors_c = errors;
+    std::copy( errors_c.hostData().begin(), errors_c.hostData().end(), dh.begin() + out_step * depth );
+    for ( size_t e = 0; e < carry.hidden.size() && e < out_step * depth; e++ ) dh[ out_step * steps + e ] += carry.hidden[ e ];
+    for ( size_t e = 0; e < carry.inputs.size() && e < in_step * ( depth - 1 ); e++ ) dx[ in_step * steps + e ] += carry.inputs[ e ];
+    for ( size_t e = 0; e < carry.cells.size() && e < out_step; e++ ) dc[ e ] = carry.cells[ e ];
+
+    const dType*    wba_h  = &wba.hostData()[ 0 ];
+    const dType*    u_h    = wba_h + wba.index( 0, num_inputs, 0, 0 );
+    dType*          grad_h = &gradients.hostData()[ 0 ];
+    dType*          grad_u = grad_h + gradients.index( 0, num_inputs, 0, 0 );
+
+    for ( size_t t = steps; t-- > 0; ) {
+        const dType*    pre_t  = &trace.pre[ rows * batch_size * t ];
+        const dType*    rec_t  = &trace.rec[ rows * batch_size * t ];
+        const dType*    h_prev = &trace.hs[ out_step * ( depth + t - 1 ) ];
+        const dType*    c_prev = &trace.cells[ out_step * t ];
+        const dType*    dh_t   = &dh[ out_step * ( depth + t ) ];
+        dType*          dh_prev = &dh[ out_step * ( depth + t - 1 ) ];
+        dType*          d_in_t  = &d_in[ rows * batch_size * t ];
+
+        #pragma omp parallel for if ( out_step >= frnn::CPU_PARALLEL_MIN_ELEMENTS )
+        for ( size_t e = 0; e < out_step; e++ ) {
+            const size_t    node   = e % nodes;
+            const size_t    sample = e / nodes;
+            dType           in_g[ Cell::gates ], rec_g[ Cell::gates ], d_in_g[ Cell::gates ], d_rec_g[ Cell::gates ];
+            for ( size_t g = 0; g < Cell::gates; g++ ) {
+                in_g[ g ]  = pre_t[ sample * rows + g * nodes + node ];
+                rec_g[ g ] = rec_t[ sample * rows + g * nodes + node ];
+            }
+            dh_prev[ e ] += Cell::backward( in_g, rec_g, h_prev[ e ], c_prev[ e ], dh_t[ e ], dc[ e ], d_in_g, d_rec_g );
+            for ( size_t g = 0; g < Cell::gates; g++ ) {
+                d_in_t[ sample * rows + g * nodes + node ] = d_in_g[ g ];
+                d_rec[ sample * rows + g * nodes + node ]  = d_rec_g[ g ];
+            }
+        }
+
+        // Page d used the outputs d + 1 timesteps back
+        for ( size_t d = 0; d < depth; d++ ) {
+            const size_t h_offset = out_step * ( depth + t - 1 - d );
+            frnn::math<dType, device::CPU>::gemm(
+                    blas::cpu::OP_T, blas::cpu::OP_N, nodes, batch_size, rows, dType( 1 ),
+                    u_h + d * page_size, rows, &d_rec[ 0 ], rows, dType( 1 ), &dh[ h_offset ], nodes );
+            frnn::math<dType, device::CPU>::gemm(
+                    blas::cpu::OP_N, blas::cpu::OP_T, rows, nodes, batch_size, dType( 1 ),
+                    &d_rec[ 0 ], rows, &trace.hs[ h_offset ], nodes, dType( 1 ), grad_u + d * page_size, rows );
+        }
+    }
+
+    // Page d used the inputs d timesteps back, and every page has the same bias gradients
+    for ( size_t d = 0; d < depth; d++ ) {
+        const size_t x_offset = in_step * ( depth - 1 - d );
+        frnn::math<dType, device::CPU>::gemm(
+                blas::cpu::OP_N, blas::cpu::OP_T, rows, num_inputs, batch_size * steps, dType( 1 ),
+                &d_in[ 0 ], rows, &trace.xs[ x_offset ], num_inputs, dType( 1 ), grad_h + d * page_size, rows );
+        frnn::math<dType, device::CPU>::gemm(
+                blas::cpu::OP_T, blas::cpu::OP_N, num_inputs, batch_size * steps, rows, dType( 1 ),
+                wba_h + d * page_size, rows, &d_in[ 0 ], rows, dType( 1 ), &dx[ x_offset ], num_inputs );
+    }
+    sumVectorsCpu( error, &d_in[ 0 ], rows, batch_size * steps, rows, &d_biases[ 0 ] );
+    for ( size_t d = 0; d < depth; d++ ) {
+        dType* grad_b = grad_h + gradients.index( 0, num_inputs + nodes, d, 0 );
+        for ( size_t r = 0; r < rows; r++ ) grad_b[ r ] += d_biases[ r ];
+    }
+
+    std::copy( dx.begin() + in_step * ( depth - 1 ), dx.end(), in_errors.hostData().begin() );
+    carry.hidden.assign( dh.begin(), dh.begin() + out_step * depth );
+    carry.inputs.assign( dx.begin(), dx.begin() + in_step * ( depth - 1 ) );
+    carry.cells.swap( dc );
+}
+
+/*
+ * ==========================================================================================================
+ * Function     : recurrentUpdateWbaCpu
+ *
+ * Description  : Updates the wba of a recurrent layer with the gradients of the backward passes since the
+ *                last update, using gradient descent with momentum, and sets the gradients to zero
+ *
+ * Inputs       : samples       : The number of samples the gradients are for (the gradient is averaged)
+ *              : learning_rate : The learning rate for the update
+ *              : momentum      : The fraction of the previous update to add to this update
+ *              : gradients     : The gradients of the wba
+ *
+ * Outputs      : wba           : The updated wba
+ *              : wba_deltas    : The updates of the wba (for the momentum of the next update)
+ *              : gradients     : Zeros
+ *
+ * Params       : dType         : The type of data used for the computation
+ *              : Storage       : The storage policy of the tensors
+ * ==========================================================================================================
+ */
+template <typename dType, template <typename> class Storage>
+void recurrentUpdateWbaCpu( size_t                      samples      ,
+                            dType                       learning_rate,
+                            dType                       momentum     ,
+                            Tensor4<dType, Storage>&    gradients    ,
+                            Tensor4<dType, Storage>&    wba          ,
+                            Tensor4<dType, Storage>&    wba_deltas   ) {
+    frnnError error;
+    if ( gradients.size() != wba.size() || wba_deltas.size() != wba.size() ) {
+        frnn::err::dimError( error, stringify( gradients ), stringify( wba ) );
+        return;
+    }
+
+    const dType rate    = samples == 0 ? dType( 0 ) : learning_rate / static_cast<dType>( samples );
+    dType*      wba_h   = &wba.hostData()[ 0 ];
+    dType*      delta_h = &wba_deltas.hostData()[ 0 ];
+    dType*      grad_h  = &gradients.hostData()[ 0 ];
+
+    #pragma omp parallel for if ( wba.size() >= frnn::CPU_PARALLEL_MIN_ELEMENTS )
+    for ( size_t e = 0; e < wba.size(); e++ ) {
+        delta_h[ e ]  = momentum * delta_h[ e ] - rate * grad_h[ e ];
+        wba_h[ e ]   += delta_h[ e ];
+        grad_h[ e ]   = dType( 0 );
+    }
+}
+
+}   // Namespace frnn
+
+#endif
@@ -0,0 +1,318 @@
+/*
+ *  Header file for fastRNN recurrent layer GPU functions.
+ *
+ *  Copyright (C) 2015 Rob Clucas robclu1818@gmail.com
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published
+ *  by the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program; if not, write to the Free Software Foundation,
+ *  Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#ifndef _FRNN_RECURRENT_FUNCTIONS_GPU_
+#define _FRNN_RECURRENT_FUNCTIONS_GPU_
+
+#include <cuda_runtime.h>
+#include <cublas_v2.h>
+
+#include "../../tensor/tensor.cuh"
+#include "../../util/errors.h"
+#include "../../frnn/gpu_context.cuh"
+#include "../../frnn/profiler.cuh"
+#include "../../math/blas/frnn_blas.h"
+#include "../../math/math_gpu.hpp"
+#include "softmax_gpu_functions.cuh"
+#include "recurrent_kernels_gpu.cuh"
+
+namespace frnn {
+
+const size_t RNN_PERSISTENT_MAX_BATCH = 64;             // Max batch size for the persistent kernel
+
+/*
+ * ==========================================================================================================
+ * Function     : copyTensorGpu
+ *
+ * Description  : Copies all the data of a tensor into device memory, or the data in device memory into a
+ *                tensor, on stream. For tensors stored on the device the copy is device to device.
+ *
+ * Inputs       : error     : fastRNN error type for results of operations
+ *              : tensor    : The tensor to copy from (or to)
+ *              : buffer    : The device memory to copy to (or from), which holds all the elements
+ *              : stream    : The stream to copy on
+ *
+ * Params       : dType     : The type of data in the tensor
+ * ==========================================================================================================
+ */
+template <typename dType>
+void copyTensorGpu( frnnError& error, dType* buffer, const Tensor4<dType, storage::Host>& tensor, cudaStream_t stream ) {
+    if ( tensor.size() == 0 ) return;
+    if ( frnn::prof::memcpyAsync( buffer, &tensor.hostData()[ 0 ], tensor.size() * sizeof( dType ),
+                                  cudaMemcpyHostToDevice, stream ) != cudaSuccess ) {
+        frnn::err::copyError( error, stringify( tensor ) );
+    }
+}
+
+template <typename dType>
+void copyTensorGpu( frnnError& error, dType* buffer, const Tensor4<dType, storage::Device>& tensor, cudaStream_t stream ) {
+    if ( tensor.size() == 0 ) return;
+    if ( frnn::prof::memcpyAsync( buffer, tensor.deviceData(), tensor.size() * sizeof( dType ),
+                                  cudaMemcpyDeviceToDevice, stream ) != cudaSuccess ) {
+        frnn::err::copyError( error, stringify( tensor ) );
+    }
+}
+
+template <typename dType>
+void copyTensorGpu( frnnError& error, Tensor4<dType, storage::Host>& tensor, const dType* buffer, cudaStream_t stream ) {
+    if ( tensor.size() == 0 ) return;
+    if ( frnn::prof::memcpyAsync( &tensor.hostData()[ 0 ], buffer, tensor.size() * sizeof( dType ),
+                                  cudaMemcpyDeviceToHost, stream ) != cudaSuccess ) {
+        frnn::err::copyError( error, stringify( tensor ) );
+    }
+}
+
+template <typename dType>
+void copyTensorGpu( frnnError& error, Tensor4<dType, storage::Device>& tensor, const dType* buffer, cudaStream_t stream ) {
+    if ( tensor.size() == 0 ) return;
+    if ( frnn::prof::memcpyAsync( tensor.deviceData(), buffer, tensor.size() * sizeof( dType ),
+                                  cudaMemcpyDeviceToDevice, stream ) != cudaSuccess ) {
+        frnn::err::copyError( error, stringify( tensor ) );
+    }
+}
+
+/*
+ * ==========================================================================================================
+ * Function     : launchPersistentGpu
+ *
+ * Description  : Launches the persistent kernel for the recurrence of a forward pass (see NOTES 1 and 2 of
+ *                recurrent_kernels_gpu.cuh) on the primary stream of the context. The kernel syncs its whole
+ *                grid, so it is only launched cooperatively, and only when the occupancy of the kernel lets
+ *                all the blocks be resident at once.
+ *
+ * Inputs       : context       : The GPU context which provides the stream and the device attributes
+ *              : blocks        : The number of blocks of the grid
+ *              : shared        : The bytes of shared memory of each block
+ *              : The arguments of recurrentPersistentKernel
+ *
+ * Outputs      : If the kernel was launched, otherwise the caller does the recurrence another way
+ *
+ * Params       : Cell          : The recurrent cell
+ *              : dType         : The type of data of the layer
+ * ==========================================================================================================
+ */
+template <typename Cell, typename dType>
+bool launchPersistentGpu( GpuContext&  context   , size_t blocks, size_t       shared   , const dType* wba   ,
+                          uint         num_inputs, uint   nodes , uint         depth    , size_t       page_size,
+                          uint         batch_size, uint   steps , const dType* pre      , dType*       hidden,
+                          dType*       cells     ) {
+    void (*kernel)( const dType*, uint, uint, uint, size_t, uint, uint, const dType*, dType*, dType* ) =
+            recurrentPersistentKernel<Cell, dType>;
+    int resident = 0;
+
+    if ( !context.cooperativeLaunch() || blocks == 0 || shared > context.sharedMemoryPerBlock() ) return false;
+    if ( cudaOccupancyMaxActiveBlocksPerMultiprocessor( &resident, kernel, THREADS_PER_BLOCK, shared ) !=
+            cudaSuccess || static_cast<size_t>( resident ) * context.multiProcessors() < blocks ) {
+        return false;
+    }
+
+    void* args[] = { &wba, &num_inputs, &nodes, &depth, &page_size, &batch_size, &steps, &pre, &hidden, &cells };
+    FRNN_COUNT_LAUNCH();
+    if ( cudaLaunchCooperativeKernel( reinterpret_cast<void*>( kernel ), dim3( blocks ),
+                                      dim3( THREADS_PER_BLOCK ), args, shared, context.stream() ) != cudaSuccess ) {
+        cudaGetLastError();                                 // Clear the launch error for the fallback
+        return false;
+    }
+    return true;
+}
+
+/*
+ * ==========================================================================================================
+ * Function     : recurrentForwardGpu
+ *
+ * Description  : Forward pass of a recurrent layer for a batch of sequences on the GPU. The input part of
+ *                the pre-activations of all the timesteps is one gemm per page (see recurrentForwardCpu).
+ *                When the recurrent weights of a block of nodes fit in shared memory and the device can run
+ *                every block at once, the recurrence is done by a single cooperative launch of the persistent
+ *                kernel (see NOTES 1 and 2 of recurrent_kernels_gpu.cuh), otherwise each timestep is a gemm
+ *                per page followed by a launch of the cell kernel.
+ *
+ * Inputs       : context       : The GPU context which provides the cuBLAS handle and the scratch memory
+ *              : ins           : The inputs to the layer, (num_inputs x batch size x timesteps)
+ *              : wba           : The weights, biases and activations of the layer
+ *              : num_inputs    : The number of inputs to the layer
+ *              : state         : The recurrent state of the layer before the first timestep
+ *
+ * Outputs      : outs          : The outputs of the layer (nodes x batch size x timesteps)
+ *              : state         : The recurrent state of the layer after the last timestep
+ *
+ * Params       : Cell          : The recurrent cell (see frnn::cell)
+ *              : dType         : The type of data used for the computation
+ *              : Storage       : The storage policy of the wba tensor
+ *              : IoStorage     : The storage policy of the input and output tensors
+ * ==========================================================================================================
+ */
+template <typename Cell, typename dType, template <typename> class Storage, template <typename> class IoStorage>
+void recurrentForwardGpu( GpuContext&                                   context   ,
+                          const Tensor4<dType, IoStorage>&              ins       ,
+                          const Tensor4<dType, Storage>&                wba       ,
+                          uint                                          num_inputs,
+                          recurrent_state<dType, storage::Device>&      state     ,
+                          Tensor4<dType, IoStorage>&                    outs      ) {
+    frnnError       error;
+    cublasHandle_t  handle     = context.blasHandle();
+    cudaStream_t    stream     = context.stream();
+    const size_t    rows       = wba.x();
+    const size_t    nodes      = rows / Cell::gates;
+    const size_t    depth      = wba.z();
+    const size_t    batch_size = ins.y();
+    const size_t    steps      = ins.z();
+    const size_t    page_size  = wba.x() * wba.y();
+
+    if ( ins.x() != num_inputs || depth == 0 ) {
+        frnn::err::dimError( error, stringify( ins ), stringify( num_inputs ) );
+        return;
+    }
+    if ( outs.x() != nodes || outs.y() != batch_size || outs.z() != steps || outs.size() != nodes * batch_size * steps ) {
+        outs.reshape( nodes, batch_size, steps, 1 );
+    }
+    state.reset( nodes, num_inputs, batch_size, depth );
+    if ( batch_size == 0 || steps == 0 ) return;
+
+    // Scratch slots : 0 inputs, 1 input pre-activations, 2 outputs, 3 recurrent pre-activations, 4 sum of
+    // biases, 5 ones, 6 wba. The inputs and outputs of the state come first (see CPU version)
+    const size_t    in_step  = num_inputs * batch_size;
+    const size_t    out_step = nodes * batch_size;
+    dType*          xs_d     = context.scratch<dType>( error, 0, in_step * ( depth - 1 + steps ) );
+    dType*          pre_d    = context.scratch<dType>( error, 1, rows * batch_size * steps );
+    dType*          hs_d     = context.scratch<dType>( error, 2, out_step * ( depth + steps ) );
+    dType*          rec_d    = context.scratch<dType>( error, 3, rows * batch_size );
+    dType*          biases_d = context.scratch<dType>( error, 4, rows );
+    dType*          ones_d   = context.scratch<dType>( error, 5, batch_size * steps );
+    const dType*    wba_d    = deviceTensorGpu( error, context.scratch<dType>( error, 6, wba.size() ), wba, stream );
+    dType*          cells_d  = state.cells.deviceData();
+
+    if ( xs_d == 0 || pre_d == 0 || hs_d == 0 || rec_d == 0 || biases_d == 0 || ones_d == 0 || wba_d == 0 ||
+         cells_d == 0 ) return;
+
+    const Tensor4<dType, storage::Device>& inputs_c = state.inputs;
+    const Tensor4<dType, storage::Device>& hidden_c = state.hidden;
+    copyTensorGpu( error, xs_d, inputs_c, stream );
+    copyTensorGpu( error, xs_d + in_step * ( depth - 1 ), ins, stream );
+    copyTensorGpu( error, hs_d, hidden_c, stream );
+    FRNN_COUNT_LAUNCH();
+    fill<<<( batch_size * steps ) / THREADS_PER_BLOCK + 1, THREADS_PER_BLOCK, 0, stream>>>( ones_d, batch_size * steps, dType( 1 ) );
+
+    cublasSetPointerMode( handle, CUBLAS_POINTER_MODE_HOST );
+    dType alpha = 1; dType beta_zero = 0; dType beta_one = 1;
+
+    // Input part of the pre-activations : the sum of the biases for every sample of every timestep, then
+    // page d adds W_d times the inputs d timesteps back
+    sumVectorsGpu( error, context, wba_d + wba.index( 0, num_inputs + nodes, 0, 0 ), rows, depth, page_size, biases_d );
+    frnn::blas::functions<dType>::gemm(
+            handle, CUBLAS_OP_N, CUBLAS_OP_N, rows, batch_size * steps, 1, &alpha, biases_d, rows,
+            ones_d, 1          , &beta_zero , pre_d, rows                                              );
+    for ( size_t d = 0; d < depth; d++ ) {
+        frnn::blas::functions<dType>::gemm(
+                handle, CUBLAS_OP_N, CUBLAS_OP_N, rows, batch_size * steps, num_inputs, &alpha,
+                wba_d + d * page_size, rows, xs_d + in_step * ( depth - 1 - d ), num_inputs, &beta_one,
+                pre_d, rows                                                                             );
+    }
+
+    const size_t    blocks      = std::min( context.multiProcessors(), nodes );
+    const size_t    block_nodes = blocks == 0 ? 0 : ( nodes + blocks - 1 ) / blocks;
+    const size_t    shared      = depth * rows * block_nodes * sizeof( dType );
+
+    if ( batch_size > RNN_PERSISTENT_MAX_BATCH ||
+         !launchPersistentGpu<Cell>( context, blocks, shared, wba_d, num_inputs, nodes, depth, page_size,
+                                     batch_size, steps, pre_d, hs_d, cells_d ) ) {
+        const dType*    u_d         = wba_d + wba.index( 0, num_inputs, 0, 0 );
+        const size_t    cell_blocks = std::min( out_step / THREADS_PER_BLOCK + 1, static_cast<size_t>( MAX_BLOCKS ) );
+        for ( size_t t = 0; t < steps; t++ ) {
+            // Recurrent part, page d uses the outputs d + 1 timesteps back
+            for ( size_t d = 0; d < depth; d++ ) {
+                frnn::blas::functions<dType>::gemm(
+                        handle, CUBLAS_OP_N, CUBLAS_OP_N, rows, batch_size, nodes, &alpha,
+                        u_d + d * page_size, rows, hs_d + out_step * ( depth + t - 1 - d ), nodes,
+                        d == 0 ? &beta_zero : &beta_one, rec_d, rows                                    );
+            }
+            FRNN_COUNT_LAUNCH();
+            recurrentCellKernel<Cell><<<cell_blocks, THREADS_PER_BLOCK, 0, stream>>>(
+                    pre_d + rows * batch_size * t, rec_d, hs_d + out_step * ( depth + t - 1 ), nodes, batch_size,
+                    cells_d, hs_d + out_step * ( depth + t ) );
+        }
+    }
+
+    // The outputs of this pass, and the last depth timesteps are the state for the next pass
+    copyTensorGpu( error, state.hidden, hs_d + out_step * steps, stream );
+    copyTensorGpu( error, state.inputs, xs_d + in_step * steps , stream );
+    copyTensorGpu( error, outs        , hs_d + out_step * depth, stream );
+    cudaStreamSynchronize( stream );
+}
+
+/*
+ * ==========================================================================================================
+ * Function     : recurrentUpdateWbaGpu
+ *
+ * Description  : Updates the wba of a recurrent layer on the device with the gradients of the backward
+ *                passes since the last update (see recurrentUpdateWbaCpu), and sets the gradients to zero
+ *
+ * Inputs       : context       : The GPU context which provides the stream
+ *              : samples       : The number of samples the gradients are for (the gradient is averaged)
+ *              : learning_rate : The learning rate for the update
+ *              : momentum      : The fraction of the previous update to add to this update
+ *              : gradients     : The gradients of the wba
+ *              : scaler        : The loss scaler if the errors are scaled (the update is skipped, and the
+ *                                gradients are still set to zero, when a gradient is inf or nan), or 0
+ *
+ * Outputs      : wba           : The updated wba
+ *              : wba_deltas    : The updates of the wba (for the momentum of the next update)
+ *              : gradients     : Zeros
+ *
+ * Params       : dType         : The type of data used for the computation
+ * ==========================================================================================================
+ */
+template <typename dType>
+void recurrentUpdateWbaGpu( GpuContext&                             context      ,
+                            size_t                                  samples      ,
+                            dType                                   learning_rate,
+                            dType                                   momentum     ,
+                            Tensor4<dType, storage::Device>&        gradients    ,
+                            Tensor4<dType, storage::Device>&        wba          ,
+                            Tensor4<dType, storage::Device>&        wba_deltas   ,
+                            LossScaler*                             scaler = 0   ) {
+    typedef typename frnn::accumulate_type<dType>::type aType;
+    frnnError       error;
+    cudaStream_t    stream = context.stream();
+
+    if ( gradients.size() != wba.size() || wba_deltas.size() != wba.size() ) {
+        frnn::err::dimError( error, stringify( gradients ), stringify( wba ) );
+        return;
+    }
+    if ( wba.size() == 0 ) return;
+
+    const aType     rate    = samples == 0 ? aType( 0 ) : static_cast<aType>( learning_rate ) / static_cast<aType>( samples );
+    const size_t    blocks  = std::min( wba.size() / THREADS_PER_BLOCK + 1, static_cast<size_t>( MAX_BLOCKS ) );
+    dType*          grad_d  = gradients.deviceData();
+    aType           scale;
+
+    gradientHookGpu( error, context, grad_d, wba.size() );
+    if ( lossScaleGpu( error, context, grad_d, wba.size(), scaler, scale ) ) {
+        FRNN_COUNT_LAUNCH();
+        updateWeights<<<blocks, THREADS_PER_BLOCK, 0, stream>>>( wba.deviceData(), wba_deltas.deviceData(), grad_d,
+                                                                 wba.size(), rate, static_cast<aType>( momentum ), scale );
+    }
+    cudaMemsetAsync( grad_d, 0, gradients.size() * sizeof( dType ), stream );
+    cudaStreamSynchronize( stream );
+}
+
+}   // Namespace frnn
+
+#endif
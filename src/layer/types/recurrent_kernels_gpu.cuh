@@ -0,0 +1,174 @@
+/*
+ *  Header file for fastRNN recurrent layer GPU kernels.
+ *
+ *  Copyright (C) 2015 Rob Clucas robclu1818@gmail.com
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published
+ *  by the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program; if not, write to the Free Software Foundation,
+ *  Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#ifndef _FRNN_RECURRENT_KERNELS_GPU_
+#define _FRNN_RECURRENT_KERNELS_GPU_
+
+#include <cuda.h>
+#include <cuda_runtime.h>
+#include <cooperative_groups.h>
+
+#include "recurrent_cells.hpp"
+
+/* ============================================= NOTES ======================================================
+ *
+ * 1. The persistent kernel does all the timesteps of a forward pass in a single launch. Each block owns a
+ *    range of the nodes, and loads the rows of U (for all the gates and pages) for its nodes into shared
+ *    memory once, so the recurrent weights are read from global memory once per pass rather than once per
+ *    timestep. The shared memory layout is u[ ( ( d * gates + g ) * nodes + j ) * block_nodes + k ], the
+ *    weight of output j for gate g of the k'th node of the block for page d, so the threads of a warp (which
+ *    are for consecutive nodes) read consecutive words.
+ *
+ * 2. The outputs of a timestep are needed by every block for the next timestep, so the blocks wait for each
+ *    other with a grid sync (of cooperative groups) after each timestep. A grid sync needs all the blocks to
+ *    be resident at the same time, which is only guaranteed for a cooperative launch with a grid which fits
+ *    on the device (see launchPersistentGpu, which falls back to a gemm and a cell kernel per timestep when
+ *    it doesn't). The kernel is launched on the primary stream, which the other work of the context is
+ *    joined back to. The outputs are read through volatile pointers so that they are not cached in L1
+ *    between timesteps.
+ *
+ * ==========================================================================================================
+ */
+
+/*
+ * ==========================================================================================================
+ * Function     : recurrentPersistentKernel
+ *
+ * Description  : Does all the timesteps of the recurrence of a forward pass of a recurrent layer (see NOTES 1
+ *                and 2), given the input part of the pre-activations of every timestep. It must be launched
+ *                cooperatively, with a grid which is resident on the device at once.
+ *
+ * Inputs       : wba           : The weights, biases and activations of the layer
+ *              : num_inputs    : The number of inputs to the layer
+ *              : nodes         : The number of nodes of the layer
+ *              : depth         : The depth (number of pages) of the layer
+ *              : page_size     : The number of elements in a page of wba
+ *              : batch_size    : The number of samples in the batch
+ *              : steps         : The number of timesteps
+ *              : pre           : The input part of the pre-activations (gates * nodes x batch x steps)
+ *              : hidden        : The outputs of the depth timesteps before the pass, followed by space for
+ *                                the outputs of the pass (nodes x batch x depth + steps)
+ *              : cells         : The cell states of the timestep before the pass (nodes x batch)
+ *
+ * Outputs      : hidden        : The outputs of every timestep of the pass after those of the state
+ *              : cells         : The cell states after the last timestep
+ *
+ * Params       : Cell          : The recurrent cell
+ *              : dType         : The type of data of the layer
+ * ==========================================================================================================
+ */
+template <typename Cell, typename dType>
+__global__ void recurrentPersistentKernel( const dType* wba      , uint          num_inputs, uint   nodes,
+                                           uint         depth    , size_t        page_size , uint   batch_size,
+                                           uint         steps    , const dType*  pre       , dType* hidden,
+                                           dType*       cells    ) {
+    extern __shared__ unsigned char shared_bytes[];
+    dType*          u           = reinterpret_cast<dType*>( shared_bytes );
+    const uint      rows        = Cell::gates * nodes;
+    const uint      block_nodes = ( nodes + gridDim.x - 1 ) / gridDim.x;
+    const uint      first       = blockIdx.x * block_nodes;
+    const uint      my_nodes    = first < nodes ? min( block_nodes, nodes - first ) : 0;
+    const dType*    u_global    = wba + static_cast<size_t>( num_inputs ) * rows;
+
+    // Load the recurrent weights of the nodes of the block (see NOTES 1)
+    for ( size_t idx = threadIdx.x; idx < static_cast<size_t>( depth ) * rows * block_nodes; idx += blockDim.x ) {
+        const uint k  = idx % block_nodes;
+        const uint j  = ( idx / block_nodes ) % nodes;
+        const uint dg = idx / ( static_cast<size_t>( block_nodes ) * nodes );
+        const uint g  = dg % Cell::gates;
+        const uint d  = dg / Cell::gates;
+        u[ idx ] = k < my_nodes ? u_global[ d * page_size + static_cast<size_t>( j ) * rows + g * nodes + first + k ]
+                                : dType( 0 );
+    }
+    __syncthreads();
+
+    const volatile dType* h_all = hidden;
+    const size_t          step  = static_cast<size_t>( nodes ) * batch_size;
+
+    for ( uint t = 0; t < steps; t++ ) {
+        for ( uint w = threadIdx.x; w < my_nodes * batch_size; w += blockDim.x ) {
+            const uint  k      = w % my_nodes;
+            const uint  sample = w / my_nodes;
+            dType       in_g[ Cell::gates ], rec_g[ Cell::gates ];
+
+            for ( uint g = 0; g < Cell::gates; g++ ) {
+                in_g[ g ]  = pre[ ( static_cast<size_t>( t ) * batch_size + sample ) * rows + g * nodes + first + k ];
+                rec_g[ g ] = dType( 0 );
+            }
+            for ( uint d = 0; d < depth; d++ ) {
+                const volatile dType* h_d = h_all + ( depth + t - 1 - d ) * step + sample * nodes;
+                const dType*          u_d = u + static_cast<size_t>( d ) * rows * block_nodes + k;
+                for ( uint j = 0; j < nodes; j++ ) {
+                    const dType h_j = h_d[ j ];
+                    for ( uint g = 0; g < Cell::gates; g++ ) {
+                        rec_g[ g ] += u_d[ ( static_cast<size_t>( g ) * nodes + j ) * block_nodes ] * h_j;
+                    }
+                }
+            }
+
+            const size_t e = static_cast<size_t>( sample ) * nodes + first + k;
+            hidden[ ( depth + t ) * step + e ] = Cell::step( in_g, rec_g, h_all[ ( depth + t - 1 ) * step + e ],
+                                                             cells[ e ] );
+        }
+        cooperative_groups::this_grid().sync();
+    }
+}
+
+/*
+ * ==========================================================================================================
+ * Function     : recurrentCellKernel
+ *
+ * Description  : Does the cells of all the nodes of all the samples for one timestep, given the input and
+ *                recurrent parts of the pre-activations of the timestep
+ *
+ * Inputs       : pre           : The input part of the pre-activations of the timestep (gates * nodes x batch)
+ *              : rec           : The recurrent part of the pre-activations (gates * nodes x batch)
+ *              : h_prev        : The outputs of the previous timestep (nodes x batch)
+ *              : nodes         : The number of nodes of the layer
+ *              : batch_size    : The number of samples in the batch
+ *              : cells         : The cell states of the previous timestep (nodes x batch)
+ *
+ * Outputs      : h             : The outputs of the timestep (nodes x batch)
+ *              : cells         : The cell states of the timestep
+ *
+ * Params       : Cell          : The recurrent cell
+ *              : dType         : The type of data of the layer
+ * ==========================================================================================================
+ */
+template <typename Cell, typename dType>
+__global__ void recurrentCellKernel( const dType* pre       , const dType* rec  , const dType* h_prev, uint nodes,
+                                     uint         batch_size, dType*       cells, dType*       h     ) {
+    const uint rows = Cell::gates * nodes;
+
+    for ( size_t e = blockIdx.x * blockDim.x + threadIdx.x; e < static_cast<size_t>( nodes ) * batch_size;
+          e += blockDim.x * gridDim.x ) {
+        const size_t node   = e % nodes;
+        const size_t sample = e / nodes;
+        dType        in_g[ Cell::gates ], rec_g[ Cell::gates ];
+
+        for ( uint g = 0; g < Cell::gates; g++ ) {
+            in_g[ g ]  = pre[ sample * rows + g * nodes + node ];
+            rec_g[ g ] = rec[ sample * rows + g * nodes + node ];
+        }
+        h[ e ] = Cell::step( in_g, rec_g, h_prev[ e ], cells[ e ] );
+    }
+}
+
+#endif
@@ -0,0 +1,503 @@
+/*
+ *  Header file for fastRNN recurrent policy class.
+ *
+ *  Copyright (C) 2015 Rob Clucas robclu1818@gmail.com
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published
+ *  by the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program; if not, write to the Free Software Foundation,
+ *  Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#ifndef _FRNN_RECURRENT_POLICY_
+#define _FRNN_RECURRENT_POLICY_
+
+#include <algorithm>
+#include <vector>
+
+#include "../../tensor/tensor.cuh"
+#include "../../frnn/frnn.h"
+#include "../../frnn/gpu_context.cuh"
+#include "recurrent_cells.hpp"
+#include "recurrent_cpu_functions.hpp"
+#ifdef FRNN_WITH_CUDA
+#include "recurrent_gpu_functions.cuh"
+#endif
+
+namespace frnn {
+namespace ltype {
+
+/*
+ * ==========================================================================================================
+ * Class        : RecurrentPolicy
+ *
+ * Desription   : Policy class for a recurrent layer (vanilla RNN, LSTM or GRU), which defines the forward
+ *                propogation of sequences through the layer. The wba and depth are the same as for the other
+ *                layer types, except that each page has a row for each gate of each node and the columns of
+ *                the weights of the inputs are followed by the columns of the weights of the outputs (see
+ *                NOTES 1 of recurrent_cells.hpp).
+ *
+ * Params       : Cell      : The recurrent cell (see frnn::cell)
+ *              : dType     : The type of data for the network
+ *              : device    : The device type to use (CPU or GPU)
+ *              : nodes     : The number of nodes for the layer
+ *              : inputs    : The number of inputs to the layer
+ *              : depth     : The number of timesteps back which have inputs to the layer
+ * ==========================================================================================================
+ */
+template <typename          Cell,
+          typename          dType,
+          frnn::device      dev,
+          uint              nodes,
+          uint              inputs,
+          uint              depth>
+class RecurrentPolicy;
+
+/* ============================================== GPU Definitions ========================================  */
+#ifdef FRNN_WITH_CUDA
+
+template <typename          Cell,
+          typename          dType,
+          uint              nodes,
+          uint              inputs,
+          uint              depth>
+class RecurrentPolicy<Cell, dType, frnn::device::GPU, nodes, inputs, depth> {
+
+    public:
+        typedef recurrent_state<dType, storage::Device> state_type;    // Recurrent state (and checkpoints)
+
+        /*
+         * ==================================================================================================
+         * Function     : RecurrentPolicy
+         *
+         * Description  : Constructor for the RecurrentPolicy. Sets the tensor (wba) which holds the weights,
+         *                biases, and activations of every gate, and the number of inputs for the layer.
+         *
+         * Inputs       : gpu_context   : The GPU context which owns the handles and device memory used by the
+         *                                GPU functions of the layer (it must outlive the layer)
+         * ==================================================================================================
+         */
+        explicit RecurrentPolicy(GpuContext& gpu_context = GpuContext::global()) :
+            wba(Cell::gates * nodes, inputs + nodes + 2, depth, 1), num_inputs(inputs), errors(nodes, 1, 1, 1),
+            wba_prev(Cell::gates * nodes, inputs + nodes + 2, depth, 1),
+            wba_deltas(Cell::gates * nodes, inputs + nodes + 2, depth, 1),
+            wba_gradients(Cell::gates * nodes, inputs + nodes + 2, depth, 1), gradient_samples(0),
+            context(&gpu_context) {}
+
+        /*
+         * ==================================================================================================
+         * Function     : forward
+         *
+         * Description  : Forward propogates the inputs of one timestep of a single sequence through the layer,
+         *                using (and updating) the recurrent state of the layer.
+         *
+         * Inputs       : ins   : The inputs to the layer for the timestep
+         *
+         * Outputs      : outs  : The outputs of the layer for the timestep
+         * ==================================================================================================
+         */
+        void forward(std::vector<dType>& ins, std::vector<dType>& outs);
+
+        /*
+         * ==================================================================================================
+         * Function     : forward (sequences)
+         *
+         * Description  : Forward propogates a batch of sequences through the layer, carrying on from the
+         *                recurrent state of the layer (see NOTES 2 of recurrent_cells.hpp).
+         *
+         * Inputs       : ins   : The inputs to the layer (inputs x batch size x timesteps)
+         *
+         * Outputs      : outs  : The outputs of the layer (nodes x batch size x timesteps)
+         *
+         * Params       : Storage   : The storage policy of the input and output tensors
+         * ==================================================================================================
+         */
+        template <template <typename> class Storage>
+        void forward(const Tensor4<dType, Storage>& ins, Tensor4<dType, Storage>& outs);
+
+        /*
+         * ==================================================================================================
+         * Function     : resetState
+         *
+         * Description  : Sets the recurrent state of the layer to zeros, so that the next forward pass is the
+         *                start of new sequences.
+         * ==================================================================================================
+         */
+        void resetState() { state.reset(nodes, num_inputs, std::max(state.hidden.y(), 1u), depth, true); }
+
+        /*
+         * ==================================================================================================
+         * Function     : weightsPerPage
+         *
+         * Description  : Gets the number of weights (the W and U columns) at the start of each page of wba
+         * ==================================================================================================
+         */
+        static size_t weightsPerPage() { return Cell::gates * nodes * (inputs + nodes); }
+
+        /*
+         * ==================================================================================================
+         * Function     : recurrentState
+         *
+         * Description  : Gets the recurrent state of the layer, so that it can be kept (as a checkpoint) and
+         *                set again with setRecurrentState
+         * ==================================================================================================
+         */
+        const state_type& recurrentState() const { return state; }
+
+        void setRecurrentState(const state_type& new_state) { state = new_state; }
+
+        /*
+         * ==================================================================================================
+         * Function     : forward (traced)
+         *
+         * Description  : Forward propogates a batch of sequences through the layer (as the sequence forward)
+         *                and keeps what the backward pass needs in a trace. The traced forward is done on
+         *                the CPU, since the trace is used by the CPU backward pass.
+         *
+         * Inputs       : ins   : The inputs to the layer (inputs x batch size x timesteps)
+         *
+         * Outputs      : outs  : The outputs of the layer (nodes x batch size x timesteps)
+         *              : trace : The trace of the forward pass
+         *
+         * Params       : Storage   : The storage policy of the input and output tensors
+         * ==================================================================================================
+         */
+        template <template <typename> class Storage>
+        void forward(const Tensor4<dType, Storage>& ins, Tensor4<dType, Storage>& outs, recurrent_trace<dType>& trace);
+
+        /*
+         * ==================================================================================================
+         * Function     : backward
+         *
+         * Description  : Backward propogates the errors of the timesteps of a traced forward pass, adding to
+         *                the gradients of the wba (see recurrentBackwardCpu)
+         *
+         * Inputs       : trace     : The trace of the forward pass
+         *              : errors    : The gradients of the outputs (nodes x batch size x timesteps)
+         *              : carry     : The gradients carried from the timesteps after the pass
+         *
+         * Outputs      : carry     : The gradients to carry to the timesteps before the pass
+         *              : in_errors : The gradients of the inputs (inputs x batch size x timesteps)
+         *
+         * Params       : Storage   : The storage policy of the error tensors
+         * ==================================================================================================
+         */
+        template <template <typename> class Storage>
+        void backward(const recurrent_trace<dType>& trace, const Tensor4<dType, Storage>& errors,
+                      recurrent_carry<dType>& carry, Tensor4<dType, Storage>& in_errors);
+
+        /*
+         * ==================================================================================================
+         * Function     : updateWba
+         *
+         * Description  : Updates the wba with the average (over the samples of the batch) of the gradients
+         *                since the last update, using gradient descent with momentum
+         *
+         * Inputs       : learning_rate     : The learning rate for the update
+         *              : momentum          : The fraction of the previous update to add to this update
+         * ==================================================================================================
+         */
+        void updateWba(dType learning_rate = dType(0.01), dType momentum = dType(0));
+
+        /*
+         * ==================================================================================================
+         * Function     : getWbaGradients
+         *
+         * Description  : Gets the gradients of the wba since the last update
+         * ==================================================================================================
+         */
+        const Tensor4<dType, storage::Device>& getWbaGradients() const { return wba_gradients; }
+
+    public:
+        typedef Tensor4<dType, storage::Device> wba_type;
+        typedef Tensor4<dType, storage::Device> errors_type;
+
+    protected:
+        wba_type                                wba;             // Tensor for weights, biases, and activations
+        wba_type                                wba_prev;        // Tensor for weights, biases, and activations from the previous timestep
+        wba_type                                wba_deltas;      // Updates of the wba from the last update (for momentum)
+        errors_type                             errors;          // Errors for the layer (one column per sample)
+        uint                                    num_inputs;      // Number of inputs for the layer
+        wba_type                                wba_gradients;   // Gradients of the wba since the last update
+        size_t                                  gradient_samples;// Samples of the gradients (the batch size)
+        state_type                              state;           // Recurrent state between forward passes
+        GpuContext*                             context;         // GPU context for the GPU functions
+};
+#endif
+
+/* =============================================== CPU Definitions ======================================== */
+
+template <typename          Cell,
+          typename          dType,
+          uint              nodes,
+          uint              inputs,
+          uint              depth>
+class RecurrentPolicy<Cell, dType, frnn::device::CPU, nodes, inputs, depth> {
+
+    public:
+        typedef recurrent_state<dType, storage::Host> state_type;    // Recurrent state (and checkpoints)
+
+        /*
+         * ==================================================================================================
+         * Function     : RecurrentPolicy
+         *
+         * Description  : Constructor for the RecurrentPolicy. Sets the tensor (wba) which holds the weights,
+         *                biases, and activations of every gate, and the number of inputs for the layer.
+         *
+         * Inputs       : gpu_context   : The GPU context of the layer, which the CPU functions don't use (it is
+         *                                kept so that the CPU and GPU layers are created the same way)
+         * ==================================================================================================
+         */
+        explicit RecurrentPolicy(GpuContext& gpu_context = GpuContext::global()) :
+            wba(Cell::gates * nodes, inputs + nodes + 2, depth, 1), num_inputs(inputs), errors(nodes, 1, 1, 1),
+            wba_prev(Cell::gates * nodes, inputs + nodes + 2, depth, 1),
+            wba_deltas(Cell::gates * nodes, inputs + nodes + 2, depth, 1),
+            wba_gradients(Cell::gates * nodes, inputs + nodes + 2, depth, 1), gradient_samples(0),
+            context(&gpu_context) {}
+
+        /*
+         * ==================================================================================================
+         * Function     : forward
+         *
+         * Description  : Forward propogates the inputs of one timestep of a single sequence through the layer,
+         *                using (and updating) the recurrent state of the layer.
+         *
+         * Inputs       : ins   : The inputs to the layer for the timestep
+         *
+         * Outputs      : outs  : The outputs of the layer for the timestep
+         * ==================================================================================================
+         */
+        void forward(std::vector<dType>& ins, std::vector<dType>& outs);
+
+        /*
+         * ==================================================================================================
+         * Function     : forward (sequences)
+         *
+         * Description  : Forward propogates a batch of sequences through the layer, carrying on from the
+         *                recurrent state of the layer (see NOTES 2 of recurrent_cells.hpp).
+         *
+         * Inputs       : ins   : The inputs to the layer (inputs x batch size x timesteps)
+         *
+         * Outputs      : outs  : The outputs of the layer (nodes x batch size x timesteps)
+         *
+         * Params       : Storage   : The storage policy of the input and output tensors
+         * ==================================================================================================
+         */
+        template <template <typename> class Storage>
+        void forward(const Tensor4<dType, Storage>& ins, Tensor4<dType, Storage>& outs);
+
+        /*
+         * ==================================================================================================
+         * Function     : resetState
+         *
+         * Description  : Sets the recurrent state of the layer to zeros, so that the next forward pass is the
+         *                start of new sequences.
+         * ==================================================================================================
+         */
+        void resetState() { state.reset(nodes, num_inputs, std::max(state.hidden.y(), 1u), depth, true); }
+
+        /*
+         * ==================================================================================================
+         * Function     : weightsPerPage
+         *
+         * Description  : Gets the number of weights (the W and U columns) at the start of each page of wba
+         * ==================================================================================================
+         */
+        static size_t weightsPerPage() { return Cell::gates * nodes * (inputs + nodes); }
+
+        /*
+         * ==================================================================================================
+         * Function     : recurrentState
+         *
+         * Description  : Gets the recurrent state of the layer, so that it can be kept (as a checkpoint) and
+         *                set again with setRecurrentState
+         * ==================================================================================================
+         */
+        const state_type& recurrentState() const { return state; }
+
+        void setRecurrentState(const state_type& new_state) { state = new_state; }
+
+        /*
+         * ==================================================================================================
+         * Function     : forward (traced)
+         *
+         * Description  : Forward propogates a batch of sequences through the layer (as the sequence forward)
+         *                and keeps what the backward pass needs in a trace. The traced forward is done on
+         *                the CPU, since the trace is used by the CPU backward pass.
+         *
+         * Inputs       : ins   : The inputs to the layer (inputs x batch size x timesteps)
+         *
+         * Outputs      : outs  : The outputs of the layer (nodes x batch size x timesteps)
+         *              : trace : The trace of the forward pass
+         *
+         * Params       : Storage   : The storage policy of the input and output tensors
+         * ==================================================================================================
+         */
+        template <template <typename> class Storage>
+        void forward(const Tensor4<dType, Storage>& ins, Tensor4<dType, Storage>& outs, recurrent_trace<dType>& trace);
+
+        /*
+         * ==================================================================================================
+         * Function     : backward
+         *
+         * Description  : Backward propogates the errors of the timesteps of a traced forward pass, adding to
+         *                the gradients of the wba (see recurrentBackwardCpu)
+         *
+         * Inputs       : trace     : The trace of the forward pass
+         *              : errors    : The gradients of the outputs (nodes x batch size x timesteps)
+         *              : carry     : The gradients carried from the timesteps after the pass
+         *
+         * Outputs      : carry     : The gradients to carry to the timesteps before the pass
+         *              : in_errors : The gradients of the inputs (inputs x batch size x timesteps)
+         *
+         * Params       : Storage   : The storage policy of the error tensors
+         * ==================================================================================================
+         */
+        template <template <typename> class Storage>
+        void backward(const recurrent_trace<dType>& trace, const Tensor4<dType, Storage>& errors,
+                      recurrent_carry<dType>& carry, Tensor4<dType, Storage>& in_errors);
+
+        /*
+         * ==================================================================================================
+         * Function     : updateWba
+         *
+         * Description  : Updates the wba with the average (over the samples of the batch) of the gradients
+         *                since the last update, using gradient descent with momentum
+         *
+         * Inputs       : learning_rate     : The learning rate for the update
+         *              : momentum          : The fraction of the previous update to add to this update
+         * ==================================================================================================
+         */
+        void updateWba(dType learning_rate = dType(0.01), dType momentum = dType(0));
+
+        /*
+         * ==================================================================================================
+         * Function     : getWbaGradients
+         *
+         * Description  : Gets the gradients of the wba since the last update
+         * ==================================================================================================
+         */
+        const Tensor4<dType>& getWbaGradients() const { return wba_gradients; }
+
+    public:
+        typedef Tensor4<dType> wba_type;
+        typedef Tensor4<dType> errors_type;
+
+    protected:
+        wba_type                                wba;             // Tensor for weights, biases, and activations
+        wba_type                                wba_prev;        // Tensor for weights, biases, and activations from the previous timestep
+        wba_type                                wba_deltas;      // Updates of the wba from the last update (for momentum)
+        errors_type                             errors;          // Errors for the layer (one column per sample)
+        uint                                    num_inputs;      // Number of inputs for the layer
+        wba_type                                wba_gradients;   // Gradients of the wba since the last update
+        size_t                                  gradient_samples;// Samples of the gradients (the batch size)
+        state_type                              state;           // Recurrent state between forward passes
+        GpuContext*                             context;         // GPU context (unused by the CPU functions)
+};
+
+/* ============================================== Typedefs ================================================ */
+
+// Recurrent policies for each cell, which have the same parameters as the other layer types
+template <typename dType, frnn::device dev, uint nodes, uint inputs, uint depth>
+using RnnPolicy  = RecurrentPolicy<frnn::cell::rnn , dType, dev, nodes, inputs, depth>;
+
+template <typename dType, frnn::device dev, uint nodes, uint inputs, uint depth>
+using LstmPolicy = RecurrentPolicy<frnn::cell::lstm, dType, dev, nodes, inputs, depth>;
+
+template <typename dType, frnn::device dev, uint nodes, uint inputs, uint depth>
+using GruPolicy  = RecurrentPolicy<frnn::cell::gru , dType, dev, nodes, inputs, depth>;
+
+/* ======================================= GPU IMPLEMENTATIONS ============================================ */
+#ifdef FRNN_WITH_CUDA
+
+template <typename Cell, typename dType, uint nds, uint ipts, uint dth>
+void RecurrentPolicy<Cell, dType, device::GPU, nds, ipts, dth>::forward(
+        std::vector<dType>& ins, std::vector<dType>& outs) {
+    // A single sample, so the state is for a batch of 1
+    Tensor4<dType> ins_t(ipts, 1, 1, 1), outs_t(nds, 1, 1, 1);
+    std::copy(ins.begin(), ins.begin() + std::min(ins.size(), static_cast<size_t>(ipts)), ins_t.getData().begin());
+    recurrentForwardGpu<Cell>(*context, ins_t, wba, num_inputs, state, outs_t);
+    outs.assign(outs_t.getData().begin(), outs_t.getData().end());
+}
+
+template <typename Cell, typename dType, uint nds, uint ipts, uint dth>
+template <template <typename> class Storage>
+void RecurrentPolicy<Cell, dType, device::GPU, nds, ipts, dth>::forward(
+        const Tensor4<dType, Storage>& ins, Tensor4<dType, Storage>& outs) {
+    const wba_type& wba_c = wba;
+    recurrentForwardGpu<Cell>(*context, ins, wba_c, num_inputs, state, outs);
+}
+
+template <typename Cell, typename dType, uint nds, uint ipts, uint dth>
+template <template <typename> class Storage>
+void RecurrentPolicy<Cell, dType, device::GPU, nds, ipts, dth>::forward(
+        const Tensor4<dType, Storage>& ins, Tensor4<dType, Storage>& outs, recurrent_trace<dType>& trace) {
+    const wba_type& wba_c = wba;
+    recurrentForwardCpu<Cell>(ins, wba_c, num_inputs, state, outs, &trace);
+}
+
+template <typename Cell, typename dType, uint nds, uint ipts, uint dth>
+template <template <typename> class Storage>
+void RecurrentPolicy<Cell, dType, device::GPU, nds, ipts, dth>::backward(const recurrent_trace<dType>& trace,
+        const Tensor4<dType, Storage>& errors, recurrent_carry<dType>& carry, Tensor4<dType, Storage>& in_errors) {
+    const wba_type& wba_c = wba;
+    recurrentBackwardCpu<Cell>(wba_c, num_inputs, trace, errors, carry, wba_gradients, in_errors);
+    gradient_samples = errors.y();
+}
+
+template <typename Cell, typename dType, uint nds, uint ipts, uint dth>
+void RecurrentPolicy<Cell, dType, device::GPU, nds, ipts, dth>::updateWba(dType learning_rate, dType momentum) {
+    recurrentUpdateWbaGpu(*context, gradient_samples, learning_rate, momentum, wba_gradients, wba, wba_deltas);
+}
+#endif
+
+/* ======================================= CPU IMPLEMENTATIONS  =========================================== */
+
+template <typename Cell, typename dType, uint nds, uint ipts, uint dth>
+void RecurrentPolicy<Cell, dType, device::CPU, nds, ipts, dth>::forward(
+        std::vector<dType>& ins, std::vector<dType>& outs) {
+    Tensor4<dType> ins_t(ipts, 1, 1, 1), outs_t(nds, 1, 1, 1);
+    std::copy(ins.begin(), ins.begin() + std::min(ins.size(), static_cast<size_t>(ipts)), ins_t.getData().begin());
+    recurrentForwardCpu<Cell>(ins_t, wba, num_inputs, state, outs_t);
+    outs.assign(outs_t.getData().begin(), outs_t.getData().end());
+}
+
+template <typename Cell, typename dType, uint nds, uint ipts, uint dth>
+template <template <typename> class Storage>
+void RecurrentPolicy<Cell, dType, device::CPU, nds, ipts, dth>::forward(
+        const Tensor4<dType, Storage>& ins, Tensor4<dType, Storage>& outs) {
+    recurrentForwardCpu<Cell>(ins, wba, num_inputs, state, outs);
+}
+
+template <typename Cell, typename dType, uint nds, uint ipts, uint dth>
+template <template <typename> class Storage>
+void RecurrentPolicy<Cell, dType, device::CPU, nds, ipts, dth>::forward(
+        const Tensor4<dType, Storage>& ins, Tensor4<dType, Storage>& outs, recurrent_trace<dType>& trace) {
+    recurrentForwardCpu<Cell>(ins, wba, num_inputs, state, outs, &trace);
+}
+
+template <typename Cell, typename dType, uint nds, uint ipts, uint dth>
+template <template <typename> class Storage>
+void RecurrentPolicy<Cell, dType, device::CPU, nds, ipts, dth>::backward(const recurrent_trace<dType>& trace,
+        const Tensor4<dType, Storage>& errors, recurrent_carry<dType>& carry, Tensor4<dType, Storage>& in_errors) {
+    recurrentBackwardCpu<Cell>(wba, num_inputs, trace, errors, carry, wba_gradients, in_errors);
+    gradient_samples = errors.y();
+}
+
+template <typename Cell, typename dType, uint nds, uint ipts, uint dth>
+void RecurrentPolicy<Cell, dType, device::CPU, nds, ipts, dth>::updateWba(dType learning_rate, dType momentum) {
+    recurrentUpdateWbaCpu(gradient_samples, learning_rate, momentum, wba_gradients, wba, wba_deltas);
+}
+
+}   // Namepsace ltype
+}   // Namepsace frnn
+#endif
@@ -21,26 +21,472 @@
 #ifndef _FRNN_SOFTMAX_KERNELS_CPU_
 #define _FRNN_SOFTMAX_KERNELS_CPU_
 
+#include <vector>
+
 #include "../../frnn/types.h"
 #include "../../util/errors.h"
+#include "../../tensor/tensor.cuh"
 #include "../../math/math.hpp"
+#include "wba_planes.hpp"
+#include "quantized_wba.hpp"
+#include "sparse_wba.hpp"
 
 namespace frnn {
     
-template <typename dType>
-void softmaxBackwardCpu( std::vector<dType>& outs, std::vector<dType>& targets, std::vector<dType>& errors ) {
+template <typename dType, typename OutAlloc, typename TargetAlloc, typename ErrAlloc>
+void softmaxBackwardCpu( std::vector<dType, OutAlloc>&    outs   , 
+                         std::vector<dType, TargetAlloc>& targets, 
+                         std::vector<dType, ErrAlloc>&    errors ) {
   
     frnnError error; 
-    // Check dimensions
+    // Check dimensions, the errors have one element for each output (which
+    // is a batch of outputs for batched backprop)
     if ( outs.size() != targets.size() ) {
         frnn::err::dimError( error, stringify( outs ), stringify( targets ) );
-    } else if ( outs.size() != errors.size() ) { 
-        frnn::err::dimError( error, stringify( outs ), stringify( errors ) );
+        return;
     }
+    if ( outs.size() != errors.size() ) errors.resize( outs.size(), 0 );
     
     // Call CPU X minus Y kernel because these vectors will never be big 
     // enough to warrant the data transfer between the CPU and the GPU
-    frnn::math<dType, device::CPU>::xmy( outs, targets, errors );
+    // (the errors are usually the aligned host data of a tensor, so xmyCpu is used for any allocator)
+    xmyCpu( outs, targets, errors );
+}
+
+/*
+ * ==========================================================================================================
+ * Function     : softmaxForwardPagesCpu
+ *
+ * Description  : Computes softmax( sum over pages ( W*X + b ) ) for each column of X on the CPU, for weights
+ *                and biases with any leading dimension and page strides. The logits of each sample start as
+ *                the sum of the biases of the pages, then a gemm for each page adds W_p * X, and the softmax
+ *                of each column is done with the vectorized CPU kernels.
+ *
+ * Inputs       : ins_h         : The inputs (num_inputs x batch size), one sample per column
+ *              : weights_h     : The weights of the first page (nodes x num_inputs, with leading dimension ld)
+ *              : ld            : The leading dimension of the weights
+ *              : weight_stride : The number of elements between the weights of consecutive pages
+ *              : biases_h      : The biases of the first page
+ *              : bias_stride   : The number of elements between the biases of consecutive pages
+ *              : nodes         : The number of nodes of the layer
+ *              : pages         : The number of pages
+ *              : num_inputs    : The number of inputs to the layer
+ *              : batch_size    : The number of samples
+ *
+ * Outputs      : outs_h        : The outputs (nodes x batch size), one sample per column
+ *
+ * Params       : dType         : The type of data used for the computation
+ * ==========================================================================================================
+ */
+template <typename dType>
+void softmaxForwardPagesCpu( const dType* ins_h      , const dType* weights_h  , size_t ld        , 
+                             size_t       weight_stride, const dType* biases_h , size_t bias_stride,
+                             size_t       nodes      , size_t       pages      , size_t num_inputs , 
+                             size_t       batch_size , dType*       outs_h     ) {
+    frnnError           error;
+    std::vector<dType>  biases( nodes, 0 );
+
+    // Sum of the biases of the pages, which each sample starts with
+    sumVectorsCpu( error, biases_h, nodes, pages, bias_stride, &biases[ 0 ] );
+    for ( size_t b = 0; b < batch_size; b++ ) std::copy( biases.begin(), biases.end(), outs_h + b * nodes );
+
+    // W_p * X for each page, added to the logits
+    for ( size_t page = 0; page < pages; page++ ) {
+        frnn::math<dType, device::CPU>::gemm( 
+                blas::cpu::OP_N, blas::cpu::OP_N, nodes, batch_size, num_inputs, dType( 1 ), 
+                weights_h + page * weight_stride, ld, ins_h, num_inputs, dType( 1 ), outs_h, nodes );
+    }
+
+    // Softmax of each sample (column)
+    #pragma omp parallel for if ( nodes * batch_size >= frnn::CPU_PARALLEL_MIN_ELEMENTS )
+    for ( size_t b = 0; b < batch_size; b++ ) softmaxArrayCpu( outs_h + b * nodes, outs_h + b * nodes, nodes );
+}
+
+/*
+ * ==========================================================================================================
+ * Function     : softmaxForwardBatchedCpu
+ *
+ * Description  : Forward pass for a softmax layer for a batch of inputs on the CPU, which computes
+ *                softmax( sum over pages ( W*X + b ) ) for each column of X (see softmaxForwardPagesCpu).
+ *                The overloads are for the packed wba, the wba planes, the quantized wba and the sparse wba.
+ *
+ * Inputs       : ins           : The inputs to the layer, (num_inputs x batch size), one sample per column
+ *              : wba           : The weights, biases and activations of the layer (packed or planes)
+ *              : num_inputs    : The number of inputs to the layer
+ *
+ * Outputs      : outs          : The outputs of the layer (nodes x batch size), one sample per column
+ *
+ * Params       : dType         : The type of data used for the computation
+ *              : Storage       : The storage policy of the wba tensor(s)
+ *              : IoStorage     : The storage policy of the input and output tensors
+ * ==========================================================================================================
+ */
+template <typename dType, template <typename> class Storage, template <typename> class IoStorage>
+void softmaxForwardBatchedCpu( const Tensor4<dType, IoStorage>& ins       ,
+                               const Tensor4<dType, Storage>&   wba       ,
+                               uint                             num_inputs,
+                               Tensor4<dType, IoStorage>&       outs      ) {
+    frnnError       error;
+    const size_t    nodes      = wba.x();
+    const size_t    batch_size = ins.y();
+    const size_t    page_size  = wba.x() * wba.y();
+
+    if ( ins.x() != num_inputs ) {
+        frnn::err::dimError( error, stringify( ins ), stringify( num_inputs ) );
+        return;
+    }
+    if ( outs.x() != nodes || outs.y() != batch_size || outs.size() != nodes * batch_size ) {
+        outs.reshape( nodes, batch_size, 1, 1 );
+    }
+    if ( batch_size == 0 ) return;
+
+    // The bias columns are a page apart
+    const dType* wba_h = &wba.hostData()[ 0 ];
+    softmaxForwardPagesCpu( &ins.hostData()[ 0 ], wba_h, nodes, page_size, wba_h + wba.index( 0, num_inputs, 0, 0 ), 
+                            page_size, nodes, wba.z(), num_inputs, batch_size, &outs.hostData()[ 0 ] );
+}
+
+template <typename dType, template <typename> class Storage, template <typename> class IoStorage>
+void softmaxForwardBatchedCpu( const Tensor4<dType, IoStorage>&     ins       ,
+                               const wba_planes<dType, Storage>&    planes    ,
+                               uint                                 num_inputs,
+                               Tensor4<dType, IoStorage>&           outs      ) {
+    frnnError       error;
+    const size_t    nodes      = planes.nodes;
+    const size_t    batch_size = ins.y();
+    const size_t    ld         = planes.leadingDimension();
+
+    if ( ins.x() != num_inputs || planes.numInputs() != num_inputs ) {
+        frnn::err::dimError( error, stringify( ins ), stringify( num_inputs ) );
+        return;
+    }
+    if ( outs.x() != nodes || outs.y() != batch_size || outs.size() != nodes * batch_size ) {
+        outs.reshape( nodes, batch_size, 1, 1 );
+    }
+    if ( batch_size == 0 ) return;
+
+    softmaxForwardPagesCpu( &ins.hostData()[ 0 ], &planes.weights.hostData()[ 0 ], ld, ld * num_inputs, 
+                            &planes.biases.hostData()[ 0 ], ld, nodes, planes.depth(), num_inputs, batch_size, 
+                            &outs.hostData()[ 0 ] );
+}
+
+/*
+ * ==========================================================================================================
+ * Function     : softmaxForwardBatchedCpu (quantized)
+ *
+ * Description  : Forward pass for a softmax layer with int8 weights (see quantized_wba.hpp). Each sample is
+ *                quantized with its own scale, and the logit of each node is the sum over the pages of the 
+ *                int8 dot product of the sample and the row of the node, times the scales of the row and 
+ *                the sample, plus the bias. So the products are only dequantized at the input to the
+ *                softmax.
+ *
+ * Inputs       : ins           : The inputs to the layer, (num_inputs x batch size), one sample per column
+ *              : quantized     : The quantized weights and the biases of the layer
+ *              : num_inputs    : The number of inputs to the layer
+ *
+ * Outputs      : outs          : The outputs of the layer (nodes x batch size), one sample per column
+ *
+ * Params       : dType         : The type of data used for the computation
+ *              : IoStorage     : The storage policy of the input and output tensors
+ * ==========================================================================================================
+ */
+template <typename dType, template <typename> class IoStorage>
+void softmaxForwardBatchedCpu( const Tensor4<dType, IoStorage>&     ins       ,
+                               const quantized_wba<dType>&          quantized ,
+                               uint                                 num_inputs,
+                               Tensor4<dType, IoStorage>&           outs      ) {
+    frnnError       error;
+    const size_t    nodes      = quantized.nodes;
+    const size_t    batch_size = ins.y();
+    const size_t    stride     = quantized.row_stride;
+
+    if ( ins.x() != num_inputs || quantized.inputs != num_inputs ) {
+        frnn::err::dimError( error, stringify( ins ), stringify( num_inputs ) );
+        return;
+    }
+    if ( outs.x() != nodes || outs.y() != batch_size || outs.size() != nodes * batch_size ) {
+        outs.reshape( nodes, batch_size, 1, 1 );
+    }
+    if ( batch_size == 0 ) return;
+
+    // The padding of each quantized sample is 0, like the padding of the rows
+    const dType*            ins_h  = &ins.hostData()[ 0 ];
+    dType*                  outs_h = &outs.hostData()[ 0 ];
+    aligned_vector<int8_t>  samples( stride * batch_size, 0 );
+    std::vector<dType>      sample_scales( batch_size );
+
+    #pragma omp parallel for if ( nodes * batch_size >= frnn::CPU_PARALLEL_MIN_ELEMENTS )
+    for ( size_t b = 0; b < batch_size; b++ ) {
+        const int8_t* x = &samples[ 0 ] + b * stride;
+        sample_scales[ b ] = quantizeCpu( ins_h + b * num_inputs, num_inputs, &samples[ 0 ] + b * stride );
+
+        for ( size_t node = 0; node < nodes; node++ ) {
+            dType logit = quantized.biases[ node ];
+            for ( size_t page = 0; page < quantized.depth; page++ ) {
+                logit += quantized.scale( node, page ) * sample_scales[ b ] * 
+                         static_cast<dType>( dotInt8Cpu( quantized.row( node, page ), x, stride ) );
+            }
+            outs_h[ b * nodes + node ] = logit;
+        }
+        softmaxArrayCpu( outs_h + b * nodes, outs_h + b * nodes, nodes );
+    }
+}
+
+/*
+ * ==========================================================================================================
+ * Function     : softmaxForwardBatchedCpu (sparse)
+ *
+ * Description  : Forward pass for a softmax layer with sparse weights (see sparse_wba.hpp). The logit of each
+ *                node is the dot product of the non zero weights of its row and the inputs of their columns,
+ *                plus the bias, for each sample, so the work is proportional to the number of non zero 
+ *                weights times the batch size. The rows are split between the threads, and each row is used 
+ *                for every sample while it's in the cache.
+ *
+ * Inputs       : ins           : The inputs to the layer, (num_inputs x batch size), one sample per column
+ *              : sparse        : The sparse weights and the biases of the layer
+ *              : num_inputs    : The number of inputs to the layer
+ *
+ * Outputs      : outs          : The outputs of the layer (nodes x batch size), one sample per column
+ *
+ * Params       : dType         : The type of data used for the computation
+ *              : Storage       : The storage policy of the sparse wba
+ *              : IoStorage     : The storage policy of the input and output tensors
+ * ==========================================================================================================
+ */
+template <typename dType, template <typename> class Storage, template <typename> class IoStorage>
+void softmaxForwardBatchedCpu( const Tensor4<dType, IoStorage>&     ins       ,
+                               const sparse_wba<dType, Storage>&    sparse    ,
+                               uint                                 num_inputs,
+                               Tensor4<dType, IoStorage>&           outs      ) {
+    frnnError       error;
+    const size_t    nodes      = sparse.nodes;
+    const size_t    batch_size = ins.y();
+
+    if ( ins.x() != num_inputs || sparse.inputs != num_inputs ) {
+        frnn::err::dimError( error, stringify( ins ), stringify( num_inputs ) );
+        return;
+    }
+    if ( outs.x() != nodes || outs.y() != batch_size || outs.size() != nodes * batch_size ) {
+        outs.reshape( nodes, batch_size, 1, 1 );
+    }
+    if ( batch_size == 0 ) return;
+
+    const dType*    ins_h     = &ins.hostData()[ 0 ];
+    const dType*    values_h  = &sparse.values.hostData()[ 0 ];
+    const uint*     columns_h = &sparse.columns.hostData()[ 0 ];
+    const uint*     offsets_h = &sparse.row_offsets.hostData()[ 0 ];
+    const dType*    biases_h  = &sparse.biases.hostData()[ 0 ];
+    dType*          outs_h    = &outs.hostData()[ 0 ];
+
+    #pragma omp parallel for if ( sparse.non_zeros * batch_size >= frnn::CPU_PARALLEL_MIN_ELEMENTS )
+    for ( size_t node = 0; node < nodes; node++ ) {
+        for ( size_t b = 0; b < batch_size; b++ ) {
+            const dType* x     = ins_h + b * num_inputs;
+            dType        logit = biases_h[ node ];
+            for ( uint k = offsets_h[ node ]; k < offsets_h[ node + 1 ]; k++ ) logit += values_h[ k ] * x[ columns_h[ k ] ];
+            outs_h[ b * nodes + node ] = logit;
+        }
+    }
+
+    // Softmax of each sample (column)
+    #pragma omp parallel for if ( nodes * batch_size >= frnn::CPU_PARALLEL_MIN_ELEMENTS )
+    for ( size_t b = 0; b < batch_size; b++ ) softmaxArrayCpu( outs_h + b * nodes, outs_h + b * nodes, nodes );
+}
+
+/*
+ * ==========================================================================================================
+ * Function     : softmaxForwardCpu
+ *
+ * Description  : Forward pass for a softmax layer on the CPU, which computes softmax( sum over pages 
+ *                ( W*x + b ) ), this is the batched version for a batch of one sample.
+ *
+ * Inputs       : ins           : The inputs to the layer
+ *              : wba           : The weights, biases and activations of the layer
+ *              : num_inputs    : The number of inputs to the layer
+ *
+ * Outputs      : outs          : The outputs (activations) of the layer
+ *
+ * Params       : dType         : The type of data used for the computation
+ *              : Wba           : The type of the wba (a packed wba tensor, wba planes, a quantized wba or a
+ *                                sparse wba)
+ * ==========================================================================================================
+ */
+template <typename dType, typename Wba>
+void softmaxForwardCpu( const std::vector<dType>&       ins       ,
+                        const Wba&                      wba       ,
+                        uint                            num_inputs,
+                        std::vector<dType>&             outs      ) {
+    frnnError error;
+    if ( ins.size() != num_inputs ) {
+        frnn::err::dimError( error, stringify( ins ), stringify( num_inputs ) );
+        return;
+    }
+
+    Tensor4<dType> ins_t( ins.size(), 1, 1, 1 ), outs_t;
+    ins_t.getData().assign( ins.begin(), ins.end() );
+    softmaxForwardBatchedCpu( static_cast<const Tensor4<dType>&>( ins_t ), wba, num_inputs, outs_t );
+
+    if ( outs.size() < outs_t.size() ) outs.resize( outs_t.size(), 0 );
+    std::copy( outs_t.getData().begin(), outs_t.getData().end(), outs.begin() );
+}
+
+/*
+ * ==========================================================================================================
+ * Function     : softmaxUpdateWbaCpu
+ *
+ * Description  : Updates the weights and biases of a softmax layer on the CPU with the average gradient of
+ *                a batch, using gradient descent with momentum. The weight gradient is E * A^(T) / B, which
+ *                is a single gemm, and the bias gradient is E * 1 / B, which is a gemv. All the pages get the
+ *                same inputs, so the gradients are found once and used for the update of each page.
+ *
+ * Inputs       : prev_acts     : The activations of the previous layer (num_inputs x batch size) 
+ *              : errors        : The errors of the layer for the batch (nodes x batch size)
+ *              : num_inputs    : The number of inputs to the layer
+ *              : learning_rate : The learning rate for the update
+ *              : momentum      : The momentum for the update
+ *
+ * Outputs      : wba           : The weights, biases and activations of the layer, with updated weights 
+ *                                and biases
+ *              : wba_deltas    : The updates of the wba elements, which are used for the momentum of the
+ *                                next update (the same shape as wba)
+ *
+ * Params       : dType         : The type of data used for the computation
+ *              : Storage       : The storage policy of the wba, wba deltas and errors tensors
+ *              : IoStorage     : The storage policy of the activations tensor
+ * ==========================================================================================================
+ */
+template <typename dType, template <typename> class Storage, template <typename> class IoStorage>
+void softmaxUpdateWbaCpu( const Tensor4<dType, IoStorage>&   prev_acts    ,
+                          const Tensor4<dType, Storage>&     errors       ,
+                          uint                               num_inputs   ,
+                          dType                              learning_rate,
+                          dType                              momentum     ,
+                          Tensor4<dType, Storage>&           wba          ,
+                          Tensor4<dType, Storage>&           wba_deltas   ) {
+
+    typedef frnn::cpu::KernelCpu<frnn::cpu::momentumKernel, frnn::cpu::VectorizedCpu<dType>::value> update;
+
+    frnnError       error;
+    const size_t    nodes      = wba.x();
+    const size_t    batch_size = prev_acts.y();
+    const size_t    page_size  = wba.x() * wba.y();
+
+    if ( prev_acts.x() != num_inputs ) {
+        frnn::err::dimError( error, stringify( prev_acts ), stringify( num_inputs ) );
+        return;
+    }
+    if ( errors.size() != nodes * batch_size ) {
+        frnn::err::dimError( error, stringify( errors ), stringify( prev_acts ) );
+        return;
+    }
+    if ( wba_deltas.size() != wba.size() ) {
+        frnn::err::dimError( error, stringify( wba_deltas ), stringify( wba ) );
+        return;
+    }
+    if ( batch_size == 0 ) return;
+
+    // Gradients of the weights (nodes x num_inputs) followed by the gradients of the biases
+    const size_t        page_elements = nodes * ( num_inputs + 1 );
+    std::vector<dType>  gradients( page_elements, 0 );
+    std::vector<dType>  ones( batch_size, dType( 1 ) );
+    const dType*        acts_h   = &prev_acts.hostData()[ 0 ];
+    const dType*        errors_h = &errors.hostData()[ 0 ];
+    const dType         alpha    = dType( 1 ) / static_cast<dType>( batch_size );
+
+    frnn::math<dType, device::CPU>::gemm( 
+            blas::cpu::OP_N, blas::cpu::OP_T, nodes, num_inputs, batch_size, alpha, 
+            errors_h, nodes, acts_h, num_inputs, dType( 0 ), &gradients[ 0 ], nodes );
+    frnn::math<dType, device::CPU>::gemv( 
+            blas::cpu::OP_N, nodes, batch_size, alpha, errors_h, nodes, &ones[ 0 ], dType( 0 ), 
+            &gradients[ nodes * num_inputs ] );
+
+    // Only the weights and the biases get an update, the activations (and the unused 
+    // elements of the pages) don't have a gradient, so their deltas stay at 0
+    dType* wba_h    = &wba.hostData()[ 0 ];
+    dType* deltas_h = &wba_deltas.hostData()[ 0 ];
+    for ( size_t page = 0; page < wba.z(); page++ ) {
+        update::run( wba_h + page * page_size, deltas_h + page * page_size, 
+                     static_cast<const dType*>( &gradients[ 0 ] ), page_elements, learning_rate, momentum );
+    }
+}
+
+/*
+ * ==========================================================================================================
+ * Function     : softmaxUpdateWbaCpu (planes)
+ *
+ * Description  : Updates the weights and biases of a softmax layer with wba planes on the CPU, as for the 
+ *                packed wba. The gradients have the leading dimension of the planes, so the whole of each
+ *                plane is updated by one momentum kernel (the padding rows have no gradient, so they stay 0).
+ *
+ * Inputs       : prev_acts     : The activations of the previous layer (num_inputs x batch size) 
+ *              : errors        : The errors of the layer for the batch (nodes x batch size)
+ *              : num_inputs    : The number of inputs to the layer
+ *              : learning_rate : The learning rate for the update
+ *              : momentum      : The momentum for the update
+ *
+ * Outputs      : planes        : The wba planes of the layer, with updated weights and biases
+ *              : deltas        : The updates of the planes, which are used for the momentum of the next
+ *                                update (the same shape as planes)
+ *
+ * Params       : dType         : The type of data used for the computation
+ *              : Storage       : The storage policy of the planes and the errors tensor
+ *              : IoStorage     : The storage policy of the activations tensor
+ * ==========================================================================================================
+ */
+template <typename dType, template <typename> class Storage, template <typename> class IoStorage>
+void softmaxUpdateWbaCpu( const Tensor4<dType, IoStorage>&   prev_acts    ,
+                          const Tensor4<dType, Storage>&     errors       ,
+                          uint                               num_inputs   ,
+                          dType                              learning_rate,
+                          dType                              momentum     ,
+                          wba_planes<dType, Storage>&        planes       ,
+                          wba_planes<dType, Storage>&        deltas       ) {
+
+    typedef frnn::cpu::KernelCpu<frnn::cpu::momentumKernel, frnn::cpu::VectorizedCpu<dType>::value> update;
+
+    frnnError       error;
+    const size_t    nodes      = planes.nodes;
+    const size_t    batch_size = prev_acts.y();
+    const size_t    ld         = planes.leadingDimension();
+
+    if ( prev_acts.x() != num_inputs || planes.numInputs() != num_inputs ) {
+        frnn::err::dimError( error, stringify( prev_acts ), stringify( num_inputs ) );
+        return;
+    }
+    if ( errors.size() != nodes * batch_size ) {
+        frnn::err::dimError( error, stringify( errors ), stringify( prev_acts ) );
+        return;
+    }
+    if ( deltas.weights.size() != planes.weights.size() || deltas.biases.size() != planes.biases.size() ) {
+        frnn::err::dimError( error, stringify( deltas ), stringify( planes ) );
+        return;
+    }
+    if ( batch_size == 0 ) return;
+
+    aligned_vector<dType>   weight_gradients( ld * num_inputs, 0 );
+    aligned_vector<dType>   bias_gradients( ld, 0 );
+    std::vector<dType>      ones( batch_size, dType( 1 ) );
+    const dType*            acts_h   = &prev_acts.hostData()[ 0 ];
+    const dType*            errors_h = &errors.hostData()[ 0 ];
+    const dType             alpha    = dType( 1 ) / static_cast<dType>( batch_size );
+
+    frnn::math<dType, device::CPU>::gemm( 
+            blas::cpu::OP_N, blas::cpu::OP_T, nodes, num_inputs, batch_size, alpha, 
+            errors_h, nodes, acts_h, num_inputs, dType( 0 ), &weight_gradients[ 0 ], ld );
+    frnn::math<dType, device::CPU>::gemv( 
+            blas::cpu::OP_N, nodes, batch_size, alpha, errors_h, nodes, &ones[ 0 ], dType( 0 ), &bias_gradients[ 0 ] );
+
+    // All the pages get the same inputs, so they have the same gradients
+    dType* weights_h = &planes.weights.getData()[ 0 ];
+    dType* biases_h  = &planes.biases.getData()[ 0 ];
+    dType* dw_h      = &deltas.weights.getData()[ 0 ];
+    dType* db_h      = &deltas.biases.getData()[ 0 ];
+    for ( size_t page = 0; page < planes.depth(); page++ ) {
+        update::run( weights_h + page * ld * num_inputs, dw_h + page * ld * num_inputs, 
+                     static_cast<const dType*>( &weight_gradients[ 0 ] ), ld * num_inputs, learning_rate, momentum );
+        update::run( biases_h + page * ld, db_h + page * ld, 
+                     static_cast<const dType*>( &bias_gradients[ 0 ] ), ld, learning_rate, momentum );
+    }
 }
 
 }   // Namespace frnn
@@ -19,42 +19,127 @@
  */
 
 #ifndef _FRNN_SOFTMAX_FUNCTIONS_GPU_
-#define _FRNN_SOFTMAX_FUNCITONS_GPU_
+#define _FRNN_SOFTMAX_FUNCTIONS_GPU_
 
 #include <omp.h>
 #include <cuda_runtime.h>
+#include <cstring>
 #include <cublas_v2.h>
 
 #include "../../tensor/tensor.cuh"
 #include "../../util/errors.h"
 #include "../../frnn/frnn.h"
+#include "../../frnn/gpu_context.cuh"
+#include "../../frnn/cuda_graph.cuh"
+#include "../../frnn/profiler.cuh"
 #include "../../math/blas/frnn_blas.h"
+#include "../../math/math_gpu.hpp"
+#include "../../frnn/precision.h"
+#include "softmax_kernels_gpu.cuh"
+#include "softmax_cpu_functions.hpp"
 
 namespace frnn {
     
+/*
+ * ==========================================================================================================
+ * Function     : devicePageGpu
+ *
+ * Description  : Gets a device pointer to N elements of a tensor, starting at offset. For tensors stored on
+ *                the host the elements are staged in pinned memory and copied (asynchronously, on stream)
+ *                into a scratch buffer, while for tensors stored on the device a pointer into the device data
+ *                is returned, so nothing is copied.
+ *
+ * Inputs       : error     : fastRNN error type for results of operations
+ *              : buffer    : A device buffer which can hold N elements (only used for host tensors)
+ *              : staging   : A pinned host buffer which can hold N elements (only used for host tensors)
+ *              : tensor    : The tensor to get the elements from
+ *              : offset    : The offset of the first element in the tensor
+ *              : N         : The number of elements
+ *              : stream    : The stream to copy the elements on
+ *
+ * Outputs      : A device pointer to the elements
+ *
+ * Params       : dType     : The type of data in the tensor
+ * ==========================================================================================================
+ */
 template <typename dType>
-void softmaxForwardGpu( std::vector<dType>& ins       , 
-                        Tensor4<dType>&     wba       ,
-                        uint                num_inputs ,
-                        std::vector<dType>& outs      ) {         
-   
-    // Thread sizes
-    size_t threads_x, threads_y, blocks_x, blocks_y;
+const dType* devicePageGpu( frnnError& error, dType* buffer, dType* staging, const Tensor4<dType, storage::Host>& tensor,
+                            size_t offset, size_t N, cudaStream_t stream ) {
+    std::memcpy( staging, &tensor.hostData()[ offset ], N * sizeof( dType ) );
+    if ( frnn::prof::memcpyAsync( buffer, staging, N * sizeof( dType ), cudaMemcpyHostToDevice, stream ) != cudaSuccess ) {
+        frnn::err::copyError( error, stringify( buffer ) );
+    }
+    return buffer;
+}
+
+template <typename dType>
+const dType* devicePageGpu( frnnError& error, dType* buffer, dType* staging, const Tensor4<dType, storage::Device>& tensor,
+                            size_t offset, size_t N, cudaStream_t stream ) {
+    return tensor.deviceData() + offset;
+}
 
+/*
+ * ==========================================================================================================
+ * Function     : softmaxForwardGpu
+ *
+ * Description  : Forward pass for a softmax layer, which computes softmax( sum over pages ( W*x + b ) ). The
+ *                device buffers come from the scratch slots of the context, so after the first call no more
+ *                device allocations (or handle creations) are made. If the wba tensor is stored on the 
+ *                device the weights are used in place and the biases are copied on the device, so only the
+ *                inputs and the outputs are copied between the host and the device.
+ *
+ *                Each page is queued on its own stream of the context, with all copies staged in pinned 
+ *                memory and done asynchronously, so the upload of one page overlaps the gemv of the pages
+ *                before it. The primary stream waits on an event for each page, and then the sum of the 
+ *                pages and the (numerically stable) softmax are done by two kernels.
+ *
+ * Inputs       : context       : The GPU context which provides the cuBLAS handle, the streams and the 
+ *                                scratch memory
+ *              : ins           : The inputs to the layer
+ *              : wba           : The weights, biases and activations of the layer
+ *              : num_inputs    : The number of inputs to the layer
+ *
+ * Outputs      : outs          : The outputs (activations) of the layer
+ *
+ * Params       : dType         : The type of data used for the computation
+ *              : Storage       : The storage policy of the wba tensor
+ * ==========================================================================================================
+ */
+template <typename dType, template <typename> class Storage>
+void softmaxForwardGpu( GpuContext&                 context   ,
+                        std::vector<dType>&         ins       , 
+                        Tensor4<dType, Storage>&    wba       ,
+                        uint                        num_inputs ,
+                        std::vector<dType>&         outs      ) {         
+   
     // Statuses
-    frnnError      error;
-    cublasHandle_t  handle;
-    cublasStatus_t  status;
+    frnnError       error;
+    cublasHandle_t  handle = context.blasHandle();
+    cudaStream_t    stream = context.stream();              // Primary stream, for the inputs and the join
 
-    status = cublasCreate( &handle );
-    cublasSetPointerMode( handle, CUBLAS_POINTER_MODE_HOST );
+    // Scratch slots : Slot 0 is for the inputs (which are the same for all pages), then for 
+    // each page (wba.z) there is a slot for the weights and biases (only used when wba is on 
+    // the host) and one for the results of W*x + b, followed by the slots for the results, the acts 
+    // and the partial results of the softmax
+    const size_t        in_slot       = 0;
+    const size_t        results_slot  = 2 * wba.z() + 1;
+    const size_t        acts_slot     = 2 * wba.z() + 2;
+    const size_t        partials_slot = 2 * wba.z() + 3;
+    // Pinned staging slots 
+    const size_t        in_staging   = 0;
+    const size_t        wba_staging  = 1;
+    const size_t        out_staging  = 2;
 
-    // Device pointers : For each page (wba.z) we need a pointer for :
-    //      inputs, weights, biases
-    std::vector<dType*> d_pointers( 3 * wba.z(), 0 );
-    dType*              results_h[ wba.z() ];           // Pointers to results of W*x + b on host
+    const bool          on_device     = Storage<dType>::on_device;
+    const size_t        page_elements = wba.x() * ( num_inputs + 1 );      // Weights and the biases of a page
+    std::vector<dType*> d_pointers( 2 * wba.z(), 0 );
+    dType*              in_d;                           // Inputs on the device
+    dType*              ins_h;                          // Pinned staging for the inputs
+    dType*              wba_h   = 0;                    // Pinned staging for the weights and biases
+    dType*              outs_h;                         // Pinned staging for the outputs
+    std::vector<dType*> results_h( wba.z(), 0 );        // Pointers to results of W*x + b on host
     dType**             results_d;                      // Pointers to results of W*x + b on device
-    functors::exp       exp_op;                         // Exp operation for softmax
+    dType*              acts;                           // Pointer to the softmax results (node activations)
 
     // Outputs vector must have same dimension as number of nodes
     if ( outs.size() < wba.x() ) outs.resize( wba.x(), 0 );
@@ -64,136 +149,749 @@ void softmaxForwardGpu( std::vector<dType>& ins       ,
         return;
     }
 
-    // Each page is done by a separate kernel
-    #pragma omp parallel num_threads( wba.z() )
-    {
-        int thread_id      = omp_get_thread_num();
-        int in_offset      = 3 * thread_id;
-        int weight_offset  = 3 * thread_id + 1;
-        int bias_offset    = 3 * thread_id + 2;
+    // Get the buffers, weights buffers are not needed when the weights are already on the device
+    in_d = context.scratch<dType>( error, in_slot, ins.size() );
+    for ( size_t page = 0; page < wba.z(); page++ ) {
+        if ( !on_device ) d_pointers[ 2 * page ] = context.scratch<dType>( error, 2 * page + 1, page_elements );
+        d_pointers[ 2 * page + 1 ] = context.scratch<dType>( error, 2 * page + 2, wba.x() );
+    }
+    results_d = context.scratch<dType*>( error, results_slot, wba.z() );
+    acts      = context.scratch<dType>(  error, acts_slot   , wba.x() );
+    ins_h     = context.pinned<dType>(   error, in_staging  , ins.size() );
+    outs_h    = context.pinned<dType>(   error, out_staging , wba.x() );
+    if ( !on_device ) wba_h = context.pinned<dType>( error, wba_staging, page_elements * wba.z() );
 
-        // Alllocate memory on the device
-        if ( cudaMalloc( (void**)&d_pointers[ in_offset ], ins.size() * sizeof( dType ) ) != cudaSuccess ) {
-            frnn::err::allocError( error, stringify( ins ) );
-        }
-        if ( cudaMalloc( (void**)&d_pointers[ weight_offset ], wba.x() * num_inputs * sizeof( dType ) ) != cudaSuccess ) {
-            frnn::err::allocError( error, stringify( weights ) );
-        }
-        if ( cudaMalloc( (void**)&d_pointers[ bias_offset ], wba.x() * sizeof( dType) ) != cudaSuccess ) {
-            frnn::err::allocError( error, stringify( biases ) );
-        }
-        // Copy data from host to device
-        if ( cudaMemcpy( d_pointers[ in_offset ], &ins[0], ins.size() * sizeof( dType ), cudaMemcpyHostToDevice ) != cudaSuccess ) {
-            frnn::err::copyError( error, stringify( ins ) );
-        }
-        if ( cudaMemcpy( d_pointers[ weight_offset ]            , &wba( 0, 0, thread_id, 0 ), 
-                         wba.x() * num_inputs * sizeof( dType ) , cudaMemcpyHostToDevice   ) != cudaSuccess ) {
-            frnn::err::copyError( error, stringify( weights ) );
-        }
-        if ( cudaMemcpy( d_pointers[ bias_offset ], &wba( 0, num_inputs, thread_id, 0 ), 
-                         wba.x() * sizeof( dType ), cudaMemcpyHostToDevice            ) != cudaSuccess ) {
+    if ( in_d == 0 || results_d == 0 || acts == 0 || ins_h == 0 || outs_h == 0 || ( !on_device && wba_h == 0 ) ) return;
+    for ( size_t page = 0; page < wba.z(); page++ ) {
+        if ( ( !on_device && d_pointers[ 2 * page ] == 0 ) || d_pointers[ 2 * page + 1 ] == 0 ) return;
+    }
+
+    // Make sure the device copy of wba is current before the pages are queued
+    wba.sync();
+    const Tensor4<dType, Storage>& wba_c = wba;
+
+    // The inputs are the same for all pages, so they are uploaded once
+    // and each page waits for the upload (event 0) before its gemv
+    std::memcpy( ins_h, &ins[ 0 ], ins.size() * sizeof( dType ) );
+    if ( frnn::prof::memcpyAsync( in_d, ins_h, ins.size() * sizeof( dType ), cudaMemcpyHostToDevice, stream ) != cudaSuccess ) {
+        frnn::err::copyError( error, stringify( ins ) );
+    }
+    cudaEventRecord( context.event( 0 ), stream );
+
+    cublasSetPointerMode( handle, CUBLAS_POINTER_MODE_HOST );
+    dType alpha = 1; dType beta = 1;
+
+    // Queue each page on its own stream, nothing here blocks the host, so the
+    // staging and upload of a page overlap the work of the pages before it
+    for ( size_t page = 0; page < wba.z(); page++ ) {
+        cudaStream_t page_stream = context.stream( page + 1 );
+        dType*       results     = d_pointers[ 2 * page + 1 ];
+        dType*       staging     = on_device ? 0 : wba_h + page * page_elements;
+
+        // The weights of a page are followed by the biases
+        const dType* weights = devicePageGpu( error, d_pointers[ 2 * page ], staging, wba_c, 
+                                              wba_c.index( 0, 0, page, 0 ), page_elements, page_stream );
+        const dType* biases  = weights + wba.x() * num_inputs;
+
+        // The results start as the biases, which are copied so that gemv doesn't overwrite them
+        if ( frnn::prof::memcpyAsync( results, biases, wba.x() * sizeof( dType ), cudaMemcpyDeviceToDevice, page_stream ) != cudaSuccess ) {
             frnn::err::copyError( error, stringify( biases ) );
         }
+        cudaStreamWaitEvent( page_stream, context.event( 0 ), 0 );
 
         // Multiply inputs and weights (column-wise) and add biases { W^(T)*x + b }
-        dType alpha = 1; dType beta = 1;
-        status = frnn::blas::functions<dType>::gemv( 
-                handle , CUBLAS_OP_N            , wba.x(), num_inputs, &alpha                   , d_pointers[ weight_offset ]  , 
-                wba.x(), d_pointers[ in_offset ], 1      , &beta      , d_pointers[ bias_offset ], 1                            );
+        cublasSetStream( handle, page_stream );
+        frnn::blas::functions<dType>::gemv( 
+                handle , CUBLAS_OP_N, wba.x(), num_inputs, &alpha , const_cast<dType*>( weights ), 
+                wba.x(), in_d       , 1      , &beta     , results, 1                             );
         
-        // Assign results to results pointer array
-        results_h[ thread_id ] = d_pointers[ bias_offset ];
+        results_h[ page ] = results;
+        cudaEventRecord( context.event( page + 1 ), page_stream );
     }
+    cublasSetStream( handle, stream );
 
-    // Allocate space and copy the pointers to the resuls to host memory
-    if ( cudaMalloc( (void**)&results_d, wba.z() * sizeof( dType* ) ) != cudaSuccess ) {
-        frnn::err::allocError( error, stringify( results_h ) );
+    // Join : the primary stream waits for all the pages before they are summed
+    for ( size_t page = 0; page < wba.z(); page++ ) {
+        cudaStreamWaitEvent( stream, context.event( page + 1 ), 0 );
     }
-    if ( cudaMemcpy( results_d, results_h, wba.z() * sizeof( dType* ), cudaMemcpyHostToDevice ) != cudaSuccess ) {
+
+    // Copy the pointers to the resuls to device memory
+    if ( frnn::prof::memcpyAsync( results_d, &results_h[ 0 ], wba.z() * sizeof( dType* ), cudaMemcpyHostToDevice, stream ) != cudaSuccess ) {
         frnn::err::copyError( error, stringify( results_d ) );
     }
 
-    if ( wba.z() > 1 ) {
-        // Determine sizes of blocks and threads for next kernel
-        threads_x = wba.x() >= THREADS_PER_BLOCK ? THREADS_PER_BLOCK : wba.x();
-        threads_y = wba.z() >= THREADS_PER_BLOCK ? THREADS_PER_BLOCK : wba.z();
-        blocks_x  = wba.x()  > THREADS_PER_BLOCK ? wba.x() / THREADS_PER_BLOCK + 1 : 1;
-        blocks_y  = wba.z()  > THREADS_PER_BLOCK ? wba.z() / THREADS_PER_BLOCK + 1 : 1;
-        size_t sharedMemAmount = wba.z() * ( wba.x() / 2 ) * sizeof( dType );
+    // Stable softmax of the sum of the pages, the pages are summed as they 
+    // are read by the first pass, so there is no separate accumulation pass
+    pageSumLoader<dType> load = { results_d, wba.z() };
+    softmaxStableGpu( error, context, partials_slot, load, acts, wba.x() );
 
-        dim3 blocks(  blocks_x , blocks_y  );
-        dim3 threads( threads_x, threads_y );
+    if ( frnn::prof::memcpyAsync( outs_h, acts, wba.x() * sizeof( dType ), cudaMemcpyDeviceToHost, stream ) != cudaSuccess ) {
+        frnn::err::copyError( error, stringify( outs ) );
+    }
+    cudaStreamSynchronize( stream );
+    std::memcpy( &outs[ 0 ], outs_h, wba.x() * sizeof( dType ) );
+}
+ 
+/*
+ * ==========================================================================================================
+ * Function     : deviceTensorGpu
+ *
+ * Description  : Gets a device pointer to all the data of a tensor. Tensors stored on the host are copied
+ *                into buffer (on stream), while for tensors stored on the device the device data is used.
+ *                The non-const versions are for tensors which are written to, and for host tensors the data
+ *                is only copied to the device if upload is true (see finishTensorGpu for the copy back).
+ *
+ * Inputs       : error     : fastRNN error type for results of operations
+ *              : buffer    : A device buffer which can hold all the elements (only used for host tensors)
+ *              : tensor    : The tensor to get the data of
+ *              : stream    : The stream to copy the data on
+ *              : upload    : If the host data must be copied to the device
+ *
+ * Outputs      : A device pointer to the data of the tensor
+ *
+ * Params       : dType     : The type of data in the tensor
+ * ==========================================================================================================
+ */
+template <typename dType>
+const dType* deviceTensorGpu( frnnError& error, dType* buffer, const Tensor4<dType, storage::Host>& tensor,
+                              cudaStream_t stream ) {
+    if ( frnn::prof::memcpyAsync( buffer, &tensor.hostData()[ 0 ], tensor.size() * sizeof( dType ), 
+                                  cudaMemcpyHostToDevice, stream ) != cudaSuccess ) {
+        frnn::err::copyError( error, stringify( tensor ) );
+    }
+    return buffer;
+}
+
+template <typename dType>
+const dType* deviceTensorGpu( frnnError& error, dType* buffer, const Tensor4<dType, storage::Device>& tensor,
+                              cudaStream_t stream ) {
+    return tensor.deviceData();
+}
+
+template <typename dType>
+dType* deviceTensorGpu( frnnError& error, dType* buffer, Tensor4<dType, storage::Host>& tensor,
+                        cudaStream_t stream, bool upload ) {
+    if ( upload ) deviceTensorGpu( error, buffer, static_cast<const Tensor4<dType, storage::Host>&>( tensor ), stream );
+    return buffer;
+}
+
+template <typename dType>
+dType* deviceTensorGpu( frnnError& error, dType* buffer, Tensor4<dType, storage::Device>& tensor,
+                        cudaStream_t stream, bool upload ) {
+    return tensor.deviceData();
+}
 
-        // Sum all the results of W*x + b from each page (or layer in network)
-        xpny<<<blocks, threads, sharedMemAmount>>>( results_d, wba.x(), wba.z() );
+/*
+ * ==========================================================================================================
+ * Function     : finishTensorGpu
+ *
+ * Description  : Copies the results in buffer back to a tensor stored on the host and waits for stream to 
+ *                finish. Tensors stored on the device already have the results, so only the wait is done (and
+ *                not while the stream is captured into a graph, see cuda_graph.cuh).
+ *
+ * Inputs       : error     : fastRNN error type for results of operations
+ *              : buffer    : The device buffer with the results (only used for host tensors)
+ *              : stream    : The stream the results were computed on
+ *
+ * Outputs      : tensor    : The tensor to copy the results to
+ *
+ * Params       : dType     : The type of data in the tensor
+ * ==========================================================================================================
+ */
+template <typename dType>
+void finishTensorGpu( frnnError& error, const dType* buffer, Tensor4<dType, storage::Host>& tensor, cudaStream_t stream ) {
+    if ( frnn::prof::memcpyAsync( &tensor.hostData()[ 0 ], buffer, tensor.size() * sizeof( dType ), 
+                                  cudaMemcpyDeviceToHost, stream ) != cudaSuccess ) {
+        frnn::err::copyError( error, stringify( tensor ) );
     }
+    cudaStreamSynchronize( stream );
+}
+
+template <typename dType>
+void finishTensorGpu( frnnError& error, const dType* buffer, Tensor4<dType, storage::Device>& tensor, cudaStream_t stream ) {
+    waitForStream( stream );
+}
+
+/*
+ * ==========================================================================================================
+ * Function     : softmaxLogitsPagesGpu
+ *
+ * Description  : Computes sum over pages ( W*X + b ) for each column of X on the device, for weights and 
+ *                biases with any leading dimension and page strides. Each page is one gemm of the strided 
+ *                batched gemm, the pages (and their biases) are summed with sumVectorsGpu, and the biases are
+ *                added with a rank 1 gemm, so the work for the whole batch is a constant number of launches.
+ *                Nothing waits for the stream. Scratch slots 2, 4 and 5 of the context are used.
+ *
+ * Inputs       : error         : fastRNN error type for results of operations
+ *              : context       : The GPU context which provides the cuBLAS handle and the scratch memory
+ *              : ins_d         : The inputs on the device (num_inputs x batch size)
+ *              : weights_d     : The weights of the first page on the device (with leading dimension ld)
+ *              : ld            : The leading dimension of the weights
+ *              : weight_stride : The number of elements between the weights of consecutive pages
+ *              : biases_d      : The biases of the first page on the device
+ *              : bias_stride   : The number of elements between the biases of consecutive pages
+ *              : nodes         : The number of nodes of the layer
+ *              : pages         : The number of pages
+ *              : num_inputs    : The number of inputs to the layer
+ *              : batch_size    : The number of samples
+ *
+ * Outputs      : logits_d      : The sums of the pages on the device (nodes x batch size)
+ *
+ * Params       : dType         : The type of data used for the computation
+ * ==========================================================================================================
+ */
+template <typename dType>
+void softmaxLogitsPagesGpu( frnnError&   error      , GpuContext&  context      , const dType* ins_d      , 
+                            const dType* weights_d  , size_t       ld           , size_t       weight_stride, 
+                            const dType* biases_d   , size_t       bias_stride  , size_t       nodes      , 
+                            size_t       pages      , size_t       num_inputs   , size_t       batch_size , 
+                            dType*       logits_d   ) {
+    cublasHandle_t  handle = context.blasHandle();
+    cudaStream_t    stream = context.stream();
+
+    // Scratch slots : 2 per page results, 4 ones, 5 sum of biases
+    dType*       pages_d   = context.scratch<dType>( error, 2, nodes * batch_size * pages );
+    dType*       ones_d    = context.scratch<dType>( error, 4, batch_size );
+    dType*       bsum_d    = context.scratch<dType>( error, 5, nodes );
+
+    if ( pages_d == 0 || ones_d == 0 || bsum_d == 0 ) return;
+
+    FRNN_COUNT_LAUNCH();
+    fill<<<batch_size / THREADS_PER_BLOCK + 1, THREADS_PER_BLOCK, 0, stream>>>( ones_d, batch_size, dType( 1 ) );
+
+    cublasSetPointerMode( handle, CUBLAS_POINTER_MODE_HOST );
+    dType alpha = 1; dType beta_zero = 0; dType beta_one = 1;
+
+    // W_p * X for each page p, into consecutive (nodes x batch) blocks
+    frnn::blas::functions<dType>::gemmStridedBatched( 
+            handle    , CUBLAS_OP_N, CUBLAS_OP_N, nodes, batch_size, num_inputs, &alpha, 
+            weights_d , ld         , weight_stride,
+            ins_d     , num_inputs , 0            , &beta_zero, 
+            pages_d   , nodes      , nodes * batch_size, pages                                  );
+
+    // Sum over the pages : the page results are the columns of a (nodes * batch x pages) matrix
+    sumVectorsGpu( error, context, static_cast<const dType*>( pages_d ), nodes * batch_size, pages, 
+                   nodes * batch_size, logits_d );
+
+    // Sum of the biases of each page, then add them to each sample
+    sumVectorsGpu( error, context, biases_d, nodes, pages, bias_stride, bsum_d );
+    frnn::blas::functions<dType>::gemm( 
+            handle, CUBLAS_OP_N, CUBLAS_OP_N, nodes, batch_size, 1, &alpha, bsum_d, nodes, 
+            ones_d, 1          , &beta_one  , logits_d, nodes                                   );
+}
+
+/*
+ * ==========================================================================================================
+ * Function     : softmaxForwardPagesGpu
+ *
+ * Description  : Computes softmax( sum over pages ( W*X + b ) ) for each column of X on the device, as the
+ *                logits of softmaxLogitsPagesGpu followed by a single launch for the softmax of every column.
+ *                Scratch slots 2 - 5 of the context are used.
+ *
+ * Inputs       : (see softmaxLogitsPagesGpu)
+ *
+ * Outputs      : outs_d        : The outputs on the device (nodes x batch size)
+ *
+ * Params       : dType         : The type of data used for the computation
+ * ==========================================================================================================
+ */
+template <typename dType>
+void softmaxForwardPagesGpu( frnnError&   error      , GpuContext&  context      , const dType* ins_d      , 
+                             const dType* weights_d  , size_t       ld           , size_t       weight_stride, 
+                             const dType* biases_d   , size_t       bias_stride  , size_t       nodes      , 
+                             size_t       pages      , size_t       num_inputs   , size_t       batch_size , 
+                             dType*       outs_d     ) {
+    // Scratch slot 3 is for the logits
+    dType* logits_d = context.scratch<dType>( error, 3, nodes * batch_size );
+    if ( logits_d == 0 ) return;
+
+    softmaxLogitsPagesGpu( error, context, ins_d, weights_d, ld, weight_stride, biases_d, bias_stride, nodes, 
+                           pages, num_inputs, batch_size, logits_d );
 
-    // Create pointer to the softmax results (node activations)
-    dType* acts;
-    if ( cudaMalloc( (void**)&acts, wba.x() * sizeof( dType ) ) != cudaSuccess ) {
-        frnn::err::allocError( error, stringify( acts ) );
+    // Softmax of each sample (column)
+    softmaxColumnsGpu( context, logits_d, outs_d, nodes, batch_size );
+}
+
+/*
+ * ==========================================================================================================
+ * Function     : softmaxForwardBatchedGpu
+ *
+ * Description  : Forward pass for a softmax layer for a batch of inputs, which computes 
+ *                softmax( sum over pages ( W*X + b ) ) for each column of X (see softmaxForwardPagesGpu). The
+ *                overloads are for the packed wba, for the wba planes, for which the gemm uses the padded
+ *                leading dimension of the planes, and for the sparse wba (see sparseLogits).
+ *
+ * Inputs       : context       : The GPU context which provides the cuBLAS handle and the scratch memory
+ *              : ins           : The inputs to the layer, (num_inputs x batch size), one sample per column
+ *              : wba           : The weights, biases and activations of the layer (packed or planes)
+ *              : num_inputs    : The number of inputs to the layer
+ *
+ * Outputs      : outs          : The outputs of the layer (nodes x batch size), one sample per column
+ *
+ * Params       : dType         : The type of data used for the computation
+ *              : Storage       : The storage policy of the wba tensor(s)
+ *              : IoStorage     : The storage policy of the input and output tensors
+ * ==========================================================================================================
+ */
+template <typename dType, template <typename> class Storage, template <typename> class IoStorage>
+void softmaxForwardBatchedGpu( GpuContext&                      context   ,
+                               const Tensor4<dType, IoStorage>& ins       ,
+                               Tensor4<dType, Storage>&         wba       ,
+                               uint                             num_inputs,
+                               Tensor4<dType, IoStorage>&       outs      ) {
+
+    frnnError       error;
+    cudaStream_t    stream     = context.stream();
+    const size_t    nodes      = wba.x();
+    const size_t    batch_size = ins.y();
+    const size_t    page_size  = wba.x() * wba.y();
+
+    if ( ins.x() != num_inputs ) {
+        frnn::err::dimError( error, stringify( ins ), stringify( num_inputs ) );
+        return;
     }
-    if ( cudaMemset( acts, 0, wba.x() * sizeof( dType ) ) != cudaSuccess ) {
-        frnn::err::copyError( error, stringify( acts ) );
+    if ( outs.x() != nodes || outs.y() != batch_size || outs.size() != nodes * batch_size ) {
+        outs.reshape( nodes, batch_size, 1, 1 );
     }
 
-    // Define grid size for the softmax operations 
-    wba.x() > THREADS_PER_BLOCK * MAX_BLOCKS    ? 
-        threads_x = 2 * THREADS_PER_BLOCK       : 
-        threads_x = THREADS_PER_BLOCK;
-    
-    blocks_x = std::min( static_cast<int>( wba.x() / threads_x ), MAX_BLOCKS );
-    if ( blocks_x * threads_x < wba.x() ) blocks_x++;
+    // Scratch slots : 0 inputs, 1 wba, 6 outputs
+    const Tensor4<dType, Storage>& wba_c = wba;
+    const dType* ins_d    = deviceTensorGpu( error, context.scratch<dType>( error, 0, ins.size() ), ins, stream );
+    const dType* wba_d    = deviceTensorGpu( error, context.scratch<dType>( error, 1, wba.size() ), wba_c, stream );
+    dType*       outs_d   = deviceTensorGpu( error, context.scratch<dType>( error, 6, outs.size() ), outs, stream, false );
 
-    // Perform softmax on results of Wx + b (see math softmax for what each kernel does)
-    blockReduceAtomicVectorizedAll<<<blocks_x, threads_x>>>( d_pointers[ 2 ], acts, wba.x(), exp_op );
-    blockScatter<<<blocks_x, threads_x>>>( acts, wba.x() );
-    softmaxKernel<<<blocks_x, threads_x>>>( d_pointers[ 2 ], acts, wba.x() );      
+    if ( ins_d == 0 || wba_d == 0 || outs_d == 0 ) return;
 
-    if ( cudaMemcpy( &outs[ 0 ], acts, wba.x() * sizeof( dType ), cudaMemcpyDeviceToHost ) != cudaSuccess ) {
-        frnn::err::copyError( error, stringify( outs ) );
+    // The bias columns are a page apart
+    softmaxForwardPagesGpu( error, context, ins_d, wba_d, nodes, page_size, wba_d + wba.index( 0, num_inputs, 0, 0 ),
+                            page_size, nodes, wba.z(), num_inputs, batch_size, outs_d );
+
+    finishTensorGpu( error, outs_d, outs, stream );
+}
+
+template <typename dType, template <typename> class Storage, template <typename> class IoStorage>
+void softmaxForwardBatchedGpu( GpuContext&                          context   ,
+                               const Tensor4<dType, IoStorage>&     ins       ,
+                               const wba_planes<dType, Storage>&    planes    ,
+                               uint                                 num_inputs,
+                               Tensor4<dType, IoStorage>&           outs      ) {
+
+    frnnError       error;
+    cudaStream_t    stream     = context.stream();
+    const size_t    nodes      = planes.nodes;
+    const size_t    batch_size = ins.y();
+    const size_t    ld         = planes.leadingDimension();
+
+    if ( ins.x() != num_inputs || planes.numInputs() != num_inputs ) {
+        frnn::err::dimError( error, stringify( ins ), stringify( num_inputs ) );
+        return;
+    }
+    if ( outs.x() != nodes || outs.y() != batch_size || outs.size() != nodes * batch_size ) {
+        outs.reshape( nodes, batch_size, 1, 1 );
     }
 
-    cublasDestroy( handle );
- 
-    for ( int i = 0; i < d_pointers.size(); i++ ) cudaFree( d_pointers[i] );
-    cudaFree( results_d ); cudaFree( acts );
+    // Scratch slots : 0 inputs, 1 weights, 6 outputs, 7 biases
+    const dType* ins_d     = deviceTensorGpu( error, context.scratch<dType>( error, 0, ins.size() ), ins, stream );
+    const dType* weights_d = deviceTensorGpu( error, context.scratch<dType>( error, 1, planes.weights.size() ), 
+                                              planes.weights, stream );
+    const dType* biases_d  = deviceTensorGpu( error, context.scratch<dType>( error, 7, planes.biases.size() ), 
+                                              planes.biases, stream );
+    dType*       outs_d    = deviceTensorGpu( error, context.scratch<dType>( error, 6, outs.size() ), outs, stream, false );
+
+    if ( ins_d == 0 || weights_d == 0 || biases_d == 0 || outs_d == 0 ) return;
+
+    softmaxForwardPagesGpu( error, context, ins_d, weights_d, ld, ld * num_inputs, biases_d, ld, nodes, 
+                            planes.depth(), num_inputs, batch_size, outs_d );
+
+    finishTensorGpu( error, outs_d, outs, stream );
 }
- 
+
+template <typename dType, template <typename> class Storage, template <typename> class IoStorage>
+void softmaxForwardBatchedGpu( GpuContext&                          context   ,
+                               const Tensor4<dType, IoStorage>&     ins       ,
+                               const sparse_wba<dType, Storage>&    sparse    ,
+                               uint                                 num_inputs,
+                               Tensor4<dType, IoStorage>&           outs      ) {
+
+    frnnError       error;
+    cudaStream_t    stream     = context.stream();
+    const size_t    nodes      = sparse.nodes;
+    const size_t    batch_size = ins.y();
+
+    if ( ins.x() != num_inputs || sparse.inputs != num_inputs ) {
+        frnn::err::dimError( error, stringify( ins ), stringify( num_inputs ) );
+        return;
+    }
+    if ( outs.x() != nodes || outs.y() != batch_size || outs.size() != nodes * batch_size ) {
+        outs.reshape( nodes, batch_size, 1, 1 );
+    }
+    if ( batch_size == 0 ) return;
+
+    // Scratch slots : 0 inputs, 1 values, 3 logits, 6 outputs, 7 biases, 9 columns, 10 row offsets
+    const dType*        ins_d     = deviceTensorGpu( error, context.scratch<dType>( error, 0, ins.size() ), ins, stream );
+    const dType*        values_d  = deviceTensorGpu( error, context.scratch<dType>( error, 1, sparse.values.size() ), 
+                                                     sparse.values, stream );
+    const dType*        biases_d  = deviceTensorGpu( error, context.scratch<dType>( error, 7, sparse.biases.size() ), 
+                                                     sparse.biases, stream );
+    const unsigned int* columns_d = deviceTensorGpu( error, context.scratch<unsigned int>( error, 9, sparse.columns.size() ), 
+                                                     sparse.columns, stream );
+    const unsigned int* offsets_d = deviceTensorGpu( error, context.scratch<unsigned int>( error, 10, sparse.row_offsets.size() ), 
+                                                     sparse.row_offsets, stream );
+    dType*              logits_d  = context.scratch<dType>( error, 3, nodes * batch_size );
+    dType*              outs_d    = deviceTensorGpu( error, context.scratch<dType>( error, 6, outs.size() ), outs, stream, false );
+
+    if ( ins_d == 0 || values_d == 0 || biases_d == 0 || columns_d == 0 || offsets_d == 0 || logits_d == 0 || outs_d == 0 ) return;
+
+    // A warp for each row
+    const size_t warps_per_block = THREADS_PER_BLOCK / 32;
+    const size_t row_blocks      = std::min( ( nodes + warps_per_block - 1 ) / warps_per_block, static_cast<size_t>( MAX_BLOCKS ) );
+    FRNN_COUNT_LAUNCH();
+    sparseLogits<<<row_blocks, THREADS_PER_BLOCK, 0, stream>>>( values_d, columns_d, offsets_d, biases_d, ins_d, nodes, 
+                                                                num_inputs, batch_size, logits_d );
+
+    // Softmax of each sample (column)
+    softmaxColumnsGpu( context, logits_d, outs_d, nodes, batch_size );
+
+    finishTensorGpu( error, outs_d, outs, stream );
+}
+
+/*
+ * ==========================================================================================================
+ * Function     : softmaxBackwardGpu
+ *
+ * Description  : Backward pass for a batch of a softmax layer, which determines the errors as the difference
+ *                between the outputs and the targets. For tensors stored on the device the errors are found
+ *                on the device, so the outputs don't need to be copied to the host. For tensors stored on the
+ *                host the CPU version is used, since it's faster than copying the data to the device.
+ *
+ * Inputs       : context       : The GPU context which provides the stream
+ *              : outs          : The outputs of the layer (nodes x batch size)
+ *              : targets       : The targets for the outputs (nodes x batch size)
+ *
+ * Outputs      : errors        : The errors of the layer (nodes x batch size)
+ *
+ * Params       : dType         : The type of data used for the computation
+ *              : ErrStorage    : The storage policy of the errors tensor
+ * ==========================================================================================================
+ */
+template <typename dType, template <typename> class ErrStorage>
+void softmaxBackwardGpu( GpuContext&                             context, 
+                         Tensor4<dType, storage::Host>&          outs   ,
+                         Tensor4<dType, storage::Host>&          targets,
+                         Tensor4<dType, ErrStorage>&             errors ) {
+    errors.reshape( outs.x(), outs.y(), 1, 1 );
+    softmaxBackwardCpu( outs.getData(), targets.getData(), errors.getData() );
+}
+
+template <typename dType, template <typename> class ErrStorage>
+void softmaxBackwardGpu( GpuContext&                             context, 
+                         Tensor4<dType, storage::Device>&        outs   ,
+                         Tensor4<dType, storage::Device>&        targets,
+                         Tensor4<dType, ErrStorage>&             errors ) {
+    frnnError    error;
+    cudaStream_t stream = context.stream();
+
+    if ( outs.size() != targets.size() ) {
+        frnn::err::dimError( error, stringify( outs ), stringify( targets ) );
+        return;
+    }
+    errors.reshape( outs.x(), outs.y(), 1, 1 );
+
+    const Tensor4<dType, storage::Device>& outs_c    = outs;
+    const Tensor4<dType, storage::Device>& targets_c = targets;
+    dType* errors_d = deviceTensorGpu( error, context.scratch<dType>( error, 0, errors.size() ), errors, stream, false );
+    if ( errors_d == 0 ) return;
+
+    size_t blocks = std::min( errors.size() / THREADS_PER_BLOCK + 1, static_cast<size_t>( MAX_BLOCKS ) );
+    FRNN_COUNT_LAUNCH();
+    xmy<<<blocks, THREADS_PER_BLOCK, 0, stream>>>( outs_c.deviceData(), targets_c.deviceData(), errors_d, errors.size() );
+
+    finishTensorGpu( error, errors_d, errors, stream );
+}
+
+/*
+ * ==========================================================================================================
+ * Function     : gradientHookGpu
+ *
+ * Description  : Gives the gradients of an update to the gradient hook of the context, if it has one (see
+ *                GradientHook), before they are checked and applied
+ *
+ * Inputs       : error         : The error for the result of the hook
+ *              : context       : The GPU context
+ *              : gradients_d   : The gradients on the device
+ *              : N             : The number of gradients
+ *
+ * Params       : dType         : The type of data of the gradients
+ * ==========================================================================================================
+ */
 template <typename dType>
-void softmaxUpadateWbaGpu( Tensor4<dType>& prev_wba, uint act_start, size_t N, 
-                           Tensor4<dType>& curr_wba, uint err_start, size_t M ) {
-    
-    frnnError error;
-    
-    // Each page of the matrix is done by a separate omp thread
-    #pragma omp parallel num_threads( curr_wba.z ) 
-    {
-        float   *prev_wba_d, *curr_wba_d;
-        int      thread_id;
-        // Allocate device memory for weights 
-        if ( cudaMalloc( (void**)&prev_wba_d, N * sizeof( dType ) ) != cudaSuccess ) {
-            frnn::err::allocError( error, stringify( prev_wba_d ) );
-        }
-        if ( cudaMalloc( (void**)&curr_wba_d, M * sizeof( dType ) ) != cudaSuccess ) {
-            frnn::err::allocError( error, stringify( curr_wba_d ) );
-        }
-        
-        // Copy to device memory 
-        if ( cudaMemcpy( prev_wba_d,          &prev_wba( act_start, 0, thread_id, 0 ), 
-                         N * sizeof( dType ), cudaMemcpyHostToDevice ) != cudaSuccess ) {
-            frnn::err::copyError( error, stringify( prev_wba ) );
-        }
-        if ( cudaMemcpy( prev_wba_d,          &prev_wba( err_start, 0, thread_id, 0 ), 
-                         N * sizeof( dType ), cudaMemcpyHostToDevice ) != cudaSuccess ) {
-            frnn::err::copyError( error, stringify( prev_wba ) );
-        }
-        
-        // Invoke the kernel to upadte the weights
+inline void gradientHookGpu( frnnError& error, GpuContext& context, dType* gradients_d, size_t N ) {
+    if ( context.gradientHook() != 0 ) context.gradientHook()->gradients( error, context, gradients_d, N );
+}
+
+/*
+ * ==========================================================================================================
+ * Function     : lossScaleGpu
+ *
+ * Description  : Checks the gradients of an update for inf or nan, and updates the loss scale (see 
+ *                frnn/precision.h NOTES 2). This waits for the stream, since the scaler is on the host.
+ *
+ * Inputs       : error         : The error to set if the check fails
+ *              : context       : The GPU context which provides the stream and the scratch memory (slot 8
+ *                                is used for the flag)
+ *              : gradients_d   : The gradients (scaled by the current scale of the scaler) on the device
+ *              : N             : The number of gradients
+ *              : scaler        : The loss scaler, or 0 if the loss isn't scaled
+ *
+ * Outputs      : gradient_scale: The factor the gradients must be multiplied by for the update
+ *              : If the update must be applied
+ *
+ * Params       : dType         : The type of data of the gradients
+ * ==========================================================================================================
+ */
+template <typename dType>
+bool lossScaleGpu( frnnError& error, GpuContext& context, const dType* gradients_d, size_t N, LossScaler* scaler,
+                   typename frnn::accumulate_type<dType>::type& gradient_scale ) {
+    gradient_scale = 1;
+    if ( scaler == 0 ) return true;
+
+    cudaStream_t    stream   = context.stream();
+    unsigned int*   found_d  = context.scratch<unsigned int>( error, 8, 1 );
+    unsigned int    found    = 0;
+    if ( found_d == 0 ) return false;
+
+    size_t blocks = std::min( N / THREADS_PER_BLOCK + 1, static_cast<size_t>( MAX_BLOCKS ) );
+    cudaMemsetAsync( found_d, 0, sizeof( unsigned int ), stream );
+    FRNN_COUNT_LAUNCH();
+    checkFinite<<<blocks, THREADS_PER_BLOCK, 0, stream>>>( gradients_d, N, found_d );
+    if ( frnn::prof::memcpyAsync( &found, found_d, sizeof( unsigned int ), cudaMemcpyDeviceToHost, stream ) != cudaSuccess ) {
+        frnn::err::copyError( error, stringify( found_d ) );
     }
-    
+    cudaStreamSynchronize( stream );
+
+    gradient_scale = scaler->inverseScale();
+    return scaler->update( found != 0 );
+}
+
+/*
+ * ==========================================================================================================
+ * Function     : softmaxUpdateWbaGpu
+ *
+ * Description  : Updates the weights and biases of a softmax layer with the average gradient of a batch,
+ *                using gradient descent with momentum. The weight gradient for the batch is E * A^(T) (where 
+ *                each column of E is the errors and each column of A the inputs of a sample), which is a 
+ *                single gemm for all the samples, and is done for all the pages with a strided batched gemm.
+ *                The update (see updateWeights) is then done by a single kernel for the whole tensor. When 
+ *                the tensors are stored on the device nothing is copied between the host and the device.
+ *
+ * Inputs       : context       : The GPU context which provides the cuBLAS handle and the scratch memory
+ *              : prev_acts     : The activations of the previous layer (num_inputs x batch size) 
+ *              : errors        : The errors of the layer for the batch (nodes x batch size)
+ *              : num_inputs    : The number of inputs to the layer
+ *              : learning_rate : The learning rate for the update
+ *              : momentum      : The momentum for the update
+ *              : scaler        : The loss scaler if the errors are scaled (the update is skipped when a 
+ *                                gradient is inf or nan), or 0
+ *
+ * Outputs      : wba           : The weights, biases and activations of the layer, with updated weights 
+ *                                and biases
+ *              : wba_deltas    : The updates of the wba elements, which are used for the momentum of the
+ *                                next update (the same shape as wba)
+ *
+ * Params       : dType         : The type of data used for the computation
+ *              : Storage       : The storage policy of the wba, wba deltas and errors tensors
+ *              : IoStorage     : The storage policy of the activations tensor
+ * ==========================================================================================================
+ */
+template <typename dType, template <typename> class Storage, template <typename> class IoStorage>
+void softmaxUpdateWbaGpu( GpuContext&                        context      ,
+                          const Tensor4<dType, IoStorage>&   prev_acts    ,
+                          const Tensor4<dType, Storage>&     errors       ,
+                          uint                               num_inputs   ,
+                          dType                              learning_rate,
+                          dType                              momentum     ,
+                          Tensor4<dType, Storage>&           wba          ,
+                          Tensor4<dType, Storage>&           wba_deltas   ,
+                          LossScaler*                        scaler = 0   ) {
+
+    frnnError       error;
+    cublasHandle_t  handle     = context.blasHandle();
+    cudaStream_t    stream     = context.stream();
+    const size_t    nodes      = wba.x();
+    const size_t    batch_size = prev_acts.y();
+    const size_t    page_size  = wba.x() * wba.y();
+
+    if ( prev_acts.x() != num_inputs ) {
+        frnn::err::dimError( error, stringify( prev_acts ), stringify( num_inputs ) );
+        return;
+    }
+    if ( errors.size() != nodes * batch_size ) {
+        frnn::err::dimError( error, stringify( errors ), stringify( prev_acts ) );
+        return;
+    }
+    if ( wba_deltas.size() != wba.size() ) {
+        frnn::err::dimError( error, stringify( wba_deltas ), stringify( wba ) );
+        return;
+    }
+
+    // Scratch slots : 0 activations, 1 errors, 2 ones, 3 gradients, 4 wba, 5 wba deltas
+    const dType* acts_d      = deviceTensorGpu( error, context.scratch<dType>( error, 0, prev_acts.size() ), prev_acts, stream );
+    const dType* errors_d    = deviceTensorGpu( error, context.scratch<dType>( error, 1, errors.size() ), errors, stream );
+    dType*       ones_d      = context.scratch<dType>( error, 2, batch_size );
+    dType*       gradients_d = context.scratch<dType>( error, 3, wba.size() );
+    dType*       wba_d       = deviceTensorGpu( error, context.scratch<dType>( error, 4, wba.size() ), wba, stream, true );
+    dType*       deltas_d    = deviceTensorGpu( error, context.scratch<dType>( error, 5, wba.size() ), wba_deltas, stream, true );
+
+    if ( acts_d == 0 || errors_d == 0 || ones_d == 0 || gradients_d == 0 || wba_d == 0 || deltas_d == 0 ) return;
+
+    // Only the weights and biases get a gradient
+    if ( cudaMemsetAsync( gradients_d, 0, wba.size() * sizeof( dType ), stream ) != cudaSuccess ) {
+        frnn::err::copyError( error, stringify( gradients_d ) );
+    }
+    FRNN_COUNT_LAUNCH();
+    fill<<<batch_size / THREADS_PER_BLOCK + 1, THREADS_PER_BLOCK, 0, stream>>>( ones_d, batch_size, dType( 1 ) );
+
+    cublasSetPointerMode( handle, CUBLAS_POINTER_MODE_HOST );
+    dType alpha = dType( 1 ) / static_cast<dType>( batch_size ); dType beta = 0;
+
+    // Weight gradient E * A^(T) / B for each page (all pages get the same inputs)
+    frnn::blas::functions<dType>::gemmStridedBatched( 
+            handle      , CUBLAS_OP_N, CUBLAS_OP_T, nodes, num_inputs, batch_size, &alpha, 
+            errors_d    , nodes      , 0          ,
+            acts_d      , num_inputs , 0          , &beta, 
+            gradients_d , nodes      , page_size  , wba.z()                                 );
+
+    // Bias gradient E * 1 / B for each page
+    frnn::blas::functions<dType>::gemmStridedBatched( 
+            handle      , CUBLAS_OP_N, CUBLAS_OP_N, nodes, 1, batch_size, &alpha, 
+            errors_d    , nodes      , 0          ,
+            ones_d      , batch_size , 0          , &beta, 
+            gradients_d + wba.index( 0, num_inputs, 0, 0 ), nodes, page_size, wba.z()       );
+
+    typename frnn::accumulate_type<dType>::type scale;
+    gradientHookGpu( error, context, gradients_d, wba.size() );
+    if ( !lossScaleGpu( error, context, gradients_d, wba.size(), scaler, scale ) ) return;
+
+    size_t blocks = std::min( wba.size() / THREADS_PER_BLOCK + 1, static_cast<size_t>( MAX_BLOCKS ) );
+    FRNN_COUNT_LAUNCH();
+    updateWeights<<<blocks, THREADS_PER_BLOCK, 0, stream>>>( wba_d, deltas_d, gradients_d, wba.size(), learning_rate, momentum, scale );
+
+    if ( !Storage<dType>::on_device ) finishTensorGpu( error, deltas_d, wba_deltas, stream );
+    finishTensorGpu( error, wba_d, wba, stream );
+}
+
+/*
+ * ==========================================================================================================
+ * Function     : softmaxUpdateWbaGpu (planes)
+ *
+ * Description  : Updates the weights and biases of a softmax layer with wba planes, as for the packed wba.
+ *                The gradients have the leading dimension of the planes, so each plane is updated by a 
+ *                single kernel (the padding rows have no gradient, so they stay 0).
+ *
+ * Inputs       : context       : The GPU context which provides the cuBLAS handle and the scratch memory
+ *              : prev_acts     : The activations of the previous layer (num_inputs x batch size) 
+ *              : errors        : The errors of the layer for the batch (nodes x batch size)
+ *              : num_inputs    : The number of inputs to the layer
+ *              : learning_rate : The learning rate for the update
+ *              : momentum      : The momentum for the update
+ *              : scaler        : The loss scaler if the errors are scaled, or 0
+ *
+ * Outputs      : planes        : The wba planes of the layer, with updated weights and biases
+ *              : deltas        : The updates of the planes, which are used for the momentum of the next
+ *                                update (the same shape as planes)
+ *
+ * Params       : dType         : The type of data used for the computation
+ *              : Storage       : The storage policy of the planes and the errors tensor
+ *              : IoStorage     : The storage policy of the activations tensor
+ * ==========================================================================================================
+ */
+template <typename dType, template <typename> class Storage, template <typename> class IoStorage>
+void softmaxUpdateWbaGpu( GpuContext&                        context      ,
+                          const Tensor4<dType, IoStorage>&   prev_acts    ,
+                          const Tensor4<dType, Storage>&     errors       ,
+                          uint                               num_inputs   ,
+                          dType                              learning_rate,
+                          dType                              momentum     ,
+                          wba_planes<dType, Storage>&        planes       ,
+                          wba_planes<dType, Storage>&        deltas       ,
+                          LossScaler*                        scaler = 0   ) {
+
+    frnnError       error;
+    cublasHandle_t  handle     = context.blasHandle();
+    cudaStream_t    stream     = context.stream();
+    const size_t    nodes      = planes.nodes;
+    const size_t    batch_size = prev_acts.y();
+    const size_t    ld         = planes.leadingDimension();
+    const size_t    w_size     = planes.weights.size();
+    const size_t    b_size     = planes.biases.size();
+
+    if ( prev_acts.x() != num_inputs || planes.numInputs() != num_inputs ) {
+        frnn::err::dimError( error, stringify( prev_acts ), stringify( num_inputs ) );
+        return;
+    }
+    if ( errors.size() != nodes * batch_size ) {
+        frnn::err::dimError( error, stringify( errors ), stringify( prev_acts ) );
+        return;
+    }
+    if ( deltas.weights.size() != w_size || deltas.biases.size() != b_size ) {
+        frnn::err::dimError( error, stringify( deltas ), stringify( planes ) );
+        return;
+    }
+
+    // Scratch slots : 0 activations, 1 errors, 2 ones, 3 gradients (weights then biases), 4 - 7 the planes
+    const dType* acts_d      = deviceTensorGpu( error, context.scratch<dType>( error, 0, prev_acts.size() ), prev_acts, stream );
+    const dType* errors_d    = deviceTensorGpu( error, context.scratch<dType>( error, 1, errors.size() ), errors, stream );
+    dType*       ones_d      = context.scratch<dType>( error, 2, batch_size );
+    dType*       gradients_d = context.scratch<dType>( error, 3, w_size + b_size );
+    dType*       weights_d   = deviceTensorGpu( error, context.scratch<dType>( error, 4, w_size ), planes.weights, stream, true );
+    dType*       biases_d    = deviceTensorGpu( error, context.scratch<dType>( error, 5, b_size ), planes.biases, stream, true );
+    dType*       dw_d        = deviceTensorGpu( error, context.scratch<dType>( error, 6, w_size ), deltas.weights, stream, true );
+    dType*       db_d        = deviceTensorGpu( error, context.scratch<dType>( error, 7, b_size ), deltas.biases, stream, true );
+
+    if ( acts_d == 0 || errors_d == 0 || ones_d == 0 || gradients_d == 0 || weights_d == 0 || biases_d == 0 || 
+         dw_d == 0 || db_d == 0 ) return;
+
+    // The gemms only write the nodes rows of each column, the padding rows have no gradient
+    if ( cudaMemsetAsync( gradients_d, 0, ( w_size + b_size ) * sizeof( dType ), stream ) != cudaSuccess ) {
+        frnn::err::copyError( error, stringify( gradients_d ) );
+    }
+    FRNN_COUNT_LAUNCH();
+    fill<<<batch_size / THREADS_PER_BLOCK + 1, THREADS_PER_BLOCK, 0, stream>>>( ones_d, batch_size, dType( 1 ) );
+
+    cublasSetPointerMode( handle, CUBLAS_POINTER_MODE_HOST );
+    dType alpha = dType( 1 ) / static_cast<dType>( batch_size ); dType beta = 0;
+
+    // Weight gradient E * A^(T) / B and bias gradient E * 1 / B for each page (all pages get the same inputs)
+    frnn::blas::functions<dType>::gemmStridedBatched( 
+            handle      , CUBLAS_OP_N, CUBLAS_OP_T, nodes, num_inputs, batch_size, &alpha, 
+            errors_d    , nodes      , 0          ,
+            acts_d      , num_inputs , 0          , &beta, 
+            gradients_d , ld         , ld * num_inputs, planes.depth()                            );
+    frnn::blas::functions<dType>::gemmStridedBatched( 
+            handle      , CUBLAS_OP_N, CUBLAS_OP_N, nodes, 1, batch_size, &alpha, 
+            errors_d    , nodes      , 0          ,
+            ones_d      , batch_size , 0          , &beta, 
+            gradients_d + w_size, ld , ld         , planes.depth()                                );
+
+    typename frnn::accumulate_type<dType>::type scale;
+    gradientHookGpu( error, context, gradients_d, w_size + b_size );
+    if ( !lossScaleGpu( error, context, gradients_d, w_size + b_size, scaler, scale ) ) return;
+
+    size_t blocks = std::min( w_size / THREADS_PER_BLOCK + 1, static_cast<size_t>( MAX_BLOCKS ) );
+    FRNN_COUNT_LAUNCH();
+    updateWeights<<<blocks, THREADS_PER_BLOCK, 0, stream>>>( weights_d, dw_d, gradients_d, w_size, learning_rate, momentum, scale );
+    blocks = std::min( b_size / THREADS_PER_BLOCK + 1, static_cast<size_t>( MAX_BLOCKS ) );
+    FRNN_COUNT_LAUNCH();
+    updateWeights<<<blocks, THREADS_PER_BLOCK, 0, stream>>>( biases_d, db_d, gradients_d + w_size, b_size, learning_rate, momentum, scale );
+
+    if ( !Storage<dType>::on_device ) {
+        finishTensorGpu( error, dw_d, deltas.weights, stream );
+        finishTensorGpu( error, db_d, deltas.biases, stream );
+        finishTensorGpu( error, biases_d, planes.biases, stream );
+    }
+    finishTensorGpu( error, weights_d, planes.weights, stream );
 }
 
-}  // Namespace cpu
+}   // Namespace frnn
 
 #endif 
@@ -24,44 +24,144 @@
 #include <cuda.h>
 #include <cuda_runtime.h>
 
+#include "../../frnn/precision.h"
+#include "../../math/reduce_kernels_gpu.cuh"
+
 /*
  * ==========================================================================================================
  * Function         : updateWeights 
  * 
- * Description      : Updates the weights for a layer using the GPU. The update rule (amount to modify the
- *                    weight by) is first determined, and is then subtracted from the current value of the
- *                    weight.
+ * Description      : Updates the weights (and biases) for a layer using the GPU, with momentum. The update 
+ *                    for each weight is first determined from the update of the previous iteration and the
+ *                    gradient, and is then added to the current value of the weight. The update is stored so
+ *                    that it can be used for the next iteration. The arithmetic is done in the accumulate type
+ *                    (floats for the reduced precision types), and the gradients are multiplied by 
+ *                    gradient_scale first, which is the inverse of the loss scale when the loss is scaled.
  *                    
- * Inputs           : curr_wba      : A pointer to the current wba tensor 
- *                  : ces           : Current Error Start, which is the endex of the first error element in
- *                  :               : the curr_wba array
- *                  : num_errors    : The dimensionality of the erros (how many errors there are, which is the
- *                  :               : number of elements after ces till the last error element.
- *                  : prev_wba      : The previous wba tensor
- *                  : pas           : Previous Activation Start, which has the same meaning as ces but points
- *                  :               : to where the activations start
- *                  : num_acts      : The number of elements past pas that are activation elements
- *                  : prev_wba_delta: An array of the weight update values from the previous iteration
+ * Inputs           : N             : The number of elements in the wba tensor
+ *                  : gradients     : The gradient for each element of the wba tensor
  *                  : learn_rate    : The learning rate to use for the update
  *                  : momentum      : The amount of momentum to use for the update
+ *                  : gradient_scale: The factor to multiply the gradients by
+ *                  : skip          : A flag in device memory, the update is not done if it's set (checkFinite
+ *                                    sets it), or 0 to always do the update
+ *
+ * Outputs          : wba           : The wba tensor with the updated weights
+ *                  : wba_deltas    : The update of each element (for the next iteration)
+ *
+ * Params           : dType         : The type of data of the elements
  * ==========================================================================================================
  */
 template <typename dType>
-void updateWeights( dType* curr_wba       , size_t ces       , size_t num_errs,
-                    dType* prev_wba       , size_t pas       , size_t num_acts,
-                    dType* prev_wba_delta , dType learn_rate , dType momentum ) {
+__global__ void updateWeights( dType* wba, dType* wba_deltas, const dType* gradients, size_t N, 
+                               typename frnn::accumulate_type<dType>::type learn_rate, 
+                               typename frnn::accumulate_type<dType>::type momentum,
+                               typename frnn::accumulate_type<dType>::type gradient_scale = 1,
+                               const unsigned int*                         skip           = 0 ) {
+    typedef typename frnn::accumulate_type<dType>::type aType;
+    if ( skip != 0 && *skip != 0 ) return;
     
-    // Get thread index to use as weight index 
-    int idx = blockIdx.x * blockDim.x + threadIdx.x;
-    
-    // Determine the weight update (might need atomics)
-    dType prev_weight_update = prev_wba_delta[ idx ];
-    prev_wba_delta[ idx ] = ( momentum * prev_weight_update  ) -            // Momentum contribution
-                            ( learn_rate *                                  // Gradient descent
-                              curr_wba[ ces + ( idx % num_errs ) ] *        // This layers error      
-                              prev_wba[ pas + ( idx / num_acts ) ] );       // Prev layer activation
-    // Update the weight with the weight update
-    curr_wba[ idx ] += prev_weight_delts[ idx ];
+    for ( size_t idx = blockIdx.x * blockDim.x + threadIdx.x; idx < N; idx += blockDim.x * gridDim.x ) {
+        // Momentum contribution and gradient descent
+        const aType weight_delta = ( momentum * static_cast<aType>( wba_deltas[ idx ] ) ) - 
+                                   ( learn_rate * gradient_scale * static_cast<aType>( gradients[ idx ] ) );
+
+        wba_deltas[ idx ] = static_cast<dType>( weight_delta );
+        wba[ idx ]        = static_cast<dType>( static_cast<aType>( wba[ idx ] ) + weight_delta );
+    }
+}
+
+/*
+ * ==========================================================================================================
+ * Function         : checkFinite 
+ * 
+ * Description      : Sets a flag if any element of an array is inf or nan (the flag is only ever set, so it
+ *                    must be cleared before the check)
+ *                    
+ * Inputs           : x         : The array to check
+ *                  : N         : The number of elements in the array
+ *
+ * Outputs          : found     : A flag in device memory which is set if there is an element which isn't 
+ *                                finite
+ *
+ * Params           : dType     : The type of data of the elements
+ * ==========================================================================================================
+ */
+template <typename dType>
+__global__ void checkFinite( const dType* x, size_t N, unsigned int* found ) {
+    typedef typename frnn::accumulate_type<dType>::type aType;
+    for ( size_t idx = blockIdx.x * blockDim.x + threadIdx.x; idx < N; idx += blockDim.x * gridDim.x ) {
+        if ( !isfinite( static_cast<aType>( x[ idx ] ) ) ) *found = 1;
+    }
+}
+
+/*
+ * ==========================================================================================================
+ * Function         : xmy 
+ * 
+ * Description      : Performs X minus Y for two arrays X and Y 
+ *                    
+ * Inputs           : x         : The first array
+ *                  : y         : The second array
+ *                  : N         : The number of elements in the arrays
+ *
+ * Outputs          : result    : The result of X - Y
+ *
+ * Params           : dType     : The type of data of the elements
+ * ==========================================================================================================
+ */
+template <typename dType>
+__global__ void xmy( const dType* x, const dType* y, dType* result, size_t N ) {
+    for ( size_t idx = blockIdx.x * blockDim.x + threadIdx.x; idx < N; idx += blockDim.x * gridDim.x ) {
+        result[ idx ] = x[ idx ] - y[ idx ];
+    }
+}
+
+/*
+ * ==========================================================================================================
+ * Function         : sparseLogits 
+ * 
+ * Description      : Computes the logits of a softmax layer with weights in compressed sparse rows (see 
+ *                    sparse_wba.hpp), W * X + b for each column of X. Each row is done by a warp, whose lanes
+ *                    take every warpSize'th non zero weight of the row, so the loads of the values and the
+ *                    columns are coalesced, and the products are summed with shuffles. The row is used for 
+ *                    every sample while it's in the cache. The block size must be a multiple of the warp size.
+ *                    
+ * Inputs           : values        : The non zero weights, row by row
+ *                  : columns       : The column (input) of each value
+ *                  : row_offsets   : The first value of each row (nodes + 1 elements)
+ *                  : biases        : The bias of each node
+ *                  : ins           : The inputs (num_inputs x batch size), one sample per column
+ *                  : nodes         : The number of nodes (rows)
+ *                  : num_inputs    : The number of inputs
+ *                  : batch_size    : The number of samples
+ *
+ * Outputs          : logits        : The logits (nodes x batch size)
+ *
+ * Params           : dType         : The type of data of the elements
+ * ==========================================================================================================
+ */
+template <typename dType>
+__global__ void sparseLogits( const dType* values, const unsigned int* columns, const unsigned int* row_offsets, 
+                              const dType* biases, const dType* ins, size_t nodes, size_t num_inputs, 
+                              size_t batch_size, dType* logits ) {
+    typedef typename frnn::accumulate_type<dType>::type aType;
+    const unsigned int  lane  = threadIdx.x % warpSize;
+    const size_t        warps = ( static_cast<size_t>( blockDim.x ) * gridDim.x ) / warpSize;
+
+    // The loops are the same for every lane of a warp, so all the lanes do the shuffles
+    for ( size_t row = ( blockIdx.x * blockDim.x + threadIdx.x ) / warpSize; row < nodes; row += warps ) {
+        const unsigned int start = row_offsets[ row ], end = row_offsets[ row + 1 ];
+        for ( size_t b = 0; b < batch_size; b++ ) {
+            const dType* x   = ins + b * num_inputs;
+            aType        sum = 0;
+            for ( unsigned int k = start + lane; k < end; k += warpSize ) {
+                sum += static_cast<aType>( values[ k ] ) * static_cast<aType>( x[ columns[ k ] ] );
+            }
+            for ( int offset = warpSize / 2; offset > 0; offset /= 2 ) sum += shflXor( sum, offset );
+            if ( lane == 0 ) logits[ b * nodes + row ] = static_cast<dType>( sum + static_cast<aType>( biases[ row ] ) );
+        }
+    }
 }
 
 #endif
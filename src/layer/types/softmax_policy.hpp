@@ -25,8 +25,11 @@
 
 #include "../../tensor/tensor.cuh"
 #include "../../frnn/frnn.h"
+#include "../../frnn/gpu_context.cuh"
 #include "softmax_cpu_functions.hpp"
+#ifdef FRNN_WITH_CUDA
 #include "softmax_gpu_functions.cuh"
+#endif
 
 namespace frnn {
 namespace ltype {
@@ -59,6 +62,7 @@ template <typename          dType,
 class SoftmaxPolicy;
 
 /* ============================================== GPU Definitions ========================================  */
+#ifdef FRNN_WITH_CUDA
 
 template <typename          dType, 
           uint              nodes,
@@ -74,11 +78,15 @@ class SoftmaxPolicy<dType, frnn::device::GPU, nodes, inputs, depth> {
          * Description  : Constructor for the softmaxPolicy. Sets the tensor (wba) which holds the weights,
          *                biases, and activations (using the forst 2 dimensions of the tensor), and the number
          *                of inputs for the layer.
+         *
+         * Inputs       : gpu_context   : The GPU context which owns the handles and device memory used by the
+         *                                GPU functions of the layer (it must outlive the layer)
          * ==================================================================================================
          */
-        explicit SoftmaxPolicy() :
-            wba(nodes, std::max(inputs, nodes) + 2, depth, 1), num_inputs(inputs), errors(nodes, 0),
-            wba_prev(nodes, std::max(inputs, nodes) + 2, depth, 1) {}
+        explicit SoftmaxPolicy(GpuContext& gpu_context = GpuContext::global()) :
+            wba(nodes, std::max(inputs, nodes) + 2, depth, 1), num_inputs(inputs), errors(nodes, 1, 1, 1),
+            wba_prev(nodes, std::max(inputs, nodes) + 2, depth, 1), 
+            wba_deltas(nodes, std::max(inputs, nodes) + 2, depth, 1), context(&gpu_context) {}
 
         /*
          * ==================================================================================================
@@ -95,6 +103,23 @@ class SoftmaxPolicy<dType, frnn::device::GPU, nodes, inputs, depth> {
          */
         void forward(std::vector<dType>& ins, std::vector<dType>& outs);
 
+        /*
+         * ==================================================================================================
+         * Function     : forward (batched)
+         *
+         * Description  : Forward propogates a batch of inputs through the layer, with a single set of 
+         *                launches for the whole batch.
+         *
+         * Inputs       : ins   : The inputs to the layer (inputs x batch size), one sample per column
+         *
+         * Outputs      : outs  : The outputs of the layer (nodes x batch size), one sample per column
+         *
+         * Params       : Storage   : The storage policy of the input and output tensors
+         * ==================================================================================================
+         */
+        template <template <typename> class Storage>
+        void forward(const Tensor4<dType, Storage>& ins, Tensor4<dType, Storage>& outs);
+
         /*
          * ==================================================================================================
          * Function     : backward 
@@ -111,23 +136,68 @@ class SoftmaxPolicy<dType, frnn::device::GPU, nodes, inputs, depth> {
          */
         void backward(std::vector<dType>& outs, std::vector<dType>& targets);
 
+        /*
+         * ==================================================================================================
+         * Function     : backward (batched)
+         * 
+         * Description  : Backward propogates the errors for a batch through the layer
+         * 
+         * Inputs       : outs      : The outputs of the layer (nodes x batch size)
+         *              : targets   : The targets for each of the outputs (nodes x batch size)
+         *              
+         * Outputs      : The results are stored in the errors vector (one column per sample)
+         *
+         * Params       : Storage   : The storage policy of the tensors
+         * ==================================================================================================
+         */
+        template <template <typename> class Storage>
+        void backward(Tensor4<dType, Storage>& outs, Tensor4<dType, Storage>& targets);
+
         /* 
          * ==================================================================================================
          * Function     : updateWba 
          * 
-         * Description  : Updates the weights, biases and activations
+         * Description  : Updates the weights and biases with the errors from the last backward pass, which can 
+         *                be for a single sample or a batch (in which case the average gradient is used), using
+         *                gradient descent with momentum. The update is done on the device, and the wba and 
+         *                the updates (for the momentum) stay on the device between iterations.
          * 
-         * Inputs       : prevLayerActs   : The activations (outputs) of the nodes in the previous layer
+         * Inputs       : prev_layer_acts   : The activations (outputs) of the nodes in the previous layer, 
+         *                                    (inputs x batch size) with one sample per column
+         *              : learning_rate     : The learning rate for the update
+         *              : momentum          : The fraction of the previous update to add to this update
+         *
+         * Params       : Storage           : The storage policy of the activations tensor
          * ==================================================================================================
          */
-        void updateWba(const frnn::Tensor4<dType>& prevLayerActs);
+        template <template <typename> class Storage>
+        void updateWba(const frnn::Tensor4<dType, Storage>& prev_layer_acts, 
+                       dType learning_rate = dType(0.01), dType momentum = dType(0));
+
+        /*
+         * ==================================================================================================
+         * Function     : weightsPerPage
+         *
+         * Description  : Gets the number of weights at the start of each page of wba
+         * ==================================================================================================
+         */
+        static size_t weightsPerPage() { return nodes * std::max(nodes, inputs); }
         
+    public:
+        // The wba tensors stay on the device between calls, so the weights are only 
+        // copied to the device when they are changed on the host
+        typedef Tensor4<dType, storage::Device> wba_type;
+        typedef Tensor4<dType, storage::Device> errors_type;
+
     protected:
-        Tensor4<dType>      wba;             // Tensor for weights, biases, and activations
-        Tensor4<dType>      wba_prev;        // Tensor for weights, biases, and activations from the previous timestep
-        std::vector<dType>  errors;          // Errors for the layer
+        wba_type            wba;             // Tensor for weights, biases, and activations
+        wba_type            wba_prev;        // Tensor for weights, biases, and activations from the previous timestep
+        wba_type            wba_deltas;      // Updates of the wba from the last update (for momentum)
+        errors_type         errors;          // Errors for the layer (one column per sample)
         uint                num_inputs;      // Number of inputs for the layer
+        GpuContext*         context;         // GPU context for the GPU functions
 };
+#endif
 
 /* =============================================== CPU Definitions ======================================== */
 
@@ -145,11 +215,15 @@ class SoftmaxPolicy<dType, frnn::device::CPU, nodes, inputs, depth> {
          * Description  : Constructor for the softmaxPolicy. Sets the tensor (wba) which holds the weights,
          *                biases, and activations (using the forst 2 dimensions of the tensor), and the number
          *                of inputs for the layer.
+         *
+         * Inputs       : gpu_context   : The GPU context of the layer, which the CPU functions don't use (it is
+         *                                kept so that the CPU and GPU layers are created the same way)
          * ==================================================================================================
          */
-        explicit SoftmaxPolicy() :
-            wba(nodes, std::max(inputs, nodes) + 2, depth, 1), num_inputs(inputs), errors(nodes, 0),
-            wba_prev(nodes, std::max(inputs, nodes) + 2, depth, 1) {}
+        explicit SoftmaxPolicy(GpuContext& gpu_context = GpuContext::global()) :
+            wba(nodes, std::max(inputs, nodes) + 2, depth, 1), num_inputs(inputs), errors(nodes, 1, 1, 1),
+            wba_prev(nodes, std::max(inputs, nodes) + 2, depth, 1), 
+            wba_deltas(nodes, std::max(inputs, nodes) + 2, depth, 1), context(&gpu_context) {}
 
         /*
          * ==================================================================================================
@@ -166,6 +240,23 @@ class SoftmaxPolicy<dType, frnn::device::CPU, nodes, inputs, depth> {
          */
         void forward(std::vector<dType>& ins, std::vector<dType>& outs);
 
+        /*
+         * ==================================================================================================
+         * Function     : forward (batched)
+         *
+         * Description  : Forward propogates a batch of inputs through the layer, with a gemm for each page
+         *                for the whole batch.
+         *
+         * Inputs       : ins   : The inputs to the layer (inputs x batch size), one sample per column
+         *
+         * Outputs      : outs  : The outputs of the layer (nodes x batch size), one sample per column
+         *
+         * Params       : Storage   : The storage policy of the input and output tensors
+         * ==================================================================================================
+         */
+        template <template <typename> class Storage>
+        void forward(const Tensor4<dType, Storage>& ins, Tensor4<dType, Storage>& outs);
+
         /*
          * ==================================================================================================
          * Function     : backward 
@@ -182,31 +273,73 @@ class SoftmaxPolicy<dType, frnn::device::CPU, nodes, inputs, depth> {
          */
         void backward(std::vector<dType>& outs, std::vector<dType>&targets);
 
+        /*
+         * ==================================================================================================
+         * Function     : backward (batched)
+         * 
+         * Description  : Backward propogates the errors for a batch through the layer
+         * 
+         * Inputs       : outs      : The outputs of the layer (nodes x batch size)
+         *              : targets   : The targets for each of the outputs (nodes x batch size)
+         *              
+         * Outputs      : The results are stored in the errors vector (one column per sample)
+         *
+         * Params       : Storage   : The storage policy of the tensors
+         * ==================================================================================================
+         */
+        template <template <typename> class Storage>
+        void backward(Tensor4<dType, Storage>& outs, Tensor4<dType, Storage>& targets);
+
         /* 
          * ==================================================================================================
          * Function     : updateWba 
          * 
-         * Description  : Updates the weights, biases and activations
+         * Description  : Updates the weights and biases with the errors from the last backward pass, which can 
+         *                be for a single sample or a batch (in which case the average gradient is used), using
+         *                gradient descent with momentum.
          * 
-         * Inputs       : prevLayerActs   : The activations (outputs) of the nodes in the previous layer
+         * Inputs       : prev_layer_acts   : The activations (outputs) of the nodes in the previous layer, 
+         *                                    (inputs x batch size) with one sample per column
+         *              : learning_rate     : The learning rate for the update
+         *              : momentum          : The fraction of the previous update to add to this update
+         *
+         * Params       : Storage           : The storage policy of the activations tensor
+         * ==================================================================================================
+         */
+        template <template <typename> class Storage>
+        void updateWba(const frnn::Tensor4<dType, Storage>& prev_layer_acts, 
+                       dType learning_rate = dType(0.01), dType momentum = dType(0));
+
+        /*
+         * ==================================================================================================
+         * Function     : weightsPerPage
+         *
+         * Description  : Gets the number of weights at the start of each page of wba
          * ==================================================================================================
          */
-        void updateWba(const frnn::Tensor4<dType>& prevLayerActs);
+        static size_t weightsPerPage() { return nodes * std::max(nodes, inputs); }
         
+    public:
+        typedef Tensor4<dType> wba_type;
+        typedef Tensor4<dType> errors_type;
+
     protected:
-        Tensor4<dType>      wba;             // Tensor for weights, biases, and activations
-        Tensor4<dType>      wba_prev;        // Tensor for weights, biases, and activations from the previous timestep
-        std::vector<dType>  errors;          // Errors for the layer
+        wba_type            wba;             // Tensor for weights, biases, and activations
+        wba_type            wba_prev;        // Tensor for weights, biases, and activations from the previous timestep
+        wba_type            wba_deltas;      // Updates of the wba from the last update (for momentum)
+        errors_type         errors;          // Errors for the layer (one column per sample)
         uint                num_inputs;      // Number of inputs for the layer
+        GpuContext*         context;         // GPU context (unused by the CPU functions)
 };
 
 /* ======================================= GPU IMPLEMENTATIONS ============================================ */
+#ifdef FRNN_WITH_CUDA
 
 template <typename dType, uint nds, uint ipts, uint dth>
 void SoftmaxPolicy<dType, device::GPU, nds, ipts, dth>::forward (
         std::vector<dType>& ins, std::vector<dType>& outs) {
     // Call softmax forward gpu version 
-    softmaxForwardGpu(ins, wba, num_inputs, outs);
+    softmaxForwardGpu(*context, ins, wba, num_inputs, outs);
 }
 
 template <typename dType, uint nds, uint ipts, uint dth>
@@ -214,36 +347,69 @@ void SoftmaxPolicy<dType, device::GPU, nds, ipts, dth>::backward(
         std::vector<dType>& outs, std::vector<dType>& targets) {
     // Even though this is the GPU version, 
     // the CPU version is faster, so use that
-    softmaxBackwardCpu(outs, targets, errors);
+    errors.reshape(outs.size(), 1, 1, 1);
+    softmaxBackwardCpu(outs, targets, errors.getData());
+}
+
+template <typename dType, uint nds, uint ipts, uint dth>
+template <template <typename> class Storage>
+void SoftmaxPolicy<dType, device::GPU, nds, ipts, dth>::forward(
+        const Tensor4<dType, Storage>& ins, Tensor4<dType, Storage>& outs) {
+    softmaxForwardBatchedGpu(*context, ins, wba, num_inputs, outs);
+}
+
+template <typename dType, uint nds, uint ipts, uint dth>
+template <template <typename> class Storage>
+void SoftmaxPolicy<dType, device::GPU, nds, ipts, dth>::backward(
+        Tensor4<dType, Storage>& outs, Tensor4<dType, Storage>& targets) {
+    // Errors are found on the device if the outputs are on the device
+    softmaxBackwardGpu(*context, outs, targets, errors);
 }
 
-// NOT DONE
 template <typename dType, uint nds, uint ipts, uint dth>
+template <template <typename> class Storage>
 void SoftmaxPolicy<dType, device::GPU, nds, ipts, dth>::updateWba( 
-        const frnn::Tensor4<dType>& prev_layer_acts) {
+        const frnn::Tensor4<dType, Storage>& prev_layer_acts, dType learning_rate, dType momentum) {
+    softmaxUpdateWbaGpu(*context, prev_layer_acts, errors, num_inputs, learning_rate, momentum, wba, wba_deltas);
 }
+#endif
 
 /* ======================================= CPU IMPLEMENTATIONS  =========================================== */
 
-// NOT DONE
 template <typename dType, uint nds, uint ipts, uint dth>
 void SoftmaxPolicy<dType, device::CPU, nds, ipts, dth>::forward( 
         std::vector<dType>& ins, std::vector<dType>& outs) {
-    // CPU implementation not done yet, use gpu
-    softmaxForwardGpu(ins, wba, num_inputs, outs);
+    softmaxForwardCpu(ins, wba, num_inputs, outs);
 }
 
 template <typename dType, uint nds, uint ipts, uint dth>
 void SoftmaxPolicy<dType, device::CPU, nds, ipts, dth>::backward( 
         std::vector<dType>& outs, std::vector<dType>& targets) {
     // Call softmax backward cpu kernel
-    softmaxBackwardCpu(outs, targets, errors);
+    errors.reshape(outs.size(), 1, 1, 1);
+    softmaxBackwardCpu(outs, targets, errors.getData());
+}
+
+template <typename dType, uint nds, uint ipts, uint dth>
+template <template <typename> class Storage>
+void SoftmaxPolicy<dType, device::CPU, nds, ipts, dth>::forward( 
+        const Tensor4<dType, Storage>& ins, Tensor4<dType, Storage>& outs) {
+    softmaxForwardBatchedCpu(ins, wba, num_inputs, outs);
+}
+
+template <typename dType, uint nds, uint ipts, uint dth>
+template <template <typename> class Storage>
+void SoftmaxPolicy<dType, device::CPU, nds, ipts, dth>::backward( 
+        Tensor4<dType, Storage>& outs, Tensor4<dType, Storage>& targets) {
+    errors.reshape(outs.x(), outs.y(), 1, 1);
+    softmaxBackwardCpu(outs.getData(), targets.getData(), errors.getData());
 }
 
-// NOT DONE
 template <typename dType, uint nds, uint ipts, uint dth>
+template <template <typename> class Storage>
 void SoftmaxPolicy<dType, device::CPU, nds, ipts, dth>::updateWba( 
-        const frnn::Tensor4<dType>& prev_layer_acts) {
+        const frnn::Tensor4<dType, Storage>& prev_layer_acts, dType learning_rate, dType momentum) {
+    softmaxUpdateWbaCpu(prev_layer_acts, errors, num_inputs, learning_rate, momentum, wba, wba_deltas);
 }
 
 }   // Namepsace ltype
@@ -0,0 +1,305 @@
+/*
+ *  Header file for fastRNN sparse softmax policy class, a softmax layer whose
+ *  forward pass uses the pruned weights in compressed sparse rows.
+ *
+ *  Copyright (C) 2015 Rob Clucas robclu1818@gmail.com
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published
+ *  by the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program; if not, write to the Free Software Foundation,
+ *  Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#ifndef _FRNN_SPARSE_SOFTMAX_POLICY_
+#define _FRNN_SPARSE_SOFTMAX_POLICY_
+
+#include <vector>
+
+#include "../../tensor/tensor.cuh"
+#include "../../frnn/frnn.h"
+#include "../../frnn/gpu_context.cuh"
+#include "sparse_wba.hpp"
+#include "softmax_cpu_functions.hpp"
+#ifdef FRNN_WITH_CUDA
+#include "softmax_gpu_functions.cuh"
+#endif
+
+/* ============================================= NOTES ======================================================
+ *
+ * 1. The layer keeps the packed wba (in dType) as the parameters, and a sparse copy of the weights (see
+ *    sparse_wba.hpp) which the forward passes use. The copy is made by loadWba, which the layer calls when
+ *    the weights are initialized or loaded, and which must be called after the wba is changed in any other
+ *    way. prune zeros the weights of smallest magnitude and makes the copy again, so a trained layer is
+ *    pruned and then used for inference with prune( 0.9 ) for a layer with 10% of its weights.
+ *
+ * 2. The backward pass and the update are those of a SoftmaxPolicy layer, on the packed wba, after which the
+ *    pattern of the sparse weights is applied to the wba (so the pruned weights stay zero) and the copy is
+ *    made again. So a pruned layer can be fine tuned, but the copy is made on the host for each update, so
+ *    the layer is meant for inference.
+ *
+ * ==========================================================================================================
+ */
+
+namespace frnn {
+namespace ltype {
+
+/*
+ * ==========================================================================================================
+ * Class        : SparseSoftmaxPolicy
+ *
+ * Desription   : Policy class for a softmax layer with a sparse forward pass (see NOTES 1 - 2)
+ *
+ * Params       : dType     : The type of data for the network
+ *              : device    : The device type to use (CPU or GPU)
+ *              : nodes     : The number of nodes for the layer
+ *              : inputs    : The number of inputs to the layer
+ *              : depth     : The number of different inputs in the layer (almost always 1 for softmax)
+ * ==========================================================================================================
+ */
+template <typename          dType,
+         frnn::device       dev,
+         uint               nodes,
+         uint               inputs,
+         uint               depth>
+class SparseSoftmaxPolicy;
+
+/* ============================================== GPU Definitions ========================================  */
+#ifdef FRNN_WITH_CUDA
+
+template <typename          dType,
+          uint              nodes,
+          uint              inputs,
+          uint              depth>
+class SparseSoftmaxPolicy<dType, frnn::device::GPU, nodes, inputs, depth> {
+
+    public:
+        // The wba and the sparse weights stay on the device between calls
+        typedef Tensor4<dType, storage::Device>         wba_type;
+        typedef Tensor4<dType, storage::Device>         errors_type;
+        typedef sparse_wba<dType, storage::Device>      sparse_type;
+
+        /*
+         * ==================================================================================================
+         * Function     : SparseSoftmaxPolicy
+         *
+         * Description  : Constructor for the policy, which compresses the (zero) weights
+         *
+         * Inputs       : gpu_context   : The GPU context which owns the handles and device memory used by the
+         *                                GPU functions of the layer (it must outlive the layer)
+         * ==================================================================================================
+         */
+        explicit SparseSoftmaxPolicy(GpuContext& gpu_context = GpuContext::global()) :
+            wba(nodes, std::max(inputs, nodes) + 2, depth, 1),
+            wba_deltas(nodes, std::max(inputs, nodes) + 2, depth, 1), errors(nodes, 1, 1, 1),
+            num_inputs(inputs), context(&gpu_context) { loadWba(); }
+
+        inline const sparse_type& getSparse() const { return sparse; }
+
+        void loadWba() { sparse.compress(static_cast<const wba_type&>(wba), num_inputs); }
+
+        /*
+         * ==================================================================================================
+         * Function     : prune
+         *
+         * Description  : Zeros the weights whose sum over the pages has the smallest magnitude and compresses
+         *                the weights which are left (see NOTES 1)
+         *
+         * Inputs       : sparsity  : The fraction of the weights of the sum of the pages to zero, in [0, 1]
+         *
+         * Outputs      : The number of weights of the wba which are zero
+         * ==================================================================================================
+         */
+        size_t prune(float sparsity) {
+            const size_t zeros = pruneWba(wba, num_inputs, sparsity);
+            loadWba();
+            return zeros;
+        }
+
+        // See SoftmaxPolicy for the forward, backward and update functions
+        void forward(std::vector<dType>& ins, std::vector<dType>& outs);
+
+        template <template <typename> class Storage>
+        void forward(const Tensor4<dType, Storage>& ins, Tensor4<dType, Storage>& outs);
+
+        void backward(std::vector<dType>& outs, std::vector<dType>& targets);
+
+        template <template <typename> class Storage>
+        void backward(Tensor4<dType, Storage>& outs, Tensor4<dType, Storage>& targets);
+
+        template <template <typename> class Storage>
+        void updateWba(const frnn::Tensor4<dType, Storage>& prev_layer_acts,
+                       dType learning_rate = dType(0.01), dType momentum = dType(0));
+
+        static size_t weightsPerPage() { return nodes * std::max(nodes, inputs); }
+
+    protected:
+        wba_type            wba;             // Weights, biases and activations (dense)
+        wba_type            wba_deltas;      // Updates of the wba from the last update (for momentum)
+        sparse_type         sparse;          // Sparse weights and biases for the forward passes
+        errors_type         errors;          // Errors for the layer (one column per sample)
+        uint                num_inputs;      // Number of inputs for the layer
+        GpuContext*         context;         // GPU context for the GPU functions
+};
+#endif
+
+/* =============================================== CPU Definitions ======================================== */
+
+template <typename          dType,
+          uint              nodes,
+          uint              inputs,
+          uint              depth>
+class SparseSoftmaxPolicy<dType, frnn::device::CPU, nodes, inputs, depth> {
+
+    public:
+        typedef Tensor4<dType>                      wba_type;
+        typedef Tensor4<dType>                      errors_type;
+        typedef sparse_wba<dType, storage::Host>    sparse_type;
+
+        /*
+         * ==================================================================================================
+         * Function     : SparseSoftmaxPolicy
+         *
+         * Description  : Constructor for the policy, which compresses the (zero) weights
+         *
+         * Inputs       : gpu_context   : The GPU context of the layer, which the CPU functions don't use (it is
+         *                                kept so that the CPU and GPU layers are created the same way)
+         * ==================================================================================================
+         */
+        explicit SparseSoftmaxPolicy(GpuContext& gpu_context = GpuContext::global()) :
+            wba(nodes, std::max(inputs, nodes) + 2, depth, 1),
+            wba_deltas(nodes, std::max(inputs, nodes) + 2, depth, 1), errors(nodes, 1, 1, 1),
+            num_inputs(inputs), context(&gpu_context) { loadWba(); }
+
+        inline const sparse_type& getSparse() const { return sparse; }
+
+        void loadWba() { sparse.compress(static_cast<const wba_type&>(wba), num_inputs); }
+
+        size_t prune(float sparsity) {
+            const size_t zeros = pruneWba(wba, num_inputs, sparsity);
+            loadWba();
+            return zeros;
+        }
+
+        void forward(std::vector<dType>& ins, std::vector<dType>& outs);
+
+        template <template <typename> class Storage>
+        void forward(const Tensor4<dType, Storage>& ins, Tensor4<dType, Storage>& outs);
+
+        void backward(std::vector<dType>& outs, std::vector<dType>& targets);
+
+        template <template <typename> class Storage>
+        void backward(Tensor4<dType, Storage>& outs, Tensor4<dType, Storage>& targets);
+
+        template <template <typename> class Storage>
+        void updateWba(const frnn::Tensor4<dType, Storage>& prev_layer_acts,
+                       dType learning_rate = dType(0.01), dType momentum = dType(0));
+
+        static size_t weightsPerPage() { return nodes * std::max(nodes, inputs); }
+
+    protected:
+        wba_type            wba;             // Weights, biases and activations (dense)
+        wba_type            wba_deltas;      // Updates of the wba from the last update (for momentum)
+        sparse_type         sparse;          // Sparse weights and biases for the forward passes
+        errors_type         errors;          // Errors for the layer (one column per sample)
+        uint                num_inputs;      // Number of inputs for the layer
+        GpuContext*         context;         // GPU context (unused by the CPU functions)
+};
+
+/* ======================================= GPU IMPLEMENTATIONS ============================================ */
+#ifdef FRNN_WITH_CUDA
+
+template <typename dType, uint nds, uint ipts, uint dth>
+void SparseSoftmaxPolicy<dType, device::GPU, nds, ipts, dth>::forward(
+        std::vector<dType>& ins, std::vector<dType>& outs) {
+    // A batch of one sample, so that the sparse weights are used by the batched kernels
+    Tensor4<dType> ins_t(ins.size(), 1, 1, 1), outs_t;
+    ins_t.getData().assign(ins.begin(), ins.end());
+    softmaxForwardBatchedGpu(*context, static_cast<const Tensor4<dType>&>(ins_t),
+                             static_cast<const sparse_type&>(sparse), num_inputs, outs_t);
+
+    if (outs.size() < outs_t.size()) outs.resize(outs_t.size(), 0);
+    std::copy(outs_t.getData().begin(), outs_t.getData().end(), outs.begin());
+}
+
+template <typename dType, uint nds, uint ipts, uint dth>
+template <template <typename> class Storage>
+void SparseSoftmaxPolicy<dType, device::GPU, nds, ipts, dth>::forward(
+        const Tensor4<dType, Storage>& ins, Tensor4<dType, Storage>& outs) {
+    softmaxForwardBatchedGpu(*context, ins, static_cast<const sparse_type&>(sparse), num_inputs, outs);
+}
+
+template <typename dType, uint nds, uint ipts, uint dth>
+void SparseSoftmaxPolicy<dType, device::GPU, nds, ipts, dth>::backward(
+        std::vector<dType>& outs, std::vector<dType>& targets) {
+    errors.reshape(outs.size(), 1, 1, 1);
+    softmaxBackwardCpu(outs, targets, errors.getData());
+}
+
+template <typename dType, uint nds, uint ipts, uint dth>
+template <template <typename> class Storage>
+void SparseSoftmaxPolicy<dType, device::GPU, nds, ipts, dth>::backward(
+        Tensor4<dType, Storage>& outs, Tensor4<dType, Storage>& targets) {
+    softmaxBackwardGpu(*context, outs, targets, errors);
+}
+
+template <typename dType, uint nds, uint ipts, uint dth>
+template <template <typename> class Storage>
+void SparseSoftmaxPolicy<dType, device::GPU, nds, ipts, dth>::updateWba(
+        const frnn::Tensor4<dType, Storage>& prev_layer_acts, dType learning_rate, dType momentum) {
+    softmaxUpdateWbaGpu(*context, prev_layer_acts, errors, num_inputs, learning_rate, momentum, wba, wba_deltas);
+    sparse.mask(wba, num_inputs);
+    loadWba();
+}
+#endif
+
+/* ======================================= CPU IMPLEMENTATIONS  =========================================== */
+
+template <typename dType, uint nds, uint ipts, uint dth>
+void SparseSoftmaxPolicy<dType, device::CPU, nds, ipts, dth>::forward(
+        std::vector<dType>& ins, std::vector<dType>& outs) {
+    softmaxForwardCpu(ins, sparse, num_inputs, outs);
+}
+
+template <typename dType, uint nds, uint ipts, uint dth>
+template <template <typename> class Storage>
+void SparseSoftmaxPolicy<dType, device::CPU, nds, ipts, dth>::forward(
+        const Tensor4<dType, Storage>& ins, Tensor4<dType, Storage>& outs) {
+    softmaxForwardBatchedCpu(ins, sparse, num_inputs, outs);
+}
+
+template <typename dType, uint nds, uint ipts, uint dth>
+void SparseSoftmaxPolicy<dType, device::CPU, nds, ipts, dth>::backward(
+        std::vector<dType>& outs, std::vector<dType>& targets) {
+    errors.reshape(outs.size(), 1, 1, 1);
+    softmaxBackwardCpu(outs, targets, errors.getData());
+}
+
+template <typename dType, uint nds, uint ipts, uint dth>
+template <template <typename> class Storage>
+void SparseSoftmaxPolicy<dType, device::CPU, nds, ipts, dth>::backward(
+        Tensor4<dType, Storage>& outs, Tensor4<dType, Storage>& targets) {
+    errors.reshape(outs.x(), outs.y(), 1, 1);
+    softmaxBackwardCpu(outs.getData(), targets.getData(), errors.getData());
+}
+
+template <typename dType, uint nds, uint ipts, uint dth>
+template <template <typename> class Storage>
+void SparseSoftmaxPolicy<dType, device::CPU, nds, ipts, dth>::updateWba(
+        const frnn::Tensor4<dType, Storage>& prev_layer_acts, dType learning_rate, dType momentum) {
+    softmaxUpdateWbaCpu(prev_layer_acts, errors, num_inputs, learning_rate, momentum, wba, wba_deltas);
+    sparse.mask(wba, num_inputs);
+    loadWba();
+}
+
+}   // Namepsace ltype
+}   // Namepsace frnn
+#endif
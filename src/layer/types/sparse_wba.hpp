@@ -0,0 +1,243 @@
+/*
+ *  Header file for the fastRNN sparse wba, which stores the weights of a
+ *  pruned layer in compressed sparse rows, and the magnitude pruning of the
+ *  weights of a wba.
+ *
+ *  Copyright (C) 2015 Rob Clucas robclu1818@gmail.com
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published
+ *  by the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program; if not, write to the Free Software Foundation,
+ *  Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#ifndef _FRNN_SPARSE_WBA_
+#define _FRNN_SPARSE_WBA_
+
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+#include "../../tensor/tensor.cuh"
+#include "../../util/errors.h"
+
+/* ============================================= NOTES ======================================================
+ *
+ * 1. All the pages of a softmax layer get the same inputs, so sum over pages ( W_p * x ) = ( sum over pages
+ *    W_p ) * x, and the sparse wba is the sum of the weights of the pages, in compressed sparse rows (CSR).
+ *    Row n is the weights of node n : the values and the columns (the inputs) of its non zero weights are
+ *    elements row_offsets[ n ] to row_offsets[ n + 1 ] of values and columns, with the columns in order. So
+ *    the memory of the weights, and the bandwidth of a forward pass, is proportional to the number of non
+ *    zero weights rather than nodes x inputs (x pages), which is what matters for big output layers.
+ *
+ * 2. The biases are kept in dType, summed over the pages, as for the quantized wba.
+ *
+ * 3. The values and the columns have at least one element (which is unused for a layer without any non
+ *    zero weights), so that device tensors of them always have a buffer.
+ *
+ * 4. pruneWba zeros the weights of a packed wba whose sum over the pages has the smallest magnitude
+ *    (magnitude pruning of the weights which compress stores), in every page, so a layer can be pruned after
+ *    (or during) training and then compressed, and the sparse wba has a fraction 1 - sparsity of the weights
+ *    for any number of pages. Pruning each page on its own would give a union of the patterns of the pages
+ *    after the sum. The pattern of a sparse wba (the weights it has for each node) can be applied to a
+ *    packed wba with mask, which keeps the pruned weights at zero when the packed wba is updated.
+ *
+ * ==========================================================================================================
+ */
+
+namespace frnn {
+
+/*
+ * ==========================================================================================================
+ * Function     : pruneWba
+ *
+ * Description  : Zeros the weights of a packed wba (in every page) whose sum over the pages has the smallest
+ *                magnitude (see NOTES 4), so that a fraction sparsity of the weights of the sum of the pages
+ *                are zero. The biases aren't changed.
+ *
+ * Inputs       : wba           : The packed weights, biases and activations
+ *              : num_inputs    : The number of inputs of the layer
+ *              : sparsity      : The fraction of the weights of the sum of the pages to zero, in [0, 1]
+ *
+ * Outputs      : The number of weights (of all the pages) which are zero after the pruning
+ *
+ * Params       : dType         : The type of data of the wba
+ *              : Storage       : The storage policy of the wba
+ * ==========================================================================================================
+ */
+template <typename dType, template <typename> class Storage>
+size_t pruneWba( Tensor4<dType, Storage>& wba, uint num_inputs, float sparsity ) {
+    frnnError error;
+    if ( wba.y() < num_inputs || sparsity < 0.f || sparsity > 1.f ) {
+        frnn::err::dimError( error, stringify( wba ), stringify( sparsity ) );
+        return 0;
+    }
+
+    const size_t        nodes     = wba.x();
+    const size_t        weights   = nodes * num_inputs;
+    const size_t        pruned    = static_cast<size_t>( std::floor( sparsity * weights ) );
+    dType*              wba_h     = &wba.getData()[ 0 ];
+    std::vector<double> summed( weights, 0.0 );
+    std::vector<size_t> order( weights );
+    size_t              zeros     = 0;
+
+    // The weights of a page are its first num_inputs columns, which are contiguous (column major), so
+    // element i of each page is the same weight
+    for ( uint page = 0; page < wba.z(); page++ ) {
+        const dType* page_h = wba_h + wba.index( 0, 0, page, 0 );
+        for ( size_t i = 0; i < weights; i++ ) summed[ i ] += static_cast<double>( page_h[ i ] );
+    }
+    for ( size_t i = 0; i < weights; i++ ) order[ i ] = i;
+
+    std::nth_element( order.begin(), order.begin() + pruned, order.end(), [&summed]( size_t a, size_t b ) {
+        return std::abs( summed[ a ] ) < std::abs( summed[ b ] );
+    } );
+    for ( uint page = 0; page < wba.z(); page++ ) {
+        dType* page_h = wba_h + wba.index( 0, 0, page, 0 );
+        for ( size_t i = 0; i < pruned; i++ ) page_h[ order[ i ] ] = dType( 0 );
+        for ( size_t i = 0; i < weights; i++ ) zeros += page_h[ i ] == dType( 0 ) ? 1 : 0;
+    }
+    return zeros;
+}
+
+/*
+ * ==========================================================================================================
+ * Struct       : sparse_wba
+ *
+ * Description  : The weights of a layer (summed over the pages) in compressed sparse rows, and the biases
+ *                (see NOTES 1 - 4)
+ *
+ * Params       : dType     : The type of data of the weights and the biases
+ *              : Storage   : The storage policy of the tensors
+ * ==========================================================================================================
+ */
+template <typename dType, template <typename> class Storage>
+struct sparse_wba {
+    Tensor4<dType, Storage> values;         // The non zero weights, row by row
+    Tensor4<uint , Storage> columns;        // The column (input) of each value
+    Tensor4<uint , Storage> row_offsets;    // The first value of each row, and the number of values at the end
+    Tensor4<dType, Storage> biases;         // The sum of the biases of the pages for each node
+    uint                    nodes;          // The number of nodes of the layer
+    uint                    inputs;         // The number of inputs of the layer
+    size_t                  non_zeros;      // The number of non zero weights
+
+    sparse_wba() : nodes( 0 ), inputs( 0 ), non_zeros( 0 ) {}
+
+    // The fraction of the weights (of the sum of the pages) which are stored
+    inline double density() const {
+        return nodes * inputs == 0 ? 0.0 : static_cast<double>( non_zeros ) / ( static_cast<double>( nodes ) * inputs );
+    }
+
+    /*
+     * ======================================================================================================
+     * Function     : compress
+     *
+     * Description  : Sets the sparse weights and the biases from a packed wba tensor, keeping the weights of
+     *                the sum of the pages which aren't zero
+     *
+     * Inputs       : wba           : The packed weights, biases and activations
+     *              : num_inputs    : The number of inputs of the layer
+     *
+     * Params       : WbaStorage    : The storage policy of the packed tensor
+     * ======================================================================================================
+     */
+    template <template <typename> class WbaStorage>
+    void compress( const Tensor4<dType, WbaStorage>& wba, uint num_inputs ) {
+        frnnError error;
+        if ( wba.y() < num_inputs + 2 ) {
+            frnn::err::dimError( error, stringify( wba ), stringify( num_inputs ) );
+            return;
+        }
+
+        nodes  = wba.x();
+        inputs = num_inputs;
+
+        // The rows are the columns of the packed weights, so the sum of the pages is made first
+        const dType*        wba_h = &wba.hostData()[ 0 ];
+        std::vector<dType>  summed( static_cast<size_t>( nodes ) * num_inputs, dType( 0 ) );
+        std::vector<dType>  bias_sums( nodes, dType( 0 ) );
+        for ( uint page = 0; page < wba.z(); page++ ) {
+            for ( uint col = 0; col < num_inputs; col++ ) {
+                for ( uint node = 0; node < nodes; node++ ) {
+                    summed[ static_cast<size_t>( node ) * num_inputs + col ] += wba_h[ wba.index( node, col, page, 0 ) ];
+                }
+            }
+            for ( uint node = 0; node < nodes; node++ ) bias_sums[ node ] += wba_h[ wba.index( node, num_inputs, page, 0 ) ];
+        }
+
+        non_zeros = 0;
+        for ( size_t i = 0; i < summed.size(); i++ ) non_zeros += summed[ i ] != dType( 0 ) ? 1 : 0;
+
+        values.reshape( std::max( non_zeros, size_t( 1 ) ), 1, 1, 1 );
+        columns.reshape( std::max( non_zeros, size_t( 1 ) ), 1, 1, 1 );
+        row_offsets.reshape( nodes + 1, 1, 1, 1 );
+        biases.reshape( nodes, 1, 1, 1 );
+
+        auto& values_h  = values.getData();
+        auto& columns_h = columns.getData();
+        auto& offsets_h = row_offsets.getData();
+        size_t next = 0;
+        for ( uint node = 0; node < nodes; node++ ) {
+            offsets_h[ node ] = static_cast<uint>( next );
+            for ( uint col = 0; col < num_inputs; col++ ) {
+                const dType weight = summed[ static_cast<size_t>( node ) * num_inputs + col ];
+                if ( weight == dType( 0 ) ) continue;
+                values_h[ next ]  = weight;
+                columns_h[ next ] = col;
+                next++;
+            }
+        }
+        offsets_h[ nodes ] = static_cast<uint>( next );
+        std::copy( bias_sums.begin(), bias_sums.end(), biases.getData().begin() );
+    }
+
+    /*
+     * ======================================================================================================
+     * Function     : mask
+     *
+     * Description  : Zeros the weights of a packed wba (of every page) which aren't in the pattern of the
+     *                sparse weights, so that pruned weights stay pruned after an update (see NOTES 4)
+     *
+     * Inputs       : num_inputs    : The number of inputs of the layer
+     *
+     * Outputs      : wba           : The packed weights, biases and activations
+     *
+     * Params       : WbaStorage    : The storage policy of the packed tensor
+     * ======================================================================================================
+     */
+    template <template <typename> class WbaStorage>
+    void mask( Tensor4<dType, WbaStorage>& wba, uint num_inputs ) const {
+        frnnError error;
+        if ( wba.x() != nodes || num_inputs != inputs ) {
+            frnn::err::dimError( error, stringify( wba ), stringify( nodes ) );
+            return;
+        }
+
+        const auto&         columns_h = columns.hostData();
+        const auto&         offsets_h = row_offsets.hostData();
+        dType*              wba_h     = &wba.getData()[ 0 ];
+        std::vector<char>   kept( num_inputs );
+        for ( uint node = 0; node < nodes; node++ ) {
+            std::fill( kept.begin(), kept.end(), 0 );
+            for ( uint k = offsets_h[ node ]; k < offsets_h[ node + 1 ]; k++ ) kept[ columns_h[ k ] ] = 1;
+            for ( uint page = 0; page < wba.z(); page++ ) {
+                for ( uint col = 0; col < num_inputs; col++ ) {
+                    if ( !kept[ col ] ) wba_h[ wba.index( node, col, page, 0 ) ] = dType( 0 );
+                }
+            }
+        }
+    }
+};
+
+}   // Namespace frnn
+
+#endif
@@ -0,0 +1,190 @@
+/*
+ *  Header file for the fastRNN wba planes, which store the weights, biases
+ *  and activations of a layer in separate tensors with a padded leading
+ *  dimension, rather than packed into the pages of a single tensor.
+ *
+ *  Copyright (C) 2015 Rob Clucas robclu1818@gmail.com
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published
+ *  by the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program; if not, write to the Free Software Foundation,
+ *  Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#ifndef _FRNN_WBA_PLANES_
+#define _FRNN_WBA_PLANES_
+
+#include <algorithm>
+
+#include "../../tensor/tensor.cuh"
+#include "../../util/errors.h"
+
+/* ============================================= NOTES ======================================================
+ *
+ * 1. The packed wba of a layer is a nodes x ( max( inputs, nodes ) + 2 ) x depth tensor, with the weights in
+ *    the first inputs columns of each page, then the biases and the activations. So when there are more
+ *    nodes than inputs ( nodes - inputs ) columns of each page are never used, and the columns of the
+ *    weights are nodes elements apart, which is only aligned for some numbers of nodes.
+ *
+ * 2. The planes are three tensors, the weights ( ld x inputs x depth ), the biases ( ld x 1 x depth ) and the
+ *    activations ( ld x 1 x depth ), where the leading dimension ld is the number of nodes rounded up so that
+ *    each column is a multiple of the alignment (128 bytes by default, the size of a global memory
+ *    transaction). So every column of every plane starts on an aligned boundary (the tensors themselves are
+ *    aligned by the allocators) and the gemms can use ld as the leading dimension. The padding rows are 0,
+ *    and are never read by the gemms (which only use nodes rows).
+ *
+ * ==========================================================================================================
+ */
+
+namespace frnn {
+
+const size_t WBA_PLANE_ALIGNMENT = 128;                 // Bytes, the default alignment of a column of a plane
+
+/*
+ * ==========================================================================================================
+ * Function     : alignedLeadingDimension
+ *
+ * Description  : Gets the number of nodes rounded up so that a column of nodes elements is a multiple of
+ *                alignment bytes (an alignment which is 0 or smaller than an element gives no padding)
+ *
+ * Inputs       : nodes     : The number of nodes (the rows of a plane)
+ *              : alignment : The alignment (in bytes) of each column
+ *
+ * Params       : dType     : The type of the elements
+ * ==========================================================================================================
+ */
+template <typename dType>
+inline size_t alignedLeadingDimension( size_t nodes, size_t alignment = WBA_PLANE_ALIGNMENT ) {
+    const size_t per_column = alignment / sizeof( dType );
+    if ( per_column <= 1 ) return nodes;
+    return ( ( nodes + per_column - 1 ) / per_column ) * per_column;
+}
+
+/*
+ * ==========================================================================================================
+ * Struct       : wba_planes
+ *
+ * Description  : The weights, biases and activations of a layer as separate planes with a padded leading
+ *                dimension (see NOTES 2)
+ *
+ * Params       : dType     : The type of data of the planes
+ *              : Storage   : The storage policy of the plane tensors
+ * ==========================================================================================================
+ */
+template <typename dType, template <typename> class Storage>
+struct wba_planes {
+    Tensor4<dType, Storage>     weights;        // ld x inputs x depth
+    Tensor4<dType, Storage>     biases;         // ld x 1 x depth
+    Tensor4<dType, Storage>     activations;    // ld x 1 x depth
+    uint                        nodes;          // The rows of each plane which are used
+
+    wba_planes() : nodes( 0 ) {}
+
+    inline uint leadingDimension() const { return weights.x(); }
+    inline uint numInputs() const { return weights.y(); }
+    inline uint depth() const { return weights.z(); }
+
+    /*
+     * ======================================================================================================
+     * Function     : reshape
+     *
+     * Description  : Sets the size of the planes and sets all the elements to 0
+     *
+     * Inputs       : num_nodes     : The number of nodes of the layer
+     *              : num_inputs    : The number of inputs of the layer
+     *              : num_pages     : The depth of the layer
+     *              : ld            : The leading dimension of the planes (at least num_nodes)
+     * ======================================================================================================
+     */
+    void reshape( uint num_nodes, uint num_inputs, uint num_pages, uint ld ) {
+        nodes = num_nodes;
+        weights.reshape( ld, num_inputs, num_pages, 1 );
+        biases.reshape( ld, 1, num_pages, 1 );
+        activations.reshape( ld, 1, num_pages, 1 );
+        std::fill( weights.getData().begin()    , weights.getData().end()    , dType( 0 ) );
+        std::fill( biases.getData().begin()     , biases.getData().end()     , dType( 0 ) );
+        std::fill( activations.getData().begin(), activations.getData().end(), dType( 0 ) );
+    }
+
+    /*
+     * ======================================================================================================
+     * Function     : load
+     *
+     * Description  : Sets the planes from a packed wba tensor (see NOTES 1), which must be for the same
+     *                number of nodes, inputs and pages
+     *
+     * Inputs       : wba   : The packed weights, biases and activations
+     *
+     * Params       : WbaStorage    : The storage policy of the packed tensor
+     * ======================================================================================================
+     */
+    template <template <typename> class WbaStorage>
+    void load( const Tensor4<dType, WbaStorage>& wba ) {
+        frnnError error;
+        if ( wba.x() != nodes || wba.y() < numInputs() + 2 || wba.z() != depth() ) {
+            frnn::err::dimError( error, stringify( wba ), stringify( weights ) );
+            return;
+        }
+
+        const dType* wba_h  = &wba.hostData()[ 0 ];
+        dType*       w_h    = &weights.getData()[ 0 ];
+        dType*       b_h    = &biases.getData()[ 0 ];
+        dType*       a_h    = &activations.getData()[ 0 ];
+        const size_t ld     = leadingDimension();
+        for ( uint page = 0; page < depth(); page++ ) {
+            for ( uint col = 0; col < numInputs(); col++ ) {
+                const dType* column = wba_h + wba.index( 0, col, page, 0 );
+                std::copy( column, column + nodes, w_h + ld * ( col + numInputs() * page ) );
+            }
+            const dType* bias = wba_h + wba.index( 0, numInputs(), page, 0 );
+            std::copy( bias, bias + nodes, b_h + ld * page );
+            std::copy( bias + nodes, bias + 2 * nodes, a_h + ld * page );
+        }
+    }
+
+    /*
+     * ======================================================================================================
+     * Function     : pack
+     *
+     * Description  : Packs the planes into a wba tensor (see NOTES 1), the columns which aren't part of the
+     *                planes are 0
+     *
+     * Outputs      : wba   : The packed weights, biases and activations
+     *
+     * Params       : WbaStorage    : The storage policy of the packed tensor
+     * ======================================================================================================
+     */
+    template <template <typename> class WbaStorage>
+    void pack( Tensor4<dType, WbaStorage>& wba ) const {
+        const uint cols = std::max( numInputs(), nodes ) + 2;
+        if ( wba.x() != nodes || wba.y() != cols || wba.z() != depth() ) wba.reshape( nodes, cols, depth(), 1 );
+
+        dType*       wba_h = &wba.getData()[ 0 ];
+        const dType* w_h   = &weights.hostData()[ 0 ];
+        const dType* b_h   = &biases.hostData()[ 0 ];
+        const dType* a_h   = &activations.hostData()[ 0 ];
+        const size_t ld    = leadingDimension();
+        std::fill( wba_h, wba_h + wba.size(), dType( 0 ) );
+        for ( uint page = 0; page < depth(); page++ ) {
+            for ( uint col = 0; col < numInputs(); col++ ) {
+                const dType* column = w_h + ld * ( col + numInputs() * page );
+                std::copy( column, column + nodes, wba_h + wba.index( 0, col, page, 0 ) );
+            }
+            std::copy( b_h + ld * page, b_h + ld * page + nodes, wba_h + wba.index( 0, numInputs()    , page, 0 ) );
+            std::copy( a_h + ld * page, a_h + ld * page + nodes, wba_h + wba.index( 0, numInputs() + 1, page, 0 ) );
+        }
+    }
+};
+
+}   // Namespace frnn
+
+#endif
@@ -26,6 +26,8 @@
 #include <cuda_runtime.h>
 #include <cublas_v2.h>
 
+#include "../../frnn/precision.h"
+
 /*
  * ========================================= NOTES ==========================================================
  * 1. The functions in this namespace are simply 'wrappers' that allow the cublas functions to be called in
@@ -62,6 +64,20 @@ template <> struct functions<float> {
                                       int             , float*  , int                           );
     static constexpr fpaxpy axpy = &cublasSaxpy;
 
+    // Matrix matrix multiplication
+    typedef cublasStatus_t (*fpgemm)( cublasHandle_t  , cublasOperation_t  , cublasOperation_t  , int          ,
+                                      int             , int                , const float*       , const float* ,
+                                      int             , const float*       , int                , const float* ,
+                                      float*          , int                                                    );
+    static constexpr fpgemm gemm = &cublasSgemm;
+
+    // Batched matrix matrix multiplication, where the matrices of each batch are a constant stride apart
+    typedef cublasStatus_t (*fpgemmsb)( cublasHandle_t  , cublasOperation_t  , cublasOperation_t  , int          ,
+                                        int             , int                , const float*       , const float* ,
+                                        int             , long long int      , const float*       , int          ,
+                                        long long int   , const float*       , float*             , int          ,
+                                        long long int   , int                                                    );
+    static constexpr fpgemmsb gemmStridedBatched = &cublasSgemmStridedBatched;
 };
 
 // Partial specification for double precision cublas functions
@@ -77,8 +93,81 @@ template <> struct functions<double> {
     typedef cublasStatus_t (*fpaxpy)( cublasHandle_t  , int     , const double*  , const double*    ,
                                       int             , double* , int                               );
     static constexpr fpaxpy axpy = &cublasDaxpy;
+
+    // Matrix matrix multiplication
+    typedef cublasStatus_t (*fpgemm)( cublasHandle_t  , cublasOperation_t  , cublasOperation_t  , int           ,
+                                      int             , int                , const double*      , const double* ,
+                                      int             , const double*      , int                , const double* ,
+                                      double*         , int                                                     );
+    static constexpr fpgemm gemm = &cublasDgemm;
+
+    // Batched matrix matrix multiplication, where the matrices of each batch are a constant stride apart
+    typedef cublasStatus_t (*fpgemmsb)( cublasHandle_t  , cublasOperation_t  , cublasOperation_t  , int           ,
+                                        int             , int                , const double*      , const double* ,
+                                        int             , long long int      , const double*      , int           ,
+                                        long long int   , const double*      , double*            , int           ,
+                                        long long int   , int                                                     );
+    static constexpr fpgemmsb gemmStridedBatched = &cublasDgemmStridedBatched;
+};
+
+/*
+ * ==========================================================================================================
+ * Structs      : reducedPrecision, functions<__half>, functions<__nv_bfloat16>
+ *
+ * Description  : The cublas functions for the reduced precision types (see precision.h), which are the Ex
+ *                versions of the functions with float computation (on the tensor cores where the device has
+ *                them). The scalars are given as the storage type, like the other specializations, and are
+ *                converted to floats. cublas has no gemv for these types, so gemv is a gemm with a single
+ *                column (the vectors must then be contiguous).
+ *
+ * Params       : dType     : The reduced precision type
+ * ==========================================================================================================
+ */
+#if CUDART_VERSION >= 11000
+template <typename dType> struct reducedPrecision {
+
+    static cublasStatus_t gemm( cublasHandle_t handle, cublasOperation_t op_a, cublasOperation_t op_b, int m, 
+                                int n, int k, const dType* alpha, const dType* A, int lda, const dType* B, int ldb,
+                                const dType* beta, dType* C, int ldc ) {
+        const float alpha_f = static_cast<float>( *alpha ), beta_f = static_cast<float>( *beta );
+        return cublasGemmEx( handle, op_a, op_b, m, n, k, &alpha_f, A, frnn::cuda_data_type<dType>::value, lda,
+                             B, frnn::cuda_data_type<dType>::value, ldb, &beta_f, C, frnn::cuda_data_type<dType>::value,
+                             ldc, CUBLAS_COMPUTE_32F, CUBLAS_GEMM_DEFAULT_TENSOR_OP );
+    }
+
+    static cublasStatus_t gemmStridedBatched( cublasHandle_t handle, cublasOperation_t op_a, cublasOperation_t op_b,
+                                              int m, int n, int k, const dType* alpha, const dType* A, int lda, 
+                                              long long int stride_a, const dType* B, int ldb, long long int stride_b,
+                                              const dType* beta, dType* C, int ldc, long long int stride_c, 
+                                              int batch_count ) {
+        const float alpha_f = static_cast<float>( *alpha ), beta_f = static_cast<float>( *beta );
+        return cublasGemmStridedBatchedEx( 
+                handle, op_a, op_b, m, n, k, &alpha_f, A, frnn::cuda_data_type<dType>::value, lda, stride_a, 
+                B, frnn::cuda_data_type<dType>::value, ldb, stride_b, &beta_f, C, frnn::cuda_data_type<dType>::value,
+                ldc, stride_c, batch_count, CUBLAS_COMPUTE_32F, CUBLAS_GEMM_DEFAULT_TENSOR_OP );
+    }
+
+    static cublasStatus_t gemv( cublasHandle_t handle, cublasOperation_t op, int m, int n, const dType* alpha, 
+                                const dType* A, int lda, const dType* x, int incx, const dType* beta, dType* y, 
+                                int incy ) {
+        if ( incx != 1 || incy != 1 ) return CUBLAS_STATUS_NOT_SUPPORTED;
+        const int rows  = op == CUBLAS_OP_N ? m : n;
+        const int inner = op == CUBLAS_OP_N ? n : m;
+        return gemm( handle, op, CUBLAS_OP_N, rows, 1, inner, alpha, A, lda, x, inner, beta, y, rows );
+    }
+
+    static cublasStatus_t axpy( cublasHandle_t handle, int n, const dType* alpha, const dType* x, int incx, 
+                                dType* y, int incy ) {
+        const float alpha_f = static_cast<float>( *alpha );
+        return cublasAxpyEx( handle, n, &alpha_f, CUDA_R_32F, x, frnn::cuda_data_type<dType>::value, incx, 
+                             y, frnn::cuda_data_type<dType>::value, incy, CUDA_R_32F );
+    }
 };
 
+template <> struct functions<__half> : reducedPrecision<__half> {};
+template <> struct functions<__nv_bfloat16> : reducedPrecision<__nv_bfloat16> {};
+#endif
+
 }
 }
 
@@ -0,0 +1,266 @@
+/*
+ *  Header file for fastRNN CPU blas functions. The functions call a CPU BLAS
+ *  library (OpenBLAS, MKL or BLIS, chosen when the library is built) through
+ *  the CBLAS interface, or the threaded and vectorized fallback versions when
+ *  the library is built without a CPU BLAS library.
+ *
+ *  Copyright (C) 2015 Rob Clucas robclu1818@gmail.com
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published
+ *  by the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT AN_size.y WARRANTY; without even the implied warranty of
+ *  MERCHANTABILIT_size.y or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program; if not, write to the Free Software Foundation,
+ *  Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#ifndef _FRNN_BLAS_CPU_
+#define _FRNN_BLAS_CPU_
+
+#include <algorithm>
+#include <vector>
+
+#include "../math_kernels_cpu.h"
+
+// The CPU BLAS library is chosen with a define (-DFRNN_CPU_BLAS_OPENBLAS for example) and must be linked
+// (-lopenblas, -lmkl_rt or -lblis), all of them provide the CBLAS interface
+#if defined( FRNN_CPU_BLAS_MKL )
+    #include <mkl_cblas.h>
+    #define FRNN_CPU_CBLAS
+#elif defined( FRNN_CPU_BLAS_OPENBLAS ) || defined( FRNN_CPU_BLAS_BLIS )
+    #include <cblas.h>
+    #define FRNN_CPU_CBLAS
+#endif
+
+/*
+ * ========================================= NOTES ==========================================================
+ * 1. All the matrices are column major (the same as cuBLAS and the wba tensors), and the arguments are the
+ *    same as the cuBLAS functions (without the handle, and the vectors are contiguous).
+ *
+ * 2. The fallback versions are threaded with OpenMP (when it is enabled) over columns, so that each thread
+ *    writes to different elements of the result and the results don't depend on the number of threads.
+ *    They are for when a BLAS library isn't available, the BLAS libraries are much faster for big matrices.
+ * ==========================================================================================================
+ */
+
+namespace frnn {
+namespace blas {
+namespace cpu  {
+
+// Operation on a matrix argument
+enum operation { OP_N, OP_T };
+
+// Min number of multiply-adds for the fallback functions to use more than one thread
+const size_t PARALLEL_MIN_OPS = 1 << 16;
+
+// Number of rows of C which are updated at a time by the fallback gemm, so that they stay in L1
+const size_t GEMM_ROW_BLOCK   = 1024;
+
+/*
+ * ==========================================================================================================
+ * Function     : scaleResultCpu
+ *
+ * Description  : Scales the result of a gemv or gemm by beta, when beta is 0 the result is set to 0 (so
+ *                that NaNs in the result are not kept, which is the same as BLAS)
+ *
+ * Inputs       : beta      : The constant to scale the result by
+ *              : y         : The result to scale
+ *              : N         : The number of elements in the result
+ *
+ * Params       : dType     : The type of data in the result
+ * ==========================================================================================================
+ */
+template <typename dType>
+inline void scaleResultCpu( dType beta, dType* y, size_t N ) {
+    if ( beta == dType( 0 ) )       std::fill( y, y + N, dType( 0 ) );
+    else if ( beta != dType( 1 ) )  frnn::cpu::KernelCpu<frnn::cpu::scaleKernel,
+                                                         frnn::cpu::VectorizedCpu<dType>::value>::run( beta, y, N );
+}
+
+/*
+ * ==========================================================================================================
+ * Function     : gemvFallbackCpu
+ *
+ * Description  : Computes y = alpha * op( A ) * x + beta * y, where A is an (M x N) matrix. Without the
+ *                transpose each thread computes a block of rows of y as a sum of scaled columns of A, and
+ *                with the transpose each element of y is the dot product of a column of A and x.
+ *
+ * Inputs       : op        : The operation on A
+ *              : M         : The number of rows of A
+ *              : N         : The number of columns of A
+ *              : alpha     : The constant to multiply op( A ) * x by
+ *              : A         : The matrix
+ *              : lda       : The leading dimension of A
+ *              : x         : The vector to multiply with op( A )
+ *              : beta      : The constant to multiply y by
+ *              : y         : The vector to add to
+ *
+ * Outputs      : y         : The result of alpha * op( A ) * x + beta * y
+ *
+ * Params       : dType     : The type of data for the computation
+ * ==========================================================================================================
+ */
+template <typename dType>
+void gemvFallbackCpu( operation op, int M, int N, dType alpha, const dType* A, int lda,
+                      const dType* x, dType beta, dType* y ) {
+    typedef frnn::cpu::KernelCpu<frnn::cpu::axpyKernel, frnn::cpu::VectorizedCpu<dType>::value> axpy;
+    typedef frnn::cpu::KernelCpu<frnn::cpu::dotKernel , frnn::cpu::VectorizedCpu<dType>::value> dot;
+
+    const bool parallel = static_cast<size_t>( M ) * N >= PARALLEL_MIN_OPS;
+
+    if ( op == OP_N ) {
+        const int blocks = ( M + GEMM_ROW_BLOCK - 1 ) / GEMM_ROW_BLOCK;
+        #pragma omp parallel for if ( parallel )
+        for ( int block = 0; block < blocks; block++ ) {
+            const int first = block * GEMM_ROW_BLOCK;
+            const int rows  = std::min( static_cast<int>( GEMM_ROW_BLOCK ), M - first );
+            scaleResultCpu( beta, y + first, rows );
+            for ( int j = 0; j < N; j++ ) {
+                axpy::run( alpha * x[ j ], A + first + static_cast<size_t>( j ) * lda, y + first, static_cast<size_t>( rows ) );
+            }
+        }
+    } else {
+        #pragma omp parallel for if ( parallel )
+        for ( int j = 0; j < N; j++ ) {
+            dType result = alpha * dot::run( A + static_cast<size_t>( j ) * lda, x, static_cast<size_t>( M ) );
+            y[ j ] = beta == dType( 0 ) ? result : result + beta * y[ j ];
+        }
+    }
+}
+
+/*
+ * ==========================================================================================================
+ * Function     : gemmFallbackCpu
+ *
+ * Description  : Computes C = alpha * op( A ) * op( B ) + beta * C, where op( A ) is (M x K), op( B ) is
+ *                (K x N) and C is (M x N). Each thread computes whole columns of C, as a sum of scaled
+ *                columns of A (or dot products of the columns of A when A is transposed), with the rows of
+ *                C done in blocks which stay in L1. Columns of op( B ) for a transposed B are first copied
+ *                into a contiguous buffer for the thread.
+ *
+ * Inputs       : op_a      : The operation on A
+ *              : op_b      : The operation on B
+ *              : M         : The number of rows of op( A ) and C
+ *              : N         : The number of columns of op( B ) and C
+ *              : K         : The number of columns of op( A ) and rows of op( B )
+ *              : alpha     : The constant to multiply op( A ) * op( B ) by
+ *              : A         : The first matrix
+ *              : lda       : The leading dimension of A
+ *              : B         : The second matrix
+ *              : ldb       : The leading dimension of B
+ *              : beta      : The constant to multiply C by
+ *              : C         : The matrix to add to
+ *              : ldc       : The leading dimension of C
+ *
+ * Outputs      : C         : The result of alpha * op( A ) * op( B ) + beta * C
+ *
+ * Params       : dType     : The type of data for the computation
+ * ==========================================================================================================
+ */
+template <typename dType>
+void gemmFallbackCpu( operation op_a, operation op_b, int M, int N, int K, dType alpha,
+                      const dType* A, int lda, const dType* B, int ldb, dType beta, dType* C, int ldc ) {
+    typedef frnn::cpu::KernelCpu<frnn::cpu::axpyKernel, frnn::cpu::VectorizedCpu<dType>::value> axpy;
+    typedef frnn::cpu::KernelCpu<frnn::cpu::dotKernel , frnn::cpu::VectorizedCpu<dType>::value> dot;
+
+    const bool parallel = static_cast<size_t>( M ) * N * K >= PARALLEL_MIN_OPS;
+
+    #pragma omp parallel if ( parallel )
+    {
+        std::vector<dType> b_column( op_b == OP_T ? K : 0 );
+
+        #pragma omp for
+        for ( int j = 0; j < N; j++ ) {
+            dType*       c_j = C + static_cast<size_t>( j ) * ldc;
+            const dType* b_j = B + static_cast<size_t>( j ) * ldb;
+
+            // Column j of op( B ) is row j of B
+            if ( op_b == OP_T ) {
+                for ( int k = 0; k < K; k++ ) b_column[ k ] = B[ j + static_cast<size_t>( k ) * ldb ];
+                b_j = b_column.data();
+            }
+
+            if ( op_a == OP_N ) {
+                for ( int first = 0; first < M; first += GEMM_ROW_BLOCK ) {
+                    const size_t rows = std::min( static_cast<int>( GEMM_ROW_BLOCK ), M - first );
+                    scaleResultCpu( beta, c_j + first, rows );
+                    for ( int k = 0; k < K; k++ ) {
+                        axpy::run( alpha * b_j[ k ], A + first + static_cast<size_t>( k ) * lda, c_j + first, rows );
+                    }
+                }
+            } else {
+                for ( int i = 0; i < M; i++ ) {
+                    dType result = alpha * dot::run( A + static_cast<size_t>( i ) * lda, b_j, static_cast<size_t>( K ) );
+                    c_j[ i ] = beta == dType( 0 ) ? result : result + beta * c_j[ i ];
+                }
+            }
+        }
+    }
+}
+
+/*
+ * ==========================================================================================================
+ * Struct       : functions
+ *
+ * Description  : Struct that holds the CPU blas functions for a type, which are the fallback versions for
+ *                types which the BLAS library doesn't have (and for all types without a BLAS library)
+ *
+ * Params       : dType     : The type of data the function must use
+ * ==========================================================================================================
+ */
+template <typename dType> struct functions {
+    static inline void gemv( operation op, int M, int N, dType alpha, const dType* A, int lda,
+                             const dType* x, dType beta, dType* y ) {
+        gemvFallbackCpu( op, M, N, alpha, A, lda, x, beta, y );
+    }
+
+    static inline void gemm( operation op_a, operation op_b, int M, int N, int K, dType alpha,
+                             const dType* A, int lda, const dType* B, int ldb, dType beta, dType* C, int ldc ) {
+        gemmFallbackCpu( op_a, op_b, M, N, K, alpha, A, lda, B, ldb, beta, C, ldc );
+    }
+};
+
+#ifdef FRNN_CPU_CBLAS
+inline CBLAS_TRANSPOSE cblasOperation( operation op ) { return op == OP_N ? CblasNoTrans : CblasTrans; }
+
+// Single precision BLAS library functions
+template <> struct functions<float> {
+    static inline void gemv( operation op, int M, int N, float alpha, const float* A, int lda,
+                             const float* x, float beta, float* y ) {
+        cblas_sgemv( CblasColMajor, cblasOperation( op ), M, N, alpha, A, lda, x, 1, beta, y, 1 );
+    }
+
+    static inline void gemm( operation op_a, operation op_b, int M, int N, int K, float alpha,
+                             const float* A, int lda, const float* B, int ldb, float beta, float* C, int ldc ) {
+        cblas_sgemm( CblasColMajor, cblasOperation( op_a ), cblasOperation( op_b ), M, N, K,
+                     alpha, A, lda, B, ldb, beta, C, ldc );
+    }
+};
+
+// Double precision BLAS library functions
+template <> struct functions<double> {
+    static inline void gemv( operation op, int M, int N, double alpha, const double* A, int lda,
+                             const double* x, double beta, double* y ) {
+        cblas_dgemv( CblasColMajor, cblasOperation( op ), M, N, alpha, A, lda, x, 1, beta, y, 1 );
+    }
+
+    static inline void gemm( operation op_a, operation op_b, int M, int N, int K, double alpha,
+                             const double* A, int lda, const double* B, int ldb, double beta, double* C, int ldc ) {
+        cblas_dgemm( CblasColMajor, cblasOperation( op_a ), cblasOperation( op_b ), M, N, K,
+                     alpha, A, lda, B, ldb, beta, C, ldc );
+    }
+};
+#endif
+
+}   // Namespace cpu
+}   // Namespace blas
+}   // Namespace frnn
+
+#endif
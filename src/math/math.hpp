@@ -27,8 +27,13 @@
 #include <vector>
 
 #include "../frnn/types.h"
+#include "../frnn/gpu_context.cuh"
+#include "../tensor/tensor.cuh"
 #include "math_cpu.hpp"
+#ifdef FRNN_WITH_CUDA
 #include "math_gpu.hpp"
+#include "math_auto.hpp"
+#endif
 
 namespace frnn {
  
@@ -53,35 +58,129 @@ template <typename dType> struct math<dType, frnn::device::CPU> {
     static constexpr x_minus_y_cpu xmy = &xmyCpu;
     
     // Rand function
-    typedef void (*rand_cpu)( dType*, size_t, dType, dType );
+    typedef void (*rand_cpu)( dType*, size_t, dType, dType, unsigned long long, unsigned long long );
     static constexpr rand_cpu rand = &randCpu; 
-
+    
+    // a*X plus Y function 
+    typedef void (*ax_plus_y_cpu)( frnnError&, const dType a, const std::vector<dType>&, std::vector<dType>& );
+    static constexpr ax_plus_y_cpu axpy = &axpyCpu;
+    
+    // Softmax function
+    typedef void (*softmax_cpu)( frnnError&, const std::vector<dType>&, std::vector<dType>& );
+    static constexpr softmax_cpu softmax = &softmaxCpu;
+    
+    // Sum function
+    typedef dType (*sum_cpu)( frnnError&, const std::vector<dType>& );
+    static constexpr sum_cpu sum = &sumCpu;
+    
+    // Sum vectorized function
+    typedef void (*sum_vectorized_cpu)( frnnError&, const std::vector<dType>&, std::vector<dType>& );
+    static constexpr sum_vectorized_cpu sumVectorized = &sumVectorizedCpu;
+    
+    // Elementwise sum of the columns of a matrix
+    typedef void (*sum_vectors_cpu)( frnnError&, const dType*, size_t, size_t, size_t, dType* );
+    static constexpr sum_vectors_cpu sumVectors = &sumVectorsCpu;
+    
+    // Matrix vector multiplication (column major, with the CPU BLAS library)
+    typedef void (*gemv_cpu)( blas::cpu::operation, int, int, dType, const dType*, int, const dType*, 
+                              dType, dType* );
+    static constexpr gemv_cpu gemv = &gemvCpu;
+    
+    // Matrix matrix multiplication (column major, with the CPU BLAS library)
+    typedef void (*gemm_cpu)( blas::cpu::operation, blas::cpu::operation, int, int, int, dType, const dType*, 
+                              int, const dType*, int, dType, dType*, int );
+    static constexpr gemm_cpu gemm = &gemmCpu;
 };
 
-// Specify for GPU
+#ifdef FRNN_WITH_CUDA
+// Specify for GPU (each function takes the GpuContext which owns the handles and scratch memory to use)
 template <typename dType> struct math<dType, frnn::device::GPU> {
     
     // a*X plus Y function 
-    typedef void (*ax_plus_y_gpu)( frnnError&, const dType a, const std::vector<dType>&, std::vector<dType>& );
+    typedef void (*ax_plus_y_gpu)( frnnError&, GpuContext&, const dType a, const std::vector<dType>&, 
+                                   std::vector<dType>& );
     static constexpr ax_plus_y_gpu axpy = &axpyGpu;
   
     // Rand function
-    typedef void (*rand_gpu)( dType*, size_t, dType, dType );
+    typedef void (*rand_gpu)( GpuContext&, dType*, size_t, dType, dType, unsigned long long, unsigned long long );
     static constexpr rand_gpu rand = &randGpu; 
     
     // Softmax fucntion 
-    typedef void (*softmax_gpu)( frnnError&, const std::vector<dType>&, std::vector<dType>& );
+    typedef void (*softmax_gpu)( frnnError&, GpuContext&, const std::vector<dType>&, std::vector<dType>& );
     static constexpr softmax_gpu softmax = &softmaxGpu;
     
     // Sum function
-    typedef dType (*sum_gpu)( frnnError&, const std::vector<dType>& );
+    typedef dType (*sum_gpu)( frnnError&, GpuContext&, const std::vector<dType>& );
     static constexpr sum_gpu sum = &sumGpu;
     
+    // Max, min and argmax functions
+    typedef dType (*max_gpu)( frnnError&, GpuContext&, const std::vector<dType>& );
+    static constexpr max_gpu max = &maxGpu;
+    static constexpr max_gpu min = &minGpu;
+
+    typedef size_t (*argmax_gpu)( frnnError&, GpuContext&, const std::vector<dType>& );
+    static constexpr argmax_gpu argmax = &argmaxGpu;
+    
     // Sum vectorized function
-    typedef void (*sum_vectorized_gpu)( frnnError&, const std::vector<dType>&, std::vector<dType>&);
+    typedef void (*sum_vectorized_gpu)( frnnError&, GpuContext&, const std::vector<dType>&, std::vector<dType>&);
     static constexpr sum_vectorized_gpu sumVectorized = &sumVectorizedGpu;
+
+    // Elementwise sum of the columns of a matrix in device memory
+    typedef void (*sum_vectors_gpu)( frnnError&, GpuContext&, const dType*, size_t, size_t, size_t, dType* );
+    static constexpr sum_vectors_gpu sumVectors = &sumVectorsGpu;
+
+    // Versions for tensors which are stored on the device, these don't copy any data between the host and the 
+    // device and don't wait for the GPU, so they can be chained (host data is copied when it's read)
+    typedef Tensor4<dType, storage::Device> device_tensor;
+
+    typedef void (*ax_plus_y_device_gpu)( frnnError&, GpuContext&, const dType a, const device_tensor&, 
+                                          device_tensor& );
+    static constexpr ax_plus_y_device_gpu axpyDevice = &axpyGpu;
+
+    typedef void (*softmax_device_gpu)( frnnError&, GpuContext&, const device_tensor&, device_tensor& );
+    static constexpr softmax_device_gpu softmaxDevice = &softmaxGpu;
+
+    typedef void (*sum_vectorized_device_gpu)( frnnError&, GpuContext&, const device_tensor&, device_tensor& );
+    static constexpr sum_vectorized_device_gpu sumVectorizedDevice = &sumVectorizedGpu;
+
+    typedef void (*rand_device_gpu)( GpuContext&, device_tensor&, dType, dType, unsigned long long, 
+                                     unsigned long long );
+    static constexpr rand_device_gpu randDevice = &randGpu;
+};
+
+// Specify for choosing the device at runtime, each function is run on the device with the smallest time for 
+// the size of its inputs and where they are (see device_dispatcher.cuh), with the process wide GPU context
+template <typename dType> struct math<dType, frnn::device::AUTO> {
+    
+    // a*X plus Y function 
+    typedef void (*ax_plus_y_auto)( frnnError&, const dType a, const std::vector<dType>&, std::vector<dType>& );
+    static constexpr ax_plus_y_auto axpy = &axpyAuto;
+    
+    // Softmax function
+    typedef void (*softmax_auto)( frnnError&, const std::vector<dType>&, std::vector<dType>& );
+    static constexpr softmax_auto softmax = &softmaxAuto;
     
+    // Sum function
+    typedef dType (*sum_auto)( frnnError&, const std::vector<dType>& );
+    static constexpr sum_auto sum = &sumAuto;
+    
+    // Sum vectorized function
+    typedef void (*sum_vectorized_auto)( frnnError&, const std::vector<dType>&, std::vector<dType>& );
+    static constexpr sum_vectorized_auto sumVectorized = &sumVectorizedAuto;
+    
+    // Versions for tensors which are stored on the device, which stay on the device if the GPU is used
+    typedef Tensor4<dType, storage::Device> device_tensor;
+
+    typedef void (*ax_plus_y_device_auto)( frnnError&, const dType a, const device_tensor&, device_tensor& );
+    static constexpr ax_plus_y_device_auto axpyDevice = &axpyAuto;
+
+    typedef void (*softmax_device_auto)( frnnError&, const device_tensor&, device_tensor& );
+    static constexpr softmax_device_auto softmaxDevice = &softmaxAuto;
+
+    typedef void (*sum_vectorized_device_auto)( frnnError&, const device_tensor&, device_tensor& );
+    static constexpr sum_vectorized_device_auto sumVectorizedDevice = &sumVectorizedAuto;
 };
+#endif
 
 }
 #endif 
@@ -0,0 +1,194 @@
+/*
+ *  Header file for fastRNN math functions which choose the device to run
+ *  on at runtime, with the cost model of the device dispatcher.
+ *
+ *  Copyright (C) 2015 Rob Clucas robclu1818@gmail.com
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published
+ *  by the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program; if not, write to the Free Software Foundation,
+ *  Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#ifndef _FRNN_MATH_AUTO_
+#define _FRNN_MATH_AUTO_
+
+#include <vector>
+
+#include "../tensor/tensor.cuh"
+#include "../frnn/frnn.h"
+#include "../frnn/gpu_context.cuh"
+#include "../frnn/device_dispatcher.cuh"
+#include "math_cpu.hpp"
+#include "math_gpu.hpp"
+
+/* ============================================= NOTES ======================================================
+ *
+ * 1. The functions use the process wide dispatcher and GPU context. Host vectors are always on the host, so
+ *    the GPU versions pay for the copies both ways, while device tensors are on the device if their device
+ *    data is current, and the GPU versions leave the results on the device.
+ *
+ * 2. When the CPU is chosen for device tensors the host data of the tensors is used, which is copied from
+ *    the device (only if the device data is newer) by the storage policy.
+ *
+ * ==========================================================================================================
+ */
+
+/*
+ * ==========================================================================================================
+ * Function     : selectDevice
+ *
+ * Description  : Chooses the device for a function with the process wide dispatcher
+ *
+ * Inputs       : cost          : The cost of the function for each element
+ *              : N             : The number of elements
+ *              : on_device     : If the inputs are currently on the device
+ *              : out_on_host   : If the outputs are needed on the host
+ * ==========================================================================================================
+ */
+inline frnn::device selectDevice( const frnn::op_cost& cost, size_t N, bool on_device, bool out_on_host ) {
+    return frnn::DeviceDispatcher::global().select( cost, N, on_device, out_on_host );
+}
+
+/*
+ * ==========================================================================================================
+ * Function     : axpyAuto
+ *
+ * Description  : Performs a*X + Y on the device with the smallest modelled time
+ *
+ * Inputs       : error     : fastRNN error type for result of operations
+ *              : a         : Constant for multiplication
+ *              : x         : Vector (or device tensor) to multiply with a
+ *
+ * Outputs      : y         : Vector (or device tensor) used in a*X + Y, where the result is stored
+ *
+ * Params       : dType     : The type of data used for the computation
+ * ==========================================================================================================
+ */
+template <typename dType>
+void axpyAuto( frnn::frnnError& error, const dType a, const std::vector<dType>& x, std::vector<dType>& y ) {
+    if ( selectDevice( frnn::OpCosts<dType>::axpy(), x.size(), false, true ) == frnn::device::GPU ) {
+        axpyGpu( error, frnn::GpuContext::global(), a, x, y );
+    } else {
+        axpyCpu( error, a, x, y );
+    }
+}
+
+template <typename dType>
+void axpyAuto( frnn::frnnError& error, const dType a, const frnn::Tensor4<dType, frnn::storage::Device>& x,
+               frnn::Tensor4<dType, frnn::storage::Device>& y ) {
+    if ( selectDevice( frnn::OpCosts<dType>::axpy(), x.size(), x.deviceCurrent(), false ) == frnn::device::GPU ) {
+        axpyGpu( error, frnn::GpuContext::global(), a, x, y );
+    } else {
+        axpyCpu( error, a, x.hostData(), y.hostData() );
+    }
+}
+
+/*
+ * ==========================================================================================================
+ * Function     : softmaxAuto
+ *
+ * Description  : Performs the softmax function of a vector (or device tensor) of data on the device with
+ *                the smallest modelled time
+ *
+ * Inputs       : error     : fastRNN error type for results of operations
+ *              : x         : The data to compute the softmax of
+ *
+ * Outputs      : val       : Where to store the result
+ *
+ * Params       : dType     : The type of data
+ * ==========================================================================================================
+ */
+template <typename dType>
+void softmaxAuto( frnn::frnnError& error, const std::vector<dType>& x, std::vector<dType>& val ) {
+    if ( selectDevice( frnn::OpCosts<dType>::softmax(), x.size(), false, true ) == frnn::device::GPU ) {
+        softmaxGpu( error, frnn::GpuContext::global(), x, val );
+    } else {
+        softmaxCpu( error, x, val );
+    }
+}
+
+template <typename dType>
+void softmaxAuto( frnn::frnnError& error, const frnn::Tensor4<dType, frnn::storage::Device>& x,
+                  frnn::Tensor4<dType, frnn::storage::Device>& val ) {
+    if ( selectDevice( frnn::OpCosts<dType>::softmax(), x.size(), x.deviceCurrent(), false ) == frnn::device::GPU ) {
+        softmaxGpu( error, frnn::GpuContext::global(), x, val );
+    } else {
+        if ( val.size() < x.size() ) {
+            frnn::err::dimError( error, stringify( x ), stringify( val ) );
+            return;
+        }
+        softmaxCpu( error, x.hostData(), val.hostData() );
+    }
+}
+
+/*
+ * ==========================================================================================================
+ * Function     : sumAuto
+ *
+ * Description  : Performs the sum of the elements in a vector on the device with the smallest modelled time
+ *
+ * Inputs       : error     : fastRNN error type for results of operations
+ *              : x         : The vector to compute the sum of
+ *
+ * Outputs      : The result of the sum of the vector
+ *
+ * Params       : dType     : The data type of the vector elements
+ * ==========================================================================================================
+ */
+template <typename dType>
+dType sumAuto( frnn::frnnError& error, const std::vector<dType>& x ) {
+    if ( selectDevice( frnn::OpCosts<dType>::sum(), x.size(), false, true ) == frnn::device::GPU ) {
+        return sumGpu( error, frnn::GpuContext::global(), x );
+    }
+    return sumCpu( error, x );
+}
+
+/*
+ * ==========================================================================================================
+ * Function     : sumVectorizedAuto
+ *
+ * Description  : Performs the sum of the elements in a vector (or device tensor) and stores the result in
+ *                each element of the output, on the device with the smallest modelled time
+ *
+ * Inputs       : error     : fastRNN error type for results of operations
+ *              : x         : The data to compute the sum of
+ *
+ * Outputs      : val       : Where each element holds the result of the sum
+ *
+ * Params       : dType     : The data type of the elements
+ * ==========================================================================================================
+ */
+template <typename dType>
+void sumVectorizedAuto( frnn::frnnError& error, const std::vector<dType>& x, std::vector<dType>& val ) {
+    if ( selectDevice( frnn::OpCosts<dType>::sumVectorized(), x.size(), false, true ) == frnn::device::GPU ) {
+        sumVectorizedGpu( error, frnn::GpuContext::global(), x, val );
+    } else {
+        sumVectorizedCpu( error, x, val );
+    }
+}
+
+template <typename dType>
+void sumVectorizedAuto( frnn::frnnError& error, const frnn::Tensor4<dType, frnn::storage::Device>& x,
+                        frnn::Tensor4<dType, frnn::storage::Device>& val ) {
+    if ( selectDevice( frnn::OpCosts<dType>::sumVectorized(), x.size(), x.deviceCurrent(), false ) == frnn::device::GPU ) {
+        sumVectorizedGpu( error, frnn::GpuContext::global(), x, val );
+    } else {
+        if ( val.size() < x.size() ) {
+            frnn::err::dimError( error, stringify( x ), stringify( val ) );
+            return;
+        }
+        sumVectorizedCpu( error, x.hostData(), val.hostData() );
+    }
+}
+
+#endif
@@ -18,24 +18,169 @@
  *  Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
  */
 
-#ifndef _FRNN_MATH_KERNELS_CPU_
-#define _FRNN_MATH_KERNELS_CPU_
+#ifndef _FRNN_MATH_CPU_
+#define _FRNN_MATH_CPU_
 
+#include <algorithm>
+#include <cmath>
 #include <vector>
-#include <random>
 
 #include "../frnn/types.h"
+#include "../frnn/frnn.h"
+#include "../frnn/profiler.cuh"
+#include "blas/frnn_blas_cpu.h"
+#include "math_kernels_cpu.h"
+
+/* ============================================= NOTES ======================================================
+ *
+ * 1. Arrays with at least CPU_PARALLEL_MIN_ELEMENTS elements are split into chunks of CPU_CHUNK_ELEMENTS,
+ *    which are done by different threads (with OpenMP, when it's enabled), and each chunk is done with the
+ *    vectorized kernels for the widest instruction set the CPU supports. The partial results of the chunks
+ *    of a reduction are then added in order, so the results don't depend on the number of threads.
+ *
+ * 2. The functions have the same arguments as the GPU versions (without the GpuContext), so that the CPU and
+ *    GPU versions can be used in the same way through the math struct.
+ *
+ * 3. The vector functions take vectors with any allocator, so that they work for std::vectors and for the 
+ *    (aligned) host data of tensors, and the chunks start at multiples of CPU_CHUNK_ELEMENTS so that the 
+ *    chunks of aligned data are aligned too.
+ *
+ * ==========================================================================================================
+ */
+
+namespace frnn {
+    
+const size_t CPU_PARALLEL_MIN_ELEMENTS = 1 << 15;           // Min elements to use more than one thread
+const size_t CPU_CHUNK_ELEMENTS        = 1 << 13;           // Elements in each chunk for the threads
+
+}   // Namespace frnn
+
+/*
+ * ==========================================================================================================
+ * Function     : numChunksCpu
+ * 
+ * Description  : Gets the number of chunks an array is split into for the threads
+ * 
+ * Inputs       : N         : The number of elements in the array
+ * ==========================================================================================================
+ */
+inline size_t numChunksCpu( size_t N ) {
+    return N < frnn::CPU_PARALLEL_MIN_ELEMENTS ? 1 : ( N + frnn::CPU_CHUNK_ELEMENTS - 1 ) / frnn::CPU_CHUNK_ELEMENTS;
+}
+
+/*
+ * ==========================================================================================================
+ * Function     : chunkCpu
+ * 
+ * Description  : Gets the first element and the number of elements of a chunk of an array
+ * 
+ * Inputs       : chunk     : The index of the chunk
+ *              : chunks    : The number of chunks the array is split into
+ *              : N         : The number of elements in the array
+ *              
+ * Outputs      : first     : The index of the first element of the chunk
+ *              : size      : The number of elements in the chunk
+ * ==========================================================================================================
+ */
+inline void chunkCpu( size_t chunk, size_t chunks, size_t N, size_t& first, size_t& size ) {
+    first = chunk * frnn::CPU_CHUNK_ELEMENTS;
+    size  = chunks == 1 ? N : std::min( frnn::CPU_CHUNK_ELEMENTS, N - first );
+}
+
+/*
+ * ==========================================================================================================
+ * Function     : sumArrayCpu
+ * 
+ * Description  : Computes the sum of the elements of an array, on the CPU
+ * 
+ * Inputs       : x         : The array to sum
+ *              : N         : The number of elements in the array
+ *              
+ * Outputs      : The sum of the elements
+ * 
+ * Params       : dType     : The type of data in the array
+ * ==========================================================================================================
+ */
+template <typename dType>
+dType sumArrayCpu( const dType* x, size_t N ) {
+    typedef frnn::cpu::KernelCpu<frnn::cpu::sumKernel, frnn::cpu::VectorizedCpu<dType>::value> kernel;
+    
+    const size_t        chunks = numChunksCpu( N );
+    std::vector<dType>  partials( chunks, 0 );
+    
+    #pragma omp parallel for if ( chunks > 1 )
+    for ( size_t chunk = 0; chunk < chunks; chunk++ ) {
+        size_t first, size;
+        chunkCpu( chunk, chunks, N, first, size );
+        partials[ chunk ] = kernel::run( x + first, size );
+    }
+    return frnn::cpu::sumKernel::scalar( &partials[ 0 ], chunks );
+}
+
+/*
+ * ==========================================================================================================
+ * Function     : softmaxArrayCpu
+ * 
+ * Description  : Computes the (numerically stable) softmax of an array, on the CPU, with a pass to find 
+ *                the max, a pass for exp( x_i - max ) and the sum, and a pass to normalize.
+ * 
+ * Inputs       : x         : The array to compute the softmax of
+ *              : N         : The number of elements in the array
+ *              
+ * Outputs      : out       : The softmax of the array (which can be x)
+ * 
+ * Params       : dType     : The type of data in the arrays
+ * ==========================================================================================================
+ */
+template <typename dType>
+void softmaxArrayCpu( const dType* x, dType* out, size_t N ) {
+    typedef frnn::cpu::KernelCpu<frnn::cpu::maxKernel   , frnn::cpu::VectorizedCpu<dType>::value> max_kernel;
+    typedef frnn::cpu::KernelCpu<frnn::cpu::expSumKernel, frnn::cpu::VectorizedCpu<dType>::value> exp_kernel;
+    typedef frnn::cpu::KernelCpu<frnn::cpu::scaleKernel , frnn::cpu::VectorizedCpu<dType>::value> scale_kernel;
+    
+    if ( N == 0 ) return;
+    
+    const size_t        chunks = numChunksCpu( N );
+    std::vector<dType>  partials( chunks, 0 );
+    
+    #pragma omp parallel for if ( chunks > 1 )
+    for ( size_t chunk = 0; chunk < chunks; chunk++ ) {
+        size_t first, size;
+        chunkCpu( chunk, chunks, N, first, size );
+        partials[ chunk ] = max_kernel::run( x + first, size );
+    }
+    const dType max = frnn::cpu::maxKernel::scalar( &partials[ 0 ], chunks );
+    
+    #pragma omp parallel for if ( chunks > 1 )
+    for ( size_t chunk = 0; chunk < chunks; chunk++ ) {
+        size_t first, size;
+        chunkCpu( chunk, chunks, N, first, size );
+        partials[ chunk ] = exp_kernel::run( x + first, max, out + first, size );
+    }
+    const dType inv_sum = dType( 1 ) / frnn::cpu::sumKernel::scalar( &partials[ 0 ], chunks );
+    
+    #pragma omp parallel for if ( chunks > 1 )
+    for ( size_t chunk = 0; chunk < chunks; chunk++ ) {
+        size_t first, size;
+        chunkCpu( chunk, chunks, N, first, size );
+        scale_kernel::run( inv_sum, out + first, size );
+    }
+}
 
 /*
  * ==========================================================================================================
- * Function     : rand 
+ * Function     : randCpu 
  * 
- * Descrition   : Generates a random number between 2 limits for each element in an array
+ * Descrition   : Fills an array with elements offset to offset + N - 1 of the Philox stream for a seed, as
+ *                uniform numbers on the range [lo, hi). The chunks of the array are filled by all the 
+ *                threads, and the numbers are the same as the GPU version for the same seed and offset.
  * 
  * Inputs       : x         : The array that must be filled with random numbers
  *              : N         : The number of elements in the array that must be filled with a randomm number
  *              : lo        : The lower bound for each random number
  *              : hi        : The upper bound for each random number 
+ *              : seed      : The seed of the stream
+ *              : offset    : The index in the stream of the first element
  *              
  * Oututs       : An array of random number on the range lo - hi
  * 
@@ -43,13 +188,15 @@
  * ==========================================================================================================
  */
 template <typename dType>
-void randCpu( dType* x, size_t N, dType lo, dType hi ) {
-    std::random_device                  rd;                             // Random device
-    std::mt19937                        gen( rd() );                    // Generator
-    std::uniform_real_distribution<>    dist( lo, hi );
+void randCpu( dType* x, size_t N, dType lo, dType hi, unsigned long long seed, unsigned long long offset ) {
+    FRNN_PROFILE_CPU( "randCpu", 0 );
+    const size_t chunks = numChunksCpu( N );
     
-    for ( size_t i = 0; i < N; i++ ) {
-        x[ i ] = static_cast<dType>( dist( gen ) );
+    #pragma omp parallel for if ( chunks > 1 )
+    for ( size_t chunk = 0; chunk < chunks; chunk++ ) {
+        size_t first, size;
+        chunkCpu( chunk, chunks, N, first, size );
+        frnn::dispatchCpu<frnn::cpu::philoxUniformKernel>( x + first, size, lo, hi, seed, offset + first );
     }
 }
 
@@ -65,35 +212,285 @@ void randCpu( dType* x, size_t N, dType lo, dType hi ) {
  * Outputs      : result    : The resultant vector from X - Y
  * 
  * Params       : dType     : The type of data in the vectors
+ *              : XAlloc    : The allocator of x (and YAlloc and RAlloc of y and result)
  * ==========================================================================================================
  */
-template <typename dType>
-void xmyCpu( std::vector<dType>& x, std::vector<dType>& y, std::vector<dType>& result ) {
-    typedef typename frnn::VectorizedInstructionsCpu<dType>    vect_ins;
-    typedef typename frnn::VectorizedTypeCpu<dType>::vect_type vect4;
+template <typename dType, typename XAlloc, typename YAlloc, typename RAlloc>
+void xmyCpu( std::vector<dType, XAlloc>& x, std::vector<dType, YAlloc>& y, std::vector<dType, RAlloc>& result ) {
+    FRNN_PROFILE_CPU( "xmyCpu", 0 );
+    const size_t N = x.size();
+    if ( N == 0 ) return;
+    if ( result.size() < N ) result.resize( N );
     
-    // Get size and pointers 
-    const size_t N     = x.size();
-    size_t step        = vect_ins::typeSize();
-    dType* x_p         = N > 0 ? &x[ 0 ] : NULL;
-    dType* y_p         = N > 0 ? &y[ 0 ] : NULL;
-    dType* result_p    = &result[ 0 ];
+    // Runs with the widest vector instructions the CPU supports
+    frnn::dispatchCpu<frnn::cpu::xmyKernel>( static_cast<const dType*>( &x[ 0 ] ), 
+                                             static_cast<const dType*>( &y[ 0 ] ), &result[ 0 ], N );
+}
+
+/*
+ * ==========================================================================================================
+ * Function     : axpyCpu
+ *
+ * Description  : Performs a*X + Y on the CPU
+ *
+ * Inputs       : error     : fastRNN error type for result of operations
+ *              : a         : Constant for multiplication 
+ *              : x         : Vector to multiply with a
+ * 
+ * Outputs      : y         : Vector used in a*X + Y, and where the result of a*X + Y is stored
+ * 
+ * Params       : dType     : The type of data used for the computation
+ *              : Alloc     : The allocator of the vectors
+ * ==========================================================================================================
+ */
+template <typename dType, typename Alloc>
+void axpyCpu( frnn::frnnError& error, const dType a, const std::vector<dType, Alloc>& x, std::vector<dType, Alloc>& y ) {
+    FRNN_PROFILE_CPU( "axpyCpu", &error );
+    typedef frnn::cpu::KernelCpu<frnn::cpu::axpyKernel, frnn::cpu::VectorizedCpu<dType>::value> kernel;
     
-    vect4 x4; vect4 y4; vect4 result4;
+    const size_t N = x.size();
+    if ( y.size() != N ) {
+        frnn::err::dimError( error, stringify( x ), stringify( y ) );
+        return;
+    }
     
-    // For every 4 elements
-    for ( size_t i = 0; i < N; i += step ) {
-        x4      = vect_ins::mm_load_u( x_p );             // Load to vectorized version
-        y4      = vect_ins::mm_load_u( y_p );             // Load to vectorized version
-        result4 = vect_ins::mm_sub_p( x4, y4 );           // Subtract
-        vect_ins::mm_store_p( result_p, result4 );        // Move result to output
+    const size_t chunks = numChunksCpu( N );
+    #pragma omp parallel for if ( chunks > 1 )
+    for ( size_t chunk = 0; chunk < chunks; chunk++ ) {
+        size_t first, size;
+        chunkCpu( chunk, chunks, N, first, size );
+        kernel::run( a, &x[ first ], &y[ first ], size );
+    }
+}
+
+/*
+ * ==========================================================================================================
+ * Function     : softmaxCpu
+ *
+ * Description  : Performs the (numerically stable) softmax function of a vector of data x on the CPU, which 
+ *                is 
+ *                  
+ *                softmax( x_i ) = exp( x_i - max( x ) ) / sum[ j=1 to J ]( exp( x_j - max( x ) ) )
+ *
+ * Inputs       : error     : fastRNN error type for results of operations
+ *              : x         : Vector to compute the softmax of
+ *        
+ * Outputs      : val       : Vector to store the result in
+ *
+ * Params       : dType     : The type of data
+ *              : Alloc     : The allocator of the vectors
+ * ==========================================================================================================
+ */ 
+template <typename dType, typename Alloc>
+void softmaxCpu( frnn::frnnError& error, const std::vector<dType, Alloc>& x, std::vector<dType, Alloc>& val ) {
+    FRNN_PROFILE_CPU( "softmaxCpu", &error );
+    if ( x.empty() ) return;
+    if ( val.size() < x.size() ) val.resize( x.size(), 0 );
+    softmaxArrayCpu( &x[ 0 ], &val[ 0 ], x.size() );
+}
+
+/*
+ * ==========================================================================================================
+ * Function     : sumCpu
+ *
+ * Description  : Performs the sum of the elements in a vector on the CPU
+ *                  
+ * Inputs       : error     : fastRNN error type for results of operations
+ *              : x         : The vector to compute the sum of
+ *        
+ * Outputs      : The result of the sum of the vector
+ *
+ * Params       : dType     : The data type of the vector elements
+ *              : Alloc     : The allocator of the vectors
+ * ==========================================================================================================
+ */  
+template <typename dType, typename Alloc>
+dType sumCpu( frnn::frnnError& error, const std::vector<dType, Alloc>& x ) {
+    FRNN_PROFILE_CPU( "sumCpu", &error );
+    if ( x.empty() ) return dType( 0 );
+    return sumArrayCpu( &x[ 0 ], x.size() );
+}
+
+/*
+ * ==========================================================================================================
+ * Function     : sumVectorizedCpu
+ *
+ * Description  : Performs the sum of the elements in a vector on the CPU and returns a vector of the same
+ *                dimension with each element having the result
+ *                  
+ * Inputs       : error     : fastRNN error type for results of operations
+ *              : x         : The vector to compute the sum of
+ *        
+ * Outputs      : val       : A vector where each element holds the result of the sum
+ *
+ * Params       : dType     : The data type of the vector elements
+ *              : Alloc     : The allocator of the vectors
+ * ==========================================================================================================
+ */  
+template <typename dType, typename Alloc>
+void sumVectorizedCpu( frnn::frnnError& error, const std::vector<dType, Alloc>& x, std::vector<dType, Alloc>& val ) {
+    FRNN_PROFILE_CPU( "sumVectorizedCpu", &error );
+    if ( val.size() < x.size() ) val.resize( x.size(), 0 );
+    std::fill( val.begin(), val.begin() + x.size(), sumCpu( error, x ) );
+}
+
+/*
+ * ==========================================================================================================
+ * Function     : sumVectorsCpu
+ *
+ * Description  : Computes the elementwise sum of M arrays (the columns of a column major matrix) on the CPU.
+ *                Each chunk of the result stays in cache while the chunks of the arrays are added to it, in
+ *                the order of the arrays, with the vectorized axpy kernel.
+ *
+ * Inputs       : error     : fastRNN error type for results of operations
+ *              : vectors   : The arrays to sum, array v starts at vectors + v * ld
+ *              : N         : The number of elements in each array
+ *              : M         : The number of arrays
+ *              : ld        : The leading dimension of the arrays (at least N)
+ *
+ * Outputs      : out       : The N elements of the sum (which must not be in the arrays)
+ *
+ * Params       : dType     : The data type of the arrays
+ * ==========================================================================================================
+ */
+template <typename dType>
+void sumVectorsCpu( frnn::frnnError& error, const dType* vectors, size_t N, size_t M, size_t ld, dType* out ) {
+    FRNN_PROFILE_CPU( "sumVectorsCpu", &error );
+    typedef frnn::cpu::KernelCpu<frnn::cpu::axpyKernel, frnn::cpu::VectorizedCpu<dType>::value> kernel;
+    
+    if ( ld < N ) {
+        frnn::err::dimError( error, stringify( ld ), stringify( N ) );
+        return;
+    }
+    
+    const size_t chunks = numChunksCpu( N );
+    #pragma omp parallel for if ( chunks > 1 )
+    for ( size_t chunk = 0; chunk < chunks; chunk++ ) {
+        size_t first, size;
+        chunkCpu( chunk, chunks, N, first, size );
         
-        // Increment
-        x_p += step; y_p += step; result_p += step;
-    }  
-    for ( size_t i = 0; i < N % step; i ++ ) {
-        result[ N - 1 - i ] = x[ N - 1 - i] - y[ N - i - i ];
+        std::fill( out + first, out + first + size, dType( 0 ) );
+        for ( size_t v = 0; v < M; v++ ) kernel::run( dType( 1 ), vectors + v * ld + first, out + first, size );
+    }
+}
+
+/*
+ * ==========================================================================================================
+ * Function     : gemvCpu
+ *
+ * Description  : Computes y = alpha * op( A ) * x + beta * y on the CPU, with the CPU BLAS library (see 
+ *                blas/frnn_blas_cpu.h)
+ *
+ * Inputs       : op        : The operation on A (OP_N or OP_T)
+ *              : M         : The number of rows of A
+ *              : N         : The number of columns of A
+ *              : alpha     : The constant to multiply op( A ) * x by
+ *              : A         : The (column major) matrix
+ *              : lda       : The leading dimension of A
+ *              : x         : The vector to multiply with op( A )
+ *              : beta      : The constant to multiply y by
+ *              : y         : The vector to add to
+ *
+ * Outputs      : y         : The result of alpha * op( A ) * x + beta * y
+ *
+ * Params       : dType     : The type of data for the computation
+ * ==========================================================================================================
+ */
+template <typename dType>
+void gemvCpu( frnn::blas::cpu::operation op, int M, int N, dType alpha, const dType* A, int lda,
+              const dType* x, dType beta, dType* y ) {
+    FRNN_PROFILE_CPU( "gemvCpu", 0 );
+    frnn::blas::cpu::functions<dType>::gemv( op, M, N, alpha, A, lda, x, beta, y );
+}
+
+/*
+ * ==========================================================================================================
+ * Function     : gemmCpu
+ *
+ * Description  : Computes C = alpha * op( A ) * op( B ) + beta * C on the CPU, with the CPU BLAS library
+ *                (see blas/frnn_blas_cpu.h)
+ *
+ * Inputs       : op_a      : The operation on A
+ *              : op_b      : The operation on B
+ *              : M         : The number of rows of op( A ) and C
+ *              : N         : The number of columns of op( B ) and C
+ *              : K         : The number of columns of op( A ) and rows of op( B )
+ *              : alpha     : The constant to multiply op( A ) * op( B ) by
+ *              : A         : The first (column major) matrix
+ *              : lda       : The leading dimension of A
+ *              : B         : The second (column major) matrix
+ *              : ldb       : The leading dimension of B
+ *              : beta      : The constant to multiply C by
+ *              : C         : The matrix to add to
+ *              : ldc       : The leading dimension of C
+ *
+ * Outputs      : C         : The result of alpha * op( A ) * op( B ) + beta * C
+ *
+ * Params       : dType     : The type of data for the computation
+ * ==========================================================================================================
+ */
+template <typename dType>
+void gemmCpu( frnn::blas::cpu::operation op_a, frnn::blas::cpu::operation op_b, int M, int N, int K, dType alpha,
+              const dType* A, int lda, const dType* B, int ldb, dType beta, dType* C, int ldc ) {
+    FRNN_PROFILE_CPU( "gemmCpu", 0 );
+    frnn::blas::cpu::functions<dType>::gemm( op_a, op_b, M, N, K, alpha, A, lda, B, ldb, beta, C, ldc );
+}
+
+/*
+ * ==========================================================================================================
+ * Function     : dotInt8Cpu
+ *
+ * Description  : Computes the dot product of two int8 arrays on the CPU, in int32, with the VNNI 
+ *                instructions when the CPU has them and otherwise with the widest instruction set
+ *
+ * Inputs       : x         : The first array
+ *              : y         : The second array
+ *              : N         : The number of elements in the arrays
+ *
+ * Outputs      : The dot product of x and y
+ * ==========================================================================================================
+ */
+#ifdef FRNN_CPU_X86
+FRNN_TARGET_AVX512VNNI inline int32_t dotInt8VnniCpu( const int8_t* x, const int8_t* y, size_t N ) {
+    return frnn::cpu::dotInt8Kernel::body<frnn::Int8VnniInstructionsCpu>( x, y, N );
+}
+#endif
+
+inline int32_t dotInt8Cpu( const int8_t* x, const int8_t* y, size_t N ) {
+#ifdef FRNN_CPU_X86
+    if ( frnn::cpuHasVnni() ) return dotInt8VnniCpu( x, y, N );
+#endif
+    return frnn::dispatchCpu<frnn::cpu::dotInt8Kernel>( x, y, N );
+}
+
+/*
+ * ==========================================================================================================
+ * Function     : quantizeCpu
+ *
+ * Description  : Quantizes an array to int8 with a symmetric scale, so that x_i is q_i * scale, where the 
+ *                scale is max( |x_i| ) / 127 (or 1 if all the elements are 0)
+ *
+ * Inputs       : x         : The array to quantize
+ *              : N         : The number of elements in the array
+ *
+ * Outputs      : q         : The quantized elements
+ *              : The scale of the quantized elements
+ *
+ * Params       : dType     : The type of data of the array
+ * ==========================================================================================================
+ */
+template <typename dType>
+dType quantizeCpu( const dType* x, size_t N, int8_t* q ) {
+    dType max = 0;
+    for ( size_t i = 0; i < N; i++ ) max = std::max( max, static_cast<dType>( std::fabs( x[ i ] ) ) );
+    
+    const dType scale = max == dType( 0 ) ? dType( 1 ) : max / dType( 127 );
+    const dType inv   = dType( 1 ) / scale;
+    for ( size_t i = 0; i < N; i++ ) {
+        const long v = std::lround( x[ i ] * inv );
+        q[ i ]       = static_cast<int8_t>( std::max( -127L, std::min( 127L, v ) ) );
     }
+    return scale;
 }
 
 #endif
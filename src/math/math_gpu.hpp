@@ -29,15 +29,41 @@
 
 #include <vector>
 #include <random>
+#include <string>
+#include <typeinfo>
 #include <omp.h>
 
 #include "../tensor/tensor.cuh"
 #include "../util/errors.h"
 #include "../frnn/frnn.h"
+#include "../frnn/gpu_context.cuh"
+#include "../frnn/profiler.cuh"
+#include "../frnn/kernel_tuner.cuh"
 #include "math_kernels_gpu.cuh"
 #include "blas/frnn_blas.h"
 #include "rand/frnn_rand.h"
 
+/* ============================================= NOTES ======================================================
+ *
+ * 1. All the functions take a GpuContext, which owns the cuBLAS handle, the cuRAND generator, the streams and
+ *    the scratch buffers. The functions use scratch slots 0 and 1 of the context for their device copies of
+ *    the inputs and outputs (and the softmax uses slot 2 for its partial results, and the reductions use 
+ *    slots 3, 4 and 5 for the results of the blocks, the counter of the blocks which are done and the 
+ *    result), so after the first call with a given size there are no device allocations.
+ *
+ * 2. sumVectorsGpu doesn't use the scratch slots, so it can be used for the scratch buffers of a caller. Its
+ *    partial results come from the allocator of the context for the stream, and are given back as soon as
+ *    the kernels are queued, which is safe since the allocator only reuses a block on the same stream.
+ *
+ * 3. The grid stride kernels which can be run again on the same data (randGpu, reduceSegmentsGpu, the
+ *    broadcast of sumVectorizedGpu, sumVectorsGpu and softmaxColumnsGpu) are queued with launchTunedGpu,
+ *    which uses the launch configuration which the kernel tuner selects, and the single pass reduction has
+ *    its own candidates (see reduceDeviceGpu). The two passes of softmaxStableGpu aren't tuned, since the
+ *    second normalizes the logits in place (see kernel_tuner.cuh NOTES 5).
+ *
+ * ==========================================================================================================
+ */
+
 /*
  * ==========================================================================================================
  * Function     : axpyGpu
@@ -45,6 +71,7 @@
  * Description  : Performs simgle/double precision a*X + Y, using CUBLAS
  *
  * Inputs       : error     : fastRNN error type for result of operations
+ *              : context   : The GPU context which provides the cuBLAS handle and the scratch memory
  *              : a         : Constant for multiplication 
  *              : x         : Vector to multiply with a
  * 
@@ -54,78 +81,212 @@
  * ==========================================================================================================
  */
 template <typename dType>
-void axpyGpu( frnn::frnnError& error, const dType a, const std::vector<dType>& x, std::vector<dType>& y ) {
+void axpyGpu( frnn::frnnError& error, frnn::GpuContext& context, const dType a, 
+              const std::vector<dType>& x, std::vector<dType>& y ) {
+    FRNN_PROFILE_GPU( "axpyGpu", &error, context.stream() );
 
-    cublasHandle_t handle;
-    cublasStatus_t status;
-    dType* da = 0, *dx = 0, *dy = 0;
+    if ( x.size() != y.size() ) {
+        frnn::err::dimError( error, stringify( x ), stringify( y ) );
+        return;
+    }
+    if ( x.empty() ) return;
 
-    status = cublasCreate( &handle );
-    cublasSetPointerMode( handle, CUBLAS_POINTER_MODE_DEVICE );
+    cudaStream_t   stream = context.stream();
+    dType*         dx     = context.scratch<dType>( error, 0, x.size() );
+    dType*         dy     = context.scratch<dType>( error, 1, y.size() );
 
-    // Allocate and fill device vectors with host vector data 
-    if ( cudaMalloc( (void**)&da, sizeof( dType ) ) != cudaSuccess ) {
-        frnn::err::allocError( error, stringify( da ) );
-    }
-    if ( cudaMalloc( (void**)&dx, x.size() * sizeof( dType ) ) != cudaSuccess ) {
-        frnn::err::allocError( error, stringify( dx ) );   
-    }
-    if ( cudaMalloc( (void**)&dy, y.size() * sizeof( dType ) ) != cudaSuccess ) {
-        frnn::err::allocError( error, stringify( dy ) );   
+    if ( dx == 0 || dy == 0 ) return;
+
+    // a stays on the host, so there is no need for a device copy of it
+    if ( cublasSetPointerMode( context.blasHandle(), CUBLAS_POINTER_MODE_HOST ) != CUBLAS_STATUS_SUCCESS ) {
+        frnn::err::blasError( error, stringify( a ) );
+        return;
     }
 
     // Fill device vectors with data
-    if ( cudaMemcpy( da, &a, sizeof( dType ), cudaMemcpyHostToDevice ) != cudaSuccess ) {
-        frnn::err::copyError( error, stringify( da ) );
-    }
-    if ( cudaMemcpy( dx, &x[0], x.size() * sizeof( dType ), cudaMemcpyHostToDevice ) != cudaSuccess ) {
-        frnn::err::copyError( error, stringify( da ) );
-    }
-    if ( cudaMemcpy( dy, &y[0], y.size() * sizeof( dType ), cudaMemcpyHostToDevice ) != cudaSuccess ) {
-        frnn::err::copyError( error, stringify( da ) );
+    if ( frnn::prof::memcpyAsync( dx, &x[0], x.size() * sizeof( dType ), cudaMemcpyHostToDevice, stream ) != cudaSuccess ||
+         frnn::prof::memcpyAsync( dy, &y[0], y.size() * sizeof( dType ), cudaMemcpyHostToDevice, stream ) != cudaSuccess ) {
+        frnn::err::copyError( error, stringify( dy ) );
+        return;
     }
 
-    // Perform CUBLAS axpy using wrapper blas library
-    status = frnn::blas::functions<dType>::axpy( handle, x.size(), da, dx, 1, dy, 1 );
+    // Perform CUBLAS axpy using wrapper blas library, y is only copied back if it succeeded
+    if ( frnn::blas::functions<dType>::axpy( context.blasHandle(), x.size(), &a, dx, 1, dy, 1 ) != CUBLAS_STATUS_SUCCESS ) {
+        frnn::err::blasError( error, stringify( y ) );
+        cudaStreamSynchronize( stream );
+        return;
+    }
 
-    if ( cudaMemcpy( &y[0], dy, y.size() * sizeof( dType ), cudaMemcpyDeviceToHost ) != cudaSuccess ) {
+    if ( frnn::prof::memcpyAsync( &y[0], dy, y.size() * sizeof( dType ), cudaMemcpyDeviceToHost, stream ) != cudaSuccess ||
+         cudaStreamSynchronize( stream ) != cudaSuccess ) {
         frnn::err::copyError( error, stringify( y ) );
     }
+} 
+
+/*
+ * ==========================================================================================================
+ * Function     : axpyGpu (device tensors)
+ *
+ * Description  : Performs simgle/double precision a*X + Y, using CUBLAS, on tensors which are stored on the 
+ *                device, so no data is copied between the host and the device
+ *
+ * Inputs       : error     : fastRNN error type for result of operations
+ *              : context   : The GPU context which provides the cuBLAS handle
+ *              : a         : Constant for multiplication 
+ *              : x         : Tensor to multiply with a
+ * 
+ * Outputs      : y         : Tensor used in a*X + Y, and where the result of a*X + Y is stored
+ * 
+ * Params       : dType     : The type of data used for the computation
+ * ==========================================================================================================
+ */
+template <typename dType>
+void axpyGpu( frnn::frnnError& error, frnn::GpuContext& context, const dType a, 
+              const Tensor4<dType, storage::Device>& x, Tensor4<dType, storage::Device>& y ) {
+    FRNN_PROFILE_GPU( "axpyGpu", &error, context.stream() );
 
-    status = cublasDestroy( handle );
+    if ( x.size() != y.size() ) {
+        frnn::err::dimError( error, stringify( x ), stringify( y ) );
+        return;
+    }
 
-    cudaFree( da );
-    cudaFree( dx );
-    cudaFree( dy );
-} 
+    if ( cublasSetPointerMode( context.blasHandle(), CUBLAS_POINTER_MODE_HOST ) != CUBLAS_STATUS_SUCCESS ||
+         frnn::blas::functions<dType>::axpy( context.blasHandle(), x.size(), &a, x.deviceData(), 1, 
+                                             y.deviceData(), 1 ) != CUBLAS_STATUS_SUCCESS ) {
+        frnn::err::blasError( error, stringify( y ) );
+    }
+}
 
 /*
  * ==========================================================================================================
  * Function     : axpyGpu (for ints)
  *
- * Description  : Performs a*X + Y, using own implementation for ints
+ * Description  : Performs a*X + Y for ints, with axpyKernel since cuBLAS only has floating point axpys
  *
  * Inputs       : error     : fastRNN error type for result of operations
+ *              : context   : The GPU context which provides the stream and the scratch memory
  *              : a         : Constant for multiplication 
  *              : x         : Vector to multiply with a
  * 
  * Outputs      : y         : Vector used in a*X + Y, and where the result of a*X + Y is stored
  * ==========================================================================================================
  */
-void axpyGpu( frnn::frnnError& error, const int a, const std::vector<int>& x, std::vector<int>& y ) {
-    // Still implement - placeholder for now
+inline void axpyGpu( frnn::frnnError& error, frnn::GpuContext& context, const int a, 
+                     const std::vector<int>& x, std::vector<int>& y ) {
+    FRNN_PROFILE_GPU( "axpyGpu", &error, context.stream() );
+
+    if ( x.size() != y.size() ) {
+        frnn::err::dimError( error, stringify( x ), stringify( y ) );
+        return;
+    }
+    if ( x.empty() ) return;
+
+    cudaStream_t stream = context.stream();
+    int*         dx     = context.scratch<int>( error, 0, x.size() );
+    int*         dy     = context.scratch<int>( error, 1, y.size() );
+
+    if ( dx == 0 || dy == 0 ) return;
+
+    if ( frnn::prof::memcpyAsync( dx, &x[0], x.size() * sizeof( int ), cudaMemcpyHostToDevice, stream ) != cudaSuccess ) {
+        frnn::err::copyError( error, stringify( dx ) );
+    }
+    if ( frnn::prof::memcpyAsync( dy, &y[0], y.size() * sizeof( int ), cudaMemcpyHostToDevice, stream ) != cudaSuccess ) {
+        frnn::err::copyError( error, stringify( dy ) );
+    }
+
+    const size_t blocks = std::min( x.size() / THREADS_PER_BLOCK + 1, static_cast<size_t>( MAX_BLOCKS ) );
+    FRNN_COUNT_LAUNCH();
+    axpyKernel<<<blocks, THREADS_PER_BLOCK, 0, stream>>>( x.size(), a, dx, dy );
+
+    if ( frnn::prof::memcpyAsync( &y[0], dy, y.size() * sizeof( int ), cudaMemcpyDeviceToHost, stream ) != cudaSuccess ||
+         cudaStreamSynchronize( stream ) != cudaSuccess ) {
+        frnn::err::copyError( error, stringify( y ) );
+    }
+}
+
+/*
+ * ==========================================================================================================
+ * Function     : gridCandidatesGpu
+ *
+ * Description  : Gets the launch configurations which the kernel tuner benchmarks for the grid stride 
+ *                kernels (the element-wise kernels, and those with a block for each segment or column). The
+ *                first is the default (THREADS_PER_BLOCK threads and up to MAX_BLOCKS blocks), and the width
+ *                is always 1 since the kernels don't have vector loads.
+ * ==========================================================================================================
+ */  
+inline const std::vector<frnn::launch_config>& gridCandidatesGpu() {
+    static const std::vector<frnn::launch_config> candidates = [] {
+        const uint threads[] = { THREADS_PER_BLOCK, 128, 512, 1024 };
+        const uint blocks[]  = { MAX_BLOCKS, 4096, 1024, 256 };
+
+        std::vector<frnn::launch_config> configs;
+        for ( uint t : threads ) {
+            for ( uint b : blocks ) configs.push_back( frnn::launch_config{ t, b, 1 } );
+        }
+        return configs;
+    }();
+    return candidates;
+}
+
+/*
+ * ==========================================================================================================
+ * Function     : gridBlocksGpu
+ *
+ * Description  : Gets the number of blocks of a launch configuration for a grid stride kernel, enough for
+ *                each of the work items to be done in one pass of the grid but at most the max blocks of
+ *                the configuration (and at least 1)
+ *
+ * Inputs       : config    : The launch configuration
+ *              : work      : The number of work items (elements, segments or columns)
+ *              : per_block : The number of work items which a block does in each pass
+ * ==========================================================================================================
+ */  
+inline size_t gridBlocksGpu( const frnn::launch_config& config, size_t work, size_t per_block ) {
+    return std::max( std::min( ( work + per_block - 1 ) / per_block, static_cast<size_t>( config.blocks ) ), 
+                     size_t( 1 ) );
+}
+
+/*
+ * ==========================================================================================================
+ * Function     : launchTunedGpu
+ *
+ * Description  : Queues a grid stride kernel on the primary stream of the context with the configuration
+ *                (of gridCandidatesGpu) which the kernel tuner selects for the device and the problem size.
+ *                The kernel must give the same results when it is run again on the same data, since the
+ *                tuner runs it more than once on the buffers of the launch when it benchmarks (see
+ *                kernel_tuner.cuh NOTES 2 and 5) : a kernel which reads what it writes (an in place update
+ *                or an accumulation) must not be launched with this, but with a fixed configuration.
+ *
+ * Inputs       : context   : The GPU context which the kernel is run on
+ *              : kernel    : The name of the kernel (with its template arguments)
+ *              : N         : The size of the problem
+ *              : launch    : Queues the kernel with a configuration
+ *
+ * Params       : Launch    : The type of launch (a callable which takes a launch_config)
+ * ==========================================================================================================
+ */  
+template <typename Launch>
+void launchTunedGpu( frnn::GpuContext& context, const std::string& kernel, size_t N, Launch launch ) {
+    FRNN_COUNT_LAUNCH();
+    launch( frnn::KernelTuner::global().select( context, kernel, N, gridCandidatesGpu(), launch ) );
 }
 
 /*
  * ==========================================================================================================
  * Function     : randGpu 
  * 
- * Descrition   : Generates a random number between 2 limits on the GPU
+ * Descrition   : Fills an array in device memory with elements offset to offset + N - 1 of the Philox stream
+ *                for a seed, as uniform numbers on the range [lo, hi), which are the same as the CPU version
+ *                for the same seed and offset. The kernel is queued on the primary stream of the context 
+ *                and the numbers stay on the device.
  * 
- * Inputs       : x         : The array that must be filled with random numbers
- *              : N         : The number of elements in the array x to fille with random numbers
+ * Inputs       : context   : The GPU context which provides the stream
+ *              : x         : The device array (or device tensor) to fill with random numbers
+ *              : N         : The number of elements in the array x to fill with random numbers
  *              : lo        : The lower bound for each random number
  *              : hi        : The upper bound for each random number 
+ *              : seed      : The seed of the stream
+ *              : offset    : The index in the stream of the first element
  *              
  * Oututs       : The array of random numbers on the range lo - hi
  * 
@@ -133,39 +294,124 @@ void axpyGpu( frnn::frnnError& error, const int a, const std::vector<int>& x, st
  * ==========================================================================================================
  */ 
 template <typename dType>
-void randGpu( dType* x, size_t N, dType lo, dType hi ) {
+void randGpu( frnn::GpuContext& context, dType* x, size_t N, dType lo, dType hi, unsigned long long seed, 
+              unsigned long long offset ) {
+    FRNN_PROFILE_GPU( "randGpu", 0, context.stream() );
+    if ( N == 0 ) return;
     
-    curandGenerator_t   gen;                    // Device random number generator
-    frnnError          error;
-    dType*              device_randoms = 0;
-    
-    // Allocate memory on the device
-    if ( cudaMalloc( (void**)&device_randoms, N * sizeof( dType) ) != cudaSuccess ) {
-        frnn::err::allocError( error, stringify( device_randoms ) );
-    }
-   
-    curandCreateGenerator( &gen, CURAND_RNG_PSEUDO_DEFAULT );                  // Create generator
-    curandSetPseudoRandomGeneratorSeed( gen, 1234ULL );                        // Seed RNG
-    frnn::rng::generators<dType>::uniform( gen, device_randoms, N );          // Create rand nums on GPU
-    
-    int threads, blocks;
-    threads = ( ( N < 1024 ) ? N : 1024 );
-    blocks  = std::min( static_cast<int>( N / threads + 1 ), MAX_BLOCKS );
-    
-
-    // Call kernel to chnage the range from 0 - 1 to lo - hi
-    scale<<<blocks, threads>>>( device_randoms, N, lo, hi );
-    
-    // Copy results from deviec mem to x
-    if ( cudaMemcpy( x, device_randoms, N * sizeof( dType ), cudaMemcpyDeviceToHost ) != cudaSuccess ) {
-        frnn::err::copyError( error, stringify( device_randoms ) );
-    }
-    
-    // Clean up
-    cudaFree ( device_randoms );
-    curandDestroyGenerator( gen );
+    // Each thread makes a block of the stream, which has up to 4 elements, so the numbers are the same for
+    // any launch configuration
+    static const std::string kernel = std::string( "philoxUniform_" ) + typeid( dType ).name();
+    const size_t blocks_needed = N / ( 4 / frnn::rng::PhiloxUniform<dType>::words ) + 2;
+
+    launchTunedGpu( context, kernel, N, [&]( const frnn::launch_config& config ) {
+        philoxUniformKernel<<<gridBlocksGpu( config, blocks_needed, config.threads ), config.threads, 0, 
+                              context.stream()>>>( x, N, lo, hi, seed, offset );
+    } );
 }    
+
+template <typename dType>
+void randGpu( frnn::GpuContext& context, Tensor4<dType, storage::Device>& x, dType lo, dType hi, 
+              unsigned long long seed, unsigned long long offset ) {
+    randGpu( context, x.deviceData(), x.size(), lo, hi, seed, offset );
+}
     
+/*
+ * ==========================================================================================================
+ * Function     : softmaxStableGpu
+ *
+ * Description  : Queues the two passes of the numerically stable softmax (see softmaxPartialsKernel and
+ *                softmaxNormalizeKernel) on the primary stream of the context. The first pass finds the max
+ *                and the sum of the exponentials for each block in a single read of the logits, and the 
+ *                second pass combines the block results and normalizes, so large logits don't overflow.
+ *
+ * Inputs       : error         : fastRNN error type for results of operations
+ *              : context       : The GPU context which provides the stream and the scratch memory
+ *              : partials_slot : The scratch slot to use for the results of each block
+ *              : load          : The loader for the logits (see elementLoader and pageSumLoader)
+ *              : N             : The number of elements
+ *        
+ * Outputs      : out           : Device pointer to where the results are stored
+ *
+ * Params       : dType         : The type of data (float or double)
+ *              : Loader        : The type of the loader
+ * ==========================================================================================================
+ */ 
+template <typename dType, typename Loader>
+void softmaxStableGpu( frnn::frnnError& error, frnn::GpuContext& context, size_t partials_slot,
+                       Loader load, dType* out, size_t N ) {
+    FRNN_PROFILE_GPU( "softmaxStableGpu", &error, context.stream() );
+    cudaStream_t stream         = context.stream();
+    size_t       blocks         = N / THREADS_PER_BLOCK + ( N % THREADS_PER_BLOCK != 0 ? 1 : 0 );
+    // Few enough first pass blocks that each second pass block can combine them cheaply
+    size_t       partial_blocks = std::min( blocks, static_cast<size_t>( THREADS_PER_BLOCK ) );
+    dType*       partials       = context.scratch<dType>( error, partials_slot, 2 * partial_blocks );
+
+    if ( partials == 0 || N == 0 ) return;
+
+    FRNN_COUNT_LAUNCH();
+    softmaxPartialsKernel<<<partial_blocks, THREADS_PER_BLOCK, 0, stream>>>( 
+            load, out, N, partials, partials + partial_blocks );
+    FRNN_COUNT_LAUNCH();
+    softmaxNormalizeKernel<<<std::min( blocks, static_cast<size_t>( MAX_BLOCKS ) ), THREADS_PER_BLOCK, 0, stream>>>( 
+            out, out, N, partials, partials + partial_blocks, partial_blocks );
+}
+
+/*
+ * ==========================================================================================================
+ * Function     : softmaxColumnsGpu
+ *
+ * Description  : Queues the (numerically stable) softmax of each column of a column major matrix in device
+ *                memory (see softmaxColumnsKernel), for example the logits of a batch, on the primary stream
+ *                of the context, with the launch configuration which the kernel tuner selects
+ *
+ * Inputs       : context   : The GPU context which provides the stream
+ *              : in        : The device matrix to compute the softmax of each column of
+ *              : N         : The number of elements in each column (rows)
+ *              : M         : The number of columns
+ *        
+ * Outputs      : out       : The device matrix for the results (which must not be in)
+ *
+ * Params       : dType     : The type of data (float or double)
+ * ==========================================================================================================
+ */ 
+template <typename dType>
+void softmaxColumnsGpu( frnn::GpuContext& context, const dType* in, dType* out, size_t N, size_t M ) {
+    static const std::string kernel = std::string( "softmaxColumns_" ) + typeid( dType ).name();
+    if ( M == 0 ) return;
+
+    // A block for each column, so the problem size is the number of elements of all the columns
+    launchTunedGpu( context, kernel, N * M, [&]( const frnn::launch_config& config ) {
+        softmaxColumnsKernel<<<gridBlocksGpu( config, M, 1 ), config.threads, 0, context.stream()>>>( 
+                in, out, N, M );
+    } );
+}
+
+/*
+ * ==========================================================================================================
+ * Function     : softmaxDeviceGpu
+ *
+ * Description  : Performs the softmax function on data which is already on the device. The kernels are 
+ *                queued on the primary stream of the context and the function returns without waiting for
+ *                them to finish.
+ *
+ * Inputs       : error     : fastRNN error type for results of operations
+ *              : context   : The GPU context which provides the stream and the scratch memory
+ *              : in        : Device pointer to the data to compute the softmax of
+ *              : N         : The number of elements in the data 
+ *        
+ * Outputs      : out       : Device pointer to where the results are stored (can be the same as in)
+ *
+ * Params       : dType     : The type of data
+ * ==========================================================================================================
+ */ 
+template <typename dType>
+void softmaxDeviceGpu( frnn::frnnError& error, frnn::GpuContext& context, 
+                       const dType* in, dType* out, size_t N ) {
+    elementLoader<dType> load = { in };
+    softmaxStableGpu( error, context, 2, load, out, N );
+}
+
 /*
  * ==========================================================================================================
  * Function     : softmaxGpu
@@ -174,112 +420,317 @@ void randGpu( dType* x, size_t N, dType lo, dType hi ) {
  *                  
  *                softmax( x_i ) = exp( x_i ) / sum[ j=1 to J ]( exp( x_j )
  *
- * Inputs       : status    : Cublas status for determining correct completion of operation
+ * Inputs       : error     : fastRNN error type for results of operations
+ *              : context   : The GPU context which provides the stream and the scratch memory
+ *              : x         : Vector to compute the softmax of
  *        
- * Outputs      : x         : Vector to compute the softmax of, and to store the result in
+ * Outputs      : val       : Vector to store the result in
  *
  * Params       : dType     : The type of data (float or int) double not supported due to lack of
  *                            support for doubles in some Nvidia kernel functions
  * ==========================================================================================================
  */ 
-
 template <typename dType>
-void softmaxGpu( frnn::frnnError& error, const std::vector<dType>& x, std::vector<dType>& val ) {
+void softmaxGpu( frnn::frnnError& error, frnn::GpuContext& context, 
+                 const std::vector<dType>& x, std::vector<dType>& val ) {
+    FRNN_PROFILE_GPU( "softmaxGpu", &error, context.stream() );
 
-    dType* in = 0, *out = 0;
-    frnn::functors::exp exp_op;           // Define operation on each element to be exponentiation
+    cudaStream_t        stream = context.stream();
+    dType*              in     = context.scratch<dType>( error, 0, x.size() );
+    dType*              out    = context.scratch<dType>( error, 1, x.size() );
+
+    if ( in == 0 || out == 0 ) return;
 
     // Check output vector can hold all reasults
     if ( val.size() < x.size() ) val.resize( x.size(), 0 );
     
-    // Alllocate memory on the device
-    if ( cudaMalloc( (void**)&in, x.size() * sizeof( dType ) ) != cudaSuccess ) {
-        frnn::err::allocError( error, stringify( in ) );
-    }
-    if ( cudaMalloc( (void**)&out, x.size() * sizeof( dType) ) != cudaSuccess ) {
-        frnn::err::allocError( error, stringify( out ) );
-    }
-    
     // Copy data from x to in
-    if ( cudaMemcpy( in, &x[0], x.size() * sizeof( dType ), cudaMemcpyHostToDevice ) != cudaSuccess ) {
+    if ( frnn::prof::memcpyAsync( in, &x[0], x.size() * sizeof( dType ), cudaMemcpyHostToDevice, stream ) != cudaSuccess ) {
         frnn::err::copyError( error, stringify( in ) );
     }
-    if ( cudaMemset( out, 0, x.size() * sizeof( dType ) ) != cudaSuccess ) {
-        frnn::err::copyError( error, stringify( out ) );
-    }
-    
-    // Determine the size of the grids for the kernel, we need enough blocks
-    // to make sure that each element of the output vector gets a result
-    int threads;
-    x.size() > 256 * MAX_BLOCKS ? threads = 512 : threads = 256;
-    
-    int blocks  = std::min( static_cast<int>( x.size() / threads ), MAX_BLOCKS );
-    if (  blocks * threads < x.size() ) blocks++;
-
-    // Execute kernel to reduce all blocks, using the exp functor to
-    // exponentiate each element before addition
-    blockReduceAtomicVectorizedAll<<<blocks, threads>>>( in, out, x.size(), exp_op );
-    // Copy result from the first thread inea ch block to the others
-    blockScatter<<<blocks, threads>>>( out, x.size() );
-    // Do normalization to get get softmax
-    softmaxKernel<<<blocks, threads>>>( in, out, x.size() );        
-
-    if ( cudaMemcpy( &val[0], out, x.size() * sizeof( dType ), cudaMemcpyDeviceToHost ) != cudaSuccess ) {
+
+    softmaxDeviceGpu( error, context, in, out, x.size() );
+
+    if ( frnn::prof::memcpyAsync( &val[0], out, x.size() * sizeof( dType ), cudaMemcpyDeviceToHost, stream ) != cudaSuccess ) {
         frnn::err::copyError( error, stringify( val ) );
     }
-
-    cudaFree( in ); cudaFree( out );
+    cudaStreamSynchronize( stream );
 }
 
 /*
  * ==========================================================================================================
- * Function     : sumGpu
+ * Function     : softmaxGpu (device tensors)
  *
- * Description  : Performs the sum of the elements in a vector
- *                  
- * Inputs       : error     : fastRNN error type for results of opsofterations
- *              : x         : The vector, araary etc.. (data) to comupte the sum of
+ * Description  : Performs the softmax function on a tensor which is stored on the device, the result stays
+ *                on the device until its host data is read
+ *
+ * Inputs       : error     : fastRNN error type for results of operations
+ *              : context   : The GPU context which provides the stream
+ *              : x         : Tensor to compute the softmax of
  *        
- * Outputs      : val       : The result of the sum of the array 
+ * Outputs      : val       : Tensor to store the result in
  *
- * Params       : dType     : The data type of the array elements
+ * Params       : dType     : The type of data
  * ==========================================================================================================
- */  
+ */ 
 template <typename dType>
-dType sumGpu( frnn::frnnError& error, const std::vector<dType>& x ) {
+void softmaxGpu( frnn::frnnError& error, frnn::GpuContext& context, 
+                 const Tensor4<dType, storage::Device>& x, Tensor4<dType, storage::Device>& val ) {
+    FRNN_PROFILE_GPU( "softmaxGpu", &error, context.stream() );
 
-    dType* in = 0, *out = 0, val = 0;
+    if ( val.size() < x.size() ) {
+        frnn::err::dimError( error, stringify( x ), stringify( val ) );
+        return;
+    }
+    softmaxDeviceGpu( error, context, x.deviceData(), val.deviceData(), x.size() );
+}
 
-    // Alllocate memory on the device
-    if ( cudaMalloc( (void**)&in, x.size() * sizeof( dType ) ) != cudaSuccess ) {
-        frnn::err::allocError( error, stringify( in ) );
+/*
+ * ==========================================================================================================
+ * Function     : reduceLaunchGpu
+ *
+ * Description  : Queues the single pass reduction (see reduceKernel) of an array in device memory on the 
+ *                primary stream of the context with a launch configuration, the result stays on the device
+ *                  
+ * Inputs       : error     : fastRNN error type for results of operations
+ *              : context   : The GPU context which provides the stream and the scratch memory
+ *              : in        : The device array to reduce
+ *              : N         : The number of elements in the array
+ *              : f         : The functor to apply to each element before reducing
+ *              : config    : The block size, the max number of blocks and the width of the loads
+ *        
+ * Outputs      : out       : A pointer to device memory for the result
+ *
+ * Params       : Op        : The reduction operation (frnn::reduce::sum, max, min, argmax or argmin)
+ *              : dType     : The data type of the array elements
+ *              : F         : The type of the functor
+ * ==========================================================================================================
+ */  
+template <typename Op, typename dType, typename F>
+void reduceLaunchGpu( frnn::frnnError& error, frnn::GpuContext& context, const dType* in, size_t N, 
+                      typename Op::template value_type<dType>::type* out, F f, const frnn::launch_config& config ) {
+    typedef typename Op::template value_type<dType>::type vType;
+
+    cudaStream_t    stream   = context.stream();
+    const size_t    threads  = config.threads;
+    const size_t    blocks   = std::max( std::min( ( N / config.width + threads - 1 ) / threads, 
+                                                   static_cast<size_t>( config.blocks ) ), size_t( 1 ) );
+    vType*          partials = context.scratch<vType>( error, 3, blocks );
+    unsigned int*   counter  = context.scratch<unsigned int>( error, 4, 1 );
+
+    if ( partials == 0 || counter == 0 ) return;
+
+    if ( cudaMemsetAsync( counter, 0, sizeof( unsigned int ), stream ) != cudaSuccess ) {
+        frnn::err::copyError( error, stringify( counter ) );
+        return;
     }
-    if ( cudaMalloc( (void**)&out, sizeof( dType) ) != cudaSuccess ) {
-        frnn::err::allocError( error, stringify( out ) );
+    FRNN_COUNT_LAUNCH();
+    switch ( config.width ) {
+        case 1 : reduceKernel<Op, 1><<<blocks, threads, 0, stream>>>( in, N, partials, counter, out, f ); break;
+        case 2 : reduceKernel<Op, 2><<<blocks, threads, 0, stream>>>( in, N, partials, counter, out, f ); break;
+        default: reduceKernel<Op, 4><<<blocks, threads, 0, stream>>>( in, N, partials, counter, out, f ); break;
     }
+}
 
-    // Copy data from x to in
-    if ( cudaMemcpy( in, &x[0], x.size() * sizeof( dType ), cudaMemcpyHostToDevice ) != cudaSuccess ) {
+/*
+ * ==========================================================================================================
+ * Function     : reduceCandidatesGpu
+ *
+ * Description  : Gets the launch configurations which the kernel tuner benchmarks for the single pass
+ *                reduction, the first is the default (256 threads, REDUCE_MAX_BLOCKS blocks and loads of 4
+ *                elements)
+ * ==========================================================================================================
+ */  
+inline const std::vector<frnn::launch_config>& reduceCandidatesGpu() {
+    static const std::vector<frnn::launch_config> candidates = [] {
+        const uint threads[] = { THREADS_PER_BLOCK, 128, 512, 1024 };
+        const uint blocks[]  = { frnn::REDUCE_MAX_BLOCKS, 512, 256, 128 };
+        const uint widths[]  = { 4, 2, 1 };
+
+        std::vector<frnn::launch_config> configs;
+        for ( uint t : threads ) {
+            for ( uint b : blocks ) {
+                for ( uint w : widths ) configs.push_back( frnn::launch_config{ t, b, w } );
+            }
+        }
+        return configs;
+    }();
+    return candidates;
+}
+
+/*
+ * ==========================================================================================================
+ * Function     : reduceDeviceGpu
+ *
+ * Description  : Queues the single pass reduction (see reduceKernel) of an array in device memory on the 
+ *                primary stream of the context, with the launch configuration which the kernel tuner selects
+ *                for the device and the size of the array. The result stays on the device.
+ *                  
+ * Inputs       : error     : fastRNN error type for results of operations
+ *              : context   : The GPU context which provides the stream and the scratch memory
+ *              : in        : The device array to reduce
+ *              : N         : The number of elements in the array
+ *              : f         : The functor to apply to each element before reducing
+ *        
+ * Outputs      : out       : A pointer to device memory for the result
+ *
+ * Params       : Op        : The reduction operation (frnn::reduce::sum, max, min, argmax or argmin)
+ *              : dType     : The data type of the array elements
+ *              : F         : The type of the functor
+ * ==========================================================================================================
+ */  
+template <typename Op, typename dType, typename F>
+void reduceDeviceGpu( frnn::frnnError& error, frnn::GpuContext& context, const dType* in, size_t N, 
+                      typename Op::template value_type<dType>::type* out, F f ) {
+    FRNN_PROFILE_GPU( "reduceDeviceGpu", &error, context.stream() );
+    static const std::string kernel = std::string( "reduce_" ) + typeid( Op ).name() + "_" 
+                                    + typeid( dType ).name() + "_" + typeid( F ).name();
+
+    const frnn::launch_config config = frnn::KernelTuner::global().select( context, kernel, N, reduceCandidatesGpu(),
+        [&]( const frnn::launch_config& candidate ) { reduceLaunchGpu<Op>( error, context, in, N, out, f, candidate ); } );
+    reduceLaunchGpu<Op>( error, context, in, N, out, f, config );
+}
+
+/*
+ * ==========================================================================================================
+ * Function     : reduceSegmentsGpu
+ *
+ * Description  : Queues the reduction of each of M segments of N elements of an array in device memory, 
+ *                where the segments are ld elements apart (see reduceSegmentsKernel), for example the 
+ *                columns of a batch, on the primary stream of the context. The results stay on the device.
+ *                  
+ * Inputs       : context   : The GPU context which provides the stream
+ *              : in        : The device array with the segments
+ *              : N         : The number of elements in each segment
+ *              : M         : The number of segments
+ *              : ld        : The number of elements from the start of one segment to the start of the next
+ *              : f         : The functor to apply to each element before reducing
+ *        
+ * Outputs      : out       : A pointer to device memory for the M results
+ *
+ * Params       : Op        : The reduction operation (frnn::reduce::sum, max, min, argmax or argmin)
+ *              : dType     : The data type of the array elements
+ *              : F         : The type of the functor
+ * ==========================================================================================================
+ */  
+template <typename Op, typename dType, typename F>
+void reduceSegmentsGpu( frnn::GpuContext& context, const dType* in, size_t N, size_t M, size_t ld, 
+                        typename Op::template value_type<dType>::type* out, F f ) {
+    FRNN_PROFILE_GPU( "reduceSegmentsGpu", 0, context.stream() );
+    static const std::string kernel = std::string( "reduceSegments_" ) + typeid( Op ).name() + "_" 
+                                    + typeid( dType ).name() + "_" + typeid( F ).name();
+    if ( M == 0 ) return;
+
+    // A block for each segment, so the problem size is the number of elements of all the segments
+    launchTunedGpu( context, kernel, N * M, [&]( const frnn::launch_config& config ) {
+        reduceSegmentsKernel<Op><<<gridBlocksGpu( config, M, 1 ), config.threads, 0, context.stream()>>>( 
+                in, N, M, ld, out, f );
+    } );
+}
+
+/*
+ * ==========================================================================================================
+ * Function     : reduceGpu
+ *
+ * Description  : Performs a reduction of the elements of a vector
+ *                  
+ * Inputs       : error     : fastRNN error type for results of operations
+ *              : context   : The GPU context which provides the stream and the scratch memory
+ *              : x         : The vector to reduce
+ *              : f         : The functor to apply to each element before reducing
+ *        
+ * Outputs      : The result of the reduction
+ *
+ * Params       : Op        : The reduction operation (frnn::reduce::sum, max, min, argmax or argmin)
+ *              : dType     : The data type of the vector elements
+ *              : F         : The type of the functor
+ * ==========================================================================================================
+ */  
+template <typename Op, typename dType, typename F = functors::voidFunctor>
+typename Op::template value_type<dType>::type reduceGpu( frnn::frnnError& error, frnn::GpuContext& context, 
+                                                         const std::vector<dType>& x, F f = F() ) {
+    FRNN_PROFILE_GPU( "reduceGpu", &error, context.stream() );
+    typedef typename Op::template value_type<dType>::type vType;
+
+    vType           val    = vType();
+    cudaStream_t    stream = context.stream();
+    dType*          in     = context.scratch<dType>( error, 0, x.size() );
+    vType*          out    = context.scratch<vType>( error, 5, 1 );
+
+    if ( in == 0 || out == 0 ) return val;
+
+    if ( x.size() > 0 &&
+         frnn::prof::memcpyAsync( in, &x[0], x.size() * sizeof( dType ), cudaMemcpyHostToDevice, stream ) != cudaSuccess ) {
         frnn::err::copyError( error, stringify( in ) );
     }
-    // Set out to 0 on the device
-    if ( cudaMemsetAsync( out, 0, sizeof( dType) ) != cudaSuccess ) {
+    reduceDeviceGpu<Op>( error, context, in, x.size(), out, f );
+
+    if ( frnn::prof::memcpyAsync( &val, out, sizeof( vType ), cudaMemcpyDeviceToHost, stream ) != cudaSuccess ) {
         frnn::err::copyError( error, stringify( out ) );
     }
+    cudaStreamSynchronize( stream );
+    return val;
+}
+
+/*
+ * ==========================================================================================================
+ * Function     : sumGpu / maxGpu / minGpu / argmaxGpu
+ *
+ * Description  : Performs the sum of, finds the max or the min of, or finds the index of the max of the 
+ *                elements in a vector
+ *                  
+ * Inputs       : error     : fastRNN error type for results of operations
+ *              : context   : The GPU context which provides the stream and the scratch memory
+ *              : x         : The vector, araary etc.. (data) to comupte the result of
+ *        
+ * Outputs      : The result for the vector
+ *
+ * Params       : dType     : The data type of the array elements
+ * ==========================================================================================================
+ */  
+template <typename dType>
+dType sumGpu( frnn::frnnError& error, frnn::GpuContext& context, const std::vector<dType>& x ) {
+    return reduceGpu<frnn::reduce::sum>( error, context, x );
+}
 
-    // 256 threads per block is optimal, however, if this isn't enough use more
-    int threads;
-    x.size() > 256 * MAX_BLOCKS ? threads = 512 : threads = 256;
-    int blocks  = std::min( static_cast<int>( ( ( x.size() / 2 ) + threads - 1 ) / threads ), MAX_BLOCKS );
+template <typename dType>
+dType maxGpu( frnn::frnnError& error, frnn::GpuContext& context, const std::vector<dType>& x ) {
+    return reduceGpu<frnn::reduce::max>( error, context, x );
+}
 
-    blockReduceAtomicVectorized<<<blocks, threads>>>( in, out, x.size() );
+template <typename dType>
+dType minGpu( frnn::frnnError& error, frnn::GpuContext& context, const std::vector<dType>& x ) {
+    return reduceGpu<frnn::reduce::min>( error, context, x );
+}
 
-    if ( cudaMemcpy( &val, out, sizeof( dType ), cudaMemcpyDeviceToHost ) != cudaSuccess ) {
-        frnn::err::copyError( error, stringify( out ) );
-    }
+template <typename dType>
+size_t argmaxGpu( frnn::frnnError& error, frnn::GpuContext& context, const std::vector<dType>& x ) {
+    return static_cast<size_t>( reduceGpu<frnn::reduce::argmax>( error, context, x ).index );
+}
 
-    cudaFree( in ); cudaFree( out );
-    return val;
+/*
+ * ==========================================================================================================
+ * Function     : broadcastGpu
+ *
+ * Description  : Queues the kernel which sets each element of an array in device memory to a value which 
+ *                is in device memory (see broadcast) on the primary stream of the context
+ *
+ * Inputs       : context   : The GPU context which provides the stream
+ *              : N         : The number of elements in the array
+ *              : value     : A pointer to device memory for the value (which must not be in the array)
+ *
+ * Outputs      : x         : The device array where each element is the value
+ *
+ * Params       : dType     : The data type of the array elements
+ * ==========================================================================================================
+ */  
+template <typename dType>
+void broadcastGpu( frnn::GpuContext& context, dType* x, size_t N, const dType* value ) {
+    static const std::string kernel = std::string( "broadcast_" ) + typeid( dType ).name();
+    launchTunedGpu( context, kernel, N, [&]( const frnn::launch_config& config ) {
+        broadcast<<<gridBlocksGpu( config, N, config.threads ), config.threads, 0, context.stream()>>>( 
+                x, N, value );
+    } );
 }
 
 /*
@@ -290,6 +741,7 @@ dType sumGpu( frnn::frnnError& error, const std::vector<dType>& x ) {
  *                dimension with each element having the result
  *                  
  * Inputs       : error     : fastRNN error type for results of operations
+ *              : context   : The GPU context which provides the stream and the scratch memory
  *              : x         : The vector, araary etc.. (data) to comupte the sum of
  *        
  * Outputs      : val       : A vector where each element holds the result of the sum
@@ -298,45 +750,144 @@ dType sumGpu( frnn::frnnError& error, const std::vector<dType>& x ) {
  * ==========================================================================================================
  */  
 template <typename dType>
-void sumVectorizedGpu( frnnError& error, const std::vector<dType>& x, std::vector<dType>& val ) {
-
-    dType* in = 0, *out = 0;
+void sumVectorizedGpu( frnnError& error, frnn::GpuContext& context, 
+                       const std::vector<dType>& x, std::vector<dType>& val ) {
+    FRNN_PROFILE_GPU( "sumVectorizedGpu", &error, context.stream() );
+
+    cudaStream_t    stream = context.stream();
+    dType*          in     = context.scratch<dType>( error, 0, x.size() );
+    dType*          out    = context.scratch<dType>( error, 1, x.size() );
+    dType*          sum    = context.scratch<dType>( error, 5, 1 );
     
+    if ( in == 0 || out == 0 || sum == 0 || x.size() == 0 ) return;
+
     // Check output vector can hold results
-    if ( val.capacity() < x.size() ) val.reserve( x.size() );
+    if ( val.size() < x.size() ) val.resize( x.size(), 0 );
 
-    // Alllocate memory on the device
-    if ( cudaMalloc( (void**)&in, x.size() * sizeof( dType ) ) != cudaSuccess ) {
-        frnn::err::allocError( error, stringify( in ) );
-    }
-    if ( cudaMalloc( (void**)&out, x.size() * sizeof( dType) ) != cudaSuccess ) {
-        frnn::err::allocError( error, stringify( out ) );
-    }
-    
     // Copy data from x to in
-    if ( cudaMemcpy( in, &x[0], x.size() * sizeof( dType ), cudaMemcpyHostToDevice ) != cudaSuccess ) {
+    if ( frnn::prof::memcpyAsync( in, &x[0], x.size() * sizeof( dType ), cudaMemcpyHostToDevice, stream ) != cudaSuccess ) {
         frnn::err::copyError( error, stringify( in ) );
     }
-    if ( cudaMemset( out, 0, x.size() * sizeof( dType ) ) != cudaSuccess ) {
-        frnn::err::copyError( error, stringify( out ) );
-    }
     
-    // Determine the size of the grids for the kernel, we need enough blocks
-    // to make sure that each element of the output vector gets a result
-    int threads;
-    x.size() > 256 * MAX_BLOCKS ? threads = 512 : threads = 256;
-    int blocks  = std::min( static_cast<int>( x.size() / threads ), MAX_BLOCKS );
-    if (  blocks * threads < x.size() ) blocks++;
-
-    blockReduceAtomicVectorizedAll<<<blocks, threads>>>( in, out, x.size() );
-    // Copy result from first thread in each block to the others
-    blockScatter<<<blocks, threads>>>( out, x.size() );         
-
-    if ( cudaMemcpy( &val[0], out, x.size() * sizeof( dType ), cudaMemcpyDeviceToHost ) != cudaSuccess ) {
+    reduceDeviceGpu<frnn::reduce::sum>( error, context, in, x.size(), sum, functors::voidFunctor() );
+    broadcastGpu( context, out, x.size(), sum );
+
+    if ( frnn::prof::memcpyAsync( &val[0], out, x.size() * sizeof( dType ), cudaMemcpyDeviceToHost, stream ) != cudaSuccess ) {
         frnn::err::copyError( error, stringify( val ) );
     }
+    cudaStreamSynchronize( stream );
+}
+
+/*
+ * ==========================================================================================================
+ * Function     : sumVectorizedGpu (device tensors)
+ *
+ * Description  : Performs the sum of the elements in a tensor which is stored on the device and stores the 
+ *                result in each element of the output tensor, which stays on the device
+ *                  
+ * Inputs       : error     : fastRNN error type for results of operations
+ *              : context   : The GPU context which provides the stream
+ *              : x         : The tensor to comupte the sum of
+ *        
+ * Outputs      : val       : A tensor where each element holds the result of the sum (must not be x)
+ *
+ * Params       : dType     : The data type of the tensor elements
+ * ==========================================================================================================
+ */  
+template <typename dType>
+void sumVectorizedGpu( frnnError& error, frnn::GpuContext& context, 
+                       const Tensor4<dType, storage::Device>& x, Tensor4<dType, storage::Device>& val ) {
+    FRNN_PROFILE_GPU( "sumVectorizedGpu", &error, context.stream() );
+
+    size_t N = x.size();
+
+    if ( val.size() < N ) {
+        frnn::err::dimError( error, stringify( x ), stringify( val ) );
+        return;
+    }
+
+    dType* sum = context.scratch<dType>( error, 5, 1 );
+    if ( sum == 0 || N == 0 ) return;
+
+    reduceDeviceGpu<frnn::reduce::sum>( error, context, x.deviceData(), N, sum, functors::voidFunctor() );
+    broadcastGpu( context, val.deviceData(), N, sum );
+}
+
+namespace frnn {
+
+const size_t SUM_VECTORS_MIN_SEGMENT   = 32;            // Min vectors which a block row of sumVectorsKernel sums
+const size_t SUM_VECTORS_TARGET_BLOCKS = 256;           // Blocks to aim for to keep all the SMs busy
+
+}   // Namespace frnn
+
+/*
+ * ==========================================================================================================
+ * Function     : sumVectorsGpu
+ *
+ * Description  : Computes the elementwise sum of M vectors in device memory (the columns of a column major
+ *                matrix), for example the W*x + b results of the pages of a layer. When there are too few
+ *                elements to keep the device busy, the vectors are split into segments which are summed by
+ *                different block rows, and the segment sums are then summed by a second pass (see NOTES 2).
+ *                The kernels are queued on the primary stream of the context.
+ *
+ * Inputs       : error     : fastRNN error type for results of operations
+ *              : context   : The GPU context which provides the stream and the allocator
+ *              : vectors   : The vectors to sum, vector v starts at vectors + v * ld
+ *              : N         : The number of elements in each vector
+ *              : M         : The number of vectors
+ *              : ld        : The leading dimension of the vectors (at least N)
+ *
+ * Outputs      : out       : A pointer to device memory for the N elements of the sum (which must not be in
+ *                            the vectors)
+ *
+ * Params       : dType     : The data type of the vectors
+ * ==========================================================================================================
+ */
+template <typename dType>
+void sumVectorsGpu( frnnError& error, frnn::GpuContext& context, const dType* vectors, size_t N, size_t M, 
+                    size_t ld, dType* out ) {
+    FRNN_PROFILE_GPU( "sumVectorsGpu", &error, context.stream() );
+    cudaStream_t stream   = context.stream();
+    const size_t blocks_x = std::min( ( N + THREADS_PER_BLOCK - 1 ) / THREADS_PER_BLOCK, static_cast<size_t>( MAX_BLOCKS ) );
+
+    if ( N == 0 ) return;
+    if ( ld < N ) {
+        frnn::err::dimError( error, stringify( ld ), stringify( N ) );
+        return;
+    }
+    if ( M == 0 ) {
+        FRNN_COUNT_LAUNCH();
+        fill<<<blocks_x, THREADS_PER_BLOCK, 0, stream>>>( out, N, dType( 0 ) );
+        return;
+    }
+
+    // Only as many segments as are needed to fill the device, each with at least SUM_VECTORS_MIN_SEGMENT vectors
+    const size_t segments = std::min( ( M + frnn::SUM_VECTORS_MIN_SEGMENT - 1 ) / frnn::SUM_VECTORS_MIN_SEGMENT, 
+                                      ( frnn::SUM_VECTORS_TARGET_BLOCKS + blocks_x - 1 ) / blocks_x     );
+    
+    // The segments come from the default configuration, so the order of the additions (and the sum) is the
+    // same for the configuration which the tuner selects, which only changes the threads and blocks_x
+    static const std::string kernel          = std::string( "sumVectors_" ) + typeid( dType ).name();
+    static const std::string segments_kernel = std::string( "sumVectorSegments_" ) + typeid( dType ).name();
+    if ( segments == 1 ) {
+        launchTunedGpu( context, kernel, N * M, [&]( const frnn::launch_config& config ) {
+            sumVectorsKernel<<<gridBlocksGpu( config, N, config.threads ), config.threads, 0, stream>>>( 
+                    vectors, N, M, ld, out, N );
+        } );
+        return;
+    }
 
-    cudaFree( in ); cudaFree( out );
+    dType* partials = static_cast<dType*>( context.allocator().allocate( error, segments * N * sizeof( dType ), stream ) );
+    if ( partials == 0 ) return;
+
+    FRNN_COUNT_LAUNCH();
+    launchTunedGpu( context, segments_kernel, N * M, [&]( const frnn::launch_config& config ) {
+        const size_t blocks = gridBlocksGpu( config, N, config.threads );
+        sumVectorsKernel<<<dim3( blocks, segments ), config.threads, 0, stream>>>( 
+                vectors, N, M, ld, partials, N );
+        sumVectorsKernel<<<blocks, config.threads, 0, stream>>>( partials, N, segments, N, out, N );
+    } );
+    context.allocator().deallocate( partials );
 }
 
 #endif
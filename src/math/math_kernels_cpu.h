@@ -0,0 +1,539 @@
+/*
+ *  Header file for fastRNN CPU math kernels. Each kernel is written once on
+ *  the vectorized instructions of an instruction set, and is run with
+ *  dispatchCpu for the widest instruction set which the CPU supports.
+ *
+ *  Copyright (C) 2015 Rob Clucas robclu1818@gmail.com
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published
+ *  by the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT AN_size.y WARRANTY; without even the implied warranty of
+ *  MERCHANTABILIT_size.y or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program; if not, write to the Free Software Foundation,
+ *  Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#ifndef _FRNN_MATH_KERNELS_CPU_
+#define _FRNN_MATH_KERNELS_CPU_
+
+#include <cmath>
+#include <type_traits>
+
+#include "../frnn/types.h"
+#include "../frnn/aligned_allocator.h"
+#include "rand/frnn_philox.h"
+
+/* ============================================= NOTES ======================================================
+ *
+ * 1. Kernels which store a result split the output with alignedSplit (see aligned_allocator.h), the scalar
+ *    version of the kernel does the prologue and the epilogue, and the body uses aligned stores (and aligned
+ *    loads of the output, for kernels which update it). The inputs are loaded with unaligned loads, which  
+ *    are as fast as aligned loads when the inputs have the same alignment as the output (as the host data
+ *    of tensors has), and still correct when they don't.
+ *
+ * 2. Reductions keep unaligned loads from the start of the array, so that the order in which the elements
+ *    are added (and so the result) doesn't depend on where the array is in memory.
+ *
+ * 3. The ABI warnings of GCC (-Wpsabi) are disabled for the kernels, since they are always inlined into the
+ *    entry of their instruction set (see NOTES 5 of vectorized_types_cpu.h).
+ *
+ * ==========================================================================================================
+ */
+
+#if defined( __GNUC__ ) && !defined( __clang__ )
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wpsabi"
+#endif
+
+namespace frnn {
+namespace cpu  {
+
+/*
+ * ==========================================================================================================
+ * Struct       : VectorizedCpu
+ * 
+ * Description  : If a type has vectorized instructions for all the CPU instruction sets, types which don't
+ *                (ints for example) use the scalar version of the kernels
+ *                
+ * Params       : dType     : The type to check
+ * ==========================================================================================================
+ */
+template <typename dType> struct VectorizedCpu         : std::false_type {};
+template <>               struct VectorizedCpu<float>  : std::true_type  {};
+template <>               struct VectorizedCpu<double> : std::true_type  {};
+
+/*
+ * ==========================================================================================================
+ * Struct       : KernelCpu
+ * 
+ * Description  : Runs a kernel with dispatchCpu if the type has vectorized instructions, and otherwise with
+ *                the scalar version of the kernel (the static function scalar( args... ) of the kernel, 
+ *                which is also what the vectorized versions use for the remaining elements)
+ *                
+ * Params       : kernel        : The kernel struct
+ *              : vectorized    : If the type of the data for the kernel has vectorized instructions
+ * ==========================================================================================================
+ */
+template <typename kernel, bool vectorized> struct KernelCpu {
+    template <typename... Args>
+    static inline auto run( Args... args ) -> decltype( dispatchCpu<kernel>( args... ) ) {
+        return dispatchCpu<kernel>( args... );
+    }
+};
+
+template <typename kernel> struct KernelCpu<kernel, false> {
+    template <typename... Args>
+    static inline auto run( Args... args ) -> decltype( kernel::scalar( args... ) ) {
+        return kernel::scalar( args... );
+    }
+};
+
+/*
+ * ==========================================================================================================
+ * Struct       : xmyKernel
+ * 
+ * Description  : Kernel which computes X minus Y for two arrays X and Y, a vector at a time with the 
+ *                elements before and after the aligned vectors of the result done one at a time
+ *                
+ * Inputs       : x         : The first input array
+ *              : y         : The second input array
+ *              : N         : The number of elements in the arrays
+ *              
+ * Outputs      : result    : The result of X - Y (which can be x or y)
+ * ==========================================================================================================
+ */
+struct xmyKernel {
+    template <cpu_isa isa, typename dType>
+    FRNN_CPU_KERNEL static void run( const dType* x, const dType* y, dType* result, size_t N ) {
+        typedef VectorizedInstructionsCpu<dType, isa> vect_ins;
+        typedef typename vect_ins::vect_type          vect_type;
+        
+        const size_t        step  = vect_ins::width();
+        const aligned_split split = alignedSplit( result, N, step, sizeof( vect_type ) );
+        size_t              i     = split.head;
+        
+        scalar( x, y, result, i );
+        for ( const size_t end = i + split.vectors * step; i < end; i += step ) {
+            vect_ins::storeAligned( result + i, vect_ins::sub( vect_ins::load( x + i ), vect_ins::load( y + i ) ) );
+        }
+        scalar( x + i, y + i, result + i, split.tail );
+    }
+    
+    template <typename dType>
+    static inline void scalar( const dType* x, const dType* y, dType* result, size_t N ) {
+        for ( size_t i = 0; i < N; i++ ) result[ i ] = x[ i ] - y[ i ];
+    }
+};
+
+/*
+ * ==========================================================================================================
+ * Struct       : axpyKernel
+ * 
+ * Description  : Kernel which computes a*X plus Y for two arrays X and Y, and stores the result in Y
+ *                
+ * Inputs       : a         : The constant to multiply X with
+ *              : x         : The array to multiply with a
+ *              : y         : The array to add to a*X
+ *              : N         : The number of elements in the arrays
+ *              
+ * Outputs      : y         : The result of a*X + Y
+ * ==========================================================================================================
+ */
+struct axpyKernel {
+    template <cpu_isa isa, typename dType>
+    FRNN_CPU_KERNEL static void run( dType a, const dType* x, dType* y, size_t N ) {
+        typedef VectorizedInstructionsCpu<dType, isa> vect_ins;
+        typedef typename vect_ins::vect_type          vect_type;
+        
+        const size_t        step  = vect_ins::width();
+        const vect_type     a_v   = vect_ins::set1( a );
+        const aligned_split split = alignedSplit( y, N, step, sizeof( vect_type ) );
+        size_t              i     = split.head;
+        
+        scalar( a, x, y, i );
+        for ( const size_t end = i + split.vectors * step; i < end; i += step ) {
+            vect_ins::storeAligned( y + i, vect_ins::fma( a_v, vect_ins::load( x + i ), vect_ins::loadAligned( y + i ) ) );
+        }
+        scalar( a, x + i, y + i, split.tail );
+    }
+    
+    template <typename dType>
+    static inline void scalar( dType a, const dType* x, dType* y, size_t N ) {
+        for ( size_t i = 0; i < N; i++ ) y[ i ] += a * x[ i ];
+    }
+};
+
+/*
+ * ==========================================================================================================
+ * Struct       : scaleKernel
+ * 
+ * Description  : Kernel which multiplies each element of an array X by a constant
+ *                
+ * Inputs       : a         : The constant to multiply X with
+ *              : x         : The array to scale
+ *              : N         : The number of elements in the array
+ *              
+ * Outputs      : x         : The result of a*X
+ * ==========================================================================================================
+ */
+struct scaleKernel {
+    template <cpu_isa isa, typename dType>
+    FRNN_CPU_KERNEL static void run( dType a, dType* x, size_t N ) {
+        typedef VectorizedInstructionsCpu<dType, isa> vect_ins;
+        typedef typename vect_ins::vect_type          vect_type;
+        
+        const size_t        step  = vect_ins::width();
+        const vect_type     a_v   = vect_ins::set1( a );
+        const aligned_split split = alignedSplit( x, N, step, sizeof( vect_type ) );
+        size_t              i     = split.head;
+        
+        scalar( a, x, i );
+        for ( const size_t end = i + split.vectors * step; i < end; i += step ) {
+            vect_ins::storeAligned( x + i, vect_ins::mul( a_v, vect_ins::loadAligned( x + i ) ) );
+        }
+        scalar( a, x + i, split.tail );
+    }
+    
+    template <typename dType>
+    static inline void scalar( dType a, dType* x, size_t N ) {
+        for ( size_t i = 0; i < N; i++ ) x[ i ] *= a;
+    }
+};
+
+/*
+ * ==========================================================================================================
+ * Struct       : sumKernel
+ * 
+ * Description  : Kernel which computes the sum of the elements of an array. Four vector accumulators are 
+ *                used so that the adds don't all wait on the one before them.
+ *                
+ * Inputs       : x         : The array to sum
+ *              : N         : The number of elements in the array
+ *              
+ * Outputs      : The sum of the elements
+ * ==========================================================================================================
+ */
+struct sumKernel {
+    template <cpu_isa isa, typename dType>
+    FRNN_CPU_KERNEL static dType run( const dType* x, size_t N ) {
+        typedef VectorizedInstructionsCpu<dType, isa> vect_ins;
+        typedef typename vect_ins::vect_type          vect_type;
+        
+        const size_t step = vect_ins::width();
+        vect_type    acc0 = vect_ins::set1( 0 ), acc1 = acc0, acc2 = acc0, acc3 = acc0;
+        size_t       i    = 0;
+        for ( ; i + 4 * step <= N; i += 4 * step ) {
+            acc0 = vect_ins::add( acc0, vect_ins::load( x + i            ) );
+            acc1 = vect_ins::add( acc1, vect_ins::load( x + i + step     ) );
+            acc2 = vect_ins::add( acc2, vect_ins::load( x + i + 2 * step ) );
+            acc3 = vect_ins::add( acc3, vect_ins::load( x + i + 3 * step ) );
+        }
+        for ( ; i + step <= N; i += step ) acc0 = vect_ins::add( acc0, vect_ins::load( x + i ) );
+        
+        acc0 = vect_ins::add( vect_ins::add( acc0, acc1 ), vect_ins::add( acc2, acc3 ) );
+        return vect_ins::sum( acc0 ) + scalar( x + i, N - i );
+    }
+    
+    template <typename dType>
+    static inline dType scalar( const dType* x, size_t N ) {
+        dType total = 0;
+        for ( size_t i = 0; i < N; i++ ) total += x[ i ];
+        return total;
+    }
+};
+
+/*
+ * ==========================================================================================================
+ * Struct       : dotKernel
+ * 
+ * Description  : Kernel which computes the dot product of two arrays X and Y
+ *                
+ * Inputs       : x         : The first array
+ *              : y         : The second array
+ *              : N         : The number of elements in the arrays
+ *              
+ * Outputs      : The dot product of X and Y
+ * ==========================================================================================================
+ */
+struct dotKernel {
+    template <cpu_isa isa, typename dType>
+    FRNN_CPU_KERNEL static dType run( const dType* x, const dType* y, size_t N ) {
+        typedef VectorizedInstructionsCpu<dType, isa> vect_ins;
+        typedef typename vect_ins::vect_type          vect_type;
+        
+        const size_t step = vect_ins::width();
+        vect_type    acc0 = vect_ins::set1( 0 ), acc1 = acc0;
+        size_t       i    = 0;
+        for ( ; i + 2 * step <= N; i += 2 * step ) {
+            acc0 = vect_ins::fma( vect_ins::load( x + i ), vect_ins::load( y + i ), acc0 );
+            acc1 = vect_ins::fma( vect_ins::load( x + i + step ), vect_ins::load( y + i + step ), acc1 );
+        }
+        for ( ; i + step <= N; i += step ) acc0 = vect_ins::fma( vect_ins::load( x + i ), vect_ins::load( y + i ), acc0 );
+        
+        return vect_ins::sum( vect_ins::add( acc0, acc1 ) ) + scalar( x + i, y + i, N - i );
+    }
+    
+    template <typename dType>
+    static inline dType scalar( const dType* x, const dType* y, size_t N ) {
+        dType total = 0;
+        for ( size_t i = 0; i < N; i++ ) total += x[ i ] * y[ i ];
+        return total;
+    }
+};
+
+/*
+ * ==========================================================================================================
+ * Struct       : maxKernel
+ * 
+ * Description  : Kernel which finds the largest element of an array (which must not be empty)
+ *                
+ * Inputs       : x         : The array to find the max of
+ *              : N         : The number of elements in the array
+ *              
+ * Outputs      : The largest element
+ * ==========================================================================================================
+ */
+struct maxKernel {
+    template <cpu_isa isa, typename dType>
+    FRNN_CPU_KERNEL static dType run( const dType* x, size_t N ) {
+        typedef VectorizedInstructionsCpu<dType, isa> vect_ins;
+        typedef typename vect_ins::vect_type          vect_type;
+        
+        const size_t step = vect_ins::width();
+        if ( N < step ) return scalar( x, N );
+        
+        vect_type    acc  = vect_ins::load( x );
+        size_t       i    = step;
+        for ( ; i + step <= N; i += step ) acc = vect_ins::max( acc, vect_ins::load( x + i ) );
+        
+        dType result = vect_ins::maxAll( acc );
+        for ( ; i < N; i++ ) result = x[ i ] > result ? x[ i ] : result;
+        return result;
+    }
+    
+    template <typename dType>
+    static inline dType scalar( const dType* x, size_t N ) {
+        dType result = x[ 0 ];
+        for ( size_t i = 1; i < N; i++ ) result = x[ i ] > result ? x[ i ] : result;
+        return result;
+    }
+};
+
+/*
+ * ==========================================================================================================
+ * Struct       : expSumKernel
+ * 
+ * Description  : Kernel which computes exp( x_i - shift ) for each element of an array, and the sum of the 
+ *                results. With the shift as the max of the array this is the first pass of a (numerically 
+ *                stable) softmax.
+ *                
+ * Inputs       : x         : The input array
+ *              : shift     : The value to subtract from each element before the exp
+ *              : N         : The number of elements in the arrays
+ *              
+ * Outputs      : out       : The results of exp( x_i - shift ) (which can be x)
+ *              : The sum of the results
+ * ==========================================================================================================
+ */
+struct expSumKernel {
+    template <cpu_isa isa, typename dType>
+    FRNN_CPU_KERNEL static dType run( const dType* x, dType shift, dType* out, size_t N ) {
+        typedef VectorizedInstructionsCpu<dType, isa> vect_ins;
+        typedef typename vect_ins::vect_type          vect_type;
+        
+        const size_t    step    = vect_ins::width();
+        const vect_type shift_v = vect_ins::set1( shift );
+        vect_type       acc     = vect_ins::set1( 0 );
+        size_t          i       = 0;
+        for ( ; i + step <= N; i += step ) {
+            vect_type e = vect_ins::exp( vect_ins::sub( vect_ins::load( x + i ), shift_v ) );
+            vect_ins::store( out + i, e );
+            acc = vect_ins::add( acc, e );
+        }
+        return vect_ins::sum( acc ) + scalar( x + i, shift, out + i, N - i );
+    }
+    
+    template <typename dType>
+    static inline dType scalar( const dType* x, dType shift, dType* out, size_t N ) {
+        dType total = 0;
+        for ( size_t i = 0; i < N; i++ ) {
+            out[ i ] = static_cast<dType>( std::exp( x[ i ] - shift ) );
+            total   += out[ i ];
+        }
+        return total;
+    }
+};
+
+/*
+ * ==========================================================================================================
+ * Struct       : momentumKernel
+ * 
+ * Description  : Kernel which updates the weights with gradient descent with momentum, the update of each 
+ *                element is delta = momentum * delta - learn_rate * gradient, which is added to the weight
+ *                and stored for the next update
+ *                
+ * Inputs       : gradients     : The gradient of each weight
+ *              : N             : The number of weights
+ *              : learn_rate    : The learning rate of the update
+ *              : momentum      : The fraction of the previous update to add
+ *              
+ * Outputs      : weights       : The updated weights
+ *              : deltas        : The updates of the weights (for the next update)
+ * ==========================================================================================================
+ */
+struct momentumKernel {
+    template <cpu_isa isa, typename dType>
+    FRNN_CPU_KERNEL static void run( dType* weights, dType* deltas, const dType* gradients, size_t N, 
+                                     dType learn_rate, dType momentum ) {
+        typedef VectorizedInstructionsCpu<dType, isa> vect_ins;
+        typedef typename vect_ins::vect_type          vect_type;
+        
+        const size_t        step  = vect_ins::width();
+        const vect_type     m_v   = vect_ins::set1( momentum );
+        const vect_type     lr_v  = vect_ins::set1( -learn_rate );
+        const aligned_split split = alignedSplit( weights, N, step, sizeof( vect_type ) );
+        size_t              i     = split.head;
+        
+        scalar( weights, deltas, gradients, i, learn_rate, momentum );
+        for ( const size_t end = i + split.vectors * step; i < end; i += step ) {
+            vect_type delta = vect_ins::fma( lr_v, vect_ins::load( gradients + i ), 
+                                             vect_ins::mul( m_v, vect_ins::load( deltas + i ) ) );
+            vect_ins::store( deltas + i, delta );
+            vect_ins::storeAligned( weights + i, vect_ins::add( vect_ins::loadAligned( weights + i ), delta ) );
+        }
+        scalar( weights + i, deltas + i, gradients + i, split.tail, learn_rate, momentum );
+    }
+    
+    template <typename dType>
+    static inline void scalar( dType* weights, dType* deltas, const dType* gradients, size_t N, 
+                               dType learn_rate, dType momentum ) {
+        for ( size_t i = 0; i < N; i++ ) {
+            deltas[ i ]   = momentum * deltas[ i ] - learn_rate * gradients[ i ];
+            weights[ i ] += deltas[ i ];
+        }
+    }
+};
+
+/*
+ * ==========================================================================================================
+ * Struct       : dotInt8Kernel
+ * 
+ * Description  : Kernel which computes the dot product of two int8 arrays, in int32 (which is exact for 
+ *                arrays of up to 2^17 elements). body is the kernel for any int8 instructions struct, so
+ *                that it's also used with the VNNI instructions (see vectorized_types_cpu.h NOTES 4).
+ *                
+ * Inputs       : x         : The first array
+ *              : y         : The second array
+ *              : N         : The number of elements in the arrays
+ *              
+ * Outputs      : The dot product of x and y
+ * ==========================================================================================================
+ */
+struct dotInt8Kernel {
+    template <cpu_isa isa>
+    FRNN_CPU_KERNEL static int32_t run( const int8_t* x, const int8_t* y, size_t N ) {
+        return body<VectorizedInstructionsCpu<int8_t, isa> >( x, y, N );
+    }
+    
+    template <typename vect_ins>
+    FRNN_CPU_KERNEL static int32_t body( const int8_t* x, const int8_t* y, size_t N ) {
+        typedef typename vect_ins::acc_type acc_type;
+        
+        const size_t step = vect_ins::width();
+        acc_type     acc  = vect_ins::zero();
+        size_t       i    = 0;
+        for ( ; i + step <= N; i += step ) acc = vect_ins::dot( acc, vect_ins::load( x + i ), vect_ins::load( y + i ) );
+        return vect_ins::sum( acc ) + scalar( x + i, y + i, N - i );
+    }
+    
+    static inline int32_t scalar( const int8_t* x, const int8_t* y, size_t N ) {
+        int32_t total = 0;
+        for ( size_t i = 0; i < N; i++ ) total += static_cast<int32_t>( x[ i ] ) * static_cast<int32_t>( y[ i ] );
+        return total;
+    }
+};
+
+/*
+ * ==========================================================================================================
+ * Struct       : philoxUniformKernel
+ * 
+ * Description  : Kernel which fills an array with elements offset to offset + N - 1 of the Philox stream
+ *                for a seed (see frnn_philox.h), as uniform numbers on the range [lo, hi). The blocks of 
+ *                the stream are made BATCH at a time, with the rounds done in arrays of the words of each
+ *                block, so that they are vectorized with the integer instructions of the instruction set 
+ *                (the vectorized instructions structs only have floating point instructions).
+ *                
+ * Inputs       : N         : The number of elements to fill
+ *              : lo        : The lower bound for each random number
+ *              : hi        : The upper bound for each random number
+ *              : seed      : The seed of the stream
+ *              : offset    : The index in the stream of the first element
+ *              
+ * Outputs      : x         : The array of random numbers
+ * ==========================================================================================================
+ */
+struct philoxUniformKernel {
+    static constexpr size_t BATCH = 16;
+    
+    template <cpu_isa isa, typename dType>
+    FRNN_CPU_KERNEL static void run( dType* x, size_t N, dType lo, dType hi, unsigned long long seed, 
+                                     unsigned long long offset ) {
+        generate( x, N, lo, hi, seed, offset );
+    }
+    
+    template <typename dType>
+    static inline void scalar( dType* x, size_t N, dType lo, dType hi, unsigned long long seed, 
+                               unsigned long long offset ) {
+        generate( x, N, lo, hi, seed, offset );
+    }
+    
+    template <typename dType>
+    FRNN_CPU_KERNEL static void generate( dType* x, size_t N, dType lo, dType hi, unsigned long long seed,
+                                          unsigned long long offset ) {
+        typedef frnn::rng::PhiloxUniform<dType> uniform;
+        
+        const unsigned long long per_block = 4 / uniform::words;          // Elements in each block
+        const unsigned long long end       = offset + N;
+        uint32_t                 c0[ BATCH ], c1[ BATCH ], c2[ BATCH ], c3[ BATCH ];
+        
+        for ( unsigned long long block = offset / per_block; block * per_block < end; block += BATCH ) {
+            for ( size_t l = 0; l < BATCH; l++ ) {
+                c0[ l ] = static_cast<uint32_t>( block + l );
+                c1[ l ] = static_cast<uint32_t>( ( block + l ) >> 32 );
+                c2[ l ] = 0; 
+                c3[ l ] = 0;
+            }
+            uint32_t k0 = static_cast<uint32_t>( seed ), k1 = static_cast<uint32_t>( seed >> 32 );
+            for ( int round = 0; round < frnn::rng::PHILOX_ROUNDS; round++ ) {
+                for ( size_t l = 0; l < BATCH; l++ ) frnn::rng::philoxRound( c0[ l ], c1[ l ], c2[ l ], c3[ l ], k0, k1 );
+                k0 += frnn::rng::PHILOX_W0;
+                k1 += frnn::rng::PHILOX_W1;
+            }
+            
+            // Convert the words of the blocks which are in the range of the array
+            for ( size_t l = 0; l < BATCH; l++ ) {
+                const uint32_t w[ 4 ] = { c0[ l ], c1[ l ], c2[ l ], c3[ l ] };
+                for ( unsigned long long j = 0; j < per_block; j++ ) {
+                    const unsigned long long e = ( block + l ) * per_block + j;
+                    if ( e >= offset && e < end ) x[ e - offset ] = uniform::convert( w + j * uniform::words, lo, hi );
+                }
+            }
+        }
+    }
+};
+
+}   // Namespace cpu
+}   // Namespace frnn
+
+#if defined( __GNUC__ ) && !defined( __clang__ )
+#pragma GCC diagnostic pop
+#endif
+
+#endif
@@ -26,9 +26,12 @@
 
 #include <math.h>
 #include <cmath>
+#include <cfloat>
 
 #include "../frnn/types.h"
 #include "../functors/functors.cuh"
+#include "reduce_kernels_gpu.cuh"
+#include "rand/frnn_philox.h"
 
 /* ============================================= NOTES ======================================================
  *
@@ -44,13 +47,15 @@ using namespace frnn;
  * ==========================================================================================================
  * Function     : atomicAdd
  * 
- * Description  : Provides atotic addition for doubles - provided by Nvidia C programming guide.
+ * Description  : Provides atotic addition for doubles - provided by Nvidia C programming guide. Devices of
+ *                sm_60 and later have it natively (and it can't be redefined), so it's only for older ones.
  * 
  * Inputs       : address   : The address of the variable to be added to
  *              : val       : The val to add to the address 
  * ==========================================================================================================
  */
-__device__ double atomicAdd( double* address, double val ) { 
+#if defined( __CUDA_ARCH__ ) && __CUDA_ARCH__ < 600
+__device__ inline double atomicAdd( double* address, double val ) { 
     unsigned long long int* address_as_ull = (unsigned long long int*)address; 
     unsigned long long int  old            = *address_as_ull, assumed; 
     do { 
@@ -63,322 +68,317 @@ __device__ double atomicAdd( double* address, double val ) {
     
     return __longlong_as_double( old ); 
 }
+#endif
 
 /*
  * ==========================================================================================================
- * Function     : xpny (x plus ny )
- *                
- * Description  : Performs vector addition of x plus n other vectors and stores the result in x
- * 
- * Inputs       : vectors   : An array of pointers where each pointer N in the array is a pointer to the Nth
- *                            vector for the vector addition
+ * Function     : sumVectorsKernel
+ *
+ * Description  : Computes the elementwise sum of a segment of M vectors, which are the columns of a (column
+ *                major) matrix. Block row y of the grid sums segment y of the vectors (gridDim.y segments of
+ *                about M / gridDim.y vectors) into column y of out, and each thread sums its elements over 
+ *                the vectors of the segment in order, so the reads of a warp are coalesced, no shared memory
+ *                is used, and the result is the same for every run.
+ *
+ * Inputs       : vectors   : The vectors to sum, vector v starts at vectors + v * ld
  *              : N         : The number of elements in each vector
- *              : M         : The number of vectors for the vector addition
+ *              : M         : The number of vectors
+ *              : ld        : The leading dimension of the vectors (distance between the starts of vectors)
+ *              : out_ld    : The leading dimension of the output (for more than one segment)
+ *
+ * Outputs      : out       : The sum of each segment (the sum of all the vectors for one segment)
  *
- * Outputs      : The oututs are stored in the first vector of the vector addition
- * 
  * Params       : dType     : The type of data of the vectors
  * ==========================================================================================================
  */
 template <typename dType>
-__inline__ __global__ void xpny( dType** vectors, size_t N, size_t M ) {
-    int idx = blockIdx.x * blockDim.x + threadIdx.x;
-    int idy = blockIdx.y * blockDim.y + threadIdx.y;
-    int y_stride = M / 2;
-
-    extern __shared__ dType shared_mem[];
-
-    if ( idy < y_stride ) {
-        shared_mem[ ( idx * y_stride ) + idy ] 
-            = vectors[ idy ][ idx ] + vectors[ idy + ( M / 2 ) ][ idx ];
-    }
-
-    // Add lasit elements if M = odd
-    if ( ( M & 1 != 0 ) && idy == 0 ) shared_mem[ idx * y_stride ] += vectors[ M - 1 ][ idx ];
-    __syncthreads();
-
-    if ( idy == 0 ) {
-        vectors[ 0 ][ idx ] = 0;                        // Bad - need to improve this
-        for ( int i = 0; i < ( M / 2 ); i++ ) {
-            vectors[0][idx] += shared_mem[ idx * y_stride + i ];
-        }
+__global__ void sumVectorsKernel( const dType* vectors, size_t N, size_t M, size_t ld, dType* out, size_t out_ld ) {
+    const size_t per_segment = ( M + gridDim.y - 1 ) / gridDim.y;
+    const size_t first       = blockIdx.y * per_segment;
+    const size_t last        = first + per_segment < M ? first + per_segment : M;
+    
+    for ( size_t i = blockIdx.x * blockDim.x + threadIdx.x; i < N; i += blockDim.x * gridDim.x ) {
+        dType total = dType( 0 );
+        #pragma unroll 4
+        for ( size_t v = first; v < last; v++ ) total += vectors[ v * ld + i ];
+        out[ blockIdx.y * out_ld + i ] = total;
     }
 }
 
 /*
  * ==========================================================================================================
- * Function     : warpReduce
+ * Function     : softmaxKernel
  *
- * Description  : Performs reduction sum (log(N) sum) within a warp using __shfl_down. Only the first thread 
- *                gets the result
+ * Description  : Computes the softmax function for a vector. It requires the output array to already have 
+ *                the sum of the elements (which the above 2 kernels will do) so that each has access to the 
+ *                sum
  *
- * Inputs       : val       : Value of element to add to the sum
- * 
- * Outptuts     : The sum of the values val for each thread in the warp
+ * Inputs       : in        : The vector to compute the softmax function on
+ *              : N         : The number of elements in the vector
+ *              : f         : The operation to perform on each element, defult to exponentiation as
+ *                            per the softmax function
+ *
+ * Outputs      : out       : The vector where each element is the result of the softmax
  *
- * Params       : dType     : The data type of the elemetns
+ * Params       : dType     : The data type (double, float, int)
+ *              : F         : The functor that defines the operation on the input data
  * ==========================================================================================================
- */ 
-template <typename dType>
-__inline__ __device__ dType warpReduce( dType val ) {
-    for ( int offset = ( warpSize / 2); offset > 0; offset /= 2 ) {
-        val += __shfl_down( val, offset );  
-    }
-    return val;
+ */
+template <typename dType, typename F = functors::exp>
+__global__ void softmaxKernel( dType* in, dType* out, size_t N, F f = functors::exp() ) {
+    int idx = blockIdx.x * blockDim.x + threadIdx.x;
+
+    // Each output is assumed to already have the sum of the exponent of each element
+    // So exponentiate each element and then normalize by vector sum
+    if ( idx < N ) out[ idx ] = f( in[ idx ] ) / out[ idx ];
 }
 
 /*
  * ==========================================================================================================
- * Function     : warpReduceAll
+ * Struct       : elementLoader
  *
- * Description  : Performs reduction sum (log(N) sum) within a warp.  All threads in warp get the resultant
- *                sum of the array
- *
- * Inputs       : val       : Value of element in the array for the thread in the warp (ie val for thread 4 i
- *                            is the value of the 4th element in the array to sum
+ * Description  : Loads the logits for the softmax kernels from a single vector
+ * ==========================================================================================================
+ */
+template <typename dType>
+struct elementLoader {
+    const dType* in;
+
+    __device__ dType operator()( size_t i ) const { return in[ i ]; }
+};
+
+/*
+ * ==========================================================================================================
+ * Struct       : pageSumLoader
  *
- * Params       : dType     : The data type of the values in the array
+ * Description  : Loads the logits for the softmax kernels as the sum of the elements of M vectors (pages), so
+ *                that the pages are accumulated as the logits are read, rather than in a separate pass
  * ==========================================================================================================
- */ 
+ */
 template <typename dType>
-__inline__ __device__ dType warpReduceAll( dType val ) {
-    // (Butterfly operation) - see reference in NOTES
-    for ( int offset = ( warpSize / 2); offset > 0; offset /= 2 ) {
-        val += __shfl_xor( val, offset );   
+struct pageSumLoader {
+    dType* const*   pages;
+    size_t          M;
+
+    __device__ dType operator()( size_t i ) const {
+        dType val = dType( 0 );
+        for ( size_t p = 0; p < M; p++ ) val += pages[ p ][ i ];
+        return val;
     }
-    return val;
-}
+};
 
 /*
  * ==========================================================================================================
- * Function     : blockReduce
+ * Function     : softmaxPartialsKernel
  *
- * Description  : Performs reduction sum (log(N) sum) within a block using the above warpReduce
- *                function
+ * Description  : First pass of the numerically stable softmax. Each thread loads its logits (using the 
+ *                loader, which can sum pages on the fly), writes them to logits, and keeps a running max and
+ *                a running sum of exp( logit - max ), which is rescaled whenever the max changes (online 
+ *                softmax). The results are then combined for each block, so only one pass over the data
+ *                is needed for both the max and the sum.
  *
- * Inputs       : val       : Value of the element in the array corresponding to the threadId
+ * Inputs       : load          : The loader for the logits
+ *              : N             : The number of elements
  *
- * Outputs      : The sum of the array for the elements that the block covers
- * 
- * Params       : dType     : The data type of the elements in the array
+ * Outputs      : logits        : The loaded logits (which can be the output of the softmax)
+ *              : block_max     : The max of the logits for each block
+ *              : block_sum     : The sum of exp( logit - block max ) for each block
+ *
+ * Params       : dType         : The data type of the elements (float or double)
+ *              : Loader        : The type of the loader
  * ==========================================================================================================
- */ 
-template <typename dType>
-__inline__ __device__ dType blockReduce( dType val ) {
-    static __shared__ dType shared_mem[ 32 ];
-    int lane = threadIdx.x % warpSize;                  // Index in warp
-    int wid  = threadIdx.x / warpSize;                  // Warp index in block
-
-    val = warpReduce( val );                            // Do reduction on warp
-    if ( lane == 0 ) shared_mem[ wid ] = val;           // Write reduction to shared memory
-    __syncthreads();
+ */
+template <typename dType, typename Loader>
+__global__ void softmaxPartialsKernel( Loader load, dType* logits, size_t N, dType* block_max, dType* block_sum ) {
+    dType thread_max = lowest<dType>();
+    dType thread_sum = dType( 0 );
+
+    for ( size_t i = blockIdx.x * blockDim.x + threadIdx.x; i < N; i += blockDim.x * gridDim.x ) {
+        dType logit = load( i );
+        logits[ i ] = logit;
+        if ( logit > thread_max ) {
+            thread_sum = thread_sum * exp( thread_max - logit ) + dType( 1 );
+            thread_max = logit;
+        } else {
+            thread_sum += exp( logit - thread_max );
+        }
+    }
 
-    // Read into shared mem if threadID is less than num warps
-    val = ( threadIdx.x < blockDim.x / warpSize ) ? shared_mem[ lane ] : 0;
+    dType max_all = blockReduceOp<frnn::reduce::max>( thread_max, lowest<dType>() );
+    dType sum_all = blockReduceOp<frnn::reduce::sum>( thread_sum * exp( thread_max - max_all ), dType( 0 ) );
 
-    // Do the reduction on the first warp
-    if ( wid == 0 ) val = warpReduce( val );
-    return val;
+    if ( threadIdx.x == 0 ) {
+        block_max[ blockIdx.x ] = max_all;
+        block_sum[ blockIdx.x ] = sum_all;
+    }
 }
 
 /*
  * ==========================================================================================================
- * Function     : blockReduceAll
+ * Struct       : softmaxNormalizer
  *
- * Description  : Performs reduction sum (log(N) sum) within a block using the above warpReduceAll
- *                function
+ * Description  : Functor for the second pass of the softmax, which gives exp( x - max ) / sum for a logit
  *
- * Inputs       : val       : Value of the element in the array corresponding to the threadId
- *
- * Outputs      : The sum of the array, but each element in the arary has the result, not only the first
- * 
- * Params       : dType     : The data type of the elements in the array
+ * Params       : dType     : The data type of the elements (float or double)
  * ==========================================================================================================
- */ 
-template <typename dType>
-__inline__ __device__ dType blockReduceAll( dType val ) {
-    static __shared__ dType shared_mem[ 32 ];
-    int lane = threadIdx.x % warpSize;                  // Index in warp
-    int wid  = threadIdx.x / warpSize;                  // Warp index in block
-
-    val = warpReduceAll( val );                         // Do reduction on warp (all threads have shared[ 0 ]
-    if ( lane == 0 ) shared_mem[ wid ] = val;           // Write reduction to shared memory
-    __syncthreads();                                
-
-    // Give each warp the reduced value in shared_mem[ 0 ]
-    val = ( lane < blockDim.x / warpSize ) ? shared_mem[ lane ] : 0;
-
-    // Have each war perform the butterfly reduction
-    // so that all threads in the block have the shared[ 0 ]
-    val = warpReduceAll( val );
-    return val;
-}
+ */
+template <typename dType> struct softmaxNormalizer {
+    dType max, sum;
+    __device__ softmaxNormalizer( dType max_all, dType sum_all ) : max( max_all ), sum( sum_all ) {}
+    __device__ dType operator()( dType x ) const { return exp( x - max ) / sum; }
+};
 
 /*
  * ==========================================================================================================
- * Function     : blockReduceAtomicVectorized
+ * Function     : softmaxNormalizeKernel
  *
- * Description  : Performs reduction sum (log(N) sum) on an entire array using vectorized types to load 2
- *                elements at a time and atomic adds across the blocks which is better for floats 
+ * Description  : Second pass of the numerically stable softmax. Each block combines the (few) block results
+ *                of the first pass into the global max and sum, and then normalizes its elements. The logits 
+ *                and the outputs can be the same array.
  *
- * Inputs       : in        : A pointer to the data to compute the sum of 
- *              : N         : The number of elements to sum (in the array)
+ * Inputs       : logits        : The logits from the first pass
+ *              : N             : The number of elements
+ *              : block_max     : The max for each block of the first pass
+ *              : block_sum     : The sum for each block of the first pass
+ *              : num_blocks    : The number of blocks of the first pass
  *
- * Outputs      : out       : A poiinter to where the results should be stored
+ * Outputs      : out           : The softmax of the logits
  *
- * Params       : dType     : The data type of the elements to sum
+ * Params       : dType         : The data type of the elements (float or double)
  * ==========================================================================================================
- */ 
+ */
 template <typename dType>
-__global__ void blockReduceAtomicVectorized( dType* in, dType* out, size_t N ) {
-    dType sum = dType( 0 );
-    int   idx = blockIdx.x * blockDim.x + threadIdx.x;
-
-    // Get data to reduce from the input data
-    for ( int i = idx; i < ( N / 2 ); i += blockDim.x * gridDim.x ) {
-        // Convert to vectorized type and add to sum 
-        typedef typename frnn::VectorizedTypeGpu<dType, 2>::vect_type vect2;
-        vect2 val = reinterpret_cast<vect2*>( in )[ i ];
-        sum += val.x + val.y;
-    }
+__global__ void softmaxNormalizeKernel( const dType* logits, dType* out, size_t N, 
+                                        const dType* block_max, const dType* block_sum, size_t num_blocks ) {
+    dType max_all = lowest<dType>();
+    for ( size_t b = threadIdx.x; b < num_blocks; b += blockDim.x ) max_all = max( max_all, block_max[ b ] );
+    max_all = blockReduceOp<frnn::reduce::max>( max_all, lowest<dType>() );
 
-    // Add elements not added above
-    int i = idx + ( N / 2 * 2 );
-    if ( i < N ) sum += in[ i ]; 
+    dType sum_all = dType( 0 );
+    for ( size_t b = threadIdx.x; b < num_blocks; b += blockDim.x ) sum_all += block_sum[ b ] * exp( block_max[ b ] - max_all );
+    sum_all = blockReduceOp<frnn::reduce::sum>( sum_all, dType( 0 ) );
 
-    // Perform reduction on the blocks
-    // Store result in first thread
-    sum = blockReduce( sum );
-    if ( threadIdx.x == 0 ) atomicAdd( out, sum );
+    mapVectorized( logits, out, N, softmaxNormalizer<dType>( max_all, sum_all ) );
 }
 
 /*
  * ==========================================================================================================
- * Function     : blockReduceAtomicVectorizedAll
+ * Function     : softmaxColumnsKernel
  *
- * Description  : Performs reduction sum (log(N) sum) on an entire array using vectorized types to laod 4
- *                elements at a time and improve memory bandwidth, and atomic adds across the blocks which 
- *                is better for floats, each thread then has the result of the sum
+ * Description  : Computes the (numerically stable) softmax function for each column of a (column major) 
+ *                matrix, so that a whole batch of vectors is done with a single launch. Each block does one
+ *                column at a time, so the number of threads per block must be a multiple of the warp size.
  *
- * Inputs       : in        : A pointer to the data to compute the sum of 
- *              : N         : The number of elements to sum (in the array)
- *              : f         : The functor to operate on each element to provide more functionality
+ * Inputs       : in        : The matrix to compute the softmax of each column of
+ *              : N         : The number of elements in each column (rows)
+ *              : M         : The number of columns
+ *              : f         : The operation to perform on each element, defult to exponentiation as
+ *                            per the softmax function
  *
- * Outputs      : out       : A poiinter to where the results are stored
+ * Outputs      : out       : The matrix where each column is the softmax of the column of in
  *
- * Params       : dType     : The data type of the elements in the array
- *              : F         : A functor that acts on each element before summation, default to void
+ * Params       : dType     : The data type of the elements
+ *              : F         : The functor that defines the operation on the input data
  * ==========================================================================================================
- */ 
-template <typename dType, typename F = functors::voidFunctor>
-__global__ void blockReduceAtomicVectorizedAll( dType* in, dType* out, size_t N, F f = functors::voidFunctor() ) {
-    typedef typename frnn::VectorizedTypeGpu<dType, 4>::vect_type vect4;
-    dType   sum  = dType( 0 );
-    int     idx  = blockIdx.x * blockDim.x + threadIdx.x;
-
-    // Get data from in, add using vectorized types to increase bandwidth
-    for ( int i = idx; i < ( N / 4 ); i += blockDim.x * gridDim.x ) {
-        vect4 val = reinterpret_cast<vect4*>( in )[ i ];
-        sum += f( val.x ) + f( val.y ) + f( val.z ) + f( val.w );
-    }
+ */
+template <typename dType, typename F = functors::exp>
+__global__ void softmaxColumnsKernel( const dType* in, dType* out, size_t N, size_t M, F f = functors::exp() ) {
+    for ( size_t col = blockIdx.x; col < M; col += gridDim.x ) {
+        const dType* in_col  = in  + col * N;
+        dType*       out_col = out  + col * N;
+        dType        col_max = lowest<dType>();
+        dType        sum     = dType( 0 );
 
-    // Determine elements that were addec vectorially
-    int i = idx + ( N / 4 * 4 );
-    if ( i < N ) sum += f( in[ i ] );
+        // Subtracting the max of the column keeps exp from overflowing
+        for ( size_t i = threadIdx.x; i < N; i += blockDim.x ) col_max = max( col_max, in_col[ i ] );
+        col_max = blockReduceOp<frnn::reduce::max>( col_max, lowest<dType>() );
 
-    // Perform reduction on the blocks, each thread in the 
-    // block will have the sum of that block 
-    sum = blockReduceAll( sum );
+        for ( size_t i = threadIdx.x; i < N; i += blockDim.x ) sum += f( in_col[ i ] - col_max );
+        sum = blockReduceOp<frnn::reduce::sum>( sum, dType( 0 ) );
 
-    // Add the results of all other blocks to the first 
-    // element of the block this thread belongs to
-    int out_index = threadIdx.x * blockDim.x;
-    atomicAdd( &out[ out_index ], sum );
+        for ( size_t i = threadIdx.x; i < N; i += blockDim.x ) out_col[ i ] = f( in_col[ i ] - col_max ) / sum;
+    }
 }
 
 /*
  * ==========================================================================================================
- * Function     : blockScatter
- *
- * Description  : 'Scatters' the first element of a block to all other elements of the block. Block sizes 
- *                greater than the number of threads per block get the values to scatter from blocks 
- *                blockDim.x blocks before them.
- *
- * Inputs       : data      : A pointer to the data where the first element of the block must be scattered
- *              : N         : The number of elements in the array
- *
- * Outputs      : data      : The array where each thread in the block has the same value
+ * Function     : fill
+ * 
+ * Description  : Sets each of the N elements of x to value
+ * 
+ * Inputs       : N         : The number of elements in the array
+ *              : value     : The value to set each element to
  *
- * Params       : dType     : The data type of the elements in the array
+ * Outputs      : x         : The array where each element is value
+ * 
+ * Params       : dType     : The type of data in the array
  * ==========================================================================================================
- */ 
-template <class dType> 
-__global__ void blockScatter( dType* data, size_t N ) {
-    static __shared__ dType shared_mem[ 1 ];
-    int idx = blockIdx.x * blockDim.x + threadIdx.x;
-    
-    // Copy the first element of the block to shared memory
-    if ( threadIdx.x == 0  && blockIdx.x < blockDim.x ) {
-        shared_mem[ 0 ] = data[ idx ];
-    } else if ( threadIdx.x == 0 && blockIdx.x >= blockDim.x ) { // If blockID > threads per block
-        shared_mem[ 0 ] = data[ idx - blockDim.x * blockIdx.x ];
-    }
-    __syncthreads();
-
-    // Copy from block shared mem to all threads in block
-    if ( idx < N ) data[ idx ] = shared_mem[ 0 ];
+ */
+template <typename dType>
+__global__ void fill( dType* x, size_t N, dType value ) {
+    fillVectorized( x, N, value );
 }
 
 /*
  * ==========================================================================================================
- * Function     : softmaxKernel
- *
- * Description  : Computes the softmax function for a vector. It requires the output array to already have 
- *                the sum of the elements (which the above 2 kernels will do) so that each has access to the 
- *                sum
- *
- * Inputs       : in        : The vector to compute the softmax function on
- *              : N         : The number of elements in the vector
- *              : f         : The operation to perform on each element, defult to exponentiation as
- *                            per the softmax function
- *
- * Outputs      : out       : The vector where each element is the result of the softmax
+ * Function     : axpyKernel
+ * 
+ * Description  : Computes a * x + y for each of the N elements of x and y, for types which cuBLAS doesn't 
+ *                have an axpy for (ints). The grid strides over the arrays, so any grid size works.
+ * 
+ * Inputs       : N         : The number of elements in the arrays
+ *              : a         : The constant to multiply x by
+ *              : x         : The array to multiply by a
  *
- * Params       : dType     : The data type (double, float, int)
- *              : F         : The functor that defines the operation on the input data
+ * Outputs      : y         : The array to add a * x to, where the result is stored
+ * 
+ * Params       : dType     : The type of data in the arrays
  * ==========================================================================================================
  */
-template <typename dType, typename F = functors::exp>
-__global__ void softmaxKernel( dType* in, dType* out, size_t N, F f = functors::exp() ) {
-    int idx = blockIdx.x * blockDim.x + threadIdx.x;
-
-    // Each output is assumed to already have the sum of the exponent of each element
-    // So exponentiate each element and then normalize by vector sum
-    if ( idx < N ) out[ idx ] = f( in[ idx ] ) / out[ idx ];
+template <typename dType>
+__global__ void axpyKernel( size_t N, dType a, const dType* x, dType* y ) {
+    for ( size_t i = blockIdx.x * blockDim.x + threadIdx.x; i < N; i += blockDim.x * gridDim.x ) {
+        y[ i ] = a * x[ i ] + y[ i ];
+    }
 }
 
 /*
  * ==========================================================================================================
- * Function     : scale 
+ * Function     : philoxUniformKernel 
  * 
- * Description  : Takes N values on the range 0.0 - 1.0 and scales them to the range lo - hi
+ * Description  : Fills an array with elements offset to offset + N - 1 of the Philox stream for a seed (see
+ *                frnn_philox.h), as uniform numbers on the range [lo, hi). Each thread makes one block of the
+ *                stream at a time, and writes the elements of the block which are in the array.
  * 
- * Inputs       : x         : The array of elements to scale
- *              : N         : The number of elements in the array
+ * Inputs       : N         : The number of elements in the array
  *              : lo        : The lower bound for the range of values
  *              : hi        : The upper bound for the range of values
+ *              : seed      : The seed of the stream
+ *              : offset    : The index in the stream of the first element
  *
- * Outputs      : x         : The modified array with each element being on the range lo - hi
+ * Outputs      : x         : The array of random numbers
  * 
- * Params       : dType     : The type of data to use. This should be float or double, however, ints will work
- *                            but will give a terrible distribution due to rounding
+ * Params       : dType     : The type of data to use (float, double or int)
  * ==========================================================================================================
  */
 template <typename dType>
-__global__ void scale( dType* x, size_t N, dType lo, dType hi ) {
-    int idx = blockIdx.x * blockDim.x + threadIdx.x;
+__global__ void philoxUniformKernel( dType* x, size_t N, dType lo, dType hi, unsigned long long seed, 
+                                     unsigned long long offset ) {
+    typedef frnn::rng::PhiloxUniform<dType> uniform;
     
-    if ( idx < N ) x[ idx ] = x[ idx ] * ( hi - lo ) + lo;
+    const unsigned long long per_block = 4 / uniform::words;
+    const unsigned long long first     = offset / per_block;
+    const unsigned long long blocks    = ( offset + N + per_block - 1 ) / per_block - first;
+    
+    for ( unsigned long long idx = blockIdx.x * blockDim.x + threadIdx.x; idx < blocks; 
+          idx += blockDim.x * gridDim.x ) {
+        const frnn::rng::philox4x32 words = frnn::rng::philox( seed, first + idx );
+        
+        for ( unsigned long long j = 0; j < per_block; j++ ) {
+            const unsigned long long e = ( first + idx ) * per_block + j;
+            if ( e >= offset && e < offset + N ) x[ e - offset ] = uniform::convert( words.x + j * uniform::words, lo, hi );
+        }
+    }
 }
 
 #endif
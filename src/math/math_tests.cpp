@@ -19,6 +19,8 @@
  */
 
 #include <gtest/gtest.h>
+#include <algorithm>
+#include <cmath>
 #include <iostream>
 
 #include "../frnn/types.h"
@@ -37,31 +39,54 @@ const float  TOLERANCE         = 1e-4;     // For difference between GPU and CPU
 
 /* =========================================== NOTES ========================================================
  *
- * 1. Sum does not work with doubles since the kernels use the shfl operations which can only handle ints and
- *    floats. (conversion from other params to these will be provided later on).
- *
- * 2. Softmax works with ints but the testing is not done as it is useless, since softmax returns a
+ * 1. Softmax works with ints but the testing is not done as it is useless, since softmax returns a
  *    'probablility' for each element in the vector on the range [0, 1], using ints will give the result 
  *    of 0 for each element, which is not worth the increased time for test execution
  *
  * ==========================================================================================================
  */
 
+// The GPU tests (and the tests of the GPU context, the allocator and the dispatcher) need FRNN_WITH_CUDA
+#ifdef FRNN_WITH_CUDA
+
 TEST( frnnMathGpu, CanGenerateNRandomNumbersUniformDistribution ) {
+    frnn::GpuContext context;
     float lo = -2.0f; float hi = 10.f;
-    float random_numbers[ NUM_ELEMENTS_RAND ];
+    frnn::Tensor4<float, frnn::storage::Device> random_numbers( NUM_ELEMENTS_RAND, 1, 1, 1 );
     
-    // Generate 10 randon numbers on the GPU
-    frnn::math<float, frnn::device::GPU>::rand( random_numbers, NUM_ELEMENTS_RAND, lo, hi );    
+    // Generate the randon numbers on the GPU, in place in the device tensor
+    frnn::math<float, frnn::device::GPU>::randDevice( context, random_numbers, lo, hi, 1234ULL, 0 );    
     
+    const frnn::aligned_vector<float>& numbers = random_numbers.hostData();
     for ( size_t i = 0; i < NUM_ELEMENTS_RAND; i++ ) {
-        EXPECT_GE( random_numbers[ i ], lo );
-        EXPECT_LT( random_numbers[ i ], hi );
+        EXPECT_GE( numbers[ i ], lo );
+        EXPECT_LT( numbers[ i ], hi );
     }
 }
 
+TEST( frnnMathGpu, RandomNumbersAreTheSameAsTheCpuForTheSameSeedAndOffset ) {
+    frnn::GpuContext context;
+    frnn::Tensor4<float , frnn::storage::Device> floats_gpu( NUM_ELEMENTS_RAND, 1, 1, 1 );
+    frnn::Tensor4<double, frnn::storage::Device> doubles_gpu( NUM_ELEMENTS_RAND, 1, 1, 1 );
+    frnn::Tensor4<int   , frnn::storage::Device> ints_gpu( NUM_ELEMENTS_RAND, 1, 1, 1 );
+    frnn::aligned_vector<float> floats_cpu( NUM_ELEMENTS_RAND );  frnn::aligned_vector<double> doubles_cpu( NUM_ELEMENTS_RAND );
+    frnn::aligned_vector<int>   ints_cpu( NUM_ELEMENTS_RAND );
+    
+    frnn::math<float , frnn::device::GPU>::randDevice( context, floats_gpu , -1.f, 1.f, 7ULL, 5 );
+    frnn::math<double, frnn::device::GPU>::randDevice( context, doubles_gpu, -1.0, 1.0, 7ULL, 5 );
+    frnn::math<int   , frnn::device::GPU>::randDevice( context, ints_gpu   , -3  , 9  , 7ULL, 5 );
+    frnn::math<float , frnn::device::CPU>::rand( &floats_cpu[ 0 ] , NUM_ELEMENTS_RAND, -1.f, 1.f, 7ULL, 5 );
+    frnn::math<double, frnn::device::CPU>::rand( &doubles_cpu[ 0 ], NUM_ELEMENTS_RAND, -1.0, 1.0, 7ULL, 5 );
+    frnn::math<int   , frnn::device::CPU>::rand( &ints_cpu[ 0 ]   , NUM_ELEMENTS_RAND, -3  , 9  , 7ULL, 5 );
+    
+    EXPECT_EQ( floats_gpu.hostData() , floats_cpu );
+    EXPECT_EQ( doubles_gpu.hostData(), doubles_cpu );
+    EXPECT_EQ( ints_gpu.hostData()   , ints_cpu );
+}
+
 TEST( frnnMathGpu, AxpyOperationComputesCorrectlyWithFloats ) {
     frnn::frnnError error;
+    frnn::GpuContext context;
     const float A = 2.0f;
 
     vector<float> x;
@@ -74,7 +99,7 @@ TEST( frnnMathGpu, AxpyOperationComputesCorrectlyWithFloats ) {
     }
 
     // axpy with floats
-    frnn::math<float, frnn::device::GPU>::axpy( error, A, x, y );
+    frnn::math<float, frnn::device::GPU>::axpy( error, context, A, x, y );
 
     for ( size_t i = 0; i < NUM_ELEMENTS; i++ ) {
         EXPECT_EQ( y[i], A * i + i );
@@ -83,6 +108,7 @@ TEST( frnnMathGpu, AxpyOperationComputesCorrectlyWithFloats ) {
 
 TEST( frnnMathGpu, AxpyOperationComputesCorrectlyWithDoubles ) {
     frnn::frnnError error;
+    frnn::GpuContext context;
     const double A = 2.0f;
     
     vector<double> x;
@@ -95,15 +121,38 @@ TEST( frnnMathGpu, AxpyOperationComputesCorrectlyWithDoubles ) {
     }
 
     // Performs axpy with doubles
-    frnn::math<double, frnn::device::GPU>::axpy( error, A, x, y );
+    frnn::math<double, frnn::device::GPU>::axpy( error, context, A, x, y );
 
     for ( size_t i = 0; i < NUM_ELEMENTS; i++ ) {
         EXPECT_EQ( y[i], A * i + i );
     }
 }
 
+TEST( frnnMathGpu, AxpyOperationComputesCorrectlyWithInts ) {
+    frnn::frnnError error;
+    frnn::GpuContext context;
+    const int A = 2;
+    
+    vector<int> x;
+    vector<int> y;
+
+    // Fill vectors with data
+    for ( size_t i = 0; i < NUM_ELEMENTS; i++ ) {
+        x.push_back( int( i ) ); 
+        y.push_back( int( i ) );
+    }
+
+    // Performs axpy with ints (with the kernel, cuBLAS has no int axpy)
+    axpyGpu( error, context, A, x, y );
+
+    for ( size_t i = 0; i < NUM_ELEMENTS; i++ ) {
+        EXPECT_EQ( y[i], A * int( i ) + int( i ) );
+    }
+}
+
 TEST( frnnMathGpu, ReductionSumComputesCorrectlyWithFloats ) {
     frnn::frnnError error;
+    frnn::GpuContext context;
     vector<float> x;
 
     // Fill x with data 
@@ -111,12 +160,13 @@ TEST( frnnMathGpu, ReductionSumComputesCorrectlyWithFloats ) {
         x.push_back( 1.f );
     }
     
-    float sum_of_elements = frnn::math<float, frnn::device::GPU>::sum( error, x );
+    float sum_of_elements = frnn::math<float, frnn::device::GPU>::sum( error, context, x );
     EXPECT_EQ( NUM_ELEMENTS, sum_of_elements );
 }
 
 TEST( frnnMathGpu, ReductionSumComputesCorrectlyWithInts ) {
     frnn::frnnError error;
+    frnn::GpuContext context;
     vector<int> x;
 
     // Fill x with data 
@@ -124,12 +174,24 @@ TEST( frnnMathGpu, ReductionSumComputesCorrectlyWithInts ) {
         x.push_back( int( 1 ) );
     }
     
-    int sum_of_elements = frnn::math<int, frnn::device::GPU>::sum( error, x );
+    int sum_of_elements = frnn::math<int, frnn::device::GPU>::sum( error, context, x );
     EXPECT_EQ( NUM_ELEMENTS, sum_of_elements );
 }
 
+TEST( frnnMathGpu, ReductionSumOfHalvesIsAccumulatedInFloats ) {
+    frnn::frnnError error;
+    frnn::GpuContext context;
+
+    // A half sum stops at 2048 (2048 + 1 rounds to 2048), the float accumulation doesn't
+    vector<__half> x( 4096, __float2half( 1.f ) );
+    
+    float sum_of_elements = reduceGpu<frnn::reduce::sum>( error, context, x );
+    EXPECT_EQ( 4096.f, sum_of_elements );
+}
+
 TEST( frnnMathGpu, ReductionSumVectorizedComputesCorrectlyWithFloatsAndEmptyResultsVector ) {
     frnn::frnnError error;
+    frnn::GpuContext context;
     vector<float> x, results;
 
     // Fill x with data 
@@ -138,7 +200,7 @@ TEST( frnnMathGpu, ReductionSumVectorizedComputesCorrectlyWithFloatsAndEmptyResu
     }
 
     // Get the results of the sum into the results vector
-    frnn::math<float, frnn::device::GPU>::sumVectorized( error, x, results );
+    frnn::math<float, frnn::device::GPU>::sumVectorized( error, context, x, results );
 
     for ( size_t i = 0; i < NUM_ELEMENTS; i++ ) {
         EXPECT_EQ( NUM_ELEMENTS, results[ i ]  );
@@ -147,6 +209,7 @@ TEST( frnnMathGpu, ReductionSumVectorizedComputesCorrectlyWithFloatsAndEmptyResu
 
 TEST( frnnMathGpu, ReductionSumVectorizedComputesCorrectlyWithFloatsAndFullResultsVector ) {
     frnn::frnnError error;
+    frnn::GpuContext context;
     vector<float> x, results;
 
     // Fill x with data 
@@ -156,7 +219,7 @@ TEST( frnnMathGpu, ReductionSumVectorizedComputesCorrectlyWithFloatsAndFullResul
     }
 
     // Get the results of the sum into the results vector
-    frnn::math<float, frnn::device::GPU>::sumVectorized( error, x, results );
+    frnn::math<float, frnn::device::GPU>::sumVectorized( error, context, x, results );
         
     for ( size_t i = 0; i < NUM_ELEMENTS; i++ ) {
         EXPECT_EQ( NUM_ELEMENTS, results[ i ]  );
@@ -165,6 +228,7 @@ TEST( frnnMathGpu, ReductionSumVectorizedComputesCorrectlyWithFloatsAndFullResul
 
 TEST( frnnMathGpu, ReductionSumVectorizedComputesCorrectlyWithIntsAndEmptyResultsVector ) {
     frnn::frnnError error;
+    frnn::GpuContext context;
     vector<int> x, results;
 
     // Fill x with data 
@@ -173,7 +237,7 @@ TEST( frnnMathGpu, ReductionSumVectorizedComputesCorrectlyWithIntsAndEmptyResult
     }
 
     // Get the results of the sum into the results vector
-    frnn::math<int, frnn::device::GPU>::sumVectorized( error, x, results );
+    frnn::math<int, frnn::device::GPU>::sumVectorized( error, context, x, results );
 
     for ( size_t i = 0; i < NUM_ELEMENTS; i++ ) {
         EXPECT_EQ( NUM_ELEMENTS, results[ i ]  );
@@ -182,6 +246,7 @@ TEST( frnnMathGpu, ReductionSumVectorizedComputesCorrectlyWithIntsAndEmptyResult
 
 TEST( frnnMathGpu, ReductionSumVectorizedComputesCorrectlyWithIntsAndFullResultsVector ) {
     frnn::frnnError error;
+    frnn::GpuContext context;
     vector<int> x, results;
 
     // Fill x with data 
@@ -191,15 +256,187 @@ TEST( frnnMathGpu, ReductionSumVectorizedComputesCorrectlyWithIntsAndFullResults
     }
 
     // Get the results of the sum into the results vector
-    frnn::math<int, frnn::device::GPU>::sumVectorized( error, x, results );
+    frnn::math<int, frnn::device::GPU>::sumVectorized( error, context, x, results );
 
     for ( size_t i = 0; i < NUM_ELEMENTS; i++ ) {
         EXPECT_EQ( NUM_ELEMENTS, results[ i ]  );
     }
 }
 
+TEST( frnnMathGpu, ReductionsAreReproducibleForMisalignedArraysOfAnySize ) {
+    frnn::GpuContext context;
+    frnn::frnnError  error;
+    const size_t     N = NUM_ELEMENTS + 3;
+    frnn::Tensor4<float, frnn::storage::Device> x( N, 1, 1, 1 );
+    double           expected = 0.0;
+    
+    frnn::aligned_vector<float>& data = x.hostData();
+    for ( size_t i = 0; i < N; i++ ) {
+        data[ i ] = 1.0f / float( i % 97 + 1 );
+        if ( i > 0 ) expected += data[ i ];
+    }
+    
+    // Start one element in, so the first elements aren't aligned for vectorized loads
+    float* results = context.scratch<float>( error, 6, 2 );
+    reduceDeviceGpu<frnn::reduce::sum>( error, context, x.deviceData() + 1, N - 1, results    , functors::voidFunctor() );
+    reduceDeviceGpu<frnn::reduce::sum>( error, context, x.deviceData() + 1, N - 1, results + 1, functors::voidFunctor() );
+    
+    float sums[ 2 ];
+    cudaMemcpy( sums, results, 2 * sizeof( float ), cudaMemcpyDeviceToHost );
+    
+    EXPECT_EQ( sums[ 0 ], sums[ 1 ] );
+    EXPECT_NEAR( sums[ 0 ], expected, expected * 1e-5 );
+}
+
+TEST( frnnMathGpu, ReductionsAreCorrectForEveryTunedLaunchConfiguration ) {
+    frnn::GpuContext context;
+    frnn::frnnError  error;
+    const size_t     N = NUM_ELEMENTS + 5;
+    frnn::Tensor4<float, frnn::storage::Device> x( N, 1, 1, 1 );
+    double           expected = 0.0;
+    
+    frnn::aligned_vector<float>& data = x.hostData();
+    for ( size_t i = 0; i < N; i++ ) {
+        data[ i ] = i == N / 2 ? 2.0f : 1.0f / float( i % 89 + 1 );
+        if ( i > 0 ) expected += data[ i ];
+    }
+    
+    // Each candidate, with a misaligned start so the head and the tail are used for every width
+    float*                                  sums    = context.scratch<float>( error, 6, 2 );
+    frnn::reduce::indexed<float>*           largest = context.scratch<frnn::reduce::indexed<float>>( error, 7, 1 );
+    const std::vector<frnn::launch_config>& configs = reduceCandidatesGpu();
+    for ( size_t c = 0; c < configs.size(); c++ ) {
+        reduceLaunchGpu<frnn::reduce::sum>( error, context, x.deviceData() + 1, N - 1, sums, functors::voidFunctor(), configs[ c ] );
+        reduceLaunchGpu<frnn::reduce::sum>( error, context, x.deviceData() + 1, N - 1, sums + 1, functors::voidFunctor(), configs[ c ] );
+        reduceLaunchGpu<frnn::reduce::argmax>( error, context, x.deviceData() + 1, N - 1, largest, functors::voidFunctor(), configs[ c ] );
+        
+        float                        results[ 2 ];
+        frnn::reduce::indexed<float> max;
+        cudaMemcpy( results, sums, 2 * sizeof( float ), cudaMemcpyDeviceToHost );
+        cudaMemcpy( &max, largest, sizeof( max ), cudaMemcpyDeviceToHost );
+        
+        EXPECT_EQ( results[ 0 ], results[ 1 ] );
+        EXPECT_NEAR( results[ 0 ], expected, expected * 1e-5 );
+        EXPECT_EQ( max.index, N / 2 - 1 );
+    }
+}
+
+TEST( frnnMathGpu, GridStrideKernelsAreCorrectForEveryTunedLaunchConfiguration ) {
+    frnn::GpuContext context;
+    const size_t     rows = 37, cols = 129;
+    frnn::Tensor4<float, frnn::storage::Device> numbers( NUM_ELEMENTS_RAND, 1, 1, 1 );
+    frnn::Tensor4<float, frnn::storage::Device> logits( rows, cols, 1, 1 ), probs( rows, cols, 1, 1 );
+    frnn::aligned_vector<float> expected( NUM_ELEMENTS_RAND ), expected_probs( rows * cols );
+    
+    frnn::math<float, frnn::device::CPU>::rand( &expected[ 0 ], NUM_ELEMENTS_RAND, -1.f, 1.f, 7ULL, 5 );
+    frnn::aligned_vector<float>& logits_h = logits.hostData();
+    for ( size_t i = 0; i < logits_h.size(); i++ ) logits_h[ i ] = float( i % 23 ) * 0.25f;
+    for ( size_t col = 0; col < cols; col++ ) {
+        double sum = 0.0;
+        for ( size_t r = 0; r < rows; r++ ) sum += std::exp( double( logits_h[ col * rows + r ] ) );
+        for ( size_t r = 0; r < rows; r++ ) {
+            expected_probs[ col * rows + r ] = float( std::exp( double( logits_h[ col * rows + r ] ) ) / sum );
+        }
+    }
+    
+    // Each candidate, the random numbers don't depend on the configuration
+    const std::vector<frnn::launch_config>& configs = gridCandidatesGpu();
+    for ( size_t c = 0; c < configs.size(); c++ ) {
+        const frnn::launch_config& config = configs[ c ];
+        philoxUniformKernel<<<gridBlocksGpu( config, NUM_ELEMENTS_RAND / 4 + 2, config.threads ), config.threads, 0, 
+                              context.stream()>>>( numbers.deviceData(), NUM_ELEMENTS_RAND, -1.f, 1.f, 7ULL, 5ULL );
+        softmaxColumnsKernel<<<gridBlocksGpu( config, cols, 1 ), config.threads, 0, context.stream()>>>( 
+                static_cast<const float*>( logits.deviceData() ), probs.deviceData(), rows, cols );
+        cudaStreamSynchronize( context.stream() );
+        
+        EXPECT_EQ( numbers.hostData(), expected );
+        const frnn::aligned_vector<float>& probs_h = probs.hostData();
+        for ( size_t i = 0; i < probs_h.size(); i++ ) EXPECT_NEAR( probs_h[ i ], expected_probs[ i ], 1e-6f );
+    }
+}
+
+TEST( frnnMathGpu, VectorizedKernelsAreCorrectForAnySizeAndOffset ) {
+    frnn::GpuContext context;
+    const size_t     length = 128;
+    frnn::Tensor4<float, frnn::storage::Device> x( length, 1, 1, 1 );
+    
+    // Fill slices which start at every offset from an aligned boundary, with every size up to a few vectors
+    for ( size_t offset = 0; offset < 8; offset++ ) {
+        for ( size_t N = 0; N < 23; N++ ) {
+            std::fill( x.hostData().begin(), x.hostData().end(), -1.0f );
+            fill<<<2, 4, 0, context.stream()>>>( x.deviceData() + offset, N, float( N ) );
+            
+            const frnn::aligned_vector<float>& data = static_cast<const frnn::Tensor4<float, frnn::storage::Device>&>( x ).hostData();
+            for ( size_t i = 0; i < length; i++ ) {
+                EXPECT_EQ( data[ i ], i >= offset && i < offset + N ? float( N ) : -1.0f );
+            }
+        }
+    }
+}
+
+TEST( frnnMathGpu, MaxMinAndArgmaxComputeCorrectly ) {
+    frnn::GpuContext context;
+    frnn::frnnError  error;
+    vector<float>    x( NUM_ELEMENTS + 1 );
+    vector<int>      y( 1001 );
+    
+    for ( size_t i = 0; i < x.size(); i++ ) x[ i ] = float( ( i * 7919 ) % 100003 ) - 50000.f;
+    for ( size_t i = 0; i < y.size(); i++ ) y[ i ] = int( i % 10 );           // Ties for the max
+    
+    EXPECT_EQ( frnn::math<float, device::GPU>::max( error, context, x ), *std::max_element( x.begin(), x.end() ) );
+    EXPECT_EQ( frnn::math<float, device::GPU>::min( error, context, x ), *std::min_element( x.begin(), x.end() ) );
+    EXPECT_EQ( frnn::math<float, device::GPU>::argmax( error, context, x ), 
+               size_t( std::max_element( x.begin(), x.end() ) - x.begin() ) );
+    EXPECT_EQ( frnn::math<int, device::GPU>::argmax( error, context, y ), 9 );
+}
+
+TEST( frnnMathGpu, SegmentedReductionsReduceEachColumn ) {
+    frnn::GpuContext context;
+    frnn::frnnError  error;
+    const size_t     rows = 1000, cols = 37, ld = 1003;
+    frnn::Tensor4<float, frnn::storage::Device> x( ld, cols, 1, 1 );
+    
+    frnn::aligned_vector<float>& data = x.hostData();
+    for ( size_t c = 0; c < cols; c++ ) {
+        for ( size_t r = 0; r < ld; r++ ) data[ r + c * ld ] = r < rows ? float( ( r + 3 * c ) % rows ) : 1e6f;
+    }
+    
+    frnn::reduce::indexed<float>* maxes = context.scratch<frnn::reduce::indexed<float> >( error, 6, cols );
+    reduceSegmentsGpu<frnn::reduce::argmax>( context, x.deviceData(), rows, cols, ld, maxes, functors::voidFunctor() );
+    
+    vector<frnn::reduce::indexed<float> > results( cols );
+    cudaMemcpy( &results[ 0 ], maxes, cols * sizeof( frnn::reduce::indexed<float> ), cudaMemcpyDeviceToHost );
+    
+    for ( size_t c = 0; c < cols; c++ ) {
+        EXPECT_EQ( results[ c ].value, float( rows - 1 ) );
+        EXPECT_EQ( results[ c ].index, ( 2 * rows - 1 - 3 * c ) % rows );
+    }
+}
+
+TEST( frnnMathGpu, SumOfVectorsMatchesTheCpuForManyVectorsOfAnySize ) {
+    frnn::GpuContext context;
+    frnn::frnnError  error;
+    
+    // Few long vectors (one segment), and many short vectors (split into segments), with padding between them
+    const size_t sizes[ 2 ][ 2 ] = { { 5003, 7 }, { 37, 1000 } };
+    for ( size_t s = 0; s < 2; s++ ) {
+        const size_t N = sizes[ s ][ 0 ], M = sizes[ s ][ 1 ], ld = N + 3;
+        frnn::Tensor4<int, frnn::storage::Device> x( ld, M, 1, 1 ), sum( N, 1, 1, 1 );
+        vector<int> expected( N );
+        
+        for ( size_t i = 0; i < x.size(); i++ ) x.hostData()[ i ] = int( i % 101 ) - 50;
+        frnn::math<int, frnn::device::CPU>::sumVectors( error, &x.hostData()[ 0 ], N, M, ld, &expected[ 0 ] );
+        
+        const frnn::Tensor4<int, frnn::storage::Device>& x_c = x;
+        frnn::math<int, frnn::device::GPU>::sumVectors( error, context, x_c.deviceData(), N, M, ld, sum.deviceData() );
+        
+        EXPECT_EQ( vector<int>( sum.hostData().begin(), sum.hostData().end() ), expected );
+    }
+}
+
 TEST( frnnMathGpu, SoftmaxComputesCorrectlyForFloats ) {
     frnn::frnnError error;
+    frnn::GpuContext context;
     vector<float> x, results;
 
     // Fill x with data 
@@ -208,7 +445,7 @@ TEST( frnnMathGpu, SoftmaxComputesCorrectlyForFloats ) {
     }
 
     // Get the results of the sum into the results vector
-    frnn::math<float, frnn::device::GPU>::softmax( error, x, results );
+    frnn::math<float, frnn::device::GPU>::softmax( error, context, x, results );
 
     for ( size_t i = 1; i < NUM_ELEMENTS; i++ ) {
         float softmax_i = exp( 1.f ) / ( exp( 1.f ) * (float)NUM_ELEMENTS );
@@ -217,12 +454,173 @@ TEST( frnnMathGpu, SoftmaxComputesCorrectlyForFloats ) {
     }
 }
 
+TEST( frnnMathGpu, SoftmaxDoesNotOverflowForLargeInputs ) {
+    frnn::frnnError error;
+    frnn::GpuContext context;
+    vector<float> x, results;
+    const size_t  N = 1000;
+
+    // exp( 1000 ) overflows a float, so this needs max subtraction
+    for ( size_t i = 0; i < N; i++ ) {
+        x.push_back( 1000.f + static_cast<float>( i % 2 ) );
+    }
+
+    frnn::math<float, frnn::device::GPU>::softmax( error, context, x, results );
+
+    // Each pair of elements is ( 1, e ) relative to each other
+    float pair_sum = ( 1.f + exp( 1.f ) ) * static_cast<float>( N / 2 );
+    for ( size_t i = 0; i < N; i++ ) {
+        float softmax_i = exp( static_cast<float>( i % 2 ) ) / pair_sum;
+        EXPECT_NEAR( softmax_i, results[ i ], TOLERANCE );
+    }
+}
+
+TEST( frnnGpuContext, ReusesScratchBufferWhenItIsBigEnough ) {
+    frnn::frnnError error;
+    frnn::GpuContext context;
+
+    float* first  = context.scratch<float>( error, 0, NUM_ELEMENTS );
+    float* second = context.scratch<float>( error, 0, NUM_ELEMENTS / 2 );
+
+    EXPECT_EQ( first, second );
+    EXPECT_EQ( context.scratchBytes(), frnn::DeviceAllocator::sizeClass( NUM_ELEMENTS * sizeof( float ) ) );
+}
+
+TEST( frnnGpuContext, DoesNotAllocateAfterWarmUp ) {
+    frnn::frnnError error;
+    frnn::GpuContext context;
+    vector<float> x( NUM_ELEMENTS, 1.f ), results;
+
+    // Warm up, then check that the same size call needs no more memory
+    frnn::math<float, frnn::device::GPU>::softmax( error, context, x, results );
+    size_t bytes_after_warm_up = context.scratchBytes();
+    frnn::math<float, frnn::device::GPU>::softmax( error, context, x, results );
+    frnn::math<float, frnn::device::GPU>::sumVectorized( error, context, x, results );
+
+    EXPECT_EQ( bytes_after_warm_up, context.scratchBytes() );
+}
+
+TEST( frnnDeviceAllocator, RoundsRequestsUpToSizeClasses ) {
+    EXPECT_EQ( frnn::DeviceAllocator::sizeClass( 1 )   , frnn::DeviceAllocator::MIN_BLOCK_BYTES );
+    EXPECT_EQ( frnn::DeviceAllocator::sizeClass( 1024 ), 1024 );
+    EXPECT_EQ( frnn::DeviceAllocator::sizeClass( 1025 ), 2048 );
+}
+
+TEST( frnnDeviceAllocator, ReusesFreedBlocksOnTheSameStream ) {
+    frnn::frnnError error;
+    frnn::DeviceAllocator allocator;
+
+    void* first = allocator.allocate( error, 1000 );
+    allocator.deallocate( first );
+    void* second = allocator.allocate( error, 900 );
+
+    EXPECT_EQ( first, second );
+    EXPECT_EQ( allocator.numDeviceAllocations(), 1 );
+    EXPECT_EQ( allocator.usedBytes(), 1024 );
+    allocator.deallocate( second );
+}
+
+TEST( frnnDeviceAllocator, DoesNotShareBlocksBetweenStreams ) {
+    frnn::frnnError error;
+    frnn::DeviceAllocator allocator;
+    frnn::GpuContext context;
+
+    void* first = allocator.allocate( error, 1000, context.stream( 0 ) );
+    allocator.deallocate( first );
+    void* second = allocator.allocate( error, 1000, context.stream( 1 ) );
+
+    EXPECT_NE( first, second );
+    EXPECT_EQ( allocator.numDeviceAllocations(), 2 );
+    allocator.deallocate( second );
+}
+
+TEST( frnnDeviceAllocator, TracksHighWaterMarkAndRespectsLimit ) {
+    frnn::frnnError error;
+    frnn::DeviceAllocator allocator( 4096 );
+
+    void* first  = allocator.allocate( error, 2048 );
+    void* second = allocator.allocate( error, 2048 );
+    allocator.deallocate( first );
+
+    EXPECT_EQ( allocator.highWaterMark(), 4096 );
+
+    // Needs the cached block to be released to fit under the limit,
+    // but the second block is still in use so the request must fail
+    void* too_big = allocator.allocate( error, 4096 );
+
+    EXPECT_EQ( too_big, nullptr );
+    EXPECT_EQ( allocator.reservedBytes(), 2048 );
+    allocator.deallocate( second );
+}
+
+// Model with a slow link and a fast GPU, so that only big functions use the GPU
+const frnn::cost_model TEST_COST_MODEL = { true, 10.0, 1e4, 1e4, 5.0, 1e4, 2e2 };
+
+TEST( frnnDeviceDispatcher, ChoosesCpuForSmallAndGpuForLargeFunctions ) {
+    frnn::DeviceDispatcher dispatcher( TEST_COST_MODEL );
+    const frnn::op_cost    cost = frnn::OpCosts<float>::softmax();
+
+    EXPECT_EQ( dispatcher.select( cost, 64, false, true )   , device::CPU );
+    EXPECT_EQ( dispatcher.select( cost, 1 << 20, false, true ), device::GPU );
+}
+
+TEST( frnnDeviceDispatcher, PrefersGpuWhenDataIsOnTheDevice ) {
+    frnn::DeviceDispatcher dispatcher( TEST_COST_MODEL );
+    const frnn::op_cost    cost = frnn::OpCosts<float>::axpy();
+    const size_t           N    = dispatcher.crossover( cost ) / 2;
+
+    // Below the crossover for host data, but the CPU would have to copy the data from the device
+    EXPECT_EQ( dispatcher.select( cost, N, false, true ), device::CPU );
+    EXPECT_EQ( dispatcher.select( cost, N, true, false ), device::GPU );
+}
+
+TEST( frnnDeviceDispatcher, CrossoverIsWhereTheChosenDeviceChanges ) {
+    frnn::DeviceDispatcher dispatcher( TEST_COST_MODEL );
+    const frnn::op_cost    cost      = frnn::OpCosts<double>::sumVectorized();
+    const size_t           crossover = dispatcher.crossover( cost );
+
+    EXPECT_GT( crossover, 1 );
+    EXPECT_EQ( dispatcher.select( cost, crossover - 1, false, true ), device::CPU );
+    EXPECT_EQ( dispatcher.select( cost, crossover, false, true )    , device::GPU );
+}
+
+TEST( frnnDeviceDispatcher, AlwaysChoosesCpuWithoutAGpu ) {
+    frnn::cost_model model   = TEST_COST_MODEL;
+    model.gpu_available      = false;
+    frnn::DeviceDispatcher dispatcher( model );
+
+    EXPECT_EQ( dispatcher.select( frnn::OpCosts<float>::softmax(), 1 << 24, true, false ), device::CPU );
+    EXPECT_EQ( dispatcher.crossover( frnn::OpCosts<float>::softmax() ), 0 );
+}
+
+TEST( frnnMathAuto, FunctionsMatchCpuResultsForSmallAndLargeInputs ) {
+    frnn::frnnError error;
+    
+    for ( size_t N : { size_t( 100 ), NUM_ELEMENTS } ) {
+        vector<float> x( N, 0.5f ), y_auto( N, 2.f ), y_cpu( N, 2.f );
+        vector<float> soft_auto( N ), soft_cpu( N );
+        
+        frnn::math<float, device::AUTO>::axpy( error, 2.f, x, y_auto );
+        frnn::math<float, device::CPU>::axpy( error, 2.f, x, y_cpu );
+        frnn::math<float, device::AUTO>::softmax( error, x, soft_auto );
+        frnn::math<float, device::CPU>::softmax( error, x, soft_cpu );
+        
+        EXPECT_NEAR( frnn::math<float, device::AUTO>::sum( error, x ), float( N ) * 0.5f, N * TOLERANCE );
+        for ( size_t i = 0; i < N; i += N / 10 ) {
+            EXPECT_EQ( y_auto[ i ], y_cpu[ i ] );
+            EXPECT_NEAR( soft_auto[ i ], soft_cpu[ i ], TOLERANCE );
+        }
+    }
+}
+
+#endif
+
 TEST( frnnMathCpu, CanGenerateNRandomNumbersUniformDistribution ) {
     float lo = 2.0f; float hi = 13.1f;
     float random_numbers[ NUM_ELEMENTS_RAND ];
     
     // Generate 10 randon numbers on the CPU
-    frnn::math<float, frnn::device::CPU>::rand( random_numbers, NUM_ELEMENTS_RAND, lo, hi );    
+    frnn::math<float, frnn::device::CPU>::rand( random_numbers, NUM_ELEMENTS_RAND, lo, hi, 1234ULL, 0 );    
     
     for ( size_t i = 0; i < NUM_ELEMENTS_RAND; i++ ) {
         EXPECT_GE( random_numbers[ i ], lo );
@@ -230,6 +628,41 @@ TEST( frnnMathCpu, CanGenerateNRandomNumbersUniformDistribution ) {
     }
 }
 
+TEST( frnnMathCpu, PhiloxMatchesKnownAnswers ) {
+    // Known answers for Philox4x32-10 from the Random123 library
+    frnn::rng::philox4x32 zeros = frnn::rng::philox( 0ULL, 0ULL );
+    EXPECT_EQ( zeros.x[ 0 ], 0x6627e8d5u );
+    EXPECT_EQ( zeros.x[ 1 ], 0xe169c58du );
+    EXPECT_EQ( zeros.x[ 2 ], 0xbc57ac4cu );
+    EXPECT_EQ( zeros.x[ 3 ], 0x9b00dbd8u );
+}
+
+TEST( frnnMathCpu, RandomNumbersDependOnlyOnTheSeedAndOffset ) {
+    const size_t  N = 1 << 17;                 // Enough for all the threads to be used
+    vector<float> all( N ), parts( N ), other_seed( N );
+    vector<int>   ints( NUM_ELEMENTS_RAND );
+    
+    frnn::math<float, device::CPU>::rand( &all[ 0 ], N, 0.f, 1.f, 42ULL, 0 );
+    frnn::math<float, device::CPU>::rand( &other_seed[ 0 ], N, 0.f, 1.f, 43ULL, 0 );
+    
+    // Filling in parts (which don't start on a block of the stream) gives the same numbers
+    const size_t splits[] = { 0, 3, 1001, 70001, N };
+    for ( int i = 0; i < 4; i++ ) {
+        frnn::math<float, device::CPU>::rand( &parts[ splits[ i ] ], splits[ i + 1 ] - splits[ i ], 0.f, 1.f, 
+                                              42ULL, splits[ i ] );
+    }
+    EXPECT_EQ( all, parts );
+    EXPECT_NE( all, other_seed );
+    
+    frnn::math<int, device::CPU>::rand( &ints[ 0 ], NUM_ELEMENTS_RAND, -3, 4, 42ULL, 0 );
+    for ( size_t i = 0; i < NUM_ELEMENTS_RAND; i++ ) {
+        EXPECT_GE( ints[ i ], -3 );
+        EXPECT_LT( ints[ i ], 4 );
+    }
+    EXPECT_EQ( *std::min_element( ints.begin(), ints.end() ), -3 );
+    EXPECT_EQ( *std::max_element( ints.begin(), ints.end() ), 3 );
+}
+
 TEST( frnnMathCpu, CanPerformXminusYWithVectorizedCpuKernelWithFloats ) {
     std::vector<float> x;
     std::vector<float> y;
@@ -268,3 +701,181 @@ TEST( frnnMathCpu, CanPerformXminusYWithVectorizedCpuKernelWithDoubles ) {
     }
 }
 
+
+TEST( frnnMathCpu, XminusYHandlesSizesWhichAreNotAMultipleOfTheVectorWidth ) {
+    // 37 elements is a tail for every instruction set width
+    std::vector<float> x( 37 ), y( 37 ), out( 37, 0.f );
+    for ( size_t i = 0; i < x.size(); i++ ) {
+        x[ i ] = float( 3 * i );
+        y[ i ] = float( i );
+    }
+    
+    frnn::math<float, frnn::device::CPU>::xmy( x, y, out );
+    
+    for ( size_t i = 0; i < out.size(); i++ ) {
+        EXPECT_EQ( out[ i ], float( 2 * i ) );
+    }
+}
+
+TEST( frnnMathCpu, Int8DotProductsAreExactForEachInstructionSet ) {
+    // The full range of int8 (including -128 * -128) with sizes which have tails for every width
+    std::vector<int8_t> x( 301 ), y( 301 );
+    for ( size_t i = 0; i < x.size(); i++ ) {
+        x[ i ] = static_cast<int8_t>( i % 3 == 0 ? -128 : static_cast<int>( i * 37 % 256 ) - 128 );
+        y[ i ] = static_cast<int8_t>( i % 5 == 0 ? -128 : static_cast<int>( i * 91 % 256 ) - 128 );
+    }
+    
+    for ( size_t N = 0; N <= x.size(); N += 43 ) {
+        const int32_t expected = frnn::cpu::dotInt8Kernel::scalar( &x[ 0 ], &y[ 0 ], N );
+        EXPECT_EQ( frnn::dispatchCpu<frnn::cpu::dotInt8Kernel>( &x[ 0 ], &y[ 0 ], N ), expected );
+        EXPECT_EQ( frnn::CpuIsaEntry<frnn::SSE>::run<frnn::cpu::dotInt8Kernel>( &x[ 0 ], &y[ 0 ], N ), expected );
+        EXPECT_EQ( dotInt8Cpu( &x[ 0 ], &y[ 0 ], N ), expected );
+    }
+}
+
+TEST( frnnMathCpu, QuantizedArraysAreWithinHalfTheScale ) {
+    std::vector<float>  x( 50 );
+    std::vector<int8_t> q( x.size() );
+    for ( size_t i = 0; i < x.size(); i++ ) x[ i ] = std::sin( float( i ) ) * 3.f;
+    
+    const float scale = quantizeCpu( &x[ 0 ], x.size(), &q[ 0 ] );
+    for ( size_t i = 0; i < x.size(); i++ ) EXPECT_NEAR( q[ i ] * scale, x[ i ], 0.5f * scale + 1e-6f );
+    EXPECT_EQ( quantizeCpu( &x[ 0 ], 0, &q[ 0 ] ), 1.f );
+}
+
+TEST( frnnMathCpu, VectorizedKernelsAreCorrectForAnySizeAndOffset ) {
+    // Slices which start at every offset from an aligned boundary, with every size up to a few vectors
+    frnn::aligned_vector<float> x( 128 ), y( 128 ), out( 128 );
+    EXPECT_EQ( reinterpret_cast<size_t>( &x[ 0 ] ) % frnn::FRNN_ALIGNMENT, 0 );
+    
+    for ( size_t offset = 0; offset < 16; offset++ ) {
+        for ( size_t N = 0; N < 67; N++ ) {
+            for ( size_t i = 0; i < x.size(); i++ ) {
+                x[ i ] = float( i % 13 ); y[ i ] = 1.0f; out[ i ] = -1.0f;
+            }
+            frnn::dispatchCpu<frnn::cpu::axpyKernel>( 2.0f, static_cast<const float*>( &x[ offset ] ), &y[ offset ], N );
+            frnn::dispatchCpu<frnn::cpu::xmyKernel>( static_cast<const float*>( &y[ offset ] ), 
+                                                      static_cast<const float*>( &x[ offset ] ), &out[ offset ], N );
+            
+            // Elements outside of the slice must not change
+            for ( size_t i = 0; i < x.size(); i++ ) {
+                const bool in_slice = i >= offset && i < offset + N;
+                EXPECT_EQ( y[ i ]  , in_slice ? 2.0f * float( i % 13 ) + 1.0f : 1.0f );
+                EXPECT_EQ( out[ i ], in_slice ? float( i % 13 ) + 1.0f : -1.0f );
+            }
+        }
+    }
+}
+
+TEST( frnnMathCpu, AxpyOperationComputesCorrectlyWithFloats ) {
+    std::vector<float> x( NUM_ELEMENTS_CPU + 3 ), y( NUM_ELEMENTS_CPU + 3 );
+    const float a = 2.0f;
+    for ( size_t i = 0; i < x.size(); i++ ) { 
+        x[ i ] = float( i % 100 );
+        y[ i ] = 1.0f;
+    }
+    
+    frnn::frnnError error;
+    frnn::math<float, frnn::device::CPU>::axpy( error, a, x, y );
+    
+    for ( size_t i = 0; i < y.size(); i++ ) {
+        EXPECT_EQ( y[ i ], a * float( i % 100 ) + 1.0f );
+    }
+}
+
+TEST( frnnMathCpu, ReductionSumComputesCorrectlyWithFloatsAndInts ) {
+    // Enough elements for the sum to be split between threads
+    std::vector<float> xf( NUM_ELEMENTS_CPU + 5, 1.0f );
+    std::vector<int>   xi( 1001 );
+    for ( size_t i = 0; i < xi.size(); i++ ) xi[ i ] = int( i );
+    
+    frnn::frnnError error;
+    float sum_f = frnn::math<float, frnn::device::CPU>::sum( error, xf );
+    int   sum_i = frnn::math<int  , frnn::device::CPU>::sum( error, xi );
+    
+    EXPECT_EQ( sum_f, float( NUM_ELEMENTS_CPU + 5 ) );
+    EXPECT_EQ( sum_i, 1000 * 1001 / 2 );
+}
+
+TEST( frnnMathCpu, ReductionSumVectorizedComputesCorrectlyWithFloatsAndEmptyResultsVector ) {
+    std::vector<float> x( 1000, 0.5f ), results;
+    
+    frnn::frnnError error;
+    frnn::math<float, frnn::device::CPU>::sumVectorized( error, x, results );
+    
+    EXPECT_EQ( results.size(), x.size() );
+    for ( size_t i = 0; i < results.size(); i++ ) EXPECT_EQ( results[ i ], 500.0f );
+}
+
+TEST( frnnMathCpu, SoftmaxDoesNotOverflowForLargeInputs ) {
+    // Big enough to be split between threads, with a tail for every vector width
+    std::vector<double> x( 70001 ), results;
+    for ( size_t i = 0; i < x.size(); i++ ) x[ i ] = 1000.0 + double( i % 7 );
+    
+    frnn::frnnError error;
+    frnn::math<double, frnn::device::CPU>::softmax( error, x, results );
+    
+    double norm = 0.0;
+    for ( size_t i = 0; i < x.size(); i++ ) norm += std::exp( double( i % 7 ) - 6.0 );
+    
+    double sum = 0.0;
+    for ( size_t i = 0; i < results.size(); i++ ) {
+        EXPECT_NEAR( results[ i ], std::exp( double( i % 7 ) - 6.0 ) / norm, 1e-12 );
+        sum += results[ i ];
+    }
+    EXPECT_NEAR( sum, 1.0, 1e-9 );
+}
+
+TEST( frnnMathCpu, SumOfVectorsAddsEachElementOverTheVectors ) {
+    frnn::frnnError error;
+    const size_t    N = 40003, M = 5, ld = N + 1;           // Chunks for the threads and a tail for the kernels
+    vector<float>   x( ld * M ), out( N, -1.f );
+    
+    for ( size_t v = 0; v < M; v++ ) {
+        for ( size_t i = 0; i < ld; i++ ) x[ v * ld + i ] = i < N ? float( v + 1 ) * float( i % 10 ) : 1e6f;
+    }
+    frnn::math<float, frnn::device::CPU>::sumVectors( error, &x[ 0 ], N, M, ld, &out[ 0 ] );
+    
+    // 1 + 2 + ... + M = 15
+    for ( size_t i = 0; i < N; i++ ) EXPECT_EQ( out[ i ], 15.f * float( i % 10 ) );
+}
+
+TEST( frnnMathCpu, GemvAndGemmMatchReferenceResultsForAllOperations ) {
+    const int M = 37, N = 19, K = 23;
+    std::vector<float> a( M * K ), b( K * N ), c( M * N, 1.0f ), x( K ), y( M, 1.0f );
+    for ( size_t i = 0; i < a.size(); i++ ) a[ i ] = float( ( i * 7 ) % 13 ) / 13.f - 0.5f;
+    for ( size_t i = 0; i < b.size(); i++ ) b[ i ] = float( ( i * 5 ) % 11 ) / 11.f - 0.5f;
+    for ( size_t i = 0; i < x.size(); i++ ) x[ i ] = float( i ) / K;
+    
+    // y = 2 * A * x + y, and C = 2 * A * B + 3 * C with A (M x K) and B (K x N) 
+    frnn::math<float, frnn::device::CPU>::gemv( frnn::blas::cpu::OP_N, M, K, 2.0f, &a[ 0 ], M, &x[ 0 ], 1.0f, &y[ 0 ] );
+    frnn::math<float, frnn::device::CPU>::gemm( frnn::blas::cpu::OP_N, frnn::blas::cpu::OP_N, M, N, K, 2.0f, 
+                                                &a[ 0 ], M, &b[ 0 ], K, 3.0f, &c[ 0 ], M );
+    
+    // The same with transposed copies, A^(T) is (K x M) and B^(T) is (N x K)
+    std::vector<float> at( K * M ), bt( N * K ), ct( M * N, 1.0f ), xt( M, 0.f ), yt( K, 0.f );
+    for ( int i = 0; i < M; i++ ) for ( int k = 0; k < K; k++ ) at[ k + i * K ] = a[ i + k * M ];
+    for ( int k = 0; k < K; k++ ) for ( int j = 0; j < N; j++ ) bt[ j + k * N ] = b[ k + j * K ];
+    for ( int i = 0; i < M; i++ ) xt[ i ] = float( i );
+    frnn::math<float, frnn::device::CPU>::gemm( frnn::blas::cpu::OP_T, frnn::blas::cpu::OP_T, M, N, K, 2.0f, 
+                                                &at[ 0 ], K, &bt[ 0 ], N, 3.0f, &ct[ 0 ], M );
+    frnn::math<float, frnn::device::CPU>::gemv( frnn::blas::cpu::OP_T, M, K, 1.0f, &a[ 0 ], M, &xt[ 0 ], 0.0f, &yt[ 0 ] );
+    
+    for ( int i = 0; i < M; i++ ) {
+        float ax = 0.f;
+        for ( int k = 0; k < K; k++ ) ax += a[ i + k * M ] * x[ k ];
+        EXPECT_NEAR( y[ i ], 2.f * ax + 1.f, TOLERANCE );
+        
+        for ( int j = 0; j < N; j++ ) {
+            float ab = 0.f;
+            for ( int k = 0; k < K; k++ ) ab += a[ i + k * M ] * b[ k + j * K ];
+            EXPECT_NEAR( c[ i + j * M ] , 2.f * ab + 3.f, TOLERANCE );
+            EXPECT_NEAR( ct[ i + j * M ], 2.f * ab + 3.f, TOLERANCE );
+        }
+    }
+    for ( int k = 0; k < K; k++ ) {
+        float atx = 0.f;
+        for ( int i = 0; i < M; i++ ) atx += a[ i + k * M ] * xt[ i ];
+        EXPECT_NEAR( yt[ k ], atx, 1e-3 );
+    }
+}
@@ -0,0 +1,189 @@
+/*
+ *  Header file for the fastRNN Philox4x32-10 counter based random number
+ *  generator, which is the same on the host and the device, so that the
+ *  CPU and GPU random functions give the same numbers for a seed.
+ *
+ *  Copyright (C) 2015 Rob Clucas robclu1818@gmail.com
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published
+ *  by the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program; if not, write to the Free Software Foundation,
+ *  Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#ifndef _FRNN_PHILOX_
+#define _FRNN_PHILOX_
+
+#include <cmath>
+#include <cstdint>
+#include <cstddef>
+
+#include "../../frnn/cuda_host.h"
+#include "../../frnn/precision.h"
+
+/* ============================================= NOTES ======================================================
+ *
+ * 1. Philox4x32-10 (Salmon et al., "Parallel random numbers: as easy as 1, 2, 3") maps a 128 bit counter
+ *    and a 64 bit key to 4 random 32 bit words. The key is the seed and the counter is the index of the
+ *    block of 4 words, so any part of the stream for a seed can be made without making the rest of it,
+ *    which is what lets every thread (and every SIMD lane) work on its own part of an array.
+ *
+ * 2. The stream for a seed is a sequence of 32 bit words, word w is word ( w % 4 ) of block ( w / 4 ).
+ *    Elements use PhiloxUniform<dType>::words words each, and element e of the stream starts at word
+ *    e * words, so filling N elements from an offset gives elements offset to offset + N - 1 of the stream,
+ *    and the same elements for the same seed and offset on the CPU and the GPU.
+ *
+ * 3. Floats use the top 24 bits of a word and doubles the top 53 bits of two words (so they are in [0, 1)),
+ *    and are scaled to [lo, hi) with a fused multiply-add, which is rounded the same way on the host and the
+ *    device (a result which rounds up to hi is moved to the number below it). Ints use the high 32 bits of
+ *    word * ( hi - lo ), so they are in [lo, hi). Halfs and bfloat16s are made as floats (on the float range
+ *    of lo and hi) and rounded down, so they are also in [lo, hi), and cost one word, like floats. Halfs and
+ *    bfloat16s are CUDA types, so their conversions are only in GPU builds (with FRNN_WITH_CUDA).
+ *
+ * ==========================================================================================================
+ */
+
+namespace frnn {
+namespace rng  {
+
+// Seed which is used when one is not given
+const unsigned long long DEFAULT_SEED = 1234ULL;
+
+// Philox4x32 round multipliers and the Weyl sequence constants for the key
+const uint32_t PHILOX_M0     = 0xD2511F53u;
+const uint32_t PHILOX_M1     = 0xCD9E8D57u;
+const uint32_t PHILOX_W0     = 0x9E3779B9u;
+const uint32_t PHILOX_W1     = 0xBB67AE85u;
+const int      PHILOX_ROUNDS = 10;
+
+/*
+ * ==========================================================================================================
+ * Struct       : philox4x32
+ *
+ * Description  : The 4 words of the output (or the counter) of a Philox4x32 block
+ * ==========================================================================================================
+ */
+struct philox4x32 {
+    uint32_t x[ 4 ];
+};
+
+/*
+ * ==========================================================================================================
+ * Function     : philoxRound
+ *
+ * Description  : Performs a single round of Philox4x32 on a counter, with the key for the round
+ *
+ * Inputs       : c0 - c3   : The words of the counter
+ *              : k0, k1    : The words of the key for the round
+ *
+ * Outputs      : c0 - c3   : The words of the counter after the round
+ * ==========================================================================================================
+ */
+__host__ __device__ inline void philoxRound( uint32_t& c0, uint32_t& c1, uint32_t& c2, uint32_t& c3,
+                                             uint32_t k0, uint32_t k1 ) {
+    const uint64_t p0 = static_cast<uint64_t>( PHILOX_M0 ) * c0;
+    const uint64_t p1 = static_cast<uint64_t>( PHILOX_M1 ) * c2;
+    const uint32_t n0 = static_cast<uint32_t>( p1 >> 32 ) ^ c1 ^ k0;
+    const uint32_t n2 = static_cast<uint32_t>( p0 >> 32 ) ^ c3 ^ k1;
+    c1 = static_cast<uint32_t>( p1 );
+    c3 = static_cast<uint32_t>( p0 );
+    c0 = n0;
+    c2 = n2;
+}
+
+/*
+ * ==========================================================================================================
+ * Function     : philox
+ *
+ * Description  : Computes a block of the Philox4x32-10 stream for a seed
+ *
+ * Inputs       : seed      : The seed (key) of the stream
+ *              : block     : The index of the block in the stream (the counter)
+ *
+ * Outputs      : The 4 words of the block
+ * ==========================================================================================================
+ */
+__host__ __device__ inline philox4x32 philox( unsigned long long seed, unsigned long long block ) {
+    uint32_t c0 = static_cast<uint32_t>( block ), c1 = static_cast<uint32_t>( block >> 32 ), c2 = 0, c3 = 0;
+    uint32_t k0 = static_cast<uint32_t>( seed ) , k1 = static_cast<uint32_t>( seed >> 32 );
+
+    for ( int round = 0; round < PHILOX_ROUNDS; round++ ) {
+        philoxRound( c0, c1, c2, c3, k0, k1 );
+        k0 += PHILOX_W0;
+        k1 += PHILOX_W1;
+    }
+    philox4x32 result = { { c0, c1, c2, c3 } };
+    return result;
+}
+
+/*
+ * ==========================================================================================================
+ * Struct       : PhiloxUniform
+ *
+ * Description  : Converts stream words to a uniform number of a type on the range [lo, hi)
+ *
+ * Params       : dType     : The type of the numbers
+ * ==========================================================================================================
+ */
+template <typename dType> struct PhiloxUniform;
+
+template <> struct PhiloxUniform<float> {
+    static constexpr uint32_t words = 1;
+    __host__ __device__ static inline float convert( const uint32_t* w, float lo, float hi ) {
+        // The top 24 bits times 2^-24
+        const float r = fmaf( static_cast<float>( w[ 0 ] >> 8 ) * 5.9604644775390625e-8f, hi - lo, lo );
+        return r < hi || !( hi > lo ) ? r : nextafterf( hi, lo );     // Rounding can give hi
+    }
+};
+
+template <> struct PhiloxUniform<double> {
+    static constexpr uint32_t words = 2;
+    __host__ __device__ static inline double convert( const uint32_t* w, double lo, double hi ) {
+        const uint64_t bits = ( static_cast<uint64_t>( w[ 0 ] ) << 21 ) | ( w[ 1 ] >> 11 );        // 53 bits
+        // The 53 bits times 2^-53
+        const double   r    = fma( static_cast<double>( bits ) * 1.1102230246251565e-16, hi - lo, lo );
+        return r < hi || !( hi > lo ) ? r : nextafter( hi, lo );
+    }
+};
+
+template <> struct PhiloxUniform<int> {
+    static constexpr uint32_t words = 1;
+    __host__ __device__ static inline int convert( const uint32_t* w, int lo, int hi ) {
+        const uint64_t range = static_cast<uint32_t>( hi - lo );
+        return lo + static_cast<int>( ( static_cast<uint64_t>( w[ 0 ] ) * range ) >> 32 );
+    }
+};
+
+#ifdef FRNN_WITH_CUDA
+template <> struct PhiloxUniform<__half> {
+    static constexpr uint32_t words = 1;
+    __host__ __device__ static inline __half convert( const uint32_t* w, __half lo, __half hi ) {
+        return __float2half_rd( PhiloxUniform<float>::convert( w, __half2float( lo ), __half2float( hi ) ) );
+    }
+};
+
+#ifdef FRNN_BF16
+template <> struct PhiloxUniform<__nv_bfloat16> {
+    static constexpr uint32_t words = 1;
+    __host__ __device__ static inline __nv_bfloat16 convert( const uint32_t* w, __nv_bfloat16 lo,
+                                                             __nv_bfloat16 hi ) {
+        return __float2bfloat16_rd( PhiloxUniform<float>::convert( w, __bfloat162float( lo ),
+                                                                      __bfloat162float( hi ) ) );
+    }
+};
+#endif
+#endif
+
+}   // Namespace rng
+}   // Namespace frnn
+
+#endif
@@ -26,8 +26,21 @@
 #include <cuda.h>
 #include <curand.h>
 
-curandStatus_t frnnGenerateUniform( curandGenerator_t genenrator , int* outputPtr, size_t num ) {
-    // Do nothing for the moment
+/*
+ * ==========================================================================================================
+ * Function     : frnnGenerateUniform
+ * 
+ * Description  : Generates uniformly distributed ints over the whole range of int, from the 32 bit words of 
+ *                a pseudo random generator (ints can't be on the range [0, 1) like the float versions, so use
+ *                randGpu for ints on a range)
+ * 
+ * Inputs       : generator : The curand generator to use 
+ *              : outputPtr : The device array to fill
+ *              : num       : The number of ints to generate
+ * ==========================================================================================================
+ */
+inline curandStatus_t frnnGenerateUniform( curandGenerator_t generator, int* outputPtr, size_t num ) {
+    return curandGenerate( generator, reinterpret_cast<unsigned int*>( outputPtr ), num );
 }
 
 #endif 
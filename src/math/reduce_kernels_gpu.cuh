@@ -0,0 +1,468 @@
+/*
+ *  Header file for fastRNN GPU reduction kernels. The reductions are generic
+ *  on the operation (sum, max, min, argmax, argmin) and on a functor which is
+ *  applied to each element first, and are done in a single pass over the
+ *  data with results which are the same for every run.
+ *
+ *  Copyright (C) 2015 Rob Clucas robclu1818@gmail.com
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published
+ *  by the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program; if not, write to the Free Software Foundation,
+ *  Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#ifndef _FRNN_REDUCE_KERNELS_GPU_
+#define _FRNN_REDUCE_KERNELS_GPU_
+
+#include <cuda.h>
+#include <cuda_runtime.h>
+
+#include <cfloat>
+#include <climits>
+
+#include "../frnn/types.h"
+#include "../frnn/precision.h"
+#include "../frnn/vectorized_types_gpu.h"
+#include "../functors/functors.cuh"
+#include "vectorized_kernels_gpu.cuh"
+
+/* ============================================= NOTES ======================================================
+ *
+ * 1. The grid reduction uses the last block done pattern (see the threadFenceReduction CUDA sample): each
+ *    block writes its result to partials, and the block which takes the last ticket from the counter combines
+ *    the partials in order of the block index. The order of every operation only depends on N and the size
+ *    of the grid, not on which blocks finish first, so the results are bitwise the same for every run (which
+ *    atomic adds of floats are not). Cooperative groups would also work, but need a cooperative launch with
+ *    a grid which fits on the device at once.
+ *
+ * 2. Blocks load W (1, 2 or 4) elements at a time with the vectorized types. The array is split with
+ *    alignedSplit (see vectorized_kernels_gpu.cuh), so the elements before the first one which is aligned for
+ *    the vectorized type, and the elements after the last full vector, are loaded one at a time, and any N and
+ *    any (element aligned) pointer can be used. W, the block size and the max number of blocks are the launch
+ *    configuration which the kernel tuner selects (see frnn/kernel_tuner.cuh), the results are the same for
+ *    every run with the same configuration.
+ *
+ * 3. The number of threads per block must be a multiple of the warp size, and the block reductions can be
+ *    called one after the other (they synchronize before using their shared memory).
+ *
+ * ==========================================================================================================
+ */
+
+/*
+ * ==========================================================================================================
+ * Function     : lowest / highest
+ *
+ * Description  : Gets the lowest and highest finite values of a type, which are the identities of the max
+ *                and min reductions
+ *
+ * Params       : dType     : The data type (float, double or int)
+ * ==========================================================================================================
+ */
+template <typename dType> __inline__ __device__ dType lowest();
+template <> __inline__ __device__ float  lowest<float>()   { return -FLT_MAX; }
+template <> __inline__ __device__ double lowest<double>()  { return -DBL_MAX; }
+template <> __inline__ __device__ int    lowest<int>()     { return INT_MIN;  }
+
+template <typename dType> __inline__ __device__ dType highest();
+template <> __inline__ __device__ float  highest<float>()  { return FLT_MAX;  }
+template <> __inline__ __device__ double highest<double>() { return DBL_MAX;  }
+template <> __inline__ __device__ int    highest<int>()    { return INT_MAX;  }
+
+namespace frnn   {
+
+// Max number of blocks for the single pass reduction, so the last block has few partial results to combine
+const size_t REDUCE_MAX_BLOCKS = 1024;
+
+namespace reduce {
+
+/*
+ * ==========================================================================================================
+ * Struct       : indexed
+ *
+ * Description  : A value and the index of the element it came from, which is what argmax and argmin reduce
+ *
+ * Params       : dType     : The type of the value
+ * ==========================================================================================================
+ */
+template <typename dType>
+struct indexed {
+    dType               value;
+    unsigned long long  index;
+};
+
+/*
+ * ==========================================================================================================
+ * Structs      : sum, max, min, argmax, argmin
+ *
+ * Description  : The reduction operations, each has the result type for a type of element (value_type), the
+ *                identity of the operation, the conversion of an element (and its index) to the result type,
+ *                and the combination of two results. argmax and argmin give the smallest index when there is
+ *                more than one element with the max (or min) value. The results for the reduced precision
+ *                types are floats (their accumulate_type), so the sums are accumulated in floats.
+ * ==========================================================================================================
+ */
+struct sum {
+    template <typename dType> struct value_type { typedef typename frnn::accumulate_type<dType>::type type; };
+
+    template <typename dType> __device__ static typename value_type<dType>::type identity() { 
+        return typename value_type<dType>::type( 0 ); 
+    }
+    template <typename dType> __device__ static typename value_type<dType>::type element( dType x, unsigned long long ) { 
+        return static_cast<typename value_type<dType>::type>( x ); 
+    }
+    template <typename vType> __device__ static vType combine( vType a, vType b ) { return a + b; }
+};
+
+struct max {
+    template <typename dType> struct value_type { typedef typename frnn::accumulate_type<dType>::type type; };
+
+    template <typename dType> __device__ static typename value_type<dType>::type identity() { 
+        return lowest<typename value_type<dType>::type>(); 
+    }
+    template <typename dType> __device__ static typename value_type<dType>::type element( dType x, unsigned long long ) { 
+        return static_cast<typename value_type<dType>::type>( x ); 
+    }
+    template <typename vType> __device__ static vType combine( vType a, vType b ) { return a < b ? b : a; }
+};
+
+struct min {
+    template <typename dType> struct value_type { typedef typename frnn::accumulate_type<dType>::type type; };
+
+    template <typename dType> __device__ static typename value_type<dType>::type identity() { 
+        return highest<typename value_type<dType>::type>(); 
+    }
+    template <typename dType> __device__ static typename value_type<dType>::type element( dType x, unsigned long long ) { 
+        return static_cast<typename value_type<dType>::type>( x ); 
+    }
+    template <typename vType> __device__ static vType combine( vType a, vType b ) { return b < a ? b : a; }
+};
+
+struct argmax {
+    template <typename dType> struct value_type { typedef indexed<typename frnn::accumulate_type<dType>::type> type; };
+
+    template <typename dType> __device__ static typename value_type<dType>::type identity() {
+        typename value_type<dType>::type result = { lowest<typename frnn::accumulate_type<dType>::type>(), ~0ULL };
+        return result;
+    }
+    template <typename dType> __device__ static typename value_type<dType>::type element( dType x, unsigned long long i ) {
+        typename value_type<dType>::type result = { static_cast<typename frnn::accumulate_type<dType>::type>( x ), i };
+        return result;
+    }
+    template <typename vType> __device__ static indexed<vType> combine( indexed<vType> a, indexed<vType> b ) {
+        return ( b.value > a.value || ( b.value == a.value && b.index < a.index ) ) ? b : a;
+    }
+};
+
+struct argmin {
+    template <typename dType> struct value_type { typedef indexed<typename frnn::accumulate_type<dType>::type> type; };
+
+    template <typename dType> __device__ static typename value_type<dType>::type identity() {
+        typename value_type<dType>::type result = { highest<typename frnn::accumulate_type<dType>::type>(), ~0ULL };
+        return result;
+    }
+    template <typename dType> __device__ static typename value_type<dType>::type element( dType x, unsigned long long i ) {
+        typename value_type<dType>::type result = { static_cast<typename frnn::accumulate_type<dType>::type>( x ), i };
+        return result;
+    }
+    template <typename vType> __device__ static indexed<vType> combine( indexed<vType> a, indexed<vType> b ) {
+        return ( b.value < a.value || ( b.value == a.value && b.index < a.index ) ) ? b : a;
+    }
+};
+
+}   // Namespace reduce
+}   // Namespace frnn
+
+// Mask of every lane of a warp, for the warp shuffles (which need their lanes on Volta and later)
+const unsigned int FULL_WARP_MASK = 0xffffffffu;
+
+/*
+ * ==========================================================================================================
+ * Function     : shflXor
+ *
+ * Description  : Gets the value of the thread in the warp whose lane is lane ^ offset, for the types of the
+ *                results of the reductions. Every lane of the warp must call it (see NOTES 3).
+ *
+ * Inputs       : val       : The value of this thread
+ *              : offset    : The xor of the lanes
+ * ==========================================================================================================
+ */
+template <typename dType>
+__inline__ __device__ dType shflXor( dType val, int offset ) { return __shfl_xor_sync( FULL_WARP_MASK, val, offset ); }
+
+template <typename dType>
+__inline__ __device__ frnn::reduce::indexed<dType> shflXor( frnn::reduce::indexed<dType> val, int offset ) {
+    frnn::reduce::indexed<dType> other;
+    other.value = __shfl_xor_sync( FULL_WARP_MASK, val.value, offset );
+    other.index = static_cast<unsigned int>( __shfl_xor_sync( FULL_WARP_MASK, static_cast<int>( val.index ), offset ) ) |
+                  ( static_cast<unsigned long long>(
+                        static_cast<unsigned int>( __shfl_xor_sync( FULL_WARP_MASK, static_cast<int>( val.index >> 32 ), offset ) )
+                  ) << 32 );
+    return other;
+}
+
+/*
+ * ==========================================================================================================
+ * Function     : loadVolatile
+ *
+ * Description  : Loads a value which was written by another block (so that a cached copy isn't used), for
+ *                the types of the results of the reductions
+ *
+ * Inputs       : address   : The address of the value
+ * ==========================================================================================================
+ */
+template <typename dType>
+__inline__ __device__ dType loadVolatile( const dType* address ) {
+    return *const_cast<const volatile dType*>( address );
+}
+
+template <typename dType>
+__inline__ __device__ frnn::reduce::indexed<dType> loadVolatile( const frnn::reduce::indexed<dType>* address ) {
+    const volatile frnn::reduce::indexed<dType>* val   = address;
+    frnn::reduce::indexed<dType>                 other = { val->value, val->index };
+    return other;
+}
+
+/*
+ * ==========================================================================================================
+ * Function     : warpReduceOp
+ *
+ * Description  : Reduces the values of the threads in a warp with the butterfly operation, all the threads
+ *                in the warp get the result
+ *
+ * Inputs       : val       : The value of this thread
+ *
+ * Params       : Op        : The reduction operation
+ *              : vType     : The type of the values (the result type of the operation)
+ * ==========================================================================================================
+ */
+template <typename Op, typename vType>
+__inline__ __device__ vType warpReduceOp( vType val ) {
+    for ( int offset = ( warpSize / 2 ); offset > 0; offset /= 2 ) {
+        val = Op::combine( val, shflXor( val, offset ) );
+    }
+    return val;
+}
+
+/*
+ * ==========================================================================================================
+ * Function     : blockReduceOp
+ *
+ * Description  : Reduces the values of the threads in a block, all the threads in the block get the result.
+ *                The warps are reduced with warpReduceOp and then the results of the warps, in order.
+ *
+ * Inputs       : val       : The value of this thread
+ *              : identity  : The identity of the operation (for the lanes without a warp result)
+ *
+ * Params       : Op        : The reduction operation
+ *              : vType     : The type of the values (the result type of the operation)
+ * ==========================================================================================================
+ */
+template <typename Op, typename vType>
+__inline__ __device__ vType blockReduceOp( vType val, vType identity ) {
+    __shared__ vType shared_mem[ 32 ];
+    const int lane = threadIdx.x % warpSize;
+    const int wid  = threadIdx.x / warpSize;
+
+    val = warpReduceOp<Op>( val );
+    __syncthreads();                                            // Previous use of shared_mem is done
+    if ( lane == 0 ) shared_mem[ wid ] = val;
+    __syncthreads();
+
+    val = ( lane < blockDim.x / warpSize ) ? shared_mem[ lane ] : identity;
+    return warpReduceOp<Op>( val );
+}
+
+/*
+ * ==========================================================================================================
+ * Struct       : reduceLanes
+ *
+ * Description  : The type which W elements are loaded as, and the reduction of the elements of a load (in
+ *                the order of their lanes, as pairs)
+ *
+ * Params       : W         : The number of elements of each load (1, 2 or 4)
+ * ==========================================================================================================
+ */
+template <int W> struct reduceLanes;
+
+template <> struct reduceLanes<1> {
+    template <typename dType> struct load_type { typedef dType type; };
+
+    template <typename Op, typename dType, typename F>
+    __device__ static typename Op::template value_type<dType>::type combine( dType val, unsigned long long first, F f ) {
+        return Op::element( f( val ), first );
+    }
+};
+template <> struct reduceLanes<2> {
+    template <typename dType> struct load_type { typedef typename frnn::VectorizedTypeGpu<dType, 2>::vect_type type; };
+
+    template <typename Op, typename dType, typename F, typename V>
+    __device__ static typename Op::template value_type<dType>::type combine( const V& val, unsigned long long first, F f ) {
+        return Op::combine( Op::element( f( val.x ), first ), Op::element( f( val.y ), first + 1 ) );
+    }
+};
+template <> struct reduceLanes<4> {
+    template <typename dType> struct load_type { typedef typename frnn::VectorizedTypeGpu<dType, 4>::vect_type type; };
+
+    template <typename Op, typename dType, typename F, typename V>
+    __device__ static typename Op::template value_type<dType>::type combine( const V& val, unsigned long long first, F f ) {
+        return Op::combine( Op::combine( Op::element( f( val.x ), first     ), Op::element( f( val.y ), first + 1 ) ),
+                            Op::combine( Op::element( f( val.z ), first + 2 ), Op::element( f( val.w ), first + 3 ) ) );
+    }
+};
+
+/*
+ * ==========================================================================================================
+ * Function     : threadReduce
+ *
+ * Description  : Reduces the elements of an array which a thread of the grid is responsible for, loading W
+ *                elements at a time where the array is aligned for the vectorized type (see NOTES 2)
+ *
+ * Inputs       : in        : The array to reduce
+ *              : N         : The number of elements in the array
+ *              : f         : The functor to apply to each element before reducing
+ *
+ * Params       : Op        : The reduction operation
+ *              : W         : The number of elements of each load (1, 2 or 4)
+ *              : dType     : The type of the elements
+ *              : F         : The type of the functor
+ * ==========================================================================================================
+ */
+template <typename Op, int W, typename dType, typename F>
+__inline__ __device__ typename Op::template value_type<dType>::type threadReduce( const dType* in, size_t N, F f ) {
+    typedef typename Op::template value_type<dType>::type                   vType;
+    typedef typename reduceLanes<W>::template load_type<dType>::type        vect;
+
+    const size_t              tid    = blockIdx.x * blockDim.x + threadIdx.x;
+    const size_t              stride = blockDim.x * gridDim.x;
+    const frnn::aligned_split split  = frnn::alignedSplit( in, N, W, __alignof__( vect ) );
+    const vect*               body   = reinterpret_cast<const vect*>( in + split.head );
+    vType                     result = Op::template identity<dType>();
+
+    for ( size_t i = tid; i < split.head; i += stride ) result = Op::combine( result, Op::element( f( in[ i ] ), i ) );
+    for ( size_t i = tid; i < split.vectors; i += stride ) {
+        result = Op::combine( result, reduceLanes<W>::template combine<Op, dType>( body[ i ], split.head + W * i, f ) );
+    }
+    for ( size_t i = N - split.tail + tid; i < N; i += stride ) {
+        result = Op::combine( result, Op::element( f( in[ i ] ), i ) );
+    }
+    return result;
+}
+
+/*
+ * ==========================================================================================================
+ * Function     : reduceKernel
+ *
+ * Description  : Reduces an array in a single pass, each block reduces its part of the array and the last
+ *                block to finish reduces the results of the blocks (see NOTES 1)
+ *
+ * Inputs       : in        : The array to reduce
+ *              : N         : The number of elements in the array
+ *              : partials  : Device memory for the result of each block (gridDim.x elements)
+ *              : counter   : Device counter for the blocks which are done, which must be 0 at the start
+ *                            (it is 0 again at the end)
+ *              : f         : The functor to apply to each element before reducing
+ *
+ * Outputs      : out       : The result of the reduction
+ *
+ * Params       : Op        : The reduction operation
+ *              : W         : The number of elements of each load (1, 2 or 4)
+ *              : dType     : The type of the elements
+ *              : F         : The type of the functor
+ * ==========================================================================================================
+ */
+template <typename Op, int W, typename dType, typename F>
+__global__ void reduceKernel( const dType* in, size_t N, typename Op::template value_type<dType>::type* partials,
+                              unsigned int* counter, typename Op::template value_type<dType>::type* out, F f ) {
+    typedef typename Op::template value_type<dType>::type vType;
+    __shared__ bool last_block;
+
+    const vType identity = Op::template identity<dType>();
+    vType       result   = blockReduceOp<Op>( threadReduce<Op, W>( in, N, f ), identity );
+
+    if ( threadIdx.x == 0 ) {
+        partials[ blockIdx.x ] = result;
+        __threadfence();                                        // The result is visible before the ticket
+        last_block = atomicInc( counter, gridDim.x - 1 ) == gridDim.x - 1;
+    }
+    __syncthreads();
+    if ( !last_block ) return;
+
+    // Combine the results of the blocks in order
+    result = identity;
+    for ( unsigned int b = threadIdx.x; b < gridDim.x; b += blockDim.x ) {
+        result = Op::combine( result, loadVolatile( partials + b ) );
+    }
+    result = blockReduceOp<Op>( result, identity );
+    if ( threadIdx.x == 0 ) *out = result;
+}
+
+/*
+ * ==========================================================================================================
+ * Function     : reduceSegmentsKernel
+ *
+ * Description  : Reduces each of M segments of N elements, where the segments are ld elements apart (the
+ *                columns of a column major matrix with leading dimension ld, for example the samples of a
+ *                batch). Each block does one segment at a time.
+ *
+ * Inputs       : in        : The array with the segments
+ *              : N         : The number of elements in each segment
+ *              : M         : The number of segments
+ *              : ld        : The number of elements from the start of one segment to the start of the next
+ *              : f         : The functor to apply to each element before reducing
+ *
+ * Outputs      : out       : The result for each segment, the indices of argmax and argmin are in the segment
+ *
+ * Params       : Op        : The reduction operation
+ *              : dType     : The type of the elements
+ *              : F         : The type of the functor
+ * ==========================================================================================================
+ */
+template <typename Op, typename dType, typename F>
+__global__ void reduceSegmentsKernel( const dType* in, size_t N, size_t M, size_t ld,
+                                      typename Op::template value_type<dType>::type* out, F f ) {
+    typedef typename Op::template value_type<dType>::type vType;
+    const vType identity = Op::template identity<dType>();
+
+    for ( size_t segment = blockIdx.x; segment < M; segment += gridDim.x ) {
+        const dType* in_segment = in + segment * ld;
+        vType        result     = identity;
+
+        for ( size_t i = threadIdx.x; i < N; i += blockDim.x ) {
+            result = Op::combine( result, Op::element( f( in_segment[ i ] ), i ) );
+        }
+        result = blockReduceOp<Op>( result, identity );
+        if ( threadIdx.x == 0 ) out[ segment ] = result;
+    }
+}
+
+/*
+ * ==========================================================================================================
+ * Function     : broadcast
+ *
+ * Description  : Sets each of the N elements of x to a value which is in device memory (the result of a
+ *                reduction for example)
+ *
+ * Inputs       : N         : The number of elements in the array
+ *              : value     : A pointer to the value in device memory (which must not be in x)
+ *
+ * Outputs      : x         : The array where each element is the value
+ *
+ * Params       : dType     : The type of data in the array
+ * ==========================================================================================================
+ */
+template <typename dType>
+__global__ void broadcast( dType* x, size_t N, const dType* value ) {
+    fillVectorized( x, N, *value );
+}
+
+#endif
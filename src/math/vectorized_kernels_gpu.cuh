@@ -0,0 +1,126 @@
+/*
+ *  Header file for fastRNN vectorized GPU kernel helpers, which split the
+ *  arrays of elementwise kernels into an unaligned prologue, a body of full
+ *  width vector loads and stores, and an epilogue.
+ *
+ *  Copyright (C) 2015 Rob Clucas robclu1818@gmail.com
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published
+ *  by the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program; if not, write to the Free Software Foundation,
+ *  Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#ifndef _FRNN_VECTORIZED_KERNELS_GPU_
+#define _FRNN_VECTORIZED_KERNELS_GPU_
+
+#include <cuda.h>
+#include <cuda_runtime.h>
+
+#include "../frnn/aligned_allocator.h"
+#include "../frnn/vectorized_types_gpu.h"
+
+/* ============================================= NOTES ======================================================
+ *
+ * 1. The helpers are called by every thread of a grid, and each thread does the elements (and vectors) of
+ *    its grid stride. The output is split with alignedSplit for the 4 element vectorized type, so the prologue
+ *    is the (fewer than 4) elements before the first aligned vector, and the epilogue the (fewer than 4)
+ *    elements after the last one. Every part uses a grid stride loop, so there are no elements which are
+ *    skipped for any N, grid size or offset of the arrays.
+ *
+ * 2. The input of mapVectorized is loaded 4 elements at a time too if it has the same alignment as the
+ *    output (which is the case for the same part of two arrays from the allocator). If it doesn't, vector
+ *    loads of the input would be misaligned, so the input is loaded one element at a time and the stores
+ *    are still vectorized.
+ *
+ * ==========================================================================================================
+ */
+
+/*
+ * ==========================================================================================================
+ * Function     : mapVectorized
+ *
+ * Description  : Sets out[ i ] = f( in[ i ] ) for the elements which a thread of the grid is responsible
+ *                for, with 4 element vector loads and stores for the aligned part of the arrays
+ *
+ * Inputs       : in        : The input array
+ *              : N         : The number of elements in the arrays
+ *              : f         : The functor to apply to each element
+ *
+ * Outputs      : out       : The results (which can be in)
+ *
+ * Params       : dType     : The type of the elements
+ *              : F         : The type of the functor
+ * ==========================================================================================================
+ */
+template <typename dType, typename F>
+__inline__ __device__ void mapVectorized( const dType* in, dType* out, size_t N, F f ) {
+    typedef typename frnn::VectorizedTypeGpu<dType, 4>::vect_type vect4;
+
+    const size_t              tid    = blockIdx.x * blockDim.x + threadIdx.x;
+    const size_t              stride = blockDim.x * gridDim.x;
+    const frnn::aligned_split split  = frnn::alignedSplit( out, N, 4, __alignof__( vect4 ) );
+    vect4*                    body   = reinterpret_cast<vect4*>( out + split.head );
+
+    for ( size_t i = tid; i < split.head; i += stride ) out[ i ] = f( in[ i ] );
+
+    if ( frnn::sameAlignment( in, out, __alignof__( vect4 ) ) ) {
+        const vect4* in_body = reinterpret_cast<const vect4*>( in + split.head );
+        for ( size_t i = tid; i < split.vectors; i += stride ) {
+            vect4 val = in_body[ i ];
+            val.x = f( val.x ); val.y = f( val.y ); val.z = f( val.z ); val.w = f( val.w );
+            body[ i ] = val;
+        }
+    } else {
+        for ( size_t i = tid; i < split.vectors; i += stride ) {
+            const dType* in_vect = in + split.head + 4 * i;
+            vect4        val;
+            val.x = f( in_vect[ 0 ] ); val.y = f( in_vect[ 1 ] ); val.z = f( in_vect[ 2 ] ); val.w = f( in_vect[ 3 ] );
+            body[ i ] = val;
+        }
+    }
+
+    for ( size_t i = N - split.tail + tid; i < N; i += stride ) out[ i ] = f( in[ i ] );
+}
+
+/*
+ * ==========================================================================================================
+ * Function     : fillVectorized
+ *
+ * Description  : Sets the elements of an array which a thread of the grid is responsible for to a value,
+ *                with 4 element vector stores for the aligned part of the array
+ *
+ * Inputs       : N         : The number of elements in the array
+ *              : value     : The value to set each element to
+ *
+ * Outputs      : x         : The array where each element is value
+ *
+ * Params       : dType     : The type of the elements
+ * ==========================================================================================================
+ */
+template <typename dType>
+__inline__ __device__ void fillVectorized( dType* x, size_t N, dType value ) {
+    typedef typename frnn::VectorizedTypeGpu<dType, 4>::vect_type vect4;
+
+    const size_t              tid    = blockIdx.x * blockDim.x + threadIdx.x;
+    const size_t              stride = blockDim.x * gridDim.x;
+    const frnn::aligned_split split  = frnn::alignedSplit( x, N, 4, __alignof__( vect4 ) );
+    vect4*                    body   = reinterpret_cast<vect4*>( x + split.head );
+    vect4                     val;
+    val.x = value; val.y = value; val.z = value; val.w = value;
+
+    for ( size_t i = tid; i < split.head; i += stride ) x[ i ] = value;
+    for ( size_t i = tid; i < split.vectors; i += stride ) body[ i ] = val;
+    for ( size_t i = N - split.tail + tid; i < N; i += stride ) x[ i ] = value;
+}
+
+#endif
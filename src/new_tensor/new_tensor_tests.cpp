@@ -22,6 +22,7 @@
 #include <iostream>
 
 #include "tensor.h"
+#include "static_tensor.h"
 
 TEST( frnnTensor, CanCreateTensorWithDefaultConstructor ) 
 {
@@ -227,6 +228,37 @@ TEST( frnnTensor, CanCreateNewTensorFromSlice )
     EXPECT_EQ( slice_dim_size_j, tensor.size(0) );
 }
 
+TEST( frnnTensor, SliceElementsMatchTransposedTensor ) 
+{
+    using namespace frnn::index;
+    frnn::Tensor<int, 3> tensor = {3, 2, 3};
+    for (int x = 0; x < tensor.size(); x++) tensor[x] = x;
+    
+    frnn::Tensor<int, 2> sliced_tensor = tensor.slice(j, i);
+    
+    for (int x = 0; x < 2; x++) {
+        for (int y = 0; y < 3; y++) EXPECT_EQ( sliced_tensor(x, y), tensor(y, x, 0) );
+    }
+}
+
+TEST( frnnTensor, SliceDeterminesStridesAndContiguousRuns ) 
+{
+    using namespace frnn::index;
+    frnn::Tensor<int, 3> tensor = {3, 2, 3};
+    
+    auto transpose  = tensor.slice(j, i);
+    auto skip_dim   = tensor.slice(i, k);
+    auto whole      = tensor.slice(i, j, k);
+    
+    EXPECT_EQ( transpose.strides()[0], 3 );
+    EXPECT_EQ( transpose.strides()[1], 1 );
+    EXPECT_EQ( transpose.contiguousRun(), 1 );
+    EXPECT_EQ( skip_dim.strides()[1], 6 );
+    EXPECT_EQ( skip_dim.contiguousRun(), 3 );
+    EXPECT_EQ( whole.contiguousRun(), tensor.size() );
+    EXPECT_EQ( skip_dim.offset(4), 7 );
+}
+
 TEST( frnnTensor, CanCreateTensorMultiplier )
 {
     frnn::Tensor<int, 3> tensor_1 = {2, 2, 2};
@@ -246,3 +278,148 @@ TEST( frnnTensor, CanCreateTensorMultiplier )
     EXPECT_EQ( vect[1], 2 );
     EXPECT_EQ( vect[2], 1 );
 }
+
+TEST( frnnTensor, CanMultiplyMatricesWithTensorMultiplication )
+{
+    frnn::Tensor<int, 2> tensor_1 = {2, 3};
+    frnn::Tensor<int, 2> tensor_2 = {3, 4};
+    
+    for (int x = 0; x < 2; x++) 
+        for (int y = 0; y < 3; y++) tensor_1(x, y) = x + 2 * y + 1;
+    for (int x = 0; x < 3; x++) 
+        for (int y = 0; y < 4; y++) tensor_2(x, y) = x - y;
+    
+    using namespace frnn::index;
+    frnn::Tensor<int, 2> result = tensor_1(i, j) * tensor_2(j, k);
+    
+    EXPECT_EQ( result.size(), 8 );
+    EXPECT_EQ( result.size(0), 2 );
+    EXPECT_EQ( result.size(1), 4 );
+    for (int x = 0; x < 2; x++) {
+        for (int z = 0; z < 4; z++) {
+            int expected = 0;
+            for (int y = 0; y < 3; y++) expected += tensor_1(x, y) * tensor_2(y, z);
+            EXPECT_EQ( result(x, z), expected );
+        }
+    }
+}
+
+TEST( frnnTensor, CanContractPermutedDimensionsWithTensorMultiplication )
+{
+    frnn::Tensor<int, 3> tensor_1 = {2, 3, 4};
+    frnn::Tensor<int, 3> tensor_2 = {3, 2, 5};
+    
+    for (int x = 0; x < tensor_1.size(); x++) tensor_1[x] = x % 7 - 3;
+    for (int x = 0; x < tensor_2.size(); x++) tensor_2[x] = x % 5 + 1;
+    
+    // z_kl = x_ijk * y_jil
+    using namespace frnn::index;
+    frnn::Tensor<int, 2> result = tensor_1(i, j, k) * tensor_2(j, i, l);
+    
+    EXPECT_EQ( result.size(0), 4 );
+    EXPECT_EQ( result.size(1), 5 );
+    for (int c = 0; c < 4; c++) {
+        for (int d = 0; d < 5; d++) {
+            int expected = 0;
+            for (int a = 0; a < 2; a++) 
+                for (int b = 0; b < 3; b++) expected += tensor_1(a, b, c) * tensor_2(b, a, d);
+            EXPECT_EQ( result(c, d), expected );
+        }
+    }
+}
+
+TEST( frnnTensor, CanContractAllDimensionsWithTensorMultiplication )
+{
+    frnn::Tensor<float, 1> tensor_1 = {300};
+    frnn::Tensor<float, 1> tensor_2 = {300};
+    
+    float expected = 0.f;
+    for (int x = 0; x < 300; x++) {
+        tensor_1[x] = 0.5f;
+        tensor_2[x] = static_cast<float>(x % 4);
+        expected   += tensor_1[x] * tensor_2[x];
+    }
+    
+    using namespace frnn::index;
+    auto result = tensor_1(i) * tensor_2(i);
+    
+    EXPECT_EQ( result.size(), 1 );
+    EXPECT_EQ( result.plan().K, 300 );
+    EXPECT_FLOAT_EQ( result[0], expected );
+}
+
+TEST( frnnStaticTensor, HasCompileTimeSizesAndStrides )
+{
+    typedef frnn::StaticTensor<float, 3, 2, 4> tensor_type;
+    
+    static_assert( tensor_type::size() == 24, "size must be constexpr" );
+    static_assert( tensor_type::size<1>() == 2, "dimension sizes must be constexpr" );
+    static_assert( tensor_type::stride<2>() == 6, "strides must be constexpr" );
+    static_assert( tensor_type::offset(2, 1, 3) == 2 + 3 * 1 + 6 * 3, "offsets must be constexpr" );
+    static_assert( frnn::tensor::StaticDimensionMapper<1, 3, 2, 4>::map(23) == 1, "mapping must be constexpr" );
+    
+    tensor_type tensor;
+    EXPECT_EQ( tensor.rank(), 3 );
+    EXPECT_EQ( tensor.size(2), 4 );
+    EXPECT_EQ( tensor.dimSizes()[0], 3 );
+}
+
+TEST( frnnStaticTensor, CanSetAndGetElementsOfStaticTensor )
+{
+    frnn::StaticTensor<int, 3, 2> tensor = {1, 2, 3, 4, 5, 6};
+    
+    EXPECT_EQ( tensor(0, 0), 1 );
+    EXPECT_EQ( tensor(2, 1), 6 );
+    
+    tensor(1, 1) = 10;
+    EXPECT_EQ( tensor[4], 10 );
+}
+
+TEST( frnnStaticTensor, CanUseStaticTensorsInExpressionsWithTensors )
+{
+    frnn::StaticTensor<int, 2, 2> static_tensor = {1, 2, 3, 4};
+    frnn::Tensor<int, 2> tensor = {2, 2};
+    for (int i = 0; i < tensor.size(); i++) tensor[i] = 10 * i;
+    
+    frnn::StaticTensor<int, 2, 2> sum  = static_tensor + tensor;
+    frnn::Tensor<int, 2> transpose     = static_tensor.slice(frnn::index::j, frnn::index::i);
+    
+    EXPECT_EQ( sum[3], 34 );
+    EXPECT_EQ( transpose(1, 0), static_tensor(0, 1) );
+    
+    using namespace frnn::index;
+    frnn::Tensor<int, 2> product = static_tensor(i, j) * tensor(j, k);
+    EXPECT_EQ( product(1, 1), static_tensor(1, 0) * tensor(0, 1) + static_tensor(1, 1) * tensor(1, 1) );
+}
+
+TEST( frnnTensor, CanEvaluateLargeExpressionsInParallel )
+{
+    frnn::Tensor<float, 2> tensor_1 = {1000, 203};
+    frnn::Tensor<float, 2> tensor_2 = {1000, 203};
+    for (int i = 0; i < tensor_1.size(); i++) {
+        tensor_1[i] = static_cast<float>(i % 97);
+        tensor_2[i] = static_cast<float>(i % 13);
+    }
+    
+    frnn::Tensor<float, 2> result = tensor_1 + tensor_2 - tensor_2 + tensor_1;
+    
+    EXPECT_EQ( result.size(), tensor_1.size() );
+    for (int i = 0; i < result.size(); i++) EXPECT_EQ( result[i], 2 * tensor_1[i] );
+}
+
+TEST( frnnTensor, CanEvaluateSlicesByContiguousRuns )
+{
+    using namespace frnn::index;
+    frnn::Tensor<int, 3> tensor = {300, 20, 30};
+    for (int x = 0; x < tensor.size(); x++) tensor[x] = x;
+    
+    frnn::Tensor<int, 2> skip_dim   = tensor.slice(i, k);
+    frnn::Tensor<int, 2> transpose  = tensor.slice(k, i);
+    
+    for (int x = 0; x < 300; x++) {
+        for (int z = 0; z < 30; z++) {
+            EXPECT_EQ( skip_dim(x, z), tensor(x, 0, z) );
+            EXPECT_EQ( transpose(z, x), tensor(x, 0, z) );
+        }
+    }
+}
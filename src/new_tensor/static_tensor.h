@@ -0,0 +1,262 @@
+// ==========================================================================================================
+//! @file   Header file for fastRNN static (compile time shape) tensor class.
+// ==========================================================================================================
+
+/*
+ * ==========================================================================================================
+ *  Copyright (C) 2015 Rob Clucas robclu1818@gmail.com
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published
+ *  by the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program; if not, write to the Free Software Foundation,
+ *  Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ * ==========================================================================================================
+ */
+
+
+#ifndef _FRNN_STATIC_TENSOR_
+#define _FRNN_STATIC_TENSOR_
+
+#include "tensor_expressions.h"
+#include "tensor_evaluation.h"
+#include "tensor_exceptions.h"
+#include "tensor_utils.h"
+#include "../containers/tuple.h"
+
+#include <iostream>
+#include <initializer_list>
+#include <type_traits>
+
+namespace frnn {
+
+// ==========================================================================================================
+//! @class  StaticTensor 
+//! @brief  A Tensor whose dimension sizes are template parameters, so that the sizes, the strides and the 
+//!         offset calculations are all done at compile time, and loops over the elements have a constant
+//!         trip count (which the compiler can unroll and vectorize).                                        \n
+//!                                                                                                          \n
+//!         The layout is the same as for Tensor (the first dimension is contiguous) and it is a             \n
+//!         TensorExpression, so StaticTensors and Tensors can be used in the same expressions:              \n
+//!                                                                                                          \n
+//!         StaticTensor<float, 3, 2> tensor;                   // A 3x2 (rank 2) StaticTensor               \n
+//!         Tensor<float, 2> new_tensor = tensor + tensor       // Add StaticTensors                         \n
+//!         float element = tensor(2, 1)                        // Offset computed at compile time           \n
+//!                                                                                                          \n
+//!         Use this for Tensors with sizes which are known at compile time, such as the weights of a layer  
+//!         (which has the nodes, inputs and depth as template parameters).
+//! @tparam T       Type of data used by the StaticTensor.
+//! @tparam Dims    Sizes of each of the dimensions of the StaticTensor (the rank is the number of sizes).
+// ==========================================================================================================
+template <typename T, size_t... Dims>
+class StaticTensor : public TensorExpression<T, StaticTensor<T, Dims...>> {
+public:
+    /* =========================================== Typedefs =============================================== */
+    using typename TensorExpression<T, StaticTensor<T, Dims...>>::container_type;
+    using typename TensorExpression<T, StaticTensor<T, Dims...>>::size_type;
+    using typename TensorExpression<T, StaticTensor<T, Dims...>>::value_type;
+    using typename TensorExpression<T, StaticTensor<T, Dims...>>::reference;
+    /* ==================================================================================================== */
+    static constexpr size_type R = sizeof...(Dims);                         //!< Rank of the StaticTensor
+    static constexpr size_type N = tensor::StaticProduct<Dims...>::value;   //!< Number of elements
+private:
+    container_type  _data;                                  //!< Container to hold StaticTensor data elements
+public:
+    // =====================================================================================================
+    //! @brief     Default constructor - sets all the elements to 0.
+    // =====================================================================================================
+    StaticTensor() : _data(N, 0) {}
+    
+    // =====================================================================================================
+    //! @brief     Constructor using an initializer list - sets the elements of the StaticTensor to the 
+    //!            values in the list (in memory order), any elements not in the list are set to 0.
+    //! @param[in] data    The list of values for the elements.
+    // =====================================================================================================
+    StaticTensor(std::initializer_list<T> data) : _data(data) 
+    {
+        ASSERT(data.size(), <=, N);
+        _data.resize(N, 0);
+    }
+    
+    // =====================================================================================================
+    //! @brief     Constructor using a TensorExpression - sets the data of the StaticTensor to the data of 
+    //!            the TensorExpression, which must have the same dimension sizes.
+    //! @param[in] expression  The expression which must be used to construct the StaticTensor.
+    //! @tparam    E           The type of the expression.
+    // =====================================================================================================
+    template <typename E>
+    StaticTensor(TensorExpression<T,E> const& expression) : _data(N) 
+    {
+        E const& expr = expression;
+        ASSERT(expr.size(), ==, N);
+        if (expr.size() == N) tensor::evaluate(expr, &_data[0]);
+    }
+    
+    // =====================================================================================================
+    //! @brief     Gets the size (total number of elements) of the StaticTensor.
+    //! @return    The total number of elements in the StaticTensor.
+    // =====================================================================================================
+    static constexpr size_type size() { return N; }
+    
+    // =====================================================================================================
+    //! @brief     Gets the size of a specific dimension of the StaticTensor at compile time.
+    //! @return    The number of elements in dimension d.
+    //! @tparam    d   The dimension for which the size must be returned.
+    // =====================================================================================================
+    template <size_type d>
+    static constexpr size_type size() { return tensor::StaticDimSize<d, Dims...>::value; }
+
+    // =====================================================================================================
+    //! @brief     Gets the size of a specific dimension of the StaticTensor, if the requested dimension is 
+    //!            invalid then 0 is returned. Prefer size<d>() when the dimension is known at compile time.
+    //! @param[in] dim                 The dimension for which the size must be returned.
+    //! @return    The number of elements in the requested dimension, if the dimension is a valid dimension
+    //!            for the StaticTensor, otherwise 0 is returned.
+    //! @throw     TesnorOutOfRange    Throws an error if the requested dimension is invalid.
+    // =====================================================================================================
+    size_type size(const int dim) const 
+    {
+        try {
+            if (dim >= R) throw TensorOutOfRange(dim, R);
+            return dimSizes()[dim];
+        } catch (TensorOutOfRange& e) {
+            std::cout << e.what() << std::endl;
+            return 0;
+        }
+    }
+    
+    // =====================================================================================================
+    //! @brief     Gets the stride (in memory) of a specific dimension of the StaticTensor at compile time.
+    //! @return    The stride of dimension d.
+    //! @tparam    d   The dimension for which the stride must be returned.
+    // =====================================================================================================
+    template <size_type d>
+    static constexpr size_type stride() { return tensor::StaticStride<d, Dims...>::value; }
+    
+    // =====================================================================================================
+    //! @brief     Gets the rank (number of dimensions) of the StaticTensor.
+    //! @return    The rank (number of dimensions) of the StaticTensor.
+    // =====================================================================================================
+    static constexpr size_type rank() { return R; }
+    
+    // ======================================================================================================
+    //! @brief      Gets a vector holding the size of each dimension of the StaticTensor, so that it can be 
+    //!             used in expressions with Tensors. The vector is shared by all StaticTensors of the type.
+    //! @return     A vector holding the size of each dimension of the StaticTensor.
+    // ======================================================================================================
+    static const std::vector<size_type>& dimSizes() 
+    { 
+        static const std::vector<size_type> dim_sizes = {Dims...};
+        return dim_sizes;
+    }
+    
+    // ======================================================================================================
+    //! @brief      Gets the StaticTensor data.
+    //! @return     The data for the StaticTensor.
+    // ======================================================================================================
+    const container_type& data() const { return _data; }
+    
+    // ======================================================================================================
+    //! @brief      Gets the element at position i in the StaticTensor's data vector, by reference.
+    //! @param[in]  i   The index of the element to access.
+    //! @return     The element at position i in the StaticTensor's data vecor.
+    // ======================================================================================================
+    reference operator[](size_type i) { return _data[i]; }
+    
+    // ======================================================================================================
+    //! @brief      Gets the element at position i in the StaticTensor's data vector, by value.
+    //! @param[in]  i   The index of the element to access.
+    //! @return     The element at position i in the StaticTensor's data vector.
+    // ======================================================================================================
+    value_type operator[](size_type i) const { return _data[i]; }
+    
+    // ======================================================================================================
+    //! @brief      Gets the offset in memory of an element from its index in each dimension. This is 
+    //!             constexpr, so with constant indices the offset is a constant.
+    //! @param[in]  indices     The index of the element in each dimension.
+    //! @return     The offset of the element in the StaticTensor's data vector.
+    //! @tparam     Is          The types of the indices.
+    // ======================================================================================================
+    template <typename... Is>
+    static constexpr size_type offset(Is... indices) 
+    {
+        static_assert(sizeof...(Is) == R, "StaticTensor offset needs one index for each dimension");
+        return tensor::StaticOffset<Dims...>::offset(indices...);
+    }
+    
+    // ======================================================================================================
+    //! @brief      Returns a TensorSlice which is a remapping of the dimensions of this StaticTensor.
+    //! @param[in]  dims    The dimensions of the StaticTensor which will make the sliced Tensor.
+    //! @return     A TensorSlice which is a remapping of this StaticTensor's dimensions.
+    //! @tparam     Ts      The types of the dimension variables.
+    // ======================================================================================================
+    template <typename... Ts>
+    TensorSlice<T, StaticTensor<T, Dims...>, Ts...> slice(Ts... dims) const 
+    {
+        return TensorSlice<T, StaticTensor<T, Dims...>, Ts...>(*this, Tuple<Ts...>(dims...));
+    }
+    
+    // ======================================================================================================
+    //! @brief      Returns a TensorMultiplier which can then be used with the overloaded multiplication     
+    //!             operator to multiply two StaticTensors (or a StaticTensor and a Tensor).
+    //! @param[in]  dims    The dimensions of the StaticTensor which must be multiplied.
+    //! @return     A TensorMultiplier which stores the dimensions to multiply over.
+    //! @tparam     I       The type of the first dimension variable.
+    //! @tparam     Is      The types of the rest of the dimension variables.
+    // ======================================================================================================
+    template <typename I, typename... Is>
+    typename std::enable_if<!std::is_arithmetic<I>::value, TensorMultiplier<T, StaticTensor<T, Dims...>, I>>::type
+    operator()(I dim, Is... dims) const
+    {
+        return TensorMultiplier<T, StaticTensor<T, Dims...>, I>(*this, dim, dims...);
+    }
+    
+    // ======================================================================================================
+    //! @brief      Gets an element of the StaticTensor from its index in each dimension, by reference. 
+    //!             There are no checks that the indices are in range.
+    //! @param[in]  idx     The index of the element in the first dimension.
+    //! @param[in]  indices The indices of the element in the remaining dimensions.
+    //! @return     The element at the location specified by the arguments to the function.
+    //! @tparam     I       The type of the idx parameter.
+    //! @tparam     Is      The types of the remaining index parameters.
+    // ======================================================================================================
+    template <typename I, typename... Is>
+    typename std::enable_if<std::is_arithmetic<I>::value, T&>::type operator()(I idx, Is... indices) 
+    {
+        return _data[offset(idx, indices...)];
+    }
+    
+    // ======================================================================================================
+    //! @brief      Gets an element of the StaticTensor from its index in each dimension, by value.
+    //!             There are no checks that the indices are in range.
+    //! @param[in]  idx     The index of the element in the first dimension.
+    //! @param[in]  indices The indices of the element in the remaining dimensions.
+    //! @return     The element at the location specified by the arguments to the function.
+    //! @tparam     I       The type of the idx parameter.
+    //! @tparam     Is      The types of the remaining index parameters.
+    // ======================================================================================================
+    template <typename I, typename... Is>
+    typename std::enable_if<std::is_arithmetic<I>::value, const T&>::type operator()(I idx, Is... indices) const
+    {
+        return _data[offset(idx, indices...)];
+    }
+};
+
+// Definitions of the static members (for when they are odr-used, e.g bound to a const reference)
+template <typename T, size_t... Dims>
+constexpr typename StaticTensor<T, Dims...>::size_type StaticTensor<T, Dims...>::R;
+
+template <typename T, size_t... Dims>
+constexpr typename StaticTensor<T, Dims...>::size_type StaticTensor<T, Dims...>::N;
+
+}   // End namespace frnn
+
+#endif
@@ -26,6 +26,7 @@
 #define _FRNN_NEW_TENSOR_
 
 #include "tensor_expressions.h"
+#include "tensor_evaluation.h"
 #include "tensor_exceptions.h"
 #include "../containers/tuple.h"
 
@@ -98,7 +99,7 @@ public:
     // =====================================================================================================
     //! @brief     Constructor using a TensorExpression - sets the data of the Tensor to the data of the
     //!            TensorExpression so that Tensors can be created from the ouputs of operations such as 
-    //!            addition and subtraction.
+    //!            addition and subtraction. The expression is evaluated with tensor::evaluate.
     //! @param[in] expression  The expression which must be used to construct the Tensor.
     //! @tparam    E           The type of the expression.
     // =====================================================================================================
@@ -108,9 +109,7 @@ public:
     {
         E const& expr = expression;
         _data.resize(expr.size());
-        for (size_type i = 0; i != expr.size(); ++i) {
-            _data[i] = expr[i];
-        }
+        if (!_data.empty()) tensor::evaluate(expr, &_data[0]);     // Parallel and vectorized where possible
     }
    
     // =====================================================================================================
@@ -0,0 +1,154 @@
+// ==========================================================================================================
+//! @file   Header file for fastRNN tensor expression evaluation.
+// ==========================================================================================================
+
+/*
+ * ==========================================================================================================
+ *  Copyright (C) 2015 Rob Clucas robclu1818@gmail.com
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published
+ *  by the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program; if not, write to the Free Software Foundation,
+ *  Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ * ==========================================================================================================
+ */ 
+
+
+#ifndef _FRNN_TENSOR_EVALUATION_
+#define _FRNN_TENSOR_EVALUATION_
+
+#include "tensor_expressions.h"
+
+#include <type_traits>
+
+namespace frnn {
+namespace tensor {
+
+// ==========================================================================================================
+//! @brief      Minimum number of elements for which the evaluation of an expression is split across OpenMP
+//!             threads, for fewer elements starting the threads costs more than the evaluation.
+// ==========================================================================================================
+constexpr long PARALLEL_MIN_ELEMENTS = 1 << 15;
+
+// ==========================================================================================================
+//! @struct     SimdWidth 
+//! @brief      Number of elements of type T which fit in a (256 bit) vector register, which is the size of the 
+//!             chunks that contiguous expressions are evaluated in.
+//! @tparam     T   The type of data used by the expression.
+// ==========================================================================================================
+template <typename T> struct SimdWidth {
+    static constexpr long value = (32 / sizeof(T)) > 0 ? (32 / sizeof(T)) : 1;
+};
+
+// ==========================================================================================================
+//! @struct     EvaluationTraits 
+//! @brief      Determines if element i of an expression only depends on element i of the data of the 
+//!             expression's leaves (the expression is contiguous), in which case the expression can be 
+//!             evaluated with vector loads. Tensors (and anything which stores its result) are contiguous.
+//! @tparam     E   The type of the expression.
+// ==========================================================================================================
+template <typename E> struct EvaluationTraits {
+    static constexpr bool contiguous = true;
+};
+
+// A slice reorders the elements of the expression being sliced
+template <typename T, typename E, typename... Ts> struct EvaluationTraits<TensorSlice<T, E, Ts...>> {
+    static constexpr bool contiguous = false;
+};
+
+// Elementwise operations are contiguous if both of their operands are
+template <typename T, typename E1, typename E2> struct EvaluationTraits<TensorAddition<T, E1, E2>> {
+    static constexpr bool contiguous = EvaluationTraits<E1>::contiguous && EvaluationTraits<E2>::contiguous;
+};
+
+template <typename T, typename E1, typename E2> struct EvaluationTraits<TensorDifference<T, E1, E2>> {
+    static constexpr bool contiguous = EvaluationTraits<E1>::contiguous && EvaluationTraits<E2>::contiguous;
+};
+
+template <typename T, typename E, typename I> struct EvaluationTraits<TensorMultiplier<T, E, I>> {
+    static constexpr bool contiguous = EvaluationTraits<E>::contiguous;
+};
+
+// ==========================================================================================================
+//! @brief      Evaluates a contiguous expression into out. The elements are evaluated in chunks of the SIMD
+//!             width (so that the loop over a chunk is vectorized), with the chunks split across OpenMP 
+//!             threads for big expressions. The elements after the last full chunk are evaluated one at a 
+//!             time.
+//! @param[in]  expr    The expression to evaluate.
+//! @param[out] out     The data to evaluate the expression into, which must hold expr.size() elements.
+//! @tparam     T       The type of data used by the expression.
+//! @tparam     E       The type of the expression.
+// ==========================================================================================================
+template <typename T, typename E>
+typename std::enable_if<EvaluationTraits<E>::contiguous, void>::type evaluate(E const& expr, T* out)
+{
+    const long N      = static_cast<long>(expr.size());
+    const long W      = SimdWidth<T>::value;
+    const long chunks = N / W;
+    
+    #pragma omp parallel for schedule(static) if (N >= PARALLEL_MIN_ELEMENTS)
+    for (long chunk = 0; chunk < chunks; ++chunk) {
+        const long start = chunk * W;
+        #pragma omp simd
+        for (long i = start; i < start + W; ++i) out[i] = expr[i];
+    }
+    for (long i = chunks * W; i < N; ++i) out[i] = expr[i];             // Tail which is not a full chunk
+}
+
+// ==========================================================================================================
+//! @brief      Evaluates an expression which is not contiguous (it has a slice in an operand) into out, one 
+//!             element at a time, with the elements split across OpenMP threads for big expressions.
+//! @param[in]  expr    The expression to evaluate.
+//! @param[out] out     The data to evaluate the expression into, which must hold expr.size() elements.
+//! @tparam     T       The type of data used by the expression.
+//! @tparam     E       The type of the expression.
+// ==========================================================================================================
+template <typename T, typename E>
+typename std::enable_if<!EvaluationTraits<E>::contiguous, void>::type evaluate(E const& expr, T* out)
+{
+    const long N = static_cast<long>(expr.size());
+    
+    #pragma omp parallel for schedule(static) if (N >= PARALLEL_MIN_ELEMENTS)
+    for (long i = 0; i < N; ++i) out[i] = expr[i];
+}
+
+// ==========================================================================================================
+//! @brief      Evaluates a slice into out, a contiguous run at a time. The elements of a run are next to each 
+//!             other in the expression which is sliced, so each run is a vectorizable copy (for a transpose
+//!             the runs have length 1, which is evaluation one element at a time).
+//! @param[in]  slice   The slice to evaluate.
+//! @param[out] out     The data to evaluate the slice into, which must hold slice.size() elements.
+//! @tparam     T       The type of data used by the slice.
+//! @tparam     E       The type of the expression which is sliced.
+//! @tparam     Ts      The types of the variables used to represent the dimensions of the slice.
+// ==========================================================================================================
+template <typename T, typename E, typename... Ts>
+void evaluate(TensorSlice<T, E, Ts...> const& slice, T* out)
+{
+    const long  N    = static_cast<long>(slice.size());
+    const long  run  = static_cast<long>(slice.contiguousRun());
+    const long  runs = N / run;
+    E const&    x    = slice.expression();
+    
+    #pragma omp parallel for schedule(static) if (N >= PARALLEL_MIN_ELEMENTS)
+    for (long r = 0; r < runs; ++r) {
+        const long start = r * run;
+        const long base  = static_cast<long>(slice.offset(start));
+        #pragma omp simd
+        for (long i = 0; i < run; ++i) out[start + i] = x[base + i];
+    }
+}
+
+}       // End namespace tensor
+}       // End namespace frnn
+
+#endif
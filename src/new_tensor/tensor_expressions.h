@@ -26,11 +26,12 @@
 #define _FRNN_TENSOR_EXPRESSIONS_
 
 #include "tensor_utils.h"
+#include "tensor_gemm.h"
 #include "../containers/tuple.h"
 #include "../containers/index_map.h"
 #include "../util/errors.h"
 
-#include <set>
+#include <numeric>
 
 namespace frnn {
 
@@ -266,7 +267,13 @@ public:
 
 // ==========================================================================================================
 //! @class      TensorMultiplication    
-//! @brief      Expression class which multiplies 2 TensorExpressions.
+//! @brief      Expression class which multiplies (contracts) 2 TensorExpressions.                           \n
+//!                                                                                                          \n
+//!             The contraction is done when the expression is created: a ContractionPlan is built from the  \n
+//!             dimensions to reduce and not reduce, both operands are packed into matrices as per the plan  \n
+//!             and then multiplied with a single GEMM, so the result is stored by the expression. Doing     \n
+//!             the contraction for each element would cost O(K) per element, and would read the operands   \n
+//!             in an order which does not use the cache.
 //! @tparam     T   The data type used by the Expressions.
 //! @tparam     E1  The first expression to multiply.
 //! @tparam     E2  The second expression to multiply.
@@ -280,25 +287,33 @@ public:
     using typename TensorExpression<T, TensorMultiplication<T, E1, E2>>::value_type;
     /* ==================================================================================================== */ 
 private:
-    E1&                                 _x;                 //!< Left side expression to multiple
-    E2&                                 _y;                 //!< Right side expression to multiply
-    std::unordered_map<size_t, size_t>  _reduce_dims;       //!< Dimensions of expressions to be reduced
-    std::set<size_t>                    _nreduce_dims_x;    //!< Dimensions of x not to be reduced
-    std::set<size_t>                    _nreduce_dims_y;    //!< Dimensions of y not to be reduced
+    tensor::DimensionList               _reduce_dims_x;     //!< Dimensions of x to be reduced
+    tensor::DimensionList               _reduce_dims_y;     //!< Matching dimensions of y to be reduced
+    tensor::DimensionList               _nreduce_dims_x;    //!< Dimensions of x not to be reduced
+    tensor::DimensionList               _nreduce_dims_y;    //!< Dimensions of y not to be reduced
     std::vector<size_type>              _dim_sizes;         //!< Sizes of the dimensions of the result
+    tensor::ContractionPlan             _plan;              //!< How x and y are reshaped into a GEMM
+    container_type                      _result;            //!< Result of the contraction
 public:
     // ======================================================================================================
-    //! @brief      Sets the expressions and created the maps of dimensions to reduce and to not reduce.
-    //! @param[in]  x   The first (left) expression for multiplication. (Not const as it is intended to be a 
-    //!             temporary expression).
-    //! @param[in]  y   The second (right) epression for multiplication. (Not const as it is intended to be a
-    //!             temporary expression).
+    //! @brief      Creates the lists of dimensions to reduce and to not reduce, builds the plan for the 
+    //!             contraction and then does the contraction. The expressions are only used by the 
+    //!             constructor, so they can be temporaries.
+    //! @param[in]  x   The first (left) expression for multiplication.
+    //! @param[in]  y   The second (right) epression for multiplication.
     // ======================================================================================================
-    TensorMultiplication(TensorExpression<T, E1>& x, TensorExpression<T, E2>& y)
-    : _x(x), _y(y), _dim_sizes(0)
+    TensorMultiplication(TensorExpression<T, E1> const& x, TensorExpression<T, E2> const& y)
+    : _dim_sizes(0)
     {
-        buildDimensions();
-        setDimSizes();
+        E1 const& x_expr = x;
+        E2 const& y_expr = y;
+        buildDimensions(x_expr, y_expr);
+        setDimSizes(x_expr, y_expr);
+        _result.resize(std::accumulate(_dim_sizes.begin()           ,
+                                       _dim_sizes.end()             ,
+                                       1                            ,
+                                       std::multiplies<size_type>() ), 0);
+        if (buildPlan(x_expr, y_expr)) contract(x_expr, y_expr);
     }
         
     // ======================================================================================================
@@ -307,24 +322,29 @@ public:
     // ======================================================================================================
     const std::vector<size_type>& dimSizes() const { return _dim_sizes; }
     
-    // CHANGE
     // ======================================================================================================
     //! @brief     Returns the size of the expression.
-    //! @return    The size of the TensorMultiplier.
+    //! @return    The size of the TensorMultiplication (the product of the non-reduced dimension sizes).
     // ====================================================================================================== 
-    size_type size() const { return _x.size(); }
+    size_type size() const { return _result.size(); }
     
-    // CHANGE
     // ======================================================================================================
-    //! @brief     Multiplies two elements (one from each Tensor) from the Tensor expression data.
+    //! @brief     Gets an element of the result of the contraction.
     //! @param[in] i   The element in the expression which must be fetched.
-    //! @return    The result of the multiplication of the Tensors.
+    //! @return    The element at position i of the result of the multiplication.
     // ======================================================================================================
-    value_type operator[](size_type i) const { return _x[i]; }
+    value_type operator[](size_type i) const { return _result[i]; }
     
     // ======================================================================================================
-    //! @brief      Creates a unordered_map of common dimensions which must be reduced or contracted (see    \n
-    //!             Tensor contraction), and two sets of dimensions which must not be - one for each of the  \n
+    //! @brief     Gets the plan which was used for the contraction.
+    //! @return    A constant reference to the contraction plan.
+    // ======================================================================================================
+    const tensor::ContractionPlan& plan() const { return _plan; }
+    
+private:
+    // ======================================================================================================
+    //! @brief      Creates a list of common dimensions which must be reduced or contracted (see             \n
+    //!             Tensor contraction), and two lists of dimensions which must not be - one for each of the  \n
     //!             expressions to multiply. For example, if there are two tensors, say x and y, and they    \n
     //!             are being multiplied to make a Tensor z, then as per Tensor multiplication when using    \n
     //!             Einstein summation convention, the result is:                                            \n
@@ -334,58 +354,117 @@ public:
     //!             Since j and i are common to both, they are reduced dimensions, while k, l and m are not  \n
     //!             reduced. To perform the multiplication, the reduced and non-reduced dimensions and their \n
     //!             indices in the subscript notation need to be known, thus the function builds the         \n
-    //!             following maps:                                                                          \n
+    //!             following lists (which are fixed size, and are in the order of the subscripts of x):    \n
     //!                                                                                                      \n
-    //!             reduced = [{key, value}...]         , key = index in 1st expression to multiply (x)
-    //!                                                 , value = index in 2nd expression to multiply (y)    \n
+    //!             reduced_x = [value, ...]            , value = index in 1st expression to multiply (x)    \n
+    //!             reduced_y = [value, ...]            , value = index of the same dimension in y           \n
     //!                                                                                                      \n
     //!             nreduced_x = [value, ...]           , value = index in 1st expression to multiply (x)    \n
     //!             nreduced_y = [value, ...]           , value = index in 2st expression to multiply (y)    \n
     //!                                                                                                      \n
-    //!             Thus for the example above the maps would be built as:                                   \n
+    //!             Thus for the example above the lists would be built as:                                  \n
     //!                                                                                                      \n
-    //!             reduced = [ {0, 1}, {1, 0} ]                                                             \n
+    //!             reduced_x = [ 0, 1 ]                                                                     \n
+    //!             reduced_y = [ 1, 0 ]                                                                     \n
     //!             nreduced_x = [ 2 ]                                                                       \n
     //!             nreduced_y = [ 2, 3 ]
+    //! @param[in]  x   The first (left) expression for multiplication.
+    //! @param[in]  y   The second (right) epression for multiplication.
     // ======================================================================================================
-    void buildDimensions() 
+    void buildDimensions(E1 const& x, E2 const& y) 
     {
-        for (auto& dim_x : _x.multDims()) {                                     // Search all x dims
-            auto dim_y = _y.multDims().find(dim_x.first());                     // Check is dim_x is in y dims
-            if (dim_y != _y.multDims().end()) { 
+        for (auto& dim_x : x.multDims()) {                                      // Search all x dims
+            auto dim_y = y.multDims().find(dim_x.first());                      // Check is dim_x is in y dims
+            if (dim_y != y.multDims().end()) { 
                 // Insert the dimension using the index of the element in
                 // x's subscript list(see above) as the key and the index 
                 // of the element in y's subscript list as the value
-                _reduce_dims.emplace(dim_x.second, dim_y->second);
-                _y.multDims().erase(dim_y);                                     // Remove found element
+                _reduce_dims_x.push_back(dim_x.second);
+                _reduce_dims_y.push_back(dim_y->second);
             } else {
                 // Insert the dimension in the set of dimensions not 
                 // to reduce for x, the value inserted is the index of
                 // the dimension in x's subscript list
-                _nreduce_dims_x.insert(dim_x.second);
+                _nreduce_dims_x.push_back(dim_x.second);
             }
         }
-        for (auto& dim_y : _y.multDims()) {
+        for (auto& dim_y : y.multDims()) {
             // Insert the dimension in the set of dimensions not 
-            // to reduce for y, the value inserted is the index of
-            // the dimension in y's subscript list
-            _nreduce_dims_y.insert(dim_y.second);                              
+            // to reduce for y, if it is not a dimension of x, the 
+            // value inserted is the index of the dimension in y's 
+            // subscript list
+            if (x.multDims().find(dim_y.first()) == x.multDims().end()) _nreduce_dims_y.push_back(dim_y.second);
+        }
+    }
+    
+    // ======================================================================================================
+    //! @brief      Sets the sizes of the dimensions of the result of the multiplication.
+    //! @param[in]  x   The first (left) expression for multiplication.
+    //! @param[in]  y   The second (right) epression for multiplication.
+    // ======================================================================================================
+    void setDimSizes(E1 const& x, E2 const& y) 
+    {
+        for (auto& dim : _nreduce_dims_x) _dim_sizes.push_back(x.dimSizes()[dim]);
+        for (auto& dim : _nreduce_dims_y) _dim_sizes.push_back(y.dimSizes()[dim]);
+    }
+    
+    // ======================================================================================================
+    //! @brief      Builds the plan for the contraction (see ContractionPlan). The non-reduced dimensions of 
+    //!             each expression keep their order, and the reduced dimensions are ordered as in x.
+    //! @param[in]  x   The first (left) expression for multiplication.
+    //! @param[in]  y   The second (right) epression for multiplication.
+    //! @return     True if the reduced dimensions of x and y have the same sizes, otherwise false (and the 
+    //!             result is left as zeros).
+    // ======================================================================================================
+    bool buildPlan(E1 const& x, E2 const& y)
+    {
+        for (size_t d = 0; d < _reduce_dims_x.size(); ++d) {                    // Check reduced dim sizes
+            ASSERT(x.dimSizes()[_reduce_dims_x[d]], ==, y.dimSizes()[_reduce_dims_y[d]]);
+            if (x.dimSizes()[_reduce_dims_x[d]] != y.dimSizes()[_reduce_dims_y[d]]) return false;
+        }
+        if (x.dimSizes().size() > INDEX_MAP_CAPACITY || y.dimSizes().size() > INDEX_MAP_CAPACITY) return false;
+        
+        for (auto& dim : _nreduce_dims_x) {                                     // Rows of A
+            _plan.x_strides[dim] = _plan.M;
+            _plan.M             *= x.dimSizes()[dim];
+        }
+        for (size_t d = 0; d < _reduce_dims_x.size(); ++d) {                    // Columns of A, rows of B
+            _plan.x_strides[_reduce_dims_x[d]] = _plan.M * _plan.K;
+            _plan.y_strides[_reduce_dims_y[d]] = _plan.K;
+            _plan.K                           *= x.dimSizes()[_reduce_dims_x[d]];
         }
+        for (auto& dim : _nreduce_dims_y) {                                     // Columns of B
+            _plan.y_strides[dim] = _plan.K * _plan.N;
+            _plan.N             *= y.dimSizes()[dim];
+        }
+        return true;
     }
     
     // ======================================================================================================
-    //! @brief      Sets the sizes of the dimensions of the result of the multiplication
+    //! @brief      Packs x and y into matrices as per the plan, and multiplies them into the result.
+    //! @param[in]  x   The first (left) expression for multiplication.
+    //! @param[in]  y   The second (right) epression for multiplication.
     // ======================================================================================================
-    void setDimSizes() 
+    void contract(E1 const& x, E2 const& y)
     {
-        for (auto& dim : _nreduce_dims_x) _dim_sizes.push_back(_x.dimSizes()[dim]);
-        for (auto& dim : _nreduce_dims_y) _dim_sizes.push_back(_y.dimSizes()[dim]);
+        container_type a(_plan.M * _plan.K), b(_plan.K * _plan.N);
+        if (a.empty() || b.empty()) return;
+        
+        tensor::packOperand(x, _plan.x_strides, &a[0]);
+        tensor::packOperand(y, _plan.y_strides, &b[0]);
+        tensor::gemm(_plan.M, _plan.N, _plan.K, &a[0], &b[0], &_result[0]);
     }
 };
 
 // ==========================================================================================================
 //! @class      TensorSlice
-//! @brief      Expression class used to slice a TensorExpression by dimension.
+//! @brief      Expression class used to slice a TensorExpression by dimension.                              \n
+//!                                                                                                          \n
+//!             The slice is a strided view of the expression: when the slice is created the stride (in the  \n
+//!             expression being sliced) of each dimension of the slice is determined, so the offset of an   \n
+//!             element is the dot product of its multi-index in the slice with the strides. The number of  \n
+//!             elements which are next to each other in both the slice and the expression (the contiguous  \n
+//!             run) is also determined, so that callers can copy whole runs at a time.
 //! @tparam     T   The type of data used by the tensor.
 //! @tparam     E   The expression to slice.
 //! @tparam     Ts  The types of the variables used to represent the dimensions to slice.
@@ -399,28 +478,29 @@ public:
     using typename TensorExpression<T, TensorSlice<T,E,Ts...>>::value_type;
     /* ==================================================================================================== */ 
 private:
-    // Note : These are mutable because this class is essentially a functor without state an is intended to 
-    //        be used as a functor once. The mutable memebers are really just temporary variables which hold
-    //        state during the dimension mapping computations, thus it is okay to modify them. However, the 
-    //        function which modifies them need to be const to access _x, hence they are mutable.
     E const&                        _x;                 //!< Expression to slice
-    mutable Tuple<Ts...>            _slice_dims;        //!< Dimensions of the sliced Expression
-    mutable std::vector<size_type>  _prev_slice_dims;   //!< Dimensions used for iterative index mapping
-    mutable std::vector<size_type>  _slice_dim_sizes;   //!< Sizes of the dimensions for the sliced Expression
-    mutable size_type               _index;             //!< Mapped index from the slice to the Expression
-    mutable size_type               _offset;            //!< Offset in the Expression due to its 0 dimension
+    std::vector<size_type>          _slice_dim_sizes;   //!< Sizes of the dimensions for the sliced Expression
+    std::vector<size_type>          _strides;           //!< Stride in the Expression of each slice dimension
     size_type                       _slice_size;        //!< Size (number of elements) of the slice
+    size_type                       _run_length;        //!< Number of elements in each contiguous run
 public:        
      // =====================================================================================================
-     //! @brief     Initializes member variables, builds vector of dimensions of the Expression to slice, and 
-     //!            determines the size of the slice.
+     //! @brief     Builds the sizes and strides of the dimensions of the slice, and determines the size of 
+     //!            the slice and the length of its contiguous runs.
      //! @param[in] x           The Expression to slice.
      //! @param[in] slice_dims  The dimension of Expression which make up the slice.
      // =====================================================================================================
     TensorSlice(TensorExpression<T, E> const& x, Tuple<Ts...> slice_dims)
-    : _x(x), _index(0), _offset(0), _prev_slice_dims(0), 
-      _slice_size(buildSliceDimSizes()), _slice_dims(slice_dims) 
-    {}
+    : _x(x), _slice_size(1), _run_length(1)
+    {
+        buildDescriptor(slice_dims);
+        for (size_type dim = 0; dim < _strides.size(); ++dim) {
+            _slice_size *= _slice_dim_sizes[dim];
+        }
+        for (size_type dim = 0; dim < _strides.size() && _strides[dim] == _run_length; ++dim) {
+            _run_length *= _slice_dim_sizes[dim];                   // Merge dims which follow on in memory 
+        }
+    }
   
     // ======================================================================================================
     //! @brief     Returns the size of the expression
@@ -434,98 +514,93 @@ public:
     // ======================================================================================================
     const std::vector<size_type>& dimSizes() const { return _slice_dim_sizes; }
 
+    // ======================================================================================================
+    //! @brief      Returns the stride (in the Expression being sliced) of each of the dimensions of the slice.
+    //! @return     A constant reference to the stride vector of the slice.
+    // ======================================================================================================
+    const std::vector<size_type>& strides() const { return _strides; }
+    
+    // ======================================================================================================
+    //! @brief      Gets the number of elements of the slice, starting from an element whose index is a 
+    //!             multiple of the run length, which are contiguous in the Expression being sliced. For a 
+    //!             slice which does not reorder the first dimension this is at least the first dimension's 
+    //!             size, for a transpose it is 1.
+    //! @return     The length of the contiguous runs of the slice.
+    // ======================================================================================================
+    size_type contiguousRun() const { return _run_length; }
+    
+    // ======================================================================================================
+    //! @brief      Gets the Expression which is being sliced, so that contiguous runs can be read from it.
+    //! @return     A constant reference to the Expression being sliced.
+    // ======================================================================================================
+    E const& expression() const { return _x; }
+    
+    // ======================================================================================================
+    //! @brief      Maps the index of an element in the slice to the index of the element in the Expression 
+    //!             being sliced, by splitting the index into a multi-index (one index for each dimension of 
+    //!             the slice) and taking the dot product with the strides. The slice has every element of
+    //!             the dimensions which it is made up of, and the first element of the others, so the first
+    //!             element of the slice is the first element of the Expression.
+    //! @param[in]  i   The index of the element in the slice.
+    //! @return     The index of the element in the Expression being sliced.
+    // ======================================================================================================
+    size_type offset(size_type i) const 
+    {
+        size_type offset = 0;
+        for (size_type dim = 0; dim < _strides.size(); ++dim) {
+            offset += (i % _slice_dim_sizes[dim]) * _strides[dim];
+            i      /= _slice_dim_sizes[dim];
+        }
+        return offset;
+    }
+    
     // ======================================================================================================
     //! @brief     Gets an element from the Expression data which should be in position i of the slice's data.
     //! @param[in] i   The element in the expression which must be fetched.
     //! @return    The value of the element at position i of the expression data.
     // ======================================================================================================
-    value_type operator[](size_type i) const { return _x[mapIndex(i)]; }
+    value_type operator[](size_type i) const { return _x[offset(i)]; }
     
 private:
     // =====================================================================================================
-    //! @brief     Adds the size of a dimension from the Expression to the slice dimension sizes vector so 
-    //!            that all dimension sizes of the slice are known. Case for all iterations but the last.
+    //! @brief     Adds the size and the stride of a dimension from the Expression to the slice's vectors of 
+    //!            sizes and strides. Case for all iterations but the last.
+    //! @param[in] slice_dims  The dimension of Expression which make up the slice.
     //! @tparam    i   The iteration of the function.
     // =====================================================================================================
     template <size_type i = 0>
-    typename std::enable_if<i != (sizeof...(Ts) - 1), size_type>::type buildSliceDimSizes() const
+    typename std::enable_if<i != (sizeof...(Ts) - 1), void>::type 
+    buildDescriptor(const Tuple<Ts...>& slice_dims) 
     {
-        _slice_dim_sizes.push_back(_x.size(get<i>(_slice_dims)()));                 // Add dimension i's size
-        return ( _x.size(get<i>(_slice_dims)()) *                   // Get size of dim i from the Expression
-                 buildSliceDimSizes<i + 1>()    );                  // Multiply with the remaining dimensions
+        addDimension(get<i>(slice_dims)());
+        buildDescriptor<i + 1>(slice_dims);
     }
 
     // =====================================================================================================
-    //! @brief     Adds the size of a dimension from the Expression to the slice dimension sizes vector so 
-    //!            that all dimensions sizes of the slice are known. Case for the last iteration.
+    //! @brief     Adds the size and the stride of a dimension from the Expression to the slice's vectors of 
+    //!            sizes and strides. Case for the last iteration.
+    //! @param[in] slice_dims  The dimension of Expression which make up the slice.
     //! @tparam    i   The iteration of the function.
     // =====================================================================================================
     template <size_type i>
-    typename std::enable_if<i == (sizeof...(Ts) - 1), size_type>::type buildSliceDimSizes() const 
+    typename std::enable_if<i == (sizeof...(Ts) - 1), void>::type 
+    buildDescriptor(const Tuple<Ts...>& slice_dims) 
     {
-        _slice_dim_sizes.push_back(_x.size(get<i>(_slice_dims)()));                 // Add last dimension size 
-        return _x.size(get<i>(_slice_dims)());                  // Get size of last dimension of the Expression
+        addDimension(get<i>(slice_dims)());
     }
     
     // =====================================================================================================
-    //! @brief         Takes the index of an element in the slice, and maps the index to and element in the 
-    //!                Expression being sliced. Case for all iterations but the last.
-    //! @param[in]     idx     The index of the element in the slice.
-    //! @return        The index of the element i in the slice, in the Expression's data variable.
-    //! @tparam        i       The iteration of the function, essentially which element (in the vector of
-    //!                slice dimensions) the offset in the Expression's is being determined.
+    //! @brief     Adds a dimension of the Expression to the slice, its stride is the product of the sizes of
+    //!            all the dimensions of the Expression before it (the first dimension is contiguous).
+    //! @param[in] dim     The dimension of the Expression to add.
     // =====================================================================================================
-    template <size_type i = 0>
-    typename std::enable_if<i != (sizeof...(Ts) - 1), size_type>::type mapIndex(size_type idx) const 
-    {
-        size_type mapped_dim = 0, dim = 0, dim_offset = 0;
-
-        dim         = get<i>(_slice_dims)();                                        // Size of dim i
-        dim_offset  = std::accumulate(_x.dimSizes().begin()           ,             // Index offset of i in 
-                                      _x.dimSizes().begin() + dim     ,             // original tensors memory
-                                      1                               ,
-                                      std::multiplies<size_type>()    );
-        
-        tensor::DimensionMapper<i> mapper;                                      // Get index in dimension i of
-        mapped_dim = mapper(idx, _x.dimSizes()[dim]);                           // idx in tensor being sliced
-                
-        dim == 0  ? _index   = mapped_dim
-                  : _offset += dim_offset * mapped_dim;
-        
-        _prev_slice_dims.push_back(dim);
-        return mapIndex<i + 1>(idx);                                // Continue until all dimensions finished
-    }
-    
-    // =====================================================================================================
-    //! @brief         Takes the index of an element in the slice, and maps the index to and element in the 
-    //!                Expression being sliced. Case for the last iteration.
-    //! @param[in]     idx     The index of the element in the slice.
-    //! @return        The index of the element i in the slice, in the Expression's data variable.
-    //! @tparam        i       The iteration of the function, essentially which element (in the vector of
-    //!                slice dimensions) the offset in the Expression's is being determined.
-    // =====================================================================================================
-    template <size_type i>
-    typename std::enable_if<i == (sizeof...(Ts) - 1), size_type>::type mapIndex(size_type idx) const 
+    void addDimension(const size_type dim)
     {
-        size_type mapped_dim = 0, dim = 0, dim_offset = 0;
-        
-        dim         = get<i>(_slice_dims)();                                        // Size of dim i 
-        dim_offset  = std::accumulate(_x.dimSizes().begin()           ,             // Index offset of i in 
-                                      _x.dimSizes().begin() + dim     ,             // original tensors memory
-                                      1                               ,
-                                      std::multiplies<size_type>()    );
-        
-        tensor::DimensionMapper<i> mapper;                                      // Get index of dimension i of
-        mapped_dim = mapper(idx, _x.dimSizes()[dim], _prev_slice_dims);         // idx in tensor being sliced
-                
-        dim == 0  ? _index   = mapped_dim
-                  : _offset += dim_offset * mapped_dim;
-        
-        size_type total_offset = _index + _offset;                                  // Calculate final offset
-        _prev_slice_dims.clear();                                                   // Reset all class vars
-        _index = 0; _offset = 0;
-    
-        return total_offset;
+        _slice_dim_sizes.push_back(_x.size(dim));
+        _strides.push_back(std::accumulate(_x.dimSizes().begin()           ,
+                                           _x.dimSizes().begin() + dim     ,
+                                           1                               ,
+                                           std::multiplies<size_type>()    ));
     }
 };
 
@@ -572,8 +647,8 @@ frnn::TensorAddition<T, E1 ,E2> const operator+(frnn::TensorExpression<T, E1> co
 }
 
 // ==========================================================================================================
-//! @brief      Multiplies two TensorExpressions (actually only multiplies two TensorMultipliers for the
-//!             moment
+//! @brief      Multiplies (contracts) two TensorExpressions (actually only multiplies two TensorMultipliers 
+//!             for the moment), for example z = x(i, j) * y(j, k)
 //! @param[in]  x   The TensorExpression on the left of the multiplcication operand..
 //! @param[in]  y   The TensorExpression to the right of the multiplication operand.
 //! @return     The result of the addition of the two TensorExpressions.
@@ -582,8 +657,8 @@ frnn::TensorAddition<T, E1 ,E2> const operator+(frnn::TensorExpression<T, E1> co
 //! @tparam     E2  The type of the right expression to multiply.
 // ==========================================================================================================
 template <typename T, typename E1, typename E2>
-frnn::TensorMultiplication<T, E1 ,E2> const operator*(frnn::TensorExpression<T, E1>& x, 
-                                                      frnn::TensorExpression<T, E2>& y)    
+frnn::TensorMultiplication<T, E1 ,E2> const operator*(frnn::TensorExpression<T, E1> const& x, 
+                                                      frnn::TensorExpression<T, E2> const& y)    
 {
     return frnn::TensorMultiplication<T, E1, E2>(x, y);
 }
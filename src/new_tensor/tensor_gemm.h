@@ -0,0 +1,279 @@
+// ==========================================================================================================
+//! @file   Header file for fastRNN tensor GEMM functions (used for Tensor contractions).
+// ==========================================================================================================
+
+/*
+ * ==========================================================================================================
+ *  Copyright (C) 2015 Rob Clucas robclu1818@gmail.com
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published
+ *  by the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program; if not, write to the Free Software Foundation,
+ *  Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ * ==========================================================================================================
+ */ 
+
+#ifndef _FRNN_TENSOR_GEMM_
+#define _FRNN_TENSOR_GEMM_
+
+#include <array>
+#include <vector>
+#include <algorithm>
+
+#include "../containers/index_map.h"
+#include "../frnn/types.h"
+
+#ifdef FRNN_WITH_CUDA
+#include "../frnn/gpu_context.cuh"
+#include "../math/blas/frnn_blas.h"
+#endif
+
+namespace frnn {
+namespace tensor {
+
+// ==========================================================================================================
+//! @struct     GemmBlocking 
+//! @brief      Sizes of the blocks (tiles) used by the CPU GEMM. A block of A (MC x KC) is reused for each 
+//!             column of the block of B, and the KC x NC block of B stays in cache while the rows of A are 
+//!             iterated over, so that each element loaded from memory is used many times.
+//! @tparam     T   The type of data used by the GEMM.
+// ==========================================================================================================
+template <typename T> struct GemmBlocking {
+    static constexpr size_t MC = 256;                       //!< Rows of A and C in a block
+    static constexpr size_t KC = 128;                       //!< Columns of A (rows of B) in a block
+    static constexpr size_t NC = 64;                        //!< Columns of B and C in a block
+};
+
+// ==========================================================================================================
+//! @brief      Minimum number of multiply-adds (M * N * K) for which a GEMM is sent to the GPU, below this
+//!             the copies to and from the device cost more than the CPU GEMM.
+// ==========================================================================================================
+constexpr size_t GPU_GEMM_MIN_OPS = size_t(1) << 24;
+
+// ==========================================================================================================
+//! @brief      Blocked (cache tiled) GEMM on the CPU which computes C = A * B, where all the matrices are 
+//!             stored column major (the first dimension is contiguous, as for a Tensor), so A is M x K, B 
+//!             is K x N and C is M x N. The inner loop runs down a column of A and C, so it is contiguous 
+//!             and can be vectorized by the compiler.
+//! @param[in]  M   The number of rows of A and C.
+//! @param[in]  N   The number of columns of B and C.
+//! @param[in]  K   The number of columns of A and rows of B.
+//! @param[in]  a   The data for A.
+//! @param[in]  b   The data for B.
+//! @param[out] c   The data for C, which must hold M * N elements (which are overwritten).
+//! @tparam     T   The type of data used by the matrices.
+// ==========================================================================================================
+template <typename T>
+void gemmCpu(const size_t M, const size_t N, const size_t K, const T* a, const T* b, T* c)
+{
+    using blocking = GemmBlocking<T>;
+    std::fill(c, c + M * N, T(0));
+    
+    for (size_t n0 = 0; n0 < N; n0 += blocking::NC) {
+        const size_t n1 = std::min(n0 + blocking::NC, N);
+        for (size_t k0 = 0; k0 < K; k0 += blocking::KC) {
+            const size_t k1 = std::min(k0 + blocking::KC, K);
+            for (size_t m0 = 0; m0 < M; m0 += blocking::MC) {
+                const size_t m1 = std::min(m0 + blocking::MC, M);
+                for (size_t n = n0; n < n1; ++n) {
+                    T* c_col = c + M * n;
+                    for (size_t k = k0; k < k1; ++k) {
+                        const T  b_kn  = b[k + K * n];
+                        const T* a_col = a + M * k;
+                        for (size_t m = m0; m < m1; ++m) c_col[m] += a_col[m] * b_kn;
+                    }
+                }
+            }
+        }
+    }
+}
+
+// ==========================================================================================================
+//! @brief      GEMM on the GPU (with cuBLAS), for types which cuBLAS doesn't support (and for every type in
+//!             CPU only builds). Nothing is done and false is returned so the CPU GEMM is used.             \n
+//!                                                                                                          \n
+//!             The float and double specializations are chosen by FRNN_WITH_CUDA, which is the same for
+//!             every translation unit of a build, and not by the compiler, so a gemm instantiation is the 
+//!             same in the C++ and the CUDA sources of a build (they only use the cuBLAS host API).
+//! @return     False, since the GEMM was not done.
+// ==========================================================================================================
+template <typename T>
+bool gemmGpu(const size_t /*M*/, const size_t /*N*/, const size_t /*K*/, const T* /*a*/, const T* /*b*/, 
+             T* /*c*/) 
+{ 
+    return false; 
+}
+
+#ifdef FRNN_WITH_CUDA
+// ==========================================================================================================
+//! @brief      The GpuContext which the contractions use. It is separate from GpuContext::global() so that 
+//!             the scratch buffers of a contraction never alias the scratch slots of the math functions and
+//!             the layers, which use the global context.
+//! @return     The context for the contractions.
+// ==========================================================================================================
+inline GpuContext& contractionContext()
+{
+    static GpuContext context;
+    return context;
+}
+
+// ==========================================================================================================
+//! @brief      GEMM on the GPU (with cuBLAS) which computes C = A * B, for float and double. The matrices 
+//!             are copied into scratch buffers (slots 0 - 2) of the context, so after the first big 
+//!             contraction no device memory is allocated.
+//! @param[in]  context The GPU context which provides the cuBLAS handle, the stream and the scratch memory.
+//! @param[in]  M   The number of rows of A and C.
+//! @param[in]  N   The number of columns of B and C.
+//! @param[in]  K   The number of columns of A and rows of B.
+//! @param[in]  a   The (host) data for A.
+//! @param[in]  b   The (host) data for B.
+//! @param[out] c   The (host) data for C, which must hold M * N elements.
+//! @return     True if the GEMM was done on the GPU, false if any of the GPU calls failed.
+//! @tparam     T   The type of data used by the matrices (float or double).
+// ==========================================================================================================
+template <typename T>
+bool gemmGpuBlas(GpuContext& context, const size_t M, const size_t N, const size_t K, const T* a, const T* b, 
+                 T* c)
+{
+    frnnError   error;
+    const T     alpha = T(1), beta = T(0);
+    
+    T* a_device = context.scratch<T>(error, 0, M * K);
+    T* b_device = context.scratch<T>(error, 1, K * N);
+    T* c_device = context.scratch<T>(error, 2, M * N);
+    if (a_device == 0 || b_device == 0 || c_device == 0) return false;
+    
+    cudaStream_t stream = context.stream();
+    if (cudaMemcpyAsync(a_device, a, M * K * sizeof(T), cudaMemcpyHostToDevice, stream) != cudaSuccess ||
+        cudaMemcpyAsync(b_device, b, K * N * sizeof(T), cudaMemcpyHostToDevice, stream) != cudaSuccess ) {
+        return false;
+    }
+    if (blas::functions<T>::gemm(context.blasHandle(), CUBLAS_OP_N, CUBLAS_OP_N, M, N, K, &alpha,
+                                 a_device, M, b_device, K, &beta, c_device, M) != CUBLAS_STATUS_SUCCESS) {
+        return false;
+    }
+    if (cudaMemcpyAsync(c, c_device, M * N * sizeof(T), cudaMemcpyDeviceToHost, stream) != cudaSuccess) {
+        return false;
+    }
+    return cudaStreamSynchronize(stream) == cudaSuccess;
+}
+
+template <>
+inline bool gemmGpu<float>(const size_t M, const size_t N, const size_t K, const float* a, const float* b, 
+                           float* c) 
+{
+    return gemmGpuBlas(contractionContext(), M, N, K, a, b, c);
+}
+
+template <>
+inline bool gemmGpu<double>(const size_t M, const size_t N, const size_t K, const double* a, const double* b, 
+                            double* c) 
+{
+    return gemmGpuBlas(contractionContext(), M, N, K, a, b, c);
+}
+#endif
+
+// ==========================================================================================================
+//! @struct     ContractionPlan 
+//! @brief      Describes how the two operands of a Tensor contraction are permuted and reshaped so that the
+//!             contraction is a single GEMM. For z = x * y the non-reduced dimensions of x become the rows
+//!             (M) of A, the reduced dimensions become the columns (K) of A and the rows of B, and the 
+//!             non-reduced dimensions of y become the columns (N) of B, so that C = A * B has the same 
+//!             memory layout as z.                                                                          \n
+//!                                                                                                          \n
+//!             The strides are the distance in the packed matrix (A for x, B for y) between elements which 
+//!             are next to each other in a dimension of the operand, thus packing is a single pass over 
+//!             the operand. There is at most one dimension for each Index of the contraction, so the strides
+//!             are fixed size arrays and building a plan does not allocate.
+// ==========================================================================================================
+struct ContractionPlan {
+    typedef std::array<size_t, INDEX_MAP_CAPACITY> stride_type;
+    
+    size_t              M;                              //!< Rows of A and C (product of x's free dims)
+    size_t              N;                              //!< Columns of B and C (product of y's free dims)
+    size_t              K;                              //!< Product of the sizes of the reduced dims
+    stride_type         x_strides;                      //!< Stride in A of each dimension of x
+    stride_type         y_strides;                      //!< Stride in B of each dimension of y
+    
+    ContractionPlan() : M(1), N(1), K(1), x_strides(), y_strides() {}
+};
+
+// ==========================================================================================================
+//! @struct     DimensionList 
+//! @brief      A list of dimensions (the positions of the dimensions in the subscripts of an operand) of a 
+//!             contraction, with space for as many dimensions as there are Indexes in an IndexMap, so that 
+//!             the lists never allocate.
+// ==========================================================================================================
+struct DimensionList {
+    size_t              dims[INDEX_MAP_CAPACITY];       //!< The dimensions in the list
+    size_t              count;                          //!< The number of dimensions in the list
+    
+    DimensionList() : count(0) {}
+    
+    void          push_back(size_t dim)        { dims[count++] = dim; }
+    size_t        size()                 const { return count; }
+    size_t        operator[](size_t i)   const { return dims[i]; }
+    const size_t* begin()                const { return dims; }
+    const size_t* end()                  const { return dims + count; }
+};
+
+// ==========================================================================================================
+//! @brief      Packs (permutes and reshapes) an operand of a contraction into a contiguous matrix, by 
+//!             walking over the elements of the operand in memory order and keeping track of the offset of
+//!             each element in the packed matrix with a counter for each dimension.
+//! @param[in]  x           The operand (expression) to pack.
+//! @param[in]  strides     The stride in the packed matrix of each dimension of x (see ContractionPlan), x 
+//!                         can have at most INDEX_MAP_CAPACITY dimensions.
+//! @param[out] packed      The packed matrix, which must hold x.size() elements.
+//! @tparam     T           The type of data used by the operand.
+//! @tparam     E           The type of the operand expression.
+// ==========================================================================================================
+template <typename T, typename E>
+void packOperand(const E& x, const ContractionPlan::stride_type& strides, T* packed)
+{
+    const std::vector<size_t>&   dim_sizes = x.dimSizes();
+    ContractionPlan::stride_type counters  = {};
+    size_t                       offset    = 0;
+    
+    for (size_t i = 0; i < x.size(); ++i) {
+        packed[offset] = x[i];
+        for (size_t dim = 0; dim < dim_sizes.size(); ++dim) {          // Move to the next element, carrying
+            offset += strides[dim];                                     // into the next dimension when the
+            if (++counters[dim] < dim_sizes[dim]) break;                // end of a dimension is reached
+            offset -= strides[dim] * dim_sizes[dim];
+            counters[dim] = 0;
+        }
+    }
+}
+
+// ==========================================================================================================
+//! @brief      Computes C = A * B (column major), using cuBLAS if the GEMM is big enough for the GPU to be 
+//!             faster (and the build has FRNN_WITH_CUDA), otherwise using the blocked CPU GEMM.
+//! @param[in]  M   The number of rows of A and C.
+//! @param[in]  N   The number of columns of B and C.
+//! @param[in]  K   The number of columns of A and rows of B.
+//! @param[in]  a   The data for A.
+//! @param[in]  b   The data for B.
+//! @param[out] c   The data for C, which must hold M * N elements.
+//! @tparam     T   The type of data used by the matrices.
+// ==========================================================================================================
+template <typename T>
+void gemm(const size_t M, const size_t N, const size_t K, const T* a, const T* b, T* c)
+{
+    if (M * N * K >= GPU_GEMM_MIN_OPS && gemmGpu(M, N, K, a, b, c)) return;
+    gemmCpu(M, N, K, a, b, c);
+}
+
+}       // End namespace tensor
+}       // End namespace frnn
+
+#endif
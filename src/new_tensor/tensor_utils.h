@@ -25,6 +25,7 @@
 #ifndef _FRNN_TENSOR_UTILS_
 #define _FRNN_TENSOR_UTILS_
 
+#include <cstddef>
 #include <vector>
 #include <numeric>
 
@@ -100,6 +101,103 @@ public:
     }
 };
 
+// ==========================================================================================================
+//! @struct     StaticProduct 
+//! @brief      Computes the product of a list of dimension sizes at compile time, i.e the number of elements 
+//!             of a Tensor with those dimension sizes.
+//! @tparam     Dims    The sizes of the dimensions.
+// ==========================================================================================================
+template <size_t... Dims> struct StaticProduct;
+
+template <> struct StaticProduct<> {
+    static constexpr size_t value = 1;
+};
+
+template <size_t D, size_t... Ds> struct StaticProduct<D, Ds...> {
+    static constexpr size_t value = D * StaticProduct<Ds...>::value;
+};
+
+// ==========================================================================================================
+//! @struct     StaticDimSize 
+//! @brief      Gets the size of dimension d from a list of dimension sizes at compile time.
+//! @tparam     d       The dimension to get the size of.
+//! @tparam     Dims    The sizes of the dimensions.
+// ==========================================================================================================
+template <size_t d, size_t... Dims> struct StaticDimSize;
+
+template <size_t D, size_t... Ds> struct StaticDimSize<0, D, Ds...> {
+    static constexpr size_t value = D;
+};
+
+template <size_t d, size_t D, size_t... Ds> struct StaticDimSize<d, D, Ds...> {
+    static constexpr size_t value = StaticDimSize<d - 1, Ds...>::value;
+};
+
+// ==========================================================================================================
+//! @struct     StaticStride 
+//! @brief      Gets the stride (in memory) of dimension d of a Tensor with the given dimension sizes at 
+//!             compile time. The first dimension is contiguous.
+//! @tparam     d       The dimension to get the stride of.
+//! @tparam     Dims    The sizes of the dimensions.
+// ==========================================================================================================
+template <size_t d, size_t... Dims> struct StaticStride;
+
+template <size_t D, size_t... Ds> struct StaticStride<0, D, Ds...> {
+    static constexpr size_t value = 1;
+};
+
+template <size_t d, size_t D, size_t... Ds> struct StaticStride<d, D, Ds...> {
+    static constexpr size_t value = D * StaticStride<d - 1, Ds...>::value;
+};
+
+// ==========================================================================================================
+//! @struct     StaticOffset 
+//! @brief      Computes the offset in memory of an element of a Tensor with the given dimension sizes from 
+//!             the index of the element in each dimension. The recursion is done by the compiler, so the 
+//!             computation is unrolled (and is constexpr if the indices are).
+//! @tparam     Dims    The sizes of the dimensions.
+// ==========================================================================================================
+template <size_t... Dims> struct StaticOffset;
+
+template <> struct StaticOffset<> {
+    static constexpr size_t offset() { return 0; }
+};
+
+template <size_t D, size_t... Ds> struct StaticOffset<D, Ds...> {
+    // ======================================================================================================
+    //! @brief      Computes the offset of an element, which is the index in the first dimension plus the size
+    //!             of the first dimension times the offset due to the rest of the dimensions.
+    //! @param[in]  idx         The index of the element in the first dimension.
+    //! @param[in]  indices     The indices of the element in the rest of the dimensions.
+    //! @return     The offset of the element in memory.
+    // ======================================================================================================
+    template <typename I, typename... Is>
+    static constexpr size_t offset(I idx, Is... indices) 
+    {
+        return static_cast<size_t>(idx) + D * StaticOffset<Ds...>::offset(indices...);
+    }
+};
+
+// ==========================================================================================================
+//! @struct     StaticDimensionMapper 
+//! @brief      Compile time version of the DimensionMapper, which gets the index in dimension d of the 
+//!             element at position idx of a Tensor with the given dimension sizes. Since the sizes and the 
+//!             strides are known at compile time the division and modulus are by constants.
+//! @tparam     d       The dimension to get the index of the element in.
+//! @tparam     Dims    The sizes of the dimensions.
+// ==========================================================================================================
+template <size_t d, size_t... Dims> struct StaticDimensionMapper {
+    // ======================================================================================================
+    //! @brief      Gets the index in dimension d of an element.
+    //! @param[in]  idx     The position of the element in memory.
+    //! @return     The index of the element in dimension d.
+    // ======================================================================================================
+    static constexpr size_t map(const size_t idx) 
+    {
+        return (idx / StaticStride<d, Dims...>::value) % StaticDimSize<d, Dims...>::value;
+    }
+};
+
 }       // End namespace tensor
 }       // End namespace frnn
 
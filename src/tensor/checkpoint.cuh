@@ -0,0 +1,618 @@
+/*
+ *  Header file for the fastRNN checkpoint format, a binary file of named
+ *  tensors which can be memory mapped, so tensors can be made over the file
+ *  without a copy, or copied straight from the mapping to the device.
+ *
+ *  Copyright (C) 2015 Rob Clucas robclu1818@gmail.com
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published
+ *  by the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program; if not, write to the Free Software Foundation,
+ *	Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#ifndef _FRNN_CHECKPOINT_
+#define _FRNN_CHECKPOINT_
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <vector>
+
+#ifdef FRNN_WITH_CUFILE
+#include <cufile.h>
+#endif
+
+#include "../util/errors.h"
+#include "../frnn/cuda_host.h"
+#include "../frnn/aligned_allocator.h"
+#include "../frnn/precision.h"
+#include "tensor.cuh"
+
+/* ============================================= NOTES ======================================================
+ *
+ * 1. A checkpoint is a 64 byte header, a table with a 64 byte entry for each tensor, and then the data of
+ *    the tensors. The entry of a tensor has its name, its type, its layout (the column major layout of a
+ *    Tensor4 is the only one), its dimensions, and the offset and size of its data. The data of each tensor
+ *    starts on a CHECKPOINT_ALIGNMENT (64) byte boundary of the file, and is padded with zeros to the next
+ *    one. All the values are little endian (the byte order of the hosts which are supported).
+ *
+ * 2. The version is changed whenever the format changes, and a checkpoint of a different version is not
+ *    read. New types and layouts can be added to the enums without changing the version, since a reader
+ *    which doesn't know one only fails on the tensors which use it.
+ *
+ * 3. The reader maps the whole file (privately, so writes to a view are not written to the file), and the
+ *    mapping starts on a page boundary, so the data of every tensor is FRNN_ALIGNMENT aligned in memory. A
+ *    view is a Tensor4 with the Mapped storage policy over the data in the mapping, so making it doesn't
+ *    read the file : the pages are read when they are first used. The checkpoint must outlive its views.
+ *
+ * 4. Loading into a device tensor copies from the mapping to the device without a host tensor. When the
+ *    mapping is pinned (see pin) the copy is a DMA from the mapped pages, otherwise the driver stages it
+ *    through its own pinned buffers. With FRNN_WITH_CUFILE loadDirect reads the file straight into device
+ *    memory with GPUDirect Storage (cuFile), without using the mapping. Without FRNN_WITH_CUDA there are no
+ *    device tensors (or halfs) to load, and a mapping can't be pinned.
+ *
+ * ==========================================================================================================
+ */
+
+namespace frnn {
+
+const char      CHECKPOINT_MAGIC[ 8 ]     = { 'F', 'R', 'N', 'N', 'C', 'K', 'P', 'T' };
+const uint32_t  CHECKPOINT_VERSION        = 1;
+const size_t    CHECKPOINT_ALIGNMENT      = FRNN_ALIGNMENT;         // Alignment of the data of each tensor
+const size_t    CHECKPOINT_NAME_BYTES     = 24;                     // Bytes of a name (with the terminating 0)
+
+/*
+ * ==========================================================================================================
+ * Enum         : checkpoint_dtype
+ *
+ * Description  : The types of the elements of the tensors of a checkpoint
+ * ==========================================================================================================
+ */
+enum checkpoint_dtype : uint32_t {
+    CHECKPOINT_FLOAT32  = 1,
+    CHECKPOINT_FLOAT64  = 2,
+    CHECKPOINT_FLOAT16  = 3,
+    CHECKPOINT_BFLOAT16 = 4,
+    CHECKPOINT_INT8     = 5
+};
+
+/*
+ * ==========================================================================================================
+ * Enum         : checkpoint_layout
+ *
+ * Description  : The layouts of the data of the tensors of a checkpoint
+ * ==========================================================================================================
+ */
+enum checkpoint_layout : uint32_t {
+    CHECKPOINT_COLUMN_MAJOR = 0                 // Layout of a Tensor4 (x changes fastest, then y, z and w)
+};
+
+/*
+ * ==========================================================================================================
+ * Struct       : checkpoint_type
+ *
+ * Description  : Gets the checkpoint type of dType
+ *
+ * Params       : dType     : The type of the elements
+ * ==========================================================================================================
+ */
+template <typename dType> struct checkpoint_type;
+template <> struct checkpoint_type<float>   { static constexpr checkpoint_dtype value = CHECKPOINT_FLOAT32;  };
+template <> struct checkpoint_type<double>  { static constexpr checkpoint_dtype value = CHECKPOINT_FLOAT64;  };
+template <> struct checkpoint_type<int8_t>  { static constexpr checkpoint_dtype value = CHECKPOINT_INT8;     };
+#ifdef FRNN_WITH_CUDA
+template <> struct checkpoint_type<__half>  { static constexpr checkpoint_dtype value = CHECKPOINT_FLOAT16;  };
+#endif
+#ifdef FRNN_BF16
+template <> struct checkpoint_type<__nv_bfloat16> { static constexpr checkpoint_dtype value = CHECKPOINT_BFLOAT16; };
+#endif
+
+/*
+ * ==========================================================================================================
+ * Struct       : checkpoint_header
+ *
+ * Description  : The header at the start of a checkpoint file (see NOTES 1)
+ * ==========================================================================================================
+ */
+struct checkpoint_header {
+    char            magic[ 8 ];                 // CHECKPOINT_MAGIC
+    uint32_t        version;                    // CHECKPOINT_VERSION of the writer
+    uint32_t        num_tensors;                // Number of entries in the table
+    uint64_t        table_offset;               // Offset of the table from the start of the file
+    uint64_t        file_bytes;                 // Size of the file
+    uint8_t         reserved[ 32 ];             // Zero
+};
+
+/*
+ * ==========================================================================================================
+ * Struct       : checkpoint_entry
+ *
+ * Description  : The entry of a tensor in the table of a checkpoint (see NOTES 1)
+ * ==========================================================================================================
+ */
+struct checkpoint_entry {
+    char            name[ CHECKPOINT_NAME_BYTES ];  // Name of the tensor (0 terminated)
+    uint32_t        dtype;                          // checkpoint_dtype of the elements
+    uint32_t        layout;                         // checkpoint_layout of the data
+    uint32_t        dims[ 4 ];                      // x, y, z and w dimensions
+    uint64_t        offset;                         // Offset of the data from the start of the file
+    uint64_t        bytes;                          // Size of the data (without the padding)
+
+    inline size_t elements() const { return static_cast<size_t>( dims[ 0 ] ) * dims[ 1 ] * dims[ 2 ] * dims[ 3 ]; }
+};
+
+static_assert( sizeof( checkpoint_header ) == 64, "The checkpoint header must be 64 bytes" );
+static_assert( sizeof( checkpoint_entry )  == 64, "A checkpoint entry must be 64 bytes" );
+
+// If the number of elements of an entry is at most its number of bytes, with a product of the dimensions which
+// can't wrap, so the entry's elements() can be compared with its bytes
+inline bool checkpointElementsFit( const checkpoint_entry& entry ) {
+    uint64_t elements = 1;
+    for ( size_t d = 0; d < 4; d++ ) {
+        if ( entry.dims[ d ] == 0 ) return true;
+        if ( elements > entry.bytes / entry.dims[ d ] ) return false;
+        elements *= entry.dims[ d ];
+    }
+    return true;
+}
+
+// Rounds bytes up to a multiple of the checkpoint alignment
+inline uint64_t checkpointPadded( uint64_t bytes ) {
+    return ( ( bytes + CHECKPOINT_ALIGNMENT - 1 ) / CHECKPOINT_ALIGNMENT ) * CHECKPOINT_ALIGNMENT;
+}
+
+/*
+ * ==========================================================================================================
+ * Class        : CheckpointWriter
+ *
+ * Description  : Collects named tensors and writes them to a checkpoint file. The tensors are not copied,
+ *                so they must not be changed (or destroyed) until the checkpoint has been written.
+ * ==========================================================================================================
+ */
+class CheckpointWriter {
+    private:
+        struct pending {
+            checkpoint_entry    entry;              // Entry of the tensor (the offset is set when written)
+            const void*         data;               // Host data of the tensor
+        };
+        std::vector<pending>    tensors_;
+
+    public:
+        inline size_t numTensors() const { return tensors_.size(); }
+
+        /*
+         * ==================================================================================================
+         * Function     : add
+         *
+         * Description  : Adds a tensor to the checkpoint. Device tensors are copied to their host mirror.
+         *
+         * Inputs       : error     : fastRNN error type for the result
+         *              : name      : The name of the tensor, which must be unique and shorter than
+         *                            CHECKPOINT_NAME_BYTES
+         *              : tensor    : The tensor to add
+         *
+         * Outputs      : If the tensor was added
+         *
+         * Params       : dType     : The type of the elements of the tensor
+         *              : Storage   : The storage policy of the tensor
+         * ==================================================================================================
+         */
+        template <typename dType, template <typename> class Storage>
+        bool add( frnnError& error, const char* name, const Tensor4<dType, Storage>& tensor ) {
+            if ( std::strlen( name ) >= CHECKPOINT_NAME_BYTES ) {
+                frnn::err::fileError( error, name, "the tensor name is too long" );
+                return false;
+            }
+            for ( size_t i = 0; i < tensors_.size(); i++ ) {
+                if ( std::strcmp( tensors_[ i ].entry.name, name ) == 0 ) {
+                    frnn::err::fileError( error, name, "a tensor with the name was already added" );
+                    return false;
+                }
+            }
+
+            pending tensor_info;
+            std::memset( &tensor_info.entry, 0, sizeof( checkpoint_entry ) );
+            std::strcpy( tensor_info.entry.name, name );
+            tensor_info.entry.dtype     = checkpoint_type<dType>::value;
+            tensor_info.entry.layout    = CHECKPOINT_COLUMN_MAJOR;
+            tensor_info.entry.dims[ 0 ] = tensor.x();
+            tensor_info.entry.dims[ 1 ] = tensor.y();
+            tensor_info.entry.dims[ 2 ] = tensor.z();
+            tensor_info.entry.dims[ 3 ] = tensor.w();
+            tensor_info.entry.bytes     = tensor.size() * sizeof( dType );
+            tensor_info.data            = tensor.size() == 0 ? 0 : &tensor.hostData()[ 0 ];
+            tensors_.push_back( tensor_info );
+            return true;
+        }
+
+        /*
+         * ==================================================================================================
+         * Function     : write
+         *
+         * Description  : Writes the tensors which have been added to a checkpoint file
+         *
+         * Inputs       : error     : fastRNN error type for the result
+         *              : path      : The path of the file, which is replaced if it exists
+         *
+         * Outputs      : If the file was written
+         * ==================================================================================================
+         */
+        bool write( frnnError& error, const char* path ) {
+            checkpoint_header header;
+            std::memset( &header, 0, sizeof( header ) );
+            std::memcpy( header.magic, CHECKPOINT_MAGIC, sizeof( header.magic ) );
+            header.version      = CHECKPOINT_VERSION;
+            header.num_tensors  = static_cast<uint32_t>( tensors_.size() );
+            header.table_offset = sizeof( checkpoint_header );
+
+            uint64_t offset = header.table_offset + tensors_.size() * sizeof( checkpoint_entry );
+            for ( size_t i = 0; i < tensors_.size(); i++ ) {
+                tensors_[ i ].entry.offset = offset;
+                offset += checkpointPadded( tensors_[ i ].entry.bytes );
+            }
+            header.file_bytes = offset;
+
+            FILE* file = std::fopen( path, "wb" );
+            if ( file == 0 ) {
+                frnn::err::fileError( error, path, "could not be opened for writing" );
+                return false;
+            }
+
+            static const char zeros[ CHECKPOINT_ALIGNMENT ] = {};
+            bool written = std::fwrite( &header, sizeof( header ), 1, file ) == 1;
+            for ( size_t i = 0; i < tensors_.size() && written; i++ ) {
+                written = std::fwrite( &tensors_[ i ].entry, sizeof( checkpoint_entry ), 1, file ) == 1;
+            }
+            for ( size_t i = 0; i < tensors_.size() && written; i++ ) {
+                const size_t bytes   = tensors_[ i ].entry.bytes;
+                const size_t padding = checkpointPadded( bytes ) - bytes;
+                if ( bytes > 0 )   written = std::fwrite( tensors_[ i ].data, 1, bytes, file ) == bytes;
+                if ( padding > 0 ) written = written && std::fwrite( zeros, 1, padding, file ) == padding;
+            }
+            if ( std::fclose( file ) != 0 ) written = false;
+
+            if ( !written ) frnn::err::fileError( error, path, "could not be written" );
+            return written;
+        }
+};
+
+/*
+ * ==========================================================================================================
+ * Class        : Checkpoint
+ *
+ * Description  : A checkpoint file which is mapped into memory, from which tensors can be viewed without a
+ *                copy, or loaded into host or device tensors (see NOTES 3 - 4)
+ * ==========================================================================================================
+ */
+class Checkpoint {
+    private:
+        int                         fd_;            // File descriptor of the file
+        char*                       base_;          // Start of the mapping
+        size_t                      bytes_;         // Size of the mapping (the size of the file)
+        bool                        pinned_;        // If the mapping is registered with CUDA
+        const checkpoint_header*    header_;        // The header (at the start of the mapping)
+        const checkpoint_entry*     table_;         // The table of the tensors
+        std::vector<char>           path_;          // Path of the file (for errors and loadDirect)
+
+    public:
+        Checkpoint() : fd_( -1 ), base_( 0 ), bytes_( 0 ), pinned_( false ), header_( 0 ), table_( 0 ) {}
+
+        /*
+         * ==================================================================================================
+         * Function     : Checkpoint
+         *
+         * Description  : Maps a checkpoint file (see open)
+         *
+         * Inputs       : error     : fastRNN error type for the result
+         *              : path      : The path of the file
+         * ==================================================================================================
+         */
+        Checkpoint( frnnError& error, const char* path ) :
+            fd_( -1 ), base_( 0 ), bytes_( 0 ), pinned_( false ), header_( 0 ), table_( 0 ) { open( error, path ); }
+
+        ~Checkpoint() { close(); }
+
+        // The checkpoint owns the mapping, so it can't be copied
+        Checkpoint( const Checkpoint& )             = delete;
+        Checkpoint& operator=( const Checkpoint& )  = delete;
+
+        inline bool isOpen() const { return header_ != 0; }
+        inline bool isPinned() const { return pinned_; }
+        inline size_t numTensors() const { return header_ == 0 ? 0 : header_->num_tensors; }
+        inline const checkpoint_entry& entry( size_t i ) const { return table_[ i ]; }
+        inline const char* data() const { return base_; }
+
+        /*
+         * ==================================================================================================
+         * Function     : open
+         *
+         * Description  : Maps a checkpoint file and checks its header and its table, any checkpoint which is
+         *                already open is closed first
+         *
+         * Inputs       : error     : fastRNN error type for the result
+         *              : path      : The path of the file
+         *
+         * Outputs      : If the file is a valid checkpoint
+         * ==================================================================================================
+         */
+        bool open( frnnError& error, const char* path ) {
+            close();
+            path_.assign( path, path + std::strlen( path ) + 1 );
+
+            struct stat info;
+            fd_ = ::open( path, O_RDONLY );
+            if ( fd_ < 0 || fstat( fd_, &info ) != 0 ) {
+                frnn::err::fileError( error, path, "could not be opened" );
+                close();
+                return false;
+            }
+            bytes_ = static_cast<size_t>( info.st_size );
+            if ( bytes_ < sizeof( checkpoint_header ) ) {
+                frnn::err::fileError( error, path, "is too small to be a checkpoint" );
+                close();
+                return false;
+            }
+
+            // Views are Tensor4s with writable data, so the pages are writable, but the mapping is private
+            // so a write to a view only changes its copy of the page, never the file (see NOTES 3)
+            void* mapping = mmap( 0, bytes_, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd_, 0 );
+            if ( mapping == MAP_FAILED ) {
+                frnn::err::fileError( error, path, "could not be mapped" );
+                close();
+                return false;
+            }
+            base_ = static_cast<char*>( mapping );
+
+            const checkpoint_header* header = reinterpret_cast<const checkpoint_header*>( base_ );
+            if ( std::memcmp( header->magic, CHECKPOINT_MAGIC, sizeof( header->magic ) ) != 0 ) {
+                frnn::err::fileError( error, path, "is not a checkpoint" );
+                close();
+                return false;
+            }
+            if ( header->version != CHECKPOINT_VERSION ) {
+                frnn::err::fileError( error, path, "is a checkpoint of a different version" );
+                close();
+                return false;
+            }
+            // The offsets and sizes come from the file, so they are checked without sums which can wrap
+            if ( header->file_bytes != bytes_ || header->table_offset % CHECKPOINT_ALIGNMENT != 0 ||
+                 header->table_offset > bytes_ ||
+                 header->num_tensors > ( bytes_ - header->table_offset ) / sizeof( checkpoint_entry ) ) {
+                frnn::err::fileError( error, path, "is truncated or has a bad table" );
+                close();
+                return false;
+            }
+
+            const checkpoint_entry* table = reinterpret_cast<const checkpoint_entry*>( base_ + header->table_offset );
+            for ( uint32_t i = 0; i < header->num_tensors; i++ ) {
+                if ( table[ i ].offset % CHECKPOINT_ALIGNMENT != 0 || table[ i ].offset > bytes_ ||
+                     table[ i ].bytes > bytes_ - table[ i ].offset || !checkpointElementsFit( table[ i ] ) ||
+                     table[ i ].name[ CHECKPOINT_NAME_BYTES - 1 ] != 0 ) {
+                    frnn::err::fileError( error, path, "has a bad tensor entry" );
+                    close();
+                    return false;
+                }
+            }
+            header_ = header;
+            table_  = table;
+            return true;
+        }
+
+        /*
+         * ==================================================================================================
+         * Function     : close
+         *
+         * Description  : Unpins and unmaps the file, after which the views of the checkpoint are not valid
+         * ==================================================================================================
+         */
+        void close() {
+#ifdef FRNN_WITH_CUDA
+            if ( pinned_ ) cudaHostUnregister( base_ );
+#endif
+            if ( base_ != 0 ) munmap( base_, bytes_ );
+            if ( fd_ >= 0 ) ::close( fd_ );
+            fd_ = -1; base_ = 0; bytes_ = 0; pinned_ = false; header_ = 0; table_ = 0;
+        }
+
+        /*
+         * ==================================================================================================
+         * Function     : find
+         *
+         * Description  : Gets the entry of a tensor
+         *
+         * Inputs       : name      : The name of the tensor
+         *
+         * Outputs      : The entry, or 0 if there is no tensor with the name
+         * ==================================================================================================
+         */
+        const checkpoint_entry* find( const char* name ) const {
+            for ( size_t i = 0; i < numTensors(); i++ ) {
+                if ( std::strncmp( table_[ i ].name, name, CHECKPOINT_NAME_BYTES ) == 0 ) return &table_[ i ];
+            }
+            return 0;
+        }
+
+        /*
+         * ==================================================================================================
+         * Function     : pin
+         *
+         * Description  : Registers the mapping with CUDA, so the copies to device tensors are DMAs from the
+         *                mapped pages (see NOTES 4). This reads (and locks) all the pages of the file.
+         *
+         * Inputs       : error     : fastRNN error type for the result
+         *
+         * Outputs      : If the mapping is pinned
+         * ==================================================================================================
+         */
+        bool pin( frnnError& error ) {
+            if ( pinned_ || !isOpen() ) return pinned_;
+#ifndef FRNN_WITH_CUDA
+            frnn::err::fileError( error, &path_[ 0 ], "could not be pinned without CUDA" );
+            return false;
+#else
+#if CUDART_VERSION >= 11010
+            const unsigned int flags = cudaHostRegisterReadOnly;
+#else
+            const unsigned int flags = cudaHostRegisterDefault;
+#endif
+            if ( cudaHostRegister( base_, bytes_, flags ) != cudaSuccess ) {
+                frnn::err::fileError( error, &path_[ 0 ], "could not be pinned" );
+                return false;
+            }
+            pinned_ = true;
+            return true;
+#endif
+        }
+
+        /*
+         * ==================================================================================================
+         * Function     : view
+         *
+         * Description  : Gets a tensor which is a view of the data of a tensor in the mapping (see NOTES 3)
+         *
+         * Inputs       : error     : fastRNN error type for the result
+         *              : name      : The name of the tensor
+         *
+         * Outputs      : The view, which is empty if the tensor doesn't exist or has a different type
+         *
+         * Params       : dType     : The type of the elements of the tensor
+         * ==================================================================================================
+         */
+        template <typename dType>
+        Tensor4<dType, storage::Mapped> view( frnnError& error, const char* name ) {
+            const checkpoint_entry* tensor_entry = checkedEntry<dType>( error, name );
+            if ( tensor_entry == 0 ) return Tensor4<dType, storage::Mapped>();
+
+            dType* tensor_data = reinterpret_cast<dType*>( base_ + tensor_entry->offset );
+            return Tensor4<dType, storage::Mapped>(
+                        storage::Mapped<dType>( storage::mapped_span<dType>( tensor_data, tensor_entry->elements() ) ),
+                        tensor_entry->dims[ 0 ], tensor_entry->dims[ 1 ], tensor_entry->dims[ 2 ], tensor_entry->dims[ 3 ] );
+        }
+
+        /*
+         * ==================================================================================================
+         * Function     : load
+         *
+         * Description  : Copies a tensor from the mapping into a tensor, which is reshaped to the dimensions
+         *                of the tensor in the checkpoint. For device tensors the data is copied straight from
+         *                the mapping to the device (see NOTES 4).
+         *
+         * Inputs       : error     : fastRNN error type for the result
+         *              : name      : The name of the tensor
+         *
+         * Outputs      : tensor    : The tensor to copy the data to
+         *
+         * Params       : dType     : The type of the elements of the tensor
+         * ==================================================================================================
+         */
+        template <typename dType>
+        bool load( frnnError& error, const char* name, Tensor4<dType, storage::Host>& tensor ) const {
+            const checkpoint_entry* tensor_entry = checkedEntry<dType>( error, name );
+            if ( tensor_entry == 0 ) return false;
+
+            tensor.reshape( tensor_entry->dims[ 0 ], tensor_entry->dims[ 1 ], tensor_entry->dims[ 2 ], tensor_entry->dims[ 3 ] );
+            if ( tensor_entry->bytes > 0 ) std::memcpy( &tensor.hostData()[ 0 ], base_ + tensor_entry->offset, tensor_entry->bytes );
+            return true;
+        }
+
+#ifdef FRNN_WITH_CUDA
+        template <typename dType>
+        bool load( frnnError& error, const char* name, Tensor4<dType, storage::Device>& tensor ) const {
+            const checkpoint_entry* tensor_entry = checkedEntry<dType>( error, name );
+            if ( tensor_entry == 0 ) return false;
+
+            tensor.reshape( tensor_entry->dims[ 0 ], tensor_entry->dims[ 1 ], tensor_entry->dims[ 2 ], tensor_entry->dims[ 3 ] );
+            if ( tensor_entry->bytes == 0 ) return true;
+            dType* tensor_d = tensor.overwriteDeviceData();
+            if ( tensor_d == 0 || frnn::prof::memcpy( tensor_d, base_ + tensor_entry->offset, tensor_entry->bytes,
+                                                      cudaMemcpyHostToDevice ) != cudaSuccess ) {
+                frnn::err::copyError( error, stringify( tensor ) );
+                return false;
+            }
+            return true;
+        }
+
+#ifdef FRNN_WITH_CUFILE
+        /*
+         * ==================================================================================================
+         * Function     : loadDirect
+         *
+         * Description  : Reads a tensor from the file straight into a device tensor with GPUDirect Storage
+         *                (see NOTES 4), which is reshaped to the dimensions of the tensor in the checkpoint.
+         *                The cuFile driver must have been opened (cuFileDriverOpen).
+         *
+         * Inputs       : error     : fastRNN error type for the result
+         *              : name      : The name of the tensor
+         *
+         * Outputs      : tensor    : The tensor to read the data into
+         *
+         * Params       : dType     : The type of the elements of the tensor
+         * ==================================================================================================
+         */
+        template <typename dType>
+        bool loadDirect( frnnError& error, const char* name, Tensor4<dType, storage::Device>& tensor ) const {
+            const checkpoint_entry* tensor_entry = checkedEntry<dType>( error, name );
+            if ( tensor_entry == 0 ) return false;
+
+            tensor.reshape( tensor_entry->dims[ 0 ], tensor_entry->dims[ 1 ], tensor_entry->dims[ 2 ], tensor_entry->dims[ 3 ] );
+            if ( tensor_entry->bytes == 0 ) return true;
+            dType* tensor_d = tensor.overwriteDeviceData();
+
+            // GPUDirect Storage needs the file to be opened for direct IO
+            int direct_fd = ::open( &path_[ 0 ], O_RDONLY | O_DIRECT );
+            CUfileDescr_t   descr;
+            CUfileHandle_t  handle;
+            std::memset( &descr, 0, sizeof( descr ) );
+            descr.handle.fd = direct_fd;
+            descr.type      = CU_FILE_HANDLE_TYPE_OPAQUE_FD;
+
+            bool loaded = direct_fd >= 0 && tensor_d != 0 && cuFileHandleRegister( &handle, &descr ).err == CU_FILE_SUCCESS;
+            if ( loaded ) {
+                loaded = cuFileRead( handle, tensor_d, tensor_entry->bytes, tensor_entry->offset, 0 ) ==
+                         static_cast<ssize_t>( tensor_entry->bytes );
+                cuFileHandleDeregister( handle );
+            }
+            if ( direct_fd >= 0 ) ::close( direct_fd );
+
+            if ( !loaded ) frnn::err::fileError( error, &path_[ 0 ], "could not be read with GPUDirect Storage" );
+            return loaded;
+        }
+#endif
+#endif
+
+    private:
+        // Gets the entry of a tensor and checks that it has the type and the layout of a Tensor4<dType>
+        template <typename dType>
+        const checkpoint_entry* checkedEntry( frnnError& error, const char* name ) const {
+            const checkpoint_entry* tensor_entry = find( name );
+            if ( tensor_entry == 0 ) {
+                frnn::err::fileError( error, name, "is not a tensor of the checkpoint" );
+                return 0;
+            }
+            if ( tensor_entry->dtype != checkpoint_type<dType>::value || tensor_entry->layout != CHECKPOINT_COLUMN_MAJOR ||
+                 tensor_entry->bytes != tensor_entry->elements() * sizeof( dType ) ) {
+                frnn::err::fileError( error, name, "has a different type or layout in the checkpoint" );
+                return 0;
+            }
+            return tensor_entry;
+        }
+};
+
+}   // Namespace frnn
+
+#endif
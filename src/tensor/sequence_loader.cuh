@@ -0,0 +1,354 @@
+/*
+ *  Header file for the fastRNN sequence loader, which streams minibatches of
+ *  a sequence dataset from disk to device tensors, with the reading, the
+ *  packing and the uploads overlapped with the computation.
+ *
+ *  Copyright (C) 2015 Rob Clucas robclu1818@gmail.com
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published
+ *  by the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program; if not, write to the Free Software Foundation,
+ *	Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#ifndef _FRNN_SEQUENCE_LOADER_
+#define _FRNN_SEQUENCE_LOADER_
+
+#include <cuda_runtime.h>
+
+#include <condition_variable>
+#include <cstring>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "../util/errors.h"
+#include "../frnn/gpu_context.cuh"
+#include "tensor.cuh"
+#include "checkpoint.cuh"
+
+/* ============================================= NOTES ======================================================
+ *
+ * 1. A dataset is a checkpoint (see checkpoint.cuh) with a tensor of inputs (features x samples x timesteps)
+ *    and a tensor of targets (outputs x samples x timesteps), which is the layout of the batched tensors of
+ *    the recurrent layers, so a minibatch of consecutive samples is one contiguous chunk of each timestep.
+ *
+ * 2. The worker threads pack the minibatches from the mapping of the checkpoint into a ring of pinned host
+ *    slots, so the pages of the file are read (on the first touch) by the workers, in chunks of a batch, and
+ *    never by the thread which runs the layers. A slot is only refilled once its upload has finished.
+ *
+ * 3. The device has two buffers for each of the inputs and the targets. When batch t is returned by next,
+ *    the upload of batch t + 1 is queued on the stream of the loader, into the buffer which held batch t - 1
+ *    once the work which has been queued on it (on the primary stream of the context) is done, and the
+ *    primary stream waits for the upload of batch t. So the host only waits if the workers are behind, and
+ *    the device only waits if an upload takes longer than the computation of a batch.
+ *
+ * 4. The tensors which next returns are valid until the next call after it, and all the work which uses
+ *    them must be queued on the primary stream of the context before then.
+ *
+ * ==========================================================================================================
+ */
+
+namespace frnn {
+
+/*
+ * ==========================================================================================================
+ * Class        : SequenceLoader
+ *
+ * Description  : Streams the minibatches of a sequence dataset to device tensors (see NOTES 1 - 4)
+ *
+ * Params       : dType     : The type of the elements of the dataset
+ * ==========================================================================================================
+ */
+template <typename dType>
+class SequenceLoader {
+    public:
+        typedef Tensor4<dType, storage::Device>     device_tensor;
+
+    private:
+        // A pinned host buffer for one minibatch
+        struct slot {
+            dType*          ins_h;                  // Pinned inputs of the batch
+            dType*          targets_h;              // Pinned targets of the batch
+            size_t          batch;                  // Batch which goes in the slot next
+            bool            filled;                 // If the slot holds batch, ready for its upload
+            cudaEvent_t     uploaded;               // Recorded after the upload of the slot
+        };
+
+        const dType*                ins_data_;          // Inputs of the dataset (in the mapping)
+        const dType*                targets_data_;      // Targets of the dataset (in the mapping)
+        uint                        features_;          // Elements of an input of a timestep
+        uint                        outputs_;           // Elements of a target of a timestep
+        uint                        samples_;           // Samples in the dataset
+        uint                        timesteps_;         // Timesteps of each sample
+        uint                        batch_size_;        // Samples in each batch
+        size_t                      num_batches_;       // Batches in an epoch (a partial last batch is dropped)
+
+        GpuContext*                 context_;           // Context the batches are used on
+        cudaStream_t                copy_stream_;       // Stream for the uploads
+        device_tensor               device_ins_[ 2 ];   // Device inputs (see NOTES 3)
+        device_tensor               device_targets_[ 2 ];
+        cudaEvent_t                 ready_[ 2 ];        // Recorded after the upload into each device buffer
+        cudaEvent_t                 consumed_[ 2 ];     // Recorded after the work on each device buffer
+
+        std::vector<slot>           slots_;             // Ring of pinned slots (see NOTES 2)
+        std::vector<std::thread>    workers_;           // Threads which fill the slots
+        std::mutex                  mutex_;
+        std::condition_variable     changed_;           // Signalled when a slot is filled or freed
+        bool                        stop_;              // If the workers must stop
+        size_t                      next_batch_;        // Batch which next returns
+
+    public:
+        /*
+         * ==================================================================================================
+         * Function     : SequenceLoader
+         *
+         * Description  : Checks the dataset, allocates the pinned slots and the device buffers, and starts
+         *                the workers on the first epoch
+         *
+         * Inputs       : error         : fastRNN error type for the result
+         *              : dataset       : The checkpoint with the dataset, which must outlive the loader
+         *              : ins_name      : The name of the inputs in the checkpoint
+         *              : targets_name  : The name of the targets in the checkpoint
+         *              : batch_size    : The number of samples in each batch
+         *              : context       : The context whose primary stream the batches are used on
+         *              : num_workers   : The number of worker threads
+         *              : num_slots     : The number of pinned slots (at least num_workers + 1)
+         * ==================================================================================================
+         */
+        SequenceLoader( frnnError&          error       ,
+                        Checkpoint&         dataset     ,
+                        const char*         ins_name    ,
+                        const char*         targets_name,
+                        uint                batch_size  ,
+                        GpuContext&         context     = GpuContext::global(),
+                        size_t              num_workers = 1,
+                        size_t              num_slots   = 3 ) :
+            ins_data_( 0 ), targets_data_( 0 ), features_( 0 ), outputs_( 0 ), samples_( 0 ), timesteps_( 0 ),
+            batch_size_( batch_size ), num_batches_( 0 ), context_( &context ), copy_stream_( 0 ), stop_( false ),
+            next_batch_( 0 ) {
+            for ( size_t i = 0; i < 2; i++ ) {
+                cudaEventCreateWithFlags( &ready_[ i ], cudaEventDisableTiming );
+                cudaEventCreateWithFlags( &consumed_[ i ], cudaEventDisableTiming );
+            }
+            cudaStreamCreate( &copy_stream_ );
+
+            Tensor4<dType, storage::Mapped> ins     = dataset.view<dType>( error, ins_name );
+            Tensor4<dType, storage::Mapped> targets = dataset.view<dType>( error, targets_name );
+            if ( ins.size() == 0 || targets.size() == 0 ) return;
+            if ( ins.y() != targets.y() || ins.z() != targets.z() || batch_size == 0 || ins.y() < batch_size ) {
+                frnn::err::dimError( error, stringify( ins ), stringify( targets ) );
+                return;
+            }
+
+            ins_data_     = &ins.hostData()[ 0 ];
+            targets_data_ = &targets.hostData()[ 0 ];
+            features_     = ins.x();
+            outputs_      = targets.x();
+            samples_      = ins.y();
+            timesteps_    = ins.z();
+            num_batches_  = samples_ / batch_size_;
+
+            slots_.resize( std::max( num_slots, num_workers + 1 ) );
+            for ( size_t i = 0; i < slots_.size(); i++ ) {
+                slot& s = slots_[ i ];
+                s.ins_h = 0; s.targets_h = 0; s.filled = false;
+                cudaEventCreateWithFlags( &s.uploaded, cudaEventDisableTiming );
+                if ( cudaHostAlloc( reinterpret_cast<void**>( &s.ins_h ), insElements() * sizeof( dType ), cudaHostAllocDefault ) != cudaSuccess ||
+                     cudaHostAlloc( reinterpret_cast<void**>( &s.targets_h ), targetsElements() * sizeof( dType ), cudaHostAllocDefault ) != cudaSuccess ) {
+                    frnn::err::allocError( error, stringify( slots_ ) );
+                    num_batches_ = 0;
+                    return;
+                }
+            }
+            for ( size_t i = 0; i < 2; i++ ) {
+                device_ins_[ i ].reshape( features_, batch_size_, timesteps_, 1 );
+                device_targets_[ i ].reshape( outputs_, batch_size_, timesteps_, 1 );
+            }
+            startWorkers( num_workers );
+        }
+
+        /*
+         * ==================================================================================================
+         * Function     : ~SequenceLoader
+         *
+         * Description  : Stops the workers and releases the slots, the events and the stream
+         * ==================================================================================================
+         */
+        ~SequenceLoader() {
+            stopWorkers();
+            cudaStreamSynchronize( copy_stream_ );
+            for ( size_t i = 0; i < slots_.size(); i++ ) {
+                cudaFreeHost( slots_[ i ].ins_h );
+                cudaFreeHost( slots_[ i ].targets_h );
+                cudaEventDestroy( slots_[ i ].uploaded );
+            }
+            for ( size_t i = 0; i < 2; i++ ) {
+                cudaEventDestroy( ready_[ i ] );
+                cudaEventDestroy( consumed_[ i ] );
+            }
+            cudaStreamDestroy( copy_stream_ );
+        }
+
+        // The loader owns threads and pinned memory, so it can't be copied
+        SequenceLoader( const SequenceLoader& )             = delete;
+        SequenceLoader& operator=( const SequenceLoader& )  = delete;
+
+        inline size_t numBatches() const { return num_batches_; }
+        inline size_t batchIndex() const { return next_batch_; }
+        inline uint batchSize() const { return batch_size_; }
+
+        /*
+         * ==================================================================================================
+         * Function     : next
+         *
+         * Description  : Gets the next batch of the epoch, and queues the upload of the batch after it (see
+         *                NOTES 3 - 4)
+         *
+         * Outputs      : ins       : The inputs of the batch on the device (features x batch size x timesteps)
+         *              : targets   : The targets of the batch on the device (outputs x batch size x timesteps)
+         *              : If there was a batch (false at the end of an epoch)
+         * ==================================================================================================
+         */
+        bool next( device_tensor*& ins, device_tensor*& targets ) {
+            if ( next_batch_ >= num_batches_ ) return false;
+
+            const size_t batch   = next_batch_++;
+            const size_t current = batch % 2;
+            cudaStream_t stream  = context_->stream();
+
+            // The work on batch - 1 has all been queued, so its buffer is free once that is done
+            if ( batch > 0 ) cudaEventRecord( consumed_[ 1 - current ], stream );
+            if ( batch == 0 ) {
+                cudaStreamWaitEvent( copy_stream_, consumed_[ current ], 0 );
+                upload( batch );
+            }
+            if ( batch + 1 < num_batches_ ) {
+                cudaStreamWaitEvent( copy_stream_, consumed_[ 1 - current ], 0 );
+                upload( batch + 1 );
+            }
+
+            cudaStreamWaitEvent( stream, ready_[ current ], 0 );
+            ins     = &device_ins_[ current ];
+            targets = &device_targets_[ current ];
+            return true;
+        }
+
+        /*
+         * ==================================================================================================
+         * Function     : restart
+         *
+         * Description  : Starts a new epoch, from the first batch of the dataset
+         *
+         * Inputs       : num_workers   : The number of worker threads for the epoch
+         * ==================================================================================================
+         */
+        void restart( size_t num_workers = 1 ) {
+            // The last batches of the epoch may still be in use
+            cudaEventRecord( consumed_[ 0 ], context_->stream() );
+            cudaEventRecord( consumed_[ 1 ], context_->stream() );
+            stopWorkers();
+            cudaStreamSynchronize( copy_stream_ );
+            next_batch_ = 0;
+            startWorkers( num_workers );
+        }
+
+    private:
+        inline size_t insElements() const { return static_cast<size_t>( features_ ) * batch_size_ * timesteps_; }
+        inline size_t targetsElements() const { return static_cast<size_t>( outputs_ ) * batch_size_ * timesteps_; }
+
+        void startWorkers( size_t num_workers ) {
+            if ( num_batches_ == 0 ) return;
+            stop_ = false;
+            for ( size_t i = 0; i < slots_.size(); i++ ) {
+                slots_[ i ].batch  = i;
+                slots_[ i ].filled = false;
+            }
+            num_workers = std::max( std::min( num_workers, slots_.size() - 1 ), size_t( 1 ) );
+            for ( size_t w = 0; w < num_workers; w++ ) workers_.push_back( std::thread( &SequenceLoader::work, this, w, num_workers ) );
+        }
+
+        void stopWorkers() {
+            {
+                std::lock_guard<std::mutex> lock( mutex_ );
+                stop_ = true;
+            }
+            changed_.notify_all();
+            for ( size_t w = 0; w < workers_.size(); w++ ) workers_[ w ].join();
+            workers_.clear();
+        }
+
+        // Worker w fills the batches w, w + num_workers, ... of the epoch (see NOTES 2)
+        void work( size_t w, size_t num_workers ) {
+            context_->makeCurrent();
+            for ( size_t batch = w; batch < num_batches_; batch += num_workers ) {
+                slot& s = slots_[ batch % slots_.size() ];
+                {
+                    std::unique_lock<std::mutex> lock( mutex_ );
+                    changed_.wait( lock, [&]() { return stop_ || ( s.batch == batch && !s.filled ); } );
+                    if ( stop_ ) return;
+                }
+                // The last upload from the slot must be done before it's overwritten
+                cudaEventSynchronize( s.uploaded );
+                pack( batch, s );
+                {
+                    std::lock_guard<std::mutex> lock( mutex_ );
+                    s.filled = true;
+                }
+                changed_.notify_all();
+            }
+        }
+
+        // Copies the columns of a batch for each timestep from the mapping into a slot
+        void pack( size_t batch, slot& s ) const {
+            const size_t first     = batch * batch_size_;
+            const size_t in_chunk  = static_cast<size_t>( features_ ) * batch_size_;
+            const size_t out_chunk = static_cast<size_t>( outputs_ ) * batch_size_;
+            for ( size_t t = 0; t < timesteps_; t++ ) {
+                std::memcpy( s.ins_h + t * in_chunk, ins_data_ + ( t * samples_ + first ) * features_,
+                             in_chunk * sizeof( dType ) );
+                std::memcpy( s.targets_h + t * out_chunk, targets_data_ + ( t * samples_ + first ) * outputs_,
+                             out_chunk * sizeof( dType ) );
+            }
+        }
+
+        // Queues the upload of a batch (after its slot is filled) into its device buffer
+        void upload( size_t batch ) {
+            frnnError error;
+            slot&     s      = slots_[ batch % slots_.size() ];
+            const size_t buffer = batch % 2;
+            {
+                std::unique_lock<std::mutex> lock( mutex_ );
+                changed_.wait( lock, [&]() { return s.batch == batch && s.filled; } );
+            }
+
+            if ( frnn::prof::memcpyAsync( device_ins_[ buffer ].overwriteDeviceData(), s.ins_h,
+                                          insElements() * sizeof( dType ), cudaMemcpyHostToDevice, copy_stream_ ) != cudaSuccess ||
+                 frnn::prof::memcpyAsync( device_targets_[ buffer ].overwriteDeviceData(), s.targets_h,
+                                          targetsElements() * sizeof( dType ), cudaMemcpyHostToDevice, copy_stream_ ) != cudaSuccess ) {
+                frnn::err::copyError( error, stringify( device_ins_ ) );
+            }
+            cudaEventRecord( s.uploaded, copy_stream_ );
+            cudaEventRecord( ready_[ buffer ], copy_stream_ );
+
+            {
+                std::lock_guard<std::mutex> lock( mutex_ );
+                s.filled = false;
+                s.batch  = batch + slots_.size();
+            }
+            changed_.notify_all();
+        }
+};
+
+}   // Namespace frnn
+
+#endif
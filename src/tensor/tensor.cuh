@@ -25,6 +25,8 @@
 #include <iostream>
 #include <limits>
 
+#include "tensor_storage.cuh"
+
 namespace frnn  {
 
 /*
@@ -35,17 +37,20 @@ namespace frnn  {
  *				  less passes need to be made to the GPU
  *
  * Params		: dType		: The data type for the matrix
+ *				: Storage	: The storage policy, which determines where the data lives (storage::Host for host
+ *							  memory only, or storage::Device for device memory with a lazy host mirror)
  * ==========================================================================================================
  */
-template <typename dType>
-class Tensor4 {
+template <typename dType, template <typename> class Storage = storage::Host>
+class Tensor4 : public Storage<dType> {
 	private:
 		uint				w_;
 		uint				x_;
 		uint				y_; 
 		uint				z_;
-		std::vector<dType>	data;
 	public:
+		typedef typename Storage<dType>::data_type	data_type;		// Aligned host data of the tensor
+
 		/*
 		 * ==================================================================================================
 		 * Function			: Tensor4 
@@ -70,7 +75,38 @@ class Tensor4 {
 		 * ==================================================================================================
 		 */
 		Tensor4(uint _x, uint _y, uint _z, uint _w) :
-			x_(_x), y_(_y), z_(_z), w_(_w), data(_x * _y * _z * _w, 0) {}
+			Storage<dType>(_x * _y * _z * _w), x_(_x), y_(_y), z_(_z), w_(_w) {}
+
+		/*
+		 * ==================================================================================================
+		 * Function			: Tensor4 (storage constructor)
+		 *
+		 * Description		: Creates a tensor with the given dimensions over existing storage, for storage
+		 *					  policies which are views (see storage::Mapped)
+		 *
+		 * Inputs			: data	: The storage of the tensor, which must have _x * _y * _z * _w elements
+		 *					: _x	: Number of elements in the 1st dimension
+		 *					: _y	: Number of elements in the 2nd dimension
+		 *					: _z	: Number of elements in the 3rd dimension
+		 *					: _w	: Number of elements in the 4th dimension
+		 * ==================================================================================================
+		 */
+		Tensor4(const Storage<dType>& data, uint _x, uint _y, uint _z, uint _w) :
+			Storage<dType>(data), x_(_x), y_(_y), z_(_z), w_(_w) {}
+
+		/*
+		 * ==================================================================================================
+		 * Function			: Tensor4 (converting constructor)
+		 *
+		 * Description		: Creates a tensor with the same dimensions and data as a tensor which uses a 
+		 *					  different storage policy (for example to get a host copy of a device tensor)
+		 *
+		 * Inputs			: other	: The tensor to copy
+		 * ==================================================================================================
+		 */
+		template <template <typename> class OtherStorage>
+		Tensor4(const Tensor4<dType, OtherStorage>& other) :
+			Storage<dType>(other.hostData()), x_(other.x()), y_(other.y()), z_(other.z()), w_(other.w()) {}
 
         /*
          * ==================================================================================================
@@ -81,7 +117,7 @@ class Tensor4 {
          * Outputs          : The data vector for the Tensor (to support moving)
          * ==================================================================================================
          */
-        inline std::vector<dType>& getData() { return data; }
+        inline data_type& getData() { return this->hostData(); }
         
         /*
          * ==================================================================================================
@@ -92,8 +128,8 @@ class Tensor4 {
          * Inputs           : otherTensor   : The tensor from which the data must be moved from
          * ==================================================================================================
          */
-        inline void moveData(Tensor4<dType>& otherTensor) {
-            otherTensor.getData() = std::move(data);
+        inline void moveData(Tensor4<dType, Storage>& otherTensor) {
+            otherTensor.getData() = std::move(this->hostData());
         }
          
 		/* ==================================================================================================
@@ -103,7 +139,7 @@ class Tensor4 {
 		 * ==================================================================================================
 		 */
 		__inline__ __device__ __host__ size_t size() const {
-			return data.size();
+			return this->numElements();
 		}
 
 		__inline__ __device__ __host__ uint x() const { return x_; }
@@ -128,7 +164,47 @@ class Tensor4 {
 			y_ = (y_new != -1) ? static_cast<uint>(y_new) : y_;		
 			z_ = (z_new != -1) ? static_cast<uint>(z_new) : z_;		
 			w_ = (w_new != -1) ? static_cast<uint>(w_new) : w_;		
-			data.resize(w_ * x_ * y_ * z_, 0);
+			this->resize(w_ * x_ * y_ * z_);
+		}
+
+		/*
+		 * ==================================================================================================
+		 * Function		: reshapeForOverwrite 
+		 *
+		 * Description	: Reshapes the tensor as for reshape when its contents are going to be overwritten, so
+		 *				  the storage doesn't need to keep the data (and a device tensor which still fits in
+		 *				  its device buffer doesn't copy it to the host)
+		 *
+		 * Inputs		: x_new		: New number of elements for 1st dimension
+		 *				: y_new		: New number of elements for 2nd dimension
+		 *				: z_new		: New number of elements for 3rd dimension
+		 *				: w_new		: New number of elements for 4th dimension
+		 * ==================================================================================================
+		 */
+		inline void reshapeForOverwrite(int x_new, int y_new, int z_new, int w_new) {
+			x_ = (x_new != -1) ? static_cast<uint>(x_new) : x_;		
+			y_ = (y_new != -1) ? static_cast<uint>(y_new) : y_;		
+			z_ = (z_new != -1) ? static_cast<uint>(z_new) : z_;		
+			w_ = (w_new != -1) ? static_cast<uint>(w_new) : w_;		
+			this->resizeForOverwrite(w_ * x_ * y_ * z_);
+		}
+
+		/*
+		 * ==================================================================================================
+		 * Function		: index 
+		 *
+		 * Description	: Gets the offset of an element in the tensor's data (which is the same for the host
+		 *				  and the device data), without any range checking
+		 *
+		 * Inputs		: x_elem	: Element position in 1st (x) dimension
+		 *				: y_elem	: Element position in 2nd (y) dimension
+		 *				: z_elem	: Element position in 3rd (z) dimension
+		 *				: w_elem	: Element position in 4th (w) dimension
+		 * ==================================================================================================
+		 */
+		__inline__ __device__ __host__ size_t index(uint x_elem, uint y_elem, uint z_elem, uint w_elem) const {
+			return static_cast<size_t>(x_) * y_ * z_ * w_elem + static_cast<size_t>(x_) * y_ * z_elem +
+				   static_cast<size_t>(x_) * y_elem + x_elem;
 		}
 
 		/*
@@ -144,6 +220,7 @@ class Tensor4 {
 		 * ==================================================================================================
 		 */
 		dType& operator() (uint x_elem, uint y_elem, uint z_elem, uint w_elem) {
+			data_type& data = this->hostData();
 			int error = 0;
 			if (x_elem < 0 || x_elem >= x_) error = -1;
 			if (y_elem < 0 || y_elem >= y_) error = -2;
@@ -188,6 +265,7 @@ class Tensor4 {
 		 * ==================================================================================================
 		 */
 		dType const& operator()(uint x_elem, uint y_elem, uint z_elem, uint w_elem) const {
+			const data_type& data = this->hostData();
 			int error = 0;
 			if (x_elem < 0 || x_elem >= x_) error = -1;
 			if (y_elem < 0 || y_elem >= y_) error = -2;
@@ -0,0 +1,440 @@
+/*
+ *  Header file for fastRNN tensor storage policies. A storage policy decides
+ *  where the data of a tensor lives (host memory only, or device memory with
+ *  a lazily updated host mirror).
+ *
+ *  Copyright (C) 2015 Rob Clucas robclu1818@gmail.com
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published
+ *  by the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program; if not, write to the Free Software Foundation,
+ *	Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#ifndef _FRNN_TENSOR_STORAGE_
+#define _FRNN_TENSOR_STORAGE_
+
+#include <vector>
+
+#include "../util/errors.h"
+#include "../frnn/cuda_host.h"
+#include "../frnn/frnn.h"
+#ifdef FRNN_WITH_CUDA
+#include "../frnn/device_allocator.cuh"
+#endif
+#include "../frnn/profiler.cuh"
+#include "../frnn/aligned_allocator.h"
+
+/* ============================================= NOTES ======================================================
+ *
+ * 1. The Device policy keeps track of which copy (host or device) was modified last, and only copies when
+ *    the other side is asked for. Asking for a non-const reference to the host data, or a non-const pointer
+ *    to the device data, marks that side as modified, so the const accessors should be used where possible.
+ *
+ * 2. The host <-> device copies use cudaMemcpy on the default stream, which synchronizes with the (blocking)
+ *    streams of a GpuContext, so any work queued on the context streams finishes before a copy is made.
+ *
+ * 3. Device buffers come from the process wide DeviceAllocator (for the default stream), so creating and
+ *    destroying device tensors of the same sizes doesn't call cudaMalloc and cudaFree after warm up.
+ *
+ * 4. The host data of both policies is an aligned_vector, so it starts on a FRNN_ALIGNMENT (64) byte 
+ *    boundary, and the vectorized CPU kernels can use aligned loads and stores for all of it.
+ *
+ * 5. The Mapped policy doesn't own its data, it is a view (a mapped_span) of memory owned by something else,
+ *    usually the mapping of a checkpoint file (see checkpoint.cuh), so a tensor can be made over the file
+ *    without a copy. The owner must outlive the tensor, and the number of elements can't be changed.
+ *
+ * 6. The Device policy is only in GPU builds (with FRNN_WITH_CUDA, see cuda_host.h), the Host and Mapped
+ *    policies are in both.
+ *
+ * ==========================================================================================================
+ */
+
+namespace frnn    {
+namespace storage {
+
+/*
+ * ==========================================================================================================
+ * Class		: mapped_span
+ *
+ * Description	: A view of N contiguous elements which are owned by something else (see NOTES 5)
+ *
+ * Params		: dType		: The type of the elements
+ * ==========================================================================================================
+ */
+template <typename dType>
+class mapped_span {
+	private:
+		dType*		data_;
+		size_t		size_;
+	public:
+		typedef dType			value_type;
+		typedef dType*			iterator;
+		typedef const dType*	const_iterator;
+
+		mapped_span() : data_(0), size_(0) {}
+		mapped_span(dType* data, size_t N) : data_(data), size_(N) {}
+
+		inline dType* data() { return data_; }
+		inline const dType* data() const { return data_; }
+		inline size_t size() const { return size_; }
+		inline bool empty() const { return size_ == 0; }
+
+		inline dType& operator[](size_t i) { return data_[i]; }
+		inline const dType& operator[](size_t i) const { return data_[i]; }
+
+		inline iterator begin() { return data_; }
+		inline iterator end() { return data_ + size_; }
+		inline const_iterator begin() const { return data_; }
+		inline const_iterator end() const { return data_ + size_; }
+};
+
+/*
+ * ==========================================================================================================
+ * Class		: Host
+ *
+ * Description	: Storage policy which keeps the data of a tensor in host memory only
+ *
+ * Params		: dType		: The type of data to store
+ * ==========================================================================================================
+ */
+template <typename dType>
+class Host {
+	public:
+		typedef frnn::aligned_vector<dType>	data_type;
+	private:
+		data_type	host_;
+	public:
+		static constexpr bool on_device = false;
+
+		explicit Host() {}
+		explicit Host(size_t N) : host_(N, 0) {}
+		explicit Host(const data_type& data) : host_(data) {}
+		explicit Host(const std::vector<dType>& data) : host_(data.begin(), data.end()) {}
+		explicit Host(const mapped_span<dType>& data) : host_(data.begin(), data.end()) {}
+
+		/*
+		 * ==================================================================================================
+		 * Function		: hostData
+		 *
+		 * Description	: Gets the host data of the tensor
+		 * ==================================================================================================
+		 */
+		inline data_type& hostData() { return host_; }
+		inline const data_type& hostData() const { return host_; }
+
+		/*
+		 * ==================================================================================================
+		 * Function		: numElements
+		 *
+		 * Description	: Gets the number of elements which are stored
+		 * ==================================================================================================
+		 */
+		inline size_t numElements() const { return host_.size(); }
+
+		/*
+		 * ==================================================================================================
+		 * Function		: resize
+		 *
+		 * Description	: Changes the number of elements which are stored, new elements are set to 0
+		 *
+		 * Inputs		: N		: The new number of elements
+		 * ==================================================================================================
+		 */
+		inline void resize(size_t N) { host_.resize(N, 0); }
+
+		// The host data is the only copy, so there is nothing to skip when the contents are overwritten
+		inline void resizeForOverwrite(size_t N) { host_.resize(N, 0); }
+
+		// Host data is always current, so syncing does nothing
+		inline void sync() const {}
+
+		// There is no device data
+		inline bool deviceCurrent() const { return false; }
+};
+
+#ifdef FRNN_WITH_CUDA
+/*
+ * ==========================================================================================================
+ * Class		: Device
+ *
+ * Description	: Storage policy which keeps the data of a tensor in device memory, with a host mirror which
+ *				  is only updated when the host data is read after the device data has been modified. This
+ *				  allows a chain of GPU operations on a tensor without any host <-> device copies.
+ *
+ * Params		: dType		: The type of data to store
+ * ==========================================================================================================
+ */
+template <typename dType>
+class Device {
+	private:
+		// Which of the copies holds the most recent data
+		enum location { SYNCED, HOST_NEWER, DEVICE_NEWER };
+	public:
+		typedef frnn::aligned_vector<dType>	data_type;
+	private:
+		mutable data_type			host_;				// Host mirror of the data
+		mutable dType*				device_;			// Device copy of the data
+		mutable size_t				device_elements_;	// Number of elements the device buffer can hold
+		mutable location			state_;				// Which copy holds the most recent data
+	public:
+		static constexpr bool on_device = true;
+
+		explicit Device() :
+			device_(0), device_elements_(0), state_(SYNCED) {}
+
+		explicit Device(size_t N) :
+			host_(N, 0), device_(0), device_elements_(0), state_(HOST_NEWER) {}
+
+		explicit Device(const data_type& data) :
+			host_(data), device_(0), device_elements_(0), state_(HOST_NEWER) {}
+
+		explicit Device(const std::vector<dType>& data) :
+			host_(data.begin(), data.end()), device_(0), device_elements_(0), state_(HOST_NEWER) {}
+
+		explicit Device(const mapped_span<dType>& data) :
+			host_(data.begin(), data.end()), device_(0), device_elements_(0), state_(HOST_NEWER) {}
+
+		Device(const Device& other) :
+			host_(other.hostData()), device_(0), device_elements_(0), state_(HOST_NEWER) {}
+
+		Device& operator=(const Device& other) {
+			if (this != &other) {
+				host_  = other.hostData();
+				state_ = HOST_NEWER;
+			}
+			return *this;
+		}
+
+		~Device() { DeviceAllocator::global().deallocate(device_); }
+
+		/*
+		 * ==================================================================================================
+		 * Function		: hostData
+		 *
+		 * Description	: Gets the host data, first copying it from the device if the device data is newer.
+		 *				  The non-const version marks the host data as modified.
+		 * ==================================================================================================
+		 */
+		inline data_type& hostData() {
+			syncHost();
+			state_ = HOST_NEWER;
+			return host_;
+		}
+
+		inline const data_type& hostData() const {
+			syncHost();
+			return host_;
+		}
+
+		/*
+		 * ==================================================================================================
+		 * Function		: deviceData
+		 *
+		 * Description	: Gets a pointer to the device data, first copying it from the host if the host data
+		 *				  is newer. The non-const version marks the device data as modified.
+		 * ==================================================================================================
+		 */
+		inline dType* deviceData() {
+			syncDevice();
+			state_ = DEVICE_NEWER;
+			return device_;
+		}
+
+		inline const dType* deviceData() const {
+			syncDevice();
+			return device_;
+		}
+
+		/*
+		 * ==================================================================================================
+		 * Function		: overwriteDeviceData
+		 *
+		 * Description	: Gets a pointer to the device data for a caller which overwrites all of it, so the
+		 *				  host data isn't copied to the device first. The device data is marked as modified.
+		 * ==================================================================================================
+		 */
+		inline dType* overwriteDeviceData() {
+			reserveDevice();
+			state_ = DEVICE_NEWER;
+			return device_;
+		}
+
+		inline size_t numElements() const { return host_.size(); }
+
+		/*
+		 * ==================================================================================================
+		 * Function		: deviceCurrent
+		 *
+		 * Description	: If the device data is current (so using it doesn't need a copy from the host)
+		 * ==================================================================================================
+		 */
+		inline bool deviceCurrent() const { return device_ != 0 && state_ != HOST_NEWER; }
+
+		/*
+		 * ==================================================================================================
+		 * Function		: resize
+		 *
+		 * Description	: Changes the number of elements which are stored, new elements are set to 0. The
+		 *				  device buffer is only reallocated (lazily) if it is too small, and nothing is changed
+		 *				  if the number of elements is the same.
+		 *
+		 * Inputs		: N		: The new number of elements
+		 * ==================================================================================================
+		 */
+		inline void resize(size_t N) {
+			if (N == host_.size()) return;
+			syncHost();
+			host_.resize(N, 0);
+			state_ = HOST_NEWER;
+		}
+
+		/*
+		 * ==================================================================================================
+		 * Function		: resizeForOverwrite
+		 *
+		 * Description	: Changes the number of elements which are stored when the contents are going to be
+		 *				  overwritten, so the device data isn't copied to the host. If the device buffer can
+		 *				  hold all the elements it stays the current copy, so nothing is copied or
+		 *				  reallocated, otherwise it is reallocated (lazily) as for a resize.
+		 *
+		 * Inputs		: N		: The new number of elements
+		 * ==================================================================================================
+		 */
+		inline void resizeForOverwrite(size_t N) {
+			if (N == host_.size()) return;
+			host_.resize(N, 0);
+			state_ = (device_ != 0 && device_elements_ >= N) ? DEVICE_NEWER : HOST_NEWER;
+		}
+
+		/*
+		 * ==================================================================================================
+		 * Function		: sync
+		 *
+		 * Description	: Explicit sync point which makes the host and device copies the same
+		 * ==================================================================================================
+		 */
+		inline void sync() const {
+			syncHost();
+			syncDevice();
+		}
+
+		/*
+		 * ==================================================================================================
+		 * Function		: syncHost
+		 *
+		 * Description	: Copies the device data to the host if the device data is newer
+		 * ==================================================================================================
+		 */
+		inline void syncHost() const {
+			if (state_ != DEVICE_NEWER) return;
+
+			frnnError error;
+			if (host_.size() > 0 &&
+				frnn::prof::memcpy(&host_[0], device_, host_.size() * sizeof(dType), cudaMemcpyDeviceToHost) != cudaSuccess) {
+				frnn::err::copyError(error, stringify(host_));
+				return;
+			}
+			state_ = SYNCED;
+		}
+
+		/*
+		 * ==================================================================================================
+		 * Function		: syncDevice
+		 *
+		 * Description	: Copies the host data to the device if the host data is newer, allocating the device
+		 *				  buffer if it can't hold all the elements
+		 * ==================================================================================================
+		 */
+		inline void syncDevice() const {
+			frnnError error;
+			if (reserveDevice()) state_ = HOST_NEWER;			// New buffer has no valid data
+			if (device_ == 0 || state_ != HOST_NEWER) return;
+
+			if (host_.size() > 0 &&
+				frnn::prof::memcpy(device_, &host_[0], host_.size() * sizeof(dType), cudaMemcpyHostToDevice) != cudaSuccess) {
+				frnn::err::copyError(error, stringify(device_));
+				return;
+			}
+			state_ = SYNCED;
+		}
+
+		/*
+		 * ==================================================================================================
+		 * Function		: reserveDevice
+		 *
+		 * Description	: Allocates the device buffer if it can't hold all the elements, without copying
+		 *
+		 * Outputs		: If a new buffer was allocated
+		 * ==================================================================================================
+		 */
+		inline bool reserveDevice() const {
+			frnnError error;
+			if (device_elements_ >= host_.size()) return false;
+
+			DeviceAllocator::global().deallocate(device_);
+			device_elements_ = 0;
+			device_          = static_cast<dType*>(DeviceAllocator::global().allocate(error, host_.size() * sizeof(dType)));
+			if (device_ == 0) return false;
+			device_elements_ = DeviceAllocator::sizeClass(host_.size() * sizeof(dType)) / sizeof(dType);
+			return true;
+		}
+};
+
+#endif
+
+/*
+ * ==========================================================================================================
+ * Class		: Mapped
+ *
+ * Description	: Storage policy for a tensor which is a view of host memory owned by something else, such as
+ *				  the mapping of a checkpoint (see NOTES 5)
+ *
+ * Params		: dType		: The type of data to store
+ * ==========================================================================================================
+ */
+template <typename dType>
+class Mapped {
+	public:
+		typedef mapped_span<dType>	data_type;
+	private:
+		data_type	host_;
+	public:
+		static constexpr bool on_device = false;
+
+		explicit Mapped() {}
+		explicit Mapped(const data_type& data) : host_(data) {}
+
+		inline data_type& hostData() { return host_; }
+		inline const data_type& hostData() const { return host_; }
+
+		inline size_t numElements() const { return host_.size(); }
+
+		// The view can't change size, so only a resize to the same number of elements is allowed
+		inline void resize(size_t N) {
+			frnnError error;
+			if (N != host_.size()) frnn::err::dimError(error, stringify(N), stringify(host_));
+		}
+
+		inline void resizeForOverwrite(size_t N) { resize(N); }
+
+		// The data is always current, so syncing does nothing
+		inline void sync() const {}
+
+		// There is no device data
+		inline bool deviceCurrent() const { return false; }
+};
+
+}	// Namespace storage
+}	// Namespace frnn
+
+#endif
@@ -19,9 +19,12 @@
  */
 
 #include <gtest/gtest.h>
+#include <cstddef>
 #include <iostream>
 
 #include "tensor.cuh"
+#include "checkpoint.cuh"
+#include "sequence_loader.cuh"
 
 const size_t W = 3;
 const size_t X = 4;
@@ -163,3 +166,213 @@ TEST(frnnTensor, CanMoveTensorDataCorrectly) {
     }
 }
 
+TEST(frnnTensor, DeviceTensorCopiesHostDataToDevice) {
+    frnn::Tensor4<float, frnn::storage::Device> t(X, Y, 1, 1);
+    std::vector<float> results(t.size(), 0.f);
+
+    for (size_t i = 0; i < X; i++) t(i, 0, 0, 0) = float(i);
+
+    const frnn::Tensor4<float, frnn::storage::Device>& t_const = t;
+    cudaMemcpy(&results[0], t_const.deviceData(), t.size() * sizeof(float), cudaMemcpyDeviceToHost);
+
+    for (size_t i = 0; i < X; i++) {
+        EXPECT_EQ( results[i], float(i) );
+    }
+}
+
+TEST(frnnTensor, DeviceTensorCopiesDeviceDataToHostWhenRead) {
+    frnn::Tensor4<float, frnn::storage::Device> t(X, Y, 1, 1);
+    std::vector<float> values(t.size(), 3.f);
+
+    // Modify the device data directly, as a kernel would
+    cudaMemcpy(t.deviceData(), &values[0], t.size() * sizeof(float), cudaMemcpyHostToDevice);
+
+    const frnn::Tensor4<float, frnn::storage::Device>& t_const = t;
+    for (size_t j = 0; j < Y; j++) {
+        for (size_t i = 0; i < X; i++) {
+            EXPECT_EQ( t_const(i, j, 0, 0), 3.f );
+        }
+    }
+}
+
+TEST(frnnTensor, CanConvertDeviceTensorToHostTensor) {
+    frnn::Tensor4<float, frnn::storage::Device> t_device(2, 2, 1, 1);
+    t_device(1, 1, 0, 0) = 4.f;
+
+    frnn::Tensor4<float> t_host(t_device);
+
+    EXPECT_EQ( t_host.size(), t_device.size() );
+    EXPECT_EQ( t_host(1, 1, 0, 0), 4.f );
+}
+
+
+TEST(frnnTensor, CheckpointRoundTripsTensorsOfEachType) {
+    frnn::frnnError                 error = frnn::frnnError(0);
+    frnn::Tensor4<float>            weights(3, 5, 2, 1);
+    frnn::Tensor4<double>           biases(7, 1, 1, 1);
+    frnn::CheckpointWriter          writer;
+
+    for (size_t i = 0; i < weights.size(); i++) weights.getData()[i] = float(i) / 4.f;
+    for (size_t i = 0; i < biases.size(); i++) biases.getData()[i] = -double(i);
+
+    EXPECT_TRUE( writer.add(error, "weights", weights) );
+    EXPECT_TRUE( writer.add(error, "biases", biases) );
+    ASSERT_TRUE( writer.write(error, "frnn_tensor_test.ckpt") );
+
+    frnn::Checkpoint        checkpoint(error, "frnn_tensor_test.ckpt");
+    frnn::Tensor4<float>    loaded_weights;
+    frnn::Tensor4<double>   loaded_biases;
+    ASSERT_TRUE( checkpoint.isOpen() );
+    EXPECT_EQ( checkpoint.numTensors(), 2u );
+    EXPECT_TRUE( checkpoint.load(error, "weights", loaded_weights) );
+    EXPECT_TRUE( checkpoint.load(error, "biases", loaded_biases) );
+
+    EXPECT_EQ( loaded_weights.z(), 2u );
+    EXPECT_EQ( loaded_weights.hostData(), weights.hostData() );
+    EXPECT_EQ( loaded_biases.hostData(), biases.hostData() );
+    EXPECT_EQ( error, frnn::frnnError(0) );
+    std::remove("frnn_tensor_test.ckpt");
+}
+
+TEST(frnnTensor, CheckpointViewsAreAlignedAndDontCopy) {
+    frnn::frnnError         error = frnn::frnnError(0);
+    frnn::Tensor4<float>    first(5, 1, 1, 1), second(4, 3, 1, 1);
+    frnn::CheckpointWriter  writer;
+
+    for (size_t i = 0; i < second.size(); i++) second.getData()[i] = float(i);
+    writer.add(error, "first", first);
+    writer.add(error, "second", second);
+    writer.write(error, "frnn_view_test.ckpt");
+
+    frnn::Checkpoint checkpoint(error, "frnn_view_test.ckpt");
+    frnn::Tensor4<float, frnn::storage::Mapped> view = checkpoint.view<float>(error, "second");
+
+    // The view is the data in the mapping, and it starts on an aligned boundary even though the first
+    // tensor isn't a multiple of the alignment
+    const float* view_data = &view.hostData()[0];
+    EXPECT_EQ( reinterpret_cast<const char*>(view_data), checkpoint.data() + checkpoint.find("second")->offset );
+    EXPECT_EQ( reinterpret_cast<size_t>(view_data) % frnn::CHECKPOINT_ALIGNMENT, 0u );
+    EXPECT_EQ( view.x(), 4u );
+    EXPECT_EQ( view.y(), 3u );
+    EXPECT_EQ( view(3, 2, 0, 0), second(3, 2, 0, 0) );
+
+    // A host copy of the view can outlive it
+    frnn::Tensor4<float> copy(view);
+    EXPECT_EQ( copy.hostData(), second.hostData() );
+    std::remove("frnn_view_test.ckpt");
+}
+
+TEST(frnnTensor, CheckpointLoadsStraightIntoDeviceTensor) {
+    frnn::frnnError                             error = frnn::frnnError(0);
+    frnn::Tensor4<float>                        values(X, Y, 1, 1);
+    frnn::Tensor4<float, frnn::storage::Device> t_device;
+    frnn::CheckpointWriter                      writer;
+
+    for (size_t i = 0; i < values.size(); i++) values.getData()[i] = float(i % 13);
+    writer.add(error, "values", values);
+    writer.write(error, "frnn_device_test.ckpt");
+
+    frnn::Checkpoint checkpoint(error, "frnn_device_test.ckpt");
+    checkpoint.pin(error);
+    EXPECT_TRUE( checkpoint.load(error, "values", t_device) );
+
+    // The device data is newer, so reading the host copies it back from the device
+    const frnn::Tensor4<float, frnn::storage::Device>& t_const = t_device;
+    EXPECT_EQ( t_const.x(), X );
+    for (size_t i = 0; i < values.size(); i++) EXPECT_EQ( t_const.hostData()[i], values.getData()[i] );
+    std::remove("frnn_device_test.ckpt");
+}
+
+TEST(frnnTensor, CheckpointRejectsBadFilesAndTypes) {
+    frnn::frnnError         error = frnn::frnnError(0);
+    frnn::Tensor4<float>    values(4, 1, 1, 1), loaded;
+    frnn::CheckpointWriter  writer;
+
+    EXPECT_FALSE( writer.add(error, "a_name_which_is_too_long_for_a_checkpoint", values) );
+    EXPECT_EQ( error, frnn::frnnError::FRNN_FILE_ERROR );
+    writer.add(error, "values", values);
+    writer.write(error, "frnn_bad_test.ckpt");
+
+    // Wrong type and a missing tensor
+    error = frnn::frnnError(0);
+    frnn::Checkpoint checkpoint(error, "frnn_bad_test.ckpt");
+    frnn::Tensor4<double> wrong_type;
+    EXPECT_FALSE( checkpoint.load(error, "values", wrong_type) );
+    EXPECT_FALSE( checkpoint.load(error, "missing", loaded) );
+    EXPECT_EQ( error, frnn::frnnError::FRNN_FILE_ERROR );
+
+    // An entry whose offset plus its size wraps around to inside the file
+    const uint64_t wrapping_bytes = ~uint64_t(0) - frnn::CHECKPOINT_ALIGNMENT + 1;
+    FILE* file = std::fopen("frnn_bad_test.ckpt", "r+b");
+    std::fseek(file, sizeof(frnn::checkpoint_header) + offsetof(frnn::checkpoint_entry, bytes), SEEK_SET);
+    std::fwrite(&wrapping_bytes, sizeof(wrapping_bytes), 1, file);
+    std::fclose(file);
+    frnn::Checkpoint wrapping(error, "frnn_bad_test.ckpt");
+    EXPECT_FALSE( wrapping.isOpen() );
+
+    // Not a checkpoint
+    file = std::fopen("frnn_bad_test.ckpt", "wb");
+    std::fwrite("not a checkpoint, just some text which is longer than the header of one", 1, 72, file);
+    std::fclose(file);
+    frnn::Checkpoint not_checkpoint(error, "frnn_bad_test.ckpt");
+    EXPECT_FALSE( not_checkpoint.isOpen() );
+    std::remove("frnn_bad_test.ckpt");
+}
+
+// Writes a sequence dataset of (features x samples x timesteps) inputs, where each input is the sample, the
+// timestep and the feature, and targets of twice the inputs
+void writeSequenceDataset(const char* path, uint features, uint samples, uint timesteps) {
+    frnn::frnnError         error;
+    frnn::Tensor4<float>    ins(features, samples, timesteps, 1), targets(features, samples, timesteps, 1);
+    frnn::CheckpointWriter  writer;
+
+    for (uint t = 0; t < timesteps; t++) {
+        for (uint s = 0; s < samples; s++) {
+            for (uint f = 0; f < features; f++) {
+                ins(f, s, t, 0)     = float(100 * s + 10 * t + f);
+                targets(f, s, t, 0) = 2.f * ins(f, s, t, 0);
+            }
+        }
+    }
+    writer.add(error, "inputs", ins);
+    writer.add(error, "targets", targets);
+    writer.write(error, path);
+}
+
+TEST(frnnTensor, SequenceLoaderStreamsEachBatchOfEachEpoch) {
+    frnn::frnnError     error = frnn::frnnError(0);
+    const uint          features = 3, samples = 10, timesteps = 4, batch_size = 3;
+    writeSequenceDataset("frnn_loader_test.ckpt", features, samples, timesteps);
+
+    frnn::Checkpoint                dataset(error, "frnn_loader_test.ckpt");
+    frnn::SequenceLoader<float>     loader(error, dataset, "inputs", "targets", batch_size, frnn::GpuContext::global(), 2);
+    frnn::Tensor4<float, frnn::storage::Device>* ins;
+    frnn::Tensor4<float, frnn::storage::Device>* targets;
+
+    // The partial last batch is dropped
+    ASSERT_EQ( loader.numBatches(), 3u );
+    for (uint epoch = 0; epoch < 2; epoch++) {
+        size_t batches = 0;
+        while (loader.next(ins, targets)) {
+            const frnn::Tensor4<float, frnn::storage::Device>& ins_c     = *ins;
+            const frnn::Tensor4<float, frnn::storage::Device>& targets_c = *targets;
+            ASSERT_EQ( ins_c.x(), features );
+            ASSERT_EQ( ins_c.y(), batch_size );
+            ASSERT_EQ( ins_c.z(), timesteps );
+            for (uint t = 0; t < timesteps; t++) {
+                for (uint b = 0; b < batch_size; b++) {
+                    for (uint f = 0; f < features; f++) {
+                        const float expected = float(100 * (batches * batch_size + b) + 10 * t + f);
+                        EXPECT_EQ( ins_c(f, b, t, 0), expected );
+                        EXPECT_EQ( targets_c(f, b, t, 0), 2.f * expected );
+                    }
+                }
+            }
+            batches++;
+        }
+        EXPECT_EQ( batches, loader.numBatches() );
+        loader.restart(2);
+    }
+    EXPECT_EQ( error, frnn::frnnError(0) );
+    std::remove("frnn_loader_test.ckpt");
+}
@@ -28,6 +28,11 @@ void allocError( frnn::frnnError& error, const char * varname ) {
     error = frnn::frnnError::FRNN_ALLOC_ERROR;
 }               
 
+void blasError( frnn::frnnError& error, const char* varname ) {
+    std::cerr << "Error : BLAS call failed for variable " << varname << "\n";
+    error = frnn::frnnError::FRNN_BLAS_ERROR;
+}
+
 void copyError( frnn::frnnError& error, const char* varname ) {
     std::cerr << "Error : Could not copy to/from variable " << varname << "\n";
     error = frnn::frnnError::FRNN_COPY_ERROR;
@@ -38,5 +43,15 @@ void dimError( frnn::frnnError& error, const char* varname1, const char* varname
     error = frnn::frnnError::FRNN_DIMENSION_ERROR;
 }
 
+void fileError( frnn::frnnError& error, const char* filename, const char* reason ) {
+    std::cerr << "Error : File " << filename << " : " << reason << "\n";
+    error = frnn::frnnError::FRNN_FILE_ERROR;
+}
+
+void graphError( frnn::frnnError& error, const char* varname ) {
+    std::cerr << "Error : Could not instantiate or launch the CUDA graph " << varname << "\n";
+    error = frnn::frnnError::FRNN_GRAPH_ERROR;
+}
+
 }   // Namepsace err
 }   // Namespace frnn
@@ -38,7 +38,7 @@ inline const char* varname( const char* name ) { return name; }
     }                                                                                   \
 }
 
-namespace currn {
+namespace frnn {
 namespace err {
 
 /*
@@ -52,6 +52,17 @@ namespace err {
  */
 void allocError( frnn::frnnError& error, const char * varname );  
 
+/*
+ * ==============================================================================================
+ * Function     : blasError
+ *
+ * Description  : Prints an error message if a (cu)BLAS call failed
+ *
+ * Inputs       : varname   : The name of the variable which the call was for
+ * ==============================================================================================
+ */
+void blasError( frnn::frnnError& error, const char* varname );
+
 /*
  * ==============================================================================================
  * Function     : copyError
@@ -75,6 +86,31 @@ void copyError( frnn::frnnError& error, const char* varname );
  */
 void dimError( frnn::frnnError& error, const char* varname1, const char* varname2 );
 
+/*
+ * ==============================================================================================
+ * Function     : fileError
+ *
+ * Description  : Prints an error message if a file could not be opened, read or written, or 
+ *                has the wrong format
+ *
+ * Inputs       : filename  : The name of the file
+ *              : reason    : What went wrong with the file
+ * ==============================================================================================
+ */
+void fileError( frnn::frnnError& error, const char* filename, const char* reason );
+
+/*
+ * ==============================================================================================
+ * Function     : graphError
+ *
+ * Description  : Prints an error message if a captured CUDA graph could not be instantiated,
+ *                updated or launched
+ *
+ * Inputs       : varname   : The name of the graph
+ * ==============================================================================================
+ */
+void graphError( frnn::frnnError& error, const char* varname );
+
 }   // Namepsace err
 }   // Namespace frnn
 
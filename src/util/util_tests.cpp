@@ -55,3 +55,11 @@ TEST( frnnErrors, DeterminesErrorForBadCopy ) {
 
     EXPECT_EQ( error, frnn::frnnError::FRNN_COPY_ERROR );
 }
+
+TEST( frnnErrors, DeterminesErrorForBadFile ) {
+    
+    frnn::frnnError error;
+    frnn::err::fileError( error, "missing.frnn", "could not be opened" );
+
+    EXPECT_EQ( error, frnn::frnnError::FRNN_FILE_ERROR );
+}